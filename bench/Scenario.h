@@ -0,0 +1,111 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_BENCH_SCENARIO_H
+#define AFT_BENCH_SCENARIO_H
+
+#include <mtp/types.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+namespace mtp { namespace bench
+{
+	typedef std::chrono::steady_clock Clock;
+
+	inline double GetCpuTime()
+	{
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+	}
+
+	class Scenario //! collects per-operation latencies and transferred bytes
+	{
+		std::string				_name;
+		std::vector<double>		_latencies;
+		u64						_bytes;
+		double					_wallTime;
+		double					_cpuTime;
+
+		double Percentile(double p) const
+		{
+			std::vector<double> sorted(_latencies);
+			std::sort(sorted.begin(), sorted.end());
+			size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+			return sorted[index];
+		}
+
+	public:
+		Scenario(const std::string &name): _name(name), _bytes(0), _wallTime(0), _cpuTime(0)
+		{ }
+
+		///runs op and records its latency, op returns number of bytes transferred
+		void Run(const std::function<u64 ()> &op)
+		{
+			double cpu = GetCpuTime();
+			auto started = Clock::now();
+			_bytes += op();
+			double dt = std::chrono::duration<double>(Clock::now() - started).count();
+			_cpuTime += GetCpuTime() - cpu;
+			_wallTime += dt;
+			_latencies.push_back(dt);
+		}
+
+		///merges operations measured concurrently elsewhere, wall and cpu time cover all of them
+		void Add(const std::vector<double> &latencies, u64 bytes, double wallTime, double cpuTime)
+		{
+			_latencies.insert(_latencies.end(), latencies.begin(), latencies.end());
+			_bytes += bytes;
+			_wallTime += wallTime;
+			_cpuTime += cpuTime;
+		}
+
+		void Report() const
+		{
+			if (_latencies.empty())
+			{
+				print(_name, ": skipped");
+				return;
+			}
+			double mb = _bytes / 1048576.0;
+			std::string line = _name + ":";
+			char buf[256];
+			snprintf(buf, sizeof(buf), " %zu ops, %.1f ops/s, p50 %.2f ms, p99 %.2f ms",
+				_latencies.size(), _latencies.size() / _wallTime, Percentile(0.5) * 1000, Percentile(0.99) * 1000);
+			line += buf;
+			if (_bytes)
+			{
+				snprintf(buf, sizeof(buf), ", %.2f MB/s, %.3f cpu s/MB", mb / _wallTime, _cpuTime / mb);
+				line += buf;
+			}
+			print(line);
+		}
+	};
+
+}}
+
+#endif
@@ -0,0 +1,357 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/Device.h>
+#include <mtp/mock/BulkPipe.h>
+#include <mtp/ptp/Session.h>
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/log.h>
+
+#include <usb/Device.h>
+
+#include <bench/Scenario.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+	using namespace mtp;
+	using bench::Scenario;
+
+	class NullOutputStream final : public IObjectOutputStream, public CancellableStream //! output stream discarding all data
+	{
+		u64		_size;
+
+	public:
+		NullOutputStream(): _size(0) { }
+
+		u64 GetSize() const
+		{ return _size; }
+
+		virtual size_t Write(const u8 *data, size_t size)
+		{
+			CheckCancelled();
+			_size += size;
+			return size;
+		}
+	};
+	DECLARE_PTR(NullOutputStream);
+
+	class PatternInputStream final : public IObjectInputStream, public CancellableStream //! input stream generating data of given size
+	{
+		u64		_size;
+		u64		_offset;
+
+	public:
+		PatternInputStream(u64 size): _size(size), _offset(0) { }
+
+		virtual u64 GetSize() const
+		{ return _size; }
+
+		virtual size_t Read(u8 *data, size_t size)
+		{
+			CheckCancelled();
+			size_t n = std::min<u64>(size, _size - _offset);
+			for(size_t i = 0; i < n; ++i)
+				data[i] = static_cast<u8>(_offset + i);
+			_offset += n;
+			return n;
+		}
+	};
+
+	struct Object
+	{
+		ObjectId		Id;
+		ObjectFormat	Format;
+		u64				Size;
+	};
+
+	std::vector<Object> ListObjects(const SessionPtr &session, StorageId storageId, ObjectId parent)
+	{
+		std::vector<Object> objects;
+		auto handles = session->GetObjectHandles(storageId, ObjectFormat::Any, parent);
+		for(auto id : handles.ObjectHandles)
+		{
+			Object object;
+			object.Id = id;
+			object.Format = static_cast<ObjectFormat>(session->GetObjectIntegerProperty(id, ObjectProperty::ObjectFormat));
+			object.Size = session->GetObjectIntegerProperty(id, ObjectProperty::ObjectSize);
+			objects.push_back(object);
+		}
+		return objects;
+	}
+
+	ObjectId Resolve(const SessionPtr &session, StorageId storageId, const std::string &path)
+	{
+		ObjectId parent = Session::Root;
+		size_t begin = 0;
+		while(begin < path.size())
+		{
+			size_t end = path.find('/', begin);
+			if (end == path.npos)
+				end = path.size();
+			std::string name = path.substr(begin, end - begin);
+			begin = end + 1;
+			if (name.empty())
+				continue;
+
+			bool found = false;
+			auto handles = session->GetObjectHandles(storageId, ObjectFormat::Any, parent);
+			for(auto id : handles.ObjectHandles)
+			{
+				if (session->GetObjectStringProperty(id, ObjectProperty::ObjectFilename) == name)
+				{
+					parent = id;
+					found = true;
+					break;
+				}
+			}
+			if (!found)
+				throw std::runtime_error("could not find " + name + " in " + path);
+		}
+		return parent;
+	}
+
+	DevicePtr CreateMockDevice(long latency, u64 bandwidth)
+	{
+		auto responder = std::make_shared<mock::Responder>("aft-bench mock");
+		StorageId storage = responder->AddStorage("Internal storage", 64ull * 1024 * 1024 * 1024);
+		ObjectId dir = responder->AddDirectory(storage, Session::Root, "bench");
+		for(int i = 0; i < 256; ++i)
+			responder->AddFile(storage, dir, "file" + std::to_string(i) + ".txt", 4096);
+		responder->AddFile(storage, dir, "large.bin", 64 * 1024 * 1024);
+
+		auto pipe = std::make_shared<mock::BulkPipe>(responder);
+		pipe->SetLatency(std::chrono::microseconds(latency));
+		pipe->SetBandwidth(bandwidth);
+		return std::make_shared<Device>(pipe);
+	}
+
+	void ShowHelp()
+	{
+		error(
+			"usage: aft-bench [options]\n"
+			"-h\t--help\t\tshow this help\n"
+			"-v\t--verbose\tshow debug output\n"
+			"-C\t--no-claim\tno usb interface claim\n"
+			"-d\t--directory\tdevice directory used for benchmarks, storage root by default\n"
+			"-n\t--iterations\tnumber of iterations for every scenario, 3 by default\n"
+			"-w\t--write\t\tenable SendObject scenario (creates and deletes a file in directory)\n"
+			"-s\t--size\t\tsize of uploaded file in megabytes, 32 by default\n"
+			"-T\t--transfer-size\tusb transfer size in bytes, automatic by default\n"
+			"-M\t--mock\t\tuse in-process emulated device instead of usb one, benchmarks protocol overhead\n"
+			"-L\t--latency\tper-transfer latency of emulated device in microseconds, 0 by default\n"
+			"-B\t--bandwidth\tbandwidth of emulated device in megabytes per second, unlimited by default"
+		);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	using namespace mtp;
+	bool claimInterface = true;
+	bool write = false;
+	std::string directory;
+	int iterations = 3;
+	u64 uploadSize = 32;
+	size_t transferSize = 0;
+	bool mock = false;
+	long latency = 0;
+	u64 bandwidth = 0;
+
+	static struct option long_options[] =
+	{
+		{"verbose",			no_argument,		0,	'v' },
+		{"help",			no_argument,		0,	'h' },
+		{"no-claim",		no_argument,		0,	'C' },
+		{"directory",		required_argument,	0,	'd' },
+		{"iterations",		required_argument,	0,	'n' },
+		{"write",			no_argument,		0,	'w' },
+		{"size",			required_argument,	0,	's' },
+		{"transfer-size",	required_argument,	0,	'T' },
+		{"mock",			no_argument,		0,	'M' },
+		{"latency",			required_argument,	0,	'L' },
+		{"bandwidth",		required_argument,	0,	'B' },
+		{0,					0,					0,	 0	}
+	};
+
+	while(true)
+	{
+		int optionIndex = 0;
+		int c = getopt_long(argc, argv, "vhCd:n:ws:T:ML:B:", long_options, &optionIndex);
+		if (c == -1)
+			break;
+		switch(c)
+		{
+		case 'v':
+			g_debug = true;
+			break;
+		case 'C':
+			claimInterface = false;
+			break;
+		case 'd':
+			directory = optarg;
+			break;
+		case 'n':
+			iterations = std::max(1, atoi(optarg));
+			break;
+		case 'w':
+			write = true;
+			break;
+		case 's':
+			uploadSize = strtoull(optarg, NULL, 10);
+			break;
+		case 'T':
+			transferSize = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			mock = true;
+			break;
+		case 'L':
+			latency = std::max(0l, atol(optarg));
+			break;
+		case 'B':
+			bandwidth = strtoull(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		case 'h':
+		default:
+			ShowHelp();
+			return 0;
+		}
+	}
+
+	try
+	{
+		DevicePtr device;
+		if (mock)
+		{
+			device = CreateMockDevice(latency, bandwidth);
+			if (directory.empty())
+				directory = "bench";
+		}
+		else
+			device = Device::FindFirst(claimInterface);
+		if (!device)
+		{
+			error("no mtp device found");
+			return 1;
+		}
+		if (transferSize)
+		{
+			if (mock)
+				std::static_pointer_cast<mock::BulkPipe>(device->GetPipe())->SetTransferSize(transferSize);
+			else
+				device->GetPipe()->GetDevice()->SetTransferSize(transferSize);
+		}
+
+		Scenario openSession("OpenSession");
+		SessionPtr session;
+		openSession.Run([&]() -> u64 { session = device->OpenSession(1); return 0; });
+		if (mock)
+			session->SetCoalesceDataPhase(true);
+
+		auto storages = session->GetStorageIDs();
+		if (storages.StorageIDs.empty())
+			throw std::runtime_error("no storages available, device may be locked");
+		StorageId storageId = storages.StorageIDs.front();
+
+		ObjectId parent = Resolve(session, storageId, directory);
+		auto objects = ListObjects(session, storageId, parent);
+		print("directory contains ", objects.size(), " objects");
+
+		Object largest = {};
+		for(auto & object : objects)
+		{
+			if (object.Format != ObjectFormat::Association && object.Size > largest.Size)
+				largest = object;
+		}
+
+		Scenario objectInfo("GetObjectInfo");
+		for(int i = 0; i < iterations; ++i)
+			for(auto & object : objects)
+				objectInfo.Run([&]() -> u64 { session->GetObjectInfo(object.Id); return 0; });
+
+		Scenario objectHandles("GetObjectHandles");
+		for(int i = 0; i < iterations; ++i)
+			objectHandles.Run([&]() -> u64 { return session->GetObjectHandles(storageId, ObjectFormat::Any, parent).ObjectHandles.size() * sizeof(u32); });
+
+		Scenario propList("GetObjectPropList");
+		if (session->GetObjectPropertyListSupported() && parent != Session::Root)
+			for(int i = 0; i < iterations; ++i)
+				propList.Run([&]() -> u64 { return session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::All, 0, 1).size(); });
+
+		Scenario getObject("GetObject");
+		if (largest.Size)
+			for(int i = 0; i < iterations; ++i)
+				getObject.Run([&]() -> u64 { auto stream = std::make_shared<NullOutputStream>(); session->GetObject(largest.Id, stream); return stream->GetSize(); });
+
+		std::vector<Scenario> partial;
+		for(u32 chunk : { 64u * 1024, 256u * 1024, 1024u * 1024 })
+		{
+			partial.emplace_back("GetPartialObject/" + std::to_string(chunk / 1024) + "k");
+			Scenario & scenario = partial.back();
+			u64 size = std::min<u64>(largest.Size, 16 * 1024 * 1024);
+			for(u64 offset = 0; offset < size; offset += chunk)
+				scenario.Run([&]() -> u64 { return session->GetPartialObject(largest.Id, offset, chunk).size(); });
+		}
+
+		Scenario sendObject("SendObject");
+		if (write)
+		{
+			for(int i = 0; i < iterations; ++i)
+			{
+				msg::ObjectInfo oi;
+				oi.Filename = "aft-bench.bin";
+				oi.ObjectFormat = ObjectFormat::Undefined;
+				oi.SetSize(uploadSize * 1024 * 1024);
+				Session::NewObjectInfo noi;
+				sendObject.Run([&]() -> u64
+				{
+					noi = session->SendObjectInfo(oi, storageId, parent);
+					session->SendObject(std::make_shared<PatternInputStream>(uploadSize * 1024 * 1024));
+					return uploadSize * 1024 * 1024;
+				});
+				session->DeleteObject(noi.ObjectId);
+			}
+		}
+
+		openSession.Report();
+		objectInfo.Report();
+		objectHandles.Report();
+		propList.Report();
+		getObject.Report();
+		for(auto & scenario : partial)
+			scenario.Report();
+		sendObject.Report();
+	}
+	catch(const std::exception &ex)
+	{
+		error("error: ", ex.what());
+		return 1;
+	}
+	return 0;
+}
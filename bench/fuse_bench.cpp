@@ -0,0 +1,411 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/log.h>
+
+#include <bench/Scenario.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+	using namespace mtp;
+	using bench::Clock;
+	using bench::Scenario;
+
+	const char * DefaultDevice = "files=10000,depth=3,fanout=6,large=2,large-size=256M";
+
+	struct Tree //! files found by traversal, inputs of stat and read workloads
+	{
+		std::vector<std::string>	Files;
+		std::string					Largest;
+		u64							LargestSize;
+
+		Tree(): LargestSize(0)
+		{ }
+	};
+
+	void Check(bool ok, const std::string &what)
+	{
+		if (!ok)
+			throw std::runtime_error(what + ": " + strerror(errno));
+	}
+
+	class Traversal //! recursive directory walk, one operation per directory
+	{
+		Scenario &	_scenario;
+		bool		_stat;
+		Tree *		_tree;
+
+		void Walk(const std::string &path)
+		{
+			std::vector<std::string> subdirs;
+			_scenario.Run([&]() -> u64
+			{
+				DIR *dir = opendir(path.c_str());
+				Check(dir != nullptr, "opendir " + path);
+				while(dirent *entry = readdir(dir))
+				{
+					if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+						continue;
+					std::string child = path + "/" + entry->d_name;
+					bool directory = entry->d_type == DT_DIR;
+					if (_stat)
+					{
+						struct stat st = {};
+						Check(lstat(child.c_str(), &st) == 0, "lstat " + child);
+						directory = S_ISDIR(st.st_mode);
+						if (_tree && S_ISREG(st.st_mode))
+						{
+							_tree->Files.push_back(child);
+							if (static_cast<u64>(st.st_size) > _tree->LargestSize)
+							{
+								_tree->LargestSize = st.st_size;
+								_tree->Largest = child;
+							}
+						}
+					}
+					if (directory)
+						subdirs.push_back(child);
+				}
+				closedir(dir);
+				return 0;
+			});
+			for(auto &subdir : subdirs)
+				Walk(subdir);
+		}
+
+	public:
+		///stat makes it ls -lR, find otherwise, tree collects regular files
+		Traversal(Scenario &scenario, bool stat, Tree *tree = nullptr): _scenario(scenario), _stat(stat), _tree(tree)
+		{ }
+
+		void Run(const std::string &root)
+		{ Walk(root); }
+	};
+
+	void ParallelStat(Scenario &scenario, const std::vector<std::string> &files, unsigned jobs)
+	{
+		std::mutex mutex;
+		std::vector<double> latencies;
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> threads;
+
+		double cpu = bench::GetCpuTime();
+		auto started = Clock::now();
+		for(unsigned j = 0; j < jobs; ++j)
+			threads.emplace_back([&]()
+			{
+				std::vector<double> local;
+				size_t i;
+				while((i = next++) < files.size())
+				{
+					auto t = Clock::now();
+					struct stat st = {};
+					stat(files[i].c_str(), &st);
+					local.push_back(std::chrono::duration<double>(Clock::now() - t).count());
+				}
+				std::lock_guard<std::mutex> l(mutex);
+				latencies.insert(latencies.end(), local.begin(), local.end());
+			});
+		for(auto &thread : threads)
+			thread.join();
+		scenario.Add(latencies, 0, std::chrono::duration<double>(Clock::now() - started).count(), bench::GetCpuTime() - cpu);
+	}
+
+	void SequentialRead(Scenario &scenario, const std::string &path, size_t blockSize)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		Check(fd >= 0, "open " + path);
+		std::vector<u8> buffer(blockSize);
+		ssize_t r = 1;
+		while(r > 0)
+			scenario.Run([&]() -> u64 { r = read(fd, buffer.data(), buffer.size()); return r > 0? r: 0; });
+		close(fd);
+		Check(r == 0, "read " + path);
+	}
+
+	void RandomRead(Scenario &scenario, const std::string &path, u64 size, size_t blockSize, unsigned count)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		Check(fd >= 0, "open " + path);
+		std::vector<u8> buffer(blockSize);
+		std::mt19937_64 random(1);
+		for(unsigned i = 0; i < count && size > blockSize; ++i)
+		{
+			off_t offset = (random() % (size - blockSize)) & ~static_cast<u64>(blockSize - 1);
+			scenario.Run([&]() -> u64 { ssize_t r = pread(fd, buffer.data(), buffer.size(), offset); return r > 0? r: 0; });
+		}
+		close(fd);
+	}
+
+	u64 WriteFile(const std::string &path, u64 size, size_t blockSize, Scenario *blocks = nullptr)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		Check(fd >= 0, "open " + path);
+		std::vector<u8> buffer(blockSize);
+		for(size_t i = 0; i < buffer.size(); ++i)
+			buffer[i] = static_cast<u8>(i);
+		for(u64 offset = 0; offset < size; offset += blockSize)
+		{
+			size_t n = std::min<u64>(blockSize, size - offset);
+			auto write = [&]() -> u64 { Check(::write(fd, buffer.data(), n) == static_cast<ssize_t>(n), "write " + path); return n; };
+			if (blocks)
+				blocks->Run(write);
+			else
+				write();
+		}
+		Check(close(fd) == 0, "close " + path);
+		return size;
+	}
+
+	class MountHelper //! runs aft-mtp-mount in foreground on simulated device, unmounts it on destruction
+	{
+		std::string		_mountpoint;
+		pid_t			_pid;
+
+		static dev_t GetDevice(const std::string &path)
+		{
+			struct stat st = {};
+			return stat(path.c_str(), &st) == 0? st.st_dev: 0;
+		}
+
+	public:
+		MountHelper(const std::string &binary, const std::string &mountpoint, const std::string &device, bool verbose): _mountpoint(mountpoint), _pid(-1)
+		{
+			dev_t parent = GetDevice(mountpoint + "/..");
+			_pid = fork();
+			Check(_pid >= 0, "fork");
+			if (_pid == 0)
+			{
+				setenv("AFT_MOCK", device.c_str(), 1);
+				if (verbose)
+					execlp(binary.c_str(), binary.c_str(), "-f", "-v", mountpoint.c_str(), (char *)nullptr);
+				else
+					execlp(binary.c_str(), binary.c_str(), "-f", mountpoint.c_str(), (char *)nullptr);
+				perror("exec");
+				_exit(127);
+			}
+
+			auto deadline = Clock::now() + std::chrono::seconds(60);
+			while(GetDevice(mountpoint) == parent)
+			{
+				int status;
+				if (waitpid(_pid, &status, WNOHANG) == _pid)
+				{
+					_pid = -1;
+					throw std::runtime_error("mount helper exited before mounting " + mountpoint);
+				}
+				if (Clock::now() > deadline)
+					throw std::runtime_error("timed out waiting for mount of " + mountpoint);
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+		}
+
+		~MountHelper()
+		{
+			if (_pid < 0)
+				return;
+			std::string command = "fusermount -u '" + _mountpoint + "' 2>/dev/null || fusermount3 -u '" + _mountpoint + "'";
+			if (system(command.c_str()) != 0)
+				kill(_pid, SIGTERM);
+			waitpid(_pid, nullptr, 0);
+		}
+	};
+
+	void ShowHelp()
+	{
+		error(
+			"usage: aft-fuse-bench [options] <mountpoint>\n"
+			"-h\t--help\t\tshow this help\n"
+			"-v\t--verbose\tshow debug output\n"
+			"-m\t--mount\t\tstart given aft-mtp-mount binary on simulated device first, existing mount is used otherwise\n"
+			"-M\t--mock\t\tsimulated device spec passed as AFT_MOCK, " + std::string(DefaultDevice) + " by default\n"
+			"-n\t--iterations\tnumber of warm passes of listing workloads, 2 by default\n"
+			"-j\t--jobs\t\tnumber of threads of parallel stat, 8 by default\n"
+			"-w\t--write\t\tenable copy-in and rename workloads (creates and deletes aft-fuse-bench folder)\n"
+			"-s\t--size\t\tsize of large copied-in file in megabytes, 64 by default\n"
+			"-f\t--files\t\tnumber of small copied-in files, 256 by default"
+		);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	using namespace mtp;
+	std::string mountBinary;
+	std::string device = DefaultDevice;
+	int iterations = 2;
+	unsigned jobs = 8;
+	bool write = false;
+	u64 uploadSize = 64;
+	unsigned smallFiles = 256;
+
+	static struct option long_options[] =
+	{
+		{"verbose",			no_argument,		0,	'v' },
+		{"help",			no_argument,		0,	'h' },
+		{"mount",			required_argument,	0,	'm' },
+		{"mock",			required_argument,	0,	'M' },
+		{"iterations",		required_argument,	0,	'n' },
+		{"jobs",			required_argument,	0,	'j' },
+		{"write",			no_argument,		0,	'w' },
+		{"size",			required_argument,	0,	's' },
+		{"files",			required_argument,	0,	'f' },
+		{0,					0,					0,	 0	}
+	};
+
+	while(true)
+	{
+		int optionIndex = 0;
+		int c = getopt_long(argc, argv, "vhm:M:n:j:ws:f:", long_options, &optionIndex);
+		if (c == -1)
+			break;
+		switch(c)
+		{
+		case 'v':
+			g_debug = true;
+			break;
+		case 'm':
+			mountBinary = optarg;
+			break;
+		case 'M':
+			device = optarg;
+			break;
+		case 'n':
+			iterations = std::max(0, atoi(optarg));
+			break;
+		case 'j':
+			jobs = std::max(1, atoi(optarg));
+			break;
+		case 'w':
+			write = true;
+			break;
+		case 's':
+			uploadSize = strtoull(optarg, NULL, 10);
+			break;
+		case 'f':
+			smallFiles = std::max(1, atoi(optarg));
+			break;
+		case 'h':
+		default:
+			ShowHelp();
+			return 0;
+		}
+	}
+
+	if (optind + 1 != argc)
+	{
+		ShowHelp();
+		return 1;
+	}
+	std::string mountpoint = argv[optind];
+
+	try
+	{
+		std::unique_ptr<MountHelper> helper;
+		if (!mountBinary.empty())
+		{
+			auto started = Clock::now();
+			helper.reset(new MountHelper(mountBinary, mountpoint, device, g_debug));
+			print("mounted ", device, " in ", std::chrono::duration<double>(Clock::now() - started).count(), " s");
+		}
+
+		Tree tree;
+		Scenario coldListing("ls -lR (cold)"), warmListing("ls -lR"), find("find");
+		Traversal(coldListing, true, &tree).Run(mountpoint);
+		for(int i = 0; i < iterations; ++i)
+			Traversal(warmListing, true).Run(mountpoint);
+		for(int i = 0; i < std::max(1, iterations); ++i)
+			Traversal(find, false).Run(mountpoint);
+		print("found ", tree.Files.size(), " files, largest ", tree.Largest, " (", tree.LargestSize, " bytes)");
+
+		Scenario parallelStat("stat x" + std::to_string(jobs));
+		ParallelStat(parallelStat, tree.Files, jobs);
+
+		Scenario sequentialRead("sequential read/128k"), randomRead("random read/4k");
+		if (tree.LargestSize)
+		{
+			SequentialRead(sequentialRead, tree.Largest, 128 * 1024);
+			RandomRead(randomRead, tree.Largest, tree.LargestSize, 4096, 1000);
+		}
+
+		Scenario smallCopy("small file copy-in/16k"), largeCopy("large file copy-in/1M"), rename("rename");
+		if (write)
+		{
+			std::string dir = mountpoint + "/aft-fuse-bench";
+			Check(mkdir(dir.c_str(), 0755) == 0, "mkdir " + dir);
+			std::vector<std::string> names;
+			for(unsigned i = 0; i < smallFiles; ++i)
+			{
+				names.push_back(dir + "/small" + std::to_string(i) + ".bin");
+				smallCopy.Run([&]() -> u64 { return WriteFile(names.back(), 16 * 1024, 16 * 1024); });
+			}
+			for(auto &name : names)
+			{
+				std::string newName = name + ".renamed";
+				rename.Run([&]() -> u64 { Check(::rename(name.c_str(), newName.c_str()) == 0, "rename " + name); return 0; });
+				name = newName;
+			}
+			std::string large = dir + "/large.bin";
+			WriteFile(large, uploadSize * 1024 * 1024, 1024 * 1024, &largeCopy);
+			names.push_back(large);
+
+			for(auto &name : names)
+				unlink(name.c_str());
+			rmdir(dir.c_str());
+		}
+
+		coldListing.Report();
+		warmListing.Report();
+		find.Report();
+		parallelStat.Report();
+		sequentialRead.Report();
+		randomRead.Report();
+		smallCopy.Report();
+		rename.Report();
+		largeCopy.Report();
+	}
+	catch(const std::exception &ex)
+	{
+		error("error: ", ex.what());
+		return 1;
+	}
+	return 0;
+}
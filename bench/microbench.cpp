@@ -0,0 +1,283 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/ByteArrayObjectStream.h>
+#include <mtp/ptp/Container.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/JoinedObjectStream.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/ptp/ObjectPropertyListParser.h>
+#include <mtp/ptp/OperationRequest.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/ptp/PipePacketer.h>
+#include <mtp/usb/BulkPipe.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+namespace
+{
+	using namespace mtp;
+
+	const u32 Transaction = 42;
+
+	class NullOutputStream final : public IObjectOutputStream, public CancellableStream //! output stream discarding all data
+	{
+	public:
+		virtual size_t Write(const u8 *data, size_t size)
+		{ return size; }
+	};
+	DECLARE_PTR(NullOutputStream);
+
+	class ReplayBulkPipe final : public usb::BulkPipe //! software pipe returning recorded containers, one per read
+	{
+		std::deque<ByteArray>	_containers;
+		size_t					_packetSize;
+
+	public:
+		ReplayBulkPipe(size_t packetSize = 16384): _packetSize(packetSize)
+		{ }
+
+		void Push(const ByteArray &container)
+		{ _containers.push_back(container); }
+
+		usb::DevicePtr GetDevice() const override
+		{ return nullptr; }
+
+		void Read(const IObjectOutputStreamPtr &outputStream, int timeout) override
+		{
+			ByteArray container = std::move(_containers.front());
+			_containers.pop_front();
+			for(size_t offset = 0; offset < container.size(); offset += _packetSize)
+				outputStream->Write(container.data() + offset, std::min(_packetSize, container.size() - offset));
+		}
+
+		void Write(const IObjectInputStreamPtr &inputStream, int timeout) override
+		{ }
+
+		void Cancel() override
+		{ }
+	};
+	DECLARE_PTR(ReplayBulkPipe);
+
+	ByteArray MakeContainer(ContainerType type, u16 code, const ByteArray &payload)
+	{
+		ByteArray data;
+		OutputStream stream(data);
+		stream.Reserve(12 + payload.size());
+		stream << static_cast<u32>(12 + payload.size());
+		stream << type;
+		stream << code;
+		stream << Transaction;
+		data.insert(data.end(), payload.begin(), payload.end());
+		return data;
+	}
+
+	std::string MakeFilename(size_t index, bool unicode)
+	{ return (unicode? "Фотография_": "IMG_20200101_") + std::to_string(100000 + index) + ".jpg"; }
+
+	ByteArray MakeString(const std::string &value)
+	{
+		ByteArray data;
+		OutputStream stream(data);
+		stream << value;
+		return data;
+	}
+
+	///property list as returned by GetObjectPropList(All) for a folder of photos
+	ByteArray MakePropertyList(size_t objects)
+	{
+		ByteArray data;
+		OutputStream stream(data);
+		stream << static_cast<u32>(objects * 4);
+		for(size_t i = 0; i < objects; ++i)
+		{
+			u32 id = 0x10000 + i;
+			stream << id << ObjectProperty::ObjectFilename << DataTypeCode::String << MakeFilename(i, i % 4 == 0);
+			stream << id << ObjectProperty::ObjectFormat << DataTypeCode::Uint16 << static_cast<u16>(ObjectFormat::ExifJpeg);
+			stream << id << ObjectProperty::ObjectSize << DataTypeCode::Uint64 << static_cast<u64>(3000000 + i);
+			stream << id << ObjectProperty::DateModified << DataTypeCode::String << std::string("20200101T120000");
+		}
+		return data;
+	}
+
+	ByteArray MakeObjectInfo()
+	{
+		msg::ObjectInfo oi;
+		oi.StorageId = StorageId(0x10001);
+		oi.ObjectFormat = ObjectFormat::ExifJpeg;
+		oi.ObjectCompressedSize = 3145728;
+		oi.ParentObject = ObjectId(0x1234);
+		oi.Filename = MakeFilename(1, false);
+		oi.CaptureDate = "20200101T120000";
+		oi.ModificationDate = "20200101T120000";
+
+		ByteArray data;
+		OutputStream stream(data);
+		oi.Write(stream);
+		return data;
+	}
+
+	void ReadString(benchmark::State &state)
+	{
+		ByteArray data = MakeString(MakeFilename(0, state.range(0) != 0));
+		for (auto _ : state)
+		{
+			InputStream stream(data);
+			benchmark::DoNotOptimize(stream.ReadString());
+		}
+		state.SetBytesProcessed(state.iterations() * data.size());
+	}
+	BENCHMARK(ReadString)->ArgName("unicode")->Arg(0)->Arg(1);
+
+	void WriteString(benchmark::State &state)
+	{
+		std::string value = MakeFilename(0, state.range(0) != 0);
+		ByteArray data;
+		for (auto _ : state)
+		{
+			data.clear();
+			OutputStream stream(data);
+			stream << value;
+			benchmark::DoNotOptimize(data.data());
+		}
+		state.SetBytesProcessed(state.iterations() * data.size());
+	}
+	BENCHMARK(WriteString)->ArgName("unicode")->Arg(0)->Arg(1);
+
+	void ParsePropertyList(benchmark::State &state)
+	{
+		ByteArray data = MakePropertyList(state.range(0));
+		for (auto _ : state)
+		{
+			u64 sum = 0;
+			ObjectPropertyListParser<ObjectPropertyValue> parser;
+			parser.Parse(data, [&sum](ObjectId id, ObjectProperty property, const ObjectPropertyValue &value)
+			{ sum += value.Integer + value.String.size(); });
+			benchmark::DoNotOptimize(sum);
+		}
+		state.SetBytesProcessed(state.iterations() * data.size());
+		state.SetItemsProcessed(state.iterations() * state.range(0) * 4);
+	}
+	BENCHMARK(ParsePropertyList)->Arg(100)->Arg(10000);
+
+	void ReadObjectInfo(benchmark::State &state)
+	{
+		ByteArray data = MakeObjectInfo();
+		for (auto _ : state)
+		{
+			InputStream stream(data);
+			msg::ObjectInfo oi;
+			oi.Read(stream);
+			benchmark::DoNotOptimize(oi.Filename.data());
+		}
+		state.SetBytesProcessed(state.iterations() * data.size());
+	}
+	BENCHMARK(ReadObjectInfo);
+
+	void ConstructContainer(benchmark::State &state)
+	{
+		auto inputStream = std::make_shared<ByteArrayObjectInputStream>(MakeObjectInfo());
+		for (auto _ : state)
+		{
+			DataRequest request(OperationCode::SendObjectInfo, Transaction);
+			Container container(request, inputStream);
+			benchmark::DoNotOptimize(container.Data.data());
+		}
+	}
+	BENCHMARK(ConstructContainer);
+
+	void ConstructOperationRequest(benchmark::State &state)
+	{
+		for (auto _ : state)
+		{
+			OperationRequest request(OperationCode::GetPartialObject64, Transaction, 0x1234, 0, 0, 1048576);
+			benchmark::DoNotOptimize(request.GetData());
+		}
+	}
+	BENCHMARK(ConstructOperationRequest);
+
+	///data phase of given size followed by response, parsed into memory or discarded
+	void PipePacketerRead(benchmark::State &state)
+	{
+		ByteArray payload(state.range(0));
+		ByteArray dataContainer = MakeContainer(ContainerType::Data, static_cast<u16>(OperationCode::GetObject), payload);
+		ByteArray responseContainer = MakeContainer(ContainerType::Response, static_cast<u16>(ResponseType::OK), ByteArray());
+		bool discard = state.range(1) != 0;
+
+		auto pipe = std::make_shared<ReplayBulkPipe>();
+		PipePacketer packeter(pipe);
+		auto nullStream = std::make_shared<NullOutputStream>();
+		ByteArray data, response;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			pipe->Push(dataContainer);
+			pipe->Push(responseContainer);
+			state.ResumeTiming();
+
+			ResponseType code;
+			if (discard)
+				packeter.Read(Transaction, nullStream, code, response, 0);
+			else
+				packeter.Read(Transaction, data, code, response, 0);
+			benchmark::DoNotOptimize(code);
+		}
+		state.SetBytesProcessed(state.iterations() * dataContainer.size());
+	}
+	BENCHMARK(PipePacketerRead)->ArgNames({"size", "discard"})->Args({512, 0})->Args({65536, 0})->Args({4194304, 0})->Args({4194304, 1});
+
+	void JoinedOutputStream(benchmark::State &state)
+	{
+		ByteArray data(state.range(0));
+		for (auto _ : state)
+		{
+			auto header = std::make_shared<FixedSizeByteArrayObjectOutputStream>(12);
+			JoinedObjectOutputStream stream(header, std::make_shared<NullOutputStream>());
+			for(size_t offset = 0; offset < data.size(); offset += 512)
+				stream.Write(data.data() + offset, std::min<size_t>(512, data.size() - offset));
+		}
+		state.SetBytesProcessed(state.iterations() * data.size());
+	}
+	BENCHMARK(JoinedOutputStream)->Arg(65536);
+
+	///growth of memory stream fed by 16k packets, optionally reserved upfront as announced by data container
+	void ByteArrayOutputStreamGrowth(benchmark::State &state)
+	{
+		ByteArray packet(16384);
+		size_t size = state.range(0);
+		bool reserve = state.range(1) != 0;
+		for (auto _ : state)
+		{
+			ByteArrayObjectOutputStream stream;
+			if (reserve)
+				stream.Reserve(size);
+			for(size_t offset = 0; offset < size; offset += packet.size())
+				stream.Write(packet.data(), std::min(packet.size(), size - offset));
+			benchmark::DoNotOptimize(stream.GetData().data());
+		}
+		state.SetBytesProcessed(state.iterations() * size);
+	}
+	BENCHMARK(ByteArrayOutputStreamGrowth)->ArgNames({"size", "reserve"})->Args({1048576, 0})->Args({1048576, 1})->Args({16777216, 0})->Args({16777216, 1});
+}
+
+BENCHMARK_MAIN();
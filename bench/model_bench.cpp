@@ -0,0 +1,257 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <qt/mtpobjectsmodel.h>
+#include <mtp/mock/DeviceSpec.h>
+#include <mtp/ptp/Device.h>
+#include <mtp/log.h>
+
+#include <bench/Scenario.h>
+
+#include <QApplication>
+#include <QEventLoop>
+#include <QSortFilterProxyModel>
+#include <QTimer>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+	using namespace mtp;
+	using bench::Clock;
+
+	const char * DefaultSizes = "10000,50000,200000";
+
+	long GetResidentSize() //kilobytes
+	{
+		long pages = 0, resident = 0;
+		FILE *f = fopen("/proc/self/statm", "r");
+		if (f)
+		{
+			if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+				resident = 0;
+			fclose(f);
+		}
+		return resident * (sysconf(_SC_PAGESIZE) / 1024);
+	}
+
+	long GetPeakResidentSize() //kilobytes
+	{
+		rusage usage = {};
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	}
+
+	///runs op once, prints its wall time, time per item and resident memory it added
+	void Measure(const std::string &name, int items, const std::function<void ()> &op)
+	{
+		long rss = GetResidentSize();
+		auto started = Clock::now();
+		op();
+		double dt = std::chrono::duration<double>(Clock::now() - started).count();
+		char buf[256];
+		snprintf(buf, sizeof(buf), "  %-28s %10.2f ms %10.1f ns/item %+10ld KiB rss, peak %ld KiB",
+			name.c_str(), dt * 1000, items? dt * 1e9 / items: 0.0, GetResidentSize() - rss, GetPeakResidentSize());
+		print(buf);
+	}
+
+	///model is populated from loader thread, so event loop is spun until listing is complete
+	void WaitLoaded(MtpObjectsModel &model)
+	{
+		QEventLoop loop;
+		QObject::connect(&model, SIGNAL(objectsLoaded()), &loop, SLOT(quit()));
+		QTimer::singleShot(600000, &loop, SLOT(quit()));
+		loop.exec();
+	}
+
+	///asks data for every row, as view does when it is scrolled over the whole folder
+	void Sweep(const QAbstractItemModel &model, int role)
+	{
+		int rows = model.rowCount();
+		for(int i = 0; i < rows; ++i)
+			model.data(model.index(i, 0), role);
+	}
+
+	void Run(int files, const std::string &extraSpec, QSize thumbnailSize)
+	{
+		std::string spec = "files=" + std::to_string(files) + ",depth=0,large=0";
+		if (!extraSpec.empty())
+			spec += "," + extraSpec;
+		print(spec, ":");
+
+		auto device = std::make_shared<Device>(mock::DeviceSpec::Parse(spec).CreatePipe());
+		auto session = device->OpenSession(1);
+
+		MtpObjectsModel model;
+		Measure("setSession + listing", files, [&]() { model.setSession(session); WaitLoaded(model); });
+		int rows = model.rowCount();
+		if (rows != files)
+			print("  warning: ", rows, " rows listed, expected ", files);
+
+		//listing of another folder and back, reset cost is paid twice
+		Measure("setParent reset", rows * 2, [&]()
+		{
+			model.setParent(ObjectId(1));
+			model.setParent(Session::Root);
+			WaitLoaded(model);
+		});
+		Measure("setParent refresh", rows, [&]() { model.setParent(Session::Root); WaitLoaded(model); });
+
+		struct RoleName { int Role; const char *Name; };
+		static const RoleName roles[] =
+		{
+			{ Qt::DisplayRole,					"data(display)" },
+			{ Qt::FontRole,						"data(font)" },
+			{ Qt::DecorationRole,				"data(decoration)" },
+			{ MtpObjectsModel::NameRole,		"data(name)" },
+			{ MtpObjectsModel::SizeRole,		"data(size)" },
+			{ MtpObjectsModel::DateRole,		"data(date)" },
+			{ MtpObjectsModel::TypeRole,		"data(type)" },
+		};
+		for(auto &role : roles)
+			Measure(role.Name, rows, [&]() { Sweep(model, role.Role); });
+
+		std::vector<ObjectId> ids;
+		QStringList names;
+		ids.reserve(rows);
+		for(int i = 0; i < rows; ++i)
+		{
+			ids.push_back(model.objectIdAt(i));
+			names.push_back(model.data(model.index(i, 0), Qt::DisplayRole).toString());
+		}
+		Measure("findObject(id)", rows, [&]() { for(auto id : ids) model.findObject(id); });
+		Measure("findObject(name)", rows, [&]() { for(auto &name : names) model.findObject(name); });
+
+		QSortFilterProxyModel proxy;
+		proxy.setDynamicSortFilter(true);
+		Measure("proxy setSourceModel", rows, [&]() { proxy.setSourceModel(&model); });
+		static const RoleName sortRoles[] =
+		{
+			{ MtpObjectsModel::NameRole,		"sort(name)" },
+			{ MtpObjectsModel::SizeRole,		"sort(size)" },
+			{ MtpObjectsModel::DateRole,		"sort(date)" },
+			{ MtpObjectsModel::TypeRole,		"sort(type)" },
+		};
+		for(auto &role : sortRoles)
+			Measure(role.Name, rows, [&]() { proxy.setSortRole(role.Role); proxy.sort(0); });
+		Measure("proxy data(display)", rows, [&]() { Sweep(proxy, Qt::DisplayRole); });
+		proxy.setSourceModel(nullptr);
+
+		//decoration requests go to thumbnail loader, memory is what rows and pending requests keep
+		Measure("enableThumbnail", rows, [&]() { model.enableThumbnail(true, thumbnailSize); });
+		Measure("data(decoration, thumbnails)", rows, [&]() { Sweep(model, Qt::DecorationRole); });
+		Measure("data(size hint, thumbnails)", rows, [&]() { Sweep(model, Qt::SizeHintRole); });
+		QCoreApplication::processEvents();
+		model.enableThumbnail(false, thumbnailSize);
+	}
+
+	void ShowHelp()
+	{
+		error(
+			"usage: aft-model-bench [options]\n"
+			"-h\t--help\t\tshow this help\n"
+			"-v\t--verbose\tshow debug output\n"
+			"-n\t--sizes\t\tcomma separated folder sizes, " + std::string(DefaultSizes) + " by default\n"
+			"-M\t--mock\t\textra simulated device spec items appended to files=N,depth=0, e.g. latency=200\n"
+			"-t\t--thumbnail\tthumbnail size in pixels, 128 by default"
+		);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	using namespace mtp;
+	std::string sizes = DefaultSizes;
+	std::string extraSpec;
+	int thumbnail = 128;
+
+	static struct option long_options[] =
+	{
+		{"verbose",			no_argument,		0,	'v' },
+		{"help",			no_argument,		0,	'h' },
+		{"sizes",			required_argument,	0,	'n' },
+		{"mock",			required_argument,	0,	'M' },
+		{"thumbnail",		required_argument,	0,	't' },
+		{0,					0,					0,	 0	}
+	};
+
+	while(true)
+	{
+		int optionIndex = 0;
+		int c = getopt_long(argc, argv, "vhn:M:t:", long_options, &optionIndex);
+		if (c == -1)
+			break;
+		switch(c)
+		{
+		case 'v':
+			g_debug = true;
+			break;
+		case 'n':
+			sizes = optarg;
+			break;
+		case 'M':
+			extraSpec = optarg;
+			break;
+		case 't':
+			thumbnail = std::max(16, atoi(optarg));
+			break;
+		case 'h':
+		default:
+			ShowHelp();
+			return 0;
+		}
+	}
+
+	//headless: no display is needed for pixmaps and fonts the model creates
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	int qtArgc = 1;
+	QApplication app(qtArgc, argv);
+
+	try
+	{
+		size_t begin = 0;
+		while(begin < sizes.size())
+		{
+			size_t end = sizes.find(',', begin);
+			if (end == sizes.npos)
+				end = sizes.size();
+			int files = atoi(sizes.substr(begin, end - begin).c_str());
+			begin = end + 1;
+			if (files > 0)
+				Run(files, extraSpec, QSize(thumbnail, thumbnail));
+		}
+	}
+	catch(const std::exception &ex)
+	{
+		error("error: ", ex.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,334 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <cli/Daemon.h>
+#include <cli/Session.h>
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/log.h>
+
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cli
+{
+	namespace
+	{
+		sockaddr_un GetAddress(const std::string &path)
+		{
+			sockaddr_un addr = {};
+			if (path.size() >= sizeof(addr.sun_path))
+				throw std::runtime_error("socket path " + path + " is too long");
+			addr.sun_family = AF_UNIX;
+			strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+			return addr;
+		}
+
+		void WriteAll(int fd, const char *data, size_t size)
+		{
+			while(size)
+			{
+				ssize_t r = write(fd, data, size);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw mtp::posix::Exception("write");
+				}
+				data += r;
+				size -= r;
+			}
+		}
+
+		///session acts on behalf of its user only, whatever permissions socket has
+		bool IsOwnUser(int client)
+		{
+#ifdef SO_PEERCRED
+			ucred cred = {};
+			socklen_t size = sizeof(cred);
+			if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0)
+				return false;
+			return cred.uid == getuid();
+#else
+			uid_t uid;
+			gid_t gid;
+			if (getpeereid(client, &uid, &gid) != 0)
+				return false;
+			return uid == getuid();
+#endif
+		}
+
+		void FlushOutput()
+		{
+			std::cout.flush();
+			std::cerr.flush();
+			fflush(stdout);
+			fflush(stderr);
+		}
+	}
+
+	Daemon::Daemon(const std::string &path): _path(path), _fd(socket(AF_UNIX, SOCK_STREAM, 0))
+	{
+		if (_fd < 0)
+			throw mtp::posix::Exception("socket");
+
+		sockaddr_un addr = GetAddress(path);
+		if (bind(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+		{
+			int client = errno == EADDRINUSE? Connect(path): -1;
+			if (client >= 0)
+			{
+				close(client);
+				close(_fd);
+				throw std::runtime_error("server is already running on " + path);
+			}
+			unlink(path.c_str()); //left by killed daemon
+			if (bind(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+			{
+				mtp::posix::Exception ex("bind " + path);
+				close(_fd);
+				throw ex;
+			}
+		}
+		if (listen(_fd, 8) != 0)
+		{
+			mtp::posix::Exception ex("listen");
+			close(_fd);
+			unlink(path.c_str());
+			throw ex;
+		}
+	}
+
+	Daemon::~Daemon()
+	{
+		close(_fd);
+		unlink(_path.c_str());
+	}
+
+	std::string Daemon::GetSocketPath(const std::string &deviceId)
+	{
+		const char *runtime = getenv("XDG_RUNTIME_DIR");
+		std::string dir;
+		if (runtime && *runtime)
+			dir = runtime; //private to user by definition
+		else
+		{
+			//anyone can create files in /tmp, socket lives in directory which only we can enter
+			dir = "/tmp/aft-mtp-cli-" + std::to_string(getuid());
+			if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+				throw mtp::posix::Exception("mkdir " + dir);
+			struct stat st;
+			if (lstat(dir.c_str(), &st) != 0)
+				throw mtp::posix::Exception("stat " + dir);
+			if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+				throw std::runtime_error(dir + " is not a private directory of current user, refusing to use it");
+		}
+		std::string path = dir + "/aft-mtp-cli";
+		if (!deviceId.empty())
+		{
+			std::string id(deviceId);
+			for(auto &ch : id)
+				if (ch == '/')
+					ch = '_';
+			path += "-" + id;
+		}
+		return path + ".sock";
+	}
+
+	int Daemon::Connect(const std::string &path)
+	{
+		sockaddr_un addr = GetAddress(path);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			throw mtp::posix::Exception("socket");
+		if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	int Daemon::Run(int fd, const std::string &commands)
+	{
+		//relative local paths are resolved in working directory of the caller
+		int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (cwd < 0)
+			throw mtp::posix::Exception("open working directory");
+		int fds[3] = { STDOUT_FILENO, STDERR_FILENO, cwd };
+		char buf[CMSG_SPACE(sizeof(fds))] = {};
+		char dummy = 0;
+		iovec iov = { &dummy, 1 };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = buf;
+		msg.msg_controllen = sizeof(buf);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+		ssize_t sent = sendmsg(fd, &msg, 0);
+		close(cwd);
+		if (sent != 1)
+			throw mtp::posix::Exception("sendmsg");
+
+		WriteAll(fd, commands.data(), commands.size());
+		shutdown(fd, SHUT_WR);
+
+		unsigned char status;
+		ssize_t r;
+		do
+			r = read(fd, &status, 1);
+		while(r < 0 && errno == EINTR);
+		close(fd);
+		if (r != 1)
+			throw std::runtime_error("server closed connection");
+		return status;
+	}
+
+	void Daemon::Process(Session &session, int client)
+	{
+		int fds[3] = { -1, -1, -1 };
+		char buf[CMSG_SPACE(sizeof(fds))] = {};
+		char dummy;
+		iovec iov = { &dummy, 1 };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = buf;
+		msg.msg_controllen = sizeof(buf);
+		if (recvmsg(client, &msg, 0) != 1)
+			return;
+
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+		{
+			mtp::error("client did not pass output descriptors and working directory");
+			return;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		std::string commands;
+		char data[4096];
+		ssize_t r;
+		while((r = read(client, data, sizeof(data))) != 0)
+		{
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			commands.append(data, r);
+		}
+
+		//command output goes straight into client's descriptors, local paths are relative to its working directory
+		FlushOutput();
+		int savedStdout = dup(STDOUT_FILENO), savedStderr = dup(STDERR_FILENO);
+		int savedCwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		dup2(fds[0], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		bool chdirFailed = fchdir(fds[2]) != 0;
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+
+		unsigned char status = 0;
+		if (chdirFailed)
+		{
+			mtp::error("error: cannot change to working directory of client: ", strerror(errno));
+			commands.clear();
+			status = 1;
+		}
+		std::stringstream ss(commands);
+		std::string command;
+		while(session.IsRunning() && std::getline(ss, command))
+		{
+			try
+			{ session.ProcessCommand(command); }
+			catch(const std::exception &ex)
+			{
+				mtp::error("error: ", ex.what());
+				status = 1;
+			}
+		}
+
+		FlushOutput();
+		dup2(savedStdout, STDOUT_FILENO);
+		dup2(savedStderr, STDERR_FILENO);
+		close(savedStdout);
+		close(savedStderr);
+		if (savedCwd >= 0)
+		{
+			if (fchdir(savedCwd) != 0)
+				mtp::debug("restoring working directory failed: ", strerror(errno));
+			close(savedCwd);
+		}
+		//client might have gone away, streams are usable for the next one
+		std::cout.clear();
+		std::cerr.clear();
+
+		try { WriteAll(client, reinterpret_cast<const char *>(&status), 1); }
+		catch(const std::exception &ex) { mtp::debug("sending status failed: ", ex.what()); }
+	}
+
+	void Daemon::Serve(Session &session, int idleTimeout)
+	{
+		signal(SIGPIPE, SIG_IGN); //clients may exit without reading their output
+		while(session.IsRunning())
+		{
+			pollfd pfd = { _fd, POLLIN, 0 };
+			int r = poll(&pfd, 1, idleTimeout * 1000);
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw mtp::posix::Exception("poll");
+			}
+			if (r == 0)
+			{
+				mtp::debug("no clients for ", idleTimeout, " seconds, exiting");
+				break;
+			}
+
+			int client = accept(_fd, NULL, NULL);
+			if (client < 0)
+				continue;
+			if (!IsOwnUser(client))
+			{
+				mtp::error("rejecting client of another user");
+				close(client);
+				continue;
+			}
+			Process(session, client);
+			close(client);
+		}
+	}
+}
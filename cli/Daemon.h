@@ -0,0 +1,59 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_CLI_DAEMON_H
+#define AFT_CLI_DAEMON_H
+
+#include <mtp/types.h>
+
+#include <string>
+
+namespace cli
+{
+	class Session;
+
+	class Daemon : mtp::Noncopyable //! serves command batches of thin clients over unix socket, so device setup is done once per session instead of once per invocation
+	{
+		std::string		_path;
+		int				_fd;
+
+		void Process(Session &session, int client);
+
+	public:
+		static const int DefaultIdleTimeout = 300; //seconds
+
+		///binds socket, stale socket of dead daemon is replaced, throws if another daemon listens on it
+		Daemon(const std::string &path);
+		~Daemon();
+
+		///socket in runtime directory or private directory in /tmp, one per user and device, throws if fallback directory is not private
+		static std::string GetSocketPath(const std::string &deviceId);
+
+		///runs batches of connected clients of the same user one by one, returns when no client connects for idleTimeout seconds or quit is received
+		void Serve(Session &session, int idleTimeout = DefaultIdleTimeout);
+
+		///returns connected socket or -1 if no daemon is listening
+		static int Connect(const std::string &path);
+
+		///sends newline separated commands along with stdout, stderr and working directory, so output goes directly to the caller and local paths are its own, returns exit status of the batch
+		static int Run(int fd, const std::string &commands);
+	};
+}
+
+#endif
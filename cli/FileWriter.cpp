@@ -0,0 +1,164 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <cli/FileWriter.h>
+#include <mtp/log.h>
+
+#include <errno.h>
+#include <string.h>
+
+namespace cli
+{
+	FileWriter::FileWriter(size_t maxQueuedSize):
+		_queuedSize(0), _pendingJobs(0), _maxQueuedSize(maxQueuedSize), _running(true),
+		_thread(&FileWriter::Run, this)
+	{ }
+
+	FileWriter::~FileWriter()
+	{
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			_running = false;
+			_jobAdded.notify_all();
+		}
+		_thread.join();
+	}
+
+	void FileWriter::Push(Job && job)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_jobDone.wait(l, [this]() { return !_error.empty() || _jobs.empty() || _queuedSize < _maxQueuedSize; });
+		if (!_error.empty())
+			throw std::runtime_error(_error);
+		_queuedSize += job.Data.size();
+		++_pendingJobs;
+		_jobs.push_back(std::move(job));
+		_jobAdded.notify_one();
+	}
+
+	void FileWriter::Close(File &file)
+	{
+		if (file.Fd < 0)
+			return;
+		if (file.Written < file.Preallocated)
+			ObjectOutputStream::Truncate(file.Fd, file.Written);
+		close(file.Fd);
+		file.Fd = -1;
+	}
+
+	void FileWriter::Process(Job &job, File &file)
+	{
+		switch(job.JobType)
+		{
+		case Job::MakeDirectory:
+			if (mkdir(job.Path.c_str(), 0700) != 0 && errno != EEXIST)
+				throw std::runtime_error("mkdir " + job.Path + " failed: " + strerror(errno));
+			break;
+		case Job::Open:
+			Close(file);
+			file = File();
+			file.Fd = open(job.Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (file.Fd < 0)
+				throw std::runtime_error("cannot open file: " + job.Path);
+			file.Path = job.Path;
+			if (ObjectOutputStream::Preallocate(file.Fd, job.Size))
+				file.Preallocated = job.Size;
+			break;
+		case Job::Write:
+			for(size_t offset = 0; offset < job.Data.size(); )
+			{
+				ssize_t r = write(file.Fd, job.Data.data() + offset, job.Data.size() - offset);
+				if (r < 0)
+					throw std::runtime_error("write " + file.Path + " failed: " + strerror(errno));
+				offset += r;
+				file.Written += r;
+			}
+			break;
+		case Job::Close:
+			Close(file);
+			if (job.ModificationTime)
+			{
+				try { ObjectOutputStream::SetModificationTime(file.Path, job.ModificationTime); }
+				catch(const std::exception &ex) { mtp::debug("setting mtime failed: ", ex.what()); }
+			}
+			break;
+		}
+	}
+
+	void FileWriter::Run()
+	{
+		File file;
+		std::unique_lock<std::mutex> l(_mutex);
+		while(true)
+		{
+			_jobAdded.wait(l, [this]() { return !_running || !_jobs.empty(); });
+			if (_jobs.empty())
+				break;
+
+			Job job(std::move(_jobs.front()));
+			_jobs.pop_front();
+			l.unlock();
+
+			std::string error;
+			try
+			{ Process(job, file); }
+			catch(const std::exception &ex)
+			{ error = ex.what(); }
+
+			l.lock();
+			_queuedSize -= job.Data.size();
+			--_pendingJobs;
+			if (!error.empty() && _error.empty())
+				_error = error;
+			_jobDone.notify_all();
+		}
+		Close(file);
+	}
+
+	size_t FileWriter::Stream::Write(const mtp::u8 *data, size_t size)
+	{
+		CheckCancelled();
+		Job job(Job::Write);
+		job.Data.assign(data, data + size);
+		_writer.Push(std::move(job));
+		Report(size);
+		return size;
+	}
+
+	void FileWriter::MakeDirectory(const std::string &path)
+	{ Push(Job(Job::MakeDirectory, path)); }
+
+	FileWriter::StreamPtr FileWriter::Open(const std::string &path, mtp::u64 size)
+	{
+		Job job(Job::Open, path);
+		job.Size = size;
+		Push(std::move(job));
+		return std::make_shared<Stream>(*this);
+	}
+
+	void FileWriter::Close(time_t mtime)
+	{ Push(Job(Job::Close, std::string(), mtime)); }
+
+	void FileWriter::Finish()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_jobDone.wait(l, [this]() { return !_error.empty() || _pendingJobs == 0; });
+		if (!_error.empty())
+			throw std::runtime_error(_error);
+	}
+}
@@ -0,0 +1,98 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_CLI_FILEWRITER_H
+#define AFT_CLI_FILEWRITER_H
+
+#include <cli/PosixStreams.h>
+#include <mtp/ByteArray.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cli
+{
+	class FileWriter : mtp::Noncopyable //! creates and writes local files in background thread, so downloads are not serialized with disk i/o
+	{
+		struct Job
+		{
+			enum Type { MakeDirectory, Open, Write, Close };
+
+			Type			JobType;
+			std::string		Path;
+			mtp::ByteArray	Data;
+			time_t			ModificationTime;
+			mtp::u64		Size; //expected file size for Open
+
+			Job(Type type, const std::string &path = std::string(), time_t mtime = 0): JobType(type), Path(path), ModificationTime(mtime), Size(0) { }
+		};
+
+		struct File //! file currently written by background thread
+		{
+			int				Fd;
+			std::string		Path;
+			mtp::u64		Written;
+			mtp::u64		Preallocated;
+
+			File(): Fd(-1), Written(0), Preallocated(0) { }
+		};
+
+		std::mutex					_mutex;
+		std::condition_variable		_jobAdded, _jobDone;
+		std::deque<Job>				_jobs;
+		size_t						_queuedSize;
+		size_t						_pendingJobs; //queued or being processed
+		size_t						_maxQueuedSize;
+		bool						_running;
+		std::string					_error;
+		std::thread					_thread;
+
+		void Push(Job && job);
+		void Process(Job &job, File &file);
+		static void Close(File &file);
+		void Run();
+
+	public:
+		class Stream final: public BaseObjectStream, public mtp::IObjectOutputStream //! output stream queueing data for \ref FileWriter
+		{
+			FileWriter &	_writer;
+
+		public:
+			Stream(FileWriter &writer): _writer(writer) { }
+
+			virtual size_t Write(const mtp::u8 *data, size_t size);
+		};
+		DECLARE_PTR(Stream);
+
+		FileWriter(size_t maxQueuedSize = 32 * 1024 * 1024);
+		~FileWriter();
+
+		void MakeDirectory(const std::string &path);
+		///creates or truncates file, following Write calls go into it, non-zero size preallocates disk space
+		StreamPtr Open(const std::string &path, mtp::u64 size = 0);
+		///closes current file, mtime is not changed if zero
+		void Close(time_t mtime);
+		///waits until all jobs are done, throws first error occured in writer thread
+		void Finish();
+	};
+}
+
+#endif
@@ -0,0 +1,146 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <cli/ListingWriter.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+
+namespace cli
+{
+	ListingWriter::~ListingWriter()
+	{
+		try
+		{ Flush(); }
+		catch(const std::exception &)
+		{ }
+	}
+
+	ListingWriter::Format ListingWriter::ParseFormat(const std::string &name)
+	{
+		if (name == "text")
+			return Format::Text;
+		else if (name == "jsonl")
+			return Format::Jsonl;
+		else if (name == "tsv")
+			return Format::Tsv;
+		else
+			throw std::runtime_error("invalid output format " + name + ", use text, jsonl or tsv");
+	}
+
+	void ListingWriter::Append(const std::string &data)
+	{
+		_buffer += data;
+		if (_buffer.size() >= BufferSize)
+			Flush();
+	}
+
+	void ListingWriter::AppendJson(const std::string &value)
+	{
+		std::string &out = _buffer;
+		out += '"';
+		for(char c : value)
+		{
+			switch(c)
+			{
+			case '"':	out += "\\\""; break;
+			case '\\':	out += "\\\\"; break;
+			case '\n':	out += "\\n"; break;
+			case '\r':	out += "\\r"; break;
+			case '\t':	out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+					out += buf;
+				}
+				else
+					out += c; //names are utf-8 already
+			}
+		}
+		out += '"';
+	}
+
+	void ListingWriter::AppendTsv(const std::string &value)
+	{
+		for(char c : value)
+		{
+			switch(c)
+			{
+			case '\\':	_buffer += "\\\\"; break;
+			case '\n':	_buffer += "\\n"; break;
+			case '\r':	_buffer += "\\r"; break;
+			case '\t':	_buffer += "\\t"; break;
+			default:	_buffer += c;
+			}
+		}
+	}
+
+	void ListingWriter::Write(const Entry &entry)
+	{
+		if (_format == Format::Jsonl)
+		{
+			_buffer += "{\"id\":" + std::to_string(entry.Id.Id);
+			if (entry.HasInfo)
+			{
+				_buffer += ",\"storage\":" + std::to_string(entry.StorageId.Id);
+				_buffer += ",\"format\":" + std::to_string(static_cast<unsigned>(entry.ObjectFormat));
+				_buffer += entry.ObjectFormat == mtp::ObjectFormat::Association? ",\"type\":\"dir\"": ",\"type\":\"file\"";
+				_buffer += ",\"size\":" + std::to_string(entry.Size);
+				_buffer += ",\"mtime\":" + std::to_string(static_cast<long long>(entry.ModificationTime));
+			}
+			_buffer += ",\"path\":";
+			AppendJson(entry.Path);
+			_buffer += "}\n";
+		}
+		else if (_format == Format::Tsv)
+		{
+			//fixed columns, so cut -f works on any listing: id, storage, format, size, mtime, path
+			_buffer += std::to_string(entry.Id.Id);
+			if (entry.HasInfo)
+			{
+				_buffer += '\t' + std::to_string(entry.StorageId.Id);
+				_buffer += '\t' + std::to_string(static_cast<unsigned>(entry.ObjectFormat));
+				_buffer += '\t' + std::to_string(entry.Size);
+				_buffer += '\t' + std::to_string(static_cast<long long>(entry.ModificationTime));
+			}
+			else
+				_buffer += "\t\t\t\t";
+			_buffer += '\t';
+			AppendTsv(entry.Path);
+			_buffer += '\n';
+		}
+		else
+			throw std::logic_error("ListingWriter::Write called in text format");
+
+		if (_buffer.size() >= BufferSize)
+			Flush();
+	}
+
+	void ListingWriter::Flush()
+	{
+		if (_buffer.empty())
+			return;
+		//cout is synchronised with stdio, so this stays ordered with mtp::print output
+		std::cout.write(_buffer.data(), _buffer.size());
+		std::cout.flush();
+		_buffer.clear();
+	}
+}
@@ -0,0 +1,88 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_CLI_LISTINGWRITER_H
+#define AFT_CLI_LISTINGWRITER_H
+
+#include <mtp/log.h>
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ObjectId.h>
+
+#include <sstream>
+#include <string>
+#include <time.h>
+
+namespace cli
+{
+	class ListingWriter : mtp::Noncopyable //! collects listing lines and writes them to stdout in large chunks instead of flushing every line, formats entries for scripts if asked
+	{
+	public:
+		enum struct Format { Text, Jsonl, Tsv };
+
+		struct Entry //! listed object, storage, format, size and time are valid only if HasInfo is set
+		{
+			mtp::ObjectId		Id;
+			mtp::StorageId		StorageId;
+			mtp::ObjectFormat	ObjectFormat;
+			mtp::u64			Size;
+			time_t				ModificationTime;
+			std::string			Path;
+			bool				HasInfo;
+
+			Entry(mtp::ObjectId id, const std::string &path): Id(id), ObjectFormat(mtp::ObjectFormat::Undefined), Size(0), ModificationTime(0), Path(path), HasInfo(false) { }
+		};
+
+		static const size_t BufferSize = 64 * 1024;
+
+	private:
+		Format		_format;
+		std::string	_buffer;
+
+		void Append(const std::string &data);
+		void AppendJson(const std::string &value);
+		void AppendTsv(const std::string &value);
+
+	public:
+		ListingWriter(Format format): _format(format) { }
+		~ListingWriter();
+
+		///parses text, jsonl or tsv, throws std::runtime_error otherwise
+		static Format ParseFormat(const std::string &name);
+
+		bool IsText() const
+		{ return _format == Format::Text; }
+
+		///writes entry as json object or tab separated line, must not be called in text format
+		void Write(const Entry &entry);
+
+		///formats one line of text output the same way mtp::print does
+		template<typename ... Args>
+		void WriteText(const Args & ... args)
+		{
+			std::ostringstream stream;
+			mtp::impl::Append(stream, args...);
+			stream << '\n';
+			Append(stream.str());
+		}
+
+		///writes buffered lines to stdout
+		void Flush();
+	};
+}
+
+#endif
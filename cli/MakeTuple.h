@@ -49,6 +49,10 @@ namespace cli
 		struct ValueConverter<mtp::u32> : StringStreamConverter<mtp::u32>
 		{ };
 
+		template<>
+		struct ValueConverter<mtp::u64> : StringStreamConverter<mtp::u64>
+		{ };
+
 		template<>
 		struct ValueConverter<std::string>
 		{
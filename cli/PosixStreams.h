@@ -26,6 +26,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -45,8 +46,8 @@ namespace cli
 		void SetProgressReporter(const decltype(_progressReporter) & pr)
 		{ _progressReporter = pr; }
 
-		void SetTotal(mtp::u64 total)
-		{ _current = 0; _total = total; }
+		void SetTotal(mtp::u64 total, mtp::u64 current = 0)
+		{ _current = current; _total = total; }
 
 	protected:
 		void Report(mtp::u64 delta)
@@ -65,6 +66,7 @@ namespace cli
 	{
 		int			_fd;
 		mtp::u64	_size;
+		time_t		_modificationTime;
 
 	public:
 		ObjectInputStream(const std::string &fname) : _fd(open(fname.c_str(), O_RDONLY))
@@ -76,6 +78,8 @@ namespace cli
 			if (stat(fname.c_str(), &st) != 0)
 				throw std::runtime_error("stat failed");
 			_size = st.st_size;
+			_modificationTime = st.st_mtime;
+			AdviseSequential(_fd);
 		}
 
 		~ObjectInputStream()
@@ -84,6 +88,16 @@ namespace cli
 		mtp::u64 GetSize() const
 		{ return _size; }
 
+		time_t GetModificationTime() const
+		{ return _modificationTime; }
+
+		///positions stream at offset of resumed upload
+		void Seek(mtp::u64 offset)
+		{
+			if (lseek(_fd, offset, SEEK_SET) < 0)
+				throw std::runtime_error("seek failed");
+		}
+
 		virtual size_t Read(mtp::u8 *data, size_t size)
 		{
 			CheckCancelled();
@@ -93,24 +107,48 @@ namespace cli
 			Report(r);
 			return r;
 		}
+
+		///lets kernel read ahead aggressively, file is read once from start to end
+		static void AdviseSequential(int fd)
+		{
+#ifdef HAVE_POSIX_FADVISE
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+			(void)fd;
+#endif
+		}
 	};
 
 	class ObjectOutputStream final:
 		public BaseObjectStream,
 		public mtp::IObjectOutputStream
 	{
-		int		_fd;
+		int			_fd;
+		mtp::u64	_written;
+		mtp::u64	_preallocated;
 
 	public:
-		ObjectOutputStream(const std::string &fname) :
-			_fd(open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644))
+		///append continues partial file left by interrupted download
+		ObjectOutputStream(const std::string &fname, bool append = false) :
+			_fd(open(fname.c_str(), O_WRONLY | O_CREAT | (append? O_APPEND: O_TRUNC), 0644)), _written(0), _preallocated(0)
 		{
 			if (_fd < 0)
 				throw std::runtime_error("cannot open file: " + fname);
 		}
 
 		~ObjectOutputStream()
-		{ close(_fd); }
+		{
+			if (_written < _preallocated)
+				Truncate(_fd, _written);
+			close(_fd);
+		}
+
+		///reserves disk space for object of known size, so file is not fragmented
+		void Preallocate(mtp::u64 size)
+		{
+			if (Preallocate(_fd, size))
+				_preallocated = size;
+		}
 
 		virtual size_t Write(const mtp::u8 *data, size_t size)
 		{
@@ -118,10 +156,40 @@ namespace cli
 			ssize_t r = write(_fd, data, size);
 			if (r < 0)
 				throw std::runtime_error("write failed");
+			_written += r;
 			Report(r);
 			return r;
 		}
 
+		///returns true if space was allocated, failure is not fatal
+		static bool Preallocate(int fd, mtp::u64 size)
+		{
+#ifdef HAVE_POSIX_FALLOCATE
+			return size != 0 && posix_fallocate(fd, 0, size) == 0;
+#else
+			(void)fd; (void)size;
+			return false;
+#endif
+		}
+
+		///drops preallocated space if object turned out to be shorter
+		static void Truncate(int fd, mtp::u64 size)
+		{
+			if (ftruncate(fd, size) != 0)
+				perror("ftruncate");
+		}
+
+		///returns length of partial file which download could be continued from, zero otherwise
+		///interrupted downloads get object mtime, so files modified since are not resumed
+		static mtp::u64 GetResumeOffset(const std::string &fname, mtp::u64 size, time_t mtime)
+		{
+			struct stat st;
+			if (mtime == 0 || stat(fname.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+				return 0;
+			mtp::u64 length = st.st_size;
+			return (length < size && st.st_mtime == mtime)? length: 0;
+		}
+
 		static void SetModificationTime(const std::string &fname, time_t mtime)
 		{
 			struct utimbuf buf = {};
@@ -132,6 +200,48 @@ namespace cli
 		}
 	};
 
+	class FileDescriptorOutputStream final:
+		public BaseObjectStream,
+		public mtp::IObjectOutputStream
+	{
+		int			_fd;
+		mtp::u64	_written;
+		mtp::u8		_last;
+
+	public:
+		///does not own fd, used for writing to stdout or pipe
+		FileDescriptorOutputStream(int fd): _fd(fd), _written(0), _last(0)
+		{ }
+
+		mtp::u64 GetWritten() const
+		{ return _written; }
+
+		///last byte written, zero if nothing was written
+		mtp::u8 GetLastByte() const
+		{ return _last; }
+
+		virtual size_t Write(const mtp::u8 *data, size_t size)
+		{
+			CheckCancelled();
+			for(size_t offset = 0; offset < size; )
+			{
+				ssize_t r = write(_fd, data + offset, size - offset);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw mtp::system_error("write");
+				}
+				offset += r;
+			}
+			if (size)
+				_last = data[size - 1];
+			_written += size;
+			Report(size);
+			return size;
+		}
+	};
+
 }
 
 #endif
@@ -23,26 +23,29 @@
 #include <string>
 #include <mtp/types.h>
 #include <mtp/log.h>
+#include <mtp/ptp/ProgressThrottle.h>
+#include <mtp/ptp/ThroughputEstimator.h>
 #include <stdio.h>
+#include <cmath>
 
 namespace cli
 {
-	class EventProgressBar
+	class EventProgressBar //! machine-readable progress: title, offset, total, bytes per second and seconds left (-1 if not known yet)
 	{
-		std::string		_title;
-		int				_steps;
-		mtp::u64		_current;
+		std::string					_title;
+		mtp::ProgressThrottle		_throttle;
+		mtp::ThroughputEstimator	_throughput;
 
 	public:
-		EventProgressBar(const std::string &title, int steps = 1000): _title(title), _steps(steps), _current(0) { }
+		EventProgressBar(const std::string &title, int steps = 1000): _title(title), _throttle(mtp::ProgressThrottle::DefaultIntervalMs, steps) { }
 
 		void operator()(mtp::u64 offset, mtp::u64 total)
 		{
-			auto current = offset * _steps / total;
-			if (current != _current || offset >= total)
+			_throughput.Update(offset);
+			if (_throttle.Update(offset, total))
 			{
-				_current = current;
-				mtp::print(":progress ", _title, " ", offset, " ", total);
+				double eta = _throughput.GetEta(total);
+				mtp::print(":progress ", _title, " ", offset, " ", total, " ", static_cast<mtp::u64>(_throughput.GetRate()), " ", eta >= 0? static_cast<long long>(std::ceil(eta)): -1);
 			}
 		}
 
@@ -51,16 +54,53 @@ namespace cli
 	class ProgressBar
 	{
 		static const unsigned Junk = 9;
+		static const unsigned RateJunk = 22; //"1023.9 KiB/s 99:59:59 "
 
 		std::string _title;
 		int			_width;
 		int			_maxWidth;
 		unsigned	_percentage;
+		bool		_showRate;
+		mtp::ProgressThrottle _throttle;
+		mtp::ThroughputEstimator _throughput;
+
+		void PrintRate(mtp::u64 total)
+		{
+			static const char * units[] = { "B", "KiB", "MiB", "GiB" };
+			double rate = _throughput.GetRate();
+			unsigned unit = 0;
+			while(rate >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0]))
+			{
+				rate /= 1024;
+				++unit;
+			}
+			if (_throughput.IsValid())
+				printf("%6.1f %-3s/s ", rate, units[unit]);
+			else
+				printf("%12s ", "");
+
+			double eta = _throughput.GetEta(total);
+			char buf[16] = "--:--";
+			if (eta >= 0)
+			{
+				mtp::u64 seconds = static_cast<mtp::u64>(std::ceil(eta));
+				if (seconds >= 360000)
+					snprintf(buf, sizeof(buf), ">99h");
+				else if (seconds >= 3600)
+					snprintf(buf, sizeof(buf), "%u:%02u:%02u", unsigned(seconds / 3600), unsigned(seconds / 60 % 60), unsigned(seconds % 60));
+				else
+					snprintf(buf, sizeof(buf), "%u:%02u", unsigned(seconds / 60), unsigned(seconds % 60));
+			}
+			printf("%8s ", buf);
+		}
 
 	public:
-		ProgressBar(const std::string & title, int w, int max): _width(w), _percentage(-1)
+		ProgressBar(const std::string & title, int w, int max): _width(w), _percentage(-1), _throttle(mtp::ProgressThrottle::DefaultIntervalMs, 100)
 		{
-			_maxWidth = max - _width - Junk;
+			_maxWidth = max - _width - Junk - RateJunk;
+			_showRate = _maxWidth >= 1;
+			if (!_showRate)
+				_maxWidth += RateJunk; //rate and eta are dropped first on narrow terminals
 			if (_maxWidth < 1)
 				throw std::runtime_error("insufficient space for progress bar");
 
@@ -77,8 +117,9 @@ namespace cli
 
 		void operator()(mtp::u64 current, mtp::u64 total)
 		{
+			_throughput.Update(current);
 			unsigned percentage = total? current * 100 / total: 100;
-			if (_percentage != percentage)
+			if (_percentage != percentage && _throttle.Update(current, total))
 			{
 				_percentage = percentage;
 				printf("%3u%% [", percentage );
@@ -89,7 +130,10 @@ namespace cli
 				while(spaces--)
 					fputc(' ', stdout);
 
-				printf("] %s\n\033[1A\033[2K", _title.c_str());
+				printf("] ");
+				if (_showRate)
+					PrintRate(total);
+				printf("%s\n\033[1A\033[2K", _title.c_str());
 			}
 		}
 	};
@@ -22,21 +22,34 @@
 #include <cli/PosixStreams.h>
 #include <cli/ProgressBar.h>
 #include <cli/Tokenizer.h>
+#include <cli/UploadCheckpoint.h>
+
+#include <mtp/backend/posix/DirectoryScanner.h>
 
 #include <mtp/make_function.h>
+#include <mtp/ptp/AsyncObjectInputStream.h>
+#include <mtp/ptp/AsyncObjectOutputStream.h>
 #include <mtp/ptp/ByteArrayObjectStream.h>
+#include <mtp/ptp/DeviceCopier.h>
+#include <mtp/ptp/HashingObjectStream.h>
 #include <mtp/ptp/ObjectPropertyListParser.h>
+#include <mtp/ptp/ThumbnailFetcher.h>
 #include <mtp/log.h>
 #include <mtp/version.h>
+#include <usb/Device.h>
+#include <chrono>
+#include <fstream>
 
 #include <sstream>
 #include <set>
 
 #include <string.h>
+#include <fnmatch.h>
+#include <glob.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
-#include <dirent.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
 
@@ -50,6 +63,103 @@ namespace
 		const char *b = prefix.c_str();
 		return strncasecmp(a, b, prefix.size()) == 0;
 	}
+
+	mtp::u64 ParseSize(const std::string &str)
+	{
+		char *end;
+		mtp::u64 size = strtoull(str.c_str(), &end, 10);
+		switch(*end)
+		{
+		case 'k': case 'K': size <<= 10; ++end; break;
+		case 'm': case 'M': size <<= 20; ++end; break;
+		case 'g': case 'G': size <<= 30; ++end; break;
+		}
+		if (end == str.c_str() || *end)
+			throw std::runtime_error("invalid size: " + str);
+		return size;
+	}
+
+	time_t ParseDate(const std::string &str)
+	{
+		struct tm time = {};
+		const char *end = strptime(str.c_str(), "%Y-%m-%d", &time);
+		if (!end || *end)
+			throw std::runtime_error("invalid date " + str + ", expected YYYY-MM-DD");
+		time.tm_isdst = -1;
+		return mktime(&time);
+	}
+
+	///accepts file extension or hex format code
+	mtp::ObjectFormat ParseFormat(const std::string &str)
+	{
+		mtp::ObjectFormat format = mtp::ParseObjectFormat(str);
+		if (format == mtp::ObjectFormat::Undefined)
+			throw std::runtime_error("unknown format " + str);
+		return format;
+	}
+
+	cli::ListingWriter::Entry MakeListingEntry(const mtp::ObjectTree::Object &object, const std::string &path)
+	{
+		cli::ListingWriter::Entry entry(object.Id, path);
+		entry.StorageId = object.StorageId;
+		entry.ObjectFormat = object.Format;
+		entry.Size = object.Size;
+		entry.ModificationTime = object.ModificationTime;
+		entry.HasInfo = true;
+		return entry;
+	}
+
+	struct FindFilter //! predicates of find command, parsed from comma separated list
+	{
+		mtp::ObjectFormat	Format;
+		int					Type; //'f', 'd' or 0 for any
+		mtp::u64			MinSize, MaxSize;
+		time_t				Newer, Older;
+
+		FindFilter(const std::string &filter): Format(mtp::ObjectFormat::Any), Type(0), MinSize(0), MaxSize(~0ull), Newer(0), Older(0)
+		{
+			std::stringstream ss(filter);
+			std::string item;
+			while(std::getline(ss, item, ','))
+			{
+				if (item.empty())
+					continue;
+				if (BeginsWith(item, "type=") && (item == "type=f" || item == "type=d"))
+					Type = item[5];
+				else if (BeginsWith(item, "format="))
+					Format = ParseFormat(item.substr(7));
+				else if (BeginsWith(item, "size>"))
+					MinSize = ParseSize(item.substr(5)) + 1;
+				else if (BeginsWith(item, "size<"))
+				{
+					mtp::u64 size = ParseSize(item.substr(5));
+					if (!size)
+						throw std::runtime_error("size<0 never matches");
+					MaxSize = size - 1;
+				}
+				else if (BeginsWith(item, "newer="))
+					Newer = ParseDate(item.substr(6));
+				else if (BeginsWith(item, "older="))
+					Older = ParseDate(item.substr(6));
+				else
+					throw std::runtime_error("invalid find filter " + item + ", expected type=f|d, format=<ext|hex>, size>N, size<N, newer=YYYY-MM-DD or older=YYYY-MM-DD");
+			}
+		}
+
+		bool Matches(const mtp::ObjectTree::Object &object) const
+		{
+			bool directory = object.Format == mtp::ObjectFormat::Association;
+			if ((Type == 'f' && directory) || (Type == 'd' && !directory))
+				return false;
+			if (Format != mtp::ObjectFormat::Any && object.Format != Format)
+				return false;
+			if (object.Size < MinSize || object.Size > MaxSize)
+				return false;
+			if ((Newer && object.ModificationTime < Newer) || (Older && object.ModificationTime >= Older))
+				return false;
+			return true;
+		}
+	};
 }
 
 
@@ -65,9 +175,11 @@ namespace cli
 		_running(true),
 		_interactive(isatty(STDOUT_FILENO)),
 		_showEvents(false),
+		_outputFormat(ListingWriter::Format::Text),
 		_showPrompt(showPrompt),
 		_terminalWidth(80),
-		_batterySupported(false)
+		_batterySupported(false),
+		_indicesStale(false)
 	{
 		using namespace mtp;
 		using namespace std::placeholders;
@@ -85,6 +197,8 @@ namespace cli
 #endif
 		}
 
+		_session->GetStats().SetEnabled(true);
+
 		AddCommand("help", "shows this help",
 			make_function([this]() -> void { Help(); }));
 
@@ -108,23 +222,56 @@ namespace cli
 		AddCommand("lsext-r", "<path> lists objects in <path> [extended info, recursive]",
 			make_function([this](const Path &path) -> void { List(path, true, true); }));
 
-		AddCommand("put", "put <file> <dir> uploads file to directory",
+		AddCommand("find", "<path> <pattern> lists objects below <path> with names matching glob <pattern>",
+			make_function([this](const Path &path, const std::string &pattern) -> void { Find(path, pattern, std::string()); }));
+		AddCommand("find", "<path> <pattern> <filter> also filters by comma separated type=f|d, format=<ext|hex>, size>N, size<N, newer=YYYY-MM-DD, older=YYYY-MM-DD",
+			make_function([this](const Path &path, const std::string &pattern, const std::string &filter) -> void { Find(path, pattern, filter); }));
+		AddCommand("output-format", "<text|jsonl|tsv> sets format of ls, lsext and find output, jsonl and tsv are meant for scripts",
+			make_function([this](const std::string &format) -> void { _outputFormat = ListingWriter::ParseFormat(format); }));
+		AddCommand("du", "shows sizes of directories below current one",
+			make_function([this]() -> void { DiskUsage(Path(".")); }));
+		AddCommand("du", "<path> shows sizes of directories below <path>",
+			make_function([this](const Path &path) -> void { DiskUsage(path); }));
+
+		AddCommand("format", "<formats> lists, finds and downloads only directories and objects of comma separated formats (extensions or hex codes)",
+			make_function([this](const std::string &formats) -> void { SetFormats(formats); }));
+		AddCommand("format-reset", "lists and downloads objects of any format",
+			make_function([this]() -> void { SetFormats(std::string()); }));
+
+		AddCommand("put", "put <file> <dir> uploads file to directory, <file> may contain wildcards",
 			make_function([this](const LocalPath &path, const Path &dst) -> void { Put(path, dst); }));
-		AddCommand("put", "<file> uploads file",
+		AddCommand("put", "<file> uploads file, wildcards upload all matches",
 			make_function([this](const LocalPath &path) -> void { Put(path); }));
 
-		AddCommand("get", "<file> downloads file",
+		AddCommand("get", "<file> downloads file, wildcards in any path component download all matches",
 			make_function([this](const Path &path) -> void { Get(path); }));
-		AddCommand("get", "<file> <dst> downloads file to <dst>",
+		AddCommand("get", "<file> <dst> downloads file to <dst>, wildcard matches go into <dst> directory",
 			make_function([this](const Path &path, const LocalPath &dst) -> void { Get(dst, path); }));
+		AddCommand("get-checksum", "<file> downloads file and prints its crc32c",
+			make_function([this](const Path &path) -> void { Get(path, true); }));
+		AddCommand("get-checksum", "<file> <dst> downloads file to <dst> and prints crc32c of each downloaded file",
+			make_function([this](const Path &path, const LocalPath &dst) -> void { Get(dst, path, true); }));
+
+		AddCommand("export-tar", "<path> <dst> streams file or directory tree as tar archive to <dst>, - for stdout",
+			make_function([this](const Path &path, const LocalPath &dst) -> void { ExportTar(path, dst); }));
+		AddCommand("import-tar", "<src> <dir> uploads contents of tar archive <src>, - for stdin, into <dir>",
+			make_function([this](const LocalPath &src, const Path &dst) -> void { ImportTar(src, dst); }));
+		AddCommand("copy-device", "<path> <device>:<dir> copies file or directory tree to <dir> of another device given by serial number or usb bus path, without temporary files",
+			make_function([this](const Path &src, const std::string &dst) -> void { CopyDevice(src, dst); }));
 
 		AddCommand("get-thumb", "<file> downloads thumbnail for file",
 			make_function([this](const Path &path) -> void { GetThumb(path); }));
 		AddCommand("get-thumb", "<file> <dst> downloads thumbnail to <dst>",
 			make_function([this](const Path &path, const LocalPath &dst) -> void { GetThumb(dst, path); }));
+		AddCommand("get-thumb-r", "<dir> <dst> downloads thumbnails of all images and videos below <dir> into <dst>, keeping directory structure",
+			make_function([this](const Path &path, const LocalPath &dst) -> void { GetThumbTree(path, dst); }));
 
-		AddCommand("cat", "<file> outputs file",
+		AddCommand("cat", "<file> outputs file, wildcard matches are concatenated",
 			make_function([this](const Path &path) -> void { Cat(path); }));
+		AddCommand("cat", "<file> <offset> outputs file starting from <offset>",
+			make_function([this](const Path &path, mtp::u64 offset) -> void { Cat(path, offset, 0); }));
+		AddCommand("cat", "<file> <offset> <length> outputs <length> bytes of file starting from <offset>",
+			make_function([this](const Path &path, mtp::u64 offset, mtp::u64 length) -> void { Cat(path, offset, length); }));
 
 		AddCommand("quit", "quits program",
 			make_function([this]() -> void { Quit(); }));
@@ -137,7 +284,7 @@ namespace cli
 			make_function([this](const StoragePath &path) -> void { ChangeStorage(path); }));
 		AddCommand("pwd", "resolved current object directory",
 			make_function([this]() -> void { CurrentDirectory(); }));
-		AddCommand("rm", "<path> removes object (WARNING: RECURSIVE, be careful!)",
+		AddCommand("rm", "<path> removes object or wildcard matches (WARNING: RECURSIVE, be careful!)",
 			make_function([this](const LocalPath &path) -> void { Delete(path); }));
 		AddCommand("mkdir", "<path> makes directory",
 			make_function([this](const Path &path) -> void { MakeDirectory(path); }));
@@ -148,6 +295,22 @@ namespace cli
 
 		AddCommand("rename", "renames object",
 			make_function([this](const Path & path, const std::string & newName) -> void { Rename(path, newName); }));
+		AddCommand("sync", "<remote> <local> downloads new and changed objects from <remote> to <local> directory",
+			make_function([this](const Path &remote, const LocalPath &local) -> void { Sync(remote, local, false, false); }));
+		AddCommand("sync-dry-run", "<remote> <local> lists objects sync would download",
+			make_function([this](const Path &remote, const LocalPath &local) -> void { Sync(remote, local, false, true); }));
+		AddCommand("sync-up", "<local> <remote> uploads new and changed files from <local> to <remote> directory",
+			make_function([this](const LocalPath &local, const Path &remote) -> void { Sync(remote, local, true, false); }));
+		AddCommand("sync-up-dry-run", "<local> <remote> lists files sync-up would upload",
+			make_function([this](const LocalPath &local, const Path &remote) -> void { Sync(remote, local, true, true); }));
+		AddCommand("manifest", "<file> runs get <remote> [<local>] and put <local> [<remote dir>] lines of file, listing each remote directory once",
+			make_function([this](const LocalPath &path) -> void { RunManifest(path); }));
+		AddCommand("rename-list", "<file> renames objects listed as <path> <new name> lines of file, in batched property updates",
+			make_function([this](const LocalPath &path) -> void { RunRenameList(path); }));
+		AddCommand("cp", "<src> <dst> copies object on device (recursive for directories)",
+			make_function([this](const Path & src, const Path & dst) -> void { Copy(src, dst, false); }));
+		AddCommand("mv", "<src> <dst> moves object on device",
+			make_function([this](const Path & src, const Path & dst) -> void { Copy(src, dst, true); }));
 		AddCommand("storage-list", "shows available MTP storages",
 			make_function([this]() -> void { ListStorages(); }));
 		AddCommand("properties", "<path> lists properties for <path>",
@@ -158,6 +321,14 @@ namespace cli
 			make_function([this]() -> void { DisplayDeviceInfo(); }));
 		AddCommand("storage-info", "<storage-id> displays storage information",
 			make_function([this](const StoragePath &path) -> void { DisplayStorageInfo(path); }));
+		AddCommand("stats", "shows per-operation transaction statistics",
+			make_function([this]() -> void { DisplayStats(); }));
+		AddCommand("stats-reset", "resets transaction statistics",
+			make_function([this]() -> void { _session->GetStats().Reset(); }));
+		AddCommand("usb-trace", "<records> keeps last <records> urb submit/reap events, 0 stops tracing",
+			make_function([this](mtp::u32 records) -> void { GetUsbDevice()->SetTraceCapacity(records); }));
+		AddCommand("usb-trace-dump", "<file> writes traced urbs to <file> in chrome trace format (chrome://tracing, ui.perfetto.dev)",
+			make_function([this](const LocalPath &path) -> void { DumpUsbTrace(path); }));
 
 		AddCommand("test-property-list", "test GetObjectPropList on given object",
 			make_function([this](const Path &path) -> void { TestObjectPropertyList(path); }));
@@ -174,12 +345,14 @@ namespace cli
 
 	bool Session::SetFirstStorage()
 	{
+		auto started = mtp::StartupTimings::Clock::now();
 		auto ids = _session->GetStorageIDs();
 		if (ids.StorageIDs.empty())
 			return false;
 
 		auto id = std::to_string(ids.StorageIDs.front().Id);
 		ChangeStorage(StoragePath(id));
+		_session->GetStartupTimings().Record("storages", started);
 		return true;
 	}
 
@@ -260,6 +433,13 @@ namespace cli
 		if (tokens.empty())
 			throw std::runtime_error("no token passed to ProcessCommand");
 
+		if (_indicesStale.exchange(false))
+		{
+			_childrenIndex.clear();
+			_directoryIndex.clear();
+			_storageNames.clear();
+		}
+
 		std::string cmdName = tokens.front();
 		tokens.pop_front();
 		auto b = _commands.lower_bound(cmdName);
@@ -281,6 +461,15 @@ namespace cli
 		throw std::runtime_error("invalid argument count (" + std::to_string(args) + ")");
 	}
 
+	void Session::SubscribeEvents()
+	{
+		_session->SubscribeEvents([this](const mtp::Event &event)
+		{
+			if (event.Code != mtp::EventCode::DevicePropChanged)
+				_indicesStale = true;
+		});
+	}
+
 	void Session::UpdatePrompt()
 	{
 		if (_showPrompt)
@@ -356,19 +545,110 @@ namespace cli
 			print("");
 	}
 
-	mtp::ObjectId Session::ResolveObjectChild(mtp::ObjectId parent, const std::string &entity)
+	Session::ChildrenIndex & Session::GetChildrenIndex(mtp::ObjectId parent)
+	{
+		using namespace mtp;
+		auto i = _childrenIndex.find(parent);
+		if (i != _childrenIndex.end())
+			return i->second;
+
+		ChildrenIndex index;
+		bool filled = false;
+		if (_session->GetObjectPropertyListSupported())
+		{
+			try
+			{
+				//root lists contain objects from all storages
+				bool filterStorage = parent == mtp::Session::Root && _cs != mtp::Session::AllStorages;
+				std::set<ObjectId> storageObjects;
+				if (filterStorage)
+				{
+					ByteArray data = _session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::StorageId, 0, 1);
+					ObjectPropertyListParser<u32> parser;
+					parser.Parse(data, [this, &storageObjects](ObjectId objectId, ObjectProperty property, u32 storageId)
+					{
+						if (storageId == _cs.Id)
+							storageObjects.insert(objectId);
+					});
+				}
+
+				ByteArray data = _session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::ObjectFilename, 0, 1);
+				ObjectPropertyListParser<std::string> parser;
+				parser.Parse(data, [&](ObjectId objectId, ObjectProperty property, const std::string &name)
+				{
+					if (!filterStorage || storageObjects.find(objectId) != storageObjects.end())
+						index.emplace(name, objectId);
+				});
+				filled = true;
+			}
+			catch(const std::exception &ex)
+			{
+				debug("GetObjectPropList failed: ", ex.what());
+				index.clear();
+			}
+		}
+
+		if (!filled)
+		{
+			auto objectList = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Any, parent);
+			for(auto object : objectList.ObjectHandles)
+				index.emplace(_session->GetObjectStringProperty(object, mtp::ObjectProperty::ObjectFilename), object);
+		}
+		return _childrenIndex.emplace(parent, std::move(index)).first->second;
+	}
+
+	const std::set<mtp::ObjectId> & Session::GetDirectoryIndex(mtp::ObjectId parent)
+	{
+		auto i = _directoryIndex.find(parent);
+		if (i != _directoryIndex.end())
+			return i->second;
+
+		//one request instead of format query per child
+		auto objectList = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Association, parent);
+		std::set<mtp::ObjectId> directories(objectList.ObjectHandles.begin(), objectList.ObjectHandles.end());
+		return _directoryIndex.emplace(parent, std::move(directories)).first->second;
+	}
+
+	void Session::AddChild(mtp::ObjectId parent, const std::string &name, mtp::ObjectId id, bool directory)
+	{
+		auto i = _childrenIndex.find(parent);
+		if (i != _childrenIndex.end())
+			i->second[name] = id;
+
+		auto d = _directoryIndex.find(parent);
+		if (directory && d != _directoryIndex.end())
+			d->second.insert(id);
+	}
+
+	void Session::InvalidateChildren(mtp::ObjectId parent)
+	{
+		_childrenIndex.erase(parent);
+		_directoryIndex.erase(parent);
+	}
+
+	void Session::RemoveChild(mtp::ObjectId id)
 	{
-		//fixme: replace with prop list!
-		auto objectList = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Any, parent);
-		for(auto object : objectList.ObjectHandles)
+		for(auto &index : _childrenIndex)
 		{
-			std::string name = _session->GetObjectStringProperty(object, mtp::ObjectProperty::ObjectFilename);
-			if (name == entity)
+			for(auto i = index.second.begin(); i != index.second.end(); )
 			{
-				return object;
+				if (i->second == id)
+					i = index.second.erase(i);
+				else
+					++i;
 			}
 		}
-		throw std::runtime_error("could not find " + entity + " in path");
+		for(auto &index : _directoryIndex)
+			index.second.erase(id);
+	}
+
+	mtp::ObjectId Session::ResolveObjectChild(mtp::ObjectId parent, const std::string &entity)
+	{
+		const ChildrenIndex &index = GetChildrenIndex(parent);
+		auto i = index.find(entity);
+		if (i == index.end())
+			throw std::runtime_error("could not find " + entity + " in path");
+		return i->second;
 	}
 
 	mtp::ObjectId Session::Resolve(const Path &path, bool create)
@@ -408,6 +688,82 @@ namespace cli
 		return id;
 	}
 
+	std::vector<Session::GlobMatch> Session::Glob(const Path &path)
+	{
+		GlobMatch start;
+		start.Parent = mtp::Session::Device;
+		start.Id = BeginsWith(path, "/")? mtp::Session::Root: _cd;
+		std::vector<GlobMatch> matches(1, start);
+		for(size_t p = 0; p < path.size() && !matches.empty(); )
+		{
+			size_t next = path.find('/', p);
+			if (next == path.npos)
+				next = path.size();
+			bool last = next >= path.size() || path.find_first_not_of('/', next) == path.npos;
+
+			std::string entity(path.substr(p, next - p));
+			p = next + 1;
+			if (entity.empty() || entity == ".")
+				continue;
+
+			std::vector<GlobMatch> children;
+			for(auto &match : matches)
+			{
+				if (entity == "..")
+				{
+					GlobMatch parent;
+					parent.Id = _session->GetObjectParent(match.Id);
+					if (parent.Id == mtp::Session::Device)
+						parent.Id = mtp::Session::Root;
+					children.push_back(parent);
+					continue;
+				}
+				//only directories are descended into, their handles come with one request per parent
+				const std::set<mtp::ObjectId> *directories = last? nullptr: &GetDirectoryIndex(match.Id);
+				const ChildrenIndex &index = GetChildrenIndex(match.Id);
+				auto add = [&](const ChildrenIndex::value_type &child)
+				{
+					if (directories && !directories->count(child.second))
+						return;
+					GlobMatch m;
+					m.Parent = match.Id;
+					m.Id = child.second;
+					m.Name = child.first;
+					children.push_back(m);
+				};
+				if (IsGlob(entity))
+				{
+					for(auto &child : index)
+						if (fnmatch(entity.c_str(), child.first.c_str(), FNM_PERIOD) == 0)
+							add(child);
+				}
+				else
+				{
+					auto child = index.find(entity);
+					if (child != index.end())
+						add(*child);
+				}
+			}
+			matches.swap(children);
+		}
+		if (matches.empty())
+			throw std::runtime_error("no objects match " + path);
+		return matches;
+	}
+
+	std::vector<std::string> Session::GlobLocal(const LocalPath &pattern)
+	{
+		glob_t paths = {};
+		int r = glob(pattern.c_str(), 0, nullptr, &paths);
+		if (r == GLOB_NOMATCH)
+			throw std::runtime_error("no files match " + pattern);
+		else if (r != 0)
+			throw std::runtime_error("glob " + pattern + " failed");
+		std::vector<std::string> result(paths.gl_pathv, paths.gl_pathv + paths.gl_pathc);
+		globfree(&paths);
+		return result;
+	}
+
 	std::string Session::GetFilename(const std::string &path)
 	{
 		size_t pos = path.rfind('/');
@@ -437,6 +793,17 @@ namespace cli
 			timespec.substr(13, 2);
 	}
 
+	std::string Session::FormatTime(time_t time)
+	{
+		struct tm bdt = {};
+		if (!time || !localtime_r(&time, &bdt))
+			return FormatTime(std::string());
+
+		char buf[32];
+		size_t r = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &bdt);
+		return std::string(buf, r);
+	}
+
 	mtp::ObjectId Session::ResolvePath(const std::string &path, std::string &file)
 	{
 		size_t pos = path.rfind('/');
@@ -469,52 +836,121 @@ namespace cli
 	}
 
 
-	void Session::List(mtp::ObjectId parent, bool extended, bool recursive, const std::string &prefix)
+	void Session::ListTree(ListingWriter &writer, const mtp::ObjectTree &tree, mtp::ObjectId parent, bool extended, const std::string &prefix)
 	{
 		using namespace mtp;
-		if (!extended && !recursive && _cs == mtp::Session::AllStorages && _session->GetObjectPropertyListSupported())
+		tree.ForEachChild(parent, [&](const ObjectTree::Object &object)
 		{
-			ByteArray data = _session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::ObjectFilename, 0, 1);
-			ObjectPropertyListParser<std::string> parser;
-			//HexDump("list", data, true);
-			parser.Parse(data, [&prefix](ObjectId objectId, ObjectProperty property, const std::string &name)
-			{
-				print(std::left, width(objectId, 10), " ", prefix + name);
-			});
-		}
-		else
+			ObjectId objectId = object.Id;
+			std::string name = tree.GetName(object);
+			if (!writer.IsText())
+				writer.Write(MakeListingEntry(object, prefix + name));
+			else if (extended)
+				writer.WriteText(
+					std::left,
+					width(objectId, 10), " ",
+					width(object.StorageId.Id, 10), " ",
+					std::right,
+					hex(object.Format, 4), " ",
+					width(object.Size, 10), " ",
+					std::left,
+					width(FormatTime(object.CreationTime? object.CreationTime: object.ModificationTime), 20), " ",
+					prefix + name, " "
+				);
+			else
+				writer.WriteText(std::left, width(objectId, 10), " ", prefix + name);
+
+			if (object.Format == mtp::ObjectFormat::Association)
+				ListTree(writer, tree, objectId, extended, prefix + name + "/");
+		});
+	}
+
+	void Session::Find(const Path &path, const std::string &pattern, const std::string &filterList)
+	{
+		using namespace mtp;
+		FindFilter filter(filterList);
+		ObjectId root = Resolve(path);
+		ObjectTree::Formats formats(_formats);
+		if (filter.Format != ObjectFormat::Any)
 		{
-			msg::ObjectHandles handles = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Any, parent);
+			if (!formats.empty() && std::find(formats.begin(), formats.end(), filter.Format) == formats.end())
+				return; //excluded by format command
+			formats.assign(1, filter.Format);
+		}
+		ObjectTree tree(_session);
+		//directories are kept by format filter, so paths are still known
+		tree.Enumerate(_cs, root, formats);
 
-			for(auto objectId : handles.ObjectHandles)
+		ListingWriter writer(_outputFormat);
+		std::function<void (ObjectId, const std::string &)> walk = [&](ObjectId parent, const std::string &prefix)
+		{
+			tree.ForEachChild(parent, [&](const ObjectTree::Object &object)
 			{
-				try
+				std::string name = tree.GetName(object);
+				if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0 && filter.Matches(object))
 				{
-					msg::ObjectInfo info = _session->GetObjectInfo(objectId);
-					if (extended)
-						print(
-							std::left,
-							width(objectId, 10), " ",
-							width(info.StorageId.Id, 10), " ",
-							std::right,
-							hex(info.ObjectFormat, 4), " ",
-							width(info.ObjectCompressedSize, 10), " ",
-							std::left,
-							width(!info.CaptureDate.empty()? FormatTime(info.CaptureDate): FormatTime(info.ModificationDate), 20), " ",
-							prefix + info.Filename, " "
-						);
+					if (writer.IsText())
+						writer.WriteText(std::left, width(object.Id, 10), " ", width(object.Size, 12), " ", width(FormatTime(object.ModificationTime), 20), " ", prefix + name);
 					else
-						print(std::left, width(objectId, 10), " ", prefix + info.Filename);
-
-					if (recursive && info.ObjectFormat == mtp::ObjectFormat::Association)
-						List(objectId, extended, recursive, prefix + info.Filename + "/");
-				}
-				catch(const std::exception &ex)
-				{
-					mtp::error("error: ", ex.what());
+						writer.Write(MakeListingEntry(object, prefix + name));
 				}
-			}
+				if (object.Format == ObjectFormat::Association)
+					walk(object.Id, prefix + name + "/");
+			});
+		};
+		walk(root, std::string());
+	}
+
+	void Session::DiskUsage(const Path &path)
+	{
+		using namespace mtp;
+		ObjectId root = Resolve(path);
+		ObjectTree tree(_session);
+		tree.Enumerate(_cs, root, _formats);
+
+		//directories are printed after their content, like du does
+		std::function<u64 (ObjectId, const std::string &)> walk = [&](ObjectId parent, const std::string &dir) -> u64
+		{
+			u64 total = 0;
+			tree.ForEachChild(parent, [&](const ObjectTree::Object &object)
+			{
+				if (object.Format == ObjectFormat::Association)
+					total += walk(object.Id, (dir.empty()? std::string(): dir + "/") + tree.GetName(object));
+				else
+					total += object.Size;
+			});
+			print(std::left, width(total, 14), " ", dir.empty()? std::string("."): dir);
+			return total;
+		};
+		walk(root, std::string());
+	}
+
+	void Session::List(mtp::ObjectId parent, bool extended, bool recursive, const std::string &prefix)
+	{
+		using namespace mtp;
+		ListingWriter writer(_outputFormat);
+		if (!recursive && !extended && _cs == mtp::Session::AllStorages && _formats.empty() && _session->GetObjectPropertyListSupported())
+		{
+			//names are written while the list is still being received
+			auto stream = std::make_shared<ObjectPropertyListStream<std::string>>([&writer, &prefix](ObjectId objectId, ObjectProperty property, const std::string &name)
+			{
+				if (writer.IsText())
+					writer.WriteText(std::left, width(objectId, 10), " ", prefix + name);
+				else
+					writer.Write(ListingWriter::Entry(objectId, prefix + name));
+			});
+			_session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::ObjectFilename, 0, 1, stream);
+			stream->Finish();
+			return;
 		}
+
+		//one property list per tree or per level, with 64-bit sizes, GetObjectInfo per object only if device has no property lists
+		ObjectTree tree(_session);
+		if (recursive)
+			tree.Enumerate(_cs, parent, _formats);
+		else
+			tree.EnumerateChildren(_cs, parent, _formats);
+		ListTree(writer, tree, parent, extended, prefix);
 	}
 
 	void Session::CompletePath(const Path &path, CompletionResult &result)
@@ -522,45 +958,48 @@ namespace cli
 		std::string filePrefix;
 		mtp::ObjectId parent = ResolvePath(path, filePrefix);
 		std::string dir = GetDirname(path);
-		auto objectList = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Any, parent);
-		for(auto object : objectList.ObjectHandles)
+		//both indices are kept between tab presses and updated by commands of this session
+		const ChildrenIndex &index = GetChildrenIndex(parent);
+		const std::set<mtp::ObjectId> &directories = GetDirectoryIndex(parent);
+		for(auto i = index.begin(); i != index.end(); ++i)
 		{
-			std::string name = _session->GetObjectStringProperty(object, mtp::ObjectProperty::ObjectFilename);
-			if (BeginsWith(name, filePrefix))
-			{
-				if (!dir.empty())
-					name = dir + '/' + name;
+			if (!BeginsWith(i->first, filePrefix)) //case insensitive, whole index is scanned
+				continue;
 
-				mtp::ObjectFormat format = (mtp::ObjectFormat)_session->GetObjectIntegerProperty(object, mtp::ObjectProperty::ObjectFormat);
-				if (format == mtp::ObjectFormat::Association)
-					name += '/';
+			std::string name = dir.empty()? i->first: dir + '/' + i->first;
+			if (directories.find(i->second) != directories.end())
+				name += '/';
 
-				result.push_back(EscapePath(name));
-			}
+			result.push_back(EscapePath(name));
 		}
 	}
 
 	void Session::CompleteStoragePath(const StoragePath &path, CompletionResult &result)
 	{
 		using namespace mtp;
-		msg::StorageIDs list = _session->GetStorageIDs();
-		for(size_t i = 0; i < list.StorageIDs.size(); ++i)
+		if (_storageNames.empty())
 		{
-			auto id = list.StorageIDs[i];
-			msg::StorageInfo si = _session->GetStorageInfo(id);
-			auto idStr = std::to_string(id.Id);
-			if (BeginsWith(idStr, path))
-				result.push_back(idStr);
-			if (BeginsWith(si.VolumeLabel, path))
-				result.push_back(EscapePath(si.VolumeLabel));
-			if (BeginsWith(si.StorageDescription, path))
-				result.push_back(EscapePath(si.StorageDescription));
+			msg::StorageIDs list = _session->GetStorageIDs();
+			for(size_t i = 0; i < list.StorageIDs.size(); ++i)
+			{
+				auto id = list.StorageIDs[i];
+				msg::StorageInfo si = _session->GetStorageInfo(id);
+				_storageNames.push_back(std::to_string(id.Id));
+				_storageNames.push_back(si.VolumeLabel);
+				_storageNames.push_back(si.StorageDescription);
+			}
+		}
+		for(const auto &name : _storageNames)
+		{
+			if (BeginsWith(name, path))
+				result.push_back(EscapePath(name));
 		}
 	}
 
 	void Session::ListStorages()
 	{
 		using namespace mtp;
+		_storageNames.clear(); //completion picks up new storages
 		msg::StorageIDs list = _session->GetStorageIDs();
 		for(size_t i = 0; i < list.StorageIDs.size(); ++i)
 		{
@@ -590,16 +1029,33 @@ namespace cli
 		throw std::runtime_error("storage " + path + " could not be found");
 	}
 
+	void Session::SetFormats(const std::string &list)
+	{
+		mtp::ObjectTree::Formats formats;
+		std::stringstream ss(list);
+		std::string format;
+		while(std::getline(ss, format, ','))
+		{
+			if (!format.empty())
+				formats.push_back(ParseFormat(format));
+		}
+		_formats.swap(formats);
+	}
+
 	void Session::ChangeStorage(const StoragePath &path)
 	{
 		using namespace mtp;
 		msg::StorageInfo si;
 		auto storageId = GetStorageByPath(path, si, true);
 		_cs = storageId;
+		InvalidateChildren(mtp::Session::Root); //root index is per storage
 		if (storageId != mtp::Session::AllStorages)
 		{
 			_csName = si.GetName();
-			print("selected storage ", _cs.Id, " ", si.VolumeLabel, " ", si.StorageDescription);
+			if (_outputFormat == ListingWriter::Format::Text)
+				print("selected storage ", _cs.Id, " ", si.VolumeLabel, " ", si.StorageDescription);
+			else //keeps machine readable listings clean
+				error("selected storage ", _cs.Id, " ", si.VolumeLabel, " ", si.StorageDescription);
 		}
 		else
 			_csName.clear();
@@ -617,150 +1073,733 @@ namespace cli
 		}
 	}
 
-	void Session::Get(const LocalPath &dst, mtp::ObjectId srcId, bool thumb)
+	void Session::Get(const LocalPath &dst, mtp::ObjectId srcId, bool thumb, bool checksum)
 	{
-		mtp::ObjectFormat format = static_cast<mtp::ObjectFormat>(_session->GetObjectIntegerProperty(srcId, mtp::ObjectProperty::ObjectFormat));
-		if (format == mtp::ObjectFormat::Association)
+		//format, 64-bit size and modification time come from a single object info query
+		mtp::msg::ObjectInfo info = _session->GetFullObjectInfo(srcId);
+		if (info.ObjectFormat == mtp::ObjectFormat::Association)
 		{
-			mkdir(dst.c_str(), 0700);
-			auto obj = _session->GetObjectHandles(_cs, mtp::ObjectFormat::Any, srcId);
-			for(auto id : obj.ObjectHandles)
-			{
-				auto info = _session->GetObjectInfo(id);
-				LocalPath dstFile = dst + "/" + info.Filename;
-				Get(dstFile, id);
-			}
+			//fetch metadata of the whole subtree first, then stream objects back to back
+			mtp::ObjectTree tree(_session);
+			tree.Enumerate(_cs, srcId, _formats);
+			FileWriter writer;
+			writer.MakeDirectory(dst);
+			GetTree(tree, srcId, dst, writer, thumb, checksum);
+			writer.Finish();
 		}
 		else
 		{
-			auto stream = std::make_shared<ObjectOutputStream>(dst);
-			if (IsInteractive() || _showEvents)
+			mtp::u64 size = info.ObjectSize, offset = 0;
+			time_t mtime = mtp::ConvertDateTime(info.ModificationDate);
+
+			if (!_downloader)
+				_downloader = std::make_shared<mtp::ObjectDownloader>(_session);
+			//hash must cover the whole file, so checksummed download is never resumed
+			if (!thumb && !checksum)
 			{
-				mtp::u64 size = _session->GetObjectIntegerProperty(srcId, mtp::ObjectProperty::ObjectSize);
-				stream->SetTotal(size);
-				if (_showEvents)
-				{
-					try { stream->SetProgressReporter(EventProgressBar(dst)); } catch(const std::exception &ex) { }
-				}
-				else if (_showPrompt)
+				offset = ObjectOutputStream::GetResumeOffset(dst, size, mtime);
+				if (offset && !_downloader->CanResume(offset, size))
+					offset = 0;
+				if (offset)
+					mtp::print("resuming ", dst, " from ", offset, " of ", size, " bytes");
+			}
+
+			auto stream = std::make_shared<ObjectOutputStream>(dst, offset != 0);
+			if (!thumb && !offset)
+				stream->Preallocate(size);
+			stream->SetTotal(size, offset);
+			if (_showEvents)
+			{
+				try { stream->SetProgressReporter(EventProgressBar(dst)); } catch(const std::exception &ex) { }
+			}
+			else if (IsInteractive() && _showPrompt)
+			{
+				try { stream->SetProgressReporter(ProgressBar(dst, _terminalWidth / 3, _terminalWidth)); } catch(const std::exception &ex) { }
+			}
+
+			//disk writes and hashing run in background, usb pipe is not stalled by slow storage
+			std::shared_ptr<mtp::HashingObjectOutputStream<>> hashing;
+			mtp::IObjectOutputStreamPtr target = stream;
+			if (checksum)
+				target = hashing = std::make_shared<mtp::HashingObjectOutputStream<>>(stream);
+			auto async = std::make_shared<mtp::AsyncObjectOutputStream>(target);
+			try
+			{
+				if (thumb)
+					_session->GetThumb(srcId, async);
+				else
+					_downloader->Download(srcId, async, offset, size);
+				async->Finish();
+			}
+			catch(...)
+			{
+				async.reset();
+				stream.reset();
+				//mark partial file, next get continues from its length
+				if (!thumb && mtime)
 				{
-					try { stream->SetProgressReporter(ProgressBar(dst, _terminalWidth / 3, _terminalWidth)); } catch(const std::exception &ex) { }
+					try { ObjectOutputStream::SetModificationTime(dst, mtime); } catch(const std::exception &ex) { }
 				}
+				throw;
 			}
-			if (thumb)
-				_session->GetThumb(srcId, stream);
-			else
-				_session->GetObject(srcId, stream);
+			async.reset();
 			stream.reset();
-			try
+			if (hashing)
+				PrintChecksum(hashing->GetHash(), dst);
+			if (mtime)
 			{
-				cli::ObjectOutputStream::SetModificationTime(dst, _session->GetObjectModificationTime(srcId));
+				try { ObjectOutputStream::SetModificationTime(dst, mtime); }
+				catch(const std::exception &ex) { mtp::debug("setting mtime failed: ", ex.what()); }
 			}
-			catch(const std::exception &ex)
-			{ mtp::debug("GetObjectModificationTime failed: ", ex.what()); }
 		}
 	}
 
-	void Session::Get(mtp::ObjectId srcId)
+	void Session::GetTree(const mtp::ObjectTree &tree, mtp::ObjectId parent, const LocalPath &dst, FileWriter &writer, bool thumb, bool checksum)
 	{
-		auto info = _session->GetObjectInfo(srcId);
-		Get(LocalPath(info.Filename), srcId);
+		tree.ForEachChild(parent, [&](const mtp::ObjectTree::Object &object)
+		{
+			LocalPath dstFile = dst + "/" + tree.GetName(object);
+			if (object.Format == mtp::ObjectFormat::Association)
+			{
+				writer.MakeDirectory(dstFile);
+				GetTree(tree, object.Id, dstFile, writer, thumb, checksum);
+			}
+			else
+				Get(object, dstFile, writer, thumb, checksum);
+		});
 	}
 
-	void Session::GetThumb(mtp::ObjectId srcId)
+	void Session::Get(const mtp::ObjectTree::Object &object, const LocalPath &dst, FileWriter &writer, bool thumb, bool checksum)
 	{
-		auto info = _session->GetObjectInfo(srcId);
-		GetThumb(LocalPath(info.Filename), srcId);
+		auto stream = writer.Open(dst, thumb? 0: object.Size);
+		stream->SetTotal(object.Size);
+		if (_showEvents)
+		{
+			try { stream->SetProgressReporter(EventProgressBar(dst)); } catch(const std::exception &ex) { }
+		}
+		else if (IsInteractive() && _showPrompt)
+		{
+			try { stream->SetProgressReporter(ProgressBar(dst, _terminalWidth / 3, _terminalWidth)); } catch(const std::exception &ex) { }
+		}
+		std::shared_ptr<mtp::HashingObjectOutputStream<>> hashing;
+		mtp::IObjectOutputStreamPtr target = stream;
+		if (checksum)
+			target = hashing = std::make_shared<mtp::HashingObjectOutputStream<>>(stream);
+		if (thumb)
+			_session->GetThumb(object.Id, target);
+		else
+			_session->GetObject(object.Id, target);
+		writer.Close(object.ModificationTime);
+		if (hashing)
+			PrintChecksum(hashing->GetHash(), dst);
 	}
 
-	void Session::Cat(const Path &path)
+	void Session::Get(const std::vector<GlobMatch> &matches, const LocalPath &dst, bool checksum)
 	{
-		mtp::ByteArrayObjectOutputStreamPtr stream(new mtp::ByteArrayObjectOutputStream);
-		_session->GetObject(Resolve(path), stream);
-		const mtp::ByteArray & data = stream->GetData();
-		std::string text(data.begin(), data.end());
-		fputs(text.c_str(), stdout);
-		if (text.empty() || text[text.size() - 1] == '\n')
-			fputc('\n', stdout);
+		std::map<mtp::ObjectId, mtp::ObjectTreePtr> parents;
+		FileWriter writer;
+		writer.MakeDirectory(dst);
+		for(auto &match : matches)
+		{
+			auto &parent = parents[match.Parent];
+			if (!parent)
+			{
+				parent = std::make_shared<mtp::ObjectTree>(_session);
+				parent->EnumerateChildren(_cs, match.Parent, _formats);
+			}
+			const mtp::ObjectTree::Object *object = parent->Find(match.Id);
+			if (!object)
+				continue; //filtered out by format
+
+			LocalPath dstFile = dst + "/" + match.Name;
+			if (object->Format == mtp::ObjectFormat::Association)
+			{
+				mtp::ObjectTree tree(_session);
+				tree.Enumerate(_cs, match.Id, _formats);
+				writer.MakeDirectory(dstFile);
+				GetTree(tree, match.Id, dstFile, writer, false, checksum);
+			}
+			else
+				Get(*object, dstFile, writer, false, checksum);
+		}
+		writer.Finish();
 	}
 
-	void Session::Rename(const Path &path, const std::string &newName)
+	void Session::PrintChecksum(const mtp::Crc32c &hash, const LocalPath &dst)
+	{ mtp::print(hash.GetHex(), "  ", dst); }
+
+	void Session::ExportTree(const std::shared_ptr<TarWriter> &writer, const mtp::ObjectTree &tree, mtp::ObjectId parent, const std::string &prefix)
 	{
-		auto objectId = Resolve(path);
-		_session->SetObjectProperty(objectId, mtp::ObjectProperty::ObjectFilename, newName);
+		tree.ForEachChild(parent, [&](const mtp::ObjectTree::Object &object)
+		{
+			std::string path = prefix + tree.GetName(object);
+			if (object.Format == mtp::ObjectFormat::Association)
+			{
+				writer->AddDirectory(path, object.ModificationTime);
+				ExportTree(writer, tree, object.Id, path + "/");
+			}
+			else
+				ExportObject(writer, object.Id, path, object.Size, object.ModificationTime);
+		});
 	}
 
-	namespace
+	void Session::ExportObject(const std::shared_ptr<TarWriter> &writer, mtp::ObjectId id, const std::string &path, mtp::u64 size, time_t mtime)
 	{
-		struct stat Stat(const std::string &path)
-		{
-			struct stat st = {};
-			if (stat(path.c_str(), &st))
-				throw std::runtime_error(std::string("stat failed: ") + strerror(errno));
-			return st;
-		}
+		writer->BeginFile(path, size, mtime);
+		try
+		{ _session->GetObject(id, writer); }
+		catch(const mtp::system_error &ex)
+		{ throw; } //archive output failed, nothing to continue with
+		catch(const std::exception &ex)
+		{ mtp::error("downloading ", path, " failed: ", ex.what()); }
+		//entry size was written in header already, short or long content is padded or cut
+		if (!writer->EndFile())
+			mtp::error(path, ": object size does not match its content, archive entry is padded or truncated");
 	}
 
-	void Session::Put(mtp::ObjectId parentId, const LocalPath &src, const std::string &targetFilename)
+	void Session::ExportTar(const Path &src, const LocalPath &dst)
 	{
 		using namespace mtp;
-		struct stat st = Stat(src);
+		ObjectId id = Resolve(src);
+		int fd = dst == "-"? STDOUT_FILENO: open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error("cannot open file: " + dst);
 
-		if (S_ISDIR(st.st_mode))
+		//stdout carries archive, so nothing else is printed there
+		auto writer = std::make_shared<TarWriter>(fd);
+		try
 		{
-			std::string name = GetFilename(src.back() == '/'? src.substr(0, src.size() - 1): static_cast<const std::string &>(src));
-			try
+			bool directory = id == mtp::Session::Root;
+			std::string name;
+			if (!directory)
+			{
+				name = _session->GetObjectStringProperty(id, ObjectProperty::ObjectFilename);
+				directory = ObjectFormat(_session->GetObjectIntegerProperty(id, ObjectProperty::ObjectFormat)) == ObjectFormat::Association;
+			}
+			if (directory)
 			{
-				mtp::ObjectId existingObject = ResolveObjectChild(parentId, name);
-				ObjectFormat format = ObjectFormat(_session->GetObjectIntegerProperty(existingObject, ObjectProperty::ObjectFormat));
-				if (format != ObjectFormat::Association)
+				//metadata of the whole subtree is fetched in batches before any object data
+				ObjectTree tree(_session);
+				tree.Enumerate(_cs, id, _formats);
+				std::string prefix;
+				if (!name.empty())
 				{
-					_session->DeleteObject(existingObject);
-					throw std::runtime_error("target is not a directory");
+					writer->AddDirectory(name, _session->GetObjectModificationTime(id));
+					prefix = name + "/";
 				}
-				parentId = existingObject;
+				ExportTree(writer, tree, id, prefix);
 			}
-			catch(const std::exception &ex)
-			{ parentId = MakeDirectory(parentId, name); }
+			else
+				ExportObject(writer, id, name, _session->GetObjectIntegerProperty(id, ObjectProperty::ObjectSize), _session->GetObjectModificationTime(id));
+			writer->Finish();
+		}
+		catch(...)
+		{
+			if (fd != STDOUT_FILENO)
+				close(fd);
+			throw;
+		}
+		if (fd != STDOUT_FILENO && close(fd) != 0)
+			throw mtp::system_error("close");
+	}
 
-			DIR *dir = opendir(src.c_str());
-			if (!dir)
-			{
-				perror("opendir");
-				return;
-			}
-			while(true)
+	namespace
+	{
+		///walks path from root of first storage of target device, missing directories are created
+		mtp::ObjectId ResolveTargetDirectory(const mtp::SessionPtr &session, const std::string &path, mtp::StorageId &storageId)
+		{
+			using namespace mtp;
+			auto storages = session->GetStorageIDs();
+			if (storages.StorageIDs.empty())
+				throw std::runtime_error("target device has no storages");
+			storageId = storages.StorageIDs.front();
+
+			ObjectId id = mtp::Session::Root;
+			for(size_t p = 0; p < path.size(); )
 			{
-				dirent *result = readdir(dir);
-				if (!result)
-					break;
+				size_t next = path.find('/', p);
+				if (next == path.npos)
+					next = path.size();
 
-				if (strcmp(result->d_name, ".") == 0 || strcmp(result->d_name, "..") == 0)
+				std::string entity(path.substr(p, next - p));
+				p = next + 1;
+				if (entity.empty() || entity == ".")
 					continue;
+				if (entity == "..")
+					throw std::runtime_error("target path must not contain ..");
 
-				std::string fname = result->d_name;
-				Put(parentId, src + "/" + fname);
+				ObjectTree children(session);
+				children.EnumerateChildren(storageId, id);
+				const ObjectTree::Object *found = nullptr;
+				children.ForEachChild(id, [&](const ObjectTree::Object &object)
+				{
+					if (!found && entity == children.GetName(object))
+						found = &object;
+				});
+				if (found && found->Format != ObjectFormat::Association)
+					throw std::runtime_error(entity + " on target device is not a directory");
+				id = found? found->Id: session->CreateDirectory(entity, id, storageId).ObjectId;
 			}
-			closedir(dir);
+			return id;
 		}
-		else if (S_ISREG(st.st_mode))
-		{
-			std::string filename = targetFilename.empty()? GetFilename(src): targetFilename;
-			try
-			{
-				mtp::ObjectId objectId = ResolveObjectChild(parentId, filename);
-				_session->DeleteObject(objectId);
-			}
-			catch(const std::exception &ex)
-			{ }
+	}
 
+	void Session::CopyDevice(const Path &src, const std::string &dst)
+	{
+		using namespace mtp;
+		size_t colon = dst.find(':');
+		if (colon == dst.npos || colon == 0)
+			throw std::runtime_error("target must be <device>:<dir>, device is serial number or usb bus path");
+
+		ObjectId srcId = Resolve(src);
+		if (srcId == mtp::Session::Root)
+			throw std::runtime_error("storage root could not be copied, copy its directories instead");
+
+		std::string deviceId = dst.substr(0, colon);
+		DevicePtr device = Device::Find(deviceId);
+		if (!device)
+			throw std::runtime_error("no mtp device " + deviceId + " found");
+		if (device->GetBusPath() == _device->GetBusPath() && !device->GetBusPath().empty())
+			throw std::runtime_error("target is the current device, use cp instead");
+
+		SessionPtr target = device->OpenSession(1);
+		StorageId storageId;
+		ObjectId parent = ResolveTargetDirectory(target, dst.substr(colon + 1), storageId);
+
+		DeviceCopier copier(_session, target);
+		if (IsInteractive() || _showEvents)
+			copier.SetCallback([](const std::string &path, u64 size) { print(path); });
+		copier.Copy(srcId, storageId, parent, std::string(), _formats);
+		print("copied ", copier.GetFiles(), " file(s), ", copier.GetDirectories(), " directories, ", copier.GetBytes(), " bytes");
+	}
+
+	void Session::Get(const Path &src, bool checksum)
+	{
+		if (IsGlob(src))
+			Get(Glob(src), LocalPath("."), checksum);
+		else
+			Get(Resolve(src), checksum);
+	}
+
+	void Session::Get(const LocalPath &dst, const Path &src, bool checksum)
+	{
+		if (IsGlob(src))
+			Get(Glob(src), dst, checksum);
+		else
+			Get(dst, Resolve(src), false, checksum);
+	}
+
+	void Session::Get(mtp::ObjectId srcId, bool checksum)
+	{
+		auto info = _session->GetObjectInfo(srcId);
+		Get(LocalPath(info.Filename), srcId, false, checksum);
+	}
+
+	void Session::GetThumb(mtp::ObjectId srcId)
+	{
+		auto info = _session->GetObjectInfo(srcId);
+		GetThumb(LocalPath(info.Filename), srcId);
+	}
+
+	void Session::GetThumbTree(const Path &src, const LocalPath &dst)
+	{
+		using namespace mtp;
+		ObjectId root = Resolve(src);
+		//metadata of the whole subtree comes first, then thumbnails are requested back to back while writer thread stores previous ones
+		ObjectTree tree(_session);
+		tree.Enumerate(_cs, root, _formats);
+		ThumbnailFetcher fetcher(_session);
+		FileWriter writer;
+		writer.MakeDirectory(dst);
+
+		size_t saved = 0, missing = 0, failed = 0;
+		std::function<void (ObjectId, const LocalPath &)> walk = [&](ObjectId parent, const LocalPath &dir)
+		{
+			tree.ForEachChild(parent, [&](const ObjectTree::Object &object)
+			{
+				LocalPath path = dir + "/" + tree.GetName(object);
+				if (object.Format == ObjectFormat::Association)
+				{
+					writer.MakeDirectory(path);
+					walk(object.Id, path);
+					return;
+				}
+				if (!ThumbnailFetcher::MayHaveThumbnail(object.Format))
+					return;
+
+				ByteArray thumb;
+				try
+				{ thumb = fetcher.Get(object.Id, object.Format); }
+				catch(const mtp::system_error &ex)
+				{ throw; }
+				catch(const InvalidResponseException &ex)
+				{
+					if (ex.Type != ResponseType::NoThumbnailPresent)
+					{
+						error("getting thumbnail of ", path, " failed: ", ex.what());
+						++failed;
+					}
+					else
+						++missing;
+					return;
+				}
+				catch(const std::exception &ex)
+				{
+					error("getting thumbnail of ", path, " failed: ", ex.what());
+					++failed;
+					return;
+				}
+				if (thumb.empty())
+				{
+					++missing;
+					return;
+				}
+
+				auto stream = writer.Open(path, thumb.size());
+				stream->Write(thumb.data(), thumb.size());
+				writer.Close(object.ModificationTime);
+				++saved;
+				if (IsInteractive() || _showEvents)
+					print(path);
+			});
+		};
+		walk(root, dst);
+		writer.Finish();
+		print("saved ", saved, " thumbnail(s), ", missing, " object(s) without thumbnail, ", failed, " failed");
+	}
+
+	void Session::Cat(const Path &path)
+	{
+		auto stream = std::make_shared<FileDescriptorOutputStream>(STDOUT_FILENO);
+		if (IsGlob(path))
+		{
+			for(auto &match : Glob(path))
+			{
+				if (!GetDirectoryIndex(match.Parent).count(match.Id))
+					_session->GetObject(match.Id, stream);
+			}
+		}
+		else
+			_session->GetObject(Resolve(path), stream);
+		FinishCat(*stream);
+	}
+
+	void Session::Cat(const Path &path, mtp::u64 offset, mtp::u64 length)
+	{
+		static const mtp::u64 ChunkSize = 16 * 1024 * 1024;
+
+		auto objectId = Resolve(path);
+		mtp::u64 size = _session->GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize);
+		mtp::u64 end = (length && length < size - std::min(offset, size))? offset + length: size;
+		auto stream = std::make_shared<FileDescriptorOutputStream>(STDOUT_FILENO);
+		while(offset < end)
+		{
+			mtp::u32 chunk = std::min(end - offset, ChunkSize);
+			mtp::u64 written = stream->GetWritten();
+			_session->GetPartialObject(objectId, offset, chunk, stream);
+			mtp::u64 received = stream->GetWritten() - written;
+			if (received == 0)
+				break;
+			offset += received;
+		}
+		FinishCat(*stream);
+	}
+
+	void Session::FinishCat(const FileDescriptorOutputStream &stream)
+	{
+		//keep prompt on its own line, piped output is passed unchanged
+		if (IsInteractive() && isatty(STDOUT_FILENO) && stream.GetWritten() && stream.GetLastByte() != '\n')
+			fputc('\n', stdout);
+	}
+
+	void Session::Rename(const Path &path, const std::string &newName)
+	{
+		auto objectId = Resolve(path);
+		_session->SetObjectProperty(objectId, mtp::ObjectProperty::ObjectFilename, newName);
+		bool directory = false;
+		for(const auto &index : _directoryIndex)
+			directory = directory || index.second.count(objectId);
+		RemoveChild(objectId);
+		mtp::ObjectId parent = _session->GetObjectParent(objectId);
+		AddChild(parent != mtp::Session::Device? parent: mtp::Session::Root, newName, objectId, directory);
+	}
+
+	void Session::Delete(const Path &path)
+	{
+		std::vector<mtp::ObjectId> objects;
+		if (IsGlob(path))
+		{
+			for(auto &match : Glob(path))
+				objects.push_back(match.Id);
+		}
+		else
+			objects.push_back(Resolve(path));
+
+		if (!_deleter)
+			_deleter = std::make_shared<mtp::ObjectDeleter>(_session);
+		//objects deleted before failure are dropped from indices too
+		size_t deleted = 0;
+		auto forget = [&]()
+		{
+			for(size_t i = 0; i < deleted; ++i)
+			{
+				RemoveChild(objects[i]);
+				InvalidateChildren(objects[i]);
+			}
+		};
+		try
+		{ _deleter->Delete(objects, &deleted); }
+		catch(...)
+		{
+			forget();
+			throw;
+		}
+		forget();
+	}
+
+	void Session::Copy(const Path &src, const Path &dst, bool move)
+	{
+		using namespace mtp;
+		ObjectId srcId = Resolve(src);
+
+		ObjectId parent;
+		std::string name;
+		bool exists = false;
+		try
+		{
+			parent = Resolve(dst);
+			exists = true;
+		}
+		catch(const std::exception &ex)
+		{ parent = ResolvePath(dst, name); } //dst is new name in existing directory
+
+		if (exists && parent != mtp::Session::Root)
+		{
+			ObjectFormat format = ObjectFormat(_session->GetObjectIntegerProperty(parent, ObjectProperty::ObjectFormat));
+			if (format != ObjectFormat::Association)
+				throw std::runtime_error("destination " + dst + " already exists");
+		}
+
+		StorageId storageId = parent != mtp::Session::Root? _session->GetObjectStorage(parent): _cs;
+		if (storageId == mtp::Session::AllStorages)
+			storageId = _session->GetObjectStorage(srcId);
+
+		if (!_copier)
+			_copier = std::make_shared<ObjectCopier>(_session);
+		if (move)
+		{
+			_copier->Move(srcId, storageId, parent, name);
+			RemoveChild(srcId);
+		}
+		else
+			_copier->Copy(srcId, storageId, parent, name);
+		InvalidateChildren(parent);
+	}
+
+	namespace
+	{
+		struct LocalFile
+		{
+			bool		Directory;
+			mtp::u64	Size;
+			time_t		ModificationTime;
+
+			LocalFile(bool directory = false): Directory(directory), Size(0), ModificationTime(0) { }
+		};
+		typedef std::map<std::string, LocalFile> LocalFiles; //relative path -> file
+
+		void ScanLocal(const std::string &root, LocalFiles &files)
+		{
+			mtp::posix::DirectoryScanner scanner(root);
+			std::vector<mtp::posix::DirectoryScanner::Entry> entries;
+			while(scanner.Fetch(entries))
+			{
+				for(auto &entry : entries)
+				{
+					LocalFile &file = files[entry.Path];
+					file.Directory = entry.Directory;
+					file.Size = entry.Size;
+					file.ModificationTime = entry.ModificationTime;
+				}
+				entries.clear();
+			}
+		}
+
+		typedef std::map<std::string, const mtp::ObjectTree::Object *> RemoteFiles; //relative path -> object
+
+		void ListRemote(const mtp::ObjectTree &tree, mtp::ObjectId parent, const std::string &prefix, RemoteFiles &files)
+		{
+			tree.ForEachChild(parent, [&](const mtp::ObjectTree::Object &object)
+			{
+				std::string name = tree.GetName(object);
+				std::string path = prefix.empty()? name: prefix + "/" + name;
+				files[path] = &object;
+				if (object.Format == mtp::ObjectFormat::Association)
+					ListRemote(tree, object.Id, path, files);
+			});
+		}
+	}
+
+	void Session::Sync(const Path &remote, const LocalPath &local, bool upload, bool dryRun)
+	{
+		using namespace mtp;
+		ObjectId remoteRoot = Resolve(remote, upload && !dryRun);
+		ObjectTree tree(_session);
+		tree.Enumerate(_cs, remoteRoot, upload? ObjectTree::Formats(): _formats); //uploads compare with everything on device
+		RemoteFiles remoteFiles;
+		ListRemote(tree, remoteRoot, std::string(), remoteFiles);
+
+		LocalFiles localFiles;
+		ScanLocal(local, localFiles);
+
+		size_t transferred = 0;
+		if (!upload)
+		{
+			FileWriter writer;
+			if (!dryRun)
+				writer.MakeDirectory(local);
+			for(auto &i : remoteFiles)
+			{
+				const ObjectTree::Object &object = *i.second;
+				auto l = localFiles.find(i.first);
+				bool directory = object.Format == ObjectFormat::Association;
+				time_t mtime = object.ModificationTime;
+				bool changed = l == localFiles.end() ||
+					(!directory && (l->second.Size != object.Size || (mtime && l->second.ModificationTime != mtime)));
+				if (!changed)
+					continue;
+
+				LocalPath dst = local + "/" + i.first;
+				if (directory)
+				{
+					if (!dryRun)
+						writer.MakeDirectory(dst);
+					continue;
+				}
+				print("get ", i.first);
+				++transferred;
+				if (!dryRun)
+					Get(object, dst, writer, false);
+			}
+			writer.Finish();
+		}
+		else
+		{
+			std::map<std::string, ObjectId> directories;
+			directories[std::string()] = remoteRoot;
+			for(auto &i : localFiles)
+			{
+				const LocalFile &file = i.second;
+				auto r = remoteFiles.find(i.first);
+				std::string dir = GetDirname(i.first);
+				ObjectId parent = directories.count(dir)? directories[dir]: ObjectId();
+				if (file.Directory)
+				{
+					if (r != remoteFiles.end())
+						directories[i.first] = r->second->Id;
+					else if (!dryRun)
+						directories[i.first] = MakeDirectory(parent, GetFilename(i.first));
+					continue;
+				}
+
+				bool changed = r == remoteFiles.end() || r->second->Size != file.Size;
+				if (!changed)
+				{
+					time_t mtime = r->second->ModificationTime;
+					changed = mtime && mtime < file.ModificationTime;
+				}
+				if (!changed)
+					continue;
+
+				print("put ", i.first);
+				++transferred;
+				if (!dryRun)
+					Put(parent, local + "/" + i.first);
+			}
+		}
+		print(dryRun? "would transfer ": "transferred ", transferred, " file(s)");
+	}
+
+	namespace
+	{
+		struct stat Stat(const std::string &path)
+		{
+			struct stat st = {};
+			if (stat(path.c_str(), &st))
+				throw std::runtime_error(std::string("stat failed: ") + strerror(errno));
+			return st;
+		}
+	}
+
+	void Session::Put(mtp::ObjectId parentId, const LocalPath &src, const std::string &targetFilename)
+	{
+		using namespace mtp;
+		struct stat st = Stat(src);
+
+		if (S_ISDIR(st.st_mode))
+		{
+			std::string name = GetFilename(src.back() == '/'? src.substr(0, src.size() - 1): static_cast<const std::string &>(src));
+			std::map<std::string, ObjectId> directories; //relative path -> object
+			directories[std::string()] = ResolveOrMakeDirectory(parentId, name);
+
+			//local tree is scanned in background, files are sent as soon as they're listed
+			posix::DirectoryScanner scanner(src);
+			posix::DirectoryScanner::Entry entry;
+			while(scanner.Next(entry))
+			{
+				auto parent = directories.find(GetDirname(entry.Path));
+				if (parent == directories.end())
+					continue; //parent directory could not be created
+
+				if (entry.Directory)
+				{
+					try
+					{ directories[entry.Path] = ResolveOrMakeDirectory(parent->second, GetFilename(entry.Path)); }
+					catch(const std::exception &ex)
+					{ error("creating directory ", entry.Path, " failed: ", ex.what()); }
+				}
+				else
+					Put(parent->second, src + "/" + entry.Path);
+			}
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			std::string filename = targetFilename.empty()? GetFilename(src): targetFilename;
 			auto stream = std::make_shared<ObjectInputStream>(src);
-			stream->SetTotal(stream->GetSize());
+			u64 size = stream->GetSize();
+
+			if (!_uploader)
+				_uploader = std::make_shared<ObjectUploader>(_session);
+			//large objects are sent in committed chunks, so interrupted upload is continued by next put
+			bool checkpointed = size > ObjectUploader::DefaultChunkSize && _uploader->CanCheckpoint();
+			UploadCheckpoint checkpoint(_gdi.SerialNumber, GetUploadStorageId(), parentId, filename);
+			UploadCheckpoint::State state;
+			bool resume = false;
+			try
+			{
+				mtp::ObjectId objectId = ResolveObjectChild(parentId, filename);
+				resume = checkpointed && checkpoint.Load(state, size, stream->GetModificationTime()) &&
+					state.ObjectId == objectId && _uploader->CanResume(objectId, state.Committed, size);
+				if (!resume)
+				{
+					_session->DeleteObject(objectId);
+					RemoveChild(objectId);
+				}
+			}
+			catch(const std::exception &ex)
+			{ }
+
+			if (resume)
+			{
+				print("resuming ", src, " from ", state.Committed);
+				stream->Seek(state.Committed);
+			}
+			stream->SetTotal(size, state.Committed);
 
 			msg::ObjectInfo oi;
 			oi.Filename = filename;
-			oi.ObjectFormat = ObjectFormatFromFilename(src);
-			oi.SetSize(stream->GetSize());
+			oi.ObjectFormat = ObjectFormatFromFilename(src, true);
+			oi.ModificationDate = ConvertDateTime(stream->GetModificationTime());
 
 			if (_showEvents)
 			{
@@ -771,14 +1810,56 @@ namespace cli
 				try { stream->SetProgressReporter(ProgressBar(src, _terminalWidth / 3, _terminalWidth)); } catch(const std::exception &ex) { }
 			}
 
-			_session->SendObjectInfo(oi, GetUploadStorageId(), parentId);
-			_session->SendObject(stream);
+			//file is read ahead in background, slow storage does not stall usb pipe
+			auto source = std::make_shared<mtp::AsyncObjectInputStream>(stream);
+			if (!checkpointed)
+			{
+				auto noi = _session->CreateObject(oi, size, GetUploadStorageId(), parentId);
+				_session->SendObject(source);
+				AddChild(parentId, filename, noi.ObjectId);
+				return;
+			}
+
+			if (!resume)
+			{
+				auto noi = _uploader->Create(oi, GetUploadStorageId(), parentId);
+				AddChild(parentId, filename, noi.ObjectId);
+				state.ObjectId = noi.ObjectId;
+				state.Size = size;
+				state.ModificationTime = stream->GetModificationTime();
+				checkpoint.Save(state);
+			}
+			_uploader->Upload(state.ObjectId, source, state.Committed, size, [&](u64 committed)
+			{
+				state.Committed = committed;
+				checkpoint.Save(state);
+			});
+			checkpoint.Remove();
+		}
+	}
+
+	void Session::Put(const LocalPath &src)
+	{
+		if (IsGlob(src) && access(src.c_str(), F_OK) != 0)
+		{
+			for(auto &file : GlobLocal(src))
+				Put(_cd, file);
 		}
+		else
+			Put(_cd, src);
 	}
 
 	void Session::Put(const LocalPath &src, const Path &dst)
 	{
 		using namespace mtp;
+		if (IsGlob(src) && access(src.c_str(), F_OK) != 0)
+		{
+			ObjectId parent = Resolve(dst, true);
+			for(auto &file : GlobLocal(src))
+				Put(parent, file);
+			return;
+		}
+
 		std::string targetFilename;
 		//handle put <file> <file> case:
 		try
@@ -813,6 +1894,392 @@ namespace cli
 		Put(Resolve(dst, true), src, targetFilename); //upload to folder
 	}
 
+	namespace
+	{
+		struct ManifestEntry //! transfer from manifest line, grouped with others by remote directory
+		{
+			size_t		Line;
+			std::string	Name; //remote filename for downloads
+			std::string	Local;
+		};
+		typedef std::map<std::string, std::vector<ManifestEntry>> ManifestGroups; //remote directory -> entries, parents sort before children
+
+		std::string GetRemoteDirname(const std::string &path)
+		{
+			size_t pos = path.rfind('/');
+			if (pos == path.npos)
+				return std::string(); //current directory
+			return pos? path.substr(0, pos): std::string("/");
+		}
+
+		mtp::u64 GetTreeSize(const mtp::ObjectTree &tree, mtp::ObjectId parent)
+		{
+			mtp::u64 size = 0;
+			tree.ForEachChild(parent, [&](const mtp::ObjectTree::Object &object)
+			{ size += object.Format == mtp::ObjectFormat::Association? GetTreeSize(tree, object.Id): object.Size; });
+			return size;
+		}
+	}
+
+	void Session::RunManifest(const LocalPath &path)
+	{
+		using namespace mtp;
+		std::ifstream manifest(path);
+		if (!manifest)
+			throw std::runtime_error("cannot open manifest " + path);
+
+		ManifestGroups downloads, uploads;
+		size_t transferred = 0, failed = 0;
+		u64 bytes = 0;
+		std::string input;
+		for(size_t line = 1; std::getline(manifest, input); ++line)
+		{
+			Tokens tokens;
+			Tokenizer(input, tokens);
+			if (tokens.empty() || tokens.front()[0] == '#')
+				continue;
+
+			std::vector<std::string> args(tokens.begin(), tokens.end());
+			if (args.size() < 2 || args.size() > 3 || (args[0] != "get" && args[0] != "put"))
+			{
+				error("manifest line ", line, ": expected get <remote> [<local>] or put <local> [<remote dir>]");
+				++failed;
+				continue;
+			}
+
+			ManifestEntry entry;
+			entry.Line = line;
+			if (args[0] == "get")
+			{
+				entry.Name = GetFilename(args[1]);
+				entry.Local = args.size() > 2? args[2]: entry.Name;
+				downloads[GetRemoteDirname(args[1])].push_back(entry);
+			}
+			else
+			{
+				entry.Local = args[1];
+				uploads[args.size() > 2? args[2]: std::string()].push_back(entry);
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		FileWriter writer;
+		for(auto &group : downloads)
+		{
+			//one listing per directory, objects are then streamed back to back in device order
+			ObjectTree tree(_session);
+			std::multimap<std::string, ManifestEntry *> pending;
+			for(auto &entry : group.second)
+				pending.emplace(entry.Name, &entry);
+			try
+			{
+				ObjectId parent = Resolve(Path(group.first));
+				tree.EnumerateChildren(_cs, parent);
+				tree.ForEachChild(parent, [&](const ObjectTree::Object &object)
+				{
+					auto range = pending.equal_range(tree.GetName(object));
+					for(auto i = range.first; i != range.second; ++i)
+					{
+						const ManifestEntry &entry = *i->second;
+						try
+						{
+							if (object.Format == ObjectFormat::Association)
+							{
+								ObjectTree subtree(_session);
+								subtree.Enumerate(_cs, object.Id, _formats);
+								writer.MakeDirectory(entry.Local);
+								GetTree(subtree, object.Id, entry.Local, writer, false);
+								bytes += GetTreeSize(subtree, object.Id);
+							}
+							else
+							{
+								Get(object, entry.Local, writer, false);
+								bytes += object.Size;
+							}
+							++transferred;
+						}
+						catch(const std::exception &ex)
+						{
+							error("manifest line ", entry.Line, ": get ", entry.Name, " failed: ", ex.what());
+							++failed;
+						}
+					}
+					pending.erase(range.first, range.second);
+				});
+			}
+			catch(const std::exception &ex)
+			{
+				//every line waiting for this directory is reported, so failures can be matched with manifest
+				for(auto &i : pending)
+					error("manifest line ", i.second->Line, ": listing ", group.first.empty()? std::string("."): group.first, " failed: ", ex.what());
+				failed += pending.size();
+				continue;
+			}
+			for(auto &i : pending)
+			{
+				error("manifest line ", i.second->Line, ": could not find ", i.first, " in ", group.first.empty()? std::string("."): group.first);
+				++failed;
+			}
+		}
+		try
+		{ writer.Finish(); }
+		catch(const std::exception &ex)
+		{
+			error("manifest: writing files failed: ", ex.what());
+			++failed;
+		}
+
+		for(auto &group : uploads)
+		{
+			ObjectId parent;
+			try
+			{
+				parent = Resolve(Path(group.first), true);
+				GetChildrenIndex(parent); //existing objects are replaced without listing directory again
+			}
+			catch(const std::exception &ex)
+			{
+				for(auto &entry : group.second)
+					error("manifest line ", entry.Line, ": resolving ", group.first.empty()? std::string("."): group.first, " failed: ", ex.what());
+				failed += group.second.size();
+				continue;
+			}
+			for(auto &entry : group.second)
+			{
+				try
+				{
+					struct stat st = Stat(entry.Local);
+					Put(parent, LocalPath(entry.Local));
+					if (S_ISREG(st.st_mode))
+						bytes += st.st_size;
+					++transferred;
+				}
+				catch(const std::exception &ex)
+				{
+					error("manifest line ", entry.Line, ": put ", entry.Local, " failed: ", ex.what());
+					++failed;
+				}
+			}
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		print("transferred ", transferred, " item(s), ", bytes, " bytes in ", seconds, " s, ", failed, " failed");
+	}
+
+	namespace
+	{
+		struct RenameEntry //! rename list line, resolved against directory index before updates are sent
+		{
+			size_t			Line;
+			mtp::ObjectId	Parent;
+			std::string		Name;
+			std::string		NewName;
+		};
+	}
+
+	void Session::RunRenameList(const LocalPath &path)
+	{
+		using namespace mtp;
+		std::ifstream list(path);
+		if (!list)
+			throw std::runtime_error("cannot open rename list " + path);
+
+		std::vector<RenameEntry> entries;
+		std::vector<mtp::Session::ObjectPropertyUpdate> updates;
+		size_t renamed = 0, failed = 0;
+		std::string input;
+		for(size_t line = 1; std::getline(list, input); ++line)
+		{
+			Tokens tokens;
+			Tokenizer(input, tokens);
+			if (tokens.empty() || tokens.front()[0] == '#')
+				continue;
+
+			std::vector<std::string> args(tokens.begin(), tokens.end());
+			if (args.size() != 2 || args[1].empty() || args[1].find('/') != args[1].npos)
+			{
+				error("rename list line ", line, ": expected <path> <new name>");
+				++failed;
+				continue;
+			}
+
+			RenameEntry entry;
+			entry.Line = line;
+			entry.Name = GetFilename(args[0]);
+			entry.NewName = args[1];
+			try
+			{
+				//each directory is listed once, however many of its objects are renamed
+				entry.Parent = Resolve(Path(GetRemoteDirname(args[0])));
+				updates.emplace_back(ResolveObjectChild(entry.Parent, entry.Name), ObjectProperty::ObjectFilename, entry.NewName);
+				entries.push_back(entry);
+			}
+			catch(const std::exception &ex)
+			{
+				error("rename list line ", line, ": ", ex.what());
+				++failed;
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		size_t index = 0;
+		while(index < updates.size())
+		{
+			std::vector<mtp::Session::ObjectPropertyUpdate> pending(updates.begin() + index, updates.end());
+			size_t applied = pending.size();
+			try
+			{ _session->SetObjectProperties(pending); }
+			catch(const ObjectPropertyUpdateException &ex)
+			{
+				applied = ex.Index;
+				error("rename list line ", entries[index + applied].Line, ": renaming ", entries[index + applied].Name, " failed: ", ex.what());
+				++failed;
+			}
+
+			for(size_t i = index; i < index + applied; ++i)
+			{
+				const RenameEntry &entry = entries[i];
+				auto children = _childrenIndex.find(entry.Parent);
+				if (children == _childrenIndex.end())
+					continue;
+				//name may already belong to object renamed earlier in the list
+				auto child = children->second.find(entry.Name);
+				if (child != children->second.end() && child->second == updates[i].ObjectId)
+					children->second.erase(child);
+				children->second[entry.NewName] = updates[i].ObjectId;
+			}
+			renamed += applied;
+			index += applied + 1; //failed update is skipped
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		print("renamed ", renamed, " object(s) in ", seconds, " s, ", failed, " failed");
+	}
+
+	mtp::ObjectId Session::ResolveImportDirectory(std::map<std::string, mtp::ObjectId> &directories, const std::string &path)
+	{
+		auto i = directories.find(path);
+		if (i != directories.end())
+			return i->second;
+		mtp::ObjectId parent = ResolveImportDirectory(directories, GetDirname(path));
+		mtp::ObjectId id = ResolveOrMakeDirectory(parent, GetFilename(path));
+		directories[path] = id;
+		return id;
+	}
+
+	void Session::ImportTar(const LocalPath &src, const Path &dst)
+	{
+		using namespace mtp;
+		ObjectId root = Resolve(dst, true);
+		int fd = src == "-"? STDIN_FILENO: open(src.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("cannot open file: " + src);
+
+		std::map<std::string, ObjectId> directories; //relative path -> object
+		directories[std::string()] = root;
+		size_t files = 0, failed = 0;
+		auto reader = std::make_shared<TarReader>(fd);
+		try
+		{
+			TarReader::Entry entry;
+			while(reader->Next(entry))
+			{
+				//leading slashes and dot components are dropped, entries escaping dst are refused
+				std::string path;
+				bool escaping = false;
+				for(size_t begin = 0; begin < entry.Path.size(); )
+				{
+					size_t end = entry.Path.find('/', begin);
+					if (end == entry.Path.npos)
+						end = entry.Path.size();
+					std::string component = entry.Path.substr(begin, end - begin);
+					if (component == "..")
+						escaping = true;
+					else if (!component.empty() && component != ".")
+						path += (path.empty()? "": "/") + component;
+					begin = end + 1;
+				}
+				if (escaping)
+				{
+					error("skipping ", entry.Path, ": path leads outside of target directory");
+					++failed;
+					continue;
+				}
+				if (path.empty() || entry.EntryType == TarReader::Entry::Type::Other)
+					continue;
+
+				try
+				{
+					if (entry.EntryType == TarReader::Entry::Type::Directory)
+					{
+						ResolveImportDirectory(directories, path);
+						continue;
+					}
+
+					ObjectId parent = ResolveImportDirectory(directories, GetDirname(path));
+					std::string filename = GetFilename(path);
+					try
+					{
+						ObjectId objectId = ResolveObjectChild(parent, filename);
+						_session->DeleteObject(objectId);
+						RemoveChild(objectId);
+					}
+					catch(const std::exception &ex)
+					{ }
+
+					msg::ObjectInfo oi;
+					oi.Filename = filename;
+					oi.ObjectFormat = ObjectFormatFromFilename(filename, true);
+					oi.ModificationDate = ConvertDateTime(entry.ModificationTime);
+
+					auto noi = _session->CreateObject(oi, entry.Size, GetUploadStorageId(), parent);
+					{
+						//archive is read ahead while previous chunk goes to device, reader is released before next header
+						auto source = std::make_shared<mtp::AsyncObjectInputStream>(reader);
+						_session->SendObject(source);
+					}
+					AddChild(parent, filename, noi.ObjectId);
+					++files;
+				}
+				catch(const mtp::system_error &ex)
+				{ throw; }
+				catch(const std::exception &ex)
+				{
+					error("importing ", path, " failed: ", ex.what());
+					++failed;
+				}
+			}
+		}
+		catch(...)
+		{
+			if (fd != STDIN_FILENO)
+				close(fd);
+			throw;
+		}
+		if (fd != STDIN_FILENO)
+			close(fd);
+		print("imported ", files, " file(s), ", failed, " failed");
+	}
+
+	mtp::ObjectId Session::ResolveOrMakeDirectory(mtp::ObjectId parentId, const std::string & name)
+	{
+		using namespace mtp;
+		try
+		{
+			mtp::ObjectId existingObject = ResolveObjectChild(parentId, name);
+			ObjectFormat format = ObjectFormat(_session->GetObjectIntegerProperty(existingObject, ObjectProperty::ObjectFormat));
+			if (format != ObjectFormat::Association)
+			{
+				_session->DeleteObject(existingObject);
+				RemoveChild(existingObject);
+				throw std::runtime_error("target is not a directory");
+			}
+			return existingObject;
+		}
+		catch(const std::exception &ex)
+		{ return MakeDirectory(parentId, name); }
+	}
+
 	mtp::ObjectId Session::MakeDirectory(mtp::ObjectId parentId, const std::string & name)
 	{
 		using namespace mtp;
@@ -820,6 +2287,7 @@ namespace cli
 		oi.Filename = name;
 		oi.ObjectFormat = ObjectFormat::Association;
 		auto noi = _session->SendObjectInfo(oi, GetUploadStorageId(), parentId);
+		AddChild(parentId, name, noi.ObjectId, true);
 		return noi.ObjectId;
 	}
 
@@ -921,13 +2389,15 @@ namespace cli
 	{
 		using namespace mtp;
 		ObjectId id = Resolve(path);
-		msg::ObjectHandles oh = _session->GetObjectHandles(_cs, ObjectFormat::Any, id);
-
 		std::set<ObjectId> objectList;
-		for(auto id : oh.ObjectHandles)
-			objectList.insert(id);
+		size_t objects = 0;
+		_session->GetObjectHandles(_cs, ObjectFormat::Any, id, [&objectList, &objects](const std::vector<ObjectId> &handles)
+		{
+			objectList.insert(handles.begin(), handles.end());
+			objects += handles.size();
+		});
 
-		print("GetObjectHandles ", id, " returns ", oh.ObjectHandles.size(), " objects, ", objectList.size(), " unique");
+		print("GetObjectHandles ", id, " returns ", objects, " objects, ", objectList.size(), " unique");
 		GetObjectPropertyList(id, objectList, ObjectProperty::ObjectFilename);
 		GetObjectPropertyList(id, objectList, ObjectProperty::ObjectFormat);
 		GetObjectPropertyList(id, objectList, ObjectProperty::ObjectSize);
@@ -956,4 +2426,41 @@ namespace cli
 		print("used ", usedBytes, " (", usedPercents, "%), free ", si.FreeSpaceInBytes, " bytes of ", si.MaxCapacity);
 	}
 
+	mtp::usb::DevicePtr Session::GetUsbDevice()
+	{
+		auto device = _device->GetPipe()->GetDevice();
+		if (!device)
+			throw std::runtime_error("device is not connected via usb");
+		return device;
+	}
+
+	void Session::DumpUsbTrace(const LocalPath &path)
+	{
+		auto device = GetUsbDevice();
+		std::ofstream file(path.c_str());
+		if (!file)
+			throw std::runtime_error("could not open " + path);
+		device->WriteTrace(file);
+		if (!file.flush())
+			throw std::runtime_error("could not write " + path);
+	}
+
+	void Session::DisplayStats()
+	{
+		using namespace mtp;
+		auto stats = _session->GetStats().GetSnapshot();
+		print("operation count   errors  timeouts  aborts  avg ms    p95 ms    max ms    in            out           MiB/s");
+		for(auto & i : stats)
+		{
+			const OperationStats & op = i.second;
+			std::stringstream code;
+			code << hex(i.first, 4);
+			double seconds = op.TotalLatencyUs / 1000000.0;
+			double speed = seconds > 0? (op.BytesIn + op.BytesOut) / seconds / 1048576: 0;
+			print(std::left, width(code.str(), 10), width(op.Count, 8), width(op.Errors, 8), width(op.Timeouts, 10), width(op.Aborts, 8),
+				width(op.GetAverageLatencyUs() / 1000.0, 10), width(op.GetLatencyPercentileUs(95) / 1000.0, 10), width(op.MaxLatencyUs / 1000.0, 10),
+				width(op.BytesIn, 14), width(op.BytesOut, 14), speed);
+		}
+	}
+
 }
@@ -20,15 +20,26 @@
 #ifndef AFT_CLI_SESSION_H
 #define AFT_CLI_SESSION_H
 
+#include <mtp/ptp/Crc32c.h>
 #include <mtp/ptp/Device.h>
 #include <mtp/ptp/Session.h>
 #include <mtp/ptp/Messages.h>
+#include <mtp/ptp/ObjectCopier.h>
+#include <mtp/ptp/ObjectDeleter.h>
+#include <mtp/ptp/ObjectDownloader.h>
+#include <mtp/ptp/ObjectUploader.h>
+#include <mtp/ptp/ObjectTree.h>
 
 #include <cli/Command.h>
+#include <cli/FileWriter.h>
+#include <cli/ListingWriter.h>
+#include <cli/TarArchive.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <set>
+#include <vector>
 
 namespace cli
 {
@@ -38,28 +49,70 @@ namespace cli
 		mtp::SessionPtr				_session;
 		mtp::msg::DeviceInfo		_gdi;
 		mtp::StorageId				_cs; //current storage
+		mtp::ObjectTree::Formats	_formats; //listings and downloads are limited to these formats, empty for all
 		std::string					_csName; //current storage name
 		mtp::ObjectId				_cd; //current directory
 		bool						_running;
 		bool						_interactive;
 		bool						_showEvents;
+		ListingWriter::Format		_outputFormat; //listing format of ls, lsext and find
 		bool						_showPrompt;
 		std::string					_prompt;
 		unsigned					_terminalWidth;
 		bool						_batterySupported;
+		mtp::ObjectCopierPtr		_copier;
+		mtp::ObjectDeleterPtr		_deleter;
+		mtp::ObjectDownloaderPtr	_downloader;
+		mtp::ObjectUploaderPtr		_uploader;
+
+		typedef std::map<std::string, mtp::ObjectId> ChildrenIndex; //ordered, so completions are sorted
+		std::map<mtp::ObjectId, ChildrenIndex> _childrenIndex; //names of already resolved directories
+		std::map<mtp::ObjectId, std::set<mtp::ObjectId>> _directoryIndex; //subdirectories of already completed directories
+		std::vector<std::string>	_storageNames; //storage ids, labels and descriptions for completion, empty until first use
+		std::atomic_bool			_indicesStale; //set by device events, indices are dropped before next command
 
 		std::multimap<std::string, ICommandPtr> _commands;
 
 		char ** CompletionCallback(const char *text, int start, int end);
 
 		mtp::ObjectId ResolvePath(const std::string &path, std::string &file);
+		ChildrenIndex & GetChildrenIndex(mtp::ObjectId parent);
+		const std::set<mtp::ObjectId> & GetDirectoryIndex(mtp::ObjectId parent);
+		///updates already built index only
+		void AddChild(mtp::ObjectId parent, const std::string &name, mtp::ObjectId id, bool directory = false);
+		void RemoveChild(mtp::ObjectId id);
+		///drops indices of parent, they are rebuilt on next use
+		void InvalidateChildren(mtp::ObjectId parent);
 		mtp::ObjectId ResolveObjectChild(mtp::ObjectId parent, const std::string &entity);
 
+		struct GlobMatch //! object matched by wildcard path
+		{
+			mtp::ObjectId	Parent;
+			mtp::ObjectId	Id;
+			std::string		Name;
+		};
+		static bool IsGlob(const std::string &path)
+		{ return path.find_first_of("*?[") != path.npos; }
+		///expands wildcards in any path component from children indices, one listing per visited directory, throws if nothing matched
+		std::vector<GlobMatch> Glob(const Path &path);
+		static std::vector<std::string> GlobLocal(const LocalPath &pattern);
+		///downloads matches to dst as a single job, metadata of every parent is fetched once
+		void Get(const std::vector<GlobMatch> &matches, const LocalPath &dst, bool checksum);
+
 		static std::string GetFilename(const std::string &path);
 		static std::string GetDirname(const std::string &path);
 		static std::string FormatTime(const std::string &timespec);
+		static std::string FormatTime(time_t time);
 
 		void GetObjectPropertyList(mtp::ObjectId parent, const std::set<mtp::ObjectId> &originalObjectList, const mtp::ObjectProperty property);
+		void ListTree(ListingWriter &writer, const mtp::ObjectTree &tree, mtp::ObjectId parent, bool extended, const std::string &prefix);
+		void GetTree(const mtp::ObjectTree &tree, mtp::ObjectId parent, const LocalPath &dst, FileWriter &writer, bool thumb, bool checksum = false);
+		void Get(const mtp::ObjectTree::Object &object, const LocalPath &dst, FileWriter &writer, bool thumb, bool checksum = false);
+		static void PrintChecksum(const mtp::Crc32c &hash, const LocalPath &dst);
+		void ExportTree(const std::shared_ptr<TarWriter> &writer, const mtp::ObjectTree &tree, mtp::ObjectId parent, const std::string &prefix);
+		void ExportObject(const std::shared_ptr<TarWriter> &writer, mtp::ObjectId id, const std::string &path, mtp::u64 size, time_t mtime);
+		///returns directory for relative archive path, creating missing parents
+		mtp::ObjectId ResolveImportDirectory(std::map<std::string, mtp::ObjectId> &directories, const std::string &path);
 
 		mtp::StorageId GetUploadStorageId()
 		{ return _cs == mtp::Session::AllStorages? mtp::Session::AnyStorage: _cs; }
@@ -74,6 +127,8 @@ namespace cli
 		{ return _interactive; }
 		void ShowEvents(bool show)
 		{ _showEvents = show; }
+		void SetOutputFormat(ListingWriter::Format format)
+		{ _outputFormat = format; }
 		void InteractiveInput();
 		void ProcessCommand(const std::string &input);
 		void ProcessCommand(Tokens &&tokens);
@@ -82,6 +137,10 @@ namespace cli
 
 		void Help();
 		void Quit() { _running = false; }
+		bool IsRunning() const
+		{ return _running; }
+		///drops directory indices when device reports changes, for sessions serving many command batches
+		void SubscribeEvents();
 
 		void CompletePath(const Path &path, CompletionResult &result);
 		void CompleteStoragePath(const StoragePath &path, CompletionResult &result);
@@ -89,19 +148,46 @@ namespace cli
 		mtp::StorageId GetStorageByPath(const StoragePath &path, mtp::msg::StorageInfo &si, bool allowAll);
 		void DisplayDeviceInfo();
 		void List(mtp::ObjectId parent, bool extended, bool recursive, const std::string &prefix = std::string());
+		///filterList: comma separated predicates, format is also used to ask device for matching objects only
+		void Find(const Path &path, const std::string &pattern, const std::string &filterList);
+		void DiskUsage(const Path &path);
+		///comma separated extensions or hex codes, empty string resets filter
+		void SetFormats(const std::string &formats);
 		void ListStorages();
 		void ChangeStorage(const StoragePath &path);
 		void DisplayStorageInfo(const StoragePath &path);
-		void Get(const LocalPath &dst, mtp::ObjectId srcId, bool thumb = false);
-		void Get(const mtp::ObjectId srcId);
+		void DisplayStats();
+		mtp::usb::DevicePtr GetUsbDevice();
+		void DumpUsbTrace(const LocalPath &path);
+		///checksum prints crc32c of every downloaded file computed while streaming, in sha256sum-like format
+		void Get(const LocalPath &dst, mtp::ObjectId srcId, bool thumb = false, bool checksum = false);
+		void Get(const mtp::ObjectId srcId, bool checksum = false);
 		void GetThumb(const mtp::ObjectId srcId);
 		void GetThumb(const LocalPath &dst, mtp::ObjectId srcId)
 		{ Get(dst, srcId, true); }
 		void Cat(const Path &path);
+		///outputs range of object, zero length means until the end
+		void Cat(const Path &path, mtp::u64 offset, mtp::u64 length);
+		void FinishCat(const FileDescriptorOutputStream &stream);
 		void Rename(const Path & path, const std::string & newName);
+		void Copy(const Path &src, const Path &dst, bool move);
+		///transfers only new objects and objects with different size or mtime
+		void Sync(const Path &remote, const LocalPath &local, bool upload, bool dryRun);
 		void Put(mtp::ObjectId parentId, const LocalPath &src, const std::string &targetFilename = std::string());
+		///transfers grouped by remote directory, failed lines are reported and skipped, summary is printed at the end
+		void RunManifest(const LocalPath &path);
+		///renames objects from <path> <new name> lines with SetObjectProperties, failed lines are reported and skipped
+		void RunRenameList(const LocalPath &path);
 		void Put(const LocalPath &src, const Path &dst);
+		///streams object or directory subtree as tar archive to dst, - for stdout
+		void ExportTar(const Path &src, const LocalPath &dst);
+		///uploads files and directories of tar archive read from src, - for stdin, into dst directory
+		void ImportTar(const LocalPath &src, const Path &dst);
+		///streams object or directory subtree into directory of another device, given as <serial number or bus path>:<path>
+		void CopyDevice(const Path &src, const std::string &dst);
 		mtp::ObjectId MakeDirectory(mtp::ObjectId parentId, const std::string & name);
+		///returns existing directory, replaces file with the same name or creates it
+		mtp::ObjectId ResolveOrMakeDirectory(mtp::ObjectId parentId, const std::string & name);
 		void ListProperties(mtp::ObjectId id);
 		void ListDeviceProperties();
 		void TestObjectPropertyList(const Path &path);
@@ -116,20 +202,18 @@ namespace cli
 		void List(const Path &path, bool extended, bool recursive)
 		{ return List(Resolve(path), extended, recursive); }
 
-		void Put(const LocalPath &src)
-		{ Put(_cd, src); }
-
-		void Get(const Path &src)
-		{ Get(Resolve(src)); }
-
-		void Get(const LocalPath &dst, const Path &src)
-		{ Get(dst, Resolve(src)); }
+		///src and path components of the rest take shell wildcards
+		void Put(const LocalPath &src);
+		void Get(const Path &src, bool checksum = false);
+		void Get(const LocalPath &dst, const Path &src, bool checksum = false);
 
 		void GetThumb(const Path &src)
 		{ GetThumb(Resolve(src)); }
 
 		void GetThumb(const LocalPath &dst, const Path &src)
 		{ GetThumb(dst, Resolve(src)); }
+		///saves thumbnails of images and videos below src into dst, mirroring directories
+		void GetThumbTree(const Path &src, const LocalPath &dst);
 
 		void MakeDirectory(const Path &path)
 		{
@@ -141,8 +225,7 @@ namespace cli
 		void MakePath(const Path &path)
 		{ Resolve(path, true); }
 
-		void Delete(const Path &path)
-		{ _session->DeleteObject(Resolve(path)); }
+		void Delete(const Path &path);
 
 		void ListProperties(const Path &path)
 		{ ListProperties(Resolve(path)); }
@@ -0,0 +1,386 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <cli/TarArchive.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace cli
+{
+	namespace
+	{
+		const size_t NameSize = 100;
+		const size_t PrefixSize = 155;
+		const mtp::u64 MaxOctalSize = 077777777777ull; //11 digits
+
+		enum : size_t
+		{
+			NameOffset = 0, ModeOffset = 100, UidOffset = 108, GidOffset = 116, SizeOffset = 124, MtimeOffset = 136,
+			ChecksumOffset = 148, TypeOffset = 156, MagicOffset = 257, VersionOffset = 263, PrefixOffset = 345
+		};
+
+		void WriteOctal(mtp::u8 *field, size_t size, mtp::u64 value)
+		{
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%0*llo", static_cast<int>(size - 1), static_cast<unsigned long long>(value));
+			memcpy(field, buf, size - 1);
+			field[size - 1] = 0;
+		}
+
+		///octal with optional spaces and terminators, or gnu base-256 if high bit is set
+		mtp::u64 ReadNumber(const mtp::u8 *field, size_t size)
+		{
+			mtp::u64 value = 0;
+			if (field[0] & 0x80)
+			{
+				value = field[0] & 0x7f;
+				for(size_t i = 1; i < size; ++i)
+					value = (value << 8) | field[i];
+				return value;
+			}
+			size_t i = 0;
+			while(i < size && field[i] == ' ')
+				++i;
+			for(; i < size && field[i] >= '0' && field[i] <= '7'; ++i)
+				value = (value << 3) | (field[i] - '0');
+			return value;
+		}
+
+		std::string ReadString(const mtp::u8 *field, size_t size)
+		{
+			const mtp::u8 *end = std::find(field, field + size, 0);
+			return std::string(field, end);
+		}
+
+		unsigned Checksum(const mtp::u8 *header)
+		{
+			unsigned sum = 0;
+			for(size_t i = 0; i < TarWriter::BlockSize; ++i)
+				sum += (i >= ChecksumOffset && i < ChecksumOffset + 8)? ' ': header[i];
+			return sum;
+		}
+
+		///returns pax record "<length> key=value\n", length includes itself
+		std::string PaxRecord(const std::string &key, const std::string &value)
+		{
+			size_t size = key.size() + value.size() + 3;
+			size_t length = size + 1;
+			while(std::to_string(length).size() + size != length)
+				++length;
+			return std::to_string(length) + " " + key + "=" + value + "\n";
+		}
+
+		mtp::u64 GetPadding(mtp::u64 size)
+		{ return (TarWriter::BlockSize - size % TarWriter::BlockSize) % TarWriter::BlockSize; }
+	}
+
+	TarWriter::TarWriter(int fd): _fd(fd), _remaining(0), _dropped(0), _padding(0)
+	{ _buffer.reserve(BufferSize); }
+
+	void TarWriter::Flush()
+	{
+		for(size_t offset = 0; offset < _buffer.size(); )
+		{
+			ssize_t r = write(_fd, _buffer.data() + offset, _buffer.size() - offset);
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw mtp::system_error("write");
+			}
+			offset += r;
+		}
+		_buffer.clear();
+	}
+
+	void TarWriter::Append(const mtp::u8 *data, size_t size)
+	{
+		if (_buffer.size() + size > BufferSize)
+			Flush();
+		if (size >= BufferSize)
+		{
+			//large chunks of object data bypass buffer
+			_buffer.assign(data, data + size);
+			Flush();
+			return;
+		}
+		_buffer.insert(_buffer.end(), data, data + size);
+	}
+
+	void TarWriter::AppendPadding(mtp::u64 size)
+	{
+		static const mtp::u8 zeros[BlockSize] = { };
+		while(size)
+		{
+			size_t n = std::min<mtp::u64>(size, BlockSize);
+			Append(zeros, n);
+			size -= n;
+		}
+	}
+
+	void TarWriter::AppendHeader(const std::string &path, char type, mtp::u64 size, time_t mtime)
+	{
+		std::string name = path, prefix, pax;
+		if (name.size() > NameSize)
+		{
+			//split at slash into ustar prefix and name, pax path otherwise
+			size_t slash = path.find('/', path.size() > NameSize + 1? path.size() - NameSize - 1: 0);
+			if (slash != path.npos && slash <= PrefixSize && path.size() - slash - 1 <= NameSize && slash + 1 < path.size())
+			{
+				prefix = path.substr(0, slash);
+				name = path.substr(slash + 1);
+			}
+			else
+			{
+				pax += PaxRecord("path", path);
+				name = path.substr(0, NameSize);
+			}
+		}
+		if (size > MaxOctalSize)
+			pax += PaxRecord("size", std::to_string(size));
+
+		if (!pax.empty())
+		{
+			AppendHeader("PaxHeaders/" + name.substr(0, NameSize - 11), 'x', pax.size(), mtime);
+			Append(reinterpret_cast<const mtp::u8 *>(pax.data()), pax.size());
+			AppendPadding(GetPadding(pax.size()));
+		}
+
+		mtp::u8 header[BlockSize] = { };
+		memcpy(header + NameOffset, name.data(), std::min(name.size(), NameSize));
+		WriteOctal(header + ModeOffset, 8, type == '5'? 0755: 0644);
+		WriteOctal(header + UidOffset, 8, 0);
+		WriteOctal(header + GidOffset, 8, 0);
+		WriteOctal(header + SizeOffset, 12, std::min(size, MaxOctalSize));
+		WriteOctal(header + MtimeOffset, 12, mtime > 0? mtime: 0);
+		header[TypeOffset] = type;
+		memcpy(header + MagicOffset, "ustar", 6);
+		memcpy(header + VersionOffset, "00", 2);
+		memcpy(header + PrefixOffset, prefix.data(), std::min(prefix.size(), PrefixSize));
+		WriteOctal(header + ChecksumOffset, 7, Checksum(header));
+		header[ChecksumOffset + 7] = ' ';
+		Append(header, sizeof(header));
+	}
+
+	void TarWriter::AddDirectory(const std::string &path, time_t mtime)
+	{ AppendHeader(path.empty() || path.back() == '/'? path: path + "/", '5', 0, mtime); }
+
+	void TarWriter::BeginFile(const std::string &path, mtp::u64 size, time_t mtime)
+	{
+		if (_remaining)
+			throw std::logic_error("previous tar entry is not finished");
+		AppendHeader(path, '0', size, mtime);
+		_remaining = size;
+		_dropped = 0;
+		_padding = GetPadding(size);
+	}
+
+	bool TarWriter::EndFile()
+	{
+		bool complete = _remaining == 0 && _dropped == 0;
+		AppendPadding(_remaining + _padding);
+		_remaining = 0;
+		_padding = 0;
+		return complete;
+	}
+
+	void TarWriter::Finish()
+	{
+		AppendPadding(2 * BlockSize);
+		Flush();
+	}
+
+	size_t TarWriter::Write(const mtp::u8 *data, size_t size)
+	{
+		CheckCancelled();
+		size_t n = std::min<mtp::u64>(size, _remaining);
+		Append(data, n);
+		_remaining -= n;
+		_dropped += size - n; //archive entry size was announced already
+		return size;
+	}
+
+	TarReader::TarReader(int fd): _fd(fd), _offset(0), _size(0), _remaining(0), _padding(0)
+	{ }
+
+	size_t TarReader::Fill(mtp::u8 *data, size_t size)
+	{
+		if (_offset == _buffer.size())
+		{
+			_buffer.resize(BufferSize);
+			ssize_t r;
+			do
+				r = read(_fd, _buffer.data(), _buffer.size());
+			while(r < 0 && errno == EINTR);
+			if (r < 0)
+				throw mtp::system_error("read");
+			_buffer.resize(r);
+			_offset = 0;
+		}
+		size_t n = std::min(size, _buffer.size() - _offset);
+		std::copy(_buffer.data() + _offset, _buffer.data() + _offset + n, data);
+		_offset += n;
+		return n;
+	}
+
+	void TarReader::ReadExactly(mtp::u8 *data, size_t size)
+	{
+		while(size)
+		{
+			size_t r = Fill(data, size);
+			if (r == 0)
+				throw std::runtime_error("unexpected end of tar archive");
+			data += r;
+			size -= r;
+		}
+	}
+
+	void TarReader::Skip(mtp::u64 size)
+	{
+		mtp::u8 buf[4096];
+		while(size)
+		{
+			size_t n = std::min<mtp::u64>(size, sizeof(buf));
+			ReadExactly(buf, n);
+			size -= n;
+		}
+	}
+
+	std::string TarReader::ReadData(mtp::u64 size)
+	{
+		static const mtp::u64 MaxHeaderData = 1024 * 1024;
+		if (size > MaxHeaderData)
+			throw std::runtime_error("tar extended header is too big");
+		std::string data(size, '\0');
+		ReadExactly(reinterpret_cast<mtp::u8 *>(&data[0]), size);
+		Skip(GetPadding(size));
+		return data;
+	}
+
+	bool TarReader::Next(Entry &entry)
+	{
+		Skip(_remaining + _padding);
+		_remaining = _padding = 0;
+
+		std::string longPath;
+		mtp::u64 paxSize = 0;
+		bool hasPaxSize = false;
+		while(true)
+		{
+			mtp::u8 header[TarWriter::BlockSize];
+			size_t r = Fill(header, sizeof(header));
+			if (r == 0)
+				return false; //truncated archives without end marker are accepted
+			if (r < sizeof(header))
+				ReadExactly(header + r, sizeof(header) - r);
+			if (std::all_of(header, header + sizeof(header), [](mtp::u8 c) { return c == 0; }))
+				return false;
+			if (ReadNumber(header + ChecksumOffset, 8) != Checksum(header))
+				throw std::runtime_error("invalid tar header checksum");
+
+			mtp::u64 size = ReadNumber(header + SizeOffset, 12);
+			char type = header[TypeOffset];
+			if (type == 'x')
+			{
+				std::string records = ReadData(size);
+				for(size_t offset = 0; offset < records.size(); )
+				{
+					size_t space = records.find(' ', offset);
+					mtp::u64 length = strtoull(records.c_str() + offset, NULL, 10);
+					if (space == records.npos || length == 0 || offset + length > records.size())
+						throw std::runtime_error("invalid pax header");
+					std::string record = records.substr(space + 1, offset + length - space - 2);
+					size_t eq = record.find('=');
+					if (eq != record.npos)
+					{
+						std::string key = record.substr(0, eq), value = record.substr(eq + 1);
+						if (key == "path")
+							longPath = value;
+						else if (key == "size")
+						{
+							paxSize = strtoull(value.c_str(), NULL, 10);
+							hasPaxSize = true;
+						}
+					}
+					offset += length;
+				}
+				continue;
+			}
+			if (type == 'L')
+			{
+				longPath = ReadData(size);
+				longPath.resize(strlen(longPath.c_str()));
+				continue;
+			}
+			if (type == 'g' || type == 'K')
+			{
+				Skip(size + GetPadding(size));
+				continue;
+			}
+
+			if (hasPaxSize)
+				size = paxSize;
+			if (!longPath.empty())
+				entry.Path = longPath;
+			else
+			{
+				std::string prefix;
+				if (memcmp(header + MagicOffset, "ustar", 5) == 0)
+					prefix = ReadString(header + PrefixOffset, PrefixSize);
+				std::string name = ReadString(header + NameOffset, NameSize);
+				entry.Path = prefix.empty()? name: prefix + "/" + name;
+			}
+			entry.ModificationTime = ReadNumber(header + MtimeOffset, 12);
+			switch(type)
+			{
+			case '0': case '\0': case '7':
+				entry.EntryType = Entry::Type::File;
+				break;
+			case '5':
+				entry.EntryType = Entry::Type::Directory;
+				break;
+			default:
+				entry.EntryType = Entry::Type::Other;
+			}
+			if (entry.EntryType == Entry::Type::File && !entry.Path.empty() && entry.Path.back() == '/')
+				entry.EntryType = Entry::Type::Directory; //old archives mark directories with trailing slash only
+			if (type == '1' || type == '2' || entry.EntryType == Entry::Type::Directory)
+				size = 0; //links and directories have no content, size field is for some other purposes
+			entry.Size = size;
+			_size = _remaining = size;
+			_padding = GetPadding(size);
+			return true;
+		}
+	}
+
+	size_t TarReader::Read(mtp::u8 *data, size_t size)
+	{
+		CheckCancelled();
+		size_t n = Fill(data, std::min<mtp::u64>(size, _remaining));
+		if (n == 0 && _remaining)
+			throw std::runtime_error("unexpected end of tar archive");
+		_remaining -= n;
+		return n;
+	}
+}
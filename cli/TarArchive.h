@@ -0,0 +1,114 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_CLI_TARARCHIVE_H
+#define AFT_CLI_TARARCHIVE_H
+
+#include <mtp/ByteArray.h>
+#include <mtp/ptp/IObjectStream.h>
+
+#include <string>
+#include <time.h>
+
+namespace cli
+{
+	class TarWriter final: //! writes ustar archive to file descriptor, long names and huge sizes go into pax headers
+		public mtp::IObjectOutputStream,
+		public mtp::CancellableStream
+	{
+		int				_fd;
+		mtp::ByteArray	_buffer;
+		mtp::u64		_remaining; //bytes of current file which are still expected
+		mtp::u64		_dropped; //bytes received beyond announced size
+		size_t			_padding; //after current file
+
+		void Append(const mtp::u8 *data, size_t size);
+		void AppendPadding(mtp::u64 size);
+		void AppendHeader(const std::string &path, char type, mtp::u64 size, time_t mtime);
+		void Flush();
+
+	public:
+		static const size_t BlockSize = 512;
+		static const size_t BufferSize = 1024 * 1024;
+
+		///does not own fd, used for stdout or pipe
+		TarWriter(int fd);
+
+		void AddDirectory(const std::string &path, time_t mtime);
+
+		///starts file entry, its content is written with Write
+		void BeginFile(const std::string &path, mtp::u64 size, time_t mtime);
+
+		///completes file entry, missing bytes are filled with zeros, returns false if content did not match announced size
+		bool EndFile();
+
+		///writes end of archive marker and flushes buffered data
+		void Finish();
+
+		virtual size_t Write(const mtp::u8 *data, size_t size);
+	};
+
+	class TarReader final: //! reads ustar, pax and gnu archives from file descriptor entry by entry
+		public mtp::IObjectInputStream,
+		public mtp::CancellableStream
+	{
+	public:
+		struct Entry //! archive member, only files have content
+		{
+			enum struct Type { File, Directory, Other };
+
+			std::string	Path;
+			Type		EntryType;
+			mtp::u64	Size;
+			time_t		ModificationTime;
+
+			Entry(): EntryType(Type::Other), Size(0), ModificationTime(0) { }
+		};
+
+	private:
+		int				_fd;
+		mtp::ByteArray	_buffer;
+		size_t			_offset; //of unread data in _buffer
+		mtp::u64		_size; //of current entry
+		mtp::u64		_remaining; //unread bytes of current entry
+		size_t			_padding; //after current entry
+
+		size_t Fill(mtp::u8 *data, size_t size);
+		void ReadExactly(mtp::u8 *data, size_t size);
+		void Skip(mtp::u64 size);
+		std::string ReadData(mtp::u64 size);
+
+	public:
+		static const size_t BufferSize = 1024 * 1024;
+
+		///does not own fd, used for stdin or pipe
+		TarReader(int fd);
+
+		///skips the rest of previous entry and reads next header, returns false at the end of archive
+		bool Next(Entry &entry);
+
+		///size of current entry
+		virtual mtp::u64 GetSize() const
+		{ return _size; }
+
+		///reads content of current entry, returns 0 at its end
+		virtual size_t Read(mtp::u8 *data, size_t size);
+	};
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_CLI_UPLOADCHECKPOINT_H
+#define AFT_CLI_UPLOADCHECKPOINT_H
+
+#include <mtp/ptp/ObjectId.h>
+
+#include <functional>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cli
+{
+	class UploadCheckpoint //! progress of resumable upload, kept in user cache directory until upload is finished
+	{
+		std::string		_path;
+
+	public:
+		struct State
+		{
+			mtp::ObjectId	ObjectId;
+			mtp::u64		Size; //of local file
+			time_t			ModificationTime; //of local file
+			mtp::u64		Committed;
+
+			State(): Size(0), ModificationTime(0), Committed(0) { }
+		};
+
+		UploadCheckpoint(const std::string &serial, mtp::StorageId storageId, mtp::ObjectId parentId, const std::string &filename)
+		{
+			const char *home = getenv("HOME");
+			if (!home)
+				return;
+
+			std::string dir = std::string(home) + "/.cache";
+			mkdir(dir.c_str(), 0700);
+			dir += "/whoozle.github.io";
+			mkdir(dir.c_str(), 0700);
+			dir += "/aft-uploads";
+			mkdir(dir.c_str(), 0700);
+
+			std::string key = serial + '\n' + std::to_string(storageId.Id) + '\n' + std::to_string(parentId.Id) + '\n' + filename;
+			char name[32];
+			snprintf(name, sizeof(name), "/%016llx", static_cast<unsigned long long>(std::hash<std::string>()(key)));
+			_path = dir + name;
+		}
+
+		///returns true if checkpoint for local file of given size and modification time exists
+		bool Load(State &state, mtp::u64 size, time_t mtime) const
+		{
+			if (_path.empty())
+				return false;
+
+			FILE *f = fopen(_path.c_str(), "r");
+			if (!f)
+				return false;
+
+			unsigned id;
+			unsigned long long fileSize, committed;
+			long long fileMtime;
+			bool ok = fscanf(f, "%u %llu %lld %llu", &id, &fileSize, &fileMtime, &committed) == 4;
+			fclose(f);
+			if (!ok || fileSize != size || fileMtime != mtime)
+				return false;
+
+			state.ObjectId = mtp::ObjectId(id);
+			state.Size = fileSize;
+			state.ModificationTime = fileMtime;
+			state.Committed = committed;
+			return true;
+		}
+
+		///records committed offset, failure only loses ability to resume
+		void Save(const State &state) const
+		{
+			if (_path.empty())
+				return;
+
+			std::string tmp = _path + ".tmp";
+			FILE *f = fopen(tmp.c_str(), "w");
+			if (!f)
+				return;
+			fprintf(f, "%u %llu %lld %llu\n", state.ObjectId.Id,
+				static_cast<unsigned long long>(state.Size), static_cast<long long>(state.ModificationTime),
+				static_cast<unsigned long long>(state.Committed));
+			if (fclose(f) == 0)
+				rename(tmp.c_str(), _path.c_str());
+			else
+				unlink(tmp.c_str());
+		}
+
+		void Remove() const
+		{
+			if (!_path.empty())
+				unlink(_path.c_str());
+		}
+	};
+}
+
+#endif
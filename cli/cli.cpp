@@ -21,19 +21,98 @@
 #include <stdexcept>
 
 #include <usb/Context.h>
+#include <usb/Device.h>
 
 #include <cli/CommandLine.h>
+#include <cli/Daemon.h>
 #include <cli/Session.h>
 
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/net/Broker.h>
+#include <mtp/net/Relay.h>
 #include <mtp/log.h>
 #include <mtp/version.h>
 
+#include <errno.h>
+
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+namespace
+{
+	///forks daemon owning the device, returns socket connected to it once session is open
+	int StartServer(const std::string &path, const char *deviceId, bool claimInterface, size_t transferSize, const mtp::usb::ReaperPolicy &reaper)
+	{
+		using namespace mtp;
+		int ready[2];
+		if (pipe(ready) != 0)
+			throw posix::Exception("pipe");
+
+		pid_t pid = fork();
+		if (pid < 0)
+			throw posix::Exception("fork");
+
+		if (pid == 0)
+		{
+			close(ready[0]);
+			setsid();
+			int null = open("/dev/null", O_RDWR);
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO); //session is not interactive
+			try
+			{
+				//socket is bound first, concurrent clients wait for the session in the backlog
+				cli::Daemon daemon(path);
+				auto mtp = deviceId? Device::Find(deviceId, claimInterface): Device::FindFirst(claimInterface);
+				if (!mtp)
+					throw std::runtime_error("no mtp device found");
+				if (transferSize && mtp->GetPipe()->GetDevice())
+					mtp->GetPipe()->GetDevice()->SetTransferSize(transferSize);
+				if (reaper.Enabled && mtp->GetPipe()->GetDevice())
+					mtp->GetPipe()->GetDevice()->SetReaper(reaper); //started after fork, threads are not inherited
+
+				cli::Session session(mtp, false);
+				if (!session.SetFirstStorage())
+					throw std::runtime_error("your device may be locked or does not have any storage available");
+				session.SubscribeEvents();
+
+				//errors until now were reported to the client starting the server
+				dup2(null, STDERR_FILENO);
+				close(null);
+				char ok = 1;
+				if (write(ready[1], &ok, 1) != 1)
+					throw posix::Exception("write");
+				close(ready[1]);
+				daemon.Serve(session);
+			}
+			catch(const std::exception &ex)
+			{
+				error("error: ", ex.what());
+				exit(1);
+			}
+			exit(0);
+		}
+
+		close(ready[1]);
+		char ok = 0;
+		ssize_t r;
+		do
+			r = read(ready[0], &ok, 1);
+		while(r < 0 && errno == EINTR);
+		close(ready[0]);
+		if (r != 1)
+			throw std::runtime_error("could not start server");
+
+		int fd = cli::Daemon::Connect(path);
+		if (fd < 0)
+			throw std::runtime_error("could not connect to server " + path);
+		return fd;
+	}
+}
+
 int main(int argc, char **argv)
 {
 	using namespace mtp;
@@ -43,7 +122,15 @@ int main(int argc, char **argv)
 	bool showVersion = false;
 	bool claimInterface = true;
 	bool showEvents = false;
+	bool listDevices = false;
+	bool useServer = false;
+	const char *outputFormat = nullptr;
 	const char *fileInput = nullptr;
+	const char *deviceId = nullptr;
+	size_t transferSize = 0;
+	usb::ReaperPolicy reaper;
+	const char *relayAddress = nullptr;
+	const char *brokerAddress = nullptr;
 
 	if (!isatty(STDIN_FILENO))
 		showPrompt = false;
@@ -58,13 +145,21 @@ int main(int argc, char **argv)
 		{"version",			no_argument,		0,	'V' },
 		{"no-claim",		no_argument,		0,	'C' },
 		{"input-file",		required_argument,	0,	'f' },
+		{"transfer-size",	required_argument,	0,	'T' },
+		{"reaper",			required_argument,	0,	'r' },
+		{"device",			required_argument,	0,	'd' },
+		{"list-devices",	no_argument,		0,	'l' },
+		{"server",			no_argument,		0,	'S' },
+		{"relay",			required_argument,	0,	'R' },
+		{"broker",			required_argument,	0,	'M' },
+		{"format",			required_argument,	0,	'F' },
 		{0,					0,					0,	 0	}
 	};
 
 	while(true)
 	{
 		int optionIndex = 0; //index of matching option
-		int c = getopt_long(argc, argv, "ibehvVCf:", long_options, &optionIndex);
+		int c = getopt_long(argc, argv, "ibehlvVCSd:f:F:T:r:R:M:", long_options, &optionIndex);
 		if (c == -1)
 			break;
 		switch(c)
@@ -88,6 +183,43 @@ int main(int argc, char **argv)
 		case 'e':
 			showEvents = true;
 			break;
+		case 'd':
+			deviceId = optarg;
+			break;
+		case 'l':
+			listDevices = true;
+			break;
+		case 'S':
+			useServer = true;
+			break;
+		case 'F':
+			outputFormat = optarg;
+			break;
+		case 'r':
+			try
+			{ reaper = usb::ReaperPolicy::Parse(optarg); }
+			catch(const std::exception &ex)
+			{
+				error(ex.what());
+				showHelp = true;
+			}
+			break;
+		case 'R':
+			relayAddress = optarg; //validated when it's bound
+			break;
+		case 'M':
+			brokerAddress = optarg;
+			break;
+		case 'T':
+			{
+				char *end;
+				transferSize = strtoul(optarg, &end, 10);
+				if (*end == 'k' || *end == 'K')
+					transferSize *= 1024;
+				else if (*end == 'm' || *end == 'M')
+					transferSize *= 1024 * 1024;
+			}
+			break;
 		case '?':
 		case 'h':
 		default:
@@ -121,6 +253,14 @@ int main(int argc, char **argv)
 			"-e\t--events\t\tallow event processing\n"
 			"-f\t--input-file\tuse file to read input commands\n"
 			"-C\t--no-claim\tno usb interface claim\n"
+			"-T\t--transfer-size\tusb transfer size in bytes (k/m suffixes allowed), automatic by default\n"
+			"-r\t--reaper\treap usb completions in dedicated thread with [policy][:priority][@cpus] scheduling, e.g. fifo:10@2 or @0-1\n"
+			"-d\t--device\tuse device with given serial number or usb bus path (e.g. 1-2.3)\n"
+			"-l\t--list-devices\tlist bus paths and serial numbers of connected devices\n"
+			"-S\t--server\trun commands in background server keeping the session open, started on demand, exits after 5 idle minutes\n"
+			"-R\t--relay\t\tserve device on given [host:]port, loopback by default, * for all interfaces, clients set AFT_REMOTE=host:port to use it, remote ones need shared AFT_RELAY_TOKEN on both sides\n"
+			"-M\t--broker\tshare one session of device between several clients (mount, ui, cli) connecting to given [host:]port with AFT_REMOTE=host:port, same address and token rules as --relay\n"
+			"-F\t--format\tformat of ls, lsext and find output: text (default), jsonl or tsv\n"
 			"-V\t--version\tshow version information"
 			);
 		exit(0);
@@ -132,17 +272,88 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
-	auto mtp = Device::FindFirst(claimInterface);
+	if (listDevices)
+	{
+		for(auto & device : Device::FindAll(claimInterface))
+		try
+		{
+			msg::DeviceInfo info = device->GetInfo();
+			print(device->GetBusPath(), "\t", info.SerialNumber, "\t", info.Manufacturer, " ", info.Model);
+		}
+		catch(const std::exception &ex)
+		{ error("error: ", ex.what()); }
+		exit(0);
+	}
+
+	if (useServer)
+	{
+		//thin client: commands from arguments or input, output is written by server straight into our descriptors
+		//server keeps its session between clients, so format is always set for this one
+		std::string commands = std::string("output-format ") + (outputFormat? outputFormat: "text") + "\n";
+		for(int i = optind; i < argc; ++i)
+			commands += std::string(argv[i]) + "\n";
+		if (optind >= argc)
+		{
+			std::string line;
+			while(std::getline(std::cin, line))
+				commands += line + "\n";
+		}
+
+		try
+		{
+			std::string path = cli::Daemon::GetSocketPath(deviceId? deviceId: std::string());
+			int fd = cli::Daemon::Connect(path);
+			if (fd < 0)
+				fd = StartServer(path, deviceId, claimInterface, transferSize, reaper);
+			exit(cli::Daemon::Run(fd, commands));
+		}
+		catch(const std::exception &ex)
+		{ error("error: ", ex.what()); exit(1); }
+	}
+
+	auto mtp = deviceId? Device::Find(deviceId, claimInterface): Device::FindFirst(claimInterface);
 	if (!mtp)
 	{
 		error("no mtp device found");
 		exit(1);
 	}
+	if (transferSize && mtp->GetPipe()->GetDevice())
+		mtp->GetPipe()->GetDevice()->SetTransferSize(transferSize);
+	if (reaper.Enabled && mtp->GetPipe()->GetDevice())
+		mtp->GetPipe()->GetDevice()->SetReaper(reaper);
+
+	if (relayAddress)
+	{
+		//raw bulk transfers are relayed, session is opened by remote client
+		try
+		{
+			net::Relay relay(mtp->GetPipe(), mtp->GetVendorId(), mtp->GetProductId(), mtp->GetBusPath(), relayAddress, net::Channel::GetToken());
+			print("relaying device ", mtp->GetBusPath(), " on ", relayAddress);
+			relay.Run();
+		}
+		catch(const std::exception &ex)
+		{ error("error: ", ex.what()); exit(1); }
+	}
+
+	if (brokerAddress)
+	{
+		//transactions of all clients are interleaved on single session, clients see it as their own
+		try
+		{
+			net::Broker broker(mtp, brokerAddress, net::Channel::GetToken());
+			print("sharing device ", mtp->GetBusPath(), " on ", brokerAddress);
+			broker.Run();
+		}
+		catch(const std::exception &ex)
+		{ error("error: ", ex.what()); exit(1); }
+	}
 
 	try
 	{
 		bool hasCommands = optind >= argc;
 		cli::Session session(mtp, showPrompt);
+		if (outputFormat)
+			session.SetOutputFormat(cli::ListingWriter::ParseFormat(outputFormat));
 		if (!session.SetFirstStorage())
 		{
 			error("your device may be locked or does not have any storage available");
@@ -20,6 +20,9 @@
 #ifndef AFS_FUSE_FUSEDIRECTORY_H
 #define	AFS_FUSE_FUSEDIRECTORY_H
 
+#include <mtp/types.h>
+
+#include <string.h>
 #include <vector>
 
 #include <fuse_lowlevel.h>
@@ -45,6 +48,43 @@ namespace mtp { namespace fuse
 			fuse_add_direntry(Request, data.data() + offset, size, name.c_str(), &entry, data.size()); //request is not used inside fuse here, so we could cache resulting dirent data
 		}
 
+		///removes entry in place, shifting offsets of following entries, returns false if not found
+		static bool Remove(CharArray & data, const std::string &name)
+		{
+			struct Header //struct fuse_dirent from fuse_kernel.h, stable kernel ABI
+			{
+				u64 Inode;
+				u64 Next;
+				u32 NameLength;
+				u32 Type;
+			};
+
+			size_t offset = 0;
+			while(offset + sizeof(Header) <= data.size())
+			{
+				Header header;
+				memcpy(&header, data.data() + offset, sizeof(header));
+				if (header.Next <= offset || header.Next > data.size())
+					return false;
+
+				if (header.NameLength == name.size() && memcmp(data.data() + offset + sizeof(header), name.data(), name.size()) == 0)
+				{
+					size_t size = header.Next - offset;
+					data.erase(data.begin() + offset, data.begin() + header.Next);
+					while(offset + sizeof(Header) <= data.size())
+					{
+						memcpy(&header, data.data() + offset, sizeof(header));
+						header.Next -= size;
+						memcpy(data.data() + offset, &header, sizeof(header));
+						offset = header.Next;
+					}
+					return true;
+				}
+				offset = header.Next;
+			}
+			return false;
+		}
+
 		static void Reply(fuse_req_t req, const CharArray &data, off_t off, size_t size)
 		{
 			if (off >= (off_t)data.size())
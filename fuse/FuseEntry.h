@@ -29,7 +29,10 @@ namespace mtp { namespace fuse
 
 	struct FuseEntry : fuse_entry_param
 	{
-		static constexpr const double	Timeout = 60.0;
+		static constexpr const double	Timeout = 10.0;
+		static constexpr const double	ReadOnlyTimeout = 3600.0;
+		static constexpr const double	NotifiedTimeout = 600.0; //device events invalidate kernel caches
+		static constexpr const double	SnapshotTimeout = 1e9; //device is not expected to change, clamped by libfuse
 		static constexpr unsigned 		FileMode 		= S_IFREG | 0444;
 		static constexpr unsigned 		DirectoryMode	= S_IFDIR | 0755;
 
@@ -41,6 +44,9 @@ namespace mtp { namespace fuse
 			attr_timeout = entry_timeout = Timeout;
 		};
 
+		void SetTimeout(double timeout)
+		{ attr_timeout = entry_timeout = timeout; }
+
 		void SetId(FuseId id)
 		{
 			ino = id.Inode;
@@ -82,7 +88,20 @@ namespace mtp { namespace fuse
 		{
 			if (attr.st_mode == 0)
 				throw std::runtime_error("uninitialized attr in FuseEntry::ReplyAttr");
-			FUSE_CALL(fuse_reply_attr(Request, &attr, Timeout));
+			FUSE_CALL(fuse_reply_attr(Request, &attr, attr_timeout));
+		}
+
+		///replies with negative entry, kernel caches lookup miss for entry_timeout
+		void ReplyNotFound()
+		{
+			if (entry_timeout <= 0)
+			{
+				ReplyError(ENOENT);
+				return;
+			}
+			ino = 0;
+			attr = { };
+			FUSE_CALL(fuse_reply_entry(Request, this));
 		}
 
 		void ReplyError(int err)
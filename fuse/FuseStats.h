@@ -0,0 +1,184 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFS_FUSE_FUSESTATS_H
+#define	AFS_FUSE_FUSESTATS_H
+
+#include <mtp/types.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+
+namespace mtp { namespace fuse
+{
+
+	class FuseStats //! fuse request and metadata cache counters, written in prometheus text format
+	{
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		enum Operation
+		{
+			Lookup, ReadDir, ReadDirPlus, GetAttr, SetAttr, Read, Write, MakeNode, Create, Open,
+			Rename, Release, Flush, FSync, MakeDir, RemoveDir, Unlink, StatFS,
+			SetXAttr, GetXAttr, RemoveXAttr, OpenDir, ReleaseDir,
+			Keepalive, //background transaction of idle mount, its latency is the cost of waking device up
+			OperationCount
+		};
+
+		enum Cache
+		{
+			FilesCache, AttrsCache, DirectoryCache, StorageCache,
+			CacheCount
+		};
+
+		class Scope : Noncopyable //! measures single request, enabled flag is sampled once
+		{
+			FuseStats &			_stats;
+			Operation			_operation;
+			bool				_enabled;
+			bool				_failed;
+			clock::time_point	_started;
+
+		public:
+			Scope(FuseStats &stats, Operation operation): _stats(stats), _operation(operation), _enabled(stats.IsEnabled()), _failed(false)
+			{
+				if (_enabled)
+					_started = clock::now();
+			}
+
+			~Scope()
+			{
+				if (_enabled)
+					_stats.Record(_operation, clock::now() - _started, _failed);
+			}
+
+			void Fail()
+			{ _failed = true; }
+		};
+
+	private:
+		struct OperationCounter
+		{
+			u64		Count;
+			u64		Errors;
+			u64		TotalLatencyUs;
+			u64		MaxLatencyUs;
+
+			OperationCounter(): Count(), Errors(), TotalLatencyUs(), MaxLatencyUs() { }
+		};
+
+		bool									_enabled;
+		mutable std::mutex						_mutex;
+		std::array<OperationCounter, OperationCount>	_operations;
+		std::atomic<u64>						_hits[CacheCount];
+		std::atomic<u64>						_misses[CacheCount];
+
+	public:
+		FuseStats(bool enabled = false): _enabled(enabled)
+		{
+			for(unsigned i = 0; i < CacheCount; ++i)
+			{
+				_hits[i].store(0);
+				_misses[i].store(0);
+			}
+		}
+
+		bool IsEnabled() const
+		{ return _enabled; }
+
+		static const char * GetName(Operation operation)
+		{
+			static const char * names[OperationCount] =
+			{
+				"lookup", "readdir", "readdirplus", "getattr", "setattr", "read", "write", "mknod", "create", "open",
+				"rename", "release", "flush", "fsync", "mkdir", "rmdir", "unlink", "statfs",
+				"setxattr", "getxattr", "removexattr", "opendir", "releasedir",
+				"keepalive"
+			};
+			return names[operation];
+		}
+
+		static const char * GetName(Cache cache)
+		{
+			static const char * names[CacheCount] = { "files", "attrs", "directory", "storage" };
+			return names[cache];
+		}
+
+		void Record(Operation operation, clock::duration latency, bool failed)
+		{
+			u64 latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+			scoped_mutex_lock l(_mutex);
+			OperationCounter &counter = _operations[operation];
+			++counter.Count;
+			if (failed)
+				++counter.Errors;
+			counter.TotalLatencyUs += latencyUs;
+			if (latencyUs > counter.MaxLatencyUs)
+				counter.MaxLatencyUs = latencyUs;
+		}
+
+		void Hit(Cache cache)
+		{ _hits[cache].fetch_add(1, std::memory_order_relaxed); }
+		void Miss(Cache cache)
+		{ _misses[cache].fetch_add(1, std::memory_order_relaxed); }
+
+		///writes request and cache counters, readahead counters are owned by cache and passed here
+		void Export(std::ostream &os, u64 readaheadHits, u64 readaheadMisses) const
+		{
+			std::array<OperationCounter, OperationCount> operations;
+			{
+				scoped_mutex_lock l(_mutex);
+				operations = _operations;
+			}
+
+			os << "# TYPE aft_fuse_requests_total counter\n";
+			for(unsigned i = 0; i < OperationCount; ++i)
+				if (operations[i].Count)
+					os << "aft_fuse_requests_total{op=\"" << GetName(static_cast<Operation>(i)) << "\"} " << operations[i].Count << "\n";
+			os << "# TYPE aft_fuse_request_errors_total counter\n";
+			for(unsigned i = 0; i < OperationCount; ++i)
+				if (operations[i].Count)
+					os << "aft_fuse_request_errors_total{op=\"" << GetName(static_cast<Operation>(i)) << "\"} " << operations[i].Errors << "\n";
+			os << "# TYPE aft_fuse_request_seconds_total counter\n";
+			for(unsigned i = 0; i < OperationCount; ++i)
+				if (operations[i].Count)
+					os << "aft_fuse_request_seconds_total{op=\"" << GetName(static_cast<Operation>(i)) << "\"} " << operations[i].TotalLatencyUs / 1e6 << "\n";
+			os << "# TYPE aft_fuse_request_max_seconds gauge\n";
+			for(unsigned i = 0; i < OperationCount; ++i)
+				if (operations[i].Count)
+					os << "aft_fuse_request_max_seconds{op=\"" << GetName(static_cast<Operation>(i)) << "\"} " << operations[i].MaxLatencyUs / 1e6 << "\n";
+
+			os << "# TYPE aft_fuse_cache_hits_total counter\n";
+			for(unsigned i = 0; i < CacheCount; ++i)
+				os << "aft_fuse_cache_hits_total{cache=\"" << GetName(static_cast<Cache>(i)) << "\"} " << _hits[i].load(std::memory_order_relaxed) << "\n";
+			os << "aft_fuse_cache_hits_total{cache=\"readahead\"} " << readaheadHits << "\n";
+			os << "# TYPE aft_fuse_cache_misses_total counter\n";
+			for(unsigned i = 0; i < CacheCount; ++i)
+				os << "aft_fuse_cache_misses_total{cache=\"" << GetName(static_cast<Cache>(i)) << "\"} " << _misses[i].load(std::memory_order_relaxed) << "\n";
+			os << "aft_fuse_cache_misses_total{cache=\"readahead\"} " << readaheadMisses << "\n";
+		}
+	};
+
+}}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFS_FUSE_MEMORYBUDGET_H
+#define	AFS_FUSE_MEMORYBUDGET_H
+
+#include <mtp/types.h>
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <ostream>
+
+namespace mtp { namespace fuse
+{
+
+	class MemoryBudget : Noncopyable //! single memory limit shared by caches and buffers, usage is accounted per consumer
+	{
+	public:
+		enum Consumer
+		{
+			Objects, Listings, Readahead, Uploads, Thumbnails, Responses,
+			ConsumerCount
+		};
+
+		class Scope : Noncopyable //! accounts temporary buffer until the end of scope
+		{
+			MemoryBudget &	_budget;
+			Consumer		_consumer;
+			size_t			_size;
+
+		public:
+			Scope(MemoryBudget &budget, Consumer consumer, size_t size): _budget(budget), _consumer(consumer), _size(size)
+			{ _budget.Acquire(_consumer, _size); }
+
+			~Scope()
+			{ _budget.Release(_consumer, _size); }
+		};
+
+	private:
+		size_t										_limit; //0 is unlimited
+		std::array<std::atomic<size_t>, ConsumerCount>	_used;
+		std::atomic<size_t>							_total;
+
+	public:
+		MemoryBudget(size_t limit = 0): _limit(limit), _total(0)
+		{
+			for(auto &used : _used)
+				used.store(0, std::memory_order_relaxed);
+		}
+
+		static const char * GetName(Consumer consumer)
+		{
+			static const char * names[ConsumerCount] = { "objects", "listings", "readahead", "uploads", "thumbnails", "responses" };
+			return names[consumer];
+		}
+
+		bool IsLimited() const
+		{ return _limit != 0; }
+
+		size_t GetLimit() const
+		{ return _limit; }
+
+		size_t GetUsed() const
+		{ return _total.load(std::memory_order_relaxed); }
+
+		size_t GetUsed(Consumer consumer) const
+		{ return _used[consumer].load(std::memory_order_relaxed); }
+
+		///returns free memory, unlimited budget has always enough
+		size_t GetAvailable() const
+		{
+			if (!_limit)
+				return std::numeric_limits<size_t>::max();
+			size_t used = GetUsed();
+			return used < _limit? _limit - used: 0;
+		}
+
+		bool IsExceeded() const
+		{ return _limit && GetUsed() > _limit; }
+
+		///accounts memory if it fits into limit, returns false otherwise, so caller could evict something or stream instead
+		bool Reserve(Consumer consumer, size_t size)
+		{
+			size_t used = _total.load(std::memory_order_relaxed);
+			do
+			{
+				if (_limit && (used > _limit || size > _limit - used))
+					return false;
+			}
+			while(!_total.compare_exchange_weak(used, used + size, std::memory_order_relaxed));
+			_used[consumer].fetch_add(size, std::memory_order_relaxed);
+			return true;
+		}
+
+		///accounts memory held regardless of limit, e.g. data already received
+		void Acquire(Consumer consumer, size_t size)
+		{
+			_used[consumer].fetch_add(size, std::memory_order_relaxed);
+			_total.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void Release(Consumer consumer, size_t size)
+		{
+			_used[consumer].fetch_sub(size, std::memory_order_relaxed);
+			_total.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		///replaces usage of consumer which is recounted rather than tracked
+		void Set(Consumer consumer, size_t size)
+		{
+			size_t old = _used[consumer].exchange(size, std::memory_order_relaxed);
+			_total.fetch_add(size - old, std::memory_order_relaxed); //wraps around on decrease
+		}
+
+		void Export(std::ostream &os) const
+		{
+			if (_limit)
+				os << "# TYPE aft_fuse_memory_budget_bytes gauge\naft_fuse_memory_budget_bytes " << _limit << "\n";
+			os << "# TYPE aft_fuse_memory_used_bytes gauge\n";
+			for(unsigned i = 0; i < ConsumerCount; ++i)
+				os << "aft_fuse_memory_used_bytes{consumer=\"" << GetName(static_cast<Consumer>(i)) << "\"} " << GetUsed(static_cast<Consumer>(i)) << "\n";
+		}
+	};
+
+}}
+
+#endif
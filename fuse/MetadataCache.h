@@ -0,0 +1,243 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFS_FUSE_METADATACACHE_H
+#define	AFS_FUSE_METADATACACHE_H
+
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/log.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <sys/stat.h>
+
+namespace mtp { namespace fuse
+{
+
+	class MetadataCache : Noncopyable //! directory listings of single device, validated against object handles before use, optionally persistent
+	{
+	public:
+		struct Entry
+		{
+			ObjectId	Id;
+			std::string	Name;
+			mode_t		Mode;
+			u64			Size;
+			time_t		ModificationTime;
+			time_t		CreationTime;
+
+			Entry(): Mode(0), Size(0), ModificationTime(0), CreationTime(0) { }
+		};
+		typedef std::vector<Entry> Directory;
+
+	private:
+		static const u32						Magic = 0x43544641; //AFTC
+		static const u32						Version = 1;
+
+		std::string								_path;
+		std::map<u64, Directory>				_directories;
+		std::map<ObjectId, u64>					_parents;
+		std::set<u64>							_validated; //listings fetched or checked against device during this session
+		bool									_dirty;
+
+		void Index(u64 key, const Directory &dir)
+		{
+			for(auto &entry : dir)
+				_parents[entry.Id] = key;
+		}
+
+		void Load()
+		{
+			FILE *f = fopen(_path.c_str(), "rb");
+			if (!f)
+				return;
+
+			ByteArray data;
+			static const size_t Step = 65536;
+			size_t r;
+			do
+			{
+				size_t offset = data.size();
+				data.resize(offset + Step);
+				r = fread(data.data() + offset, 1, Step, f);
+				data.resize(offset + r);
+			}
+			while(r == Step);
+			fclose(f);
+
+			try
+			{
+				InputStream stream(data);
+				if (stream.Read32() != Magic || stream.Read32() != Version)
+				{
+					error("ignoring incompatible metadata cache ", _path);
+					return;
+				}
+				u32 dirs = stream.Read32();
+				while(dirs--)
+				{
+					u64 key = stream.Read64();
+					u32 n = stream.Read32();
+					Directory dir(n);
+					for(auto &entry : dir)
+					{
+						entry.Id = ObjectId(stream.Read32());
+						entry.Mode = stream.Read32();
+						entry.Size = stream.Read64();
+						entry.ModificationTime = stream.Read64();
+						entry.CreationTime = stream.Read64();
+						entry.Name = stream.ReadString();
+					}
+					Index(key, dir);
+					_directories[key].swap(dir);
+				}
+				debug("loaded ", _directories.size(), " directories from metadata cache ", _path);
+			}
+			catch(const std::exception &ex)
+			{
+				error("corrupted metadata cache ", _path, ": ", ex.what());
+				_directories.clear();
+				_parents.clear();
+			}
+		}
+
+	public:
+		///empty path creates memory-only cache
+		MetadataCache(const std::string &path): _path(path), _dirty(false)
+		{
+			if (!_path.empty())
+				Load();
+		}
+
+		const std::string & GetPath() const
+		{ return _path; }
+
+		~MetadataCache()
+		{
+			try { Save(); }
+			catch(const std::exception &ex) { error("saving metadata cache failed: ", ex.what()); }
+		}
+
+		static u64 StorageKey(StorageId id)
+		{ return (1ull << 32) | id.Id; }
+
+		static u64 ObjectKey(ObjectId id)
+		{ return id.Id; }
+
+		///returns cached listing only if it contains exactly the given objects, renamed or modified objects keep their handles, see IsValidated
+		const Directory * Find(u64 key, const std::vector<ObjectId> &handles) const
+		{
+			auto i = _directories.find(key);
+			if (i == _directories.end() || i->second.size() != handles.size())
+				return nullptr;
+
+			std::set<ObjectId> objects(handles.begin(), handles.end());
+			for(auto &entry : i->second)
+			{
+				if (objects.erase(entry.Id) == 0)
+					return nullptr;
+			}
+			return objects.empty()? &i->second: nullptr;
+		}
+
+		///true if listing was fetched or checked during this session, loaded listings may be stale
+		bool IsValidated(u64 key) const
+		{ return _validated.count(key) != 0; }
+
+		void SetValidated(u64 key)
+		{ _validated.insert(key); }
+
+		void Update(u64 key, Directory dir)
+		{
+			Invalidate(key);
+			Index(key, dir);
+			_directories[key].swap(dir);
+			_validated.insert(key);
+			_dirty = true;
+		}
+
+		void Invalidate(u64 key)
+		{
+			auto i = _directories.find(key);
+			if (i == _directories.end())
+				return;
+			for(auto &entry : i->second)
+				_parents.erase(entry.Id);
+			_directories.erase(i);
+			_validated.erase(key);
+			_dirty = true;
+		}
+
+		///drops listing containing given object
+		void InvalidateObject(ObjectId id)
+		{
+			auto i = _parents.find(id);
+			if (i != _parents.end())
+				Invalidate(i->second);
+		}
+
+		void Save()
+		{
+			if (!_dirty || _path.empty())
+				return;
+
+			ByteArray data;
+			OutputStream stream(data);
+			stream.Write32(Magic);
+			stream.Write32(Version);
+			stream.Write32(_directories.size());
+			for(auto &i : _directories)
+			{
+				stream.Write64(i.first);
+				stream.Write32(i.second.size());
+				for(auto &entry : i.second)
+				{
+					stream.Write32(entry.Id.Id);
+					stream.Write32(entry.Mode);
+					stream.Write64(entry.Size);
+					stream.Write64(entry.ModificationTime);
+					stream.Write64(entry.CreationTime);
+					stream.WriteString(entry.Name);
+				}
+			}
+
+			std::string tmpPath = _path + ".tmp";
+			FILE *f = fopen(tmpPath.c_str(), "wb");
+			if (!f)
+				throw std::runtime_error("cannot open " + tmpPath);
+			bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+			ok = fclose(f) == 0 && ok;
+			if (!ok || rename(tmpPath.c_str(), _path.c_str()) != 0)
+			{
+				remove(tmpPath.c_str());
+				throw std::runtime_error("cannot write " + _path);
+			}
+			_dirty = false;
+			debug("saved ", _directories.size(), " directories to metadata cache ", _path);
+		}
+	};
+
+}}
+
+#endif
@@ -0,0 +1,264 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFS_FUSE_READAHEADCACHE_H
+#define	AFS_FUSE_READAHEADCACHE_H
+
+#include <fuse/FuseId.h>
+#include <fuse/MemoryBudget.h>
+#include <mtp/ByteArray.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+
+namespace mtp { namespace fuse
+{
+
+	class ReadaheadCache //! per-file readahead buffers, window grows while reads are sequential, memory is capped per file and globally
+	{
+	public:
+		static const size_t MinWindow			= 128 * 1024;
+		static const size_t DefaultMaxWindow	= 4 * 1024 * 1024;
+
+		using Fetcher = std::function<void (u64 offset, size_t size, ByteArray &data)>;
+
+	private:
+		struct File
+		{
+			ByteArray	Data;
+			u64			Offset;
+			u64			NextOffset;
+			size_t		Window;
+			u64			LastUse;
+			bool		Pinned;
+
+			File(): Offset(0), NextOffset(0), Window(0), LastUse(0), Pinned(false) { }
+		};
+
+		std::map<FuseId, File>	_files;
+		size_t					_maxWindow;
+		size_t					_memoryLimit;
+		size_t					_used;
+		MemoryBudget *			_budget; //shared limit, buffers are accounted in it
+		u64						_clock;
+		std::atomic<u64>		_hits; //read without cache lock by statistics
+		std::atomic<u64>		_misses;
+
+	private:
+		void Account(const File &file)
+		{
+			_used += file.Data.size();
+			if (_budget)
+				_budget->Acquire(MemoryBudget::Readahead, file.Data.size());
+		}
+
+		void Drop(File &file)
+		{
+			_used -= file.Data.size();
+			if (_budget)
+				_budget->Release(MemoryBudget::Readahead, file.Data.size());
+			ByteArray().swap(file.Data);
+			file.Pinned = false;
+		}
+
+		size_t GetLimit() const
+		{ return _budget? std::min(_memoryLimit, _used + std::min(_budget->GetAvailable(), _memoryLimit)): _memoryLimit; }
+
+		///drops least recently used buffer other than id, returns false if there is none
+		bool Evict(FuseId id)
+		{
+			auto victim = _files.end();
+			for(auto i = _files.begin(); i != _files.end(); ++i)
+			{
+				if (i->first != id && !i->second.Data.empty() && !i->second.Pinned && (victim == _files.end() || i->second.LastUse < victim->second.LastUse))
+					victim = i;
+			}
+			if (victim == _files.end())
+				return false;
+			Drop(victim->second);
+			return true;
+		}
+
+		size_t Reserve(FuseId id, size_t required, size_t wanted)
+		{
+			while(_used + wanted > GetLimit() && Evict(id))
+				;
+			size_t limit = GetLimit();
+			if (_used + wanted > limit)
+				wanted = std::max(required, limit > _used? limit - _used: 0);
+			return wanted;
+		}
+
+	public:
+		///maxWindow is per-file limit, 0 disables readahead
+		ReadaheadCache(size_t maxWindow = DefaultMaxWindow): _used(0), _budget(NULL), _clock(0), _hits(0), _misses(0)
+		{ SetMaxWindow(maxWindow); }
+
+		void SetMaxWindow(size_t maxWindow)
+		{
+			_maxWindow = maxWindow;
+			_memoryLimit = 8 * std::max(maxWindow, MinWindow);
+		}
+
+		size_t GetMaxWindow() const
+		{ return _maxWindow; }
+
+		///buffers do not grow beyond free memory of budget, reads fall back to requested size
+		void SetBudget(MemoryBudget *budget)
+		{ _budget = budget; }
+
+		///drops unpinned buffers until size bytes are released or nothing is left to drop
+		void Shrink(size_t size)
+		{
+			size_t target = _used > size? _used - size: 0;
+			while(_used > target && Evict(FuseId(0)))
+				;
+		}
+
+		u64 GetHits() const
+		{ return _hits.load(std::memory_order_relaxed); }
+		u64 GetMisses() const
+		{ return _misses.load(std::memory_order_relaxed); }
+
+		///returns pointer to data for [offset, offset + size) range, fetching it with readahead if it's not cached
+		size_t Read(FuseId id, u64 offset, size_t size, u64 fileSize, const Fetcher &fetch, const u8 *&data)
+		{
+			File &file = _files[id];
+			file.LastUse = ++_clock;
+
+			if (offset < file.Offset || offset + size > file.Offset + file.Data.size())
+			{
+				_misses.fetch_add(1, std::memory_order_relaxed);
+				if (_maxWindow && offset == file.NextOffset)
+					file.Window = file.Window? std::min(file.Window * 2, _maxWindow): std::min(MinWindow, _maxWindow);
+				else
+					file.Window = 0;
+
+				size_t fetchSize = std::max(size, file.Window);
+				if (offset < fileSize)
+					fetchSize = std::min<u64>(fetchSize, std::max<u64>(size, fileSize - offset));
+
+				Drop(file);
+				fetchSize = Reserve(id, size, fetchSize);
+				fetch(offset, fetchSize, file.Data);
+				file.Offset = offset;
+				Account(file);
+			}
+			else
+				_hits.fetch_add(1, std::memory_order_relaxed);
+
+			file.NextOffset = offset + size;
+			size_t begin = offset - file.Offset;
+			data = file.Data.data() + begin;
+			return begin < file.Data.size()? std::min(size, file.Data.size() - begin): 0;
+		}
+
+		///fetches whole object and keeps it until invalidated, returns false if it does not fit into memory limit
+		bool Prefetch(FuseId id, u64 fileSize, const Fetcher &fetch)
+		{
+			if (fileSize > _memoryLimit)
+				return false;
+
+			File &file = _files[id];
+			file.LastUse = ++_clock;
+			Drop(file);
+			if (Reserve(id, 0, fileSize) < fileSize)
+				return false;
+
+			fetch(0, fileSize, file.Data);
+			file.Offset = 0;
+			file.Pinned = true;
+			Account(file);
+			return true;
+		}
+
+		///fetches whole object into free memory without evicting anything, it stays until read, evicted by other files or invalidated
+		///returns false if there is no room for it
+		bool Warm(FuseId id, u64 fileSize, const Fetcher &fetch)
+		{
+			if (GetCachedSize(id) >= fileSize)
+				return true;
+			if (_used + fileSize > GetLimit())
+				return false;
+
+			File &file = _files[id];
+			file.LastUse = ++_clock;
+			Drop(file);
+			fetch(0, fileSize, file.Data);
+			file.Offset = 0;
+			Account(file);
+			return true;
+		}
+
+		///appends next chunk of object to its cached beginning without evicting anything, so it can be warmed in steps
+		///returns false if there is no room for it
+		bool WarmChunk(FuseId id, u64 fileSize, size_t chunk, const Fetcher &fetch)
+		{
+			u64 cached = GetCachedSize(id);
+			if (cached >= fileSize)
+				return true;
+			size_t size = std::min<u64>(chunk, fileSize - cached);
+			if (_used + size > GetLimit())
+				return false;
+
+			File &file = _files[id];
+			file.LastUse = ++_clock;
+			if (cached == 0)
+				Drop(file); //buffer in the middle of object is replaced
+			ByteArray data;
+			fetch(cached, size, data);
+			file.Data.insert(file.Data.end(), data.begin(), data.end());
+			file.Offset = 0;
+			_used += data.size();
+			if (_budget)
+				_budget->Acquire(MemoryBudget::Readahead, data.size());
+			return true;
+		}
+
+		///returns number of bytes cached from the beginning of object
+		u64 GetCachedSize(FuseId id) const
+		{
+			auto i = _files.find(id);
+			return i != _files.end() && i->second.Offset == 0? i->second.Data.size(): 0;
+		}
+
+		///drops cached data, must be called when object is modified or closed
+		void Invalidate(FuseId id)
+		{
+			auto i = _files.find(id);
+			if (i == _files.end())
+				return;
+			Drop(i->second);
+			_files.erase(i);
+		}
+
+		void Clear()
+		{
+			if (_budget)
+				_budget->Release(MemoryBudget::Readahead, _used);
+			_files.clear();
+			_used = 0;
+		}
+	};
+
+}}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFS_FUSE_WRITEBACKBUFFER_H
+#define	AFS_FUSE_WRITEBACKBUFFER_H
+
+#include <mtp/ByteArray.h>
+#include <time.h>
+
+namespace mtp { namespace fuse
+{
+
+	class WriteBackBuffer //! merges contiguous writes to opened file into larger ones, remembers size of object on device and attribute changes deferred until release
+	{
+		u64			_offset;
+		ByteArray	_data;
+		u64			_committedSize;
+		u64			_truncateSize;
+		bool		_truncate;
+		time_t		_modificationTime;
+
+	public:
+		static const size_t MaxSize = 4 * 1024 * 1024;
+
+		WriteBackBuffer(u64 committedSize = 0): _offset(0), _committedSize(committedSize), _truncateSize(0), _truncate(false), _modificationTime(0) { }
+
+		bool Empty() const
+		{ return _data.empty(); }
+
+		u64 GetOffset() const
+		{ return _offset; }
+
+		u64 GetEnd() const
+		{ return _offset + _data.size(); }
+
+		const ByteArray & GetData() const
+		{ return _data; }
+
+		u64 GetCommittedSize() const
+		{ return _committedSize; }
+
+		void SetCommittedSize(u64 size)
+		{ _committedSize = size; }
+
+		///remembers size set by truncate, only the last one is sent to device before next write
+		void Truncate(u64 size)
+		{ _truncateSize = size; _truncate = size != _committedSize; }
+
+		bool TruncatePending() const
+		{ return _truncate; }
+
+		u64 GetTruncateSize() const
+		{ return _truncateSize; }
+
+		void ClearTruncate()
+		{ _truncate = false; }
+
+		///modification time applied when file is released, 0 if not set
+		time_t GetModificationTime() const
+		{ return _modificationTime; }
+
+		void SetModificationTime(time_t mtime)
+		{ _modificationTime = mtime; }
+
+		///appends data if it's contiguous with buffered one and buffer has enough space, empty buffer accepts any write
+		bool Append(u64 offset, const u8 *data, size_t size)
+		{
+			if (_data.empty())
+				_offset = offset;
+			else if (offset != GetEnd() || _data.size() + size > MaxSize)
+				return false;
+
+			if (_data.capacity() < MaxSize)
+				_data.reserve(MaxSize);
+			_data.insert(_data.end(), data, data + size);
+			return true;
+		}
+
+		void Clear()
+		{ _data.clear(); }
+	};
+
+}}
+
+#endif
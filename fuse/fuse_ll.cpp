@@ -20,21 +20,42 @@
 #include <fuse/Exception.h>
 #include <fuse/FuseId.h>
 #include <fuse/FuseEntry.h>
+#include <fuse/FuseStats.h>
 #include <fuse/FuseDirectory.h>
+#include <fuse/MemoryBudget.h>
+#include <fuse/MetadataCache.h>
+#include <fuse/ReadaheadCache.h>
+#include <fuse/WriteBackBuffer.h>
 
 #include <mtp/ptp/ByteArrayObjectStream.h>
 #include <mtp/ptp/Device.h>
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ObjectStore.h>
 #include <mtp/ptp/ObjectPropertyListParser.h>
+#include <mtp/ptp/ThumbnailFetcher.h>
 
 #include <mtp/usb/DeviceNotFoundException.h>
+#include <usb/Device.h>
+#include <usb/HotplugMonitor.h>
 
 #include <mtp/log.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <set>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <functional>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <fuse_lowlevel.h>
 
@@ -44,20 +65,65 @@ namespace
 
 	class FuseWrapper
 	{
-		std::mutex		_mutex;
+		std::mutex		_mutex; //device i/o, taken first; slow paths look caches up again after taking it, so concurrent requests for the same inode wait for one fetch and share its result
+		std::mutex		_cacheMutex; //metadata caches, modified with both mutexes held, so either one is enough for reading
+		std::mutex		_eventMutex; //device events queued by listener thread, taken last
+		std::vector<mtp::Event>	_pendingEvents;
+		std::atomic_bool	_eventsPending; //cached replies are bypassed until events are applied
+		int				_eventSubscription;
 		bool			_claimInterface;
+		std::string		_deviceId; //serial number or bus path, first device if empty
+		size_t			_transferSize;
+		mtp::usb::ReaperPolicy	_reaper;
+		bool			_reaperStarted; //reaper thread is started once mount is daemonized, then on every connect
+		bool			_eventsStarted; //same for event listener thread, events are not reported before
+		size_t			_prefetchSize;
+		size_t			_directIoSize; //files of this size or bigger are read bypassing page cache, 0 disables
+		size_t			_sequentialSize; //head of next files prefetched when directory is opened in name order, 0 disables
+		std::string		_cacheDir;
+		double			_timeout;
+		double			_readOnlyTimeout;
+		double			_keepalive; //seconds without requests after which device is pinged, 0 disables
+		bool			_writebackCache;
+		bool			_snapshot; //device is immutable for the lifetime of the mount, nothing is invalidated or written
+		bool			_crawl; //metadata of every storage is fetched in background after each connect
+		bool			_thumbnails; //directories have virtual .thumbnails subdirectory
+		std::vector<mtp::ObjectFormat>	_formats; //only directories and objects of these formats are listed, empty for all
 		mtp::DevicePtr	_device;
 		mtp::SessionPtr	_session;
 		bool			_editObjectSupported;
+		bool			_moveObjectSupported;
 		bool			_getObjectPropertyListSupported;
 		time_t			_connectTime;
 
+		FuseStats			_stats;
+		MemoryBudget		_budget; //shared by caches and buffers, reported in statistics
+		std::chrono::steady_clock::time_point	_metadataUsageTime; //last recount of metadata memory, guarded by cache mutex
+		static const int	MetadataUsageIntervalMs = 500; //recount walks all listings, so requests do not repeat it
+		mtp::SessionPtr		_statsSession; //statistics are read without device mutex, guarded by cache mutex
+		mtp::usb::DevicePtr	_statsDevice; //also source of urb trace
+		std::mutex			_statsFilesMutex;
+		std::map<uint64_t, std::string>	_statsFiles; //snapshots of opened statistics files and thumbnails
+		uint64_t			_nextStatsHandle;
+
+		struct DirectorySnapshot //! entries of directory handle as of its first read, readdirplus offsets index them, so changes during listing do not shift them
+		{
+			std::vector<std::pair<std::string, FuseId>>	Entries; //"." and ".." first
+			bool										Thumbnails; //listed without inodes and attributes of device objects
+
+			DirectorySnapshot(): Thumbnails(false) { }
+		};
+		typedef std::shared_ptr<DirectorySnapshot> DirectorySnapshotPtr;
+		std::mutex			_directorySnapshotsMutex;
+		std::map<uint64_t, DirectorySnapshotPtr>	_directorySnapshots; //by opendir handle, kernel serializes reads of one handle
+		uint64_t			_nextDirectoryHandle;
+
 		typedef std::map<std::string, FuseId> ChildrenObjects;
 		typedef std::map<FuseId, ChildrenObjects> Files;
 		Files			_files;
 
 		typedef std::map<mtp::ObjectId, struct stat> ObjectAttrs;
-		ObjectAttrs		_objectAttrs;
+		mtp::ObjectStore	_objects; //attributes of known objects, names are kept in _files
 
 		typedef mtp::Session::ObjectEditSessionPtr ObjectEditSessionPtr;
 		typedef std::map<FuseId, ObjectEditSessionPtr> OpenedFiles;
@@ -66,13 +132,186 @@ namespace
 		typedef std::map<FuseId, CharArray> DirectoryCache;
 		DirectoryCache	_directoryCache;
 
+		struct PartialListing //! directory enumerated object by object, readdir is served while it grows
+		{
+			std::vector<mtp::ObjectId>	Handles;
+			size_t						Next;
+			mtp::u64					CacheKey;
+			ChildrenObjects				Children;
+			ObjectAttrs					Attrs;
+			CharArray					Data; //readdir data, if serving readdir
+			bool						Serve;
+
+			PartialListing(): Next(0), CacheKey(0), Serve(false) { }
+		};
+		typedef std::map<FuseId, PartialListing> PartialListings;
+		PartialListings	_partialListings;
+		static const size_t					ListingBatchSize = 32;
+
+		typedef std::map<FuseId, mtp::u64> LookupCounts;
+		LookupCounts	_lookups; //entries referenced by kernel, guarded by _cacheMutex
+		std::map<FuseId, mtp::u64>			_listingUse; //last use of cached listings, guarded by _cacheMutex
+		mtp::u64							_listingClock;
+		static const size_t					MaxCachedObjects = 262144; //least recently used listings are dropped above this
+		static const size_t					ChildEntryCost = 96; //estimated name and tree node of cached listing entry
+		static const size_t					PropertyResponseCost = 32; //estimated bytes per object of single property list
+		static const size_t					AllPropertiesResponseCost = 256; //estimated bytes per object of list with all properties
+
+		typedef std::map<FuseId, std::set<std::string>> MissingEntries;
+		MissingEntries	_missingEntries; //negative lookups per parent
+		static const size_t					MaxMissingEntries = 1024;
+
+		std::set<FuseId>	_readOnlyDirectories; //storages and directories on read-only media
+
+		ReadaheadCache	_readahead;
+
+		struct PrefetchHint //! background crawl of directory subtree requested with prefetch extended attribute
+		{
+			enum class Status { Queued, Running, Done, Cancelled };
+
+			Status		State;
+			bool		Content; //files are read into readahead cache, not only listed
+			bool		Full; //readahead memory ran out, rest of content was skipped
+			bool		Restart; //content was requested while metadata crawl was running
+			mtp::u64	Directories;
+			mtp::u64	Files;
+			mtp::u64	Bytes;
+			mtp::u64	Errors;
+
+			PrefetchHint(): State(Status::Queued), Content(false), Full(false), Restart(false), Directories(0), Files(0), Bytes(0), Errors(0) { }
+		};
+		typedef std::map<FuseId, PrefetchHint> PrefetchHints;
+		std::mutex					_prefetchMutex; //hints and their queue, taken last
+		std::condition_variable		_prefetchCondition;
+		PrefetchHints				_prefetchHints;
+		std::deque<FuseId>			_prefetchQueue;
+		bool						_prefetchStop;
+		std::thread					_prefetchThread; //started by first hint once prefetch is started
+		bool						_prefetchStarted; //set after daemonizing, hints queued before wait for it
+		std::atomic<unsigned>		_foreground; //requests in progress, background prefetch waits for them
+		std::atomic<mtp::u64>		_requests; //foreground requests started so far, keepalive skips intervals having any
+		std::mutex					_keepaliveMutex; //taken last
+		std::condition_variable		_keepaliveCondition;
+		bool						_keepaliveStop;
+		std::thread					_keepaliveThread;
+		static constexpr const char *	PrefetchAttribute = "user.aft.prefetch";
+		static const int			PrefetchIdleMs = 20;
+
+		struct SequentialAccess //! last file opened in directory, next ones are prefetched once files are opened in name order
+		{
+			FuseId		Last;
+			unsigned	Streak; //files opened right after their predecessor
+			SequentialAccess(): Last(FuseId::Root), Streak(0) { }
+		};
+		struct SequentialPrefetch //! beginning or whole content of file to warm in background
+		{
+			FuseId		Parent;
+			FuseId		Inode;
+			mtp::u64	Size;
+		};
+		std::map<FuseId, SequentialAccess>	_sequentialAccess; //by directory, i/o mutex must be held
+		std::deque<SequentialPrefetch>		_sequentialQueue; //guarded by prefetch mutex, served before crawls
+		static const size_t			SequentialFiles = 2; //files prefetched ahead of the one being read
+		static const size_t			SequentialChunkSize = 1024 * 1024; //device mutex is released between chunks if transfer size is not set
+		static const size_t			MaxSequentialDirectories = 16;
+
+#if FUSE_USE_VERSION >= 30
+		typedef struct fuse_session *	NotifyHandle;
+#else
+		typedef struct fuse_chan *		NotifyHandle;
+#endif
+		struct Invalidation //! kernel cache entry to drop, inode attributes and data if name is empty, dentry of parent otherwise
+		{
+			FuseId		Inode;
+			std::string	Name;
+
+			Invalidation(FuseId inode, const std::string &name): Inode(inode), Name(name) { }
+		};
+		std::mutex					_notifyMutex; //invalidation queue, taken last
+		std::condition_variable		_notifyCondition;
+		std::vector<Invalidation>	_invalidations;
+		NotifyHandle				_notifyHandle;
+		bool						_notifyStop;
+		std::thread					_notifyThread; //applies device events as they arrive and pushes invalidations to kernel
+		std::atomic_bool			_notifying; //kernel learns about changes, so its entries could be cached for long
+		std::atomic_bool			_eventsSupported;
+
+		std::unique_ptr<MetadataCache>	_metadataCache;
+
+		typedef std::map<FuseId, WriteBackBuffer> WriteBuffers;
+		WriteBuffers	_writeBuffers;
+		std::set<FuseId>	_lostWrites; //acknowledged writes dropped by reconnect, flush, fsync and writes fail until file is released
+
+		struct PendingUpload //! new file written sequentially, sent with single SendObjectInfo/SendObject when complete
+		{
+			FuseId				Parent;
+			std::string			Name;
+			mtp::ObjectFormat	Format;
+			mtp::ByteArray		Data;
+			struct stat			Attr;
+
+			PendingUpload(): Parent(FuseId::Root), Format(), Attr() { }
+		};
+		typedef std::map<FuseId, PendingUpload> PendingUploads;
+		PendingUploads	_pendingUploads;
+		size_t			_pendingUploadSize;
+		fuse_ino_t		_nextPendingInode;
+
+		typedef std::map<FuseId, mtp::ObjectId> Aliases;
+		Aliases			_aliases; //uploaded pending inodes
+
+		static const size_t					MaxPendingUploadSize = 64 * 1024 * 1024;
+		static const size_t					MaxPendingUploadsSize = 2 * MaxPendingUploadSize;
+
 		static const size_t					MtpStorageShift = FUSE_ROOT_ID + 1;
 		static const size_t					MtpObjectShift = 999998 + MtpStorageShift;
+		static const fuse_ino_t				PendingInodeShift = static_cast<fuse_ino_t>(1) << (sizeof(fuse_ino_t) * 8 - 1); //above any mtp object inode
+		static const fuse_ino_t				StatsInode = PendingInodeShift - 1;
+		static const fuse_ino_t				UsbTraceInode = PendingInodeShift - 2;
+		static constexpr const char *		StatsFileName = ".aft-stats"; //not listed in root directory
+		static constexpr const char *		UsbTraceFileName = ".aft-usb-trace";
+		static const size_t					UsbTraceRecords = 65536;
+		static const fuse_ino_t				ThumbnailShift = PendingInodeShift >> 1; //thumbnail of object inode, below statistics files
+		static const fuse_ino_t				ThumbnailDirectoryShift = PendingInodeShift >> 2; //.thumbnails of directory inode
+		static constexpr const char *		ThumbnailDirectoryName = ".thumbnails"; //not listed, so tree walks do not fetch every thumbnail
+		static const size_t					MaxThumbnailCacheSize = 32 * 1024 * 1024;
+
+		struct CachedThumbnail //! encoded thumbnail, empty if object has none
+		{
+			mtp::ByteArray	Data;
+			mtp::u64		Use;
+
+			CachedThumbnail(): Use(0) { }
+		};
+		typedef std::map<mtp::ObjectId, CachedThumbnail> Thumbnails;
+		Thumbnails					_thumbnailCache; //least recently used are dropped above MaxThumbnailCacheSize, guarded by _mutex
+		size_t						_thumbnailCacheSize;
+		mtp::u64					_thumbnailClock;
+		mtp::ThumbnailFetcherPtr	_thumbnailFetcher; //exif or GetThumb, whichever is faster, created on first use after connect
 
 		std::vector<mtp::StorageId>					_storageIdList;
 		std::map<mtp::StorageId, std::string>		_storageToName;
 		std::map<std::string, mtp::StorageId>		_storageFromName;
 
+		struct StorageSpace //! cached StorageInfo, statfs is answered without device i/o until it expires
+		{
+			mtp::StorageId							Id;
+			mtp::u64								FreeSpace;
+			mtp::u64								Capacity;
+			std::chrono::steady_clock::time_point	Expires;
+
+			StorageSpace(): Id(), FreeSpace(0), Capacity(0) { }
+		};
+		typedef std::map<FuseId, StorageSpace> StorageSpaces;
+		StorageSpaces				_storageSpace; //by storage inode, guarded by _cacheMutex
+		static const int			StorageSpaceTtlMs = 2000;
+
+		static const int					ReconnectAttempts = 20;
+		static const int					ReconnectDelayMs = 100; //device node appears before udev applies its permissions
+		std::string					_busPath; //of connected device, guarded by _cacheMutex
+		std::atomic_bool			_deviceLost; //removal seen, next arrival on the same port reconnects
+		mtp::usb::HotplugMonitorPtr	_hotplug; //last member, monitor thread stops before anything else is destroyed
+
 	private:
 		static FuseId ToFuse(mtp::ObjectId id)
 		{ return FuseId(id.Id + MtpObjectShift); }
@@ -80,6 +319,25 @@ namespace
 		static mtp::ObjectId FromFuse(FuseId id)
 		{ return mtp::ObjectId(id.Inode - MtpObjectShift); }
 
+		mtp::ObjectId ToObjectId(FuseId id)
+		{
+			if (!_pendingUploads.empty() && _pendingUploads.find(id) != _pendingUploads.end())
+				Upload(id);
+			return ResolveObjectId(id);
+		}
+
+		///object id of inode as it is known now, pending upload is not sent
+		mtp::ObjectId ResolveObjectId(FuseId id)
+		{
+			if (!_aliases.empty())
+			{
+				auto i = _aliases.find(id);
+				if (i != _aliases.end())
+					return i->second;
+			}
+			return FromFuse(id);
+		}
+
 		static bool IsStorage(FuseId id)
 		{ return id.Inode >= MtpStorageShift && id.Inode <= MtpObjectShift; }
 
@@ -101,66 +359,157 @@ namespace
 			return FuseId(MtpStorageShift + std::distance(_storageIdList.begin(), i));
 		}
 
-		void GetObjectInfo(ChildrenObjects &cache, mtp::ObjectId id)
+		///returns true if new name was added to cache
+		bool GetObjectInfo(ChildrenObjects &cache, ObjectAttrs &attrs, mtp::ObjectId id, std::string *filename = NULL)
 		{
-			mtp::msg::ObjectInfo oi = _session->GetObjectInfo(id);
+			mtp::msg::ObjectInfo oi = _session->GetFullObjectInfo(id);
+			return AddObjectInfo(cache, attrs, id, oi, filename);
+		}
 
+		///adds already fetched object info to cache, returns true if new name was added
+		bool AddObjectInfo(ChildrenObjects &cache, ObjectAttrs &attrs, mtp::ObjectId id, const mtp::msg::ObjectInfo &oi, std::string *filename = NULL)
+		{
 			FuseId inode = ToFuse(id);
-			cache.emplace(oi.Filename, inode);
+			bool inserted = cache.emplace(oi.Filename, inode).second;
+			if (filename)
+				*filename = oi.Filename;
 
-			struct stat &attr = _objectAttrs[id];
+			struct stat &attr = attrs[id];
 			attr.st_ino = inode.Inode;
 			attr.st_mode = FuseEntry::GetMode(oi.ObjectFormat);
 			attr.st_atime = attr.st_mtime = mtp::ConvertDateTime(oi.ModificationDate);
 			attr.st_ctime = mtp::ConvertDateTime(oi.CaptureDate);
-			attr.st_size = oi.ObjectCompressedSize != mtp::MaxObjectSize? oi.ObjectCompressedSize: _session->GetObjectIntegerProperty(id, mtp::ObjectProperty::ObjectSize);
+			attr.st_size = oi.ObjectSize;
+			return inserted;
 		}
 
-		struct stat GetObjectAttr(FuseId inode)
+		///looks attributes up without any device i/o, either mutex must be held
+		bool GetCachedObjectAttr(FuseId inode, struct stat &attr) const
 		{
-			if (inode == FuseId::Root)
+			if (inode == FuseId::Root || IsStorage(inode))
 			{
-				struct stat attr = { };
+				attr = { };
 				attr.st_ino = inode.Inode;
 				attr.st_mtime = attr.st_ctime = attr.st_atime = _connectTime;
 				attr.st_mode = FuseEntry::DirectoryMode;
-				return attr;
+				return true;
 			}
 
-			if (IsStorage(inode))
 			{
-				struct stat attr = { };
-				attr.st_ino = inode.Inode;
-				attr.st_mtime = attr.st_ctime = attr.st_atime = _connectTime;
-				attr.st_mode = FuseEntry::DirectoryMode;
-				return attr;
+				auto i = _pendingUploads.find(inode);
+				if (i != _pendingUploads.end())
+				{
+					attr = i->second.Attr;
+					return true;
+				}
 			}
 
 			mtp::ObjectId id = FromFuse(inode);
-			auto i = _objectAttrs.find(id);
-			if (i != _objectAttrs.end())
-				return i->second;
+			{
+				auto i = _aliases.find(inode);
+				if (i != _aliases.end())
+					id = i->second;
+			}
+
+			const mtp::ObjectStore::Object *object = _objects.Find(id);
+			if (!object)
+				return false;
+			ToStat(*object, inode, attr);
+			return true;
+		}
+
+		static void ToStat(const mtp::ObjectStore::Object &object, FuseId inode, struct stat &attr)
+		{
+			attr = { };
+			attr.st_ino = inode.Inode;
+			attr.st_mode = FuseEntry::GetMode(object.Format);
+			attr.st_size = object.Size;
+			attr.st_atime = attr.st_mtime = object.ModificationTime;
+			attr.st_ctime = object.CreationTime;
+		}
+
+		///stores attributes in object table without name, cache mutex must be held
+		void StoreAttr(mtp::ObjectId id, mtp::ObjectId parent, const struct stat &attr, mtp::StorageId storageId = mtp::StorageId())
+		{
+			if (storageId == mtp::StorageId())
+			{
+				//storage is inherited from parent, so statfs does not need to ask device
+				const mtp::ObjectStore::Object *parentObject = _objects.Find(parent);
+				if (parentObject)
+					storageId = parentObject->StorageId;
+			}
+			mtp::ObjectStore::Object &object = _objects.Insert(id, parent, std::string());
+			if (storageId != mtp::StorageId())
+				object.StorageId = storageId;
+			object.Format = S_ISDIR(attr.st_mode)? mtp::ObjectFormat::Association: mtp::ObjectFormat::Undefined;
+			object.Size = attr.st_size;
+			object.ModificationTime = attr.st_mtime;
+			object.CreationTime = attr.st_ctime;
+		}
+
+		///attributes of cached children, as stored in metadata cache
+		ObjectAttrs GetStoredAttrs(const ChildrenObjects &children) const
+		{
+			ObjectAttrs attrs;
+			for(auto &child : children)
+			{
+				mtp::ObjectId id = FromFuse(child.second);
+				const mtp::ObjectStore::Object *object = _objects.Find(id);
+				if (object)
+					ToStat(*object, child.second, attrs[id]);
+			}
+			return attrs;
+		}
+
+		struct stat GetObjectAttr(FuseId inode)
+		{
+			struct stat attr;
+			if (GetCachedObjectAttr(inode, attr))
+			{
+				_stats.Hit(FuseStats::AttrsCache);
+				return attr;
+			}
+			_stats.Miss(FuseStats::AttrsCache);
 
 			//populate cache for parent
+			mtp::ObjectId id = ToObjectId(inode);
 			auto parent = GetParentObject(inode);
 			GetChildren(parent); //populate cache
 
-			i = _objectAttrs.find(id);
-			if (i != _objectAttrs.end())
-				return i->second;
-			else
+			const mtp::ObjectStore::Object *object = _objects.Find(id);
+			if (!object)
 				throw std::runtime_error("no such object");
+			ToStat(*object, inode, attr);
+			return attr;
 		}
 
+		///requests property list of children, it's parsed as it arrives if whole response would not fit into memory budget
 		template<typename PropertyValueType>
-		void GetObjectPropertyList(mtp::ObjectId parent, const std::set<mtp::ObjectId> &originalObjectList, const mtp::ObjectProperty property,
-			const std::function<void (mtp::ObjectId, const PropertyValueType &)> &callback)
+		void ParseObjectPropertyList(mtp::ObjectId parent, mtp::ObjectProperty property, size_t expectedSize,
+			const typename mtp::ObjectPropertyListStream<PropertyValueType>::CallbackType &callback)
 		{
-			std::set<mtp::ObjectId> objectList(originalObjectList);
+			if (expectedSize > _budget.GetAvailable())
+			{
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "streaming property list 0x", mtp::hex(property, 4), ", memory budget is low");
+				auto stream = std::make_shared<mtp::ObjectPropertyListStream<PropertyValueType>>(callback);
+				_session->GetObjectPropertyList(parent, mtp::ObjectFormat::Any, property, 0, 1, stream);
+				stream->Finish();
+				return;
+			}
+
 			mtp::ByteArray data = _session->GetObjectPropertyList(parent, mtp::ObjectFormat::Any, property, 0, 1);
+			MemoryBudget::Scope scope(_budget, MemoryBudget::Responses, data.size());
 			mtp::ObjectPropertyListParser<PropertyValueType> parser;
+			parser.Parse(data, callback);
+		}
 
-			parser.Parse(data, [&objectList, &callback, property](mtp::ObjectId objectId, mtp::ObjectProperty p, const PropertyValueType & value) {
+		template<typename PropertyValueType>
+		void GetObjectPropertyList(mtp::ObjectId parent, const std::set<mtp::ObjectId> &originalObjectList, const mtp::ObjectProperty property,
+			const std::function<void (mtp::ObjectId, const PropertyValueType &)> &callback)
+		{
+			std::set<mtp::ObjectId> objectList(originalObjectList);
+			ParseObjectPropertyList<PropertyValueType>(parent, property, objectList.size() * PropertyResponseCost,
+				[&objectList, &callback, property](mtp::ObjectId objectId, mtp::ObjectProperty p, const PropertyValueType & value) {
 				auto it = objectList.find(objectId);
 				if (property == p && it != objectList.end())
 				{
@@ -168,7 +517,7 @@ namespace
 					try { callback(objectId, value); } catch(const std::exception &ex) { mtp::error("callback for property list 0x", mtp::hex(property, 4), " failed: ", ex.what()); }
 				}
 				else
-					mtp::debug("extra property 0x", hex(p, 4), " returned for object ", objectId.Id, ", while querying property list 0x", mtp::hex(property, 4));
+					MTP_DEBUG_CATEGORY(mtp::LogFuse, "extra property 0x", hex(p, 4), " returned for object ", objectId.Id, ", while querying property list 0x", mtp::hex(property, 4));
 			});
 
 			if (!objectList.empty())
@@ -176,7 +525,7 @@ namespace
 				mtp::error("inconsistent GetObjectPropertyList for property 0x", mtp::hex(property, 4));
 				for(auto objectId : objectList)
 				{
-					mtp::debug("querying property 0x", mtp::hex(property, 4), " for object ", objectId);
+					MTP_DEBUG_CATEGORY(mtp::LogFuse, "querying property 0x", mtp::hex(property, 4), " for object ", objectId);
 					try
 					{
 						mtp::ByteArray data = _session->GetObjectProperty(objectId, property);
@@ -194,494 +543,3476 @@ namespace
 		{
 			if (inode == FuseId::Root)
 			{
-				PopulateStorages();
-				ChildrenObjects & cache = _files[inode];
-				cache.clear();
+				//storages are enumerated on connect and updated by storage events only
+				ChildrenObjects storages;
 				for(size_t i = 0; i < _storageIdList.size(); ++i)
 				{
 					mtp::StorageId storageId = _storageIdList[i];
 					auto name = _storageToName.find(storageId);
 					if (name != _storageToName.end())
-						cache.emplace(name->second, FuseId(MtpStorageShift + i));
+						storages.emplace(name->second, FuseId(MtpStorageShift + i));
 					else
 						mtp::error("no storage name for ", storageId);
 				}
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				ChildrenObjects & cache = _files[inode];
+				cache.swap(storages);
 				return cache;
 			}
 
 			{
 				auto i = _files.find(inode);
 				if (i != _files.end())
+				{
+					_stats.Hit(FuseStats::FilesCache);
+					mtp::scoped_mutex_lock l(_cacheMutex);
+					TouchListing(inode);
 					return i->second;
+				}
+				_stats.Miss(FuseStats::FilesCache);
 			}
 
-			ChildrenObjects & cache = _files[inode];
+			PartialListing listing;
+			auto p = _partialListings.find(inode);
+			if (p != _partialListings.end())
+			{
+				listing = std::move(p->second);
+				_partialListings.erase(p);
+			}
+			else
+			{
+				ChildrenObjects *children = BeginListing(inode, listing);
+				if (children)
+					return *children;
+			}
+			FetchListing(listing, listing.Handles.size());
+			return FinishListing(inode, listing);
+		}
 
+		///fetches all properties of children with single GetObjectPropList request, returns false if it failed
+		bool GetAllObjectProperties(mtp::ObjectId parent, const std::set<mtp::ObjectId> &objects, ChildrenObjects &cache, ObjectAttrs &attrs)
+		{
 			using namespace mtp;
-			if (inode == FuseId::Root)
+			enum { FilenameFound = 1, FormatFound = 2, SizeFound = 4, AllFound = 7 };
+			std::map<ObjectId, unsigned> found;
+			auto callback = [&](ObjectId objectId, ObjectProperty property, const ObjectPropertyValue &value)
 			{
-				return cache;
-			}
+				if (objects.find(objectId) == objects.end())
+					return;
 
-			msg::ObjectHandles oh;
+				struct stat &attr = attrs[objectId];
+				attr.st_ino = ToFuse(objectId).Inode;
+				switch(property)
+				{
+				case ObjectProperty::ObjectFilename:
+					cache.emplace(value.String, ToFuse(objectId));
+					found[objectId] |= FilenameFound;
+					break;
+				case ObjectProperty::ObjectFormat:
+					attr.st_mode = FuseEntry::GetMode(static_cast<ObjectFormat>(value.Integer));
+					found[objectId] |= FormatFound;
+					break;
+				case ObjectProperty::ObjectSize:
+					attr.st_size = value.Integer;
+					found[objectId] |= SizeFound;
+					break;
+				case ObjectProperty::DateModified:
+					attr.st_mtime = ConvertDateTime(value.String);
+					break;
+				case ObjectProperty::DateAdded:
+					attr.st_ctime = ConvertDateTime(value.String);
+					break;
+				default:
+					break;
+				}
+			};
 
-			if (IsStorage(inode))
+			size_t expectedSize = objects.size() * AllPropertiesResponseCost;
+			if (expectedSize > _budget.GetAvailable())
 			{
-				mtp::StorageId storageId = FuseIdToStorageId(inode);
-				oh = _session->GetObjectHandles(storageId, mtp::ObjectFormat::Any, mtp::Session::Root);
+				//request and parsing can't be told apart while streaming, failed listing is retried with separate properties
+				try
+				{ ParseObjectPropertyList<ObjectPropertyValue>(parent, ObjectProperty::All, expectedSize, callback); }
+				catch(const std::exception &ex)
+				{
+					error("streaming property list failed: ", ex.what(), ", falling back to separate properties");
+					if (found.empty())
+						_session->SetQuirk(Capabilities::Quirk::PropertyListAllUnsupported);
+					cache.clear();
+					attrs.clear();
+					return false;
+				}
 			}
 			else
 			{
-				mtp::ObjectId parent = FromFuse(inode);
-				oh = _session->GetObjectHandles(mtp::Session::AllStorages, mtp::ObjectFormat::Any, parent);
-
-				if (_getObjectPropertyListSupported)
+				ByteArray data;
+				try
+				{ data = _session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::All, 0, 1); }
+				catch(const std::exception &ex)
 				{
-					std::set<mtp::ObjectId> objects;
-					for(auto id : oh.ObjectHandles)
-						objects.insert(id);
-
-					//populate filenames
-					GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::ObjectFilename,
-						[&cache](ObjectId objectId, const std::string &name)
-						{ cache.emplace(name, ToFuse(objectId)); });
-
-					//format
-					GetObjectPropertyList<mtp::ObjectFormat>(parent, objects, mtp::ObjectProperty::ObjectFormat,
-						[this](ObjectId objectId, mtp::ObjectFormat format)
-						{
-							struct stat & attr = _objectAttrs[objectId];
-							attr.st_ino = ToFuse(objectId).Inode;
-							attr.st_mode = FuseEntry::GetMode(format);
-						});
+					error("GetObjectPropList for all properties failed: ", ex.what(), ", falling back to separate properties");
+					_session->SetQuirk(Capabilities::Quirk::PropertyListAllUnsupported);
+					return false;
+				}
 
-					//size
-					GetObjectPropertyList<mtp::u64>(parent, objects, mtp::ObjectProperty::ObjectSize,
-						[this](ObjectId objectId, mtp::u64 size)
-						{ _objectAttrs[objectId].st_size = size; });
+				try
+				{
+					MemoryBudget::Scope scope(_budget, MemoryBudget::Responses, data.size());
+					ObjectPropertyListParser<ObjectPropertyValue> parser;
+					parser.Parse(data, callback);
+				}
+				catch(const std::exception &ex)
+				{
+					error("parsing property list failed: ", ex.what());
+					cache.clear();
+					attrs.clear();
+					return false;
+				}
+			}
 
-					//mtime
-					try
-					{
-						GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::DateModified,
-						[this](ObjectId objectId, const std::string & mtime)
-						{ _objectAttrs[objectId].st_mtime = mtp::ConvertDateTime(mtime); });
-					}
-					catch(const std::exception &ex)
-					{ }
+			for(auto id : objects)
+			{
+				auto i = found.find(id);
+				if (i != found.end() && i->second == AllFound)
+					continue;
 
-					//ctime
-					try
-					{
-						GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::DateAdded,
-						[this](ObjectId objectId, const std::string & ctime)
-						{ _objectAttrs[objectId].st_ctime = mtp::ConvertDateTime(ctime); });
-					}
-					catch(const std::exception &ex)
-					{ }
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "incomplete property list for object ", id, ", querying object info");
+				try
+				{ GetObjectInfo(cache, attrs, id); }
+				catch(const std::exception &ex)
+				{ attrs.erase(id); }
+			}
+			return true;
+		}
 
+		///fetches each property of children with separate GetObjectPropList request
+		void GetObjectPropertyLists(mtp::ObjectId parent, const std::set<mtp::ObjectId> &objects, ChildrenObjects &cache, ObjectAttrs &attrs)
+		{
+			using namespace mtp;
+			//populate filenames
+			GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::ObjectFilename,
+				[&cache](ObjectId objectId, const std::string &name)
+				{ cache.emplace(name, ToFuse(objectId)); });
+
+			//format
+			GetObjectPropertyList<mtp::ObjectFormat>(parent, objects, mtp::ObjectProperty::ObjectFormat,
+				[&attrs](ObjectId objectId, mtp::ObjectFormat format)
+				{
+					struct stat & attr = attrs[objectId];
+					attr.st_ino = ToFuse(objectId).Inode;
+					attr.st_mode = FuseEntry::GetMode(format);
+				});
 
+			//size
+			GetObjectPropertyList<mtp::u64>(parent, objects, mtp::ObjectProperty::ObjectSize,
+				[&attrs](ObjectId objectId, mtp::u64 size)
+				{ attrs[objectId].st_size = size; });
 
-					return cache;
-				}
+			//mtime
+			try
+			{
+				GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::DateModified,
+				[&attrs](ObjectId objectId, const std::string & mtime)
+				{ attrs[objectId].st_mtime = mtp::ConvertDateTime(mtime); });
 			}
+			catch(const std::exception &ex)
+			{ }
 
-			for(auto id : oh.ObjectHandles)
+			//ctime
+			try
 			{
-				try
-				{
-					GetObjectInfo(cache, id);
-				} catch(const std::exception &ex)
-				{ }
+				GetObjectPropertyList<std::string>(parent, objects, mtp::ObjectProperty::DateAdded,
+				[&attrs](ObjectId objectId, const std::string & ctime)
+				{ attrs[objectId].st_ctime = mtp::ConvertDateTime(ctime); });
 			}
-			return cache;
+			catch(const std::exception &ex)
+			{ }
 		}
 
-		FuseId CreateObject(FuseId parentInode, const std::string &filename, mtp::ObjectFormat format)
+		///children handles of given formats and all directories, device does the filtering
+		mtp::msg::ObjectHandles GetChildHandles(mtp::StorageId storageId, mtp::ObjectId parent)
 		{
-			mtp::ObjectId parentId = FromFuse(parentInode);
-			mtp::StorageId storageId;
-			if (IsStorage(parentInode))
+			if (_formats.empty())
+				return _session->GetObjectHandles(storageId, mtp::ObjectFormat::Any, parent);
+
+			mtp::msg::ObjectHandles oh = _session->GetObjectHandles(storageId, mtp::ObjectFormat::Association, parent);
+			for(auto format : _formats)
 			{
-				storageId = FuseIdToStorageId(parentInode);
-				parentId = mtp::Session::Root;
+				if (format == mtp::ObjectFormat::Association)
+					continue;
+				_session->GetObjectHandles(storageId, format, parent, [&oh](const std::vector<mtp::ObjectId> &handles)
+				{ oh.ObjectHandles.insert(oh.ObjectHandles.end(), handles.begin(), handles.end()); });
 			}
-			else
-				storageId = _session->GetObjectStorage(parentId);
-			mtp::debug("   creating object in storage ", mtp::hex(storageId.Id), ", parent: ", mtp::hex(parentId.Id, 8));
+			return oh;
+		}
 
-			mtp::Session::NewObjectInfo noi;
-			if (format != mtp::ObjectFormat::Association)
+		///fetches handles and bulk properties, returns children if complete, otherwise leaves per-object queries in listing
+		ChildrenObjects * BeginListing(FuseId inode, PartialListing &listing)
+		{
+			using namespace mtp;
+			ChildrenObjects cache;
+			ObjectAttrs attrs;
+			msg::ObjectHandles oh;
+			u64 cacheKey;
+
+			if (IsStorage(inode))
 			{
-				mtp::msg::ObjectInfo oi;
-				oi.Filename = filename;
-				oi.ObjectFormat = format;
-				noi = _session->SendObjectInfo(oi, storageId, parentId);
-				_session->SendObject(std::make_shared<mtp::ByteArrayObjectInputStream>(mtp::ByteArray()));
+				mtp::StorageId storageId = FuseIdToStorageId(inode);
+				oh = GetChildHandles(storageId, mtp::Session::Root);
+				cacheKey = MetadataCache::StorageKey(storageId);
+				if (LoadCachedChildren(cacheKey, mtp::Session::Root, oh, cache, attrs))
+					return &CacheChildren(inode, cache, attrs);
 			}
 			else
-				noi = _session->CreateDirectory(filename, parentId, storageId);
+			{
+				mtp::ObjectId parent = ToObjectId(inode);
+				oh = GetChildHandles(mtp::Session::AllStorages, parent);
+				cacheKey = MetadataCache::ObjectKey(parent);
+				if (LoadCachedChildren(cacheKey, parent, oh, cache, attrs))
+					return &CacheChildren(inode, cache, attrs);
 
-			mtp::debug("   new object id ", noi.ObjectId.Id);
+				if (_getObjectPropertyListSupported)
+				{
+					std::set<mtp::ObjectId> objects(oh.ObjectHandles.begin(), oh.ObjectHandles.end());
+					if (_session->GetCapabilities().Has(mtp::Capabilities::Quirk::PropertyListAllUnsupported) || !GetAllObjectProperties(parent, objects, cache, attrs))
+						GetObjectPropertyLists(parent, objects, cache, attrs);
 
-			{ //update cache:
-				auto i = _files.find(parentInode);
-				if (i != _files.end())
-					GetObjectInfo(i->second, noi.ObjectId); //insert object info into cache
-				_directoryCache.erase(parentInode);
+					StoreCachedChildren(cacheKey, cache, attrs);
+					return &CacheChildren(inode, cache, attrs);
+				}
 			}
-			return ToFuse(noi.ObjectId);
+
+			listing.Handles.swap(oh.ObjectHandles);
+			listing.CacheKey = cacheKey;
+			return NULL;
 		}
 
-		void CreateObject(mtp::ObjectFormat format, fuse_req_t req, FuseId parentId, const char *name, mode_t mode, fuse_file_info *createInfo = NULL)
+		void FetchListing(PartialListing &listing, size_t count)
 		{
-			if (parentId == FuseId::Root)
+			size_t end = std::min(listing.Next + count, listing.Handles.size());
+			std::vector<mtp::ObjectId> chunk(listing.Handles.begin() + listing.Next, listing.Handles.begin() + end);
+			std::vector<mtp::msg::ObjectInfo> infos;
+			try
+			{ infos = _session->GetObjectInfos(chunk); }
+			catch(const std::exception &ex)
+			{ infos.resize(chunk.size()); }
+
+			for(size_t i = 0; i < chunk.size(); ++i)
 			{
-				FUSE_CALL(fuse_reply_err(req, EPERM)); //cannot create files in the same level with storages
-				return;
+				mtp::ObjectId id = chunk[i];
+				const mtp::msg::ObjectInfo &oi = infos[i];
+				if (oi.Filename.empty())
+					continue;
+
+				std::string filename;
+				if (AddObjectInfo(listing.Children, listing.Attrs, id, oi, &filename) && listing.Serve)
+					FuseDirectory(NULL).Add(listing.Data, filename, listing.Attrs[id]); //request is not used by fuse_add_direntry
 			}
-			auto objectId = CreateObject(parentId, name, format);
-			FuseEntry entry(req);
-			entry.SetId(objectId);
-			entry.attr = GetObjectAttr(objectId);
-
-			if (createInfo)
-				entry.ReplyCreate(createInfo);
-			else
-				entry.Reply();
+			listing.Next = end;
 		}
 
-		FuseId GetParentObject(FuseId inode)
+		ChildrenObjects & FinishListing(FuseId inode, PartialListing &listing)
 		{
-			if (inode == FuseId::Root)
-				return inode;
+			StoreCachedChildren(listing.CacheKey, listing.Children, listing.Attrs);
+			if (listing.Serve)
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				_directoryCache[inode].swap(listing.Data);
+			}
+			return CacheChildren(inode, listing.Children, listing.Attrs);
+		}
 
-			if (IsStorage(inode))
-				return FuseId::Root;
+		mtp::u64 GetCacheKey(FuseId inode)
+		{ return IsStorage(inode)? MetadataCache::StorageKey(FuseIdToStorageId(inode)): MetadataCache::ObjectKey(FromFuse(inode)); }
 
-			mtp::ObjectId id = FromFuse(inode);
-			mtp::ObjectId parent = _session->GetObjectParent(id);
-			if (parent == mtp::Session::Device || parent == mtp::Session::Root) //parent == root -> storage
+		///checks cached listing with single DateModified list where fresh one would take a query per object, edits keep object handles
+		///directories listed with single list of all properties are fetched again instead, it costs the same and replaces cached entry
+		bool ValidateCachedChildren(mtp::ObjectId parent, const MetadataCache::Directory &dir)
+		{
+			if (dir.empty())
+				return true;
+			const mtp::Capabilities &caps = _session->GetCapabilities();
+			bool allProperties = parent != mtp::Session::Root && !caps.Has(mtp::Capabilities::Quirk::PropertyListAllUnsupported);
+			if (!_getObjectPropertyListSupported || allProperties || caps.Has(mtp::Capabilities::Quirk::ObjectModificationTimeBuggy))
+				return false;
+
+			//depth 1 list of device root has top-level objects of every storage, entries of other storages are skipped
+			mtp::ObjectId handle = parent == mtp::Session::Root? mtp::Session::Device: parent;
+			std::map<mtp::ObjectId, time_t> mtimes;
+			try
 			{
-				return FuseIdFromStorageId(_session->GetObjectStorage(id));
+				ParseObjectPropertyList<std::string>(handle, mtp::ObjectProperty::DateModified, dir.size() * PropertyResponseCost,
+					[&mtimes](mtp::ObjectId objectId, mtp::ObjectProperty, const std::string &mtime)
+					{ mtimes[objectId] = mtp::ConvertDateTime(mtime); });
 			}
-			else
-				return ToFuse(parent);
+			catch(const std::exception &ex)
+			{
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "   validating cached entries failed: ", ex.what());
+				return false;
+			}
+
+			for(auto &entry : dir)
+			{
+				auto mtime = mtimes.find(entry.Id);
+				if (mtime == mtimes.end() || mtime->second != entry.ModificationTime)
+				{
+					MTP_DEBUG_CATEGORY(mtp::LogFuse, "   cached entry ", entry.Name, " is stale");
+					return false;
+				}
+			}
+			return true;
 		}
 
-		bool FillEntry(FuseEntry &entry, FuseId id)
+		bool LoadCachedChildren(mtp::u64 key, mtp::ObjectId parent, const mtp::msg::ObjectHandles &oh, ChildrenObjects &children, ObjectAttrs &attrs)
 		{
-			try { entry.attr = GetObjectAttr(id); } catch(const std::exception &ex) { return false; }
-			entry.SetId(id);
+			if (!_metadataCache)
+				return false;
+
+			const MetadataCache::Directory *dir = _metadataCache->Find(key, oh.ObjectHandles);
+			if (!dir)
+				return false;
+
+			//without events nothing tells us about renames or edits, so check every time
+			if (!_eventsSupported || !_metadataCache->IsValidated(key))
+			{
+				if (!ValidateCachedChildren(parent, *dir))
+				{
+					_metadataCache->Invalidate(key);
+					return false;
+				}
+				_metadataCache->SetValidated(key);
+			}
+
+			for(auto &entry : *dir)
+			{
+				children.emplace(entry.Name, ToFuse(entry.Id));
+				struct stat &attr = attrs[entry.Id];
+				attr.st_ino = ToFuse(entry.Id).Inode;
+				attr.st_mode = entry.Mode;
+				attr.st_size = entry.Size;
+				attr.st_atime = attr.st_mtime = entry.ModificationTime;
+				attr.st_ctime = entry.CreationTime;
+			}
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   using ", dir->size(), " cached entries");
 			return true;
 		}
 
-	public:
-		FuseWrapper(bool claimInterface): _claimInterface(claimInterface)
-		{ Connect(); }
-
-		void Connect()
+		void StoreCachedChildren(mtp::u64 key, const ChildrenObjects &children, const ObjectAttrs &attrs)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
+			if (!_metadataCache)
+				return;
 
-			_openedFiles.clear();
-			_files.clear();
-			_objectAttrs.clear();
-			_directoryCache.clear();
-			_session.reset();
-			_device.reset();
-			_device = mtp::Device::FindFirst(_claimInterface);
-			if (!_device)
-				throw std::runtime_error("no MTP device found");
+			MetadataCache::Directory dir;
+			dir.reserve(children.size());
+			for(auto &child : children)
+			{
+				mtp::ObjectId id = FromFuse(child.second);
+				auto i = attrs.find(id);
+				if (i == attrs.end())
+					continue;
+
+				MetadataCache::Entry entry;
+				entry.Id = id;
+				entry.Name = child.first;
+				entry.Mode = i->second.st_mode;
+				entry.Size = i->second.st_size;
+				entry.ModificationTime = i->second.st_mtime;
+				entry.CreationTime = i->second.st_ctime;
+				dir.push_back(entry);
+			}
+			_metadataCache->Update(key, std::move(dir));
+		}
 
-			_session = _device->OpenSession(1);
-			_editObjectSupported = _session->EditObjectSupported();
-			if (!_editObjectSupported)
-				mtp::error("your device does not have android EditObject extension, mounting read-only\n");
-			_getObjectPropertyListSupported = _session->GetObjectPropertyListSupported();
-			if (!_getObjectPropertyListSupported)
-				mtp::error("your device does not have GetObjectPropertyList extension, expect slow enumeration of big directories\n");
+		std::string GetMetadataCachePath() const
+		{
+			std::string serial = _session->GetDeviceInfo().SerialNumber;
+			if (_cacheDir.empty() || serial.empty())
+				return std::string();
 
-			_connectTime = time(NULL);
-			PopulateStorages();
+			std::replace(serial.begin(), serial.end(), '/', '_');
+			return _cacheDir + "/" + serial;
 		}
 
-		void PopulateStorages()
+		ChildrenObjects & CacheChildren(FuseId inode, ChildrenObjects &children, const ObjectAttrs &attrs)
 		{
-			_storageIdList.clear();
-			_storageFromName.clear();
-			_storageToName.clear();
-			mtp::msg::StorageIDs ids = _session->GetStorageIDs();
-			_storageIdList.reserve(ids.StorageIDs.size());
-			for(size_t i = 0; i < ids.StorageIDs.size(); ++i)
+			mtp::ObjectId parent = IsStorage(inode)? mtp::Session::Root: FromFuse(inode);
+			mtp::StorageId storageId = IsStorage(inode)? FuseIdToStorageId(inode): mtp::StorageId();
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			for(auto &attr : attrs)
+				StoreAttr(attr.first, parent, attr.second, storageId);
+			if (_readOnlyDirectories.find(inode) != _readOnlyDirectories.end())
 			{
-				mtp::StorageId id = ids.StorageIDs[i];
-				mtp::msg::StorageInfo si = _session->GetStorageInfo(id);
-				std::string path = si.GetName();
-				if (path.empty())
+				for(auto &child : children)
 				{
-					char buf[64];
-					snprintf(buf, sizeof(buf), "sdcard%u", (unsigned)i);
-					path = buf;
+					auto i = attrs.find(FromFuse(child.second));
+					if (i != attrs.end() && (i->second.st_mode & S_IFDIR))
+						_readOnlyDirectories.insert(child.second);
 				}
-				FuseId inode(MtpStorageShift + i);
-				_storageIdList.push_back(id);
-				_storageFromName[path] = id;
-				_storageToName[id] = path;
 			}
+			ChildrenObjects & cache = _files[inode];
+			cache.swap(children);
+			TouchListing(inode);
+			return cache;
+		}
+
+		///cache mutex must be held
+		void TouchListing(FuseId inode)
+		{ _listingUse[inode] = ++_listingClock; }
+
+		///kernel keeps reference to replied entry until it forgets it, cache mutex must be held
+		void AddLookup(FuseId inode)
+		{ ++_lookups[inode]; }
+
+		///returns true if attributes of object are not referenced by kernel or by cached listing, cache mutex must be held
+		bool IsUnreferenced(FuseId inode, const mtp::ObjectStore::Object &object) const
+		{
+			if (_lookups.find(inode) != _lookups.end() || _files.find(inode) != _files.end())
+				return false;
+			if (object.Parent == mtp::Session::Root || object.Parent == mtp::Session::Device)
+				return false; //storage listings are small, their entries are kept
+			return _files.find(ToFuse(object.Parent)) == _files.end();
+		}
+
+		///drops lookup references, forgotten object attributes are released if no cached listing holds them, both mutexes must be held
+		void ForgetLookups(FuseId inode, mtp::u64 nlookup)
+		{
+			auto i = _lookups.find(inode);
+			if (i == _lookups.end())
+				return;
+			if (i->second > nlookup)
+			{
+				i->second -= nlookup;
+				return;
+			}
+			_lookups.erase(i);
+			if (inode == FuseId::Root || IsStorage(inode) || _pendingUploads.find(inode) != _pendingUploads.end())
+				return;
+
+			mtp::ObjectId id = FromFuse(inode);
+			auto alias = _aliases.find(inode);
+			if (alias != _aliases.end())
+				id = alias->second;
+
+			const mtp::ObjectStore::Object *object = _objects.Find(id);
+			if (object && IsUnreferenced(inode, *object))
+			{
+				_objects.Remove(id);
+				_aliases.erase(inode);
+			}
+		}
+
+		///recounts memory of object attributes, listings and readdir data at most once per interval unless forced, cache mutex must be held
+		void UpdateMetadataUsage(bool force = false)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (!force && now < _metadataUsageTime + std::chrono::milliseconds(MetadataUsageIntervalMs))
+				return;
+			_metadataUsageTime = now;
+
+			size_t entries = 0;
+			for(auto &dir : _files)
+				entries += dir.second.size();
+			_budget.Set(MemoryBudget::Objects, _objects.GetMemoryUsage() + entries * ChildEntryCost);
+
+			size_t listings = 0;
+			for(auto &dir : _directoryCache)
+				listings += dir.second.capacity();
+			_budget.Set(MemoryBudget::Listings, listings);
+		}
+
+		///drops least recently used listings when too many objects are cached or memory budget is exceeded, they are fetched again on next access
+		///content caches are shrunk first, i/o mutex must be held and no references to cached listings kept
+		void TrimCache()
+		{
+			bool overBudget = false;
+			if (_budget.IsLimited())
+			{
+				{
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					UpdateMetadataUsage();
+				}
+				if (_budget.IsExceeded())
+				{
+					TrimThumbnails(0);
+					if (_budget.IsExceeded())
+						_readahead.Shrink(_budget.GetUsed() - _budget.GetLimit());
+					overBudget = _budget.IsExceeded();
+				}
+			}
+			if (_snapshot || (_objects.GetSize() <= MaxCachedObjects && !overBudget))
+				return;
+
+			mtp::scoped_mutex_lock cl(_cacheMutex);
+			std::set<FuseId> uploading; //listings hold the only names of files not created on device yet
+			for(auto &upload : _pendingUploads)
+				uploading.insert(upload.second.Parent);
+			std::vector<std::pair<mtp::u64, FuseId>> listings;
+			listings.reserve(_files.size());
+			for(auto &dir : _files)
+			{
+				if (dir.first == FuseId::Root || _partialListings.find(dir.first) != _partialListings.end() || uploading.find(dir.first) != uploading.end())
+					continue;
+				auto use = _listingUse.find(dir.first);
+				listings.emplace_back(use != _listingUse.end()? use->second: 0, dir.first);
+			}
+			std::sort(listings.begin(), listings.end());
+
+			size_t target = std::min(_objects.GetSize(), MaxCachedObjects) / 4 * 3;
+			size_t evicted = 0;
+			for(auto &listing : listings)
+			{
+				if (_objects.GetSize() <= target)
+					break;
+
+				FuseId inode = listing.second;
+				auto dir = _files.find(inode);
+				ChildrenObjects children;
+				children.swap(dir->second);
+				_files.erase(dir);
+				_directoryCache.erase(inode);
+				_missingEntries.erase(inode);
+				for(auto &child : children)
+				{
+					mtp::ObjectId id = FromFuse(child.second);
+					const mtp::ObjectStore::Object *object = _objects.Find(id);
+					if (object && IsUnreferenced(child.second, *object))
+						_objects.Remove(id);
+				}
+				++evicted;
+			}
+
+			for(auto i = _listingUse.begin(); i != _listingUse.end(); )
+			{
+				if (_files.find(i->first) == _files.end())
+					i = _listingUse.erase(i);
+				else
+					++i;
+			}
+			if (_budget.IsLimited())
+				UpdateMetadataUsage(true);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "dropped ", evicted, " cached listings, ", _objects.GetSize(), " objects left");
+		}
+
+		///appends entry to cached readdir data, cache mutex must be held
+		void AddDirectoryEntry(FuseId parent, const std::string &name, const struct stat &attr)
+		{
+			auto i = _directoryCache.find(parent);
+			if (i != _directoryCache.end())
+				FuseDirectory(NULL).Add(i->second, name, attr); //request is not used by fuse_add_direntry
+		}
+
+		///removes entry from cached readdir data, cache mutex must be held
+		void RemoveDirectoryEntry(FuseId parent, const std::string &name)
+		{
+			auto i = _directoryCache.find(parent);
+			if (i != _directoryCache.end() && !FuseDirectory::Remove(i->second, name))
+				_directoryCache.erase(i);
+		}
+
+		///timeout for entries/attributes of given inode, either mutex must be held
+		///unless set explicitly, it's long if device events are pushed to kernel
+		double GetTimeout(FuseId inode) const
+		{
+			if (_snapshot)
+				return FuseEntry::SnapshotTimeout;
+			if (_readOnlyDirectories.find(inode) != _readOnlyDirectories.end())
+				return _readOnlyTimeout;
+			if (_timeout >= 0)
+				return _timeout;
+			return _notifying && _eventsSupported? FuseEntry::NotifiedTimeout: FuseEntry::Timeout;
+		}
+
+		void AddMissingEntry(FuseId parent, const std::string &name)
+		{
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			auto &names = _missingEntries[parent];
+			if (names.size() >= MaxMissingEntries)
+				names.clear();
+			names.insert(name);
+		}
+
+		void RemoveMissingEntry(FuseId parent, const std::string &name)
+		{
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			auto i = _missingEntries.find(parent);
+			if (i != _missingEntries.end())
+				i->second.erase(name);
+		}
+
+		///returns storage recorded when object was listed, null id if it's unknown, either mutex must be held
+		mtp::StorageId GetCachedStorage(mtp::ObjectId id) const
+		{
+			const mtp::ObjectStore::Object *object = _objects.Find(id);
+			return object? object->StorageId: mtp::StorageId();
+		}
+
+		void GetParentInfo(FuseId parentInode, mtp::ObjectId &parentId, mtp::StorageId &storageId)
+		{
+			if (IsStorage(parentInode))
+			{
+				storageId = FuseIdToStorageId(parentInode);
+				parentId = mtp::Session::Root;
+			}
+			else
+			{
+				parentId = ToObjectId(parentInode);
+				storageId = GetCachedStorage(parentId);
+				if (storageId == mtp::StorageId())
+					storageId = _session->GetObjectStorage(parentId);
+			}
+		}
+
+		FuseId CreatePendingUpload(FuseId parentInode, const std::string &filename, mtp::ObjectFormat format)
+		{
+			ChildrenObjects &children = GetChildren(parentInode);
+
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			FuseId inode(_nextPendingInode++);
+			PendingUpload &upload = _pendingUploads[inode];
+			upload.Parent = parentInode;
+			upload.Name = filename;
+			upload.Format = format;
+			upload.Attr.st_ino = inode.Inode;
+			upload.Attr.st_mode = FuseEntry::GetMode(format);
+			upload.Attr.st_atime = upload.Attr.st_mtime = upload.Attr.st_ctime = time(NULL);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   deferring creation of ", filename, ", inode ", inode.Inode);
+
+			children.emplace(filename, inode);
+			AddDirectoryEntry(parentInode, filename, upload.Attr);
+			return inode;
+		}
+
+		///sends pending new file to device, following writes go through edit session
+		void Upload(FuseId inode)
+		{
+			auto it = _pendingUploads.find(inode);
+			if (it == _pendingUploads.end())
+				return;
+
+			PendingUpload upload(std::move(it->second));
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				_pendingUploads.erase(it);
+			}
+			_pendingUploadSize -= upload.Data.size();
+			_budget.Release(MemoryBudget::Uploads, upload.Data.size());
+
+			mtp::ObjectId parentId;
+			mtp::StorageId storageId;
+			GetParentInfo(upload.Parent, parentId, storageId);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   uploading ", upload.Name, ", ", upload.Data.size(), " bytes, storage ", mtp::hex(storageId.Id), ", parent: ", mtp::hex(parentId.Id, 8));
+
+			mtp::msg::ObjectInfo oi;
+			oi.Filename = upload.Name;
+			oi.ObjectFormat = upload.Format;
+			if (upload.Attr.st_mtime)
+				oi.ModificationDate = mtp::ConvertDateTime(upload.Attr.st_mtime);
+			mtp::Session::NewObjectInfo noi = _session->CreateObject(oi, upload.Data.size(), storageId, parentId);
+			upload.Attr.st_size = upload.Data.size();
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				_aliases[inode] = noi.ObjectId;
+				StoreAttr(noi.ObjectId, parentId, upload.Attr, storageId);
+			}
+			_session->SendObject(std::make_shared<mtp::ByteArrayObjectInputStream>(std::move(upload.Data)));
+			ExpireStorageSpace();
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   new object id ", noi.ObjectId.Id);
+		}
+
+		void DiscardPendingUpload(FuseId inode)
+		{
+			auto it = _pendingUploads.find(inode);
+			if (it == _pendingUploads.end())
+				return;
+			_pendingUploadSize -= it->second.Data.size();
+			_budget.Release(MemoryBudget::Uploads, it->second.Data.size());
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			_pendingUploads.erase(it);
+		}
+
+		FuseId CreateObject(FuseId parentInode, const std::string &filename, mtp::ObjectFormat format)
+		{
+			mtp::ObjectId parentId;
+			mtp::StorageId storageId;
+			GetParentInfo(parentInode, parentId, storageId);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   creating object in storage ", mtp::hex(storageId.Id), ", parent: ", mtp::hex(parentId.Id, 8));
+
+			mtp::Session::NewObjectInfo noi;
+			if (format != mtp::ObjectFormat::Association)
+			{
+				mtp::msg::ObjectInfo oi;
+				oi.Filename = filename;
+				oi.ObjectFormat = format;
+				noi = _session->CreateObject(oi, 0, storageId, parentId);
+				_session->SendObject(std::make_shared<mtp::ByteArrayObjectInputStream>(mtp::ByteArray()));
+			}
+			else
+				noi = _session->CreateDirectory(filename, parentId, storageId);
+			ExpireStorageSpace();
+
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   new object id ", noi.ObjectId.Id);
+
+			{ //update caches with what was just sent, so the object is not asked for again
+				FuseId inode = ToFuse(noi.ObjectId);
+				struct stat attr = { };
+				attr.st_ino = inode.Inode;
+				attr.st_mode = FuseEntry::GetMode(format);
+				attr.st_atime = attr.st_mtime = attr.st_ctime = time(NULL); //device stamps new objects with its current time
+
+				auto p = _partialListings.find(parentInode);
+				if (p != _partialListings.end())
+					p->second.Handles.push_back(noi.ObjectId);
+
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				StoreAttr(noi.ObjectId, parentId, attr, noi.StorageId != mtp::StorageId()? noi.StorageId: storageId);
+				auto i = _files.find(parentInode);
+				if (i != _files.end())
+				{
+					i->second.emplace(filename, inode);
+					AddDirectoryEntry(parentInode, filename, attr);
+				}
+				else
+					_directoryCache.erase(parentInode);
+			}
+			return ToFuse(noi.ObjectId);
+		}
+
+		void CreateObject(mtp::ObjectFormat format, fuse_req_t req, FuseId parentId, const char *name, mode_t mode, fuse_file_info *createInfo = NULL)
+		{
+			if (parentId == FuseId::Root)
+			{
+				FUSE_CALL(fuse_reply_err(req, EPERM)); //cannot create files in the same level with storages
+				return;
+			}
+			RemoveMissingEntry(parentId, name);
+			auto objectId = createInfo && format != mtp::ObjectFormat::Association?
+				CreatePendingUpload(parentId, name, format):
+				CreateObject(parentId, name, format);
+			FuseEntry entry(req);
+			entry.SetId(objectId);
+			entry.attr = GetObjectAttr(objectId);
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				AddLookup(objectId);
+			}
+
+			if (createInfo)
+				entry.ReplyCreate(createInfo);
+			else
+				entry.Reply();
+		}
+
+		FuseId GetParentObject(FuseId inode)
+		{
+			if (inode == FuseId::Root)
+				return inode;
+
+			if (IsStorage(inode))
+				return FuseId::Root;
+
+			mtp::ObjectId id = ToObjectId(inode);
+			const mtp::ObjectStore::Object *object = _objects.Find(id);
+			if (object)
+			{
+				//recorded when parent was listed
+				if (object->Parent != mtp::Session::Device && object->Parent != mtp::Session::Root)
+					return ToFuse(object->Parent);
+				if (object->StorageId != mtp::StorageId())
+					return FuseIdFromStorageId(object->StorageId);
+			}
+
+			mtp::ObjectId parent = _session->GetObjectParent(id);
+			if (parent == mtp::Session::Device || parent == mtp::Session::Root) //parent == root -> storage
+			{
+				return FuseIdFromStorageId(_session->GetObjectStorage(id));
+			}
+			else
+				return ToFuse(parent);
+		}
+
+		bool FillEntry(FuseEntry &entry, FuseId id)
+		{
+			try { entry.attr = GetObjectAttr(id); } catch(const std::exception &ex) { return false; }
+			entry.SetId(id);
+			return true;
+		}
+
+	public:
+		FuseWrapper(bool claimInterface, const std::string &deviceId, size_t transferSize, const mtp::usb::ReaperPolicy &reaper, size_t readahead, size_t prefetchSize, size_t directIoSize, size_t sequentialSize, size_t memoryBudget, const std::string &cacheDir, double timeout, double readOnlyTimeout, double keepalive, bool stats, bool writebackCache, bool snapshot, bool crawl, bool thumbnails, const std::vector<mtp::ObjectFormat> &formats):
+			_eventsPending(false), _eventSubscription(-1),
+			_claimInterface(claimInterface), _deviceId(deviceId), _transferSize(transferSize), _reaper(reaper), _reaperStarted(false), _eventsStarted(false), _prefetchSize(prefetchSize), _directIoSize(directIoSize), _sequentialSize(sequentialSize), _cacheDir(cacheDir),
+			_timeout(timeout), _readOnlyTimeout(readOnlyTimeout), _keepalive(keepalive), _writebackCache(writebackCache), _snapshot(snapshot), _crawl(crawl), _thumbnails(thumbnails), _formats(formats), _stats(stats), _budget(memoryBudget), _nextStatsHandle(0), _nextDirectoryHandle(0), _listingClock(0), _readahead(readahead),
+			_prefetchStop(false), _prefetchStarted(false), _foreground(0), _requests(0), _keepaliveStop(false),
+			_notifyHandle(NULL), _notifyStop(false), _notifying(false), _eventsSupported(false), _pendingUploadSize(0), _nextPendingInode(PendingInodeShift), _thumbnailCacheSize(0), _thumbnailClock(0), _deviceLost(false)
+		{
+			_readahead.SetBudget(&_budget);
+			Connect();
+		}
+
+		///starts pushing invalidations to kernel once session is mounted, kernel entries of immutable snapshot never change
+		void StartNotifications(NotifyHandle handle)
+		{
+			if (_snapshot || _notifyThread.joinable())
+				return;
+			{
+				mtp::scoped_mutex_lock nl(_notifyMutex);
+				_notifyHandle = handle;
+				_notifyStop = false;
+			}
+			_notifying = true;
+			_notifyThread = std::thread([this] { NotifyWorker(); });
+		}
+
+		///starts dedicated urb reaper thread of device if it was requested, after daemonizing, threads do not survive fork
+		void StartReaper()
+		{
+			if (!_reaper.Enabled)
+				return;
+			mtp::scoped_mutex_lock l(_mutex);
+			_reaperStarted = true;
+			mtp::usb::DevicePtr usbDevice = _device? _device->GetPipe()->GetDevice(): mtp::usb::DevicePtr();
+			if (usbDevice)
+				usbDevice->SetReaper(_reaper);
+		}
+
+		///subscribes to device events, listener thread polling interrupt endpoint would not survive fork either
+		void StartEvents()
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			_eventsStarted = true;
+			SubscribeEvents();
+		}
+
+		///starts pinging idle device, so it does not fall asleep and the next interactive request does not pay for its wake-up
+		void StartKeepalive()
+		{
+			if (_keepalive <= 0 || _keepaliveThread.joinable())
+				return;
+			_keepaliveThread = std::thread([this] { KeepaliveWorker(); });
+		}
+
+		void StopKeepalive()
+		{
+			if (!_keepaliveThread.joinable())
+				return;
+			{
+				mtp::scoped_mutex_lock kl(_keepaliveMutex);
+				_keepaliveStop = true;
+			}
+			_keepaliveCondition.notify_all();
+			_keepaliveThread.join();
+		}
+
+		///must be called before session is unmounted
+		void StopNotifications()
+		{
+			if (!_notifyThread.joinable())
+				return;
+			{
+				mtp::scoped_mutex_lock nl(_notifyMutex);
+				_notifyStop = true;
+				_invalidations.clear();
+			}
+			_notifyCondition.notify_all();
+			_notifyThread.join();
+			_notifying = false;
+			_notifyHandle = NULL;
+		}
+
+		~FuseWrapper()
+		{
+			StopNotifications();
+			StopKeepalive();
+			{
+				mtp::scoped_mutex_lock pl(_prefetchMutex);
+				_prefetchStop = true;
+			}
+			_prefetchCondition.notify_all();
+			if (_prefetchThread.joinable())
+				_prefetchThread.join();
+		}
+
+		class Foreground : mtp::Noncopyable //! marks request in progress, background prefetch does not compete with it for device
+		{
+			std::atomic<unsigned> &	_count;
+
+		public:
+			Foreground(FuseWrapper &wrapper): _count(wrapper._foreground)
+			{ ++_count; ++wrapper._requests; }
+			~Foreground()
+			{ --_count; }
+		};
+
+		///reconnects to device once it's plugged back, monitor thread is started after daemonizing as well
+		void StartHotplugMonitor()
+		{
+			if (_hotplug || !mtp::usb::HotplugMonitor::IsSupported())
+				return;
+			try
+			{ _hotplug = std::make_shared<mtp::usb::HotplugMonitor>([this](mtp::usb::HotplugMonitor::Action action, const std::string &busPath) { OnHotplug(action, busPath); }); }
+			catch(const std::exception &ex)
+			{ mtp::error("hotplug monitor is not available: ", ex.what()); }
+		}
+
+		void OnHotplug(mtp::usb::HotplugMonitor::Action action, const std::string &busPath)
+		{
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				if (busPath.empty() || busPath != _busPath)
+					return;
+			}
+			if (action == mtp::usb::HotplugMonitor::Action::Removed)
+			{
+				_deviceLost = true;
+				return;
+			}
+			if (!_deviceLost.exchange(false))
+				return; //reconnected already or duplicate add/bind event
+
+			for(int attempt = 0; attempt < ReconnectAttempts; ++attempt)
+			{
+				try
+				{
+					Connect(busPath);
+					mtp::debug("reconnected to device at ", busPath);
+					return;
+				}
+				catch(const std::exception &ex)
+				{ mtp::debug("reconnect attempt failed: ", ex.what()); }
+				std::this_thread::sleep_for(std::chrono::milliseconds(ReconnectDelayMs));
+			}
+			mtp::error("reconnecting to device at ", busPath, " failed");
+		}
+
+		///busPath: port the device is expected at, tried before regular device selection
+		void Connect(const std::string &busPath = std::string())
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+
+			std::string serial;
+			if (_session)
+			{
+				//keep listings to revalidate them after reconnect instead of enumerating everything again
+				serial = _session->GetDeviceInfo().SerialNumber;
+				if (!_metadataCache)
+					_metadataCache.reset(new MetadataCache(std::string()));
+				for(auto &dir : _files)
+				{
+					if (dir.first == FuseId::Root)
+						continue;
+					try
+					{
+						mtp::u64 key = GetCacheKey(dir.first);
+						StoreCachedChildren(key, dir.second, GetStoredAttrs(dir.second));
+					}
+					catch(const std::exception &ex)
+					{ mtp::error("saving listing failed: ", ex.what()); }
+				}
+			}
+
+			//kernel got success for these writes already, so closing the file has to report they are gone
+			for(auto &upload : _pendingUploads)
+				_lostWrites.insert(upload.first);
+			for(auto &buffer : _writeBuffers)
+				_lostWrites.insert(buffer.first);
+			for(auto &file : _openedFiles)
+				_lostWrites.insert(file.first); //edit was not committed
+			if (!_lostWrites.empty())
+				mtp::error("reconnect dropped unsent writes of ", _lostWrites.size(), " file(s)");
+
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				_files.clear();
+				_objects.Clear();
+				_directoryCache.clear();
+				_missingEntries.clear();
+				_readOnlyDirectories.clear();
+				_pendingUploads.clear();
+				_aliases.clear();
+			}
+			_partialListings.clear();
+			_openedFiles.clear();
+			_readahead.Clear();
+			_sequentialAccess.clear();
+			{
+				mtp::scoped_mutex_lock pl(_prefetchMutex);
+				_sequentialQueue.clear();
+			}
+			_writeBuffers.clear();
+			_budget.Release(MemoryBudget::Uploads, _pendingUploadSize);
+			_pendingUploadSize = 0;
+			if (_session && _eventSubscription >= 0)
+				_session->UnsubscribeEvents(_eventSubscription);
+			_eventSubscription = -1;
+			_eventsSupported = false;
+			{
+				mtp::scoped_mutex_lock el(_eventMutex);
+				_pendingEvents.clear();
+				_eventsPending = false;
+			}
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				_statsSession.reset();
+				_statsDevice.reset();
+			}
+			_thumbnailFetcher.reset();
+			_thumbnailCache.clear();
+			_budget.Release(MemoryBudget::Thumbnails, _thumbnailCacheSize);
+			_thumbnailCacheSize = 0;
+			_session.reset();
+			_device.reset();
+			if (!busPath.empty())
+			{
+				_device = mtp::Device::Find(busPath, _claimInterface); //other devices are not opened
+				if (_device && !_deviceId.empty() && _deviceId != busPath && _device->GetInfo().SerialNumber != _deviceId)
+					_device.reset(); //another device was plugged into this port
+			}
+			if (!_device)
+				_device = _deviceId.empty()? mtp::Device::FindFirst(_claimInterface): mtp::Device::Find(_deviceId, _claimInterface);
+			if (!_device)
+				throw std::runtime_error("no MTP device found");
+			mtp::usb::DevicePtr usbDevice = _device->GetPipe()->GetDevice(); //emulated devices have none
+			if (_transferSize && usbDevice)
+				usbDevice->SetTransferSize(_transferSize);
+			if (_reaperStarted && usbDevice)
+				usbDevice->SetReaper(_reaper);
+
+			_session = _device->OpenSession(1);
+			_session->GetStats().SetEnabled(_stats.IsEnabled());
+			if (_stats.IsEnabled() && usbDevice)
+				usbDevice->SetTraceCapacity(UsbTraceRecords);
+			if (_eventsStarted)
+				SubscribeEvents();
+			_editObjectSupported = _session->EditObjectSupported();
+			_moveObjectSupported = _session->GetCapabilities().Supports(mtp::OperationCode::MoveObject);
+			if (!_editObjectSupported)
+				mtp::error("your device does not have android EditObject extension, mounting read-only\n");
+			_getObjectPropertyListSupported = _session->GetObjectPropertyListSupported();
+			if (!_getObjectPropertyListSupported)
+				mtp::error("your device does not have GetObjectPropertyList extension, expect slow enumeration of big directories\n");
+
+			std::string cachePath = GetMetadataCachePath();
+			if (_metadataCache && (serial.empty() || serial != _session->GetDeviceInfo().SerialNumber || _metadataCache->GetPath() != cachePath))
+				_metadataCache.reset(); //another device
+			if (!_metadataCache && !cachePath.empty())
+				_metadataCache.reset(new MetadataCache(cachePath));
+			else if (cachePath.empty() && !_cacheDir.empty())
+				mtp::error("device has no serial number, metadata cache disabled\n");
+
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				_connectTime = time(NULL);
+				_statsSession = _session;
+				_statsDevice = _device->GetPipe()->GetDevice();
+				_busPath = _device->GetBusPath();
+			}
+			_deviceLost = false;
+			auto started = mtp::StartupTimings::Clock::now();
+			PopulateStorages();
+			_session->GetStartupTimings().Record("storages", started);
+			if (_crawl)
+				SchedulePrefetch(FuseId::Root, false, true); //listings were dropped above, cached ones are revalidated on the way
+		}
+
+		///longer entry timeouts and trusted metadata cache depend on events, so they are reported supported only once subscribed, i/o mutex must be held
+		void SubscribeEvents()
+		{
+			if (!_session || _eventSubscription >= 0)
+				return;
+			_eventSubscription = _session->SubscribeEvents([this](const mtp::Event &event) { QueueEvent(event); });
+			_eventsSupported = _eventSubscription >= 0;
+		}
+
+		void PopulateStorages()
+		{
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				_storageSpace.clear();
+			}
+			_storageIdList.clear();
+			_storageFromName.clear();
+			_storageToName.clear();
+			mtp::msg::StorageIDs ids = _session->GetStorageIDs();
+			_storageIdList.reserve(ids.StorageIDs.size());
+			for(size_t i = 0; i < ids.StorageIDs.size(); ++i)
+			{
+				mtp::StorageId id = ids.StorageIDs[i];
+				mtp::msg::StorageInfo si = _session->GetStorageInfo(id);
+				std::string path = GetStorageName(si, i);
+				_storageIdList.push_back(id);
+				_storageFromName[path] = id;
+				_storageToName[id] = path;
+				CacheStorageInfo(FuseId(MtpStorageShift + i), id, si);
+			}
+		}
+
+		///re-reads info of single storage after StorageInfoChanged, renames it if label changed
+		void RefreshStorage(mtp::StorageId id)
+		{
+			auto it = std::find(_storageIdList.begin(), _storageIdList.end(), id);
+			if (it == _storageIdList.end())
+			{
+				PopulateStorages();
+				return;
+			}
+
+			size_t index = std::distance(_storageIdList.begin(), it);
+			mtp::msg::StorageInfo si = _session->GetStorageInfo(id);
+			std::string path = GetStorageName(si, index);
+			std::string &oldPath = _storageToName[id];
+			if (oldPath != path)
+			{
+				_storageFromName.erase(oldPath);
+				_storageFromName[path] = id;
+				oldPath = path;
+				InvalidateDirectory(FuseId::Root);
+			}
+			CacheStorageInfo(FuseId(MtpStorageShift + index), id, si);
+		}
+
+		static std::string GetStorageName(const mtp::msg::StorageInfo &si, size_t index)
+		{
+			std::string path = si.GetName();
+			if (path.empty())
+			{
+				char buf[64];
+				snprintf(buf, sizeof(buf), "sdcard%u", (unsigned)index);
+				path = buf;
+			}
+			return path;
+		}
+
+		void CacheStorageInfo(FuseId inode, mtp::StorageId id, const mtp::msg::StorageInfo &si)
+		{
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			CacheStorageSpace(inode, id, si);
+			if (IsReadOnly(si))
+				_readOnlyDirectories.insert(inode);
+			else
+				_readOnlyDirectories.erase(inode);
+		}
+
+		///cache mutex must be held
+		void CacheStorageSpace(FuseId inode, mtp::StorageId id, const mtp::msg::StorageInfo &si)
+		{
+			StorageSpace &space = _storageSpace[inode];
+			space.Id = id;
+			space.FreeSpace = si.FreeSpaceInBytes;
+			space.Capacity = si.MaxCapacity;
+			space.Expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(StorageSpaceTtlMs);
+		}
+
+		///next statfs asks device again, called after content was written or deleted, i/o mutex must be held
+		void ExpireStorageSpace()
+		{
+			mtp::scoped_mutex_lock l(_cacheMutex);
+			for(auto &space : _storageSpace)
+				space.second.Expires = std::chrono::steady_clock::time_point();
+		}
+
+		///returns inodes of storages statfs of given inode is made of, empty if object storage is not cached, cache mutex must be held
+		std::vector<FuseId> GetCachedStorages(FuseId inode) const
+		{
+			std::vector<FuseId> storages;
+			if (inode == FuseId::Root)
+			{
+				for(auto &space : _storageSpace)
+					storages.push_back(space.first);
+			}
+			else if (IsStorage(inode))
+			{
+				if (_storageSpace.find(inode) != _storageSpace.end())
+					storages.push_back(inode);
+			}
+			else
+			{
+				mtp::ObjectId id = FromFuse(inode);
+				auto alias = _aliases.find(inode);
+				if (alias != _aliases.end())
+					id = alias->second;
+
+				const mtp::ObjectStore::Object *object = _objects.Find(id);
+				if (object && object->StorageId != mtp::StorageId())
+				{
+					for(auto &space : _storageSpace)
+						if (space.second.Id == object->StorageId)
+							storages.push_back(space.first);
+				}
+			}
+			return storages;
+		}
+
+		///sums cached space of storages, returns false if any of them is expired, cache mutex must be held
+		bool GetCachedStorageSpace(const std::vector<FuseId> &storages, mtp::u64 &freeSpace, mtp::u64 &capacity) const
+		{
+			auto now = std::chrono::steady_clock::now();
+			freeSpace = capacity = 0;
+			for(auto inode : storages)
+			{
+				auto i = _storageSpace.find(inode);
+				if (i == _storageSpace.end() || i->second.Expires <= now)
+					return false;
+				freeSpace += i->second.FreeSpace;
+				capacity += i->second.Capacity;
+			}
+			return true;
+		}
+
+		static bool IsReadOnly(const mtp::msg::StorageInfo &si)
+		{
+			static const mtp::u16 FixedRom = 1, RemovableRom = 2;
+			return si.AccessCapability != 0 || si.StorageType == FixedRom || si.StorageType == RemovableRom;
+		}
+
+		static bool IsStatsFile(FuseId inode)
+		{ return inode.Inode == StatsInode || inode.Inode == UsbTraceInode; }
+
+		static void GetStatsAttr(FuseId inode, struct stat &attr)
+		{
+			attr = { };
+			attr.st_ino = inode.Inode;
+			attr.st_mode = S_IFREG | 0444;
+			attr.st_nlink = 1;
+			attr.st_mtime = attr.st_ctime = attr.st_atime = time(NULL);
+		}
+
+		template<typename Getter>
+		static void WriteTransactionMetric(std::ostream &os, const char *name, const char *type, const mtp::TransactionStats::Snapshot &operations, Getter getter)
+		{
+			os << "# TYPE " << name << " " << type << "\n";
+			for(auto & i : operations)
+				os << name << "{op=\"0x" << mtp::hex(i.first, 4) << "\"} " << getter(i.second) << "\n";
+		}
+
+		///renders statistics without taking device mutex, so stuck transaction is visible while it's running
+		std::string RenderStats()
+		{
+			mtp::SessionPtr session;
+			mtp::usb::DevicePtr device;
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				session = _statsSession;
+				device = _statsDevice;
+			}
+
+			std::stringstream os;
+			_stats.Export(os, _readahead.GetHits(), _readahead.GetMisses());
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				os << "# TYPE aft_fuse_objects gauge\naft_fuse_objects " << _objects.GetSize() << "\n";
+				os << "# TYPE aft_fuse_object_table_bytes gauge\naft_fuse_object_table_bytes " << _objects.GetMemoryUsage() << "\n";
+				UpdateMetadataUsage(true);
+			}
+			_budget.Export(os);
+			if (session)
+			{
+				typedef const mtp::OperationStats & Stats;
+				auto operations = session->GetStats().GetSnapshot();
+				WriteTransactionMetric(os, "aft_mtp_transactions_total", "counter", operations, [](Stats s) { return s.Count; });
+				WriteTransactionMetric(os, "aft_mtp_transaction_errors_total", "counter", operations, [](Stats s) { return s.Errors; });
+				WriteTransactionMetric(os, "aft_mtp_transaction_timeouts_total", "counter", operations, [](Stats s) { return s.Timeouts; });
+				WriteTransactionMetric(os, "aft_mtp_transaction_aborts_total", "counter", operations, [](Stats s) { return s.Aborts; });
+				WriteTransactionMetric(os, "aft_mtp_transaction_seconds_total", "counter", operations, [](Stats s) { return s.TotalLatencyUs / 1e6; });
+				WriteTransactionMetric(os, "aft_mtp_transaction_max_seconds", "gauge", operations, [](Stats s) { return s.MaxLatencyUs / 1e6; });
+				WriteTransactionMetric(os, "aft_mtp_received_bytes_total", "counter", operations, [](Stats s) { return s.BytesIn; });
+				WriteTransactionMetric(os, "aft_mtp_sent_bytes_total", "counter", operations, [](Stats s) { return s.BytesOut; });
+
+				mtp::OperationCode code;
+				std::chrono::steady_clock::duration age;
+				os << "# TYPE aft_mtp_transaction_running_seconds gauge\n";
+				if (session->GetCurrentTransaction(code, age))
+					os << "aft_mtp_transaction_running_seconds{op=\"0x" << mtp::hex(code, 4) << "\"} " << std::chrono::duration_cast<std::chrono::microseconds>(age).count() / 1e6 << "\n";
+
+				os << "# TYPE aft_startup_phase_seconds gauge\n";
+				for(auto & phase : session->GetStartupTimings().Get())
+					os << "aft_startup_phase_seconds{phase=\"" << phase.first << "\"} " << std::chrono::duration_cast<std::chrono::microseconds>(phase.second).count() / 1e6 << "\n";
+			}
+			if (device)
+			{
+				auto usb = device->GetTransferStats();
+				os << "# TYPE aft_usb_urbs_submitted_total counter\naft_usb_urbs_submitted_total " << usb.Submitted << "\n";
+				os << "# TYPE aft_usb_urbs_completed_total counter\naft_usb_urbs_completed_total " << usb.Completed << "\n";
+				os << "# TYPE aft_usb_urbs_failed_total counter\naft_usb_urbs_failed_total " << usb.Failed << "\n";
+				os << "# TYPE aft_usb_urbs_discarded_total counter\naft_usb_urbs_discarded_total " << usb.Discarded << "\n";
+				os << "# TYPE aft_usb_timeouts_total counter\naft_usb_timeouts_total " << usb.Timeouts << "\n";
+				os << "# TYPE aft_usb_received_bytes_total counter\naft_usb_received_bytes_total " << usb.BytesIn << "\n";
+				os << "# TYPE aft_usb_sent_bytes_total counter\naft_usb_sent_bytes_total " << usb.BytesOut << "\n";
+			}
+			return os.str();
+		}
+
+		std::string RenderUsbTrace()
+		{
+			mtp::usb::DevicePtr device;
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				device = _statsDevice;
+			}
+			std::stringstream os;
+			if (device)
+				device->WriteTrace(os);
+			return os.str();
+		}
+
+		void OpenStats(fuse_req_t req, FuseId inode, struct fuse_file_info *fi)
+		{
+			if ((fi->flags & O_ACCMODE) != O_RDONLY)
+			{
+				FUSE_CALL(fuse_reply_err(req, EACCES));
+				return;
+			}
+			std::string data = inode.Inode == UsbTraceInode? RenderUsbTrace(): RenderStats();
+			{
+				mtp::scoped_mutex_lock l(_statsFilesMutex);
+				fi->fh = ++_nextStatsHandle;
+				_statsFiles[fi->fh].swap(data);
+			}
+			fi->direct_io = 1; //size is unknown until snapshot is taken
+			FUSE_CALL(fuse_reply_open(req, fi));
+		}
+
+		void ReadStats(fuse_req_t req, size_t size, off_t begin, struct fuse_file_info *fi)
+		{
+			mtp::scoped_mutex_lock l(_statsFilesMutex);
+			auto i = _statsFiles.find(fi->fh);
+			if (i == _statsFiles.end())
+			{
+				FUSE_CALL(fuse_reply_err(req, EBADF));
+				return;
+			}
+			const std::string &data = i->second;
+			size_t offset = std::min<size_t>(begin, data.size());
+			FUSE_CALL(fuse_reply_buf(req, data.data() + offset, std::min(size, data.size() - offset)));
+		}
+
+		void ReleaseStats(fuse_req_t req, struct fuse_file_info *fi)
+		{
+			{
+				mtp::scoped_mutex_lock l(_statsFilesMutex);
+				_statsFiles.erase(fi->fh);
+			}
+			FUSE_CALL(fuse_reply_err(req, 0));
+		}
+
+		static bool IsThumbnailDirectory(FuseId inode)
+		{ return inode.Inode >= ThumbnailDirectoryShift && inode.Inode < ThumbnailShift; }
+
+		static bool IsThumbnail(FuseId inode)
+		{ return inode.Inode >= ThumbnailShift && inode.Inode < UsbTraceInode; }
+
+		static bool IsVirtual(FuseId inode)
+		{ return IsThumbnailDirectory(inode) || IsThumbnail(inode) || IsStatsFile(inode); }
+
+		///replies EACCES to modifications of virtual files and directories
+		static bool RejectVirtual(fuse_req_t req, FuseId inode)
+		{
+			if (!IsVirtual(inode))
+				return false;
+			FUSE_CALL(fuse_reply_err(req, EACCES));
+			return true;
+		}
+
+		///format guessed from extension, Undefined for names which are not images or videos
+		static mtp::ObjectFormat GetThumbnailFormat(const std::string &filename)
+		{
+			size_t dot = filename.rfind('.');
+			if (dot == filename.npos)
+				return mtp::ObjectFormat::Undefined;
+			mtp::ObjectFormat format = mtp::ParseObjectFormat(filename.substr(dot + 1));
+			return mtp::ThumbnailFetcher::MayHaveThumbnail(format)? format: mtp::ObjectFormat::Undefined;
+		}
+
+		void DropThumbnail(mtp::ObjectId id)
+		{
+			auto i = _thumbnailCache.find(id);
+			if (i == _thumbnailCache.end())
+				return;
+			_thumbnailCacheSize -= i->second.Data.size();
+			_budget.Release(MemoryBudget::Thumbnails, i->second.Data.size());
+			_thumbnailCache.erase(i);
+		}
+
+		///drops least recently used thumbnails until size more bytes fit into cache and memory budget, i/o mutex must be held
+		void TrimThumbnails(size_t size)
+		{
+			while(!_thumbnailCache.empty() && (_thumbnailCacheSize + size > MaxThumbnailCacheSize || _budget.GetAvailable() < size || _budget.IsExceeded()))
+			{
+				auto oldest = std::min_element(_thumbnailCache.begin(), _thumbnailCache.end(),
+					[](const Thumbnails::value_type &a, const Thumbnails::value_type &b) { return a.second.Use < b.second.Use; });
+				DropThumbnail(oldest->first);
+			}
+		}
+
+		///returns thumbnail through cache, empty if device has none, i/o mutex must be held
+		const mtp::ByteArray & GetThumbnail(mtp::ObjectId id, mtp::ObjectFormat format)
+		{
+			auto i = _thumbnailCache.find(id);
+			if (i == _thumbnailCache.end())
+			{
+				if (!_thumbnailFetcher)
+					_thumbnailFetcher = std::make_shared<mtp::ThumbnailFetcher>(_session);
+				mtp::ByteArray data;
+				try
+				{ data = _thumbnailFetcher->Get(id, format); }
+				catch(const mtp::InvalidResponseException &ex)
+				{
+					if (ex.Type != mtp::ResponseType::NoThumbnailPresent)
+						throw;
+				}
+
+				TrimThumbnails(data.size());
+				i = _thumbnailCache.insert(std::make_pair(id, CachedThumbnail())).first;
+				i->second.Data.swap(data);
+				_thumbnailCacheSize += i->second.Data.size();
+				_budget.Acquire(MemoryBudget::Thumbnails, i->second.Data.size()); //caller needs it even if budget is exhausted
+			}
+			i->second.Use = ++_thumbnailClock;
+			return i->second.Data;
+		}
+
+		///fills attributes of thumbnail of object named name, false if it's not an image or video or device has no thumbnail; i/o mutex must be held
+		bool GetThumbnailAttr(FuseId object, const std::string &name, struct stat &attr, mtp::ByteArray *data = NULL)
+		{
+			mtp::ObjectFormat format = GetThumbnailFormat(name);
+			if (object.Inode >= ThumbnailDirectoryShift || format == mtp::ObjectFormat::Undefined) //pending uploads have no thumbnails yet
+				return false;
+			struct stat objectAttr = GetObjectAttr(object);
+			if (S_ISDIR(objectAttr.st_mode))
+				return false;
+			const mtp::ByteArray &thumbnail = GetThumbnail(FromFuse(object), format);
+			if (thumbnail.empty())
+				return false;
+
+			attr = { };
+			attr.st_ino = object.Inode + ThumbnailShift;
+			attr.st_mode = FuseEntry::FileMode;
+			attr.st_nlink = 1;
+			attr.st_size = thumbnail.size();
+			attr.st_atime = attr.st_mtime = objectAttr.st_mtime;
+			attr.st_ctime = objectAttr.st_ctime;
+			if (data)
+				*data = thumbnail;
+			return true;
+		}
+
+		///same for thumbnail inode, object name is taken from cached listing; i/o mutex must be held
+		bool GetThumbnailAttr(FuseId inode, struct stat &attr, mtp::ByteArray *data = NULL)
+		{
+			FuseId object(inode.Inode - ThumbnailShift);
+			GetObjectAttr(object); //lists parent if needed
+			std::string name;
+			if (FindCachedParent(object, &name) == FuseId::Root)
+				name = _session->GetObjectStringProperty(FromFuse(object), mtp::ObjectProperty::ObjectFilename);
+			return GetThumbnailAttr(object, name, attr, data);
+		}
+
+		static void GetThumbnailDirectoryAttr(FuseId inode, time_t mtime, struct stat &attr)
+		{
+			attr = { };
+			attr.st_ino = inode.Inode;
+			attr.st_mode = S_IFDIR | 0555;
+			attr.st_nlink = 2;
+			attr.st_mtime = attr.st_ctime = attr.st_atime = mtime;
+		}
+
+		void LookupThumbnail(FuseEntry &entry, FuseId parent, const std::string &name)
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			if (IsThumbnail(parent) || IsStatsFile(parent))
+			{
+				entry.ReplyError(ENOTDIR);
+				return;
+			}
+			if (!IsThumbnailDirectory(parent))
+			{
+				struct stat attr = GetObjectAttr(parent);
+				if (!S_ISDIR(attr.st_mode))
+				{
+					entry.ReplyError(ENOTDIR);
+					return;
+				}
+				FuseId inode(parent.Inode + ThumbnailDirectoryShift);
+				entry.SetTimeout(GetTimeout(parent));
+				GetThumbnailDirectoryAttr(inode, attr.st_mtime, entry.attr);
+				entry.SetId(inode);
+				entry.Reply();
+				return;
+			}
+
+			FuseId directory(parent.Inode - ThumbnailDirectoryShift);
+			entry.SetTimeout(GetTimeout(directory));
+			const ChildrenObjects & children = GetChildren(directory);
+			auto it = children.find(name);
+			if (it == children.end() || !GetThumbnailAttr(it->second, name, entry.attr))
+			{
+				entry.ReplyNotFound();
+				return;
+			}
+			entry.SetId(FuseId(it->second.Inode + ThumbnailShift));
+			entry.Reply();
+		}
+
+		void ReplyThumbnailAttr(FuseEntry &entry, FuseId inode)
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			if (IsThumbnailDirectory(inode))
+			{
+				FuseId directory(inode.Inode - ThumbnailDirectoryShift);
+				entry.SetTimeout(GetTimeout(directory));
+				GetThumbnailDirectoryAttr(inode, GetObjectAttr(directory).st_mtime, entry.attr);
+			}
+			else if (!GetThumbnailAttr(inode, entry.attr))
+			{
+				entry.ReplyError(ENOENT);
+				return;
+			}
+			entry.ReplyAttr();
+		}
+
+		///lists names only, thumbnails are fetched when looked up, so listing does not cost a transfer per image, readdirplus passes its handle
+		void ReadThumbnailDirectory(fuse_req_t req, FuseId ino, size_t size, off_t off, struct fuse_file_info *plus)
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			FuseId directory(ino.Inode - ThumbnailDirectoryShift);
+			const ChildrenObjects & children = GetChildren(directory);
+			std::vector<std::pair<std::string, FuseId>> entries;
+			for(auto &child : children)
+			{
+				struct stat attr;
+				if (child.second.Inode >= ThumbnailDirectoryShift || GetThumbnailFormat(child.first) == mtp::ObjectFormat::Undefined)
+					continue;
+				if (GetCachedObjectAttr(child.second, attr) && S_ISDIR(attr.st_mode))
+					continue;
+				entries.push_back(std::make_pair(child.first, FuseId(child.second.Inode + ThumbnailShift)));
+			}
+
+			if (!plus)
+			{
+				FuseDirectory dir(req);
+				CharArray data;
+				struct stat attr = { };
+				attr.st_mode = S_IFDIR | 0555;
+				attr.st_ino = ino.Inode;
+				dir.Add(data, ".", attr);
+				attr.st_ino = directory.Inode;
+				dir.Add(data, "..", attr);
+				attr.st_mode = FuseEntry::FileMode;
+				for(auto &entry : entries)
+				{
+					attr.st_ino = entry.second.Inode;
+					dir.Add(data, entry.first, attr);
+				}
+				dir.Reply(req, data, off, size);
+				return;
+			}
+
+#if FUSE_USE_VERSION >= 30
+			DirectorySnapshotPtr snapshot = GetDirectorySnapshot(plus);
+			if (off == 0 || snapshot->Entries.empty())
+			{
+				snapshot->Thumbnails = true;
+				snapshot->Entries.clear();
+				snapshot->Entries.reserve(entries.size() + 2);
+				snapshot->Entries.emplace_back(".", ino);
+				snapshot->Entries.emplace_back("..", directory);
+				snapshot->Entries.insert(snapshot->Entries.end(), entries.begin(), entries.end());
+			}
+			ReplyDirectorySnapshot(req, *snapshot, size, off, 0);
+#endif
+		}
+
+		void OpenThumbnail(fuse_req_t req, FuseId inode, struct fuse_file_info *fi)
+		{
+			if ((fi->flags & O_ACCMODE) != O_RDONLY)
+			{
+				FUSE_CALL(fuse_reply_err(req, EACCES));
+				return;
+			}
+			mtp::ByteArray data;
+			{
+				mtp::scoped_mutex_lock l(_mutex);
+				ProcessEvents();
+				struct stat attr;
+				if (!GetThumbnailAttr(inode, attr, &data))
+				{
+					FUSE_CALL(fuse_reply_err(req, ENOENT));
+					return;
+				}
+			}
+			//served like statistics snapshot, so eviction from thumbnail cache does not affect open files
+			{
+				mtp::scoped_mutex_lock l(_statsFilesMutex);
+				fi->fh = ++_nextStatsHandle;
+				_statsFiles[fi->fh].assign(data.begin(), data.end());
+			}
+			if (_snapshot)
+				fi->keep_cache = 1;
+			FUSE_CALL(fuse_reply_open(req, fi));
+		}
+
+		FuseStats & GetStats()
+		{ return _stats; }
+
+		///replies EROFS to modifications of snapshot mount, kernel rejects most of them already
+		bool RejectWrite(fuse_req_t req)
+		{
+			if (!_snapshot)
+				return false;
+			FUSE_CALL(fuse_reply_err(req, EROFS));
+			return true;
+		}
+
+		///replies EIO if data written to file was lost on reconnect, i/o mutex must be held
+		bool RejectLostWrites(fuse_req_t req, FuseId inode)
+		{
+			if (_lostWrites.find(inode) == _lostWrites.end())
+				return false;
+			FUSE_CALL(fuse_reply_err(req, EIO));
+			return true;
+		}
+
+		///enumerates every directory once, so tree walks of snapshot mount never wait for device
+		void PreloadTree()
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			std::vector<FuseId> directories(1, FuseId::Root);
+			size_t loaded = 0;
+			while(!directories.empty())
+			{
+				FuseId inode = directories.back();
+				directories.pop_back();
+				try
+				{
+					const ChildrenObjects &children = GetChildren(inode);
+					for(auto &child : children)
+					{
+						struct stat attr;
+						if (GetCachedObjectAttr(child.second, attr) && S_ISDIR(attr.st_mode))
+							directories.push_back(child.second);
+					}
+					++loaded;
+				}
+				catch(const std::exception &ex)
+				{ mtp::error("listing directory ", inode.Inode, " failed: ", ex.what()); }
+			}
+			mtp::debug("preloaded ", loaded, " directories, ", _objects.GetSize(), " objects");
+		}
+
+		///returns hint of running crawl, NULL if it was cancelled or mount is shutting down, prefetch mutex must be held
+		PrefetchHint * FindRunningHint(FuseId root)
+		{
+			if (_prefetchStop)
+				return NULL;
+			auto i = _prefetchHints.find(root);
+			return i != _prefetchHints.end() && i->second.State == PrefetchHint::Status::Running? &i->second: NULL;
+		}
+
+		///waits until no request is in progress, returns false if crawl should stop
+		bool WaitForIdle(FuseId root)
+		{
+			while(true)
+			{
+				{
+					mtp::scoped_mutex_lock pl(_prefetchMutex);
+					if (!FindRunningHint(root))
+						return false;
+				}
+				if (_foreground.load() == 0)
+					return true;
+				std::this_thread::sleep_for(std::chrono::milliseconds(PrefetchIdleMs));
+			}
+		}
+
+		///returns false if object does not fit into free readahead memory
+		bool WarmContent(FuseId root, FuseId inode, mtp::u64 size)
+		{
+			mtp::scoped_mutex_lock l(_mutex);
+			if (_pendingUploads.find(inode) != _pendingUploads.end() || _writeBuffers.find(inode) != _writeBuffers.end())
+				return true; //being written
+			mtp::ObjectId objectId = ToObjectId(inode);
+			bool warmed;
+			try
+			{
+				warmed = _readahead.Warm(inode, size,
+					[this, objectId](mtp::u64 offset, size_t size, mtp::ByteArray &buffer)
+					{
+						auto stream = std::make_shared<mtp::ByteArrayObjectOutputStream>();
+						_session->GetObject(objectId, stream);
+						buffer = stream->ReleaseData();
+					});
+			}
+			catch(const std::exception &ex)
+			{
+				mtp::error("prefetching object ", inode.Inode, " failed: ", ex.what());
+				_readahead.Invalidate(inode);
+				mtp::scoped_mutex_lock pl(_prefetchMutex);
+				PrefetchHint *hint = FindRunningHint(root);
+				if (hint)
+					++hint->Errors;
+				return true;
+			}
+
+			mtp::scoped_mutex_lock pl(_prefetchMutex);
+			PrefetchHint *hint = FindRunningHint(root);
+			if (hint && warmed)
+			{
+				++hint->Files;
+				hint->Bytes += size;
+			}
+			return warmed;
+		}
+
+		///lists subtree breadth-first, so upper levels users browse first are warm early, and optionally reads its files
+		///each directory and file takes device mutex separately and only while mount is idle, returns false if crawl was cancelled
+		bool CrawlSubtree(FuseId root)
+		{
+			std::deque<FuseId> directories(1, root);
+			while(!directories.empty())
+			{
+				if (!WaitForIdle(root))
+					return false;
+
+				FuseId inode = directories.front();
+				directories.pop_front();
+
+				bool content;
+				{
+					mtp::scoped_mutex_lock pl(_prefetchMutex);
+					PrefetchHint *hint = FindRunningHint(root);
+					if (!hint)
+						return false;
+					content = hint->Content && !hint->Full;
+				}
+
+				std::vector<std::pair<FuseId, mtp::u64>> files;
+				try
+				{
+					mtp::scoped_mutex_lock l(_mutex);
+					ProcessEvents();
+					const ChildrenObjects &children = GetChildren(inode);
+					for(auto &child : children)
+					{
+						struct stat attr;
+						if (!GetCachedObjectAttr(child.second, attr))
+							continue;
+						if (S_ISDIR(attr.st_mode))
+							directories.push_back(child.second);
+						else if (content && attr.st_size > 0)
+							files.emplace_back(child.second, attr.st_size);
+					}
+				}
+				catch(const std::exception &ex)
+				{
+					mtp::error("prefetching directory ", inode.Inode, " failed: ", ex.what());
+					mtp::scoped_mutex_lock pl(_prefetchMutex);
+					PrefetchHint *hint = FindRunningHint(root);
+					if (hint)
+						++hint->Errors;
+					continue;
+				}
+
+				{
+					mtp::scoped_mutex_lock pl(_prefetchMutex);
+					PrefetchHint *hint = FindRunningHint(root);
+					if (hint)
+						++hint->Directories;
+				}
+
+				for(auto &file : files)
+				{
+					if (!WaitForIdle(root))
+						return false;
+					if (!WarmContent(root, file.first, file.second))
+					{
+						mtp::debug("readahead memory is full, prefetching metadata only");
+						mtp::scoped_mutex_lock pl(_prefetchMutex);
+						PrefetchHint *hint = FindRunningHint(root);
+						if (hint)
+							hint->Full = true;
+						break;
+					}
+				}
+			}
+			return true;
+		}
+
+		///records file opened for reading, once files of directory are opened one after another in name order
+		///beginning of the following ones is read in background, i/o mutex must be held
+		void TrackSequentialOpen(FuseId inode)
+		{
+			FuseId parent = GetParentObject(inode);
+			auto dir = _files.find(parent);
+			if (dir == _files.end())
+				return; //order is only known from cached listing
+
+			const ChildrenObjects &children = dir->second;
+			auto current = std::find_if(children.begin(), children.end(), [inode](const ChildrenObjects::value_type &child) { return child.second == inode; });
+			if (current == children.end())
+				return;
+
+			auto isFile = [this](FuseId id, struct stat &attr) { return GetCachedObjectAttr(id, attr) && S_ISREG(attr.st_mode); };
+			struct stat attr;
+			FuseId previous = FuseId::Root;
+			for(auto i = ChildrenObjects::const_reverse_iterator(current); i != children.rend(); ++i)
+			{
+				if (isFile(i->second, attr))
+				{
+					previous = i->second;
+					break;
+				}
+			}
+
+			if (_sequentialAccess.size() >= MaxSequentialDirectories && _sequentialAccess.find(parent) == _sequentialAccess.end())
+				_sequentialAccess.clear();
+			SequentialAccess &access = _sequentialAccess[parent];
+			if (access.Last == inode)
+				return; //players open the same file again to probe it
+			access.Streak = previous != FuseId::Root && previous == access.Last? access.Streak + 1: 0;
+			access.Last = inode;
+			if (access.Streak == 0)
+				return;
+
+			std::vector<SequentialPrefetch> next;
+			for(auto i = std::next(current); i != children.end() && next.size() < SequentialFiles; ++i)
+			{
+				if (!isFile(i->second, attr) || attr.st_size <= 0)
+					continue;
+				mtp::u64 size = std::min<mtp::u64>(attr.st_size, _sequentialSize);
+				if (_readahead.GetCachedSize(i->second) < size)
+					next.push_back(SequentialPrefetch { parent, i->second, size });
+			}
+			if (next.empty())
+				return;
+
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "sequential access to directory ", parent.Inode, ", prefetching ", next.size(), " next files");
+			mtp::scoped_mutex_lock pl(_prefetchMutex);
+			//files queued after previously opened one are stale now, other directories keep theirs
+			_sequentialQueue.erase(std::remove_if(_sequentialQueue.begin(), _sequentialQueue.end(),
+				[parent](const SequentialPrefetch &queued) { return queued.Parent == parent; }), _sequentialQueue.end());
+			_sequentialQueue.insert(_sequentialQueue.end(), next.begin(), next.end());
+			WakePrefetchWorker();
+		}
+
+		///reads file ahead of sequential consumer into free readahead memory, between its requests
+		///device mutex is taken for a single chunk at a time, so foreground requests wait for one chunk at most
+		void WarmNextFile(const SequentialPrefetch &next)
+		{
+			size_t chunk = _transferSize? _transferSize: SequentialChunkSize;
+			while(true)
+			{
+				while(_foreground.load() != 0)
+				{
+					{
+						mtp::scoped_mutex_lock pl(_prefetchMutex);
+						if (_prefetchStop)
+							return;
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(PrefetchIdleMs));
+				}
+
+				mtp::scoped_mutex_lock l(_mutex);
+				if (_foreground.load() != 0)
+					continue; //request arrived while waiting for device
+				if (_pendingUploads.find(next.Inode) != _pendingUploads.end() || _writeBuffers.find(next.Inode) != _writeBuffers.end())
+					return;
+				mtp::u64 cached = _readahead.GetCachedSize(next.Inode);
+				if (cached >= next.Size)
+				{
+					MTP_DEBUG_CATEGORY(mtp::LogFuse, "prefetched ", next.Size, " bytes of next file ", next.Inode.Inode);
+					return;
+				}
+
+				mtp::ObjectId objectId = ToObjectId(next.Inode);
+				try
+				{
+					bool warmed = _readahead.WarmChunk(next.Inode, next.Size, chunk,
+						[this, objectId](mtp::u64 offset, size_t size, mtp::ByteArray &buffer)
+						{ _session->GetPartialObject(objectId, offset, size, buffer); });
+					if (!warmed)
+					{
+						MTP_DEBUG_CATEGORY(mtp::LogFuse, "prefetching next file ", next.Inode.Inode, " stopped at ", cached, " bytes: no memory");
+						return;
+					}
+					if (_readahead.GetCachedSize(next.Inode) <= cached)
+						return; //consumer's reads replaced the buffer, it is ahead of prefetch already
+				}
+				catch(const std::exception &ex)
+				{
+					mtp::error("prefetching next file ", next.Inode.Inode, " failed: ", ex.what());
+					_readahead.Invalidate(next.Inode);
+					return;
+				}
+			}
+		}
+
+		void KeepaliveWorker()
+		{
+			std::unique_lock<std::mutex> kl(_keepaliveMutex);
+			std::chrono::duration<double> interval(_keepalive);
+			mtp::u64 requests = _requests.load();
+			while(!_keepaliveCondition.wait_for(kl, interval, [this] { return _keepaliveStop; }))
+			{
+				mtp::u64 current = _requests.load();
+				bool idle = current == requests && _foreground.load() == 0;
+				requests = current;
+				if (!idle)
+					continue;
+				kl.unlock();
+				Ping();
+				kl.lock();
+			}
+		}
+
+		///cheapest transaction refreshing something useful: free space of the first storage, reported by statfs
+		void Ping()
+		{
+			FuseStats::Scope scope(_stats, FuseStats::Keepalive);
+			try
+			{
+				mtp::scoped_mutex_lock l(_mutex);
+				if (!_session || _deviceLost || _storageIdList.empty())
+					return; //foreground request or hotplug reconnects
+				mtp::StorageId id = _storageIdList.front();
+				CacheStorageInfo(FuseId(MtpStorageShift), id, _session->GetStorageInfo(id));
+			}
+			catch(const std::exception &ex)
+			{
+				scope.Fail();
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "keepalive failed: ", ex.what());
+			}
+		}
+
+		void PrefetchWorker()
+		{
+			std::unique_lock<std::mutex> pl(_prefetchMutex);
+			while(true)
+			{
+				_prefetchCondition.wait(pl, [this] { return _prefetchStop || !_prefetchQueue.empty() || !_sequentialQueue.empty(); });
+				if (_prefetchStop)
+					return;
+
+				if (!_sequentialQueue.empty())
+				{
+					//consumer is waiting for these soon, they go before crawls
+					SequentialPrefetch next = _sequentialQueue.front();
+					_sequentialQueue.pop_front();
+					pl.unlock();
+					WarmNextFile(next);
+					pl.lock();
+					continue;
+				}
+
+				FuseId root = _prefetchQueue.front();
+				_prefetchQueue.pop_front();
+				auto i = _prefetchHints.find(root);
+				if (i == _prefetchHints.end() || i->second.State != PrefetchHint::Status::Queued)
+					continue;
+				i->second.State = PrefetchHint::Status::Running;
+
+				pl.unlock();
+				bool completed;
+				try
+				{ completed = CrawlSubtree(root); }
+				catch(const std::exception &ex)
+				{ mtp::error("prefetching ", root.Inode, " failed: ", ex.what()); completed = true; }
+				pl.lock();
+
+				PrefetchHint *hint = FindRunningHint(root);
+				if (hint && completed && hint->Restart)
+				{
+					bool content = hint->Content;
+					*hint = PrefetchHint();
+					hint->Content = content;
+					_prefetchQueue.push_back(root);
+				}
+				else if (hint)
+				{
+					hint->State = completed? PrefetchHint::Status::Done: PrefetchHint::Status::Cancelled;
+					MTP_DEBUG_CATEGORY(mtp::LogFuse, "prefetched ", hint->Directories, " directories, ", hint->Files, " files, ", hint->Bytes, " bytes of ", root.Inode);
+				}
+			}
+		}
+
+		///starts worker for queued hints, prefetch mutex must be held
+		void WakePrefetchWorker()
+		{
+			if (!_prefetchStarted)
+				return; //fork of fuse_daemonize would leave joinable thread which does not run
+			if (!_prefetchThread.joinable())
+				_prefetchThread = std::thread([this] { PrefetchWorker(); });
+			_prefetchCondition.notify_one();
+		}
+
+		///runs hints queued so far, -B crawl is queued by constructor already
+		void StartPrefetch()
+		{
+			mtp::scoped_mutex_lock pl(_prefetchMutex);
+			_prefetchStarted = true;
+			if (!_prefetchQueue.empty() || !_sequentialQueue.empty())
+				WakePrefetchWorker();
+		}
+
+		///restart: running crawl is repeated once finished, caches were dropped behind it
+		void SchedulePrefetch(FuseId root, bool content, bool restart = false)
+		{
+			mtp::scoped_mutex_lock pl(_prefetchMutex);
+			PrefetchHint &hint = _prefetchHints[root];
+			if (hint.State == PrefetchHint::Status::Queued || hint.State == PrefetchHint::Status::Running)
+			{
+				bool running = hint.State == PrefetchHint::Status::Running;
+				if (content && !hint.Content)
+				{
+					hint.Content = true;
+					hint.Restart = hint.Restart || running; //directories crawled so far are visited again for their files
+				}
+				hint.Restart = hint.Restart || (running && restart);
+			}
+			else
+			{
+				hint = PrefetchHint();
+				hint.Content = content;
+				_prefetchQueue.push_back(root);
+			}
+			WakePrefetchWorker();
 		}
 
 		void Init(void *, fuse_conn_info *conn)
 		{
 			mtp::scoped_mutex_lock l(_mutex);
+#if FUSE_USE_VERSION >= 30
+			//readdirplus only: with READDIRPLUS_AUTO kernel mixes byte offsets of readdir and indices of readdirplus on the same handle
+			conn->want |= conn->capable & FUSE_CAP_READDIRPLUS;
+			conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+			if (_writebackCache)
+				conn->want |= conn->capable & FUSE_CAP_WRITEBACK_CACHE; //kernel merges small writes into pages and sends them in large sequential chunks
+#else
 			conn->want |= conn->capable & FUSE_CAP_BIG_WRITES; //big writes
+#endif
+			//libfuse 3 negotiates max_pages from max_write, so reads and writes are sent in up to 1MiB requests
 			static const size_t MaxWriteSize = 1024 * 1024;
 			if (conn->max_write < MaxWriteSize)
 				conn->max_write = MaxWriteSize;
 		}
 
-		void Lookup (fuse_req_t req, FuseId parent, const char *name)
+		void Lookup (fuse_req_t req, FuseId parent, const char *name)
+		{
+			FuseEntry entry(req);
+			if (_stats.IsEnabled() && parent == FuseId::Root && (strcmp(name, StatsFileName) == 0 || strcmp(name, UsbTraceFileName) == 0))
+			{
+				FuseId inode(strcmp(name, StatsFileName) == 0? StatsInode: UsbTraceInode);
+				entry.SetTimeout(0);
+				GetStatsAttr(inode, entry.attr);
+				entry.SetId(inode);
+				entry.Reply();
+				return;
+			}
+			if (_thumbnails && (IsVirtual(parent) || (parent != FuseId::Root && strcmp(name, ThumbnailDirectoryName) == 0)))
+			{
+				LookupThumbnail(entry, parent, name);
+				return;
+			}
+
+			if (!_eventsPending)
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				entry.SetTimeout(GetTimeout(parent));
+
+				auto m = _missingEntries.find(parent);
+				if (m != _missingEntries.end() && m->second.find(name) != m->second.end())
+				{
+					entry.ReplyNotFound();
+					return;
+				}
+
+				auto i = parent != FuseId::Root? _files.find(parent): _files.end(); //storage list is always refreshed
+				if (i != _files.end())
+				{
+					auto it = i->second.find(name);
+					if (it == i->second.end())
+					{
+						l.unlock();
+						AddMissingEntry(parent, name);
+						entry.ReplyNotFound();
+						return;
+					}
+					_stats.Hit(FuseStats::FilesCache);
+					if (GetCachedObjectAttr(it->second, entry.attr))
+					{
+						entry.SetId(it->second);
+						TouchListing(parent);
+						AddLookup(it->second);
+						entry.Reply();
+						return;
+					}
+				}
+			}
+
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				entry.SetTimeout(GetTimeout(parent));
+			}
+
+			auto p = _partialListings.find(parent);
+			if (p != _partialListings.end())
+			{
+				//entries already returned by readdir, do not wait for the rest of directory
+				auto it = p->second.Children.find(name);
+				if (it != p->second.Children.end())
+				{
+					entry.SetId(it->second);
+					entry.attr = p->second.Attrs[FromFuse(it->second)];
+					{
+						mtp::scoped_mutex_lock cl(_cacheMutex);
+						AddLookup(it->second);
+					}
+					entry.Reply();
+					return;
+				}
+			}
+
+			const ChildrenObjects & children = GetChildren(parent);
+			auto it = children.find(name);
+			if (it == children.end())
+			{
+				AddMissingEntry(parent, name);
+				entry.ReplyNotFound();
+				return;
+			}
+			if (!FillEntry(entry, it->second))
+			{
+				entry.ReplyError(ENOENT);
+				return;
+			}
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				AddLookup(it->second);
+			}
+			entry.Reply();
+		}
+
+		void ReadDir(fuse_req_t req, FuseId ino, size_t size, off_t off, struct fuse_file_info *fi)
+		{
+			if (IsThumbnailDirectory(ino))
+			{
+				ReadThumbnailDirectory(req, ino, size, off, nullptr);
+				return;
+			}
+			FuseDirectory dir(req);
+			if (!_eventsPending)
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				auto it = _directoryCache.find(ino);
+				if (it != _directoryCache.end())
+				{
+					_stats.Hit(FuseStats::DirectoryCache);
+					dir.Reply(req, it->second, off, size);
+					return;
+				}
+			}
+
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			if (!(GetObjectAttr(ino).st_mode & S_IFDIR))
+			{
+				FUSE_CALL(fuse_reply_err(req, ENOTDIR));
+				return;
+			}
+
+			auto it = _directoryCache.find(ino);
+			if (it != _directoryCache.end())
+			{
+				_stats.Hit(FuseStats::DirectoryCache);
+				dir.Reply(req, it->second, off, size);
+				return;
+			}
+			_stats.Miss(FuseStats::DirectoryCache);
+
+			auto p = _partialListings.find(ino);
+			if (p == _partialListings.end() && ino != FuseId::Root && _files.find(ino) == _files.end())
+			{
+				PartialListing listing;
+				if (!BeginListing(ino, listing))
+				{
+					listing.Serve = true;
+					dir.Add(listing.Data, ".", GetObjectAttr(FuseId::Root));
+					dir.Add(listing.Data, "..", GetObjectAttr(GetParentObject(ino)));
+					p = _partialListings.insert(std::make_pair(ino, std::move(listing))).first;
+				}
+			}
+
+			if (p != _partialListings.end())
+			{
+				PartialListing &listing = p->second;
+				while(listing.Data.size() < off + size && listing.Next < listing.Handles.size())
+					FetchListing(listing, ListingBatchSize);
+
+				if (listing.Next < listing.Handles.size())
+				{
+					dir.Reply(req, listing.Data, off, size);
+					return;
+				}
+
+				PartialListing complete(std::move(listing));
+				_partialListings.erase(p);
+				FinishListing(ino, complete);
+				it = _directoryCache.find(ino);
+			}
+
+			if (it == _directoryCache.end())
+			{
+				const ChildrenObjects & cache = GetChildren(ino);
+
+				CharArray data;
+				dir.Add(data, ".", GetObjectAttr(FuseId::Root));
+				dir.Add(data, "..", GetObjectAttr(GetParentObject(ino)));
+				for(auto entry : cache)
+				{
+					dir.Add(data, entry.first, GetObjectAttr(entry.second));
+				}
+
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				it = _directoryCache.insert(std::make_pair(ino, std::move(data))).first;
+			}
+
+			dir.Reply(req, it->second, off, size);
+		}
+
+#if FUSE_USE_VERSION >= 30
+		void OpenDir(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		{
+			{
+				mtp::scoped_mutex_lock l(_directorySnapshotsMutex);
+				fi->fh = ++_nextDirectoryHandle;
+				_directorySnapshots[fi->fh] = std::make_shared<DirectorySnapshot>();
+			}
+			FUSE_CALL(fuse_reply_open(req, fi));
+		}
+
+		void ReleaseDir(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		{
+			{
+				mtp::scoped_mutex_lock l(_directorySnapshotsMutex);
+				_directorySnapshots.erase(fi->fh);
+			}
+			FUSE_CALL(fuse_reply_err(req, 0));
+		}
+
+		DirectorySnapshotPtr GetDirectorySnapshot(struct fuse_file_info *fi)
+		{
+			mtp::scoped_mutex_lock l(_directorySnapshotsMutex);
+			DirectorySnapshotPtr &snapshot = _directorySnapshots[fi->fh];
+			if (!snapshot)
+				snapshot = std::make_shared<DirectorySnapshot>();
+			return snapshot;
+		}
+
+		///offsets are indices of snapshot plus one, "." and ".." are sent without inode, kernel neither links nor counts them
+		void ReplyDirectorySnapshot(fuse_req_t req, const DirectorySnapshot &snapshot, size_t size, off_t off, double timeout)
+		{
+			CharArray data(size);
+			size_t used = 0;
+			for(size_t index = off; index < snapshot.Entries.size(); ++index)
+			{
+				const std::string &name = snapshot.Entries[index].first;
+				FuseId id = snapshot.Entries[index].second;
+				bool device = index >= 2 && !snapshot.Thumbnails;
+				FuseEntry entry(req);
+				entry.SetTimeout(timeout);
+				if (device)
+				{
+					if (!FillEntry(entry, id))
+						continue; //removed after snapshot was taken
+				}
+				else
+				{
+					entry.attr.st_ino = id.Inode;
+					entry.attr.st_mode = index < 2? S_IFDIR | 0555: FuseEntry::FileMode;
+				}
+
+				size_t entrySize = fuse_add_direntry_plus(req, data.data() + used, size - used, name.c_str(), &entry, index + 1);
+				if (entrySize > size - used)
+					break;
+				used += entrySize;
+				if (device)
+				{
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					AddLookup(id);
+				}
+			}
+			FUSE_CALL(fuse_reply_buf(req, data.data(), used));
+		}
+
+		///returns entries with attributes, so kernel does not issue lookup for each of them
+		void ReadDirPlus(fuse_req_t req, FuseId ino, size_t size, off_t off, struct fuse_file_info *fi)
+		{
+			if (IsThumbnailDirectory(ino))
+			{
+				ReadThumbnailDirectory(req, ino, size, off, fi);
+				return;
+			}
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			if (!(GetObjectAttr(ino).st_mode & S_IFDIR))
+			{
+				FUSE_CALL(fuse_reply_err(req, ENOTDIR));
+				return;
+			}
+
+			DirectorySnapshotPtr snapshot = GetDirectorySnapshot(fi);
+			if (off == 0 || snapshot->Entries.empty())
+			{
+				//first read or rewinddir
+				const ChildrenObjects & children = GetChildren(ino);
+				snapshot->Entries.clear();
+				snapshot->Entries.reserve(children.size() + 2);
+				snapshot->Entries.emplace_back(".", ino);
+				snapshot->Entries.emplace_back("..", GetParentObject(ino));
+				snapshot->Entries.insert(snapshot->Entries.end(), children.begin(), children.end());
+			}
+			ReplyDirectorySnapshot(req, *snapshot, size, off, GetTimeout(ino));
+		}
+#endif
+
+		void GetAttr(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		{
+			FuseEntry entry(req);
+			if (IsStatsFile(ino))
+			{
+				entry.SetTimeout(0);
+				GetStatsAttr(ino, entry.attr);
+				entry.ReplyAttr();
+				return;
+			}
+			if (IsThumbnailDirectory(ino) || IsThumbnail(ino))
+			{
+				ReplyThumbnailAttr(entry, ino);
+				return;
+			}
+			{
+				mtp::scoped_mutex_lock l(_cacheMutex);
+				entry.SetTimeout(GetTimeout(ino));
+				if (!_eventsPending && GetCachedObjectAttr(ino, entry.attr))
+				{
+					_stats.Hit(FuseStats::AttrsCache);
+					entry.SetId(ino);
+					entry.ReplyAttr();
+					return;
+				}
+			}
+
+			mtp::scoped_mutex_lock l(_mutex);
+			ProcessEvents();
+			if (FillEntry(entry, ino))
+				entry.ReplyAttr();
+			else
+				entry.ReplyError(ENOENT);
+		}
+
+		mtp::Session::ObjectEditSessionPtr GetTransaction(FuseId inode)
+		{
+			mtp::Session::ObjectEditSessionPtr tr;
+			{
+				auto it = _openedFiles.find(inode);
+				if (it != _openedFiles.end())
+					tr = it->second;
+				else
+				{
+					tr = mtp::Session::EditObject(_session, ToObjectId(inode));
+					_openedFiles[inode] = tr;
+				}
+			}
+			return NOT_NULL(tr);
+		}
+
+		void Read(fuse_req_t req, FuseId ino, size_t size, off_t begin, struct fuse_file_info *fi)
+		{
+			if (IsStatsFile(ino) || IsThumbnail(ino))
+			{
+				ReadStats(req, size, begin, fi);
+				return;
+			}
+			mtp::scoped_mutex_lock l(_mutex);
+			FlushWrites(ino);
+			ReleaseTransaction(ino);
+			struct stat attr = GetObjectAttr(ino);
+			off_t rsize = std::min<off_t>(attr.st_size - begin, size);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "reading ", rsize, " bytes");
+			if (rsize <= 0)
+			{
+				FUSE_CALL(fuse_reply_buf(req, NULL, 0));
+				return;
+			}
+
+			mtp::ObjectId objectId = ToObjectId(ino);
+			const mtp::u8 *data;
+			size_t n = _readahead.Read(ino, begin, rsize, attr.st_size,
+				[this, objectId](mtp::u64 offset, size_t size, mtp::ByteArray &buffer)
+				{ _session->GetPartialObject(objectId, offset, size, buffer); },
+				data);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "read ", n, " bytes of data");
+			//reply is written with writev straight from readahead buffer, libfuse copies memory buffers into pipe before splicing, so fuse_reply_data would not save a copy
+			FUSE_CALL(fuse_reply_buf(req, static_cast<const char *>(static_cast<const void *>(data)), n));
+		}
+
+		void Write(fuse_req_t req, FuseId inode, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+		{
+			if (RejectWrite(req))
+				return;
+			mtp::scoped_mutex_lock l(_mutex);
+			if (RejectLostWrites(req, inode))
+				return;
+
+			auto pending = _pendingUploads.find(inode);
+			if (pending != _pendingUploads.end())
+			{
+				PendingUpload &upload = pending->second;
+				if (static_cast<mtp::u64>(off) == upload.Data.size() && upload.Data.size() + size <= MaxPendingUploadSize && _pendingUploadSize + size <= MaxPendingUploadsSize &&
+					_budget.Reserve(MemoryBudget::Uploads, size))
+				{
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					upload.Data.insert(upload.Data.end(), buf, buf + size);
+					upload.Attr.st_size = upload.Data.size();
+					_pendingUploadSize += size;
+					FUSE_CALL(fuse_reply_write(req, size));
+					return;
+				}
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "   non-sequential or too big write or memory budget is exhausted, falling back to editing object");
+				Upload(inode);
+			}
+
+			struct stat attr = GetObjectAttr(inode);
+			mtp::ObjectId objectId = ToObjectId(inode);
+			_readahead.Invalidate(inode);
+
+			auto it = _writeBuffers.find(inode);
+			if (it == _writeBuffers.end())
+				it = _writeBuffers.insert(std::make_pair(inode, WriteBackBuffer(attr.st_size))).first;
+
+			const mtp::u8 *data = reinterpret_cast<const mtp::u8 *>(buf);
+			if (!it->second.Append(off, data, size))
+			{
+				FlushWrites(inode);
+				it->second.Append(off, data, size);
+			}
+
+			off_t newSize = off + size;
+			if (newSize > attr.st_size)
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				mtp::ObjectStore::Object *object = _objects.Find(objectId);
+				if (object)
+					object->Size = newSize;
+			}
+
+			FUSE_CALL(fuse_reply_write(req, size));
+		}
+
+		void FlushWrites(FuseId inode)
+		{
+			auto it = _writeBuffers.find(inode);
+			if (it == _writeBuffers.end() || (it->second.Empty() && !it->second.TruncatePending()))
+				return;
+
+			WriteBackBuffer &buffer = it->second;
+			ObjectEditSessionPtr tr = GetTransaction(inode);
+			if (_metadataCache)
+				_metadataCache->InvalidateObject(ToObjectId(inode));
+			if (buffer.TruncatePending())
+			{
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "applying truncate to ", buffer.GetTruncateSize());
+				tr->Truncate(buffer.GetTruncateSize());
+				buffer.SetCommittedSize(buffer.GetTruncateSize());
+				buffer.ClearTruncate();
+				ExpireStorageSpace();
+				if (buffer.Empty())
+					return;
+			}
+			if (buffer.GetEnd() > buffer.GetCommittedSize())
+			{
+				MTP_DEBUG_CATEGORY(mtp::LogFuse, "truncating file to ", buffer.GetEnd());
+				tr->Truncate(buffer.GetEnd());
+				buffer.SetCommittedSize(buffer.GetEnd());
+			}
+
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "flushing ", buffer.GetData().size(), " bytes at ", buffer.GetOffset());
+			tr->Send(buffer.GetOffset(), buffer.GetData());
+			buffer.Clear();
+			ExpireStorageSpace();
+		}
+
+		void Flush(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		{
+			if (IsVirtual(ino))
+			{
+				FUSE_CALL(fuse_reply_err(req, 0));
+				return;
+			}
+			mtp::scoped_mutex_lock l(_mutex);
+			if (RejectLostWrites(req, ino))
+				return;
+			Upload(ino);
+			FlushWrites(ino);
+			FUSE_CALL(fuse_reply_err(req, 0));
+		}
+
+		void FSync(fuse_req_t req, FuseId ino, int datasync, struct fuse_file_info *fi)
+		{
+			if (IsVirtual(ino))
+			{
+				FUSE_CALL(fuse_reply_err(req, 0));
+				return;
+			}
+			mtp::scoped_mutex_lock l(_mutex);
+			if (RejectLostWrites(req, ino))
+				return;
+			Upload(ino);
+			FlushWrites(ino);
+			ReleaseTransaction(ino);
+			FUSE_CALL(fuse_reply_err(req, 0));
+		}
+
+		void Create(fuse_req_t req, FuseId parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+		{ if (RejectWrite(req) || RejectVirtual(req, parent)) return; mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Undefined, req, parent, name, mode, fi); }
+
+		void MakeNode(fuse_req_t req, FuseId parent, const char *name, mode_t mode, dev_t rdev)
+		{ if (RejectWrite(req) || RejectVirtual(req, parent)) return; mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Undefined, req, parent, name, mode); }
+
+		void MakeDir(fuse_req_t req, FuseId parent, const char *name, mode_t mode)
+		{ if (RejectWrite(req) || RejectVirtual(req, parent)) return; mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Association, req, parent, name, mode); }
+
+		void Open(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
 		{
+			if (IsStatsFile(ino))
+			{
+				OpenStats(req, ino, fi);
+				return;
+			}
+			if (IsThumbnail(ino))
+			{
+				OpenThumbnail(req, ino, fi);
+				return;
+			}
+			if ((fi->flags & O_ACCMODE) != O_RDONLY && RejectWrite(req))
+				return;
 			mtp::scoped_mutex_lock l(_mutex);
-			FuseEntry entry(req);
+			ProcessEvents();
+			bool directory;
+			struct stat cachedAttr;
+			if (GetCachedObjectAttr(ino, cachedAttr))
+			{
+				//mode is known from listing, indexers open thousands of files
+				_stats.Hit(FuseStats::AttrsCache);
+				directory = S_ISDIR(cachedAttr.st_mode);
+			}
+			else
+			{
+				_stats.Miss(FuseStats::AttrsCache);
+				try
+				{
+					mtp::ObjectFormat format = static_cast<mtp::ObjectFormat>(_session->GetObjectIntegerProperty(ToObjectId(ino), mtp::ObjectProperty::ObjectFormat));
+					directory = format == mtp::ObjectFormat::Association;
+				}
+				catch(const std::exception &ex)
+				{ FUSE_CALL(fuse_reply_err(req, ENOENT)); return; }
+			}
 
-			const ChildrenObjects & children = GetChildren(parent);
-			auto it = children.find(name);
-			if (it != children.end())
+			if (directory)
+			{
+				FUSE_CALL(fuse_reply_err(req, EISDIR));
+				return;
+			}
+
+			if (_sequentialSize && (fi->flags & O_ACCMODE) == O_RDONLY)
+			{
+				try
+				{ TrackSequentialOpen(ino); }
+				catch(const std::exception &ex)
+				{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "tracking sequential access failed: ", ex.what()); }
+			}
+
+			if (_directIoSize && (fi->flags & O_ACCMODE) == O_RDONLY && static_cast<mtp::u64>(GetObjectAttr(ino).st_size) >= _directIoSize)
+			{
+				//streamed media is not read twice, kernel passes reads of application as is and readahead cache grows device requests
+				fi->direct_io = 1;
+				FUSE_CALL(fuse_reply_open(req, fi));
+				return;
+			}
+
+			if (_prefetchSize && (fi->flags & O_ACCMODE) == O_RDONLY)
 			{
-				if (FillEntry(entry, it->second))
+				struct stat attr = GetObjectAttr(ino);
+				if (attr.st_size > 0 && static_cast<size_t>(attr.st_size) <= _prefetchSize && _readahead.GetCachedSize(ino) < static_cast<mtp::u64>(attr.st_size))
 				{
-					entry.Reply();
-					return;
+					mtp::ObjectId objectId = ToObjectId(ino);
+					try
+					{
+						bool prefetched = _readahead.Prefetch(ino, attr.st_size,
+							[this, objectId](mtp::u64 offset, size_t size, mtp::ByteArray &buffer)
+							{
+								auto stream = std::make_shared<mtp::ByteArrayObjectOutputStream>();
+								_session->GetObject(objectId, stream);
+								buffer = stream->ReleaseData();
+							});
+						MTP_DEBUG_CATEGORY(mtp::LogFuse, "prefetching ", attr.st_size, " bytes: ", prefetched? "ok": "no memory");
+					}
+					catch(const std::exception &ex)
+					{
+						mtp::error("prefetching object failed: ", ex.what());
+						_readahead.Invalidate(ino);
+					}
 				}
 			}
-			entry.ReplyError(ENOENT);
+			if (_snapshot)
+				fi->keep_cache = 1; //content could not change, keep pages of previous opens
+			FUSE_CALL(fuse_reply_open(req, fi));
 		}
 
-		void ReadDir(fuse_req_t req, FuseId ino, size_t size, off_t off, struct fuse_file_info *fi)
+		void ReleaseTransaction(FuseId ino)
+		{
+			auto i = _openedFiles.find(ino);
+			if (i != _openedFiles.end())
+				_openedFiles.erase(i);
+		}
+
+		void Release(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
 		{
+			if (IsStatsFile(ino) || IsThumbnail(ino))
+			{
+				ReleaseStats(req, fi);
+				return;
+			}
 			mtp::scoped_mutex_lock l(_mutex);
-			if (!(GetObjectAttr(ino).st_mode & S_IFDIR))
+			if (_lostWrites.erase(ino))
 			{
-				FUSE_CALL(fuse_reply_err(req, ENOTDIR));
+				_readahead.Invalidate(ino);
+				FUSE_CALL(fuse_reply_err(req, EIO));
 				return;
 			}
+			time_t mtime = 0;
+			bool modified = _pendingUploads.find(ino) != _pendingUploads.end() || _writeBuffers.find(ino) != _writeBuffers.end() || _openedFiles.find(ino) != _openedFiles.end();
+			try
+			{
+				Upload(ino);
+				FlushWrites(ino);
+				auto it = _writeBuffers.find(ino);
+				if (it != _writeBuffers.end())
+					mtime = it->second.GetModificationTime();
+			}
+			catch(const std::exception &ex)
+			{
+				_writeBuffers.erase(ino);
+				ReleaseTransaction(ino);
+				_readahead.Invalidate(ino);
+				if (modified)
+					DropThumbnail(ResolveObjectId(ino));
+				throw;
+			}
+			_writeBuffers.erase(ino);
+			ReleaseTransaction(ino); //ending edit updates modification time, so deferred one is sent after it
+			_readahead.Invalidate(ino);
+			if (modified)
+				DropThumbnail(ResolveObjectId(ino)); //device regenerates it from new content
+			if (mtime)
+				SetModificationTime(ino, mtime);
+			FUSE_CALL(fuse_reply_err(req, 0));
+		}
 
-			FuseDirectory dir(req);
-			auto it = _directoryCache.find(ino);
-			if (it == _directoryCache.end())
+		void Rename(fuse_req_t req, FuseId parent, const char *name, FuseId newparent, const char *newname)
+		{
+			if (RejectWrite(req) || RejectVirtual(req, parent) || RejectVirtual(req, newparent))
+				return;
+			mtp::scoped_mutex_lock l(_mutex);
+			if (parent == FuseId::Root || newparent == FuseId::Root)
 			{
-				const ChildrenObjects & cache = GetChildren(ino);
+				FUSE_CALL(fuse_reply_err(req, EPERM)); //storages could not be renamed
+				return;
+			}
+			if (parent != newparent && !_moveObjectSupported)
+			{
+				FUSE_CALL(fuse_reply_err(req, EXDEV)); //return cross-device link, so user space should re-create file and copy it
+				return;
+			}
 
-				it = _directoryCache.insert(std::make_pair(ino, CharArray())).first;
-				CharArray &data = it->second;
+			ChildrenObjects &children = GetChildren(parent);
+			auto i = children.find(name);
+			if (i == children.end())
+			{
+				FUSE_CALL(fuse_reply_err(req, ENOENT));
+				return;
+			}
+			FuseId inode = i->second;
+			mtp::ObjectId id = ToObjectId(inode); //uploads pending file
 
-				dir.Add(data, ".", GetObjectAttr(FuseId::Root));
-				dir.Add(data, "..", GetObjectAttr(GetParentObject(ino)));
-				for(auto entry : cache)
+			ChildrenObjects &newChildren = GetChildren(newparent);
+			auto target = newChildren.find(newname);
+			if (target != newChildren.end())
+			{
+				if (target->second == inode)
 				{
-					dir.Add(data, entry.first, GetObjectAttr(entry.second));
+					FUSE_CALL(fuse_reply_err(req, 0));
+					return;
 				}
+				if ((GetObjectAttr(target->second).st_mode & S_IFDIR) && !GetChildren(target->second).empty())
+				{
+					FUSE_CALL(fuse_reply_err(req, ENOTEMPTY));
+					return;
+				}
+				RemoveObject(newparent, newChildren, target); //rename replaces existing target
 			}
 
-			dir.Reply(req, it->second, off, size);
+			struct stat attr = GetObjectAttr(inode);
+			mtp::ObjectId parentId;
+			mtp::StorageId storageId;
+			if (parent != newparent)
+			{
+				GetParentInfo(newparent, parentId, storageId);
+				mtp::StorageId oldStorageId = GetCachedStorage(id);
+				if (S_ISDIR(attr.st_mode) && oldStorageId != storageId)
+					UploadSubtree(inode); //files not created yet would be parented to stale storage
+				_session->MoveObject(id, storageId, parentId);
+				if (S_ISDIR(attr.st_mode) && oldStorageId != storageId && _files.find(inode) != _files.end())
+					ForgetSubtree(inode); //descendants recorded old storage
+			}
+			if (std::string(name) != newname)
+				_session->SetObjectProperty(id, mtp::ObjectProperty::ObjectFilename, std::string(newname));
+			DropThumbnail(id); //format and thumbnail may follow new extension
+
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				if (parent != newparent)
+					StoreAttr(id, parentId, attr, storageId); //parent and storage are answered from cache
+				RemoveDirectoryEntry(parent, name);
+				children.erase(name);
+				newChildren.emplace(newname, inode);
+				AddDirectoryEntry(newparent, newname, attr);
+				auto missing = _missingEntries.find(newparent);
+				if (missing != _missingEntries.end())
+					missing->second.erase(newname);
+			}
+			if (_metadataCache)
+			{
+				_metadataCache->Invalidate(GetCacheKey(parent));
+				_metadataCache->Invalidate(GetCacheKey(newparent));
+			}
+			FUSE_CALL(fuse_reply_err(req, 0));
 		}
 
-		void GetAttr(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+#ifdef FUSE_SET_ATTR_MTIME_NOW
+		static const int SetModificationTimeMask = FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW;
+#else
+		static const int SetModificationTimeMask = FUSE_SET_ATTR_MTIME;
+#endif
+
+		static time_t GetModificationTime(const struct stat *attr, int to_set)
+		{ return (to_set & FUSE_SET_ATTR_MTIME)? attr->st_mtime: time(NULL); }
+
+		///many devices do not allow changing DateModified, failure is not reported to application
+		void SetModificationTime(FuseId inode, time_t mtime)
+		{
+			mtp::ObjectId id = ToObjectId(inode);
+			if (_metadataCache)
+				_metadataCache->InvalidateObject(id);
+			try
+			{ _session->SetObjectProperty(id, mtp::ObjectProperty::DateModified, mtp::ConvertDateTime(mtime)); }
+			catch(const std::exception &ex)
+			{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "setting modification time failed: ", ex.what()); }
+		}
+
+		void SetAttr(fuse_req_t req, FuseId inode, struct stat *attr, int to_set, struct fuse_file_info *fi)
 		{
+			if (IsVirtual(inode))
+			{
+				FUSE_CALL(fuse_reply_err(req, EACCES));
+				return;
+			}
+			if (RejectWrite(req))
+				return;
 			mtp::scoped_mutex_lock l(_mutex);
 			FuseEntry entry(req);
-			if (FillEntry(entry, ino))
+
+			auto pending = _pendingUploads.find(inode);
+			if (pending != _pendingUploads.end())
+			{
+				PendingUpload &upload = pending->second;
+				if (!(to_set & FUSE_SET_ATTR_SIZE) || static_cast<mtp::u64>(attr->st_size) <= upload.Data.size())
+				{
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					if (to_set & FUSE_SET_ATTR_SIZE)
+					{
+						_pendingUploadSize -= upload.Data.size() - attr->st_size;
+						_budget.Release(MemoryBudget::Uploads, upload.Data.size() - attr->st_size);
+						upload.Data.resize(attr->st_size);
+						upload.Attr.st_size = attr->st_size;
+					}
+					if (to_set & SetModificationTimeMask)
+						upload.Attr.st_mtime = GetModificationTime(attr, to_set); //sent with SendObjectInfo
+					entry.SetId(inode);
+					entry.attr = upload.Attr;
+					entry.ReplyAttr();
+					return;
+				}
+				Upload(inode);
+			}
+
+			if (FillEntry(entry, inode))
+			{
+				bool directory = S_ISDIR(entry.attr.st_mode);
+				//changes to opened files are applied once at release, so ftruncate + futimens cost one truncate and one property update
+				auto it = _writeBuffers.find(inode);
+				if (it == _writeBuffers.end() && fi && !directory && (to_set & (FUSE_SET_ATTR_SIZE | SetModificationTimeMask)))
+					it = _writeBuffers.insert(std::make_pair(inode, WriteBackBuffer(entry.attr.st_size))).first;
+				bool deferred = it != _writeBuffers.end();
+
+				if (to_set & FUSE_SET_ATTR_SIZE)
+				{
+					off_t newSize = attr->st_size;
+					FlushWrites(inode);
+					_readahead.Invalidate(inode);
+					DropThumbnail(ToObjectId(inode));
+					if (_metadataCache)
+						_metadataCache->InvalidateObject(ToObjectId(inode));
+					if (deferred)
+						it->second.Truncate(newSize);
+					else
+					{
+						GetTransaction(inode)->Truncate(newSize);
+						ReleaseTransaction(inode);
+						ExpireStorageSpace();
+					}
+					entry.attr.st_size = newSize;
+				}
+				if (!directory && (to_set & SetModificationTimeMask))
+				{
+					time_t mtime = GetModificationTime(attr, to_set);
+					if (deferred)
+						it->second.SetModificationTime(mtime);
+					else
+						SetModificationTime(inode, mtime);
+					entry.attr.st_mtime = mtime;
+				}
+
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				mtp::ObjectStore::Object *object = _objects.Find(ToObjectId(inode));
+				if (object)
+				{
+					object->Size = entry.attr.st_size;
+					object->ModificationTime = entry.attr.st_mtime;
+				}
 				entry.ReplyAttr();
+			}
 			else
 				entry.ReplyError(ENOENT);
 		}
 
-		mtp::Session::ObjectEditSessionPtr GetTransaction(FuseId inode)
+		void RemoveDir (fuse_req_t req, FuseId parent, const char *name)
+		{ Unlink(req, parent, name); }
+
+		///called from event listener thread, must not touch device or wait for i/o mutex
+		void QueueEvent(const mtp::Event &event)
 		{
-			mtp::Session::ObjectEditSessionPtr tr;
+			switch(event.Code)
+			{
+			case mtp::EventCode::ObjectAdded:
+			case mtp::EventCode::ObjectRemoved:
+			case mtp::EventCode::ObjectInfoChanged:
+			case mtp::EventCode::ObjectPropChanged:
+			case mtp::EventCode::StoreAdded:
+			case mtp::EventCode::StoreRemoved:
+			case mtp::EventCode::StorageInfoChanged:
+				break;
+			default:
+				return;
+			}
+			if (_snapshot)
+				return; //kernel keeps snapshot entries forever, applying changes would only make them disagree
+			{
+				mtp::scoped_mutex_lock l(_eventMutex);
+				_pendingEvents.push_back(event);
+				_eventsPending = true;
+			}
+			if (_notifying)
+			{
+				mtp::scoped_mutex_lock nl(_notifyMutex); //worker could be between checking the flag and waiting
+				_notifyCondition.notify_one();
+			}
+		}
+
+		///queues kernel cache invalidation, it's sent from notification thread, as request handler could deadlock on kernel inode lock
+		void Invalidate(FuseId inode, const std::string &name = std::string())
+		{
+			if (!_notifying)
+				return;
+			mtp::scoped_mutex_lock nl(_notifyMutex);
+			_invalidations.emplace_back(inode, name);
+			_notifyCondition.notify_one();
+		}
+
+		void NotifyWorker()
+		{
+			while(true)
+			{
+				{
+					std::unique_lock<std::mutex> nl(_notifyMutex);
+					_notifyCondition.wait(nl, [this] { return _notifyStop || _eventsPending || !_invalidations.empty(); });
+					if (_notifyStop)
+						return;
+				}
+
+				if (_eventsPending)
+				{
+					//events are applied as they arrive instead of on next request, so kernel is told about them
+					try
+					{
+						mtp::scoped_mutex_lock l(_mutex);
+						if (_session)
+							ProcessEvents();
+						else
+						{
+							mtp::scoped_mutex_lock el(_eventMutex);
+							_pendingEvents.clear(); //caches are dropped on reconnect anyway
+							_eventsPending = false;
+						}
+					}
+					catch(const std::exception &ex)
+					{ mtp::error("processing events failed: ", ex.what()); }
+				}
+
+				std::vector<Invalidation> invalidations;
+				{
+					mtp::scoped_mutex_lock nl(_notifyMutex);
+					invalidations.swap(_invalidations);
+				}
+				for(auto &invalidation : invalidations)
+				{
+					fuse_ino_t inode = invalidation.Inode.Inode;
+					const std::string &name = invalidation.Name;
+					int r = name.empty()?
+						fuse_lowlevel_notify_inval_inode(_notifyHandle, inode, 0, 0):
+						fuse_lowlevel_notify_inval_entry(_notifyHandle, inode, name.c_str(), name.size());
+					if (r != 0 && r != -ENOENT) //entry which kernel has not cached
+						MTP_DEBUG_CATEGORY(mtp::LogFuse, "invalidating ", inode, " ", name, " failed: ", r);
+				}
+			}
+		}
+
+		///pushes entries of all storages before and after change, storage inodes follow their order
+		void InvalidateStorages(const std::map<std::string, mtp::StorageId> &previous)
+		{
+			for(auto &storage : previous)
+				Invalidate(FuseId::Root, storage.first);
+			for(auto &storage : _storageFromName)
+				if (previous.find(storage.first) == previous.end())
+					Invalidate(FuseId::Root, storage.first);
+			Invalidate(FuseId::Root);
+		}
+
+		///returns parent directory inode from cached listings, root if object is not cached, cache mutex must be held
+		FuseId FindCachedParent(FuseId inode, std::string *name = NULL) const
+		{
+			for(auto &dir : _files)
+			{
+				if (dir.first == FuseId::Root)
+					continue;
+				for(auto &child : dir.second)
+				{
+					if (child.second == inode)
+					{
+						if (name)
+							*name = child.first;
+						return dir.first;
+					}
+				}
+			}
+			return FuseId::Root;
+		}
+
+		///drops listing of single directory, it is enumerated again on next access, i/o mutex must be held
+		///files not created on device yet would vanish from the new listing, so they are uploaded first
+		void InvalidateDirectory(FuseId inode)
+		{
+			std::vector<FuseId> pending;
+			for(auto &upload : _pendingUploads)
+				if (upload.second.Parent == inode)
+					pending.push_back(upload.first);
+			for(auto &id : pending)
+			{
+				try
+				{ Upload(id); }
+				catch(const std::exception &ex)
+				{
+					mtp::error("uploading ", id.Inode, " before relisting its directory failed, keeping listing: ", ex.what());
+					return;
+				}
+			}
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				_files.erase(inode);
+				_directoryCache.erase(inode);
+				_missingEntries.erase(inode);
+			}
+			_partialListings.erase(inode);
+			if (_metadataCache && inode != FuseId::Root)
+				_metadataCache->Invalidate(GetCacheKey(inode));
+		}
+
+		///applies queued device events to caches, i/o mutex must be held and no references to cached listings kept
+		void ProcessEvents()
+		{
+			TrimCache();
+			if (!_eventsPending)
+				return;
+
+			std::vector<mtp::Event> events;
+			{
+				mtp::scoped_mutex_lock l(_eventMutex);
+				events.swap(_pendingEvents);
+				_eventsPending = false;
+			}
+
+			for(auto &event : events)
+			{
+				try
+				{ ProcessEvent(event); }
+				catch(const std::exception &ex)
+				{ mtp::error("processing event ", mtp::hex(static_cast<mtp::u16>(event.Code), 4), " failed: ", ex.what()); }
+			}
+		}
+
+		void ProcessEvent(const mtp::Event &event)
+		{
+			mtp::ObjectId id(event.GetParam(0));
+			FuseId inode = ToFuse(id);
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "device event ", mtp::hex(static_cast<mtp::u16>(event.Code), 4), " for ", id.Id);
+			switch(event.Code)
+			{
+			case mtp::EventCode::ObjectAdded:
+				{
+					mtp::ObjectId parent = _session->GetObjectParent(id);
+					FuseId parentInode = (parent == mtp::Session::Root || parent == mtp::Session::Device)?
+						FuseIdFromStorageId(_session->GetObjectStorage(id)): ToFuse(parent);
+					InvalidateDirectory(parentInode);
+					if (_notifying)
+					{
+						//kernel could have cached failed lookup of new name
+						Invalidate(parentInode, _session->GetObjectStringProperty(id, mtp::ObjectProperty::ObjectFilename));
+						Invalidate(parentInode);
+					}
+				}
+				break;
+
+			case mtp::EventCode::ObjectRemoved:
+				{
+					if (_files.find(inode) != _files.end())
+						ForgetSubtree(inode);
+					_writeBuffers.erase(inode);
+					_openedFiles.erase(inode);
+					_readahead.Invalidate(inode);
+					DropThumbnail(id);
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					std::string name;
+					FuseId parent = FindCachedParent(inode, &name);
+					if (parent != FuseId::Root)
+					{
+						RemoveDirectoryEntry(parent, name);
+						_files[parent].erase(name);
+						if (_metadataCache)
+							_metadataCache->Invalidate(GetCacheKey(parent));
+						Invalidate(parent, name);
+						Invalidate(parent);
+					}
+					_objects.Remove(id);
+					Invalidate(inode);
+				}
+				break;
+
+			case mtp::EventCode::ObjectInfoChanged:
+			case mtp::EventCode::ObjectPropChanged:
+				{
+					//name, size or date might be changed, listing is refreshed as a whole
+					FuseId parent(FuseId::Root);
+					std::string name;
+					{
+						mtp::scoped_mutex_lock cl(_cacheMutex);
+						parent = FindCachedParent(inode, &name);
+						_objects.Remove(id);
+					}
+					Invalidate(inode);
+					if (parent != FuseId::Root)
+					{
+						Invalidate(parent, name); //object might be renamed
+						Invalidate(parent);
+					}
+					_readahead.Invalidate(inode);
+					DropThumbnail(id);
+					if (_metadataCache)
+						_metadataCache->InvalidateObject(id);
+					if (parent != FuseId::Root)
+						InvalidateDirectory(parent);
+				}
+				break;
+
+			case mtp::EventCode::StorageInfoChanged:
+				{
+					auto previous = _storageFromName;
+					RefreshStorage(mtp::StorageId(event.GetParam(0)));
+					if (previous != _storageFromName)
+						InvalidateStorages(previous);
+				}
+				break;
+
+			default: //storage added or removed
+				{
+					auto previous = _storageFromName;
+					PopulateStorages();
+					InvalidateDirectory(FuseId::Root);
+					InvalidateStorages(previous);
+				}
+			}
+		}
+
+		///drops cached state of all known descendants of deleted directory in one pass, i/o mutex must be held
+		void ForgetSubtree(FuseId inode)
+		{
+			std::vector<FuseId> directories(1, inode);
+			std::vector<FuseId> files, pending;
 			{
-				auto it = _openedFiles.find(inode);
-				if (it != _openedFiles.end())
-					tr = it->second;
-				else
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				for(size_t d = 0; d < directories.size(); ++d)
 				{
-					tr = mtp::Session::EditObject(_session, FromFuse(inode));
-					_openedFiles[inode] = tr;
+					FuseId dir = directories[d];
+					auto i = _files.find(dir);
+					if (i != _files.end())
+					{
+						for(auto &child : i->second)
+						{
+							if (_pendingUploads.find(child.second) != _pendingUploads.end())
+							{
+								pending.push_back(child.second); //never reached device, nothing to upload it into
+								continue;
+							}
+							const mtp::ObjectStore::Object *object = _objects.Find(ResolveObjectId(child.second));
+							bool directory = object && object->Format == mtp::ObjectFormat::Association;
+							(directory? directories: files).push_back(child.second);
+						}
+						_files.erase(i);
+					}
+					_directoryCache.erase(dir);
+					_partialListings.erase(dir);
+					_missingEntries.erase(dir);
 				}
+				for(auto &id : directories)
+					_objects.Remove(ResolveObjectId(id));
+				for(auto &id : files)
+					_objects.Remove(ResolveObjectId(id));
+			}
+			for(auto &id : pending)
+				DiscardPendingUpload(id);
+
+			for(auto &id : files)
+			{
+				_writeBuffers.erase(id);
+				_openedFiles.erase(id);
+				_readahead.Invalidate(id);
+			}
+			if (_metadataCache)
+			{
+				for(auto &dir : directories)
+					_metadataCache->Invalidate(GetCacheKey(dir));
 			}
-			return NOT_NULL(tr);
 		}
 
-		void Read(fuse_req_t req, FuseId ino, size_t size, off_t begin, struct fuse_file_info *fi)
+		///sends pending uploads below directory, so they are not lost when its subtree is forgotten, i/o mutex must be held
+		void UploadSubtree(FuseId inode)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
-			ReleaseTransaction(ino);
-			struct stat attr = GetObjectAttr(ino);
-			off_t rsize = std::min<off_t>(attr.st_size - begin, size);
-			mtp::debug("reading ", rsize, " bytes");
-			mtp::ByteArray data;
-			if (rsize > 0)
-				data = _session->GetPartialObject(FromFuse(ino), begin, rsize);
-			mtp::debug("read", data.size(), "bytes of data");
-			FUSE_CALL(fuse_reply_buf(req, static_cast<char *>(static_cast<void *>(data.data())), data.size()));
+			std::vector<FuseId> pending;
+			{
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				std::vector<FuseId> directories(1, inode);
+				for(size_t d = 0; d < directories.size() && !_pendingUploads.empty(); ++d)
+				{
+					auto i = _files.find(directories[d]);
+					if (i == _files.end())
+						continue;
+					for(auto &child : i->second)
+					{
+						if (_pendingUploads.find(child.second) != _pendingUploads.end())
+							pending.push_back(child.second);
+						else if (_files.find(child.second) != _files.end())
+							directories.push_back(child.second);
+					}
+				}
+			}
+			for(auto &id : pending)
+				Upload(id);
 		}
 
-		void Write(fuse_req_t req, FuseId inode, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+		///deletes object and its cache entries, i/o mutex must be held
+		void RemoveObject(FuseId parent, ChildrenObjects &children, ChildrenObjects::iterator i)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
-
-			struct stat attr = GetObjectAttr(inode);
-			mtp::ObjectId objectId = FromFuse(inode);
-
-			ObjectEditSessionPtr tr = GetTransaction(inode);
+			FuseId inode = i->second;
+			std::string name = i->first;
+			MTP_DEBUG_CATEGORY(mtp::LogFuse, "   unlinking inode ", inode.Inode);
+			if (_pendingUploads.find(inode) != _pendingUploads.end())
+			{
+				DiscardPendingUpload(inode);
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				RemoveDirectoryEntry(parent, name);
+				children.erase(i);
+				return;
+			}
 
-			off_t newSize = off + size;
-			if (newSize > attr.st_size)
+			mtp::ObjectId id = ToObjectId(inode);
+			if (_files.find(inode) != _files.end())
+				ForgetSubtree(inode); //device deletes association content with it
+			_writeBuffers.erase(inode);
+			_openedFiles.erase(inode);
+			_readahead.Invalidate(inode);
+			DropThumbnail(id);
 			{
-				mtp::debug("truncating file to ", newSize);
-				tr->Truncate(newSize);
-				_objectAttrs[objectId].st_size = newSize;
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				RemoveDirectoryEntry(parent, name);
+				_aliases.erase(inode);
+				_objects.Remove(id);
+				children.erase(i);
 			}
 
-			tr->Send(off, mtp::ByteArray(buf, buf + size));
-			FUSE_CALL(fuse_reply_write(req, size));
+			_session->DeleteObject(id);
+			ExpireStorageSpace();
 		}
 
-		void Create(fuse_req_t req, FuseId parent, const char *name, mode_t mode, struct fuse_file_info *fi)
-		{ mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Undefined, req, parent, name, mode, fi); }
-
-		void MakeNode(fuse_req_t req, FuseId parent, const char *name, mode_t mode, dev_t rdev)
-		{ mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Undefined, req, parent, name, mode); }
-
-		void MakeDir(fuse_req_t req, FuseId parent, const char *name, mode_t mode)
-		{ mtp::scoped_mutex_lock l(_mutex); CreateObject(mtp::ObjectFormat::Association, req, parent, name, mode); }
-
-		void Open(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		void Unlink(fuse_req_t req, FuseId parent, const char *name)
 		{
+			if (RejectWrite(req) || RejectVirtual(req, parent))
+				return;
 			mtp::scoped_mutex_lock l(_mutex);
-			mtp::ObjectFormat format;
-
-			try
-			{
-				format = static_cast<mtp::ObjectFormat>(_session->GetObjectIntegerProperty(FromFuse(ino), mtp::ObjectProperty::ObjectFormat));
-			}
-			catch(const std::exception &ex)
-			{ FUSE_CALL(fuse_reply_err(req, ENOENT)); return; }
-
-			if (format == mtp::ObjectFormat::Association)
+			ChildrenObjects &children = GetChildren(parent);
+			auto i = children.find(name);
+			if (i == children.end())
 			{
-				FUSE_CALL(fuse_reply_err(req, EISDIR));
+				FUSE_CALL(fuse_reply_err(req, ENOENT));
 				return;
 			}
-			FUSE_CALL(fuse_reply_open(req, fi));
-		}
 
-		void ReleaseTransaction(FuseId ino)
-		{
-			auto i = _openedFiles.find(ino);
-			if (i != _openedFiles.end())
-				_openedFiles.erase(i);
+			RemoveObject(parent, children, i);
+			FUSE_CALL(fuse_reply_err(req, 0));
 		}
 
-		void Release(fuse_req_t req, FuseId ino, struct fuse_file_info *fi)
+		void Forget(FuseId inode, mtp::u64 nlookup)
 		{
 			mtp::scoped_mutex_lock l(_mutex);
-			ReleaseTransaction(ino);
-			FUSE_CALL(fuse_reply_err(req, 0));
+			mtp::scoped_mutex_lock cl(_cacheMutex);
+			ForgetLookups(inode, nlookup);
 		}
 
-		void Rename(fuse_req_t req, FuseId parent, const char *name, FuseId newparent, const char *newname)
+		void ForgetMulti(size_t count, const struct fuse_forget_data *forgets)
 		{
-			fuse_reply_err(req, EXDEV); //return cross-device link, so user space should re-create file and copy it
+			mtp::scoped_mutex_lock l(_mutex);
+			mtp::scoped_mutex_lock cl(_cacheMutex);
+			for(size_t i = 0; i < count; ++i)
+				ForgetLookups(FuseId(forgets[i].ino), forgets[i].nlookup);
 		}
 
-		void SetAttr(fuse_req_t req, FuseId inode, struct stat *attr, int to_set, struct fuse_file_info *fi)
+		void StatFS(fuse_req_t req, FuseId ino)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
-			FuseEntry entry(req);
-			if (FillEntry(entry, inode))
+			struct statvfs stat = { };
+			stat.f_namemax = 254;
+
+			mtp::u64 freeSpace = 0, capacity = 0;
+			bool cached;
 			{
-				if (to_set & FUSE_SET_ATTR_SIZE)
+				//file managers and df call statfs constantly, fresh answer is served without waiting for i/o
+				mtp::scoped_mutex_lock cl(_cacheMutex);
+				std::vector<FuseId> storages = GetCachedStorages(ino);
+				cached = !_eventsPending && (!storages.empty() || ino == FuseId::Root) && GetCachedStorageSpace(storages, freeSpace, capacity);
+			}
+			if (cached)
+				_stats.Hit(FuseStats::StorageCache);
+			else
+			{
+				_stats.Miss(FuseStats::StorageCache);
+				mtp::scoped_mutex_lock l(_mutex);
+				ProcessEvents();
+
+				std::vector<FuseId> storages;
 				{
-					off_t newSize = attr->st_size;
-					ObjectEditSessionPtr tr = GetTransaction(inode);
-					tr->Truncate(newSize);
-					entry.attr.st_size = newSize;
-					_objectAttrs[FromFuse(inode)].st_size = newSize;
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					storages = GetCachedStorages(ino);
+				}
+				if (storages.empty() && ino != FuseId::Root)
+					storages.push_back(IsStorage(ino)? ino: FuseIdFromStorageId(_session->GetObjectStorage(ToObjectId(ino))));
+
+				freeSpace = capacity = 0;
+				auto now = std::chrono::steady_clock::now();
+				for(auto inode : storages)
+				{
+					mtp::scoped_mutex_lock cl(_cacheMutex);
+					auto i = _storageSpace.find(inode);
+					if (i == _storageSpace.end() || i->second.Expires <= now)
+					{
+						mtp::StorageId storageId = FuseIdToStorageId(inode);
+						cl.unlock();
+						mtp::msg::StorageInfo si = _session->GetStorageInfo(storageId);
+						cl.lock();
+						CacheStorageSpace(inode, storageId, si);
+						i = _storageSpace.find(inode);
+					}
+					freeSpace += i->second.FreeSpace;
+					capacity += i->second.Capacity;
 				}
-				entry.ReplyAttr();
 			}
-			else
-				entry.ReplyError(ENOENT);
+
+			stat.f_frsize = stat.f_bsize = 1024 * 1024;
+			stat.f_blocks = capacity / stat.f_frsize;
+			stat.f_bfree = stat.f_bavail = freeSpace / stat.f_frsize;
+
+			FUSE_CALL(fuse_reply_statfs(req, &stat));
 		}
 
-		void RemoveDir (fuse_req_t req, FuseId parent, const char *name)
-		{ Unlink(req, parent, name); }
+#ifdef ENOATTR
+		static const int NoAttribute = ENOATTR;
+#else
+		static const int NoAttribute = ENODATA;
+#endif
 
-		void Unlink(fuse_req_t req, FuseId parent, const char *name)
+		static const char * GetPrefetchStateName(const PrefetchHint &hint)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
-			ChildrenObjects &children = GetChildren(parent);
-			auto i = children.find(name);
-			if (i == children.end())
+			switch(hint.State)
 			{
-				FUSE_CALL(fuse_reply_err(req, ENOENT));
+			case PrefetchHint::Status::Queued:		return "queued";
+			case PrefetchHint::Status::Running:		return "running";
+			case PrefetchHint::Status::Done:		return "done";
+			case PrefetchHint::Status::Cancelled:	return "cancelled";
+			}
+			return "unknown";
+		}
+
+		///"metadata" schedules background listing of directory subtree, "content" also reads its files into readahead cache
+		void SetXAttr(fuse_req_t req, FuseId inode, const char *name, const char *value, size_t size, int flags)
+		{
+			if (strcmp(name, PrefetchAttribute) != 0)
+			{
+				FUSE_CALL(fuse_reply_err(req, ENOTSUP));
 				return;
 			}
+			if (RejectVirtual(req, inode))
+				return;
 
-			FuseId inode = i->second;
-			mtp::debug("   unlinking inode ", inode.Inode);
-			mtp::ObjectId id = FromFuse(inode);
-			_directoryCache.erase(parent);
-			_openedFiles.erase(inode);
-			_objectAttrs.erase(id);
-			children.erase(i);
+			std::string mode(value, size);
+			while(!mode.empty() && (mode.back() == '\n' || mode.back() == '\0'))
+				mode.pop_back();
+			bool content;
+			if (mode == "metadata")
+				content = false;
+			else if (mode == "content")
+				content = true;
+			else
+			{
+				FUSE_CALL(fuse_reply_err(req, EINVAL));
+				return;
+			}
 
-			_session->DeleteObject(id);
+			{
+				mtp::scoped_mutex_lock l(_mutex);
+				if (!S_ISDIR(GetObjectAttr(inode).st_mode))
+				{
+					FUSE_CALL(fuse_reply_err(req, ENOTDIR));
+					return;
+				}
+			}
+
+			{
+				mtp::scoped_mutex_lock pl(_prefetchMutex);
+				bool exists = _prefetchHints.find(inode) != _prefetchHints.end();
+				int error = (flags & XATTR_CREATE) && exists? EEXIST: (flags & XATTR_REPLACE) && !exists? NoAttribute: 0;
+				if (error)
+				{
+					FUSE_CALL(fuse_reply_err(req, error));
+					return;
+				}
+			}
+			SchedulePrefetch(inode, content);
 			FUSE_CALL(fuse_reply_err(req, 0));
 		}
 
-		void StatFS(fuse_req_t req, FuseId ino)
+		///reports cache state: listing and prefetch progress of directories, cached bytes of files
+		void GetXAttr(fuse_req_t req, FuseId inode, const char *name, size_t size)
 		{
-			mtp::scoped_mutex_lock l(_mutex);
-			struct statvfs stat = { };
-			stat.f_namemax = 254;
+			if (strcmp(name, PrefetchAttribute) != 0)
+			{
+				FUSE_CALL(fuse_reply_err(req, NoAttribute));
+				return;
+			}
 
-			mtp::u64 freeSpace = 0, capacity = 0;
-			if (ino == FuseId::Root)
+			std::stringstream ss;
 			{
-				for(auto storageId : _storageIdList)
+				mtp::scoped_mutex_lock l(_mutex);
+				struct stat attr = GetObjectAttr(inode);
+				if (S_ISDIR(attr.st_mode))
 				{
-					mtp::msg::StorageInfo si = _session->GetStorageInfo(storageId);
-					freeSpace += si.FreeSpaceInBytes;
-					capacity += si.MaxCapacity;
+					bool listed;
+					{
+						mtp::scoped_mutex_lock cl(_cacheMutex);
+						listed = _files.find(inode) != _files.end();
+					}
+					mtp::scoped_mutex_lock pl(_prefetchMutex);
+					auto i = _prefetchHints.find(inode);
+					ss << "listed=" << (listed? 1: 0);
+					if (i != _prefetchHints.end())
+					{
+						const PrefetchHint &hint = i->second;
+						ss << " mode=" << (hint.Content? "content": "metadata") << " state=" << GetPrefetchStateName(hint) <<
+							" directories=" << hint.Directories << " files=" << hint.Files << " bytes=" << hint.Bytes <<
+							" errors=" << hint.Errors << " full=" << (hint.Full? 1: 0);
+					}
+					else
+						ss << " mode=none";
 				}
+				else
+					ss << "size=" << attr.st_size << " cached=" << _readahead.GetCachedSize(inode);
 			}
+			ss << "\n";
+
+			std::string value = ss.str();
+			if (size == 0)
+				FUSE_CALL(fuse_reply_xattr(req, value.size()));
+			else if (size < value.size())
+				FUSE_CALL(fuse_reply_err(req, ERANGE));
 			else
-			{
-				mtp::StorageId storageId;
-				if (IsStorage(ino))
-					storageId = FuseIdToStorageId(ino);
-				else
-					storageId = _session->GetObjectStorage(FromFuse(ino));
+				FUSE_CALL(fuse_reply_buf(req, value.data(), value.size()));
+		}
 
-				mtp::msg::StorageInfo si = _session->GetStorageInfo(storageId);
-				freeSpace = si.FreeSpaceInBytes;
-				capacity = si.MaxCapacity;
+		///cancels prefetch of directory subtree, data prefetched already stays cached
+		void RemoveXAttr(fuse_req_t req, FuseId inode, const char *name)
+		{
+			if (strcmp(name, PrefetchAttribute) != 0)
+			{
+				FUSE_CALL(fuse_reply_err(req, NoAttribute));
+				return;
 			}
 
-			stat.f_frsize = stat.f_bsize = 1024 * 1024;
-			stat.f_blocks = capacity / stat.f_frsize;
-			stat.f_bfree = stat.f_bavail = freeSpace / stat.f_frsize;
-
-			FUSE_CALL(fuse_reply_statfs(req, &stat));
+			int error = 0;
+			{
+				mtp::scoped_mutex_lock pl(_prefetchMutex);
+				auto i = _prefetchHints.find(inode);
+				if (i != _prefetchHints.end())
+					_prefetchHints.erase(i); //running crawl stops before its next step, stale queue entry is skipped
+				else
+					error = NoAttribute;
+			}
+			FUSE_CALL(fuse_reply_err(req, error));
 		}
 	};
 
 	std::unique_ptr<FuseWrapper>	g_wrapper;
 
-#define WRAP_EX(...) do { \
+#define WRAP_EX(OPERATION, ...) do { \
+		FuseStats::Scope scope(g_wrapper->GetStats(), FuseStats::OPERATION); \
+		FuseWrapper::Foreground foreground(*g_wrapper); \
 		try { return __VA_ARGS__ ; } \
 		catch (const mtp::usb::DeviceNotFoundException &) \
 		{ \
@@ -689,14 +4020,13 @@ namespace
 			__VA_ARGS__ ; \
 		} \
 		catch (const std::exception &ex) \
-		{ mtp::error(#__VA_ARGS__ " failed: ", ex.what()); fuse_reply_err(req, EIO); } \
+		{ scope.Fail(); mtp::error(#__VA_ARGS__ " failed: ", ex.what()); fuse_reply_err(req, EIO); } \
 	} while(false)
 
 	void Init (void *userdata, struct fuse_conn_info *conn)
 	{
-		mtp::debug("Init: fuse proto version: ", conn->proto_major, ".", conn->proto_minor,
+		MTP_DEBUG_CATEGORY(mtp::LogFuse, "Init: fuse proto version: ", conn->proto_major, ".", conn->proto_minor,
 			", capability: 0x", mtp::hex(conn->capable, 8),
-			", async read: ", conn->async_read,
 			//", congestion_threshold: ", conn->congestion_threshold,
 			//", max bg: ", conn->max_background,
 			", max readahead: ", conn->max_readahead, ", max write: ", conn->max_write
@@ -705,62 +4035,326 @@ namespace
 		//If synchronous reads are chosen, Fuse will wait for reads to complete before issuing any other requests.
 		//mtp is completely synchronous. you cannot have two transaction in parallel, so you have to wait any operation to finish before starting another one
 
+#if FUSE_USE_VERSION < 30
 		conn->async_read = 0;
+#endif
 		conn->want &= ~FUSE_CAP_ASYNC_READ;
 		try { g_wrapper->Init(userdata, conn); } catch (const std::exception &ex) { mtp::error("init failed:", ex.what()); }
 	}
 
 	void Lookup (fuse_req_t req, fuse_ino_t parent, const char *name)
-	{ mtp::debug("   Lookup ", parent, " ", name); WRAP_EX(g_wrapper->Lookup(req, FuseId(parent), name)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Lookup ", parent, " ", name); WRAP_EX(Lookup, g_wrapper->Lookup(req, FuseId(parent), name)); }
 
 	void ReadDir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
-	{ mtp::debug("   Readdir ", ino, " ", size, " ", off); WRAP_EX(g_wrapper->ReadDir(req, FuseId(ino), size, off, fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Readdir ", ino, " ", size, " ", off); WRAP_EX(ReadDir, g_wrapper->ReadDir(req, FuseId(ino), size, off, fi)); }
+
+#if FUSE_USE_VERSION >= 30
+	void ReadDirPlus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   ReaddirPlus ", ino, " ", size, " ", off); WRAP_EX(ReadDirPlus, g_wrapper->ReadDirPlus(req, FuseId(ino), size, off, fi)); }
+
+	void OpenDir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   OpenDir ", ino); WRAP_EX(OpenDir, g_wrapper->OpenDir(req, FuseId(ino), fi)); }
+
+	void ReleaseDir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   ReleaseDir ", ino); WRAP_EX(ReleaseDir, g_wrapper->ReleaseDir(req, FuseId(ino), fi)); }
+#endif
 
 	void GetAttr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
-	{ mtp::debug("   GetAttr ", ino); WRAP_EX(g_wrapper->GetAttr(req, FuseId(ino), fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   GetAttr ", ino); WRAP_EX(GetAttr, g_wrapper->GetAttr(req, FuseId(ino), fi)); }
 
 	void SetAttr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
-	{ mtp::debug("   SetAttr ", ino, " 0x", mtp::hex(to_set, 8)); WRAP_EX(g_wrapper->SetAttr(req, FuseId(ino), attr, to_set, fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   SetAttr ", ino, " 0x", mtp::hex(to_set, 8)); WRAP_EX(SetAttr, g_wrapper->SetAttr(req, FuseId(ino), attr, to_set, fi)); }
 
 	void Read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
-	{ mtp::debug("   Read ", ino, " ", size, " ", off); WRAP_EX(g_wrapper->Read(req, FuseId(ino), size, off, fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Read ", ino, " ", size, " ", off); WRAP_EX(Read, g_wrapper->Read(req, FuseId(ino), size, off, fi)); }
 
 	void Write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
-	{ mtp::debug("   Write ", ino, " ", size, " ", off); WRAP_EX(g_wrapper->Write(req, FuseId(ino), buf, size, off, fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Write ", ino, " ", size, " ", off); WRAP_EX(Write, g_wrapper->Write(req, FuseId(ino), buf, size, off, fi)); }
 
 	void MakeNode(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
-	{ mtp::debug("   MakeNode ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(g_wrapper->MakeNode(req, FuseId(parent), name, mode, rdev)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   MakeNode ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(MakeNode, g_wrapper->MakeNode(req, FuseId(parent), name, mode, rdev)); }
 
 	void Create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
-	{ mtp::debug("   Create ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(g_wrapper->Create(req, FuseId(parent), name, mode, fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Create ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(Create, g_wrapper->Create(req, FuseId(parent), name, mode, fi)); }
 
 	void Open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
-	{ mtp::debug("   Open ", ino); WRAP_EX(g_wrapper->Open(req, FuseId(ino), fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Open ", ino); WRAP_EX(Open, g_wrapper->Open(req, FuseId(ino), fi)); }
 
+#if FUSE_USE_VERSION >= 30
+	void Rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname, unsigned int flags)
+	{
+		if (flags)
+		{
+			fuse_reply_err(req, EINVAL); //RENAME_EXCHANGE and RENAME_NOREPLACE could not be done atomically over mtp
+			return;
+		}
+#else
 	void Rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
-	{ mtp::debug("   Rename ", parent, " ", name, " -> ", newparent, " ", newname); WRAP_EX(g_wrapper->Rename(req, FuseId(parent), name, FuseId(newparent), newname)); }
+	{
+#endif
+		MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Rename ", parent, " ", name, " -> ", newparent, " ", newname); WRAP_EX(Rename, g_wrapper->Rename(req, FuseId(parent), name, FuseId(newparent), newname));
+	}
 
 	void Release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
-	{ mtp::debug("   Release ", ino); WRAP_EX(g_wrapper->Release(req, FuseId(ino), fi)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Release ", ino); WRAP_EX(Release, g_wrapper->Release(req, FuseId(ino), fi)); }
+
+	void Flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Flush ", ino); WRAP_EX(Flush, g_wrapper->Flush(req, FuseId(ino), fi)); }
+
+	void FSync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   FSync ", ino, " ", datasync); WRAP_EX(FSync, g_wrapper->FSync(req, FuseId(ino), datasync, fi)); }
 
 	void MakeDir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
-	{ mtp::debug("   MakeDir ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(g_wrapper->MakeDir(req, FuseId(parent), name, mode)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   MakeDir ", parent, " ", name, " 0x", mtp::hex(mode, 8)); WRAP_EX(MakeDir, g_wrapper->MakeDir(req, FuseId(parent), name, mode)); }
 
 	void RemoveDir (fuse_req_t req, fuse_ino_t parent, const char *name)
-	{ mtp::debug("   RemoveDir ", parent, " ", name); WRAP_EX(g_wrapper->RemoveDir(req, FuseId(parent), name)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   RemoveDir ", parent, " ", name); WRAP_EX(RemoveDir, g_wrapper->RemoveDir(req, FuseId(parent), name)); }
 
 	void Unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
-	{ mtp::debug("   Unlink ", parent, " ", name); WRAP_EX(g_wrapper->Unlink(req, FuseId(parent), name)); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Unlink ", parent, " ", name); WRAP_EX(Unlink, g_wrapper->Unlink(req, FuseId(parent), name)); }
+
+	void Forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+	{
+		MTP_DEBUG_CATEGORY(mtp::LogFuse, "   Forget ", ino, " ", nlookup);
+		try { g_wrapper->Forget(FuseId(ino), nlookup); }
+		catch (const std::exception &ex) { mtp::error("forget failed: ", ex.what()); }
+		fuse_reply_none(req); //forget has no reply, it only wakes up request
+	}
+
+#if FUSE_MAJOR_VERSION > 2 || (FUSE_MAJOR_VERSION == 2 && FUSE_MINOR_VERSION >= 9)
+	void ForgetMulti(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+	{
+		MTP_DEBUG_CATEGORY(mtp::LogFuse, "   ForgetMulti ", count);
+		try { g_wrapper->ForgetMulti(count, forgets); }
+		catch (const std::exception &ex) { mtp::error("forget failed: ", ex.what()); }
+		fuse_reply_none(req);
+	}
+#endif
 
 	void StatFS(fuse_req_t req, fuse_ino_t ino)
-	{ mtp::debug("   StatFS ", ino); WRAP_EX(g_wrapper->StatFS(req, FuseId(ino))); }
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   StatFS ", ino); WRAP_EX(StatFS, g_wrapper->StatFS(req, FuseId(ino))); }
+
+	void SetXAttr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   SetXAttr ", ino, " ", name); WRAP_EX(SetXAttr, g_wrapper->SetXAttr(req, FuseId(ino), name, value, size, flags)); }
+
+	void GetXAttr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   GetXAttr ", ino, " ", name, " ", size); WRAP_EX(GetXAttr, g_wrapper->GetXAttr(req, FuseId(ino), name, size)); }
+
+	void RemoveXAttr(fuse_req_t req, fuse_ino_t ino, const char *name)
+	{ MTP_DEBUG_CATEGORY(mtp::LogFuse, "   RemoveXAttr ", ino, " ", name); WRAP_EX(RemoveXAttr, g_wrapper->RemoveXAttr(req, FuseId(ino), name)); }
+}
+
+namespace
+{
+	size_t ParseSize(const char *str)
+	{
+		char *end;
+		size_t size = strtoul(str, &end, 10);
+		if (*end == 'k' || *end == 'K')
+			size *= 1024;
+		else if (*end == 'm' || *end == 'M')
+			size *= 1024 * 1024;
+		return size;
+	}
+
+	///removes snapshot and snapshot=full from comma separated mount options, fuse does not know them
+	std::string TakeSnapshotOption(const char *list, bool &snapshot, bool &preload)
+	{
+		std::stringstream ss(list);
+		std::string option, options;
+		while(std::getline(ss, option, ','))
+		{
+			if (option == "snapshot" || option == "snapshot=full")
+			{
+				snapshot = true;
+				preload = preload || option == "snapshot=full";
+				continue;
+			}
+			if (!options.empty())
+				options += ',';
+			options += option;
+		}
+		return options;
+	}
+
+	std::string GetMetadataCacheDir()
+	{
+		const char *home = getenv("HOME");
+		if (!home)
+			return std::string();
+
+		std::string path = std::string(home) + "/.cache";
+		mkdir(path.c_str(), 0700);
+		path += "/whoozle.github.io";
+		mkdir(path.c_str(), 0700);
+		path += "/aft-mtp-mount";
+		mkdir(path.c_str(), 0700);
+		return path;
+	}
 }
 
 int main(int argc, char **argv)
 {
 	bool claimInterface = true;
+	size_t transferSize = 0;
+	mtp::usb::ReaperPolicy reaper;
+	size_t readahead = ReadaheadCache::DefaultMaxWindow;
+	size_t prefetchSize = 0;
+	size_t directIoSize = 0;
+	size_t sequentialSize = 0;
+	size_t memoryBudget = 0;
+	std::string cacheDir;
+	double timeout = -1; //negative picks default, longer one if kernel is notified about device events
+	double readOnlyTimeout = FuseEntry::ReadOnlyTimeout;
+	double keepalive = 0;
+	bool stats = false;
+	bool writebackCache = true;
+	bool snapshot = false, preload = false;
+	bool crawl = false;
+	bool thumbnails = false;
+	std::vector<std::string> mountOptions; //rewritten -o lists, argv points to them
+	mountOptions.reserve(argc);
+	std::string deviceId;
+	std::vector<mtp::ObjectFormat> formats;
 	for(int i = 1; i < argc; ++i)
 	{
+		if (i + 1 < argc && strcmp(argv[i], "-F") == 0)
+		{
+			//comma separated extensions or hex format codes
+			std::stringstream ss(argv[i + 1]);
+			std::string format;
+			while(std::getline(ss, format, ','))
+			{
+				if (format.empty())
+					continue;
+				mtp::ObjectFormat objectFormat = mtp::ParseObjectFormat(format);
+				if (objectFormat == mtp::ObjectFormat::Undefined)
+				{
+					mtp::error("unknown format ", format);
+					return 1;
+				}
+				formats.push_back(objectFormat);
+			}
+			std::copy(argv + i + 2, argv + argc + 1, argv + i);
+			argc -= 2;
+			--i;
+			continue;
+		}
+		if (i + 1 < argc && strcmp(argv[i], "-D") == 0)
+		{
+			deviceId = argv[i + 1]; //serial number or usb bus path
+			std::copy(argv + i + 2, argv + argc + 1, argv + i);
+			argc -= 2;
+			--i;
+			continue;
+		}
+		if (i + 1 < argc && strcmp(argv[i], "-U") == 0)
+		{
+			//urbs are reaped by dedicated thread with [policy][:priority][@cpus] scheduling
+			try
+			{ reaper = mtp::usb::ReaperPolicy::Parse(argv[i + 1]); }
+			catch(const std::exception &ex)
+			{
+				mtp::error(ex.what());
+				return 1;
+			}
+			std::copy(argv + i + 2, argv + argc + 1, argv + i);
+			argc -= 2;
+			--i;
+			continue;
+		}
+		if (i + 1 < argc && (strcmp(argv[i], "-E") == 0 || strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "-K") == 0))
+		{
+			double value = strtod(argv[i + 1], NULL);
+			switch(argv[i][1])
+			{
+			case 'E':	timeout = value; break;
+			case 'K':	keepalive = value; break; //idle device is pinged after this many seconds without requests
+			default:	readOnlyTimeout = value;
+			}
+			std::copy(argv + i + 2, argv + argc + 1, argv + i);
+			argc -= 2;
+			--i;
+			continue;
+		}
+		if (i + 1 < argc && (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "-P") == 0 || strcmp(argv[i], "-I") == 0 || strcmp(argv[i], "-N") == 0 || strcmp(argv[i], "-M") == 0))
+		{
+			size_t size = ParseSize(argv[i + 1]);
+			switch(argv[i][1])
+			{
+			case 'T':	transferSize = size; break;
+			case 'R':	readahead = size; break;
+			case 'I':	directIoSize = size; break;
+			case 'N':	sequentialSize = size; break; //files after the one opened in name order are read ahead up to this size
+			case 'M':	memoryBudget = size; break; //caches, buffers and responses share it
+			default:	prefetchSize = size;
+			}
+			//fuse does not know these options, remove it with its argument
+			std::copy(argv + i + 2, argv + argc + 1, argv + i);
+			argc -= 2;
+			--i;
+			continue;
+		}
+		if (strcmp(argv[i], "-c") == 0)
+		{
+			cacheDir = GetMetadataCacheDir();
+			std::copy(argv + i + 1, argv + argc + 1, argv + i);
+			--argc;
+			--i;
+			continue;
+		}
+		if (strcmp(argv[i], "-S") == 0)
+		{
+			stats = true; //exports statistics as /.aft-stats and urb trace as /.aft-usb-trace
+			std::copy(argv + i + 1, argv + argc + 1, argv + i);
+			--argc;
+			--i;
+			continue;
+		}
+		if (strcmp(argv[i], "-B") == 0)
+		{
+			crawl = true; //listings are fetched breadth-first while mount is idle, progress is shown by user.aft.prefetch of root
+			std::copy(argv + i + 1, argv + argc + 1, argv + i);
+			--argc;
+			--i;
+			continue;
+		}
+		if (strcmp(argv[i], "-t") == 0)
+		{
+			thumbnails = true; //every directory gets virtual .thumbnails subdirectory with device thumbnails of its images and videos
+			std::copy(argv + i + 1, argv + argc + 1, argv + i);
+			--argc;
+			--i;
+			continue;
+		}
+		if (strcmp(argv[i], "-W") == 0)
+		{
+			writebackCache = false; //kernel writeback cache is only available with libfuse 3
+			std::copy(argv + i + 1, argv + argc + 1, argv + i);
+			--argc;
+			--i;
+			continue;
+		}
+		if (strncmp(argv[i], "-o", 2) == 0 && (argv[i][2] != 0 || i + 1 < argc))
+		{
+			int value = argv[i][2] != 0? i: i + 1;
+			bool found = false;
+			std::string options = TakeSnapshotOption(value == i? argv[i] + 2: argv[value], found, preload);
+			if (found)
+			{
+				snapshot = true;
+				if (options.empty())
+				{
+					int n = value - i + 1;
+					std::copy(argv + i + n, argv + argc + 1, argv + i);
+					argc -= n;
+					--i;
+					continue;
+				}
+				mountOptions.push_back(value == i? "-o" + options: options);
+				argv[value] = const_cast<char *>(mountOptions.back().c_str());
+			}
+		}
 		if (strcmp(argv[i], "-C") == 0)
 			claimInterface = false;
 		if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "-odebug") == 0)
@@ -768,9 +4362,15 @@ int main(int argc, char **argv)
 		if (i + 1 < argc && strcmp(argv[i], "-o") == 0 && strcmp(argv[i + 1], "debug") == 0)
 			mtp::g_debug = true;
 	}
+	if (mtp::g_debug)
+		mtp::SetAsyncDebugOutput(true); //every fuse operation is traced, keep stderr writes off its thread
 
 	try
-	{ g_wrapper.reset(new FuseWrapper(claimInterface)); }
+	{
+		g_wrapper.reset(new FuseWrapper(claimInterface, deviceId, transferSize, reaper, readahead, prefetchSize, directIoSize, sequentialSize, memoryBudget, cacheDir, timeout, readOnlyTimeout, keepalive, stats, writebackCache, snapshot, crawl, thumbnails, formats));
+		if (preload)
+			g_wrapper->PreloadTree();
+	}
 	catch(const std::exception &ex)
 	{ mtp::error("connect failed: ", ex.what()); return 1; }
 
@@ -778,7 +4378,16 @@ int main(int argc, char **argv)
 
 	ops.init		= &Init;
 	ops.lookup		= &Lookup;
+	ops.forget		= &Forget;
+#if FUSE_MAJOR_VERSION > 2 || (FUSE_MAJOR_VERSION == 2 && FUSE_MINOR_VERSION >= 9)
+	ops.forget_multi	= &ForgetMulti;
+#endif
 	ops.readdir		= &ReadDir;
+#if FUSE_USE_VERSION >= 30
+	ops.readdirplus	= &ReadDirPlus;
+	ops.opendir		= &OpenDir;
+	ops.releasedir	= &ReleaseDir;
+#endif
 	ops.getattr		= &GetAttr;
 	ops.setattr		= &SetAttr;
 	ops.mknod		= &MakeNode;
@@ -789,14 +4398,60 @@ int main(int argc, char **argv)
 	ops.mkdir		= &MakeDir;
 	ops.rename		= &Rename;
 	ops.release		= &Release;
+	ops.flush		= &Flush;
+	ops.fsync		= &FSync;
 	ops.rmdir		= &RemoveDir;
 	ops.unlink		= &Unlink;
 	ops.statfs		= &StatFS;
+	ops.setxattr	= &SetXAttr;
+	ops.getxattr	= &GetXAttr;
+	ops.removexattr	= &RemoveXAttr;
 
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (snapshot)
+		fuse_opt_add_arg(&args, "-oro"); //kernel rejects writes before they reach device
+	int err = -1;
+#if FUSE_USE_VERSION >= 30
+	struct fuse_cmdline_opts opts = { };
+	if (fuse_parse_cmdline(&args, &opts) == 0 && opts.mountpoint != NULL)
+	{
+		struct fuse_session *se = fuse_session_new(&args, &ops, sizeof(ops), NULL);
+		if (se != NULL)
+		{
+			if (fuse_set_signal_handlers(se) == 0)
+			{
+				if (fuse_session_mount(se, opts.mountpoint) == 0)
+				{
+					if (fuse_daemonize(opts.foreground) == -1)
+						perror("fuse_daemonize");
+					g_wrapper->StartNotifications(se); //after daemonizing, threads do not survive fork
+					g_wrapper->StartReaper();
+					g_wrapper->StartEvents();
+					g_wrapper->StartHotplugMonitor();
+					g_wrapper->StartPrefetch();
+					g_wrapper->StartKeepalive();
+					if (opts.singlethread)
+						err = fuse_session_loop(se);
+					else
+					{
+						//cached replies are served while another worker waits for device, -o max_idle_threads=N sets the pool
+						struct fuse_loop_config config = { };
+						config.clone_fd = opts.clone_fd;
+						config.max_idle_threads = opts.max_idle_threads;
+						err = fuse_session_loop_mt(se, &config);
+					}
+					g_wrapper->StopNotifications();
+					fuse_session_unmount(se);
+				}
+				fuse_remove_signal_handlers(se);
+			}
+			fuse_session_destroy(se);
+		}
+	}
+	free(opts.mountpoint);
+#else
 	struct fuse_chan *ch;
 	char *mountpoint;
-	int err = -1;
 	int multithreaded = 0, foreground = 0;
 
 	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1 &&
@@ -812,7 +4467,14 @@ int main(int argc, char **argv)
 				fuse_session_add_chan(se, ch);
 				if (fuse_daemonize(foreground) == -1)
 					perror("fuse_daemonize");
+				g_wrapper->StartNotifications(ch);
+				g_wrapper->StartReaper();
+				g_wrapper->StartEvents();
+				g_wrapper->StartHotplugMonitor();
+				g_wrapper->StartPrefetch();
+				g_wrapper->StartKeepalive();
 				err = (multithreaded? fuse_session_loop_mt: fuse_session_loop)(se);
+				g_wrapper->StopNotifications();
 				fuse_remove_signal_handlers(se);
 				fuse_session_remove_chan(ch);
 			}
@@ -820,7 +4482,9 @@ int main(int argc, char **argv)
 		}
 		fuse_unmount(mountpoint, ch);
 	}
+#endif
 	fuse_opt_free_args(&args);
+	g_wrapper.reset(); //saves metadata cache
 
 	return err ? 1 : 0;
 }
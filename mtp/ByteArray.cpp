@@ -26,7 +26,7 @@ namespace mtp
 
 	void HexDump(const std::string &prefix, const ByteArray &data, bool force)
 	{
-		if (!g_debug && !force)
+		if (!force && !IsDebugEnabled(LogTransaction))
 			return;
 
 		std::stringstream ss;
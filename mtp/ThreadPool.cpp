@@ -0,0 +1,139 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ThreadPool.h>
+#include <mtp/log.h>
+#include <algorithm>
+
+namespace mtp
+{
+	namespace
+	{
+		thread_local const ThreadPool *	g_currentPool = nullptr;
+		thread_local size_t				g_currentWorker = 0;
+	}
+
+	ThreadPool::ThreadPool(unsigned threads): _next(0), _queued(0), _stopped(false)
+	{
+		if (!threads)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for(unsigned i = 0; i < threads; ++i)
+			_queues.emplace_back(new Queue);
+		for(unsigned i = 0; i < threads; ++i)
+			_threads.emplace_back(&ThreadPool::Run, this, i);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			scoped_mutex_lock l(_mutex);
+			_stopped = true;
+		}
+		_wakeUp.notify_all();
+		for(auto &thread : _threads)
+			thread.join();
+	}
+
+	ThreadPool & ThreadPool::Get()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void ThreadPool::Post(Task task)
+	{
+		{
+			//counted under pool mutex before it's queued, so sleeping worker can't miss it and counter never goes below zero
+			scoped_mutex_lock l(_mutex);
+			++_queued;
+		}
+		size_t index = g_currentPool == this? g_currentWorker: _next++ % _queues.size();
+		{
+			Queue &queue = *_queues[index];
+			scoped_mutex_lock l(queue.Mutex);
+			queue.Tasks.push_back(std::move(task));
+		}
+		_wakeUp.notify_one();
+	}
+
+	bool ThreadPool::Pop(size_t index, Task &task)
+	{
+		{
+			Queue &own = *_queues[index];
+			scoped_mutex_lock l(own.Mutex);
+			if (!own.Tasks.empty())
+			{
+				task = std::move(own.Tasks.back());
+				own.Tasks.pop_back();
+				--_queued;
+				return true;
+			}
+		}
+		for(size_t i = 1; i < _queues.size(); ++i)
+		{
+			Queue &victim = *_queues[(index + i) % _queues.size()];
+			scoped_mutex_lock l(victim.Mutex);
+			if (!victim.Tasks.empty())
+			{
+				task = std::move(victim.Tasks.front());
+				victim.Tasks.pop_front();
+				--_queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void ThreadPool::Execute(Task &task)
+	{
+		try
+		{ task(); }
+		catch(const std::exception &ex)
+		{ error("thread pool task failed: ", ex.what()); }
+	}
+
+	bool ThreadPool::RunOne()
+	{
+		Task task;
+		if (!Pop(g_currentPool == this? g_currentWorker: _next++ % _queues.size(), task))
+			return false;
+		Execute(task);
+		return true;
+	}
+
+	void ThreadPool::Run(size_t index)
+	{
+		g_currentPool = this;
+		g_currentWorker = index;
+		while(true)
+		{
+			Task task;
+			if (Pop(index, task))
+			{
+				Execute(task);
+				continue;
+			}
+
+			scoped_mutex_lock l(_mutex);
+			_wakeUp.wait(l, [this]() { return _stopped || _queued.load() != 0; });
+			if (_stopped && _queued.load() == 0)
+				break;
+		}
+	}
+}
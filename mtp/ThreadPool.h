@@ -0,0 +1,104 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_THREADPOOL_H
+#define AFT_THREADPOOL_H
+
+#include <mtp/types.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mtp
+{
+	class ThreadPool : Noncopyable //! work-stealing pool for cpu-bound steps (decoding, hashing, scaling), workers run their own tasks newest first and steal oldest ones from others
+	{
+	public:
+		using Task = std::function<void ()>;
+
+	private:
+		struct Queue
+		{
+			std::mutex			Mutex;
+			std::deque<Task>	Tasks;
+		};
+
+		std::vector<std::unique_ptr<Queue>>	_queues; //one per worker
+		std::vector<std::thread>			_threads;
+		std::atomic<unsigned>				_next; //queue for tasks posted from outside of pool
+		std::atomic<size_t>					_queued;
+		std::mutex							_mutex;
+		std::condition_variable				_wakeUp;
+		bool								_stopped;
+
+		void Run(size_t index);
+		bool Pop(size_t index, Task &task);
+		static void Execute(Task &task);
+
+	public:
+		///threads = 0 uses one worker per core
+		explicit ThreadPool(unsigned threads = 0);
+		///runs tasks still queued, then joins workers
+		~ThreadPool();
+
+		///pool shared by library and frontends, started on first use
+		static ThreadPool & Get();
+
+		size_t GetSize() const
+		{ return _threads.size(); }
+
+		///queues task, exceptions are logged and dropped; tasks posted by a worker go to its own queue
+		void Post(Task task);
+
+		///queues func and returns its result or exception via future
+		template<typename Func>
+		auto Submit(Func && func) -> std::future<decltype(func())>
+		{
+			using ResultType = decltype(func());
+			auto task = std::make_shared<std::packaged_task<ResultType ()>>(std::forward<Func>(func));
+			auto future = task->get_future();
+			Post([task]() { (*task)(); });
+			return future;
+		}
+
+		///runs one queued task on calling thread, returns false if there was none
+		bool RunOne();
+
+		///waits for future, running queued tasks meanwhile, so workers waiting for their subtasks do not starve the pool
+		template<typename ResultType>
+		ResultType Wait(std::future<ResultType> &future)
+		{
+			while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				if (!RunOne())
+					future.wait_for(std::chrono::milliseconds(1));
+			}
+			return future.get();
+		}
+	};
+}
+
+#endif
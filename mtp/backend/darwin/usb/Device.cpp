@@ -23,13 +23,18 @@
 #include <usb/call.h>
 #include <mtp/ByteArray.h>
 #include <mtp/log.h>
+#include <mtp/usb/TimeoutException.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
 
 #include <usb/call.h>
 
 namespace mtp { namespace usb
 {
 
-	Device::Device(ContextPtr context, IOUSBDeviceType ** dev): _context(context), _dev(dev)
+	Device::Device(ContextPtr context, IOUSBDeviceType ** dev): _context(context), _dev(dev), _transferSize(0), _stallTimeout(0), _bufferPool(std::make_shared<BufferPool>())
 	{ }
 
 	Device::~Device()
@@ -43,32 +48,128 @@ namespace mtp { namespace usb
 	void Device::SetConfiguration(int idx)
 	{ }
 
+	size_t Device::GetTransferSize(const EndpointPtr & ep) const
+	{
+		size_t packetSize = ep->GetMaxPacketSize();
+		size_t transferSize = std::min(_transferSize? _transferSize: DefaultTransferSize, BufferPool::MaxBufferSize);
+		return std::max(packetSize, transferSize / packetSize * packetSize);
+	}
+
+	namespace
+	{
+		struct AsyncTransfer
+		{
+			PooledBuffer	Buffer;
+			bool			Completed;
+			IOReturn		Result;
+			UInt32			Size;
+
+			AsyncTransfer(const BufferPoolPtr &pool, size_t size): Buffer(pool, size), Completed(true), Result(kIOReturnSuccess), Size(0)
+			{ }
+
+			static void Callback(void *refcon, IOReturn result, void *arg0)
+			{
+				AsyncTransfer *transfer = static_cast<AsyncTransfer *>(refcon);
+				transfer->Completed = true;
+				transfer->Result = result;
+				transfer->Size = static_cast<UInt32>(reinterpret_cast<uintptr_t>(arg0));
+			}
+		};
+
+		//completions are delivered through run loop of the thread waiting for them
+		class RunLoopSourceAttacher : Noncopyable
+		{
+			CFRunLoopRef		_runLoop;
+			CFRunLoopSourceRef	_source;
+
+		public:
+			RunLoopSourceAttacher(IOUSBInterfaceInterface **interface): _runLoop(CFRunLoopGetCurrent())
+			{
+				_source = (*interface)->GetInterfaceAsyncEventSource(interface);
+				if (!_source)
+					USB_CALL((*interface)->CreateInterfaceAsyncEventSource(interface, &_source));
+				CFRunLoopAddSource(_runLoop, _source, kCFRunLoopDefaultMode);
+			}
+
+			~RunLoopSourceAttacher()
+			{ CFRunLoopRemoveSource(_runLoop, _source, kCFRunLoopDefaultMode); }
+		};
+	}
+
 	void Device::WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout)
 	{
 		IOUSBInterfaceInterface	** interface = ep->GetInterfaceHandle();
+		RunLoopSourceAttacher attacher(interface);
 
-		size_t transferSize = ep->GetMaxPacketSize();
-		ByteArray buffer(transferSize);
-		size_t r;
-		do
+		size_t transferSize = GetTransferSize(ep);
+		std::vector<std::unique_ptr<AsyncTransfer>> transfers;
+		std::deque<AsyncTransfer *> idle, queue;
+
+		bool done = false;
+		try
 		{
-			r = inputStream->Read(buffer.data(), buffer.size());
-			USB_CALL((*interface)->WritePipe(interface, ep->GetRefIndex(), buffer.data(), r));
+			while(!done || !queue.empty())
+			{
+				while(!done && queue.size() < TransferQueueDepth)
+				{
+					if (idle.empty())
+					{
+						transfers.emplace_back(new AsyncTransfer(_bufferPool, transferSize));
+						idle.push_back(transfers.back().get());
+					}
+					AsyncTransfer *transfer = idle.front();
+					size_t r = inputStream->Read(transfer->Buffer.GetData(), transferSize);
+					done = r != transferSize;
+
+					transfer->Completed = false;
+					IOReturn result = (*interface)->WritePipeAsync(interface, ep->GetRefIndex(), transfer->Buffer.GetData(), r, &AsyncTransfer::Callback, transfer);
+					if (result != kIOReturnSuccess)
+						transfer->Completed = true;
+					USB_CALL(result);
+					idle.pop_front();
+					queue.push_back(transfer);
+				}
+
+				AsyncTransfer *transfer = queue.front();
+				while(!transfer->Completed)
+				{
+					if (CFRunLoopRunInMode(kCFRunLoopDefaultMode, timeout / 1000.0, true) == kCFRunLoopRunTimedOut && !transfer->Completed)
+						throw TimeoutException("timeout in bulk write");
+				}
+				timeout = GetStallTimeout(timeout); //device has accepted first chunk
+				queue.pop_front();
+				idle.push_back(transfer);
+				USB_CALL(transfer->Result);
+			}
+		}
+		catch(...)
+		{
+			//aborting completes all pending transfers with kIOReturnAborted
+			(*interface)->AbortPipe(interface, ep->GetRefIndex());
+			for(auto transfer : queue)
+			{
+				while(!transfer->Completed)
+					CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1, true);
+			}
+			throw;
 		}
-		while(r == transferSize);
 	}
 
 	void Device::ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout)
 	{
+		//reads stop at the first short packet, so they can't be queued beyond the current transfer,
+		//large buffer still lets IOKit keep the pipe busy
 		IOUSBInterfaceInterface	** interface = ep->GetInterfaceHandle();
-		size_t transferSize = ep->GetMaxPacketSize();
-		ByteArray buffer(transferSize);
+		size_t transferSize = GetTransferSize(ep);
+		PooledBuffer buffer(_bufferPool, transferSize);
 		size_t r;
 		do
 		{
-			UInt32 readBytes = buffer.size();
-			USB_CALL((*interface)->ReadPipe(interface, ep->GetRefIndex(), buffer.data(), &readBytes));
-			r = outputStream->Write(buffer.data(), readBytes);
+			UInt32 readBytes = buffer.GetSize();
+			USB_CALL((*interface)->ReadPipeTO(interface, ep->GetRefIndex(), buffer.GetData(), &readBytes, timeout, timeout));
+			outputStream->Write(buffer.GetData(), readBytes);
+			r = readBytes;
+			timeout = GetStallTimeout(timeout); //device has started sending
 		}
 		while(r == transferSize);
 	}
@@ -86,6 +187,12 @@ namespace mtp { namespace usb
 		data.resize(request.wLenDone);
 	}
 
+	void Device::Cancel(const EndpointPtr & ep)
+	{
+		IOUSBInterfaceInterface	** interface = ep->GetInterfaceHandle();
+		(*interface)->AbortPipe(interface, ep->GetRefIndex());
+	}
+
 	void Device::ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout)
 	{ ReadControl(_dev, type, req, value, index, data, timeout); }
 
@@ -25,6 +25,11 @@
 #include <mtp/Token.h>
 #include <mtp/types.h>
 #include <mtp/usb/types.h>
+#include <mtp/usb/BufferPool.h>
+#include <mtp/usb/ReaperPolicy.h>
+#include <mtp/usb/TransferStats.h>
+#include <atomic>
+#include <ostream>
 
 #include <usb/usb.h>
 
@@ -44,9 +49,16 @@ namespace mtp { namespace usb
 
 	class Device : Noncopyable
 	{
+	public:
+		static const unsigned		TransferQueueDepth		= 4;
+		static const size_t			DefaultTransferSize		= 64 * 1024;
+
 	private:
 		ContextPtr					_context;
 		IOUSBDeviceType **		_dev;
+		size_t						_transferSize;
+		std::atomic<int>			_stallTimeout;
+		BufferPoolPtr				_bufferPool; //page aligned heap memory, IOKit does not bounce it
 
 	public:
 		Device(ContextPtr ctx, IOUSBDeviceType **dev); //must be opened
@@ -54,11 +66,58 @@ namespace mtp { namespace usb
 
 		InterfaceTokenPtr ClaimInterface(const InterfacePtr &interface);
 
+		///sets bulk pipe transfer size, 0 selects it automatically
+		void SetTransferSize(size_t size)
+		{ _transferSize = size; }
+		size_t GetTransferSize() const
+		{ return _transferSize; }
+
+		///limits wait for every chunk after the first one of bulk transfer, so stalled transfer fails fast, 0 disables
+		void SetStallTimeout(int timeout)
+		{ _stallTimeout.store(timeout); }
+		///stall timeout clamped to transfer timeout
+		int GetStallTimeout(int timeout) const
+		{
+			int stall = _stallTimeout.load();
+			return stall > 0 && stall < timeout? stall: timeout;
+		}
+
+		///transfer buffers of this device, upper layers may borrow them to avoid copies, they must be returned before device is closed
+		BufferPoolPtr GetBufferPool() const
+		{ return _bufferPool; }
+
+		///transfers are not accounted by this backend
+		TransferStats GetTransferStats() const
+		{ return TransferStats(); }
+
+		///urb tracing is implemented by linux usbfs backend only, trace is always empty
+		void SetTraceCapacity(size_t records)
+		{ }
+		void WriteTrace(std::ostream &os)
+		{ os << "{\"traceEvents\":[]}\n"; }
+
+		///event loop integration is implemented by linux usbfs backend only, IOKit completions are delivered on run loop
+		int GetPollFd() const
+		{ return -1; }
+		void SetExternalReaping(bool external)
+		{ }
+		bool GetExternalReaping() const
+		{ return false; }
+		size_t ProcessCompletions()
+		{ return 0; }
+		///dedicated reaper thread is implemented by linux usbfs backend only, IOKit completions are delivered on run loop
+		void SetReaper(const ReaperPolicy &policy)
+		{ }
+
 		int GetConfiguration() const;
 		void SetConfiguration(int idx);
 
+		size_t GetTransferSize(const EndpointPtr & ep) const;
+
 		void WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout);
 		void ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout);
+		///aborts pipe, transfers in flight complete with kIOReturnAborted
+		void Cancel(const EndpointPtr & ep);
 
 		static void ReadControl(IOUSBDeviceType **dev, u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout); //result buffer must be allocated
 		void ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout); //result buffer must be allocated
@@ -72,6 +72,10 @@ namespace mtp { namespace usb
 
 		ConfigurationPtr GetConfiguration(int conf);
 		ByteArray GetDescriptor();
+
+		///bus paths are not supported, devices are matched by serial number only
+		std::string GetBusPath() const
+		{ return std::string(); }
 	};
 	DECLARE_PTR(DeviceDescriptor);
 
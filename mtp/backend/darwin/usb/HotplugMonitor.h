@@ -0,0 +1,49 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_BACKEND_DARWIN_USB_HOTPLUGMONITOR_H
+#define AFT_BACKEND_DARWIN_USB_HOTPLUGMONITOR_H
+
+#include <mtp/types.h>
+#include <functional>
+#include <string>
+
+namespace mtp { namespace usb
+{
+	class HotplugMonitor : Noncopyable //! hotplug notifications are not implemented for this backend, callback is never invoked
+	{
+	public:
+		enum struct Action
+		{
+			Added,
+			Removed
+		};
+		typedef std::function<void (Action, const std::string &busPath)> Callback;
+
+		HotplugMonitor(const Callback &callback)
+		{ }
+
+		static bool IsSupported()
+		{ return false; }
+	};
+	DECLARE_PTR(HotplugMonitor);
+
+}}
+
+#endif
@@ -24,7 +24,7 @@
 namespace mtp { namespace usb
 {
 
-	Context::Context(int debugLevel)
+	Context::Context(int debugLevel): _eventThreadRunning(false)
 	{
 		USB_CALL(libusb_init(&_ctx));
 		libusb_set_debug(_ctx, debugLevel);
@@ -41,9 +41,34 @@ namespace mtp { namespace usb
 
 	Context::~Context()
 	{
+		if (_eventThread.joinable())
+		{
+			_eventThreadRunning = false;
+			_eventThread.join();
+		}
 		libusb_exit(_ctx);
 	}
 
+	void Context::StartEventThread()
+	{
+		std::lock_guard<std::mutex> l(_eventThreadMutex);
+		if (_eventThreadRunning)
+			return;
+		_eventThreadRunning = true;
+		_eventThread = std::thread(&Context::HandleEvents, this);
+	}
+
+	void Context::HandleEvents()
+	{
+		while(_eventThreadRunning)
+		{
+			timeval tv = { 0, 100000 }; //check stop flag every 100ms
+			int r = libusb_handle_events_timeout_completed(_ctx, &tv, NULL);
+			if (r != 0 && r != LIBUSB_ERROR_INTERRUPTED)
+				fprintf(stderr, "libusb_handle_events: %s\n", libusb_error_name(r));
+		}
+	}
+
 	void Context::Wait()
 	{
 		USB_CALL(libusb_handle_events(_ctx));
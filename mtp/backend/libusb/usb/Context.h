@@ -23,6 +23,9 @@
 #include <libusb.h>
 #include <mtp/types.h>
 #include <usb/DeviceDescriptor.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace mtp { namespace usb
@@ -32,6 +35,11 @@ namespace mtp { namespace usb
 	{
 	private:
 		libusb_context *		_ctx;
+		std::mutex				_eventThreadMutex;
+		std::thread				_eventThread;
+		std::atomic<bool>		_eventThreadRunning;
+
+		void HandleEvents();
 
 	public:
 		typedef std::vector<DeviceDescriptorPtr> Devices;
@@ -45,6 +53,9 @@ namespace mtp { namespace usb
 
 		void Wait();
 
+		///starts thread running libusb event loop, asynchronous transfers complete there
+		void StartEventThread();
+
 		const Devices & GetDevices() const
 		{ return _devices; }
 	};
@@ -22,15 +22,221 @@
 #include <usb/Interface.h>
 #include <usb/call.h>
 #include <mtp/ByteArray.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/usb/DeviceNotFoundException.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace mtp { namespace usb
 {
 
-	Device::Device(ContextPtr context, libusb_device_handle * handle): _context(context), _handle(handle)
-	{}
+	namespace
+	{
+		class DeviceMemoryPool final : public BufferPool //! allocates buffers with libusb_dev_mem_alloc, libusb maps usbfs dma memory then
+		{
+			libusb_device_handle *	_handle;
+
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+			static const bool		Supported = true;
+
+		protected:
+			u8 * AllocateDeviceMemory(size_t size) override
+			{ return libusb_dev_mem_alloc(_handle, size); }
+
+			void FreeDeviceMemory(u8 *data, size_t size) override
+			{ libusb_dev_mem_free(_handle, data, size); }
+#else
+			static const bool		Supported = false;
+#endif
+
+		public:
+			DeviceMemoryPool(libusb_device_handle *handle): BufferPool(Supported), _handle(handle)
+			{ }
+
+			~DeviceMemoryPool()
+			{ Clear(); }
+		};
+	}
+
+	struct Device::Transfer : Noncopyable //! libusb transfer with its buffer, returned to device pool after every bulk transfer
+	{
+		TransferQueue *		Owner;
+		libusb_transfer *	Handle;
+		PooledBuffer		Buffer;
+		bool				Completed;
+
+		Transfer(const BufferPoolPtr &pool, size_t size): Owner(), Handle(libusb_alloc_transfer(0)), Buffer(pool, size), Completed(true)
+		{
+			if (!Handle)
+				throw std::bad_alloc();
+		}
+
+		~Transfer()
+		{ libusb_free_transfer(Handle); }
+
+		size_t GetActualLength() const
+		{ return Handle->actual_length; }
+	};
+
+	class Device::TransferQueue : Noncopyable
+	{
+		Device &								_device;
+		libusb_device_handle *					_handle;
+		u8										_endpoint;
+		unsigned								_timeout;
+
+		std::mutex								_mutex; //guards completion flags, _queue and _cancelled
+		bool									_cancelled;
+		std::condition_variable					_completed;
+		std::vector<std::unique_ptr<Transfer>>	_transfers;
+		std::deque<Transfer *>					_idle, _queue;
+
+		static void LIBUSB_CALL Callback(libusb_transfer *handle)
+		{
+			Transfer *transfer = static_cast<Transfer *>(handle->user_data);
+			TransferQueue *owner = transfer->Owner;
+			std::lock_guard<std::mutex> l(owner->_mutex);
+			transfer->Completed = true;
+			owner->_completed.notify_all();
+		}
+
+		static void CheckStatus(const Transfer *transfer)
+		{
+			switch(transfer->Handle->status)
+			{
+			case LIBUSB_TRANSFER_COMPLETED:
+				return;
+			case LIBUSB_TRANSFER_TIMED_OUT:
+				throw TimeoutException("timeout in bulk transfer");
+			case LIBUSB_TRANSFER_NO_DEVICE:
+				throw DeviceNotFoundException();
+			case LIBUSB_TRANSFER_CANCELLED:
+				throw OperationCancelledException();
+			case LIBUSB_TRANSFER_STALL:
+				throw std::runtime_error("endpoint stalled");
+			case LIBUSB_TRANSFER_OVERFLOW:
+				throw std::runtime_error("bulk transfer overflow");
+			default:
+				throw std::runtime_error("bulk transfer failed");
+			}
+		}
+
+	public:
+		TransferQueue(Device &device, u8 endpoint, int timeout):
+			_device(device), _handle(device._handle), _endpoint(endpoint), _timeout(timeout > 0? timeout: 0), _cancelled(false)
+		{
+			std::lock_guard<std::mutex> l(_device._queuesMutex);
+			_device._queues.push_back(this);
+		}
+
+		~TransferQueue()
+		{
+			{
+				std::lock_guard<std::mutex> l(_device._queuesMutex);
+				_device._queues.erase(std::find(_device._queues.begin(), _device._queues.end(), this));
+			}
+			Cancel();
+			for(auto & transfer : _transfers)
+				_device.ReleaseTransfer(std::move(transfer));
+		}
+
+		u8 GetEndpoint() const
+		{ return _endpoint; }
+
+		///applies to transfers submitted after this call
+		void SetTimeout(int timeout)
+		{ _timeout = timeout > 0? timeout: 0; }
+
+		bool Empty() const
+		{ return _queue.empty(); }
+
+		size_t Size() const
+		{ return _queue.size(); }
+
+		///returns idle transfer with buffer of given size, taking one from device pool if there's none
+		Transfer * GetIdle(size_t bufferSize)
+		{
+			auto it = std::find_if(_idle.begin(), _idle.end(), [bufferSize](Transfer *transfer) { return transfer->Buffer.GetSize() == bufferSize; });
+			if (it != _idle.end())
+				return *it;
+
+			_transfers.push_back(_device.AcquireTransfer(bufferSize));
+			Transfer *transfer = _transfers.back().get();
+			transfer->Owner = this;
+			_idle.push_back(transfer);
+			return transfer;
+		}
+
+		void Submit(Transfer *transfer, size_t size, bool zeroPacket)
+		{
+			libusb_fill_bulk_transfer(transfer->Handle, _handle, _endpoint, transfer->Buffer.GetData(), size, &Callback, transfer, _timeout);
+			if (zeroPacket)
+				transfer->Handle->flags |= LIBUSB_TRANSFER_ADD_ZERO_PACKET;
+			std::lock_guard<std::mutex> l(_mutex);
+			if (_cancelled)
+				throw OperationCancelledException();
+			transfer->Completed = false;
+			int r = libusb_submit_transfer(transfer->Handle);
+			if (r != 0)
+			{
+				transfer->Completed = true;
+				if (r == LIBUSB_ERROR_NO_DEVICE)
+					throw DeviceNotFoundException();
+				throw Exception("libusb_submit_transfer", r);
+			}
+			_idle.erase(std::find(_idle.begin(), _idle.end(), transfer));
+			_queue.push_back(transfer);
+		}
+
+		///waits for the oldest transfer in queue
+		Transfer * Wait()
+		{
+			Transfer *transfer;
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				transfer = _queue.front();
+				_completed.wait(l, [transfer] { return transfer->Completed; });
+				_queue.pop_front();
+			}
+			_idle.push_back(transfer);
+			CheckStatus(transfer);
+			return transfer;
+		}
+
+		///called from other thread, cancelled transfers complete in event thread and wake up Wait
+		void CancelAsync()
+		{
+			std::lock_guard<std::mutex> l(_mutex);
+			_cancelled = true;
+			for(auto transfer : _queue)
+				libusb_cancel_transfer(transfer->Handle);
+		}
+
+		void Cancel()
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			for(auto transfer : _queue)
+				libusb_cancel_transfer(transfer->Handle);
+
+			for(auto transfer : _queue)
+				_completed.wait(l, [transfer] { return transfer->Completed; });
+			_idle.insert(_idle.end(), _queue.begin(), _queue.end());
+			_queue.clear();
+		}
+	};
+
+	Device::Device(ContextPtr context, libusb_device_handle * handle): _context(context), _handle(handle), _transferSize(0), _stallTimeout(0), _bufferPool(std::make_shared<DeviceMemoryPool>(handle))
+	{ _context->StartEventThread(); }
 
 	Device::~Device()
 	{
+		//device memory is unmapped through the handle
+		_transferPool.clear();
+		_bufferPool.reset();
 		libusb_close(_handle);
 	}
 
@@ -57,26 +263,95 @@ namespace mtp { namespace usb
 	InterfaceTokenPtr Device::ClaimInterface(const InterfacePtr & interface)
 	{ return std::make_shared<InterfaceToken>(_handle, interface->GetIndex()); }
 
+	std::unique_ptr<Device::Transfer> Device::AcquireTransfer(size_t size)
+	{
+		{
+			std::lock_guard<std::mutex> l(_queuesMutex);
+			auto it = std::find_if(_transferPool.begin(), _transferPool.end(), [size](const std::unique_ptr<Transfer> &transfer) { return transfer->Buffer.GetSize() == size; });
+			if (it != _transferPool.end())
+			{
+				std::unique_ptr<Transfer> transfer(std::move(*it));
+				_transferPool.erase(it);
+				return transfer;
+			}
+		}
+		return std::unique_ptr<Transfer>(new Transfer(_bufferPool, size));
+	}
+
+	void Device::ReleaseTransfer(std::unique_ptr<Transfer> transfer)
+	{
+		std::lock_guard<std::mutex> l(_queuesMutex);
+		transfer->Owner = nullptr;
+		if (_transferPool.size() < MaxPooledTransfers)
+			_transferPool.push_back(std::move(transfer));
+	}
+
+	size_t Device::GetTransferSize(const EndpointPtr & ep) const
+	{
+		size_t packetSize = ep->GetMaxPacketSize();
+		size_t transferSize = std::min(_transferSize? _transferSize: packetSize * 1024, BufferPool::MaxBufferSize);
+		return std::max(packetSize, transferSize / packetSize * packetSize);
+	}
+
 	void Device::WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout)
 	{
-		ByteArray data(inputStream->GetSize());
-		inputStream->Read(data.data(), data.size());
-		int tr = 0;
-		USB_CALL(libusb_bulk_transfer(_handle, ep->GetAddress(), const_cast<u8 *>(data.data()), data.size(), &tr, timeout));
-		if (tr != (int)data.size())
-			throw std::runtime_error("short write");
+		TransferQueue queue(*this, ep->GetAddress(), timeout);
+		size_t transferSize = GetTransferSize(ep);
+		bool done = false;
+		try
+		{
+			while(!done || !queue.Empty())
+			{
+				while(!done && queue.Size() < TransferQueueDepth)
+				{
+					auto transfer = queue.GetIdle(transferSize);
+					size_t r = inputStream->Read(transfer->Buffer.GetData(), transferSize);
+					done = r != transferSize;
+					queue.Submit(transfer, r, done);
+				}
+
+				auto transfer = queue.Wait();
+				queue.SetTimeout(GetStallTimeout(timeout));
+				if (transfer->GetActualLength() != static_cast<size_t>(transfer->Handle->length))
+					throw std::runtime_error("short write");
+			}
+		}
+		catch(...)
+		{
+			queue.Cancel();
+			throw;
+		}
 	}
 
 	void Device::ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout)
 	{
-		ByteArray data(ep->GetMaxPacketSize() * 1024);
-		int tr;
-		do
+		//libusb splits every transfer into urbs itself and keeps them in flight,
+		//but reads can't be queued beyond the end of the current transfer, so submit them one by one
+		//first read is sized for a response container, large buffer is used only for the data that follows
+		TransferQueue queue(*this, ep->GetAddress(), timeout);
+		size_t packetSize = ep->GetMaxPacketSize();
+		size_t transferSize = GetTransferSize(ep);
+		size_t size = std::min(transferSize, std::max(packetSize, FirstReadSize / packetSize * packetSize));
+		while(true)
 		{
-			USB_CALL(libusb_bulk_transfer(_handle, ep->GetAddress(), data.data(), data.size(), &tr, timeout));
-			outputStream->Write(data.data(), tr);
+			auto transfer = queue.GetIdle(size);
+			queue.Submit(transfer, size, false);
+			transfer = queue.Wait();
+			queue.SetTimeout(GetStallTimeout(timeout)); //device has started sending
+			size_t r = transfer->GetActualLength();
+			outputStream->Write(transfer->Buffer.GetData(), r);
+			if (r != size)
+				break;
+			size = transferSize;
 		}
-		while(tr == (int)data.size());
+	}
+
+	void Device::Cancel(const EndpointPtr & ep)
+	{
+		std::lock_guard<std::mutex> l(_queuesMutex);
+		for(auto queue : _queues)
+			if (queue->GetEndpoint() == ep->GetAddress())
+				queue->CancelAsync();
 	}
 
 	void Device::ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout)
@@ -25,6 +25,14 @@
 #include <mtp/Token.h>
 #include <mtp/types.h>
 #include <mtp/usb/types.h>
+#include <mtp/usb/BufferPool.h>
+#include <mtp/usb/ReaperPolicy.h>
+#include <mtp/usb/TransferStats.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
 #include <libusb.h>
 
 namespace mtp { namespace usb
@@ -68,9 +76,23 @@ namespace mtp { namespace usb
 
 	class Device : Noncopyable
 	{
+	public:
+		static const unsigned	TransferQueueDepth		= 4;
+		static const size_t		FirstReadSize			= 16 * 1024; //fits any response container
+		static const size_t		MaxPooledTransfers		= 3 * TransferQueueDepth; //bulk in, bulk out and interrupt
+
 	private:
 		ContextPtr				_context;
 		libusb_device_handle *	_handle;
+		size_t					_transferSize;
+		std::atomic<int>		_stallTimeout;
+		BufferPoolPtr			_bufferPool;
+
+		struct Transfer;
+		class TransferQueue;
+		std::mutex						_queuesMutex; //also guards _transferPool
+		std::vector<TransferQueue *>	_queues; //transfers running now, found by Cancel
+		std::vector<std::unique_ptr<Transfer>>	_transferPool; //idle transfers, their buffers are allocated and zeroed once
 
 	public:
 		Device(ContextPtr ctx, libusb_device_handle * handle);
@@ -81,16 +103,66 @@ namespace mtp { namespace usb
 
 		InterfaceTokenPtr ClaimInterface(const InterfacePtr & interface);
 
+		///sets size of every bulk transfer, 0 selects it automatically
+		void SetTransferSize(size_t size)
+		{ _transferSize = size; }
+		size_t GetTransferSize() const
+		{ return _transferSize; }
+
+		///limits wait for every chunk after the first one of bulk transfer, so stalled transfer fails fast, 0 disables
+		void SetStallTimeout(int timeout)
+		{ _stallTimeout.store(timeout); }
+		///stall timeout clamped to transfer timeout
+		int GetStallTimeout(int timeout) const
+		{
+			int stall = _stallTimeout.load();
+			return stall > 0 && stall < timeout? stall: timeout;
+		}
+
+		///transfer buffers of this device, upper layers may borrow them to avoid copies, they must be returned before device is closed
+		BufferPoolPtr GetBufferPool() const
+		{ return _bufferPool; }
+
+		///transfers are not accounted by this backend
+		TransferStats GetTransferStats() const
+		{ return TransferStats(); }
+
+		///urb tracing is implemented by linux usbfs backend only, trace is always empty
+		void SetTraceCapacity(size_t records)
+		{ }
+		void WriteTrace(std::ostream &os)
+		{ os << "{\"traceEvents\":[]}\n"; }
+
+		///event loop integration is implemented by linux usbfs backend only, libusb completions are handled by context event thread
+		int GetPollFd() const
+		{ return -1; }
+		void SetExternalReaping(bool external)
+		{ }
+		bool GetExternalReaping() const
+		{ return false; }
+		size_t ProcessCompletions()
+		{ return 0; }
+		///dedicated reaper thread is implemented by linux usbfs backend only, libusb completions are handled by context event thread
+		void SetReaper(const ReaperPolicy &policy)
+		{ }
+
 		int GetConfiguration() const;
 		void SetConfiguration(int idx);
 
 		void WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout);
 		void ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout);
+		///cancels transfers in flight on endpoint, transfer running in other thread throws OperationCancelledException
+		void Cancel(const EndpointPtr & ep);
 
 		void ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout);
 		void WriteControl(u8 type, u8 req, u16 value, u16 index, const ByteArray &data, int timeout);
 
 		std::string GetString(int idx) const;
+
+	private:
+		size_t GetTransferSize(const EndpointPtr & ep) const;
+		std::unique_ptr<Transfer> AcquireTransfer(size_t size);
+		void ReleaseTransfer(std::unique_ptr<Transfer> transfer);
 	};
 	DECLARE_PTR(Device);
 }}
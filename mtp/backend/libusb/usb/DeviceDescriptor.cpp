@@ -19,6 +19,7 @@
 
 #include <usb/DeviceDescriptor.h>
 #include <usb/call.h>
+#include <sstream>
 
 namespace mtp { namespace usb
 {
@@ -54,4 +55,18 @@ namespace mtp { namespace usb
 	ByteArray DeviceDescriptor::GetDescriptor() const
 	{ throw std::runtime_error("not possible with libusb"); }
 
+	std::string DeviceDescriptor::GetBusPath() const
+	{
+		u8 ports[8]; //usb 3 limits tier chain to 7 hubs
+		int n = libusb_get_port_numbers(_dev, ports, sizeof(ports));
+		if (n <= 0)
+			return std::string();
+
+		std::stringstream ss;
+		ss << static_cast<unsigned>(libusb_get_bus_number(_dev)) << '-';
+		for(int i = 0; i < n; ++i)
+			ss << (i? ".": "") << static_cast<unsigned>(ports[i]);
+		return ss.str();
+	}
+
 }}
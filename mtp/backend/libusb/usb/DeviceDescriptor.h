@@ -73,6 +73,9 @@ namespace mtp { namespace usb
 		ConfigurationPtr GetConfiguration(int conf);
 
 		ByteArray GetDescriptor() const;
+
+		///bus number and port chain in sysfs notation, e.g. 1-2.3
+		std::string GetBusPath() const;
 	};
 	DECLARE_PTR(DeviceDescriptor);
 
@@ -26,9 +26,12 @@
 #include <mtp/ByteArray.h>
 #include <mtp/log.h>
 
+#include <algorithm>
+
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
 #include <poll.h>
+#include <unistd.h>
 #include <signal.h>
 
 #include "linux/usbdevice_fs.h"
@@ -63,17 +66,20 @@ namespace mtp { namespace usb
 #define PRINT_CAP(CAP, NAME) \
 	if (capabilities & (CAP)) \
 	{ \
-		debug(NAME " "); \
+		MTP_DEBUG_CATEGORY(LogUsb, NAME " "); \
 		capabilities &= ~(CAP); \
 	}
 
 
-	Device::Device(int fd, const EndpointPtr &controlEp): _fd(fd), _capabilities(0), _controlEp(controlEp)
+	Device::Device(int fd, const EndpointPtr &controlEp):
+		_fd(fd), _capabilities(0), _controlEp(controlEp),
+		_urbQueueDepth(DefaultUrbQueueDepth), _transferSize(0), _stallTimeout(0), _largeUrbTransferSize(0), _reaping(false),
+		_externalReaping(false), _lost(false), _reaperWakeup(-1), _reaperStop(false)
 	{
 		try { IOCTL(_fd.Get(), USBDEVFS_GET_CAPABILITIES, &_capabilities); }
 		catch(const std::exception &ex)
 		{ error("get usbfs capabilities failed: ", ex.what()); }
-		debug("capabilities = 0x", hex(_capabilities, 8));
+		MTP_DEBUG_CATEGORY(LogUsb, "capabilities = 0x", hex(_capabilities, 8));
 		bool mmap = _capabilities & USBDEVFS_CAP_MMAP;
 		_bufferAllocator = std::make_shared<BufferAllocator>(mmap? fd: -1);
 
@@ -88,14 +94,101 @@ namespace mtp { namespace usb
 			PRINT_CAP(USBDEVFS_CAP_MMAP, "<mmap>");
 			PRINT_CAP(USBDEVFS_CAP_DROP_PRIVILEGES, "<drop-privileges>");
 			if (capabilities)
-				debug("<unknown capability 0x", hex(capabilities, 2), ">");
+				MTP_DEBUG_CATEGORY(LogUsb, "<unknown capability 0x", hex(capabilities, 2), ">");
 		}
 		else
-			debug("[none]\n");
+			MTP_DEBUG_CATEGORY(LogUsb, "[none]\n");
+
+		//kernel builds scatter-gather list for large bulk urbs itself, we only have to submit them
+		if (_capabilities & (USBDEVFS_CAP_BULK_SCATTER_GATHER | USBDEVFS_CAP_NO_PACKET_SIZE_LIM))
+			_largeUrbTransferSize = BufferAllocator::MaxBufferSize;
 	}
 
 	Device::~Device()
-	{ }
+	{
+		StopReaper();
+		auto stats = _bufferAllocator->GetStats();
+		MTP_DEBUG_CATEGORY(LogUsb, "urb buffer pool: ", stats.Allocations, " allocations, high-water mark ", stats.HighWaterMark, " bytes, ", stats.Failures, " failures");
+	}
+
+	BufferPoolPtr Device::GetBufferPool() const
+	{ return _bufferAllocator; }
+
+	void Device::SetBufferPoolLimit(size_t limit)
+	{ _bufferAllocator->SetMemoryLimit(limit); }
+
+	TransferStats Device::GetTransferStats()
+	{
+		std::lock_guard<std::mutex> l(_reapMutex);
+		return _stats;
+	}
+
+	void Device::SetTraceCapacity(size_t records)
+	{
+		std::lock_guard<std::mutex> l(_reapMutex);
+		_trace.SetCapacity(records);
+	}
+
+	void Device::WriteTrace(std::ostream &os)
+	{
+		std::vector<UrbTrace::Record> records;
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			records = _trace.GetRecords();
+		}
+		UrbTrace::Write(os, records);
+	}
+
+	bool Device::IsZeroCopy() const
+	{ return _bufferAllocator->GetMode() == BufferPool::Mode::Device; }
+
+	void Device::SetUrbQueueDepth(unsigned depth)
+	{
+		if (depth == 0)
+			throw std::invalid_argument("urb queue depth must be positive");
+		_urbQueueDepth = depth;
+	}
+
+	size_t Device::GetTransferSize(const EndpointPtr &ep)
+	{
+		if (_transferSize)
+			return _transferSize;
+
+		auto it = _autoTransferSize.find(ep->GetAddress());
+		if (it != _autoTransferSize.end())
+			return it->second;
+
+		int packetSize = ep->GetMaxPacketSize();
+		size_t size;
+		if (packetSize <= 64)
+			size = 4096; //full speed
+		else if (packetSize <= 512)
+			size = 16384; //high speed
+		else
+			size = 65536; //super speed
+
+		if (!(_capabilities & USBDEVFS_CAP_NO_PACKET_SIZE_LIM))
+			size = std::min(size, MaxUsbfsTransferSize);
+
+		MTP_DEBUG_CATEGORY(LogUsb, "using ", size, " bytes urbs for endpoint ", hex(ep->GetAddress(), 2));
+		_autoTransferSize[ep->GetAddress()] = size;
+		return size;
+	}
+
+	void Device::UpdateTransferSize(const EndpointPtr &ep, size_t transferSize, size_t fullUrbs)
+	{
+		//long streams of full urbs mean we're limited by ioctl rate, not by device, double urb size then
+		if (_transferSize || fullUrbs < 2 * _urbQueueDepth)
+			return;
+
+		size_t maxSize = (_capabilities & USBDEVFS_CAP_NO_PACKET_SIZE_LIM)? BufferAllocator::MaxBufferSize / 4: MaxUsbfsTransferSize;
+		size_t & size = _autoTransferSize[ep->GetAddress()];
+		if (size != transferSize || size * 2 > maxSize)
+			return;
+
+		size *= 2;
+		MTP_DEBUG_CATEGORY(LogUsb, "increasing urb size for endpoint ", hex(ep->GetAddress(), 2), " to ", size);
+	}
 
 	int Device::GetConfiguration() const
 	{
@@ -109,18 +202,17 @@ namespace mtp { namespace usb
 
 	struct Device::Urb : usbdevfs_urb, Noncopyable
 	{
-		static const int 		MaxBufferSize = 4096;
 		BufferAllocator &		Allocator;
 		int						Fd;
 		int						PacketSize;
 		Buffer					DataBuffer;
 
-		Urb(BufferAllocator & allocator, int fd, u8 urbType, const EndpointPtr & ep):
+		Urb(BufferAllocator & allocator, int fd, u8 urbType, const EndpointPtr & ep, size_t bufferSize):
 			usbdevfs_urb(),
 			Allocator(allocator),
 			Fd(fd),
 			PacketSize(ep->GetMaxPacketSize()),
-			DataBuffer(Allocator.Allocate(std::max(PacketSize, MaxBufferSize / PacketSize * PacketSize)))
+			DataBuffer(Allocator.Allocate(GetTransferSize(ep, bufferSize)))
 		{
 			type			= urbType;
 			endpoint		= ep->GetAddress();
@@ -137,15 +229,48 @@ namespace mtp { namespace usb
 		size_t GetTransferSize() const
 		{ return DataBuffer.GetSize(); }
 
+		static size_t GetTransferSize(const EndpointPtr & ep, size_t bufferSize)
+		{
+			size_t packetSize = ep->GetMaxPacketSize();
+			return std::max(packetSize, bufferSize / packetSize * packetSize);
+		}
+
 		void Submit()
 		{
 			IOCTL(Fd, USBDEVFS_SUBMITURB, GetKernelUrb());
 		}
 
+		//returns false if kernel refused continuation urb because of short packet/error in previous one
+		bool SubmitContinuation()
+		{
+			int r = ioctl(Fd, USBDEVFS_SUBMITURB, GetKernelUrb());
+			if (r == 0)
+				return true;
+			if (errno == EREMOTEIO)
+				return false;
+			IOCTL(Fd, USBDEVFS_SUBMITURB, GetKernelUrb());
+			return true;
+		}
+
+		void PrepareRecv()
+		{
+			buffer_length	= DataBuffer.GetSize();
+			actual_length	= 0;
+			status			= 0;
+		}
+
+		void CheckStatus() const
+		{
+			if (status == -ENOENT || status == -ECONNRESET)
+				throw OperationCancelledException(); //discarded by Cancel
+			if (status != 0 && status != -EREMOTEIO)
+				throw posix::Exception("urb failed", -status);
+		}
+
 		void Discard()
 		{
 			int r = ioctl(Fd, USBDEVFS_DISCARDURB, GetKernelUrb());
-			if (r != 0)
+			if (r != 0 && errno != EINVAL) //EINVAL: urb has already completed
 			{
 				perror("ioctl(USBDEVFS_DISCARDURB)");
 			}
@@ -191,40 +316,152 @@ namespace mtp { namespace usb
 
 		void SetZeroPacketFlag(bool zero)
 		{ SetFlag<USBDEVFS_URB_ZERO_PACKET>(zero); }
+
+		void SetShortNotOkFlag(bool shortNotOk)
+		{ SetFlag<USBDEVFS_URB_SHORT_NOT_OK>(shortNotOk); }
 	};
 
-	void * Device::Reap(int timeout)
+	void * Device::Reap(std::chrono::steady_clock::time_point deadline, bool wait)
 	{
-		timeval started = {};
-		if (gettimeofday(&started, NULL) == -1)
-			throw posix::Exception("gettimeofday");
+		while(true)
+		{
+			//try to reap first, urbs usually complete before we get here, poll is needed only when queue is empty
+			usbdevfs_urb *urb;
+			int r = ioctl(_fd.Get(), USBDEVFS_REAPURBNDELAY, &urb);
+			if (r == 0)
+				return urb;
+			else if (errno != EAGAIN)
+				throw posix::Exception("ioctl");
+
+			int timeout = -1;
+			if (wait)
+			{
+				auto now = std::chrono::steady_clock::now();
+				if (now >= deadline)
+					throw TimeoutException("timeout reaping usb urb");
+				timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+			}
+			else
+				throw TimeoutException("timeout reaping usb urb");
+
+			pollfd fd = {};
+			fd.fd		= _fd.Get();
+			fd.events	= POLLOUT | POLLWRNORM;
+			r = poll(&fd, 1, timeout);
+			if (r < 0 && errno != EINTR)
+				throw posix::Exception("poll");
+		}
+	}
 
-		pollfd fd = {};
-		fd.fd		= _fd.Get();
-		fd.events	= POLLOUT | POLLWRNORM;
-		int r = poll(&fd, 1, timeout);
+	void Device::SetExternalReaping(bool external)
+	{
+		std::lock_guard<std::mutex> l(_reapMutex);
+		_externalReaping = external;
+		_reapCondition.notify_all(); //waiters reap on their own again
+	}
 
-		timeval now = {};
-		if (gettimeofday(&now, NULL) == -1)
-			throw posix::Exception("gettimeofday");
+	size_t Device::ProcessCompletions()
+	{
+		size_t reaped = 0;
+		while(true)
+		{
+			usbdevfs_urb *urb;
+			int r = ioctl(_fd.Get(), USBDEVFS_REAPURBNDELAY, &urb);
+			if (r != 0)
+			{
+				if (errno == EAGAIN)
+					break;
+				int savedErrno = errno;
+				std::lock_guard<std::mutex> l(_reapMutex);
+				_lost = savedErrno == ENODEV;
+				_reapCondition.notify_all();
+				errno = savedErrno;
+				throw posix::Exception("ioctl");
+			}
+			std::lock_guard<std::mutex> l(_reapMutex);
+			Complete(urb);
+			++reaped;
+		}
+		if (reaped)
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			_reapCondition.notify_all();
+		}
+		return reaped;
+	}
 
-		if (r < 0)
-			throw posix::Exception("poll");
+	void Device::SetReaper(const ReaperPolicy &policy)
+	{
+		StopReaper();
+		if (!policy.Enabled)
+			return;
+
+		_reaperWakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (_reaperWakeup < 0)
+			throw posix::Exception("eventfd");
+		_reaperStop.store(false);
+		SetExternalReaping(true);
+		_reaper = std::thread(&Device::RunReaper, this, policy);
+	}
 
-		if (r == 0 && timeout > 0)
+	void Device::StopReaper()
+	{
+		if (!_reaper.joinable())
+			return;
+		_reaperStop.store(true);
+		u64 value = 1;
+		if (write(_reaperWakeup, &value, sizeof(value)) != sizeof(value))
+			perror("write(eventfd)");
+		_reaper.join();
+		close(_reaperWakeup);
+		_reaperWakeup = -1;
+	}
+
+	void Device::RunReaper(ReaperPolicy policy)
+	{
+		policy.Apply();
+		MTP_DEBUG_CATEGORY(LogUsb, "urb reaper thread started");
+		try
 		{
-			int ms = (now.tv_sec - started.tv_sec) * 1000 + (now.tv_usec - started.tv_usec) / 1000;
-			error(ms, " ms since the last poll call");
+			while(!_reaperStop.load())
+			{
+				pollfd fds[2] = {};
+				fds[0].fd		= _fd.Get();
+				fds[0].events	= POLLOUT | POLLWRNORM;
+				fds[1].fd		= _reaperWakeup;
+				fds[1].events	= POLLIN;
+				int r = poll(fds, 2, -1);
+				if (r < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw posix::Exception("poll");
+				}
+				//disconnect is reported as POLLERR, reaping throws and marks device lost
+				if (fds[0].revents)
+					ProcessCompletions();
+			}
 		}
+		catch(const std::exception &ex)
+		{ error("urb reaper thread stopped: ", ex.what()); }
+		//transfers poll usbfs themselves again
+		SetExternalReaping(false);
+		MTP_DEBUG_CATEGORY(LogUsb, "urb reaper thread finished");
+	}
 
-		usbdevfs_urb *urb;
-		r = ioctl(_fd.Get(), USBDEVFS_REAPURBNDELAY, &urb);
-		if (r == 0)
-			return urb;
-		else if (errno == EAGAIN)
-			throw TimeoutException("timeout reaping usb urb");
+	void Device::Complete(void *completedKernelUrb)
+	{
+		if (_inflight.erase(completedKernelUrb))
+		{
+			if (_trace.Enabled())
+			{
+				auto kernelUrb = static_cast<const usbdevfs_urb *>(completedKernelUrb);
+				_trace.Add(UrbTrace::Event::Reap, kernelUrb, kernelUrb->endpoint, kernelUrb->actual_length, kernelUrb->status);
+			}
+			_completed.insert(completedKernelUrb);
+		}
 		else
-			throw posix::Exception("ioctl");
+			error("got unknown urb: ", completedKernelUrb);
 	}
 
 	void Device::ClearHalt(const EndpointPtr & ep)
@@ -235,79 +472,337 @@ namespace mtp { namespace usb
 		{ error("clearing halt status for ep ", hex(ep->GetAddress(), 2), ": ", ex.what()); }
 	}
 
-	void Device::Submit(Urb *urb, int timeout)
+	Device::Urb * Device::AcquireUrb(UrbStorage &urbs, std::deque<Urb *> &idle, const EndpointPtr &ep, size_t size)
+	{
+		size_t transferSize = Urb::GetTransferSize(ep, size);
+		auto it = std::find_if(idle.begin(), idle.end(), [transferSize](Urb *urb) { return urb->GetTransferSize() == transferSize; });
+		if (it != idle.end())
+		{
+			Urb *urb = *it;
+			idle.erase(it);
+			return urb;
+		}
+		urbs.emplace_back(new Urb(*_bufferAllocator, _fd.Get(), USBDEVFS_URB_TYPE_BULK, ep, size));
+		return urbs.back().get();
+	}
+
+	unsigned Device::GetCancelGeneration(const EndpointPtr &ep)
+	{
+		std::lock_guard<std::mutex> l(_reapMutex);
+		return _cancelGeneration[ep->GetAddress()];
+	}
+
+	void Device::Cancel(const EndpointPtr & ep)
+	{
+		std::lock_guard<std::mutex> l(_reapMutex);
+		u8 address = ep->GetAddress();
+		++_cancelGeneration[address];
+		for(auto kernelUrb : _inflight)
+		{
+			usbdevfs_urb *urb = static_cast<usbdevfs_urb *>(kernelUrb);
+			if (urb->endpoint != address)
+				continue;
+			//urbs in _inflight belong to transfers still waiting for them
+			//the transfer itself discards and counts the rest of its queue
+			if (ioctl(_fd.Get(), USBDEVFS_DISCARDURB, urb) != 0 && errno != EINVAL)
+				perror("ioctl(USBDEVFS_DISCARDURB)");
+		}
+	}
+
+	void Device::Submit(Urb *urb, unsigned generation)
+	{
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			if (_cancelGeneration[urb->endpoint] != generation)
+				throw OperationCancelledException();
+			_inflight.insert(urb->GetKernelUrb());
+			++_stats.Submitted;
+			_trace.Add(UrbTrace::Event::Submit, urb->GetKernelUrb(), urb->endpoint, urb->buffer_length, 0);
+		}
+		try
+		{ urb->Submit(); }
+		catch(...)
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			_inflight.erase(urb->GetKernelUrb());
+			--_stats.Submitted;
+			_trace.Add(UrbTrace::Event::Reap, urb->GetKernelUrb(), urb->endpoint, 0, -EINVAL);
+			throw;
+		}
+	}
+
+	bool Device::SubmitContinuation(Urb *urb, unsigned generation)
 	{
-		urb->Submit();
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			if (_cancelGeneration[urb->endpoint] != generation)
+				throw OperationCancelledException();
+			_inflight.insert(urb->GetKernelUrb());
+			++_stats.Submitted;
+			_trace.Add(UrbTrace::Event::Submit, urb->GetKernelUrb(), urb->endpoint, urb->buffer_length, 0);
+		}
+		bool submitted = false;
 		try
+		{ submitted = urb->SubmitContinuation(); }
+		catch(...)
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			_inflight.erase(urb->GetKernelUrb());
+			--_stats.Submitted;
+			_trace.Add(UrbTrace::Event::Reap, urb->GetKernelUrb(), urb->endpoint, 0, -EINVAL);
+			throw;
+		}
+		if (!submitted)
+		{
+			std::lock_guard<std::mutex> l(_reapMutex);
+			_inflight.erase(urb->GetKernelUrb());
+			--_stats.Submitted;
+			_trace.Add(UrbTrace::Event::Reap, urb->GetKernelUrb(), urb->endpoint, 0, -EREMOTEIO);
+		}
+		return submitted;
+	}
+
+	Device::Urb * Device::ReapQueued(std::deque<Urb *> &queue, int timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+		std::unique_lock<std::mutex> l(_reapMutex);
+		while(true)
 		{
-			while(true)
+			for(auto it = queue.begin(); it != queue.end(); ++it)
 			{
-				usbdevfs_urb * completedKernelUrb = static_cast<usbdevfs_urb *>(Reap(timeout));
-				if (urb->GetKernelUrb() != completedKernelUrb)
-				{
-					error("got unknown urb: ", completedKernelUrb);
+				Urb *urb = *it;
+				auto completed = _completed.find(urb->GetKernelUrb());
+				if (completed == _completed.end())
 					continue;
+
+				if (it != queue.begin())
+					error("urb completed out of order: ", urb->GetKernelUrb());
+				_completed.erase(completed);
+				queue.erase(it);
+				Account(urb);
+				return urb;
+			}
+
+			if (_lost)
+				throw DeviceNotFoundException();
+
+			if (_reaping || _externalReaping)
+			{
+				//another thread or event loop is waiting for completions, it will hand ours over
+				if (_reapCondition.wait_until(l, deadline) == std::cv_status::timeout)
+				{
+					++_stats.Timeouts;
+					throw TimeoutException("timeout reaping usb urb");
 				}
-				else
-					break;
+				continue;
+			}
+
+			_reaping = true;
+			void * completedKernelUrb;
+			l.unlock();
+			try
+			{ completedKernelUrb = Reap(deadline, timeout > 0); }
+			catch(const TimeoutException &)
+			{
+				l.lock();
+				_reaping = false;
+				++_stats.Timeouts;
+				_reapCondition.notify_all();
+				throw;
 			}
+			catch(...)
+			{
+				l.lock();
+				_reaping = false;
+				_reapCondition.notify_all();
+				throw;
+			}
+			l.lock();
+			_reaping = false;
+			Complete(completedKernelUrb);
+			_reapCondition.notify_all();
 		}
-		catch(const TimeoutException &ex)
+	}
+
+	void Device::Account(const Urb *urb)
+	{
+		++_stats.Completed;
+		if (urb->endpoint & 0x80)
+			_stats.BytesIn += urb->actual_length;
+		else
+			_stats.BytesOut += urb->actual_length;
+		//discarded urbs complete with ENOENT/ECONNRESET, they are counted in DiscardQueued
+		if (urb->status != 0 && urb->status != -EREMOTEIO && urb->status != -ENOENT && urb->status != -ECONNRESET)
+			++_stats.Failed;
+	}
+
+	void Device::DiscardQueued(std::deque<Urb *> &queue, int timeout)
+	{
+		if (queue.empty())
+			return;
+
 		{
-			urb->Discard();
-			throw;
+			std::lock_guard<std::mutex> l(_reapMutex);
+			_stats.Discarded += queue.size();
 		}
-		catch(const std::exception &ex)
-		{
-			error("error while submitting urb: ", ex.what());
+		for(auto urb : queue)
 			urb->Discard();
-			throw;
+
+		try
+		{
+			while(!queue.empty())
+				ReapQueued(queue, timeout);
 		}
+		catch(const std::exception &ex)
+		{ error("error while reaping discarded urbs: ", ex.what()); }
 	}
 
 	void Device::WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout)
 	{
-		Urb urb(*_bufferAllocator, _fd.Get(), USBDEVFS_URB_TYPE_BULK, ep);
-		size_t transferSize = urb.GetTransferSize();
-
-		size_t r;
+		UrbStorage urbs;
+		std::deque<Urb *> idle, queue;
+
+		u64 remaining = inputStream->GetSize();
+		unsigned generation = GetCancelGeneration(ep);
+		int stallTimeout = GetStallTimeout(timeout);
+		size_t urbTransferSize = GetTransferSize(ep);
+		size_t fullUrbs = 0;
 		bool continuation = false;
-		do
+		bool done = false;
+		bool started = false;
+		try
 		{
-			r = urb.Send(inputStream, transferSize);
-
-			if (_capabilities & USBDEVFS_CAP_ZERO_PACKET)
-				urb.SetZeroPacketFlag(r != transferSize);
+			while(!done || !queue.empty())
+			{
+				while(!done && queue.size() < _urbQueueDepth)
+				{
+					bool large = _largeUrbTransferSize && remaining >= _largeUrbTransferSize;
+					Urb *urb = AcquireUrb(urbs, idle, ep, large? _largeUrbTransferSize: urbTransferSize);
+					size_t transferSize = urb->GetTransferSize();
+
+					size_t r;
+					try
+					{ r = urb->Send(inputStream, transferSize); }
+					catch(...)
+					{ idle.push_back(urb); throw; }
+
+					remaining -= std::min<u64>(remaining, r);
+					done = r != transferSize;
+					if (!done && !large)
+						++fullUrbs;
+
+					if (_capabilities & USBDEVFS_CAP_ZERO_PACKET)
+						urb->SetZeroPacketFlag(done);
+
+					if (_capabilities & USBDEVFS_CAP_BULK_CONTINUATION)
+					{
+						urb->SetContinuationFlag(continuation);
+						continuation = true;
+					}
+					try
+					{ Submit(urb, generation); }
+					catch(...)
+					{ idle.push_back(urb); throw; }
+					queue.push_back(urb);
+				}
 
-			if (_capabilities & USBDEVFS_CAP_BULK_CONTINUATION)
+				Urb *urb = ReapQueued(queue, started? stallTimeout: timeout);
+				started = true;
+				idle.push_back(urb);
+				urb->CheckStatus();
+			}
+		}
+		catch(const std::exception &ex)
+		{
+			if (!queue.empty())
 			{
-				urb.SetContinuationFlag(continuation);
-				continuation = true;
+				error("error while writing bulk data: ", ex.what());
+				DiscardQueued(queue, timeout);
 			}
-			Submit(&urb, timeout);
+			throw;
 		}
-		while(r == transferSize);
+		UpdateTransferSize(ep, urbTransferSize, fullUrbs);
 	}
 
 	void Device::ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout)
 	{
-		Urb urb(*_bufferAllocator, _fd.Get(), USBDEVFS_URB_TYPE_BULK, ep);
-		size_t transferSize = urb.GetTransferSize();
+		UrbStorage urbs;
+		std::deque<Urb *> idle, queue;
+
+		//without continuation support the kernel does not stop queued urbs on short packet, so they would eat next transfer
+		bool pipelined = (_capabilities & USBDEVFS_CAP_BULK_CONTINUATION) && _urbQueueDepth > 1;
+		unsigned depth = pipelined? _urbQueueDepth.load(): 1;
+		unsigned generation = GetCancelGeneration(ep);
+		int stallTimeout = GetStallTimeout(timeout);
+		size_t urbTransferSize = GetTransferSize(ep);
+		size_t fullUrbs = 0;
 
-		size_t r;
 		bool continuation = false;
-		do
+		bool done = false;
+		bool started = false;
+		try
 		{
-			if (_capabilities & USBDEVFS_CAP_BULK_CONTINUATION)
+			while(!done)
 			{
-				urb.SetContinuationFlag(continuation);
-				continuation = true;
-			}
-			Submit(&urb, timeout);
+				while(queue.size() < depth)
+				{
+					//first urb is usually enough for the whole response, use large ones only for the data that follows
+					bool large = _largeUrbTransferSize && continuation;
+					Urb *urb = AcquireUrb(urbs, idle, ep, large? _largeUrbTransferSize: urbTransferSize);
+					urb->PrepareRecv();
+					urb->SetShortNotOkFlag(pipelined);
+
+					bool submitted = true;
+					try
+					{
+						if (_capabilities & USBDEVFS_CAP_BULK_CONTINUATION)
+						{
+							urb->SetContinuationFlag(continuation);
+							if (continuation)
+								submitted = SubmitContinuation(urb, generation);
+							else
+								Submit(urb, generation);
+							continuation = true;
+						}
+						else
+							Submit(urb, generation);
+					}
+					catch(...)
+					{ idle.push_back(urb); throw; }
+
+					if (!submitted)
+					{
+						idle.push_back(urb);
+						break; //short packet already arrived
+					}
+					queue.push_back(urb);
+				}
+
+				//once device started sending, long pause means stalled transfer rather than slow operation
+				Urb *urb = ReapQueued(queue, started? stallTimeout: timeout);
+				started = true;
+				idle.push_back(urb);
+				urb->CheckStatus();
 
-			r = urb.Recv(outputStream);
+				urb->Recv(outputStream);
+				done = static_cast<size_t>(urb->actual_length) != urb->GetTransferSize();
+				if (!done && urb->GetTransferSize() == Urb::GetTransferSize(ep, urbTransferSize))
+					++fullUrbs;
+			}
 		}
-		while(r == transferSize);
+		catch(const std::exception &ex)
+		{
+			if (!queue.empty())
+			{
+				error("error while reading bulk data: ", ex.what());
+				DiscardQueued(queue, timeout);
+			}
+			throw;
+		}
+
+		//kernel cancels continuation urbs queued after short packet, collect them
+		DiscardQueued(queue, timeout);
+		UpdateTransferSize(ep, urbTransferSize, fullUrbs);
 	}
 
 	u8 Device::TransactionType(const EndpointPtr &ep)
@@ -330,7 +825,7 @@ namespace mtp { namespace usb
 
 	void Device::ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout)
 	{
-		debug("read control ", hex(type, 2), " ", hex(req, 2), " ", hex(value, 4), " ", hex(index, 4));
+		MTP_DEBUG_CATEGORY(LogUsb, "read control ", hex(type, 2), " ", hex(req, 2), " ", hex(value, 4), " ", hex(index, 4));
 		usbdevfs_ctrltransfer ctrl = { };
 		ctrl.bRequestType = type;
 		ctrl.bRequest = req;
@@ -353,7 +848,7 @@ namespace mtp { namespace usb
 
 	void Device::WriteControl(u8 type, u8 req, u16 value, u16 index, const ByteArray &data, int timeout)
 	{
-		debug("write control ", hex(type, 2), " ", hex(req, 2), " ", hex(value, 4), " ", hex(index, 4));
+		MTP_DEBUG_CATEGORY(LogUsb, "write control ", hex(type, 2), " ", hex(req, 2), " ", hex(value, 4), " ", hex(index, 4));
 		usbdevfs_ctrltransfer ctrl = { };
 		ctrl.bRequestType = type;
 		ctrl.bRequest = req;
@@ -23,12 +23,26 @@
 #include <mtp/types.h>
 #include <mtp/ByteArray.h>
 #include <usb/Interface.h>
+#include <usb/UrbTrace.h>
+#include <mtp/usb/BufferPool.h>
+#include <mtp/usb/ReaperPolicy.h>
+#include <mtp/usb/TransferStats.h>
 #include <mtp/ptp/IObjectStream.h>
 #include <mtp/Token.h>
 #include <FileHandler.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <queue>
+#include <set>
+#include <thread>
 #include <functional>
+#include <vector>
 
 namespace mtp { namespace usb
 {
@@ -49,20 +63,100 @@ namespace mtp { namespace usb
 
 	class Device : Noncopyable
 	{
+	public:
+		static const unsigned	DefaultUrbQueueDepth	= 4;
+		static const size_t		MaxUsbfsTransferSize	= 16384; //kernels without NO_PACKET_SIZE_LIM reject larger urbs
+
 	private:
 		posix::FileHandler			_fd;
 		u32							_capabilities;
 		EndpointPtr					_controlEp;
 		BufferAllocatorPtr			_bufferAllocator;
+		std::atomic<unsigned>		_urbQueueDepth; //may be changed by bus scheduler while transfer runs, next batch of urbs picks it up
+		size_t						_transferSize; //0 for automatic
+		std::atomic<int>			_stallTimeout;
+		size_t						_largeUrbTransferSize; //0 if kernel can't split large urbs
+		std::map<u8, size_t>		_autoTransferSize;
 
 		struct Urb;
 		//DECLARE_PTR(Urb);
+		typedef std::vector<std::unique_ptr<Urb>> UrbStorage;
+
+		//urbs may be reaped by any thread, completions are routed to their owners via _completed
+		std::mutex					_reapMutex;
+		std::condition_variable		_reapCondition;
+		bool						_reaping;
+		bool						_externalReaping; //completions are processed by caller's event loop, transfers never poll
+		bool						_lost; //reaping failed with ENODEV, waiting transfers give up
+		std::set<void *>			_inflight;
+		std::set<void *>			_completed;
 		std::queue<std::function<void ()>>	_controls;
+		std::map<u8, unsigned>		_cancelGeneration; //by endpoint address, bumped by Cancel
+		TransferStats				_stats; //guarded by _reapMutex
+		UrbTrace					_trace; //guarded by _reapMutex
+
+		//optional completion thread, transfers wait for it the same way as for external event loop
+		std::thread					_reaper;
+		int							_reaperWakeup; //eventfd interrupting reaper poll, -1 if reaper is not running
+		std::atomic<bool>			_reaperStop;
 
 	public:
 		Device(int fd, const EndpointPtr &controlEp);
 		~Device();
 
+		///sets number of bulk urbs kept in flight per transfer
+		void SetUrbQueueDepth(unsigned depth);
+		unsigned GetUrbQueueDepth() const
+		{ return _urbQueueDepth.load(); }
+
+		///sets size of every single bulk urb, rounded to endpoint packet size, 0 selects it automatically
+		void SetTransferSize(size_t size)
+		{ _transferSize = size; }
+		size_t GetTransferSize() const
+		{ return _transferSize; }
+
+		///limits wait for every chunk after the first one of bulk transfer, so stalled transfer fails fast, 0 disables
+		void SetStallTimeout(int timeout)
+		{ _stallTimeout.store(timeout); }
+		///stall timeout clamped to transfer timeout
+		int GetStallTimeout(int timeout) const
+		{
+			int stall = _stallTimeout.load();
+			return stall > 0 && stall < timeout? stall: timeout;
+		}
+
+		///returns true if urb buffers are mapped from usbfs and kernel does not copy data
+		bool IsZeroCopy() const;
+
+		///urb buffers of this device, upper layers may borrow them to avoid copies, they must be returned before device is closed
+		BufferPoolPtr GetBufferPool() const;
+
+		///limits memory held by urb buffer pool
+		void SetBufferPoolLimit(size_t limit);
+
+		///returns snapshot of urb counters since device was opened
+		TransferStats GetTransferStats();
+
+		///keeps last submit/reap events of bulk urbs, 0 disables tracing
+		void SetTraceCapacity(size_t records);
+		///writes traced urbs in chrome trace event format
+		void WriteTrace(std::ostream &os);
+
+		///usbfs descriptor becomes writable (POLLOUT) when urbs have completed, register it in event loop (QSocketNotifier::Write, epoll EPOLLOUT)
+		int GetPollFd() const
+		{ return _fd.Get(); }
+		///transfers stop polling usbfs themselves and wait for ProcessCompletions called by event loop, set it before any transfer starts
+		void SetExternalReaping(bool external);
+		bool GetExternalReaping() const
+		{ return _externalReaping; }
+		///reaps completed urbs without blocking and wakes transfers waiting for them, returns number of urbs reaped
+		///safe to call from any thread in either mode
+		size_t ProcessCompletions();
+
+		///starts thread reaping urbs of this device with given scheduling and cpu affinity, so completions are handled even if transfer threads are descheduled
+		///disabled policy stops it, must not be combined with external reaping of event loop, fork does not inherit the thread
+		void SetReaper(const ReaperPolicy &policy);
+
 		InterfaceTokenPtr ClaimInterface(const InterfacePtr & interface)
 		{ return std::make_shared<InterfaceToken>(_fd.Get(), interface->GetIndex()); }
 
@@ -72,14 +166,27 @@ namespace mtp { namespace usb
 		void ClearHalt(const EndpointPtr & ep);
 		void WriteBulk(const EndpointPtr & ep, const IObjectInputStreamPtr &inputStream, int timeout);
 		void ReadBulk(const EndpointPtr & ep, const IObjectOutputStreamPtr &outputStream, int timeout);
+		///discards urbs in flight on endpoint, transfer running in other thread throws OperationCancelledException as soon as they are reaped
+		void Cancel(const EndpointPtr & ep);
 
 		void WriteControl(u8 type, u8 req, u16 value, u16 index, const ByteArray &data, int timeout);
 		void ReadControl(u8 type, u8 req, u16 value, u16 index, ByteArray &data, int timeout); //result buffer must be allocated
 
 	private:
 		static u8 TransactionType(const EndpointPtr &ep);
-		void * Reap(int timeout);
-		void Submit(Urb *urb, int timeout);
+		void * Reap(std::chrono::steady_clock::time_point deadline, bool wait);
+		unsigned GetCancelGeneration(const EndpointPtr &ep);
+		void Submit(Urb *urb, unsigned generation);
+		bool SubmitContinuation(Urb *urb, unsigned generation);
+		size_t GetTransferSize(const EndpointPtr &ep);
+		void UpdateTransferSize(const EndpointPtr &ep, size_t transferSize, size_t fullUrbs);
+		Urb * AcquireUrb(UrbStorage &urbs, std::deque<Urb *> &idle, const EndpointPtr &ep, size_t size);
+		Urb * ReapQueued(std::deque<Urb *> &queue, int timeout);
+		void Account(const Urb *urb); //called with _reapMutex held
+		void Complete(void *kernelUrb); //called with _reapMutex held
+		void DiscardQueued(std::deque<Urb *> &queue, int timeout);
+		void StopReaper();
+		void RunReaper(ReaperPolicy policy);
 	};
 	DECLARE_PTR(Device);
 }}
@@ -93,6 +93,13 @@ namespace mtp { namespace usb
 
 		ByteArray GetDescriptor() const
 		{ return _descriptor; }
+
+		///sysfs device name, e.g. 1-2.3
+		std::string GetBusPath() const
+		{
+			size_t pos = _path.rfind('/');
+			return pos != _path.npos? _path.substr(pos + 1): _path;
+		}
 	};
 	DECLARE_PTR(DeviceDescriptor);
 
@@ -0,0 +1,129 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <usb/HotplugMonitor.h>
+#include <Exception.h>
+#include <mtp/log.h>
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+namespace mtp { namespace usb
+{
+	namespace
+	{
+		int OpenUeventSocket()
+		{
+			int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+			if (fd == -1)
+				throw posix::Exception("socket(NETLINK_KOBJECT_UEVENT)");
+
+			sockaddr_nl addr = { };
+			addr.nl_family = AF_NETLINK;
+			addr.nl_groups = 1; //kernel events, udev is not needed
+			if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+			{
+				int err = errno;
+				close(fd);
+				throw posix::Exception("bind", err);
+			}
+			return fd;
+		}
+	}
+
+	HotplugMonitor::HotplugMonitor(const Callback &callback): _callback(callback), _socket(OpenUeventSocket())
+	{
+		if (pipe(_wakeup) == -1)
+			throw posix::Exception("pipe");
+		_thread = std::thread([this]() { Run(); });
+	}
+
+	HotplugMonitor::~HotplugMonitor()
+	{
+		char c = 0;
+		if (write(_wakeup[1], &c, 1) == -1)
+			error("HotplugMonitor: wakeup failed: ", posix::Exception::GetErrorMessage(errno));
+		_thread.join();
+		close(_wakeup[0]);
+		close(_wakeup[1]);
+	}
+
+	void HotplugMonitor::Run()
+	{
+		char buf[8192];
+		while(true)
+		{
+			pollfd fds[2] = { { _socket.Get(), POLLIN, 0 }, { _wakeup[0], POLLIN, 0 } };
+			int r = poll(fds, 2, -1);
+			if (r == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				error("HotplugMonitor: poll failed: ", posix::Exception::GetErrorMessage(errno));
+				return;
+			}
+			if (fds[1].revents)
+				return;
+
+			ssize_t size = recv(_socket.Get(), buf, sizeof(buf) - 1, 0);
+			if (size <= 0)
+				continue;
+			buf[size] = 0;
+			try
+			{ Process(buf, size); }
+			catch(const std::exception &ex)
+			{ error("HotplugMonitor: callback failed: ", ex.what()); }
+		}
+	}
+
+	void HotplugMonitor::Process(const char *data, size_t size)
+	{
+		//header "action@devpath" followed by zero separated KEY=value pairs
+		std::string action, devPath, subsystem, devType;
+		for(size_t offset = strlen(data) + 1; offset < size; offset += strlen(data + offset) + 1)
+		{
+			const char *var = data + offset;
+			if (strncmp(var, "ACTION=", 7) == 0)
+				action = var + 7;
+			else if (strncmp(var, "DEVPATH=", 8) == 0)
+				devPath = var + 8;
+			else if (strncmp(var, "SUBSYSTEM=", 10) == 0)
+				subsystem = var + 10;
+			else if (strncmp(var, "DEVTYPE=", 8) == 0)
+				devType = var + 8;
+		}
+		if (subsystem != "usb" || devType != "usb_device")
+			return;
+
+		size_t pos = devPath.rfind('/');
+		std::string busPath = pos != devPath.npos? devPath.substr(pos + 1): devPath;
+		MTP_DEBUG("HotplugMonitor: ", action, " ", busPath);
+
+		//bind comes after interfaces are created, add is kept for kernels not sending bind
+		if (action == "bind" || action == "add")
+			_callback(Action::Added, busPath);
+		else if (action == "remove")
+			_callback(Action::Removed, busPath);
+	}
+
+}}
@@ -0,0 +1,61 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_BACKEND_LINUX_USB_HOTPLUGMONITOR_H
+#define AFT_BACKEND_LINUX_USB_HOTPLUGMONITOR_H
+
+#include <mtp/types.h>
+#include <FileHandler.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace mtp { namespace usb
+{
+	class HotplugMonitor : Noncopyable //! listens to kernel uevents and reports usb devices appearing and disappearing, callback is invoked from monitor thread
+	{
+	public:
+		enum struct Action
+		{
+			Added,		///< device bound to usb core, interfaces are available
+			Removed
+		};
+		typedef std::function<void (Action, const std::string &busPath)> Callback;
+
+	private:
+		Callback			_callback;
+		posix::FileHandler	_socket;
+		int					_wakeup[2];
+		std::thread			_thread;
+
+		void Run();
+		void Process(const char *data, size_t size);
+
+	public:
+		HotplugMonitor(const Callback &callback);
+		~HotplugMonitor();
+
+		static bool IsSupported()
+		{ return true; }
+	};
+	DECLARE_PTR(HotplugMonitor);
+
+}}
+
+#endif
@@ -29,6 +29,11 @@ namespace mtp { namespace usb
 		_class		= Directory::ReadInt(path + "/bInterfaceClass");
 		_subclass	= Directory::ReadInt(path + "/bInterfaceSubClass");
 		_index		= Directory::ReadInt(path + "/bInterfaceNumber");
+		if (access((path + "/interface").c_str(), R_OK) == 0)
+		{
+			try { _name = Directory::ReadString(path + "/interface"); }
+			catch(const std::exception &) { }
+		}
 
 		Directory dir(path);
 		while(true)
@@ -37,6 +37,7 @@ namespace mtp { namespace usb
 	class Interface
 	{
 		std::string					_path;
+		std::string					_name;
 		std::vector<EndpointPtr>	_endpoints;
 		u8							_class;
 		u8							_subclass;
@@ -55,6 +56,10 @@ namespace mtp { namespace usb
 		int GetIndex() const
 		{ return _index; }
 
+		///interface string exported by kernel in sysfs, empty if device has none, no device i/o
+		const std::string & GetName() const
+		{ return _name; }
+
 		EndpointPtr GetEndpoint(int idx) const
 		{ return _endpoints.at(idx); }
 
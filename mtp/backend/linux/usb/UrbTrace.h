@@ -0,0 +1,135 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_BACKEND_LINUX_USB_URBTRACE_H
+#define AFT_BACKEND_LINUX_USB_URBTRACE_H
+
+#include <mtp/types.h>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <set>
+#include <vector>
+
+namespace mtp { namespace usb
+{
+
+	class UrbTrace //! fixed size ring of urb submit/reap events, not synchronised, written as chrome trace event json
+	{
+	public:
+		enum struct Event : u8
+		{
+			Submit, Reap
+		};
+
+		struct Record
+		{
+			u64		Time; //ns, steady clock
+			u64		Urb;
+			u32		Length; //requested on submit, actual on reap
+			s32		Status;
+			u8		Endpoint;
+			Event	Type;
+		};
+
+	private:
+		std::vector<Record>		_records;
+		size_t					_next;
+		bool					_wrapped;
+
+	public:
+		UrbTrace(): _next(0), _wrapped(false)
+		{ }
+
+		///0 disables tracing and frees the ring
+		void SetCapacity(size_t records)
+		{
+			std::vector<Record> ring;
+			ring.resize(records);
+			_records.swap(ring);
+			_next = 0;
+			_wrapped = false;
+		}
+
+		bool Enabled() const
+		{ return !_records.empty(); }
+
+		void Add(Event type, const void *urb, u8 endpoint, u32 length, s32 status)
+		{
+			if (_records.empty())
+				return;
+
+			Record &record = _records[_next];
+			record.Time		= std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			record.Urb		= reinterpret_cast<uintptr_t>(urb);
+			record.Length	= length;
+			record.Status	= status;
+			record.Endpoint	= endpoint;
+			record.Type		= type;
+			if (++_next == _records.size())
+			{
+				_next = 0;
+				_wrapped = true;
+			}
+		}
+
+		///records in chronological order
+		std::vector<Record> GetRecords() const
+		{
+			std::vector<Record> records;
+			if (_wrapped)
+				records.insert(records.end(), _records.begin() + _next, _records.end());
+			records.insert(records.end(), _records.begin(), _records.begin() + _next);
+			return records;
+		}
+
+		///writes async begin/end event per urb, one track per endpoint, loadable by chrome://tracing and perfetto
+		static void Write(std::ostream &os, const std::vector<Record> &records)
+		{
+			std::set<u64> submitted; //reaps of urbs submitted before the ring start are skipped
+			u64 start = records.empty()? 0: records.front().Time;
+			os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+			bool first = true;
+			for(auto & record : records)
+			{
+				bool submit = record.Type == Event::Submit;
+				if (submit)
+					submitted.insert(record.Urb);
+				else if (submitted.erase(record.Urb) == 0)
+					continue;
+
+				os << (first? "\n": ",\n");
+				first = false;
+				os << "{\"name\":\"" << ((record.Endpoint & 0x80)? "in": "out") << "\",\"cat\":\"urb\",\"ph\":\"" << (submit? 'b': 'e') << "\"";
+				os << ",\"id\":\"0x" << std::hex << record.Urb << std::dec << "\"";
+				os << ",\"pid\":1,\"tid\":" << static_cast<unsigned>(record.Endpoint);
+				u64 ns = record.Time - start;
+				os << ",\"ts\":" << ns / 1000 << "." << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+				os << ",\"args\":{\"" << (submit? "length": "actual") << "\":" << record.Length;
+				if (!submit)
+					os << ",\"status\":" << record.Status;
+				os << "}}";
+			}
+			os << "\n]}\n";
+		}
+	};
+
+}}
+
+#endif
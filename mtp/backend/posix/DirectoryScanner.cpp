@@ -0,0 +1,222 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <DirectoryScanner.h>
+#include <Exception.h>
+#include <FileHandler.h>
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mtp { namespace posix
+{
+
+	DirectoryScanner::DirectoryScanner(const std::string &root, unsigned threads):
+		_root(root), _busy(0), _finished(false), _stopped(false)
+	{
+		int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			throw Exception("open " + root);
+		close(fd);
+
+		_tasks.push_back(Task());
+		if (!threads)
+			threads = std::max(4u, std::thread::hardware_concurrency()); //stat is mostly waiting for disk
+		for(unsigned i = 0; i < threads; ++i)
+			_threads.emplace_back(&DirectoryScanner::Run, this);
+	}
+
+	DirectoryScanner::~DirectoryScanner()
+	{
+		{
+			scoped_mutex_lock l(_mutex);
+			_stopped = true;
+		}
+		_taskAdded.notify_all();
+		for(auto &thread : _threads)
+			thread.join();
+	}
+
+	void DirectoryScanner::Run()
+	{
+		scoped_mutex_lock l(_mutex);
+		while(true)
+		{
+			_taskAdded.wait(l, [this] { return _stopped || _finished || !_tasks.empty(); });
+			if (_stopped || _tasks.empty())
+				return;
+
+			Task task = std::move(_tasks.front());
+			_tasks.pop_front();
+			++_busy;
+			l.unlock();
+
+			std::vector<Entry> entries;
+			std::vector<Task> tasks;
+			if (task.Directory)
+				Stat(task, entries, tasks);
+			else
+				List(task, entries, tasks);
+
+			l.lock();
+			--_busy;
+			//entries go first, children of passed directories are listed only after that
+			for(auto &entry : entries)
+				_entries.push_back(std::move(entry));
+			for(auto &t : tasks)
+			{
+				//stats hold directory open, finishing them first keeps number of open descriptors low
+				if (t.Directory)
+					_tasks.push_front(std::move(t));
+				else
+					_tasks.push_back(std::move(t));
+			}
+			if (_tasks.empty() && _busy == 0)
+				_finished = true;
+
+			if (!entries.empty() || _finished)
+				_entryAdded.notify_all();
+			if (!tasks.empty() || _finished)
+				_taskAdded.notify_all();
+		}
+	}
+
+	void DirectoryScanner::List(const Task &task, std::vector<Entry> &entries, std::vector<Task> &tasks)
+	{
+		std::string path = task.Prefix.empty()? _root: _root + "/" + task.Prefix;
+		int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		auto directory = std::make_shared<FileHandler>(fd);
+		int listFd = dup(fd); //closedir closes descriptor, stats are using directory after listing
+		DIR *dir = listFd >= 0? fdopendir(listFd): nullptr;
+		if (!dir)
+		{
+			if (listFd >= 0)
+				close(listFd);
+			return;
+		}
+
+		Task stat;
+		while(dirent *entry = readdir(dir))
+		{
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+				continue;
+
+			switch(entry->d_type)
+			{
+			case DT_DIR:
+				{
+					Entry dirEntry;
+					dirEntry.Path = GetPath(task.Prefix, entry->d_name);
+					dirEntry.Directory = true;
+					Task list;
+					list.Prefix = dirEntry.Path;
+					entries.push_back(std::move(dirEntry));
+					tasks.push_back(std::move(list));
+				}
+				break;
+			case DT_REG:
+			case DT_LNK:
+			case DT_UNKNOWN:
+				stat.Names.push_back(entry->d_name);
+				if (stat.Names.size() >= StatChunkSize)
+				{
+					stat.Directory = directory;
+					stat.Prefix = task.Prefix;
+					tasks.push_back(std::move(stat));
+					stat = Task();
+				}
+				break;
+			default:
+				break; //devices, fifos and sockets could not be uploaded
+			}
+		}
+		closedir(dir);
+
+		if (!stat.Names.empty())
+		{
+			stat.Directory = directory;
+			stat.Prefix = task.Prefix;
+			tasks.push_back(std::move(stat));
+		}
+	}
+
+	void DirectoryScanner::Stat(const Task &task, std::vector<Entry> &entries, std::vector<Task> &tasks)
+	{
+		int fd = task.Directory->Get();
+		for(auto &name : task.Names)
+		{
+			struct stat st = {};
+			if (fstatat(fd, name.c_str(), &st, 0) != 0)
+				continue;
+
+			Entry entry;
+			entry.Path = GetPath(task.Prefix, name);
+			if (S_ISDIR(st.st_mode))
+			{
+				struct stat lst = {};
+				if (fstatat(fd, name.c_str(), &lst, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(lst.st_mode))
+					continue; //symlinked directories are not followed, they may loop
+
+				entry.Directory = true;
+				Task list;
+				list.Prefix = entry.Path;
+				tasks.push_back(std::move(list));
+			}
+			else if (S_ISREG(st.st_mode))
+			{
+				entry.Size = st.st_size;
+				entry.ModificationTime = st.st_mtime;
+			}
+			else
+				continue;
+			entries.push_back(std::move(entry));
+		}
+	}
+
+	size_t DirectoryScanner::Fetch(std::vector<Entry> &entries, size_t max)
+	{
+		scoped_mutex_lock l(_mutex);
+		_entryAdded.wait(l, [this] { return _finished || !_entries.empty(); });
+		size_t n = 0;
+		while(n < max && !_entries.empty())
+		{
+			entries.push_back(std::move(_entries.front()));
+			_entries.pop_front();
+			++n;
+		}
+		return n;
+	}
+
+	bool DirectoryScanner::Next(Entry &entry)
+	{
+		std::vector<Entry> entries;
+		if (!Fetch(entries, 1))
+			return false;
+		entry = std::move(entries.front());
+		return true;
+	}
+
+}}
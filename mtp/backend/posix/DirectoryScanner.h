@@ -0,0 +1,89 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef POSIX_DIRECTORYSCANNER_H
+#define POSIX_DIRECTORYSCANNER_H
+
+#include <mtp/types.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+namespace mtp { namespace posix
+{
+	class FileHandler;
+
+	class DirectoryScanner : Noncopyable //! lists local tree and stats its files from thread pool, entries are passed as soon as they're ready, directory always comes before its contents
+	{
+	public:
+		struct Entry
+		{
+			std::string		Path; //relative to scanned root
+			bool			Directory;
+			u64				Size;
+			time_t			ModificationTime;
+
+			Entry(): Directory(false), Size(0), ModificationTime(0) { }
+		};
+
+		static const size_t StatChunkSize = 64;
+
+	private:
+		struct Task
+		{
+			std::shared_ptr<FileHandler>	Directory; //listed directory, null if Prefix still has to be listed
+			std::string						Prefix;
+			std::vector<std::string>		Names; //names in Directory to stat
+		};
+
+		std::string					_root;
+		std::mutex					_mutex;
+		std::condition_variable		_taskAdded, _entryAdded;
+		std::deque<Task>			_tasks;
+		std::deque<Entry>			_entries;
+		unsigned					_busy;
+		bool						_finished;
+		bool						_stopped;
+		std::vector<std::thread>	_threads;
+
+		std::string GetPath(const std::string &prefix, const std::string &name) const
+		{ return prefix.empty()? name: prefix + "/" + name; }
+
+		void Run();
+		void List(const Task &task, std::vector<Entry> &entries, std::vector<Task> &tasks);
+		void Stat(const Task &task, std::vector<Entry> &entries, std::vector<Task> &tasks);
+
+	public:
+		///starts scanning root in background, throws if root could not be opened, threads = 0 picks default pool size
+		DirectoryScanner(const std::string &root, unsigned threads = 0);
+		~DirectoryScanner();
+
+		///waits for at least one entry and appends up to max ready entries, returns 0 when scan is complete
+		size_t Fetch(std::vector<Entry> &entries, size_t max = StatChunkSize);
+		///waits for next entry, returns false when scan is complete
+		bool Next(Entry &entry);
+	};
+}}
+
+#endif
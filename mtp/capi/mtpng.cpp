@@ -0,0 +1,453 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/capi/mtpng.h>
+#include <mtp/ptp/Device.h>
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/Response.h>
+#include <mtp/usb/DeviceNotFoundException.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/log.h>
+#include <mtp/version.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct mtpng_session //! C handle owning device, its session and operation being run on it
+{
+	mtp::DevicePtr				Device;
+	mtp::SessionPtr				Session;
+	std::string					BusPath, Serial, Manufacturer, Model;
+
+	std::mutex					Mutex;
+	mtp::ICancellableStreamPtr	Current; //stream of running transfer, cancelled by mtpng_cancel
+	std::atomic_bool			Cancelled;
+
+	mtpng_session(): Cancelled(false)
+	{ }
+};
+
+namespace
+{
+	using namespace mtp;
+
+	const size_t DefaultBatch = 64;
+
+	thread_local std::string	LastError;
+	thread_local u16			LastResponse;
+
+	struct CallbackFailedException : public OperationCancelledException //! user callback returned short count, derived from cancellation so packeter resyncs the pipe
+	{
+		const char * what() const noexcept override
+		{ return "user callback failed"; }
+	};
+
+	class Operation : Noncopyable //! marks operation running on session for mtpng_cancel
+	{
+		mtpng_session *	_session;
+
+	public:
+		Operation(mtpng_session *session): _session(session)
+		{ _session->Cancelled.store(false); }
+
+		~Operation()
+		{
+			scoped_mutex_lock l(_session->Mutex);
+			_session->Current.reset();
+		}
+
+		void SetStream(const ICancellableStreamPtr &stream)
+		{
+			scoped_mutex_lock l(_session->Mutex);
+			_session->Current = stream;
+			if (_session->Cancelled.load())
+				stream->Cancel();
+		}
+
+		void CheckCancelled() const
+		{
+			if (_session->Cancelled.load())
+				throw OperationCancelledException();
+		}
+	};
+
+	class CallbackOutputStream final : public IObjectOutputStream, public CancellableStream //! passes received data to user write callback
+	{
+		mtpng_write_callback	_callback;
+		void *					_user;
+
+	public:
+		CallbackOutputStream(mtpng_write_callback callback, void *user): _callback(callback), _user(user)
+		{ }
+
+		size_t Write(const u8 *data, size_t size) override
+		{
+			CheckCancelled();
+			if (_callback(_user, data, size) != size)
+				throw CallbackFailedException();
+			return size;
+		}
+	};
+
+	class CallbackInputStream final : public IObjectInputStream, public CancellableStream //! fills requested size from user read callback, short reads are treated as end of stream by packeter
+	{
+		mtpng_read_callback		_callback;
+		void *					_user;
+		u64						_size;
+		u64						_offset;
+
+	public:
+		CallbackInputStream(mtpng_read_callback callback, void *user, u64 size): _callback(callback), _user(user), _size(size), _offset(0)
+		{ }
+
+		u64 GetSize() const override
+		{ return _size; }
+
+		size_t Read(u8 *data, size_t size) override
+		{
+			CheckCancelled();
+			size = std::min<u64>(size, _size - _offset);
+			size_t done = 0;
+			while(done < size)
+			{
+				size_t r = _callback(_user, data + done, size - done);
+				if (r == 0 || r > size - done)
+					throw CallbackFailedException();
+				done += r;
+			}
+			_offset += done;
+			return done;
+		}
+	};
+
+	int Fail(int status, const char *message)
+	{
+		LastError = message;
+		debug("mtpng: ", message);
+		return status;
+	}
+
+	///runs func, translating exceptions into status codes, nothing is thrown across C boundary
+	template<typename Func>
+	int Run(Func && func)
+	{
+		try
+		{
+			func();
+			LastError.clear();
+			return MTPNG_OK;
+		}
+		catch(const CallbackFailedException &ex)
+		{ return Fail(MTPNG_CALLBACK_FAILED, ex.what()); }
+		catch(const OperationCancelledException &ex)
+		{ return Fail(MTPNG_CANCELLED, ex.what()); }
+		catch(const std::invalid_argument &ex)
+		{ return Fail(MTPNG_INVALID_ARGUMENT, ex.what()); }
+		catch(const usb::DeviceNotFoundException &ex)
+		{ return Fail(MTPNG_NOT_FOUND, ex.what()); }
+		catch(const usb::TimeoutException &ex)
+		{ return Fail(MTPNG_TIMEOUT, ex.what()); }
+		catch(const InvalidResponseException &ex)
+		{
+			LastResponse = static_cast<u16>(ex.Type);
+			return Fail(MTPNG_DEVICE_ERROR, ex.what());
+		}
+		catch(const std::exception &ex)
+		{ return Fail(MTPNG_ERROR, ex.what()); }
+		catch(...)
+		{ return Fail(MTPNG_ERROR, "unknown error"); }
+	}
+
+	void CheckArgument(bool valid, const char *message)
+	{
+		if (!valid)
+			throw std::invalid_argument(message);
+	}
+
+	void FillObjectInfo(ObjectId id, const msg::ObjectInfo &info, mtpng_object_info &object)
+	{
+		object.id					= id.Id;
+		object.storage_id			= info.StorageId.Id;
+		object.parent_id			= info.ParentObject.Id;
+		object.format				= static_cast<u16>(info.ObjectFormat);
+		object.is_directory			= info.ObjectFormat == ObjectFormat::Association;
+		object.size					= info.ObjectSize;
+		object.modification_time	= ConvertDateTime(info.ModificationDate);
+		object.filename				= info.Filename.c_str();
+	}
+
+	void ReportObjects(mtpng_session *session, const std::vector<ObjectId> &ids, const std::vector<msg::ObjectInfo> &infos, size_t begin, size_t end,
+		mtpng_list_callback callback, void *user)
+	{
+		std::vector<mtpng_object_info> objects;
+		objects.reserve(end - begin);
+		for(size_t i = begin; i < end; ++i)
+		{
+			if (infos[i].Filename.empty())
+				continue; //could not be queried
+			objects.push_back(mtpng_object_info());
+			FillObjectInfo(ids[i], infos[i], objects.back());
+		}
+		if (!objects.empty() && callback(user, objects.data(), objects.size()))
+			throw OperationCancelledException();
+	}
+}
+
+extern "C"
+{
+
+int mtpng_api_version(void)
+{ return MTPNG_API_VERSION; }
+
+const char * mtpng_version(void)
+{
+	static const std::string version = GetVersion();
+	return version.c_str();
+}
+
+const char * mtpng_last_error(void)
+{ return LastError.c_str(); }
+
+uint16_t mtpng_last_response(void)
+{ return LastResponse; }
+
+int mtpng_enumerate(mtpng_device_callback callback, void *user)
+{
+	return Run([&]()
+	{
+		CheckArgument(callback, "callback is required");
+		for(auto & device : Device::FindAll(false))
+		{
+			msg::DeviceInfo info;
+			try
+			{ info = device->GetInfo(); }
+			catch(const std::exception &ex)
+			{
+				error("mtpng: device ", device->GetBusPath(), " did not report its info: ", ex.what());
+				continue;
+			}
+			mtpng_device_desc desc = { };
+			desc.bus_path		= device->GetBusPath().c_str();
+			desc.serial			= info.SerialNumber.c_str();
+			desc.manufacturer	= info.Manufacturer.c_str();
+			desc.model			= info.Model.c_str();
+			desc.vendor_id		= device->GetVendorId();
+			desc.product_id		= device->GetProductId();
+			if (callback(user, &desc))
+				throw OperationCancelledException();
+		}
+	});
+}
+
+int mtpng_session_open(const char *id, mtpng_session **session)
+{
+	return Run([&]()
+	{
+		CheckArgument(session, "session is required");
+		*session = nullptr;
+		DevicePtr device = id? Device::Find(id): Device::FindFirst();
+		if (!device)
+			throw usb::DeviceNotFoundException();
+
+		std::unique_ptr<mtpng_session> handle(new mtpng_session);
+		handle->Session = device->OpenSession(1);
+		handle->Device = device;
+		const msg::DeviceInfo &info = handle->Session->GetDeviceInfo();
+		handle->BusPath			= device->GetBusPath();
+		handle->Serial			= info.SerialNumber;
+		handle->Manufacturer	= info.Manufacturer;
+		handle->Model			= info.Model;
+		*session = handle.release();
+	});
+}
+
+void mtpng_session_close(mtpng_session *session)
+{
+	try
+	{ delete session; }
+	catch(const std::exception &ex)
+	{ error("mtpng: closing session failed: ", ex.what()); }
+}
+
+int mtpng_session_get_device(mtpng_session *session, mtpng_device_desc *device)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && device, "session and device are required");
+		device->bus_path		= session->BusPath.c_str();
+		device->serial			= session->Serial.c_str();
+		device->manufacturer	= session->Manufacturer.c_str();
+		device->model			= session->Model.c_str();
+		device->vendor_id		= session->Device->GetVendorId();
+		device->product_id		= session->Device->GetProductId();
+	});
+}
+
+int mtpng_list_storages(mtpng_session *session, mtpng_storage_callback callback, void *user)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && callback, "session and callback are required");
+		Operation operation(session);
+		for(StorageId id : session->Session->GetStorageIDs().StorageIDs)
+		{
+			operation.CheckCancelled();
+			msg::StorageInfo info = session->Session->GetStorageInfo(id);
+			mtpng_storage_info storage = { };
+			storage.id				= id.Id;
+			storage.capacity		= info.MaxCapacity;
+			storage.free_space		= info.FreeSpaceInBytes;
+			storage.description		= info.StorageDescription.c_str();
+			storage.volume_label	= info.VolumeLabel.c_str();
+			if (callback(user, &storage))
+				throw OperationCancelledException();
+		}
+	});
+}
+
+int mtpng_list(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, size_t batch, mtpng_list_callback callback, void *user)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && callback, "session and callback are required");
+		Operation operation(session);
+		if (!batch)
+			batch = DefaultBatch;
+
+		const SessionPtr &s = session->Session;
+		ObjectId parent(parent_id);
+		std::vector<ObjectId> ids = s->GetObjectHandles(StorageId(storage_id), ObjectFormat::Any, parent).ObjectHandles;
+		operation.CheckCancelled();
+
+		if (ids.size() > 1 && s->GetObjectPropertyListSupported() && !s->GetCapabilities().Has(Capabilities::Quirk::PropertyListAllUnsupported))
+		{
+			//single property list for the whole folder is cheaper than any batching
+			auto infos = s->GetObjectInfos(ids, parent);
+			for(size_t begin = 0; begin < ids.size(); begin += batch)
+			{
+				operation.CheckCancelled();
+				ReportObjects(session, ids, infos, begin, std::min(begin + batch, ids.size()), callback, user);
+			}
+		}
+		else
+		{
+			//object info per object, batches are reported as soon as they're queried
+			for(size_t begin = 0; begin < ids.size(); begin += batch)
+			{
+				operation.CheckCancelled();
+				std::vector<ObjectId> chunk(ids.begin() + begin, ids.begin() + std::min(begin + batch, ids.size()));
+				auto infos = s->GetObjectInfos(chunk, Session::Device);
+				ReportObjects(session, chunk, infos, 0, chunk.size(), callback, user);
+			}
+		}
+	});
+}
+
+int mtpng_get_object_info(mtpng_session *session, uint32_t object_id, mtpng_list_callback callback, void *user)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && callback, "session and callback are required");
+		ObjectId id(object_id);
+		msg::ObjectInfo info = session->Session->GetFullObjectInfo(id);
+		mtpng_object_info object = { };
+		FillObjectInfo(id, info, object);
+		callback(user, &object, 1);
+	});
+}
+
+int mtpng_get(mtpng_session *session, uint32_t object_id, mtpng_write_callback callback, void *user)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && callback, "session and callback are required");
+		Operation operation(session);
+		auto stream = std::make_shared<CallbackOutputStream>(callback, user);
+		operation.SetStream(stream);
+		session->Session->GetObject(ObjectId(object_id), stream);
+	});
+}
+
+int mtpng_put(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, const char *filename, uint64_t size, int64_t modification_time,
+	mtpng_read_callback callback, void *user, uint32_t *object_id)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && callback && filename && *filename, "session, callback and filename are required");
+		Operation operation(session);
+		auto stream = std::make_shared<CallbackInputStream>(callback, user, size);
+		operation.SetStream(stream);
+
+		msg::ObjectInfo oi;
+		oi.Filename = filename;
+		oi.ObjectFormat = ObjectFormatFromFilename(filename);
+		if (modification_time)
+			oi.ModificationDate = ConvertDateTime(static_cast<time_t>(modification_time));
+
+		const SessionPtr &s = session->Session;
+		auto noi = s->CreateObject(oi, size, StorageId(storage_id), ObjectId(parent_id));
+		try
+		{ s->SendObject(stream); }
+		catch(const std::exception &)
+		{
+			try
+			{ s->DeleteObject(noi.ObjectId); }
+			catch(const std::exception &ex)
+			{ error("mtpng: removing partially sent object failed: ", ex.what()); }
+			throw;
+		}
+		if (object_id)
+			*object_id = noi.ObjectId.Id;
+	});
+}
+
+int mtpng_make_directory(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, const char *name, uint32_t *object_id)
+{
+	return Run([&]()
+	{
+		CheckArgument(session && name && *name, "session and name are required");
+		auto noi = session->Session->CreateDirectory(name, ObjectId(parent_id), StorageId(storage_id));
+		if (object_id)
+			*object_id = noi.ObjectId.Id;
+	});
+}
+
+int mtpng_delete(mtpng_session *session, uint32_t object_id)
+{
+	return Run([&]()
+	{
+		CheckArgument(session, "session is required");
+		session->Session->DeleteObject(ObjectId(object_id));
+	});
+}
+
+void mtpng_cancel(mtpng_session *session)
+{
+	if (!session)
+		return;
+	scoped_mutex_lock l(session->Mutex);
+	session->Cancelled.store(true);
+	if (session->Current)
+		session->Current->Cancel();
+}
+
+}
@@ -0,0 +1,144 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_CAPI_MTPNG_H
+#define AFT_CAPI_MTPNG_H
+
+/*! \file mtpng.h
+ * Stable C interface of mtp-ng library for in-process embedding.
+ *
+ * Handles are opaque and structures passed to callbacks only ever grow at the end, check \ref MTPNG_API_VERSION.
+ * Functions return \ref mtpng_status, human readable message of the last failure on calling thread is returned by \ref mtpng_last_error.
+ * Calls on one session are serialised, \ref mtpng_cancel may be called from any thread.
+ * All callbacks are invoked on the thread that made the call, strings passed to them are valid only during the callback.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#	define MTPNG_API __attribute__((visibility("default")))
+#else
+#	define MTPNG_API
+#endif
+
+#define MTPNG_API_VERSION		1
+
+#define MTPNG_ANY_STORAGE		0x00000000u	/*!< device picks storage for new object */
+#define MTPNG_ALL_STORAGES		0xffffffffu	/*!< lists objects of all storages */
+#define MTPNG_ROOT				0xffffffffu	/*!< parent id of storage root objects */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum mtpng_status
+{
+	MTPNG_OK				= 0,
+	MTPNG_ERROR				= -1,	/*!< generic failure, see mtpng_last_error() */
+	MTPNG_INVALID_ARGUMENT	= -2,
+	MTPNG_NOT_FOUND			= -3,	/*!< no matching device */
+	MTPNG_DEVICE_ERROR		= -4,	/*!< device rejected request, MTP response code is returned by mtpng_last_response() */
+	MTPNG_TIMEOUT			= -5,
+	MTPNG_CANCELLED			= -6,	/*!< mtpng_cancel() was called or callback asked to stop */
+	MTPNG_CALLBACK_FAILED	= -7	/*!< read or write callback returned short count */
+} mtpng_status;
+
+typedef struct mtpng_session mtpng_session;
+
+typedef struct mtpng_device_desc
+{
+	const char *	bus_path;		/*!< usb topology path, e.g. 1-2.3, empty for emulated devices */
+	const char *	serial;
+	const char *	manufacturer;
+	const char *	model;
+	uint16_t		vendor_id;
+	uint16_t		product_id;
+} mtpng_device_desc;
+
+typedef struct mtpng_storage_info
+{
+	uint32_t		id;
+	uint64_t		capacity;
+	uint64_t		free_space;
+	const char *	description;
+	const char *	volume_label;
+} mtpng_storage_info;
+
+typedef struct mtpng_object_info
+{
+	uint32_t		id;
+	uint32_t		storage_id;
+	uint32_t		parent_id;
+	uint16_t		format;			/*!< MTP object format code, 0x3001 for directories */
+	int				is_directory;
+	uint64_t		size;
+	int64_t			modification_time;	/*!< unix time, 0 if device did not report it */
+	const char *	filename;
+} mtpng_object_info;
+
+/*! return non-zero to stop enumeration, the call then returns MTPNG_CANCELLED */
+typedef int (*mtpng_device_callback)(void *user, const mtpng_device_desc *device);
+typedef int (*mtpng_storage_callback)(void *user, const mtpng_storage_info *storage);
+typedef int (*mtpng_list_callback)(void *user, const mtpng_object_info *objects, size_t count);
+
+/*! must consume all size bytes, anything less aborts transfer with MTPNG_CALLBACK_FAILED */
+typedef size_t (*mtpng_write_callback)(void *user, const void *data, size_t size);
+/*! fills up to size bytes and returns their count, 0 before announced object size is reached aborts transfer with MTPNG_CALLBACK_FAILED */
+typedef size_t (*mtpng_read_callback)(void *user, void *data, size_t size);
+
+MTPNG_API int mtpng_api_version(void);
+MTPNG_API const char * mtpng_version(void);
+/*! message of the last failed call on calling thread, never NULL */
+MTPNG_API const char * mtpng_last_error(void);
+/*! MTP response code of the last MTPNG_DEVICE_ERROR on calling thread */
+MTPNG_API uint16_t mtpng_last_response(void);
+
+/*! reports every MTP device connected, devices are not claimed */
+MTPNG_API int mtpng_enumerate(mtpng_device_callback callback, void *user);
+
+/*! opens device by bus path or serial number (first one found if id is NULL) and starts MTP session on it */
+MTPNG_API int mtpng_session_open(const char *id, mtpng_session **session);
+/*! drops session and releases device, running operation must be finished or cancelled first */
+MTPNG_API void mtpng_session_close(mtpng_session *session);
+/*! strings stay valid until session is closed */
+MTPNG_API int mtpng_session_get_device(mtpng_session *session, mtpng_device_desc *device);
+
+MTPNG_API int mtpng_list_storages(mtpng_session *session, mtpng_storage_callback callback, void *user);
+/*! lists children of parent_id, callback receives up to batch objects at a time (0 picks default) */
+MTPNG_API int mtpng_list(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, size_t batch, mtpng_list_callback callback, void *user);
+/*! reports single object through list callback with count 1 */
+MTPNG_API int mtpng_get_object_info(mtpng_session *session, uint32_t object_id, mtpng_list_callback callback, void *user);
+
+/*! streams object data to write callback as it arrives from device */
+MTPNG_API int mtpng_get(mtpng_session *session, uint32_t object_id, mtpng_write_callback callback, void *user);
+/*! creates object of given size and streams its data from read callback, partially sent object is deleted on failure */
+MTPNG_API int mtpng_put(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, const char *filename, uint64_t size, int64_t modification_time,
+	mtpng_read_callback callback, void *user, uint32_t *object_id);
+MTPNG_API int mtpng_make_directory(mtpng_session *session, uint32_t storage_id, uint32_t parent_id, const char *name, uint32_t *object_id);
+MTPNG_API int mtpng_delete(mtpng_session *session, uint32_t object_id);
+
+/*! aborts operation running on session from any thread, it returns MTPNG_CANCELLED; no-op if nothing is running */
+MTPNG_API void mtpng_cancel(mtpng_session *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
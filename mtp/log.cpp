@@ -17,9 +17,181 @@
     Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#include <mtp/log.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdlib.h>
+
 namespace mtp
 {
+	namespace
+	{
+		class AsyncLog //! writes queued lines to stderr from background thread
+		{
+			static const size_t			MaxQueuedLines = 65536; //caller blocks above this, so memory stays bounded
+
+			std::mutex					_mutex;
+			std::condition_variable		_queued, _written;
+			std::deque<std::string>		_lines;
+			bool						_writing;
+			bool						_stopped;
+			std::thread					_thread;
+
+			void Run()
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				while(true)
+				{
+					_queued.wait(l, [this]() { return _stopped || !_lines.empty(); });
+					if (_lines.empty())
+						break;
+
+					std::deque<std::string> lines;
+					lines.swap(_lines);
+					_writing = true;
+					_written.notify_all();
+					l.unlock();
+
+					for(auto &line : lines)
+						std::cerr << line;
+					std::cerr.flush();
+
+					l.lock();
+					_writing = false;
+					_written.notify_all();
+				}
+			}
+
+		public:
+			AsyncLog(): _writing(false), _stopped(false)
+			{ _thread = std::thread(&AsyncLog::Run, this); }
+
+			~AsyncLog()
+			{
+				{
+					std::unique_lock<std::mutex> l(_mutex);
+					_stopped = true;
+					_queued.notify_all();
+				}
+				_thread.join();
+			}
+
+			void Push(std::string && line)
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				_written.wait(l, [this]() { return _lines.size() < MaxQueuedLines; });
+				_lines.push_back(std::move(line));
+				_queued.notify_one();
+			}
+
+			///waits until all queued lines are written
+			void Flush()
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				_written.wait(l, [this]() { return _lines.empty() && !_writing; });
+			}
+		};
+
+		std::atomic<AsyncLog *>		g_asyncLogPtr(nullptr);
+
+		struct AsyncLogHolder
+		{
+			std::mutex					Mutex;
+			std::unique_ptr<AsyncLog>	Log; //kept until exit once created, callers may still hold the pointer
+
+			~AsyncLogHolder()
+			{
+				g_asyncLogPtr = nullptr;
+				Log.reset();
+			}
+		} g_asyncLog;
+
+		struct Category
+		{
+			const char *	Name;
+			unsigned		Value;
+		};
+
+		const Category Categories[] =
+		{
+			{ "general",		LogGeneral },
+			{ "usb",			LogUsb },
+			{ "transaction",	LogTransaction },
+			{ "fuse",			LogFuse },
+			{ "all",			LogAllCategories },
+		};
+
+		bool InitDebug()
+		{
+			const char *env = getenv("AFT_DEBUG");
+			if (!env || !*env)
+				return false;
+			g_debugCategories = ParseLogCategories(env);
+			return g_debugCategories != 0;
+		}
+	}
+
+	unsigned g_debugCategories = LogAllCategories;
+	bool g_debug = InitDebug();
+
+	unsigned ParseLogCategories(const std::string &list)
+	{
+		unsigned categories = 0;
+		size_t begin = 0;
+		while(begin <= list.size())
+		{
+			size_t end = list.find(',', begin);
+			if (end == list.npos)
+				end = list.size();
+			std::string name = list.substr(begin, end - begin);
+			for(auto &category : Categories)
+				if (name == category.Name)
+					categories |= category.Value;
+			begin = end + 1;
+		}
+		return categories;
+	}
+
+	void SetAsyncDebugOutput(bool async)
+	{
+		std::lock_guard<std::mutex> l(g_asyncLog.Mutex);
+		if (async)
+		{
+			if (!g_asyncLog.Log)
+				g_asyncLog.Log.reset(new AsyncLog());
+			g_asyncLogPtr = g_asyncLog.Log.get();
+		}
+		else
+		{
+			g_asyncLogPtr = nullptr;
+			if (g_asyncLog.Log)
+				g_asyncLog.Log->Flush();
+		}
+	}
 
-	bool g_debug = false;
+	namespace impl
+	{
+		void WriteDebug(std::string && line)
+		{
+			AsyncLog *log = g_asyncLogPtr;
+			if (log)
+				log->Push(std::move(line));
+			else
+				std::cerr << line;
+		}
 
+		void WriteError(std::string && line)
+		{
+			//errors are written synchronously, after debug output queued before them
+			AsyncLog *log = g_asyncLogPtr;
+			if (log)
+				log->Flush();
+			std::cerr << line;
+		}
+	}
 }
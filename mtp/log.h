@@ -24,6 +24,14 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <string>
+
+#ifdef __GNUC__
+#	define MTP_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#	define MTP_UNLIKELY(x) (x)
+#endif
 
 //I love libstdc++!
 inline std::ostream & operator << (std::ostream & stream, unsigned char v)
@@ -92,23 +100,71 @@ namespace mtp
 	}
 
 	extern bool g_debug;
+	extern unsigned g_debugCategories;
 
-	inline void error()
-	{ std::cerr << std::endl; }
+	enum LogCategory : unsigned
+	{
+		LogGeneral			= 1,
+		LogUsb				= 2,
+		LogTransaction		= 4,
+		LogFuse				= 8,
+		LogAllCategories	= ~0u
+	};
 
-	template<typename ValueType, typename ... Args>
-	void error(const ValueType & value, Args ... args)
+	inline bool IsDebugEnabled(unsigned category = LogGeneral)
+	{ return MTP_UNLIKELY(g_debug) && (g_debugCategories & category) != 0; }
+
+	///parses comma separated category names: general, usb, transaction, fuse, all; AFT_DEBUG environment variable uses the same format
+	unsigned ParseLogCategories(const std::string &list);
+
+	///debug lines are formatted by caller and written from background thread, so tracing does not serialize i/o on stderr
+	void SetAsyncDebugOutput(bool async);
+
+	namespace impl
+	{
+		inline void Append(std::ostream &)
+		{ }
+
+		template<typename ValueType, typename ... Args>
+		void Append(std::ostream & stream, const ValueType & value, const Args & ... args)
+		{
+			stream << value;
+			Append(stream, args...);
+		}
+
+		void WriteDebug(std::string && line);
+		void WriteError(std::string && line);
+
+		template<typename ... Args>
+		void Debug(const Args & ... args)
+		{
+			std::ostringstream stream;
+			Append(stream, args...);
+			stream << '\n';
+			WriteDebug(stream.str());
+		}
+	}
+
+	template<typename ... Args>
+	void error(const Args & ... args)
 	{
-		std::cerr << value;
-		error(args...);
+		std::ostringstream stream;
+		impl::Append(stream, args...);
+		stream << '\n';
+		impl::WriteError(stream.str());
 	}
 
-	template<typename ValueType, typename ... Args>
-	void debug(const ValueType & value, Args ... args)
+	///arguments are evaluated even if debug is disabled, use MTP_DEBUG on hot paths
+	template<typename ... Args>
+	void debug(const Args & ... args)
 	{
-		if (g_debug)
-			error(value, args...);
+		if (IsDebugEnabled())
+			impl::Debug(args...);
 	}
 }
 
+///checks debug flag before evaluating any argument
+#define MTP_DEBUG(...) MTP_DEBUG_CATEGORY(mtp::LogGeneral, __VA_ARGS__)
+#define MTP_DEBUG_CATEGORY(CATEGORY, ...) do { if (mtp::IsDebugEnabled(CATEGORY)) mtp::impl::Debug(__VA_ARGS__); } while(false)
+
 #endif
@@ -0,0 +1,107 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/mock/BulkPipe.h>
+#include <mtp/usb/TimeoutException.h>
+#include <thread>
+
+namespace mtp { namespace mock
+{
+	namespace
+	{
+		class ThrottledInputStream final: public IObjectInputStream, public CancellableStream //! passes host data through pipe bandwidth limit
+		{
+			BulkPipe *				_pipe;
+			IObjectInputStreamPtr	_stream;
+			size_t					_transferSize;
+
+		public:
+			ThrottledInputStream(BulkPipe *pipe, const IObjectInputStreamPtr &stream, size_t transferSize):
+				_pipe(pipe), _stream(stream), _transferSize(transferSize)
+			{ }
+
+			virtual u64 GetSize() const
+			{ return _stream->GetSize(); }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				CheckCancelled();
+				size_t r = _stream->Read(data, std::min(size, _transferSize));
+				_pipe->Transfer(r);
+				return r;
+			}
+		};
+	}
+
+	const size_t BulkPipe::DefaultTransferSize;
+
+	BulkPipe::BulkPipe(const ResponderPtr &responder):
+		_responder(responder), _latency(0), _bandwidth(0), _transferSize(DefaultTransferSize), _cancelled(false)
+	{ }
+
+	void BulkPipe::BeginTransfer()
+	{
+		_cancelled.store(false);
+		if (_latency.count() > 0)
+			std::this_thread::sleep_for(_latency);
+		_busyUntil = clock::now();
+	}
+
+	void BulkPipe::Transfer(size_t size)
+	{
+		if (_cancelled.load())
+			throw OperationCancelledException();
+		if (_bandwidth == 0 || size == 0)
+			return;
+
+		_busyUntil += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(static_cast<double>(size) / _bandwidth));
+		std::this_thread::sleep_until(_busyUntil);
+	}
+
+	void BulkPipe::Read(const IObjectOutputStreamPtr &outputStream, int timeout)
+	{
+		IObjectInputStreamPtr inputStream = _responder->Read();
+		if (!inputStream)
+			throw usb::TimeoutException("timeout reading from mock device");
+
+		BeginTransfer();
+		ByteArray buffer(_transferSize);
+		while(true)
+		{
+			size_t r = inputStream->Read(buffer.data(), buffer.size());
+			if (r == 0)
+				break;
+			Transfer(r);
+			outputStream->Write(buffer.data(), r);
+		}
+	}
+
+	void BulkPipe::Write(const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		BeginTransfer();
+		_responder->Write(std::make_shared<ThrottledInputStream>(this, inputStream, _transferSize));
+	}
+
+	void BulkPipe::Cancel()
+	{
+		_cancelled.store(true);
+		_responder->Cancel();
+	}
+
+}}
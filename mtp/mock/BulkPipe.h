@@ -0,0 +1,82 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MOCK_BULKPIPE_H
+#define AFT_MOCK_BULKPIPE_H
+
+#include <mtp/usb/BulkPipe.h>
+#include <mtp/mock/Responder.h>
+#include <atomic>
+#include <chrono>
+
+namespace mtp { namespace mock
+{
+	class BulkPipe;
+	DECLARE_PTR(BulkPipe);
+
+	class BulkPipe : public usb::BulkPipe //! Software bulk pipe connected to in-process \ref Responder, simulates bus latency and bandwidth
+	{
+		using clock = std::chrono::steady_clock;
+
+		ResponderPtr				_responder;
+		std::chrono::microseconds	_latency;
+		u64							_bandwidth;
+		size_t						_transferSize;
+		clock::time_point			_busyUntil;
+		std::atomic_bool			_cancelled;
+
+	public:
+		static const size_t DefaultTransferSize = 65536;
+
+		BulkPipe(const ResponderPtr &responder);
+
+		const ResponderPtr & GetResponder() const
+		{ return _responder; }
+
+		///delay applied to every bulk transfer, emulates bus round-trip
+		void SetLatency(std::chrono::microseconds latency)
+		{ _latency = latency; }
+
+		///bytes per second, 0 - unlimited
+		void SetBandwidth(u64 bandwidth)
+		{ _bandwidth = bandwidth; }
+
+		void SetTransferSize(size_t transferSize)
+		{ _transferSize = transferSize? transferSize: DefaultTransferSize; }
+
+		usb::DevicePtr GetDevice() const override
+		{ return nullptr; }
+
+		bool ReadInterrupt(ByteArray &data, int timeout) override
+		{ return _responder->ReadEvent(data, timeout); }
+
+		void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000) override;
+		void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000) override;
+		void Cancel() override;
+
+		///accounts transferred bytes against simulated bandwidth, throws if transfer was cancelled
+		void Transfer(size_t size);
+
+	private:
+		void BeginTransfer();
+	};
+
+}}
+
+#endif
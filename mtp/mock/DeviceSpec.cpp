@@ -0,0 +1,138 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/mock/DeviceSpec.h>
+#include <mtp/ptp/Session.h>
+#include <mtp/log.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace mtp { namespace mock
+{
+	namespace
+	{
+		u64 ParseSize(const std::string &key, const std::string &value)
+		{
+			char *end = nullptr;
+			u64 size = strtoull(value.c_str(), &end, 10);
+			if (end == value.c_str())
+				throw std::runtime_error("invalid value of " + key + ": " + value);
+			switch(*end)
+			{
+			case 'G': case 'g': size <<= 10; //fallthrough
+			case 'M': case 'm': size <<= 10; //fallthrough
+			case 'K': case 'k': size <<= 10; ++end; break;
+			}
+			if (*end)
+				throw std::runtime_error("invalid value of " + key + ": " + value);
+			return size;
+		}
+	}
+
+	DeviceSpec::DeviceSpec():
+		Files(1000), Depth(2), Fanout(8), FileSize(64 * 1024),
+		LargeFiles(2), LargeFileSize(256ull * 1024 * 1024),
+		Latency(0), Bandwidth(0)
+	{ }
+
+	DeviceSpec DeviceSpec::Parse(const std::string &spec)
+	{
+		DeviceSpec result;
+		size_t begin = 0;
+		while(begin < spec.size())
+		{
+			size_t end = spec.find(',', begin);
+			if (end == spec.npos)
+				end = spec.size();
+			std::string item = spec.substr(begin, end - begin);
+			begin = end + 1;
+			if (item.empty())
+				continue;
+
+			size_t eq = item.find('=');
+			if (eq == item.npos)
+				throw std::runtime_error("expected key=value in device spec, got " + item);
+			std::string key = item.substr(0, eq), value = item.substr(eq + 1);
+			u64 n = ParseSize(key, value);
+			if (key == "files")
+				result.Files = n;
+			else if (key == "depth")
+				result.Depth = n;
+			else if (key == "fanout")
+				result.Fanout = n? n: 1;
+			else if (key == "size")
+				result.FileSize = n;
+			else if (key == "large")
+				result.LargeFiles = n;
+			else if (key == "large-size")
+				result.LargeFileSize = n;
+			else if (key == "latency")
+				result.Latency = n;
+			else if (key == "bandwidth")
+				result.Bandwidth = n * 1024 * 1024;
+			else
+				throw std::runtime_error("unknown device spec key " + key);
+		}
+		return result;
+	}
+
+	ResponderPtr DeviceSpec::CreateResponder() const
+	{
+		auto responder = std::make_shared<Responder>("Simulated Device");
+		StorageId storage = responder->AddStorage("Internal storage", 256ull * 1024 * 1024 * 1024);
+
+		std::vector<ObjectId> level(1, Session::Root);
+		for(unsigned d = 0; d < Depth; ++d)
+		{
+			std::vector<ObjectId> next;
+			next.reserve(level.size() * Fanout);
+			for(auto parent : level)
+				for(unsigned i = 0; i < Fanout; ++i)
+					next.push_back(responder->AddDirectory(storage, parent, "dir" + std::to_string(i)));
+			level.swap(next);
+		}
+
+		char name[32];
+		for(u64 i = 0; i < Files; ++i)
+		{
+			snprintf(name, sizeof(name), "IMG_%06llu.jpg", static_cast<unsigned long long>(i));
+			responder->AddFile(storage, level[i % level.size()], name, FileSize);
+		}
+
+		if (LargeFiles)
+		{
+			ObjectId movies = responder->AddDirectory(storage, Session::Root, "Movies");
+			for(unsigned i = 0; i < LargeFiles; ++i)
+				responder->AddFile(storage, movies, "movie" + std::to_string(i) + ".mp4", LargeFileSize);
+		}
+		debug("simulated device: ", Files, " files in ", level.size(), " folders, ", LargeFiles, " large files");
+		return responder;
+	}
+
+	BulkPipePtr DeviceSpec::CreatePipe() const
+	{
+		auto pipe = std::make_shared<BulkPipe>(CreateResponder());
+		pipe->SetLatency(std::chrono::microseconds(Latency));
+		pipe->SetBandwidth(Bandwidth);
+		return pipe;
+	}
+
+}}
@@ -0,0 +1,50 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MOCK_DEVICESPEC_H
+#define AFT_MOCK_DEVICESPEC_H
+
+#include <mtp/mock/BulkPipe.h>
+#include <string>
+
+namespace mtp { namespace mock
+{
+	struct DeviceSpec //! synthetic device tree and bus parameters, parsed from comma separated key=value list
+	{
+		u64			Files;			///< number of small files, spread over leaf folders
+		unsigned	Depth;			///< folder nesting depth
+		unsigned	Fanout;			///< subfolders in every folder
+		u64			FileSize;
+		unsigned	LargeFiles;		///< number of large media files in "Movies" folder
+		u64			LargeFileSize;
+		unsigned	Latency;		///< per-transfer latency in microseconds
+		u64			Bandwidth;		///< bytes per second, 0 - unlimited
+
+		DeviceSpec();
+
+		///keys: files, depth, fanout, size, large, large-size, latency (us), bandwidth (MB/s); sizes accept K, M and G suffixes
+		static DeviceSpec Parse(const std::string &spec);
+
+		ResponderPtr CreateResponder() const;
+		BulkPipePtr CreatePipe() const;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,300 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/mock/Recording.h>
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/log.h>
+#include <thread>
+
+namespace mtp { namespace mock
+{
+	namespace
+	{
+		using clock = std::chrono::steady_clock;
+		using RecordType = Recording::RecordType;
+
+		class RecordingOutputStream final: public IObjectOutputStream, public CancellableStream //! records every chunk received from device before passing it on
+		{
+			RecordingBulkPipe *		_pipe;
+			IObjectOutputStreamPtr	_stream;
+
+		public:
+			RecordingOutputStream(RecordingBulkPipe *pipe, const IObjectOutputStreamPtr &stream): _pipe(pipe), _stream(stream)
+			{ }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				_pipe->Write(RecordType::BulkIn, clock::now(), data, size);
+				return _stream->Write(data, size);
+			}
+		};
+
+		class CountingInputStream final: public IObjectInputStream, public CancellableStream //! counts bytes sent to device
+		{
+			IObjectInputStreamPtr	_stream;
+			u64						_size;
+
+		public:
+			CountingInputStream(const IObjectInputStreamPtr &stream): _stream(stream), _size(0)
+			{ }
+
+			u64 GetTransferred() const
+			{ return _size; }
+
+			virtual u64 GetSize() const
+			{ return _stream->GetSize(); }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				size_t r = _stream->Read(data, size);
+				_size += r;
+				return r;
+			}
+		};
+
+		u64 ToMicroseconds(clock::duration duration)
+		{ return std::chrono::duration_cast<std::chrono::microseconds>(duration).count(); }
+	}
+
+	RecordingBulkPipe::RecordingBulkPipe(const usb::BulkPipePtr &pipe, const std::string &path, const Recording &header):
+		_pipe(pipe), _file(fopen(path.c_str(), "wb")), _start(clock::now())
+	{
+		if (!_file)
+			throw posix::Exception("fopen " + path);
+
+		ByteArray data;
+		OutputStream stream(data);
+		stream << Recording::Magic << Recording::Version << header.VendorId << header.ProductId;
+		stream << static_cast<u8>(header.BusPath.size());
+		data.insert(data.end(), header.BusPath.begin(), header.BusPath.end());
+		fwrite(data.data(), 1, data.size(), _file);
+		debug("recording device session to ", path);
+	}
+
+	RecordingBulkPipe::~RecordingBulkPipe()
+	{ fclose(_file); }
+
+	void RecordingBulkPipe::Write(RecordType type, clock::time_point time, const u8 *data, size_t size)
+	{
+		u8 header[13];
+		u64 us = ToMicroseconds(time - _start);
+		header[0] = static_cast<u8>(type);
+		for(size_t i = 0; i < 8; ++i)
+			header[1 + i] = us >> (8 * i);
+		for(size_t i = 0; i < 4; ++i)
+			header[9 + i] = static_cast<u32>(size) >> (8 * i);
+
+		scoped_mutex_lock l(_mutex);
+		fwrite(header, 1, sizeof(header), _file);
+		if (size)
+			fwrite(data, 1, size, _file);
+		if (type != RecordType::BulkIn)
+			fflush(_file);
+	}
+
+	bool RecordingBulkPipe::ReadInterrupt(ByteArray &data, int timeout)
+	{
+		bool r = _pipe->ReadInterrupt(data, timeout);
+		if (r)
+			Write(RecordType::Interrupt, clock::now(), data.data(), data.size());
+		return r;
+	}
+
+	void RecordingBulkPipe::Read(const IObjectOutputStreamPtr &outputStream, int timeout)
+	{
+		try
+		{ _pipe->Read(std::make_shared<RecordingOutputStream>(this, outputStream), timeout); }
+		catch(const usb::TimeoutException &)
+		{
+			Write(RecordType::BulkTimeout, clock::now());
+			throw;
+		}
+		Write(RecordType::BulkInEnd, clock::now());
+	}
+
+	void RecordingBulkPipe::Write(const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		auto stream = std::make_shared<CountingInputStream>(inputStream);
+		auto start = clock::now();
+		_pipe->Write(stream, timeout);
+		auto end = clock::now();
+
+		ByteArray data;
+		OutputStream os(data);
+		os.Write64(stream->GetTransferred());
+		os.Write64(ToMicroseconds(end - start));
+		Write(RecordType::BulkOut, end, data.data(), data.size());
+	}
+
+	void RecordingBulkPipe::Cancel()
+	{
+		Write(RecordType::Cancel, clock::now());
+		_pipe->Cancel();
+	}
+
+
+	ReplayBulkPipe::ReplayBulkPipe(const std::string &path, double speed):
+		_speed(speed), _position(0), _lastTransfer(clock::now()), _lastTime(0), _cancelled(false)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f)
+			throw posix::Exception("fopen " + path);
+
+		ByteArray data;
+		u8 buffer[65536];
+		size_t r;
+		while((r = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			data.insert(data.end(), buffer, buffer + r);
+		fclose(f);
+
+		InputStream stream(data);
+		u32 magic, version;
+		stream >> magic >> version;
+		if (magic != Recording::Magic || version != Recording::Version)
+			throw std::runtime_error("invalid or unsupported recording " + path);
+		stream >> _header.VendorId >> _header.ProductId;
+		u8 busPathSize = stream.Read8();
+		stream.Require(busPathSize);
+		_header.BusPath.assign(data.begin() + stream.GetOffset(), data.begin() + stream.GetOffset() + busPathSize);
+		stream.Skip(busPathSize);
+
+		while(!stream.AtEnd())
+		{
+			Record record;
+			record.Type = static_cast<RecordType>(stream.Read8());
+			record.Time = stream.Read64();
+			u32 size = stream.Read32();
+			stream.Require(size);
+			record.Data.assign(data.begin() + stream.GetOffset(), data.begin() + stream.GetOffset() + size);
+			stream.Skip(size);
+
+			if (record.Type == RecordType::Interrupt)
+				_interrupts.emplace_back(_bulk.size(), std::move(record.Data));
+			else if (record.Type != RecordType::Cancel)
+				_bulk.push_back(std::move(record));
+		}
+		debug("replaying ", _bulk.size(), " bulk and ", _interrupts.size(), " interrupt records from ", path);
+	}
+
+	void ReplayBulkPipe::Wait(const Record &record)
+	{
+		if (_speed > 0 && record.Time > _lastTime)
+		{
+			auto delay = std::chrono::duration<double, std::micro>((record.Time - _lastTime) / _speed);
+			auto until = _lastTransfer + std::chrono::duration_cast<clock::duration>(delay);
+			while(clock::now() < until)
+			{
+				if (_cancelled.load())
+					throw OperationCancelledException();
+				std::this_thread::sleep_until(std::min(until, clock::now() + std::chrono::milliseconds(10)));
+			}
+		}
+		_lastTransfer = clock::now();
+		_lastTime = record.Time;
+	}
+
+	void ReplayBulkPipe::Advance()
+	{
+		{
+			scoped_mutex_lock l(_mutex);
+			++_position;
+		}
+		_progress.notify_all();
+	}
+
+	bool ReplayBulkPipe::ReadInterrupt(ByteArray &data, int timeout)
+	{
+		scoped_mutex_lock l(_mutex);
+		auto ready = [this]() { return !_interrupts.empty() && _interrupts.front().first <= _position; };
+		if (!_progress.wait_for(l, std::chrono::milliseconds(timeout), ready))
+		{
+			data.clear();
+			return false;
+		}
+		data = std::move(_interrupts.front().second);
+		_interrupts.pop_front();
+		return true;
+	}
+
+	void ReplayBulkPipe::Read(const IObjectOutputStreamPtr &outputStream, int timeout)
+	{
+		_cancelled.store(false);
+		while(true)
+		{
+			if (_position >= _bulk.size())
+				throw usb::TimeoutException("end of recording");
+
+			const Record &record = _bulk[_position];
+			switch(record.Type)
+			{
+			case RecordType::BulkIn:
+				Wait(record);
+				outputStream->Write(record.Data.data(), record.Data.size());
+				Advance();
+				break;
+			case RecordType::BulkInEnd:
+				Advance();
+				return;
+			case RecordType::BulkTimeout:
+				Wait(record);
+				Advance();
+				throw usb::TimeoutException("recorded timeout");
+			default:
+				throw std::runtime_error("replay diverged: host reads, recording continues with write");
+			}
+		}
+	}
+
+	void ReplayBulkPipe::Write(const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		_cancelled.store(false);
+		auto begin = clock::now();
+		u64 size = 0;
+		u8 buffer[65536];
+		size_t r;
+		while((r = inputStream->Read(buffer, sizeof(buffer))) > 0)
+			size += r;
+
+		if (_position >= _bulk.size())
+			return; //e.g. CloseSession after recording was stopped
+
+		const Record &record = _bulk[_position];
+		if (record.Type != RecordType::BulkOut)
+			throw std::runtime_error("replay diverged: host writes, recording continues with read");
+
+		InputStream stream(record.Data);
+		u64 recordedSize = stream.Read64();
+		u64 duration = stream.Read64();
+		if (recordedSize != size)
+			debug("replay: host sent ", size, " bytes, recorded ", recordedSize);
+
+		//write is recorded at its end, its recorded duration is kept from the moment host started it
+		_lastTime = record.Time > duration? record.Time - duration: 0;
+		_lastTransfer = begin;
+		Wait(record);
+		Advance();
+	}
+
+	void ReplayBulkPipe::Cancel()
+	{ _cancelled.store(true); }
+
+}}
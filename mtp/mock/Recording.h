@@ -0,0 +1,132 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MOCK_RECORDING_H
+#define AFT_MOCK_RECORDING_H
+
+#include <mtp/usb/BulkPipe.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace mtp { namespace mock
+{
+	///binary capture of one device session: fixed header followed by records of type, microseconds since start and data
+	struct Recording //! record format shared by \ref RecordingBulkPipe and \ref ReplayBulkPipe
+	{
+		static const u32 Magic = 0x52544641; //AFTR
+		static const u32 Version = 1;
+
+		enum struct RecordType : u8
+		{
+			BulkOut		= 1, ///< transfer to device, data holds 8-byte size and 8-byte duration in microseconds instead of payload
+			BulkIn		= 2, ///< chunk of data received from device
+			BulkInEnd	= 3, ///< end of single bulk read (one container)
+			BulkTimeout	= 4, ///< bulk read timed out
+			Interrupt	= 5, ///< event container from interrupt endpoint
+			Cancel		= 6, ///< host cancelled current transfer
+		};
+
+		struct Record
+		{
+			RecordType	Type;
+			u64			Time;
+			ByteArray	Data;
+		};
+
+		u16			VendorId;
+		u16			ProductId;
+		std::string	BusPath;
+
+		Recording(): VendorId(), ProductId()
+		{ }
+	};
+
+	class RecordingBulkPipe final : public usb::BulkPipe //! forwards all transfers to underlying pipe, writing every exchange to file
+	{
+		using clock = std::chrono::steady_clock;
+
+		usb::BulkPipePtr	_pipe;
+		FILE *				_file;
+		std::mutex			_mutex;
+		clock::time_point	_start;
+
+	public:
+		RecordingBulkPipe(const usb::BulkPipePtr &pipe, const std::string &path, const Recording &header);
+		~RecordingBulkPipe();
+
+		///appends record, called from transfer and event threads
+		void Write(Recording::RecordType type, clock::time_point time, const u8 *data = nullptr, size_t size = 0);
+
+		usb::DevicePtr GetDevice() const override
+		{ return _pipe->GetDevice(); }
+
+		bool ReadInterrupt(ByteArray &data, int timeout) override;
+		void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000) override;
+		void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000) override;
+		void Cancel() override;
+	};
+	DECLARE_PTR(RecordingBulkPipe);
+
+	class ReplayBulkPipe final : public usb::BulkPipe //! feeds recorded device responses back to host, keeping original device latency and bandwidth scaled by speed
+	{
+		using clock = std::chrono::steady_clock;
+		using Record = Recording::Record;
+
+		Recording					_header;
+		std::vector<Record>			_bulk;
+		std::deque<std::pair<size_t, ByteArray>> _interrupts; //!< bulk position event was received at and event data
+		double						_speed;
+
+		std::mutex					_mutex;
+		std::condition_variable		_progress;
+		size_t						_position;
+		clock::time_point			_lastTransfer;
+		u64							_lastTime;
+		std::atomic_bool			_cancelled;
+
+		///waits until record would have been received relative to previous one
+		void Wait(const Record &record);
+		void Advance();
+
+	public:
+		///speed scales recorded delays, 0 replays without delays
+		ReplayBulkPipe(const std::string &path, double speed = 1);
+
+		const Recording & GetHeader() const
+		{ return _header; }
+
+		usb::DevicePtr GetDevice() const override
+		{ return nullptr; }
+
+		bool ReadInterrupt(ByteArray &data, int timeout) override;
+		void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000) override;
+		void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000) override;
+		void Cancel() override;
+	};
+	DECLARE_PTR(ReplayBulkPipe);
+
+}}
+
+#endif
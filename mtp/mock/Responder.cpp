@@ -0,0 +1,1111 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/mock/Responder.h>
+#include <mtp/ptp/ByteArrayObjectStream.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/JoinedObjectStream.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/log.h>
+#include <algorithm>
+
+namespace mtp { namespace mock
+{
+	namespace
+	{
+		const size_t HeaderSize	= 12;
+		const size_t ChunkSize	= 65536;
+
+		const ObjectProperty SupportedProperties[] =
+		{
+			ObjectProperty::StorageId,
+			ObjectProperty::ObjectFormat,
+			ObjectProperty::ProtectionStatus,
+			ObjectProperty::ObjectSize,
+			ObjectProperty::AssociationType,
+			ObjectProperty::ObjectFilename,
+			ObjectProperty::DateModified,
+			ObjectProperty::ParentObject,
+			ObjectProperty::Name,
+		};
+
+		const OperationCode SupportedOperations[] =
+		{
+			OperationCode::GetDeviceInfo,
+			OperationCode::OpenSession,
+			OperationCode::CloseSession,
+			OperationCode::GetStorageIDs,
+			OperationCode::GetStorageInfo,
+			OperationCode::GetObjectHandles,
+			OperationCode::GetObjectInfo,
+			OperationCode::GetObject,
+			OperationCode::GetThumb,
+			OperationCode::DeleteObject,
+			OperationCode::MoveObject,
+			OperationCode::CopyObject,
+			OperationCode::SendObjectInfo,
+			OperationCode::SendObject,
+			OperationCode::GetPartialObject,
+			OperationCode::GetPartialObject64,
+			OperationCode::SendPartialObject,
+			OperationCode::TruncateObject,
+			OperationCode::BeginEditObject,
+			OperationCode::EndEditObject,
+			OperationCode::GetObjectPropsSupported,
+			OperationCode::GetObjectPropDesc,
+			OperationCode::GetObjectPropValue,
+			OperationCode::SetObjectPropValue,
+			OperationCode::GetObjectPropList,
+			OperationCode::SetObjectPropList,
+		};
+
+		class ContentInputStream final: public IObjectInputStream, public CancellableStream //! object content slice, generated if there's no data
+		{
+			ByteArrayPtr	_data;
+			u64				_offset;
+			u64				_end;
+			u64				_size;
+
+		public:
+			ContentInputStream(const ByteArrayPtr &data, u64 offset, u64 size):
+				_data(data), _offset(offset), _end(offset + size), _size(size)
+			{ }
+
+			virtual u64 GetSize() const
+			{ return _size; }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				CheckCancelled();
+				size_t n = std::min<u64>(size, _end - _offset);
+				if (_data)
+					std::copy(_data->data() + _offset, _data->data() + _offset + n, data);
+				else
+				{
+					for(size_t i = 0; i < n; ++i)
+						data[i] = Responder::GetPattern(_offset + i);
+				}
+				_offset += n;
+				return n;
+			}
+		};
+
+		size_t ReadFully(IObjectInputStream &stream, u8 *data, size_t size)
+		{
+			size_t offset = 0;
+			while(offset < size)
+			{
+				size_t r = stream.Read(data + offset, size - offset);
+				if (r == 0)
+					break;
+				offset += r;
+			}
+			return offset;
+		}
+
+		void Skip(IObjectInputStream &stream, u64 size)
+		{
+			ByteArray buffer(std::min<u64>(size, ChunkSize));
+			while(size > 0)
+			{
+				size_t r = ReadFully(stream, buffer.data(), std::min<u64>(size, buffer.size()));
+				if (r == 0)
+					break;
+				size -= r;
+			}
+		}
+
+		ByteArray MakeHeader(ContainerType type, OperationCode code, u32 transaction, u64 payloadSize)
+		{
+			ByteArray header;
+			OutputStream stream(header);
+			u64 size = payloadSize + HeaderSize;
+			stream << static_cast<u32>(size > MaxObjectSize? MaxObjectSize: size);
+			stream << type;
+			stream << code;
+			stream << transaction;
+			return header;
+		}
+
+		ObjectId NormalizeParent(ObjectId parent)
+		{ return parent.Id == 0xffffffffu? ObjectId(0): parent; }
+	}
+
+	Responder::Responder(const std::string &model):
+		_model(model), _nextObjectId(1), _sessionOpen(false), _dataPending(false)
+	{ }
+
+	StorageId Responder::AddStorage(const std::string &description, u64 capacity)
+	{
+		scoped_mutex_lock l(_mutex);
+		Storage storage;
+		storage.Id			= StorageId(static_cast<u32>(_storages.size() + 1) << 16 | 1);
+		storage.Description	= description;
+		storage.Capacity	= capacity;
+		_storages.push_back(storage);
+		return storage.Id;
+	}
+
+	ObjectId Responder::AddDirectory(StorageId storage, ObjectId parent, const std::string &name)
+	{
+		scoped_mutex_lock l(_mutex);
+		Object object = {};
+		object.Storage	= storage;
+		object.Parent	= NormalizeParent(parent);
+		object.Format	= ObjectFormat::Association;
+		object.Filename	= name;
+		return AddObject(object);
+	}
+
+	ObjectId Responder::AddFile(StorageId storage, ObjectId parent, const std::string &name, const ByteArray &data)
+	{
+		scoped_mutex_lock l(_mutex);
+		Object object = {};
+		object.Storage	= storage;
+		object.Parent	= NormalizeParent(parent);
+		object.Format	= ObjectFormatFromFilename(name);
+		object.Filename	= name;
+		object.Size		= data.size();
+		object.Data		= std::make_shared<ByteArray>(data);
+		return AddObject(object);
+	}
+
+	ObjectId Responder::AddFile(StorageId storage, ObjectId parent, const std::string &name, u64 size)
+	{
+		scoped_mutex_lock l(_mutex);
+		Object object = {};
+		object.Storage	= storage;
+		object.Parent	= NormalizeParent(parent);
+		object.Format	= ObjectFormatFromFilename(name);
+		object.Filename	= name;
+		object.Size		= size;
+		return AddObject(object);
+	}
+
+	ObjectId Responder::AddObject(Object object)
+	{
+		object.Id = ObjectId(_nextObjectId++);
+		if (!object.ModificationTime)
+			object.ModificationTime = time(nullptr);
+		_objects[object.Id] = object;
+		return object.Id;
+	}
+
+	Responder::Object * Responder::FindObject(ObjectId id)
+	{
+		auto i = _objects.find(id);
+		return i != _objects.end()? &i->second: nullptr;
+	}
+
+	const Responder::Storage * Responder::FindStorage(StorageId id) const
+	{
+		for(const auto &storage : _storages)
+			if (storage.Id == id)
+				return &storage;
+		return nullptr;
+	}
+
+	u64 Responder::GetUsedSpace(StorageId id) const
+	{
+		u64 used = 0;
+		for(const auto &kv : _objects)
+			if (kv.second.Storage == id)
+				used += kv.second.Size;
+		return used;
+	}
+
+	bool Responder::IsDescendant(const Object &object, ObjectId parent, u32 depth) const
+	{
+		u32 level = 1;
+		ObjectId id = object.Parent;
+		while(true)
+		{
+			if (id == parent)
+				return true;
+			if (id.Id == 0 || level >= depth)
+				return false;
+			auto i = _objects.find(id);
+			if (i == _objects.end())
+				return false;
+			id = i->second.Parent;
+			++level;
+		}
+	}
+
+	void Responder::RemoveObject(ObjectId id)
+	{
+		std::vector<ObjectId> children;
+		for(const auto &kv : _objects)
+			if (kv.second.Parent == id)
+				children.push_back(kv.first);
+		for(auto child : children)
+			RemoveObject(child);
+		_objects.erase(id);
+	}
+
+	ObjectId Responder::CopyObject(ObjectId id, StorageId storage, ObjectId parent)
+	{
+		std::vector<ObjectId> children;
+		for(const auto &kv : _objects)
+			if (kv.second.Parent == id)
+				children.push_back(kv.first);
+
+		Object object = _objects.at(id);
+		object.Storage = storage;
+		object.Parent = parent;
+		if (object.Data)
+			object.Data = std::make_shared<ByteArray>(*object.Data);
+		ObjectId copy = AddObject(object);
+		for(auto child : children)
+			CopyObject(child, storage, copy);
+		return copy;
+	}
+
+	void Responder::Write(const IObjectInputStreamPtr &inputStream)
+	{
+		scoped_mutex_lock l(_mutex);
+		u64 total = inputStream->GetSize();
+		u64 offset = 0;
+		while(true)
+		{
+			ByteArray header(HeaderSize);
+			size_t r = ReadFully(*inputStream, header.data(), header.size());
+			if (r == 0)
+				break;
+			if (r != header.size())
+				throw std::runtime_error("short container header");
+			offset += r;
+
+			InputStream stream(header);
+			u32 size;
+			ContainerType type;
+			Transaction transaction;
+			stream >> size;
+			stream >> type;
+			stream >> transaction.Code;
+			stream >> transaction.Id;
+			if (size < HeaderSize)
+				throw std::runtime_error("invalid container size");
+
+			u64 payload = size != MaxObjectSize? size - HeaderSize: total - offset;
+			switch(type)
+			{
+			case ContainerType::Command:
+				{
+					ByteArray data(payload);
+					if (ReadFully(*inputStream, data.data(), data.size()) != data.size())
+						throw std::runtime_error("short command container");
+					InputStream params(data);
+					for(size_t i = 0; i + 4 <= data.size(); i += 4)
+						transaction.Params.push_back(params.Read32());
+					HandleCommand(transaction);
+				}
+				break;
+			case ContainerType::Data:
+				if (_dataPending && _pending.Id == transaction.Id)
+				{
+					_dataPending = false;
+					HandleData(_pending, inputStream, payload);
+				}
+				else
+				{
+					debug("mock: dropping unexpected data for transaction ", transaction.Id);
+					Skip(*inputStream, payload);
+				}
+				break;
+			default:
+				Skip(*inputStream, payload);
+			}
+			offset += payload;
+		}
+	}
+
+	IObjectInputStreamPtr Responder::Read()
+	{
+		scoped_mutex_lock l(_mutex);
+		if (_output.empty())
+			return nullptr;
+		IObjectInputStreamPtr stream = _output.front();
+		_output.pop_front();
+		return stream;
+	}
+
+	void Responder::Cancel()
+	{
+		scoped_mutex_lock l(_mutex);
+		_output.clear();
+		_dataPending = false;
+	}
+
+	bool Responder::HasDataPhase(OperationCode code)
+	{
+		switch(code)
+		{
+		case OperationCode::SendObjectInfo:
+		case OperationCode::SendObject:
+		case OperationCode::SendPartialObject:
+		case OperationCode::SetObjectPropValue:
+		case OperationCode::SetObjectPropList:
+		case OperationCode::SendObjectPropList:
+		case OperationCode::SetDevicePropValue:
+		case OperationCode::SetObjectReferences:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	void Responder::HandleCommand(const Transaction &transaction)
+	{
+		if (!_sessionOpen && transaction.Code != OperationCode::GetDeviceInfo && transaction.Code != OperationCode::OpenSession)
+		{
+			SendResponse(transaction, ResponseType::SessionNotOpen);
+			return;
+		}
+
+		if (HasDataPhase(transaction.Code))
+		{
+			_pending = transaction;
+			_dataPending = true;
+			return;
+		}
+
+		auto param = [&transaction](size_t index) -> u32
+		{ return index < transaction.Params.size()? transaction.Params[index]: 0; };
+
+		switch(transaction.Code)
+		{
+		case OperationCode::GetDeviceInfo:
+			SendData(transaction, GetDeviceInfo());
+			SendResponse(transaction, ResponseType::OK);
+			break;
+
+		case OperationCode::OpenSession:
+			if (_sessionOpen)
+				SendResponse(transaction, ResponseType::SessionAlreadyOpen);
+			else
+			{
+				_sessionOpen = true;
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::CloseSession:
+			_sessionOpen = false;
+			SendResponse(transaction, ResponseType::OK);
+			break;
+
+		case OperationCode::GetStorageIDs:
+			{
+				ByteArray data;
+				OutputStream stream(data);
+				stream.Write32(_storages.size());
+				for(const auto &storage : _storages)
+					stream << storage.Id;
+				SendData(transaction, data);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetStorageInfo:
+			{
+				const Storage *storage = FindStorage(StorageId(param(0)));
+				if (!storage)
+				{
+					SendResponse(transaction, ResponseType::InvalidStorageID);
+					break;
+				}
+				SendData(transaction, GetStorageInfo(*storage));
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectHandles:
+			{
+				StorageId storageId(param(0));
+				u32 format = param(1);
+				ObjectId parent(param(2));
+				if (storageId.Id != 0xffffffffu && !FindStorage(storageId))
+				{
+					SendResponse(transaction, ResponseType::InvalidStorageID);
+					break;
+				}
+				if (parent.Id != 0 && parent.Id != 0xffffffffu && !FindObject(parent))
+				{
+					SendResponse(transaction, ResponseType::InvalidParentObject);
+					break;
+				}
+
+				std::vector<ObjectId> handles;
+				for(const auto &kv : _objects)
+				{
+					const Object &object = kv.second;
+					if (storageId.Id != 0xffffffffu && object.Storage != storageId)
+						continue;
+					if (format != 0 && static_cast<u32>(object.Format) != format)
+						continue;
+					if (parent.Id != 0 && object.Parent != NormalizeParent(parent))
+						continue;
+					handles.push_back(object.Id);
+				}
+
+				ByteArray data;
+				OutputStream stream(data);
+				stream.Write32(handles.size());
+				for(auto id : handles)
+					stream << id;
+				SendData(transaction, data);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectInfo:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				SendData(transaction, GetObjectInfo(*object));
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObject:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				SendData(transaction, GetContent(*object, 0, object->Size));
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetThumb:
+			SendResponse(transaction, FindObject(ObjectId(param(0)))? ResponseType::NoThumbnailPresent: ResponseType::InvalidObjectHandle);
+			break;
+
+		case OperationCode::GetPartialObject:
+		case OperationCode::GetPartialObject64:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				bool is64 = transaction.Code == OperationCode::GetPartialObject64;
+				u64 offset = is64? param(1) | (static_cast<u64>(param(2)) << 32): param(1);
+				u64 size = is64? param(3): param(2);
+				if (offset > object->Size)
+					offset = object->Size;
+				size = std::min(size, object->Size - offset);
+				SendData(transaction, GetContent(*object, offset, size));
+				SendResponse(transaction, ResponseType::OK, { static_cast<u32>(size) });
+			}
+			break;
+
+		case OperationCode::DeleteObject:
+			{
+				ObjectId id(param(0));
+				if (id.Id == 0xffffffffu)
+					_objects.clear();
+				else if (!FindObject(id))
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				else
+					RemoveObject(id);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::MoveObject:
+		case OperationCode::CopyObject:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				StorageId storageId(param(1));
+				ObjectId parent(NormalizeParent(ObjectId(param(2))));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				if (!FindStorage(storageId))
+				{
+					SendResponse(transaction, ResponseType::InvalidStorageID);
+					break;
+				}
+				if (parent.Id != 0 && !FindObject(parent))
+				{
+					SendResponse(transaction, ResponseType::InvalidParentObject);
+					break;
+				}
+				if (transaction.Code == OperationCode::CopyObject)
+				{
+					ObjectId copy = CopyObject(object->Id, storageId, parent);
+					SendResponse(transaction, ResponseType::OK, std::vector<u32>(1, copy.Id));
+					break;
+				}
+
+				for(ObjectId p = parent; p.Id != 0; p = _objects.at(p).Parent)
+				{
+					if (p == object->Id)
+					{
+						SendResponse(transaction, ResponseType::InvalidParentObject); //moving into itself
+						return;
+					}
+				}
+				std::vector<ObjectId> subtree(1, object->Id);
+				for(size_t i = 0; i < subtree.size(); ++i)
+					for(auto &kv : _objects)
+						if (kv.second.Parent == subtree[i])
+							subtree.push_back(kv.first);
+				for(auto id : subtree)
+					_objects.at(id).Storage = storageId;
+				object->Parent = parent;
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectPropsSupported:
+			{
+				ByteArray data;
+				OutputStream stream(data);
+				stream.Write32(sizeof(SupportedProperties) / sizeof(SupportedProperties[0]));
+				for(auto property : SupportedProperties)
+					stream << property;
+				SendData(transaction, data);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectPropDesc:
+			{
+				auto property = static_cast<ObjectProperty>(param(0));
+				Object object = Object();
+				object.Format = static_cast<ObjectFormat>(param(1));
+				ByteArray value;
+				OutputStream valueStream(value);
+				DataTypeCode type;
+				if (!WriteProperty(valueStream, object, property, type))
+				{
+					SendResponse(transaction, ResponseType::ObjectPropNotSupported);
+					break;
+				}
+				ByteArray data;
+				OutputStream stream(data);
+				stream << property;
+				stream << type;
+				stream.Write8(property == ObjectProperty::ObjectFilename? 1: 0);
+				data.insert(data.end(), value.begin(), value.end());
+				stream.Write32(0); //group code
+				stream.Write8(0); //form flag
+				SendData(transaction, data);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectPropValue:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				ByteArray data;
+				OutputStream stream(data);
+				DataTypeCode type;
+				if (!WriteProperty(stream, *object, static_cast<ObjectProperty>(param(1)), type))
+				{
+					SendResponse(transaction, ResponseType::ObjectPropNotSupported);
+					break;
+				}
+				SendData(transaction, data);
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		case OperationCode::GetObjectPropList:
+			{
+				ResponseType code = ResponseType::OK;
+				ByteArray data = GetObjectPropList(transaction.Params, code);
+				if (code == ResponseType::OK)
+					SendData(transaction, data);
+				SendResponse(transaction, code);
+			}
+			break;
+
+		case OperationCode::BeginEditObject:
+		case OperationCode::EndEditObject:
+		case OperationCode::TruncateObject:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				if (!object->Data)
+				{
+					SendResponse(transaction, ResponseType::ObjectWriteProtected);
+					break;
+				}
+				if (transaction.Code == OperationCode::TruncateObject)
+				{
+					object->Data->resize(param(1) | (static_cast<u64>(param(2)) << 32));
+					object->Size = object->Data->size();
+					object->ModificationTime = time(nullptr);
+				}
+				SendResponse(transaction, ResponseType::OK);
+			}
+			break;
+
+		default:
+			debug("mock: unsupported operation ", hex(static_cast<u16>(transaction.Code), 4));
+			SendResponse(transaction, ResponseType::OperationNotSupported);
+		}
+	}
+
+	void Responder::HandleData(const Transaction &transaction, const IObjectInputStreamPtr &inputStream, u64 size)
+	{
+		auto param = [&transaction](size_t index) -> u32
+		{ return index < transaction.Params.size()? transaction.Params[index]: 0; };
+
+		if (transaction.Code == OperationCode::SendObject)
+		{
+			Object *object = FindObject(_sendObjectId);
+			_sendObjectId = ObjectId();
+			if (!object || !object->Data)
+			{
+				Skip(*inputStream, size);
+				SendResponse(transaction, ResponseType::NoValidObjectInfo);
+				return;
+			}
+
+			ByteArray &content = *object->Data;
+			content.clear();
+			ByteArray buffer(ChunkSize);
+			while(size > 0)
+			{
+				size_t r = ReadFully(*inputStream, buffer.data(), std::min<u64>(size, buffer.size()));
+				if (r == 0)
+					break;
+				content.insert(content.end(), buffer.begin(), buffer.begin() + r);
+				size -= r;
+			}
+			object->Size = content.size();
+			SendResponse(transaction, size == 0? ResponseType::OK: ResponseType::IncompleteTransfer);
+			return;
+		}
+
+		ByteArray data(size);
+		if (ReadFully(*inputStream, data.data(), data.size()) != data.size())
+		{
+			SendResponse(transaction, ResponseType::IncompleteTransfer);
+			return;
+		}
+
+		switch(transaction.Code)
+		{
+		case OperationCode::SendObjectInfo:
+			{
+				msg::ObjectInfo oi;
+				try
+				{
+					InputStream stream(data);
+					oi.Read(stream);
+				}
+				catch(const std::exception &ex)
+				{
+					SendResponse(transaction, ResponseType::InvalidDataset);
+					break;
+				}
+
+				StorageId storageId(param(0));
+				if (storageId.Id == 0 && !_storages.empty())
+					storageId = _storages.front().Id;
+				const Storage *storage = FindStorage(storageId);
+				if (!storage)
+				{
+					SendResponse(transaction, ResponseType::InvalidStorageID);
+					break;
+				}
+
+				ObjectId parent = NormalizeParent(ObjectId(param(1)));
+				if (parent.Id != 0)
+				{
+					Object *parentObject = FindObject(parent);
+					if (!parentObject || parentObject->Format != ObjectFormat::Association)
+					{
+						SendResponse(transaction, ResponseType::InvalidParentObject);
+						break;
+					}
+				}
+
+				Object object = {};
+				object.Storage			= storageId;
+				object.Parent			= parent;
+				object.Format			= oi.ObjectFormat;
+				object.Filename			= oi.Filename;
+				object.ModificationTime	= ConvertDateTime(oi.ModificationDate);
+				if (object.Format != ObjectFormat::Association)
+				{
+					object.Size = oi.ObjectCompressedSize;
+					object.Data = std::make_shared<ByteArray>();
+				}
+				if (object.Size != MaxObjectSize && GetUsedSpace(storageId) + object.Size > storage->Capacity)
+				{
+					SendResponse(transaction, ResponseType::StoreFull);
+					break;
+				}
+
+				ObjectId id = AddObject(object);
+				if (object.Data)
+					_sendObjectId = id;
+				SendResponse(transaction, ResponseType::OK, { storageId.Id, param(1), id.Id });
+			}
+			break;
+
+		case OperationCode::SendPartialObject:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				if (!object->Data)
+				{
+					SendResponse(transaction, ResponseType::ObjectWriteProtected);
+					break;
+				}
+				u64 offset = param(1) | (static_cast<u64>(param(2)) << 32);
+				ByteArray &content = *object->Data;
+				if (offset + data.size() > content.size())
+					content.resize(offset + data.size());
+				std::copy(data.begin(), data.end(), content.begin() + offset);
+				object->Size = content.size();
+				object->ModificationTime = time(nullptr);
+				SendResponse(transaction, ResponseType::OK, { static_cast<u32>(data.size()) });
+			}
+			break;
+
+		case OperationCode::SetObjectPropValue:
+			{
+				Object *object = FindObject(ObjectId(param(0)));
+				if (!object)
+				{
+					SendResponse(transaction, ResponseType::InvalidObjectHandle);
+					break;
+				}
+				ObjectProperty property = static_cast<ObjectProperty>(param(1));
+				if (property == ObjectProperty::ObjectFilename || property == ObjectProperty::Name)
+				{
+					object->Filename = ReadSingleString(data);
+					SendResponse(transaction, ResponseType::OK);
+				}
+				else
+				{
+					ByteArray value;
+					OutputStream stream(value);
+					DataTypeCode type;
+					SendResponse(transaction, WriteProperty(stream, *object, property, type)? ResponseType::AccessDenied: ResponseType::ObjectPropNotSupported);
+				}
+			}
+			break;
+
+		case OperationCode::SetObjectPropList:
+			{
+				//entries are applied in order until the first failed one, its index is returned
+				InputStream stream(data);
+				u32 count = 0;
+				u32 index = 0;
+				ResponseType code = ResponseType::OK;
+				try
+				{
+					stream >> count;
+					for(; index < count; ++index)
+					{
+						u32 objectId;
+						ObjectProperty property;
+						DataTypeCode type;
+						stream >> objectId;
+						stream >> property;
+						stream >> type;
+						if (type != DataTypeCode::String)
+						{
+							code = ResponseType::InvalidObjectPropFormat;
+							break;
+						}
+						std::string value;
+						stream >> value;
+
+						Object *object = FindObject(ObjectId(objectId));
+						if (!object)
+						{
+							code = ResponseType::InvalidObjectHandle;
+							break;
+						}
+						if (property != ObjectProperty::ObjectFilename && property != ObjectProperty::Name)
+						{
+							code = ResponseType::AccessDenied;
+							break;
+						}
+						object->Filename = value;
+					}
+				}
+				catch(const std::exception &ex)
+				{ code = ResponseType::InvalidDataset; }
+
+				if (code == ResponseType::OK)
+					SendResponse(transaction, code);
+				else
+					SendResponse(transaction, code, { index });
+			}
+			break;
+
+		default:
+			SendResponse(transaction, ResponseType::OperationNotSupported);
+		}
+	}
+
+	void Responder::SendData(const Transaction &transaction, const ByteArray &data)
+	{
+		ByteArray container = MakeHeader(ContainerType::Data, transaction.Code, transaction.Id, data.size());
+		container.insert(container.end(), data.begin(), data.end());
+		_output.push_back(std::make_shared<ByteArrayObjectInputStream>(std::move(container)));
+	}
+
+	void Responder::SendData(const Transaction &transaction, const IObjectInputStreamPtr &inputStream)
+	{
+		auto header = std::make_shared<ByteArrayObjectInputStream>(MakeHeader(ContainerType::Data, transaction.Code, transaction.Id, inputStream->GetSize()));
+		_output.push_back(std::make_shared<JoinedObjectInputStream>(header, inputStream));
+	}
+
+	void Responder::SendResponse(const Transaction &transaction, ResponseType code, const std::vector<u32> &params)
+	{
+		ByteArray container = MakeHeader(ContainerType::Response, static_cast<OperationCode>(code), transaction.Id, params.size() * 4);
+		OutputStream stream(container);
+		for(auto param : params)
+			stream << param;
+		_output.push_back(std::make_shared<ByteArrayObjectInputStream>(std::move(container)));
+	}
+
+	void Responder::PostEvent(EventCode code, const std::vector<u32> &params)
+	{
+		ByteArray container = MakeHeader(ContainerType::Event, static_cast<OperationCode>(code), 0, params.size() * 4);
+		OutputStream stream(container);
+		for(auto param : params)
+			stream << param;
+
+		scoped_mutex_lock l(_mutex);
+		_events.push_back(std::move(container));
+		_eventPosted.notify_one();
+	}
+
+	bool Responder::ReadEvent(ByteArray &data, int timeout)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		if (!_eventPosted.wait_for(l, std::chrono::milliseconds(timeout), [this]() { return !_events.empty(); }))
+		{
+			data.clear();
+			return false;
+		}
+		data.assign(_events.front().begin(), _events.front().end());
+		_events.pop_front();
+		return true;
+	}
+
+	ByteArray Responder::GetDeviceInfo() const
+	{
+		ByteArray data;
+		OutputStream stream(data);
+		stream.Write16(100);
+		stream.Write32(6);
+		stream.Write16(100);
+		stream << std::string("microsoft.com: 1.0; android.com: 1.0;");
+		stream.Write16(0);
+		stream << std::vector<OperationCode>(std::begin(SupportedOperations), std::end(SupportedOperations));
+		stream << std::vector<u16>();
+		stream << std::vector<u16>();
+		stream << std::vector<u16>();
+		stream << std::vector<u16>();
+		stream << std::string("Android File Transfer");
+		stream << _model;
+		stream << std::string("1.0");
+		stream << std::string("0123456789abcdef");
+		return data;
+	}
+
+	ByteArray Responder::GetStorageInfo(const Storage &storage) const
+	{
+		u64 used = GetUsedSpace(storage.Id);
+		ByteArray data;
+		OutputStream stream(data);
+		stream.Write16(0x0003); //fixed ram
+		stream.Write16(0x0002); //generic hierarchical
+		stream.Write16(0x0000); //read-write
+		stream.Write64(storage.Capacity);
+		stream.Write64(used < storage.Capacity? storage.Capacity - used: 0);
+		stream.Write32(0xffffffffu);
+		stream << storage.Description;
+		stream << std::string();
+		return data;
+	}
+
+	ByteArray Responder::GetObjectInfo(const Object &object) const
+	{
+		msg::ObjectInfo oi;
+		oi.StorageId		= object.Storage;
+		oi.ObjectFormat		= object.Format;
+		oi.SetSize(object.Size);
+		oi.ParentObject		= object.Parent;
+		if (object.Format == ObjectFormat::Association)
+			oi.AssociationType = AssociationType::GenericFolder;
+		oi.Filename			= object.Filename;
+		oi.CaptureDate		= ConvertDateTime(object.ModificationTime);
+		oi.ModificationDate	= oi.CaptureDate;
+
+		ByteArray data;
+		OutputStream stream(data);
+		oi.Write(stream);
+		return data;
+	}
+
+	bool Responder::WriteProperty(OutputStream &stream, const Object &object, ObjectProperty property, DataTypeCode &type) const
+	{
+		switch(property)
+		{
+		case ObjectProperty::StorageId:
+			type = DataTypeCode::Uint32;
+			stream << object.Storage;
+			return true;
+		case ObjectProperty::ObjectFormat:
+			type = DataTypeCode::Uint16;
+			stream << object.Format;
+			return true;
+		case ObjectProperty::ProtectionStatus:
+			type = DataTypeCode::Uint16;
+			stream.Write16(0);
+			return true;
+		case ObjectProperty::ObjectSize:
+			type = DataTypeCode::Uint64;
+			stream.Write64(object.Size);
+			return true;
+		case ObjectProperty::AssociationType:
+			type = DataTypeCode::Uint16;
+			stream << (object.Format == ObjectFormat::Association? AssociationType::GenericFolder: AssociationType());
+			return true;
+		case ObjectProperty::ObjectFilename:
+		case ObjectProperty::Name:
+			type = DataTypeCode::String;
+			stream << object.Filename;
+			return true;
+		case ObjectProperty::DateModified:
+			type = DataTypeCode::String;
+			stream << ConvertDateTime(object.ModificationTime);
+			return true;
+		case ObjectProperty::ParentObject:
+			type = DataTypeCode::Uint32;
+			stream << object.Parent;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	ByteArray Responder::GetObjectPropList(const std::vector<u32> &params, ResponseType &code)
+	{
+		auto param = [&params](size_t index) -> u32
+		{ return index < params.size()? params[index]: 0; };
+
+		ObjectId handle(param(0));
+		u32 format = param(1);
+		u32 propertyCode = param(2);
+		u32 depth = param(4);
+
+		std::vector<ObjectProperty> properties;
+		if (propertyCode == 0xffffffffu)
+			properties.assign(std::begin(SupportedProperties), std::end(SupportedProperties));
+		else if (propertyCode == 0)
+		{
+			code = ResponseType::UnsupportedSpecByGroup;
+			return ByteArray();
+		}
+		else
+			properties.push_back(static_cast<ObjectProperty>(propertyCode));
+
+		if (handle.Id != 0 && handle.Id != 0xffffffffu && !FindObject(handle))
+		{
+			code = ResponseType::InvalidObjectHandle;
+			return ByteArray();
+		}
+
+		ByteArray body;
+		OutputStream stream(body);
+		u32 n = 0;
+		for(const auto &kv : _objects)
+		{
+			const Object &object = kv.second;
+			bool match;
+			if (handle.Id == 0xffffffffu)
+				match = true;
+			else if (depth == 0)
+				match = object.Id == handle;
+			else
+				match = IsDescendant(object, handle, depth);
+
+			if (!match || (format != 0 && static_cast<u32>(object.Format) != format))
+				continue;
+
+			for(auto property : properties)
+			{
+				ByteArray value;
+				OutputStream valueStream(value);
+				DataTypeCode type;
+				if (!WriteProperty(valueStream, object, property, type))
+					continue;
+				stream << object.Id;
+				stream << property;
+				stream << type;
+				body.insert(body.end(), value.begin(), value.end());
+				++n;
+			}
+		}
+
+		ByteArray data;
+		OutputStream dataStream(data);
+		dataStream.Write32(n);
+		data.insert(data.end(), body.begin(), body.end());
+		code = ResponseType::OK;
+		return data;
+	}
+
+	IObjectInputStreamPtr Responder::GetContent(const Object &object, u64 offset, u64 size) const
+	{ return std::make_shared<ContentInputStream>(object.Data, offset, size); }
+
+}}
@@ -0,0 +1,143 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MOCK_RESPONDER_H
+#define AFT_MOCK_RESPONDER_H
+
+#include <mtp/ByteArray.h>
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/ObjectProperty.h>
+#include <mtp/ptp/EventCode.h>
+#include <mtp/ptp/OperationCode.h>
+#include <mtp/ptp/Response.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
+#include <time.h>
+
+namespace mtp
+{
+	class OutputStream;
+}
+
+namespace mtp { namespace mock
+{
+	class Responder;
+	DECLARE_PTR(Responder);
+
+	class Responder : Noncopyable //! In-process MTP responder emulating device with in-memory storages, used by \ref BulkPipe
+	{
+	public:
+		struct Object //! in-memory object
+		{
+			ObjectId			Id;
+			StorageId			Storage;
+			ObjectId			Parent;
+			ObjectFormat		Format;
+			std::string			Filename;
+			time_t				ModificationTime;
+			u64					Size;
+			ByteArrayPtr		Data; //!< object content, generated from offset if null
+		};
+
+	private:
+		struct Storage
+		{
+			StorageId			Id;
+			std::string			Description;
+			u64					Capacity;
+		};
+
+		struct Transaction
+		{
+			OperationCode		Code;
+			u32					Id;
+			std::vector<u32>	Params;
+		};
+
+		std::mutex							_mutex;
+		std::string							_model;
+		std::vector<Storage>				_storages;
+		std::map<ObjectId, Object>			_objects;
+		u32									_nextObjectId;
+		bool								_sessionOpen;
+		ObjectId							_sendObjectId;
+		bool								_dataPending;
+		Transaction							_pending;
+		std::deque<IObjectInputStreamPtr>	_output;
+		std::condition_variable				_eventPosted;
+		std::deque<ByteArray>				_events;
+
+	public:
+		Responder(const std::string &model = "Mock Device");
+
+		StorageId AddStorage(const std::string &description, u64 capacity);
+		ObjectId AddDirectory(StorageId storage, ObjectId parent, const std::string &name);
+		ObjectId AddFile(StorageId storage, ObjectId parent, const std::string &name, const ByteArray &data);
+		///adds file with generated content, see \ref GetPattern
+		ObjectId AddFile(StorageId storage, ObjectId parent, const std::string &name, u64 size);
+
+		///byte of generated file content at given offset
+		static u8 GetPattern(u64 offset)
+		{ return static_cast<u8>(offset ^ (offset >> 8) ^ (offset >> 16)); }
+
+		///consumes container(s) sent by host
+		void Write(const IObjectInputStreamPtr &inputStream);
+		///returns next container for host, nullptr if nothing is queued
+		IObjectInputStreamPtr Read();
+		///drops queued containers and pending data phase
+		void Cancel();
+
+		///queues event container for host interrupt endpoint
+		void PostEvent(EventCode code, const std::vector<u32> &params = std::vector<u32>());
+		///waits up to timeout ms for queued event, returns false if there was none
+		bool ReadEvent(ByteArray &data, int timeout);
+
+	private:
+		ObjectId AddObject(Object object);
+		Object * FindObject(ObjectId id);
+		const Storage * FindStorage(StorageId id) const;
+		u64 GetUsedSpace(StorageId id) const;
+		bool IsDescendant(const Object &object, ObjectId parent, u32 depth) const;
+		void RemoveObject(ObjectId id);
+		///copies object with its children, returns id of the copy
+		ObjectId CopyObject(ObjectId id, StorageId storage, ObjectId parent);
+
+		static bool HasDataPhase(OperationCode code);
+		void HandleCommand(const Transaction &transaction);
+		void HandleData(const Transaction &transaction, const IObjectInputStreamPtr &inputStream, u64 size);
+
+		void SendData(const Transaction &transaction, const ByteArray &data);
+		void SendData(const Transaction &transaction, const IObjectInputStreamPtr &inputStream);
+		void SendResponse(const Transaction &transaction, ResponseType code, const std::vector<u32> &params = std::vector<u32>());
+
+		ByteArray GetDeviceInfo() const;
+		ByteArray GetStorageInfo(const Storage &storage) const;
+		ByteArray GetObjectInfo(const Object &object) const;
+		ByteArray GetObjectPropList(const std::vector<u32> &params, ResponseType &code);
+		bool WriteProperty(OutputStream &stream, const Object &object, ObjectProperty property, DataTypeCode &type) const;
+		IObjectInputStreamPtr GetContent(const Object &object, u64 offset, u64 size) const;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,671 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/net/Broker.h>
+#include <mtp/net/RelayStreams.h>
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/ptp/PipePacketer.h>
+#include <mtp/ptp/Response.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/log.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mtp { namespace net
+{
+
+	using FrameType = Channel::FrameType;
+
+	namespace
+	{
+		const size_t HeaderSize = 12;
+		const size_t MaxCommandSize = HeaderSize + 5 * 4;
+		const int DrainTimeout = 100;
+		const int AbandonReads = 100;
+
+		u32 Get32(const u8 *src)
+		{ return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<u32>(src[3]) << 24); }
+
+		u16 Get16(const u8 *src)
+		{ return src[0] | (src[1] << 8); }
+
+		class ContainerRewriter //! replaces transaction id in headers of containers passing through, stream must start at container boundary
+		{
+			u32				_transactionId;
+			u8				_header[HeaderSize];
+			size_t			_headerOffset;
+			u64				_remaining;
+			bool			_unbounded;
+			bool			_response;
+			ResponseType	_responseCode;
+
+		public:
+			ContainerRewriter(u32 transactionId): _transactionId(transactionId), _headerOffset(0), _remaining(0), _unbounded(false), _response(false), _responseCode()
+			{ }
+
+			///true if response container passed through
+			bool ResponseSeen() const
+			{ return _response; }
+			ResponseType GetResponseCode() const
+			{ return _responseCode; }
+
+			void Rewrite(u8 *data, size_t size)
+			{
+				while(size)
+				{
+					if (_headerOffset < HeaderSize)
+					{
+						_header[_headerOffset] = *data;
+						if (_headerOffset >= 8)
+							*data = _transactionId >> (8 * (_headerOffset - 8));
+						++data;
+						--size;
+						if (++_headerOffset == HeaderSize)
+						{
+							u32 length = Get32(_header);
+							_unbounded = length == MaxObjectSize; //bogus length of huge data phase, it lasts until end of transfer
+							_remaining = length > HeaderSize? length - HeaderSize: 0;
+							if (static_cast<ContainerType>(Get16(_header + 4)) == ContainerType::Response)
+							{
+								_response = true;
+								_responseCode = static_cast<ResponseType>(Get16(_header + 6));
+							}
+							if (!_unbounded && !_remaining)
+								_headerOffset = 0;
+						}
+						continue;
+					}
+
+					if (_unbounded)
+						return;
+					size_t n = std::min<u64>(size, _remaining);
+					data += n;
+					size -= n;
+					_remaining -= n;
+					if (!_remaining)
+						_headerOffset = 0;
+				}
+			}
+		};
+
+		class BrokerInputStream final: public IObjectInputStream, public CancellableStream //! client write with already received head, rewritten on the way to device
+		{
+			ByteArray						_head;
+			size_t							_offset;
+			std::shared_ptr<RelayInputStream>	_input;
+			ContainerRewriter				_rewriter;
+
+		public:
+			BrokerInputStream(ByteArray && head, const std::shared_ptr<RelayInputStream> &input, u32 transactionId):
+				_head(std::move(head)), _offset(0), _input(input), _rewriter(transactionId)
+			{ }
+
+			virtual u64 GetSize() const
+			{ return _input->GetSize(); }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				CheckCancelled();
+				size_t r;
+				if (_offset < _head.size())
+				{
+					r = std::min(size, _head.size() - _offset);
+					std::copy(_head.begin() + _offset, _head.begin() + _offset + r, data);
+					_offset += r;
+				}
+				else
+					r = _input->Read(data, size);
+				_rewriter.Rewrite(data, r);
+				return r;
+			}
+		};
+
+		class BrokerOutputStream final: public IObjectOutputStream, public CancellableStream //! device transfer rewritten for client, optionally recorded for reply cache, dropped if there's no output
+		{
+			std::shared_ptr<RelayOutputStream>	_output;
+			ContainerRewriter					_rewriter;
+			ByteArray							_buffer;
+			ByteArray *							_recording;
+			size_t								_limit;
+			bool								_overflow;
+
+		public:
+			BrokerOutputStream(const std::shared_ptr<RelayOutputStream> &output, u32 transactionId, ByteArray *recording = nullptr, size_t limit = 0):
+				_output(output), _rewriter(transactionId), _recording(recording), _limit(limit), _overflow(false)
+			{ }
+
+			const ContainerRewriter & GetRewriter() const
+			{ return _rewriter; }
+
+			bool Overflow() const
+			{ return _overflow; }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				CheckCancelled();
+				_buffer.assign(data, data + size);
+				_rewriter.Rewrite(_buffer.data(), _buffer.size());
+				if (_recording && !_overflow)
+				{
+					if (_recording->size() + size <= _limit)
+						_recording->insert(_recording->end(), _buffer.begin(), _buffer.end());
+					else
+					{
+						_overflow = true;
+						ByteArray().swap(*_recording);
+					}
+				}
+				if (_output)
+					_output->Write(_buffer.data(), _buffer.size());
+				return size;
+			}
+		};
+
+		ByteArray MakeResponse(ResponseType code, u32 transactionId)
+		{
+			ByteArray data;
+			OutputStream stream(data);
+			stream.Write32(HeaderSize);
+			stream.Write16(static_cast<u16>(ContainerType::Response));
+			stream.Write16(static_cast<u16>(code));
+			stream.Write32(transactionId);
+			return data;
+		}
+	}
+
+	class Broker::Client : Noncopyable //! connection of single client, its requests are run from its own thread
+	{
+		Broker &				_broker;
+		int						_fd; //owned by channel, kept to shut connection down
+		Channel					_channel;
+		std::thread				_thread;
+		std::atomic_bool		_finished;
+		std::atomic<u32>		_cancelled; //highest cancelled sequence number
+		std::atomic<u32>		_current; //sequence number of operation in progress
+
+		bool					_running; //device is held between command and response
+		bool					_holding; //device is kept after SendObjectInfo/SendObjectPropList until its SendObject finishes
+		OperationCode			_code;
+		u32						_transactionId; //as sent by client
+		u32						_deviceTransactionId;
+		std::deque<ByteArray>	_replies; //transfers answered by broker itself
+		bool					_recording;
+		ByteArray				_key;
+		Reply					_reply;
+
+	public:
+		Client(Broker &broker, int fd):
+			_broker(broker), _fd(fd), _channel(fd), _finished(false), _cancelled(0), _current(0),
+			_running(false), _holding(false), _code(), _transactionId(0), _deviceTransactionId(0), _recording(false)
+		{ }
+
+		~Client()
+		{
+			shutdown(_fd, SHUT_RDWR);
+			if (_thread.joinable())
+				_thread.join();
+		}
+
+		void Start()
+		{ _thread = std::thread([this]() { Serve(); }); }
+
+		bool IsFinished() const
+		{ return _finished.load(); }
+
+		void SendEvent(const ByteArray &data)
+		{
+			try
+			{ _channel.Send(FrameType::Event, 0, data); }
+			catch(const std::exception &)
+			{ } //disconnected, its thread is finishing
+		}
+
+	private:
+		void Serve()
+		{
+			_channel.Start([this](Channel::Frame &frame) { return OnFrame(frame); });
+			try
+			{
+				ReceiveAuth(_channel, _broker._token);
+				SendHello(_channel, _broker._device->GetVendorId(), _broker._device->GetProductId(), _broker._device->GetBusPath());
+				while(true)
+				{
+					Channel::Frame frame;
+					_channel.Receive(frame, -1);
+					switch(frame.Type)
+					{
+					case FrameType::Read:
+						Read(frame);
+						break;
+					case FrameType::Write:
+						Write(frame);
+						break;
+					default:
+						break; //leftovers of failed write
+					}
+				}
+			}
+			catch(const std::exception &ex)
+			{ debug("broker client disconnected: ", ex.what()); }
+
+			if (_running)
+				Abandon();
+			else if (_holding)
+				Finish();
+			_finished.store(true);
+		}
+
+		bool OnFrame(Channel::Frame &frame)
+		{
+			if (frame.Type != FrameType::Cancel)
+				return false;
+
+			u32 seq = frame.Seq, cancelled = _cancelled.load();
+			while(seq > cancelled && !_cancelled.compare_exchange_weak(cancelled, seq))
+				;
+			if (_current.load() <= seq)
+				_broker.Cancel(*this);
+			return true;
+		}
+
+		void CheckCancelled(u32 seq) const
+		{
+			if (seq <= _cancelled.load())
+				throw OperationCancelledException();
+		}
+
+		///device is released unless object info was just accepted, the device expects its SendObject from the same client
+		void Finish(bool hold = false)
+		{
+			_running = false;
+			_recording = false;
+			_reply.clear();
+			_holding = hold;
+			if (!hold)
+				_broker.Release(*this);
+		}
+
+		///device finishes transaction of disconnected client on its own, everything it sends is dropped
+		void Abandon()
+		{
+			debug("aborting transaction ", hex(_deviceTransactionId, 8), " of disconnected client");
+			try
+			{
+				PipePacketer(_broker._pipe).Abort(_deviceTransactionId, DrainTimeout * 10);
+				auto drain = std::make_shared<BrokerOutputStream>(nullptr, _deviceTransactionId);
+				for(int i = 0; i < AbandonReads && !drain->GetRewriter().ResponseSeen(); ++i)
+					_broker._pipe->Read(drain, DrainTimeout);
+			}
+			catch(const std::exception &ex)
+			{ debug("draining abandoned transaction stopped: ", ex.what()); }
+			Finish();
+		}
+
+		///reads from client until head holds size bytes or write ends
+		static void ReadHead(RelayInputStream &input, ByteArray &head, size_t size)
+		{
+			size_t offset = head.size();
+			head.resize(size);
+			while(offset < size)
+			{
+				size_t r = input.Read(head.data() + offset, size - offset);
+				if (!r)
+					break;
+				offset += r;
+			}
+			head.resize(offset);
+		}
+
+		void Write(const Channel::Frame &request)
+		{
+			InputStream is(request.Data);
+			u64 size = is.Read64();
+			int timeout = is.Read32();
+			auto input = std::make_shared<RelayInputStream>(_channel, request.Seq, size);
+			_current.store(request.Seq);
+			bool started = false;
+			try
+			{
+				CheckCancelled(request.Seq);
+				ByteArray head;
+				ReadHead(*input, head, HeaderSize);
+				if (head.size() < HeaderSize)
+					throw std::runtime_error("short container written");
+
+				if (static_cast<ContainerType>(Get16(head.data() + 4)) == ContainerType::Command)
+				{
+					if (_running)
+						throw std::runtime_error("command sent before response of previous transaction");
+
+					ReadHead(*input, head, std::min<size_t>(std::max<size_t>(Get32(head.data()), HeaderSize), MaxCommandSize));
+					OperationCode code = static_cast<OperationCode>(Get16(head.data() + 6));
+					_transactionId = Get32(head.data() + 8);
+
+					if (code == OperationCode::OpenSession || code == OperationCode::CloseSession)
+					{
+						//session of broker stays open for everyone
+						input->Drain();
+						_replies.push_back(MakeResponse(ResponseType::OK, _transactionId));
+						return;
+					}
+
+					//everything but length and transaction id identifies request
+					ByteArray key(head.begin() + 4, head.begin() + 8);
+					key.insert(key.end(), head.begin() + HeaderSize, head.end());
+					bool cacheable = IsCacheable(code) && head.size() == size;
+					if (cacheable)
+					{
+						Reply reply;
+						if (_broker.FindReply(key, reply))
+						{
+							input->Drain();
+							for(auto & transfer : reply)
+								_replies.push_back(std::move(transfer));
+							return;
+						}
+					}
+
+					_deviceTransactionId = _broker.Acquire(*this, GetPriority(code));
+					_running = started = true;
+					_code = code;
+					if (!IsReadOnly(code))
+						_broker.Invalidate();
+					_recording = cacheable;
+					_key = std::move(key);
+					_reply.clear();
+				}
+				else if (!_running)
+					throw std::runtime_error("data written outside of transaction");
+
+				auto stream = std::make_shared<BrokerInputStream>(std::move(head), input, _deviceTransactionId);
+				_broker._pipe->Write(stream, timeout);
+				input->Drain();
+			}
+			catch(const std::exception &ex)
+			{
+				if (started)
+					Finish(); //command did not reach device
+				if (_channel.IsClosed())
+					throw;
+				SendError(_channel, request, ex);
+				input->Drain();
+			}
+		}
+
+		void Read(const Channel::Frame &request)
+		{
+			InputStream is(request.Data);
+			int timeout = is.Read32();
+			auto output = std::make_shared<RelayOutputStream>(_channel, request.Seq);
+			_current.store(request.Seq);
+			try
+			{
+				CheckCancelled(request.Seq);
+				if (!_replies.empty())
+				{
+					ByteArray data = std::move(_replies.front());
+					_replies.pop_front();
+					ContainerRewriter(_transactionId).Rewrite(data.data(), data.size());
+					output->Write(data.data(), data.size());
+					output->Flush();
+					_channel.Send(FrameType::End, request.Seq);
+					return;
+				}
+				if (!_running)
+					throw usb::TimeoutException("no transaction in progress"); //drain reads of resyncing client
+
+				ByteArray transfer;
+				auto stream = std::make_shared<BrokerOutputStream>(output, _transactionId, _recording? &transfer: nullptr, MaxCachedReply);
+				_broker._pipe->Read(stream, timeout);
+				output->Flush();
+
+				if (_recording)
+				{
+					if (stream->Overflow())
+						_recording = false;
+					else
+						_reply.push_back(std::move(transfer));
+				}
+				const ContainerRewriter &rewriter = stream->GetRewriter();
+				if (rewriter.ResponseSeen())
+				{
+					bool ok = rewriter.GetResponseCode() == ResponseType::OK;
+					if (_recording && ok)
+						_broker.StoreReply(_key, std::move(_reply));
+					Finish(ok && (_code == OperationCode::SendObjectInfo || _code == OperationCode::SendObjectPropList));
+				}
+				_channel.Send(FrameType::End, request.Seq);
+			}
+			catch(const std::exception &ex)
+			{
+				if (_channel.IsClosed())
+					throw;
+				SendError(_channel, request, ex);
+			}
+		}
+	};
+
+	Broker::Broker(const DevicePtr &device, const std::string &address, const std::string &token, u32 sessionId):
+		_device(device), _session(device->OpenSession(sessionId)), _pipe(device->GetPipe()), _token(token), _fd(Channel::Listen(address, !token.empty())),
+		_owner(nullptr), _nextTransactionId(FirstTransactionId), _cacheSize(0), _cacheHits(0), _cacheMisses(0), _stopped(false)
+	{ _events = std::thread([this]() { ForwardEvents(); }); }
+
+	Broker::~Broker()
+	{
+		close(_fd);
+		_stopped.store(true);
+		_events.join();
+		Reap(true);
+	}
+
+	Broker::Priority Broker::GetPriority(OperationCode code)
+	{
+		switch(code)
+		{
+		case OperationCode::GetObject:
+		case OperationCode::GetPartialObject:
+		case OperationCode::GetPartialObject64:
+		case OperationCode::SendObject:
+		case OperationCode::SendPartialObject:
+			return Priority::Bulk;
+		default:
+			return Priority::Interactive;
+		}
+	}
+
+	bool Broker::IsCacheable(OperationCode code)
+	{
+		switch(code)
+		{
+		case OperationCode::GetDeviceInfo:
+		case OperationCode::GetStorageIDs:
+		case OperationCode::GetObjectHandles:
+		case OperationCode::GetObjectInfo:
+		case OperationCode::GetObjectPropsSupported:
+		case OperationCode::GetObjectPropDesc:
+		case OperationCode::GetObjectPropValue:
+		case OperationCode::GetObjectPropList:
+		case OperationCode::GetObjectReferences:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool Broker::IsReadOnly(OperationCode code)
+	{
+		switch(code)
+		{
+		case OperationCode::GetStorageInfo:
+		case OperationCode::GetNumObjects:
+		case OperationCode::GetObject:
+		case OperationCode::GetThumb:
+		case OperationCode::GetPartialObject:
+		case OperationCode::GetPartialObject64:
+		case OperationCode::GetDevicePropDesc:
+		case OperationCode::GetDevicePropValue:
+			return true;
+		default:
+			return IsCacheable(code);
+		}
+	}
+
+	u32 Broker::Acquire(Client &client, Priority priority)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		if (_owner == &client)
+			return _nextTransactionId++; //kept for SendObject after its object info
+		auto &queue = _waiting[static_cast<int>(priority)];
+		auto self = queue.insert(queue.end(), &client);
+		auto &interactive = _waiting[static_cast<int>(Priority::Interactive)];
+		_released.wait(l, [&]()
+		{
+			if (_owner)
+				return false;
+			return priority == Priority::Interactive? interactive.front() == &client: interactive.empty() && queue.front() == &client;
+		});
+		queue.erase(self);
+		_owner = &client;
+		return _nextTransactionId++;
+	}
+
+	void Broker::Release(Client &client)
+	{
+		{
+			scoped_mutex_lock l(_mutex);
+			if (_owner != &client)
+				return;
+			_owner = nullptr;
+		}
+		_released.notify_all();
+	}
+
+	void Broker::Cancel(Client &client)
+	{
+		scoped_mutex_lock l(_mutex);
+		if (_owner == &client)
+			_pipe->Cancel();
+	}
+
+	bool Broker::FindReply(const ByteArray &key, Reply &reply)
+	{
+		scoped_mutex_lock l(_cacheMutex);
+		auto i = _cache.find(key);
+		if (i == _cache.end())
+		{
+			++_cacheMisses;
+			return false;
+		}
+		++_cacheHits;
+		reply = i->second;
+		return true;
+	}
+
+	void Broker::StoreReply(const ByteArray &key, Reply && reply)
+	{
+		size_t size = key.size();
+		for(auto & transfer : reply)
+			size += transfer.size();
+
+		scoped_mutex_lock l(_cacheMutex);
+		if (_cacheSize + size > MaxCacheSize)
+		{
+			_cache.clear(); //metadata is refetched cheaply, keeping it simple beats tracking use
+			_cacheSize = 0;
+		}
+		if (_cache.emplace(key, std::move(reply)).second)
+			_cacheSize += size;
+	}
+
+	void Broker::Invalidate()
+	{
+		scoped_mutex_lock l(_cacheMutex);
+		_cache.clear();
+		_cacheSize = 0;
+	}
+
+	void Broker::ForwardEvents()
+	{
+		ByteArray data;
+		while(!_stopped.load())
+		{
+			try
+			{
+				if (!_pipe->ReadInterrupt(data, EventPollTimeout))
+					continue;
+			}
+			catch(const std::exception &ex)
+			{
+				debug("broker event forwarding stopped: ", ex.what());
+				return;
+			}
+
+			Invalidate(); //anything could have changed behind cached replies
+			scoped_mutex_lock l(_clientsMutex);
+			for(auto & client : _clients)
+				client->SendEvent(data);
+		}
+	}
+
+	void Broker::Reap(bool all)
+	{
+		std::list<ClientPtr> finished;
+		{
+			scoped_mutex_lock l(_clientsMutex);
+			for(auto i = _clients.begin(); i != _clients.end(); )
+			{
+				if (all || (*i)->IsFinished())
+				{
+					finished.push_back(*i);
+					i = _clients.erase(i);
+				}
+				else
+					++i;
+			}
+		}
+		finished.clear(); //joins client threads
+	}
+
+	void Broker::Run()
+	{
+		while(true)
+		{
+			int fd = accept(_fd, nullptr, nullptr);
+			if (fd < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				throw posix::Exception("accept");
+			}
+
+			Reap(false);
+			debug("broker client connected");
+			auto client = std::make_shared<Client>(*this, fd);
+			{
+				scoped_mutex_lock l(_clientsMutex);
+				_clients.push_back(client);
+			}
+			client->Start();
+		}
+	}
+
+}}
@@ -0,0 +1,111 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_NET_BROKER_H
+#define AFT_NET_BROKER_H
+
+#include <mtp/net/Channel.h>
+#include <mtp/ptp/Device.h>
+#include <mtp/ptp/OperationCode.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <thread>
+
+namespace mtp { namespace net
+{
+
+	class Broker : Noncopyable //! shares one device session between several \ref BulkPipe clients: whole transactions of clients are interleaved, interactive ones first, transaction ids are rewritten and replies to read-only metadata requests are cached for everyone
+	{
+	public:
+		static const int		EventPollTimeout = 1000;
+		static const u32		FirstTransactionId = 0x10000; ///< above ids used by session of broker itself, devices only match containers within transaction
+		static const size_t		MaxCachedReply = 1024 * 1024;
+		static const size_t		MaxCacheSize = 32 * 1024 * 1024;
+
+	private:
+		class Client;
+		DECLARE_PTR(Client);
+		friend class Client;
+
+		enum struct Priority
+		{
+			Interactive,
+			Bulk
+		};
+
+		typedef std::vector<ByteArray> Reply; ///< transfers read from device, data and response containers
+		typedef std::map<ByteArray, Reply> ReplyCache; ///< by command container without length and transaction id
+
+		DevicePtr				_device;
+		SessionPtr				_session;
+		usb::BulkPipePtr		_pipe;
+		std::string				_token;
+		int						_fd;
+
+		std::mutex				_mutex;
+		std::condition_variable	_released;
+		Client *				_owner; ///< client running transaction on device or holding it for SendObject
+		std::list<Client *>		_waiting[2]; ///< by priority
+		u32						_nextTransactionId;
+
+		std::mutex				_cacheMutex;
+		ReplyCache				_cache;
+		size_t					_cacheSize;
+		std::atomic<u64>		_cacheHits, _cacheMisses;
+
+		std::mutex				_clientsMutex;
+		std::list<ClientPtr>	_clients;
+
+		std::atomic_bool		_stopped;
+		std::thread				_events; ///< forwards interrupts to every client
+
+		static Priority GetPriority(OperationCode code);
+		static bool IsCacheable(OperationCode code);
+		static bool IsReadOnly(OperationCode code);
+
+		///waits until client may start transaction, returns transaction id it got on device, owner gets the next one right away
+		u32 Acquire(Client &client, Priority priority);
+		void Release(Client &client);
+		///cancels transfers of client if it's running one
+		void Cancel(Client &client);
+
+		bool FindReply(const ByteArray &key, Reply &reply);
+		void StoreReply(const ByteArray &key, Reply && reply);
+		void Invalidate();
+
+		void ForwardEvents();
+		void Reap(bool all);
+
+	public:
+		///opens session on device and binds [host:]port (see \ref Channel::Listen), ids and bus path are sent to clients with matching token for quirks lookup
+		Broker(const DevicePtr &device, const std::string &address, const std::string &token, u32 sessionId = 1);
+		~Broker();
+
+		u64 GetCacheHits() const
+		{ return _cacheHits.load(); }
+		u64 GetCacheMisses() const
+		{ return _cacheMisses.load(); }
+
+		///accepts clients and serves each from its own thread, never returns unless accept fails
+		void Run();
+	};
+
+}}
+
+#endif
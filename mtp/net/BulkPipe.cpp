@@ -0,0 +1,185 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/net/BulkPipe.h>
+#include <mtp/net/RelayStreams.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/log.h>
+
+namespace mtp { namespace net
+{
+
+	using FrameType = Channel::FrameType;
+	using ErrorKind = Channel::ErrorKind;
+
+	BulkPipe::BulkPipe(const std::string &address):
+		_channel(std::make_shared<Channel>(Channel::Connect(address))), _vendorId(0), _productId(0), _seq(0), _cancelled(false)
+	{
+		_channel->Start([this](Channel::Frame &frame) { return OnFrame(frame); });
+		SendAuth(*_channel, Channel::GetToken());
+
+		Channel::Frame hello;
+		if (!_channel->Receive(hello, NetworkTimeout))
+			throw std::runtime_error("no hello from relay " + address);
+		if (hello.Type == FrameType::Error)
+			ThrowError(hello); //token was rejected
+		if (hello.Type != FrameType::Hello)
+			throw std::runtime_error("no hello from relay " + address);
+
+		InputStream stream(hello.Data);
+		u32 magic = stream.Read32(), version = stream.Read32();
+		if (magic != Channel::Magic || version != Channel::Version)
+			throw std::runtime_error("unsupported relay protocol at " + address);
+		stream >> _vendorId >> _productId;
+		u8 busPathSize = stream.Read8();
+		stream.Require(busPathSize);
+		_busPath.assign(hello.Data.begin() + stream.GetOffset(), hello.Data.begin() + stream.GetOffset() + busPathSize);
+		debug("connected to relay ", address, ", device ", hex(_vendorId, 4), ":", hex(_productId, 4), " at ", _busPath);
+	}
+
+	bool BulkPipe::OnFrame(Channel::Frame &frame)
+	{
+		if (frame.Type != FrameType::Event)
+			return false;
+
+		{
+			scoped_mutex_lock l(_eventMutex);
+			_events.push_back(std::move(frame.Data));
+		}
+		_eventReceived.notify_all();
+		return true;
+	}
+
+	bool BulkPipe::ReadInterrupt(ByteArray &data, int timeout)
+	{
+		scoped_mutex_lock l(_eventMutex);
+		if (!_eventReceived.wait_for(l, std::chrono::milliseconds(timeout), [this]() { return !_events.empty(); }))
+		{
+			data.clear();
+			return false;
+		}
+		data = std::move(_events.front());
+		_events.pop_front();
+		return true;
+	}
+
+	void BulkPipe::ThrowError(const Channel::Frame &frame)
+	{
+		InputStream stream(frame.Data);
+		stream.Read32(); //operation
+		ErrorKind kind = static_cast<ErrorKind>(stream.Read32());
+		std::string message(frame.Data.begin() + stream.GetOffset(), frame.Data.end());
+		switch(kind)
+		{
+		case ErrorKind::Timeout:
+			throw usb::TimeoutException(message);
+		case ErrorKind::Cancelled:
+			throw OperationCancelledException();
+		default:
+			throw std::runtime_error("relay: " + message);
+		}
+	}
+
+	Channel::Frame BulkPipe::Receive(int timeout)
+	{
+		Channel::Frame frame;
+		if (!_channel->Receive(frame, timeout + NetworkTimeout))
+			throw usb::TimeoutException("relay does not respond");
+		return frame;
+	}
+
+	void BulkPipe::Read(const IObjectOutputStreamPtr &outputStream, int timeout)
+	{
+		_cancelled.store(false);
+		u32 seq = ++_seq;
+		ByteArray request(4);
+		for(size_t i = 0; i < 4; ++i)
+			request[i] = static_cast<u32>(timeout) >> (8 * i);
+		_channel->Send(FrameType::Read, seq, request);
+
+		while(true)
+		{
+			Channel::Frame frame = Receive(timeout);
+			if (frame.Seq != seq)
+			{
+				//write errors are reported asynchronously, replies to reads interrupted on this side are stale
+				if (frame.Type == FrameType::Error && frame.Seq < seq && !frame.Data.empty() && frame.Data[0] == static_cast<u8>(FrameType::Write))
+					ThrowError(frame);
+				continue;
+			}
+
+			switch(frame.Type)
+			{
+			case FrameType::Data:
+				outputStream->Write(frame.Data.data(), frame.Data.size());
+				break;
+			case FrameType::End:
+				return;
+			case FrameType::Error:
+				ThrowError(frame);
+			default:
+				throw std::runtime_error("unexpected relay frame");
+			}
+		}
+	}
+
+	void BulkPipe::Write(const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		_cancelled.store(false);
+		u32 seq = ++_seq;
+		ByteArray request(12);
+		u64 size = inputStream->GetSize();
+		for(size_t i = 0; i < 8; ++i)
+			request[i] = size >> (8 * i);
+		for(size_t i = 0; i < 4; ++i)
+			request[8 + i] = static_cast<u32>(timeout) >> (8 * i);
+		_channel->Send(FrameType::Write, seq, request);
+
+		//no acknowledge is waited for, failure is reported to the next read
+		ByteArray buffer(Channel::FrameSize);
+		try
+		{
+			while(true)
+			{
+				if (_cancelled.load())
+					throw OperationCancelledException();
+				size_t r = inputStream->Read(buffer.data(), buffer.size());
+				if (r == 0)
+					break;
+				_channel->Send(FrameType::Data, seq, buffer.data(), r);
+			}
+		}
+		catch(...)
+		{
+			//relay must not pass truncated data to device as complete
+			_channel->Send(FrameType::Cancel, seq);
+			_channel->Send(FrameType::End, seq);
+			throw;
+		}
+		_channel->Send(FrameType::End, seq);
+	}
+
+	void BulkPipe::Cancel()
+	{
+		_cancelled.store(true);
+		_channel->Send(FrameType::Cancel, _seq.load());
+	}
+
+}}
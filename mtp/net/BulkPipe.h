@@ -0,0 +1,73 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_NET_BULKPIPE_H
+#define AFT_NET_BULKPIPE_H
+
+#include <mtp/usb/BulkPipe.h>
+#include <mtp/net/Channel.h>
+#include <atomic>
+
+namespace mtp { namespace net
+{
+
+	class BulkPipe final : public usb::BulkPipe //! bulk pipe of device attached to remote \ref Relay, writes are pipelined, only reads wait for the network
+	{
+		ChannelPtr					_channel;
+		u16							_vendorId, _productId;
+		std::string					_busPath;
+
+		std::mutex					_eventMutex;
+		std::condition_variable		_eventReceived;
+		std::deque<ByteArray>		_events;
+
+		std::atomic<u32>			_seq;
+		std::atomic_bool			_cancelled;
+
+		bool OnFrame(Channel::Frame &frame);
+		Channel::Frame Receive(int timeout);
+		static void ThrowError(const Channel::Frame &frame);
+
+	public:
+		static const int NetworkTimeout = 30000; ///< added to usb timeout of an operation before relay is considered gone
+
+		///connects to host:port of relay
+		BulkPipe(const std::string &address);
+
+		u16 GetVendorId() const
+		{ return _vendorId; }
+		u16 GetProductId() const
+		{ return _productId; }
+		///bus path of device on relay host
+		const std::string & GetBusPath() const
+		{ return _busPath; }
+
+		usb::DevicePtr GetDevice() const override
+		{ return nullptr; }
+
+		bool ReadInterrupt(ByteArray &data, int timeout) override;
+		void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000) override;
+		void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000) override;
+		void Cancel() override;
+	};
+	DECLARE_PTR(BulkPipe);
+
+}}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/net/Channel.h>
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/log.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#	define MSG_NOSIGNAL 0
+#endif
+
+namespace mtp { namespace net
+{
+
+	namespace
+	{
+		const size_t HeaderSize = 12;
+
+		void Put32(u8 *dst, u32 value)
+		{
+			for(size_t i = 0; i < 4; ++i)
+				dst[i] = value >> (8 * i);
+		}
+
+		u32 Get32(const u8 *src)
+		{ return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<u32>(src[3]) << 24); }
+
+		void SetupSocket(int fd)
+		{
+			int one = 1;
+			//operation frames are small and latency bound, data frames are large anyway
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		}
+	}
+
+	Channel::Channel(int fd): _fd(fd), _queued(0), _closed(false)
+	{ SetupSocket(_fd); }
+
+	Channel::~Channel()
+	{
+		shutdown(_fd, SHUT_RDWR);
+		{
+			scoped_mutex_lock l(_mutex);
+			_closed = true;
+		}
+		_consumed.notify_all();
+		if (_reader.joinable())
+			_reader.join();
+		close(_fd);
+	}
+
+	void Channel::Start(const Handler &handler)
+	{
+		_handler = handler;
+		_reader = std::thread([this]() { ReadFrames(); });
+	}
+
+	void Channel::ReadFull(u8 *data, size_t size)
+	{
+		while(size)
+		{
+			ssize_t r = recv(_fd, data, size, 0);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0)
+				throw posix::Exception("recv");
+			if (r == 0)
+				throw std::runtime_error("relay connection closed");
+			data += r;
+			size -= r;
+		}
+	}
+
+	void Channel::ReadFrames()
+	{
+		try
+		{
+			while(true)
+			{
+				u8 header[HeaderSize];
+				ReadFull(header, sizeof(header));
+				Frame frame;
+				frame.Type = static_cast<FrameType>(Get32(header));
+				frame.Seq = Get32(header + 4);
+				u32 size = Get32(header + 8);
+				if (size > FrameSize + 4096)
+					throw std::runtime_error("relay frame too large");
+				frame.Data.resize(size);
+				ReadFull(frame.Data.data(), size);
+
+				if (_handler && _handler(frame))
+					continue;
+
+				scoped_mutex_lock l(_mutex);
+				_consumed.wait(l, [this]() { return _closed || _queued < MaxQueued; });
+				if (_closed)
+					return;
+				_queued += frame.Data.size();
+				_frames.push_back(std::move(frame));
+				l.unlock();
+				_received.notify_all();
+			}
+		}
+		catch(const std::exception &ex)
+		{
+			scoped_mutex_lock l(_mutex);
+			if (!_closed)
+				debug("relay channel: ", ex.what());
+			_closed = true;
+			_error = ex.what();
+		}
+		_received.notify_all();
+	}
+
+	void Channel::Send(FrameType type, u32 seq, const u8 *data, size_t size)
+	{
+		u8 header[HeaderSize];
+		Put32(header, static_cast<u32>(type));
+		Put32(header + 4, seq);
+		Put32(header + 8, size);
+
+		iovec iov[2];
+		iov[0].iov_base = header;
+		iov[0].iov_len = sizeof(header);
+		iov[1].iov_base = const_cast<u8 *>(data);
+		iov[1].iov_len = size;
+
+		scoped_mutex_lock l(_sendMutex);
+		size_t index = 0;
+		while(index < 2)
+		{
+			msghdr msg = {};
+			msg.msg_iov = iov + index;
+			msg.msg_iovlen = 2 - index;
+			ssize_t r = sendmsg(_fd, &msg, MSG_NOSIGNAL);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0)
+				throw posix::Exception("send");
+			size_t sent = r;
+			while(index < 2 && sent >= iov[index].iov_len)
+				sent -= iov[index++].iov_len;
+			if (index < 2)
+			{
+				iov[index].iov_base = static_cast<u8 *>(iov[index].iov_base) + sent;
+				iov[index].iov_len -= sent;
+			}
+		}
+	}
+
+	bool Channel::Receive(Frame &frame, int timeout)
+	{
+		scoped_mutex_lock l(_mutex);
+		auto ready = [this]() { return !_frames.empty() || _closed; };
+		if (timeout < 0)
+			_received.wait(l, ready);
+		else if (!_received.wait_for(l, std::chrono::milliseconds(timeout), ready))
+			return false;
+
+		if (_frames.empty())
+			throw std::runtime_error(_error.empty()? "relay connection closed": _error);
+
+		frame = std::move(_frames.front());
+		_frames.pop_front();
+		_queued -= frame.Data.size();
+		l.unlock();
+		_consumed.notify_all();
+		return true;
+	}
+
+	int Channel::Connect(const std::string &address)
+	{
+		size_t colon = address.rfind(':');
+		if (colon == address.npos)
+			throw std::runtime_error("relay address " + address + " must be host:port");
+		std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+		if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+			host = host.substr(1, host.size() - 2);
+
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *result;
+		int r = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+		if (r != 0)
+			throw std::runtime_error("cannot resolve " + address + ": " + gai_strerror(r));
+
+		int fd = -1;
+		for(addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next)
+		{
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+			{
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(result);
+		if (fd < 0)
+			throw posix::Exception("connect " + address);
+		return fd;
+	}
+
+	int Channel::Listen(const std::string &address, bool authenticated)
+	{
+		std::string host, port = address;
+		size_t colon = address.rfind(':');
+		if (colon != address.npos)
+		{
+			host = address.substr(0, colon);
+			port = address.substr(colon + 1);
+			if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+				host = host.substr(1, host.size() - 2);
+		}
+		char *end;
+		unsigned long portNumber = strtoul(port.c_str(), &end, 10);
+		if (port.empty() || *end || portNumber == 0 || portNumber > 65535)
+			throw std::runtime_error("invalid port in listen address " + address);
+
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		bool any = host == "*";
+		if (any)
+			hints.ai_flags = AI_PASSIVE; //null host is wildcard address with passive flag and loopback one without it
+		addrinfo *result;
+		int r = getaddrinfo(host.empty() || any? nullptr: host.c_str(), port.c_str(), &hints, &result);
+		if (r != 0)
+			throw std::runtime_error("cannot resolve " + address + ": " + gai_strerror(r));
+
+		//dual stack socket accepts ipv4 clients as well, localhost resolves to ipv4 loopback everywhere
+		addrinfo *ai = result;
+		int preferred = any? AF_INET6: host.empty()? AF_INET: AF_UNSPEC;
+		for(addrinfo *i = result; i && preferred != AF_UNSPEC; i = i->ai_next)
+			if (i->ai_family == preferred)
+			{ ai = i; break; }
+
+		bool loopback;
+		if (ai->ai_family == AF_INET6)
+			loopback = IN6_IS_ADDR_LOOPBACK(&reinterpret_cast<const sockaddr_in6 *>(ai->ai_addr)->sin6_addr);
+		else
+			loopback = (ntohl(reinterpret_cast<const sockaddr_in *>(ai->ai_addr)->sin_addr.s_addr) >> 24) == 127;
+		if (!loopback && !authenticated)
+		{
+			freeaddrinfo(result);
+			throw std::runtime_error(std::string("refusing to serve device on ") + address + " without authentication, set " + TokenVariable);
+		}
+
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+		{
+			freeaddrinfo(result);
+			throw posix::Exception("socket");
+		}
+
+		int one = 1, zero = 0;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (any && ai->ai_family == AF_INET6)
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+		r = bind(fd, ai->ai_addr, ai->ai_addrlen);
+		freeaddrinfo(result);
+		if (r != 0 || listen(fd, 4) != 0)
+		{
+			posix::Exception ex("bind/listen " + address);
+			close(fd);
+			throw ex;
+		}
+		return fd;
+	}
+
+	std::string Channel::GetToken()
+	{
+		const char *token = getenv(TokenVariable);
+		return token? token: std::string();
+	}
+
+}}
@@ -0,0 +1,119 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_NET_CHANNEL_H
+#define AFT_NET_CHANNEL_H
+
+#include <mtp/ByteArray.h>
+#include <mtp/types.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mtp { namespace net
+{
+
+	class Channel : Noncopyable //! framed stream socket of usb relay, frames are read ahead by background thread
+	{
+	public:
+		static const u32 Magic = 0x4e544641; //AFTN
+		static const u32 Version = 2;
+		static const size_t FrameSize = 1024 * 1024;		///< data is sent in frames this large, so network round-trips do not limit bulk throughput
+		static const size_t MaxQueued = 16 * 1024 * 1024;	///< reader stops reading socket when receiver lags behind
+		static const int AuthTimeout = 10000;				///< connection is closed if client does not authenticate in time
+		static constexpr const char * TokenVariable = "AFT_RELAY_TOKEN"; ///< shared token of relay and its clients
+
+		enum struct FrameType : u32
+		{
+			Hello	= 1, ///< relay to client: magic, version, vendor id, product id, bus path, sent once client is authenticated
+			Read	= 2, ///< client to relay: timeout, relay answers with Data frames followed by End or Error
+			Write	= 3, ///< client to relay: size and timeout, followed by Data frames and End, relay answers with Error only
+			Data	= 4,
+			End		= 5,
+			Error	= 6, ///< operation type, error kind, message
+			Event	= 7, ///< relay to client: interrupt transfer
+			Cancel	= 8, ///< client to relay: cancels operation with given sequence number and all before it
+			Auth	= 9, ///< client to relay: first frame of connection, shared token, nothing is forwarded before it matches
+		};
+
+		enum struct ErrorKind : u32
+		{
+			Other		= 0,
+			Timeout		= 1,
+			Cancelled	= 2
+		};
+
+		struct Frame
+		{
+			FrameType	Type;
+			u32			Seq; ///< sequence number of client operation frame belongs to
+			ByteArray	Data;
+		};
+
+		///called from reader thread, returns true if frame was consumed and must not be queued
+		typedef std::function<bool (Frame &frame)> Handler;
+
+	private:
+		int							_fd;
+		Handler						_handler;
+		std::mutex					_sendMutex;
+		std::mutex					_mutex;
+		std::condition_variable		_received, _consumed;
+		std::deque<Frame>			_frames;
+		size_t						_queued;
+		bool						_closed;
+		std::string					_error;
+		std::thread					_reader;
+
+		void ReadFrames();
+		void ReadFull(u8 *data, size_t size);
+
+	public:
+		///takes ownership of connected socket
+		Channel(int fd);
+		~Channel();
+
+		///starts reader thread, handler sees every frame before it is queued
+		void Start(const Handler &handler = Handler());
+
+		void Send(FrameType type, u32 seq, const u8 *data = nullptr, size_t size = 0);
+		void Send(FrameType type, u32 seq, const ByteArray &data)
+		{ Send(type, seq, data.data(), data.size()); }
+
+		///returns false on timeout, throws if connection was closed, negative timeout waits forever
+		bool Receive(Frame &frame, int timeout);
+
+		bool IsClosed()
+		{ scoped_mutex_lock l(_mutex); return _closed; }
+
+		///host:port, throws if it can't connect
+		static int Connect(const std::string &address);
+		///[host:]port, loopback if host is omitted, * binds all interfaces, throws for non-loopback address unless remote clients are authenticated
+		static int Listen(const std::string &address, bool authenticated);
+		///token from environment, empty if it is not set
+		static std::string GetToken();
+	};
+	DECLARE_PTR(Channel);
+
+}}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/net/Relay.h>
+#include <mtp/net/RelayStreams.h>
+#include <mtp/backend/posix/Exception.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/usb/TimeoutException.h>
+#include <mtp/log.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+
+namespace mtp { namespace net
+{
+
+	using FrameType = Channel::FrameType;
+
+	Relay::Relay(const usb::BulkPipePtr &pipe, u16 vendorId, u16 productId, const std::string &busPath, const std::string &address, const std::string &token):
+		_pipe(pipe), _vendorId(vendorId), _productId(productId), _busPath(busPath), _token(token), _fd(Channel::Listen(address, !token.empty())), _cancelled(0), _current(0)
+	{ }
+
+	Relay::~Relay()
+	{ close(_fd); }
+
+	void Relay::Run()
+	{
+		while(true)
+		{
+			int client = accept(_fd, nullptr, nullptr);
+			if (client < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				throw posix::Exception("accept");
+			}
+
+			debug("relay client connected");
+			try
+			{
+				Channel channel(client);
+				Serve(channel);
+			}
+			catch(const std::exception &ex)
+			{ debug("relay client disconnected: ", ex.what()); }
+		}
+	}
+
+	bool Relay::OnFrame(Channel::Frame &frame)
+	{
+		if (frame.Type != FrameType::Cancel)
+			return false;
+
+		u32 seq = frame.Seq, cancelled = _cancelled.load();
+		while(seq > cancelled && !_cancelled.compare_exchange_weak(cancelled, seq))
+			;
+		if (_current.load() <= seq)
+			_pipe->Cancel();
+		return true;
+	}
+
+	void Relay::CheckCancelled(u32 seq) const
+	{
+		if (seq <= _cancelled.load())
+			throw OperationCancelledException();
+	}
+
+	void Relay::Serve(Channel &channel)
+	{
+		_cancelled.store(0);
+		_current.store(0);
+		channel.Start([this](Channel::Frame &frame) { return OnFrame(frame); });
+
+		ReceiveAuth(channel, _token);
+		SendHello(channel, _vendorId, _productId, _busPath);
+
+		//events are forwarded while client is connected, stopped before channel is destroyed
+		std::atomic_bool connected(true);
+		std::thread events([&]()
+		{
+			ByteArray data;
+			try
+			{
+				while(connected.load())
+					if (_pipe->ReadInterrupt(data, EventPollTimeout))
+						channel.Send(FrameType::Event, 0, data);
+			}
+			catch(const std::exception &ex)
+			{ debug("relay event forwarding stopped: ", ex.what()); }
+		});
+
+		try
+		{
+			while(true)
+			{
+				Channel::Frame frame;
+				channel.Receive(frame, -1);
+				switch(frame.Type)
+				{
+				case FrameType::Read:
+					Read(channel, frame);
+					break;
+				case FrameType::Write:
+					Write(channel, frame);
+					break;
+				default:
+					break; //leftovers of failed write
+				}
+			}
+		}
+		catch(...)
+		{
+			connected.store(false);
+			events.join();
+			throw;
+		}
+	}
+
+	void Relay::Read(Channel &channel, const Channel::Frame &request)
+	{
+		InputStream is(request.Data);
+		int timeout = is.Read32();
+		auto stream = std::make_shared<RelayOutputStream>(channel, request.Seq);
+		_current.store(request.Seq);
+		try
+		{
+			CheckCancelled(request.Seq);
+			_pipe->Read(stream, timeout);
+			stream->Flush();
+			channel.Send(FrameType::End, request.Seq);
+		}
+		catch(const std::exception &ex)
+		{
+			if (channel.IsClosed())
+				throw;
+			SendError(channel, request, ex);
+		}
+	}
+
+	void Relay::Write(Channel &channel, const Channel::Frame &request)
+	{
+		InputStream is(request.Data);
+		u64 size = is.Read64();
+		int timeout = is.Read32();
+		auto stream = std::make_shared<RelayInputStream>(channel, request.Seq, size);
+		_current.store(request.Seq);
+		try
+		{
+			CheckCancelled(request.Seq);
+			_pipe->Write(stream, timeout);
+			stream->Drain();
+		}
+		catch(const std::exception &ex)
+		{
+			if (channel.IsClosed())
+				throw;
+			SendError(channel, request, ex);
+			stream->Drain();
+		}
+	}
+
+}}
@@ -0,0 +1,60 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_NET_RELAY_H
+#define AFT_NET_RELAY_H
+
+#include <mtp/net/Channel.h>
+#include <mtp/usb/BulkPipe.h>
+#include <atomic>
+
+namespace mtp { namespace net
+{
+
+	class Relay : Noncopyable //! serves bulk pipe of local device to remote \ref BulkPipe over tcp, one client at a time
+	{
+		usb::BulkPipePtr		_pipe;
+		u16						_vendorId, _productId;
+		std::string				_busPath;
+		std::string				_token;
+		int						_fd;
+
+		std::atomic<u32>		_cancelled; //highest cancelled sequence number
+		std::atomic<u32>		_current; //sequence number of operation running on the pipe
+
+		void Serve(Channel &channel);
+		void Read(Channel &channel, const Channel::Frame &request);
+		void Write(Channel &channel, const Channel::Frame &request);
+		bool OnFrame(Channel::Frame &frame);
+		void CheckCancelled(u32 seq) const;
+
+	public:
+		static const int EventPollTimeout = 1000;
+
+		///binds [host:]port (see \ref Channel::Listen), ids and bus path are sent to clients with matching token for quirks lookup
+		Relay(const usb::BulkPipePtr &pipe, u16 vendorId, u16 productId, const std::string &busPath, const std::string &address, const std::string &token);
+		~Relay();
+
+		///accepts clients one by one, never returns unless accept fails
+		void Run();
+	};
+
+}}
+
+#endif
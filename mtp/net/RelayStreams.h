@@ -0,0 +1,166 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_NET_RELAYSTREAMS_H
+#define AFT_NET_RELAYSTREAMS_H
+
+#include <mtp/net/Channel.h>
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/OutputStream.h>
+#include <mtp/usb/TimeoutException.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace mtp { namespace net
+{
+
+	class RelayOutputStream final: public IObjectOutputStream, public CancellableStream //! sends data read from device in large frames
+	{
+		Channel &	_channel;
+		u32			_seq;
+		ByteArray	_buffer;
+
+	public:
+		RelayOutputStream(Channel &channel, u32 seq): _channel(channel), _seq(seq)
+		{ _buffer.reserve(Channel::FrameSize); }
+
+		virtual size_t Write(const u8 *data, size_t size)
+		{
+			for(size_t done = 0; done < size; )
+			{
+				size_t n = std::min(size - done, Channel::FrameSize - _buffer.size());
+				_buffer.insert(_buffer.end(), data + done, data + done + n);
+				done += n;
+				if (_buffer.size() == Channel::FrameSize)
+					Flush();
+			}
+			return size;
+		}
+
+		void Flush()
+		{
+			if (!_buffer.empty())
+				_channel.Send(Channel::FrameType::Data, _seq, _buffer);
+			_buffer.clear();
+		}
+	};
+
+	class RelayInputStream final: public IObjectInputStream, public CancellableStream //! feeds data frames of client write to device
+	{
+		Channel &			_channel;
+		u32					_seq;
+		u64					_size;
+		Channel::Frame		_frame;
+		size_t				_offset;
+		bool				_ended;
+
+	public:
+		RelayInputStream(Channel &channel, u32 seq, u64 size): _channel(channel), _seq(seq), _size(size), _offset(0), _ended(false)
+		{ }
+
+		bool Ended() const
+		{ return _ended; }
+
+		virtual u64 GetSize() const
+		{ return _size; }
+
+		virtual size_t Read(u8 *data, size_t size)
+		{
+			CheckCancelled();
+			while(!_ended && _offset >= _frame.Data.size())
+			{
+				_channel.Receive(_frame, -1);
+				_offset = 0;
+				if (_frame.Seq != _seq)
+					continue;
+				if (_frame.Type == Channel::FrameType::End)
+					_ended = true;
+				else if (_frame.Type != Channel::FrameType::Data)
+					throw std::runtime_error("unexpected frame in relayed write");
+			}
+			if (_ended)
+				return 0;
+			size_t n = std::min(size, _frame.Data.size() - _offset);
+			std::copy(_frame.Data.begin() + _offset, _frame.Data.begin() + _offset + n, data);
+			_offset += n;
+			return n;
+		}
+
+		///skips frames client sent after device failed
+		void Drain()
+		{
+			while(!_ended)
+			{
+				_channel.Receive(_frame, -1);
+				if (_frame.Seq == _seq && _frame.Type == Channel::FrameType::End)
+					_ended = true;
+			}
+		}
+	};
+
+	///first frame of connection, ids and bus path let client apply device quirks
+	inline void SendHello(Channel &channel, u16 vendorId, u16 productId, const std::string &busPath)
+	{
+		ByteArray hello;
+		OutputStream stream(hello);
+		stream << Channel::Magic << Channel::Version << vendorId << productId;
+		stream << static_cast<u8>(busPath.size());
+		hello.insert(hello.end(), busPath.begin(), busPath.end());
+		channel.Send(Channel::FrameType::Hello, 0, hello);
+	}
+
+	///reports failed operation, client rethrows timeouts and cancellations as such
+	inline void SendError(Channel &channel, const Channel::Frame &request, const std::exception &ex)
+	{
+		Channel::ErrorKind kind = dynamic_cast<const usb::TimeoutException *>(&ex)? Channel::ErrorKind::Timeout:
+			dynamic_cast<const OperationCancelledException *>(&ex)? Channel::ErrorKind::Cancelled: Channel::ErrorKind::Other;
+		std::string message = ex.what();
+
+		ByteArray data;
+		OutputStream stream(data);
+		stream.Write32(static_cast<u32>(request.Type));
+		stream.Write32(static_cast<u32>(kind));
+		data.insert(data.end(), message.begin(), message.end());
+		channel.Send(Channel::FrameType::Error, request.Seq, data);
+	}
+
+	///first frame client sends, token may be empty if relay listens on loopback only
+	inline void SendAuth(Channel &channel, const std::string &token)
+	{ channel.Send(Channel::FrameType::Auth, 0, reinterpret_cast<const u8 *>(token.data()), token.size()); }
+
+	///waits for auth frame of client, mismatch is reported to client before connection is dropped
+	inline void ReceiveAuth(Channel &channel, const std::string &token)
+	{
+		Channel::Frame frame;
+		if (!channel.Receive(frame, Channel::AuthTimeout))
+			throw std::runtime_error("client did not authenticate");
+
+		//compared in constant time, so token can't be guessed byte by byte from response timing
+		u8 diff = frame.Type != Channel::FrameType::Auth || frame.Data.size() != token.size();
+		for(size_t i = 0; i < std::min(frame.Data.size(), token.size()); ++i)
+			diff |= frame.Data[i] ^ static_cast<u8>(token[i]);
+		if (diff)
+		{
+			SendError(channel, frame, std::runtime_error("invalid relay token"));
+			throw std::runtime_error("client sent invalid token");
+		}
+	}
+
+}}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/AsyncObjectInputStream.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace mtp
+{
+	AsyncObjectInputStream::AsyncObjectInputStream(const IObjectInputStreamPtr &source, size_t bufferSize, size_t buffers):
+		_source(source), _bufferSize(bufferSize), _offset(0), _eof(false), _stopped(false)
+	{
+		for(size_t i = 0; i < std::max<size_t>(buffers, 2); ++i)
+		{
+			_free.emplace_back();
+			_free.back().reserve(_bufferSize);
+		}
+		_thread = std::thread(&AsyncObjectInputStream::Run, this);
+	}
+
+	AsyncObjectInputStream::~AsyncObjectInputStream()
+	{
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			_stopped = true;
+			_bufferFreed.notify_all();
+		}
+		_thread.join();
+	}
+
+	void AsyncObjectInputStream::Cancel()
+	{
+		CancellableStream::Cancel();
+		_source->Cancel();
+	}
+
+	u64 AsyncObjectInputStream::GetSize() const
+	{ return _source->GetSize(); }
+
+	void AsyncObjectInputStream::Run()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		while(true)
+		{
+			_bufferFreed.wait(l, [this]() { return _stopped || !_free.empty(); });
+			if (_stopped)
+				break;
+
+			ByteArray buffer(std::move(_free.front()));
+			_free.pop_front();
+			l.unlock();
+
+			bool eof = false;
+			size_t size = 0;
+			std::exception_ptr error;
+			try
+			{
+				buffer.resize(_bufferSize);
+				while(size < buffer.size())
+				{
+					size_t r = _source->Read(buffer.data() + size, buffer.size() - size);
+					if (r == 0)
+					{
+						eof = true;
+						break;
+					}
+					size += r;
+				}
+			}
+			catch(...)
+			{ error = std::current_exception(); }
+			buffer.resize(size);
+
+			l.lock();
+			_filled.push_back(std::move(buffer));
+			_eof = eof;
+			_error = error;
+			_bufferFilled.notify_all();
+			if (eof || error)
+				break;
+		}
+	}
+
+	size_t AsyncObjectInputStream::Read(u8 *data, size_t size)
+	{
+		CheckCancelled();
+		while(_offset >= _current.size())
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			if (_current.capacity() != 0)
+			{
+				_current.clear();
+				_free.push_back(std::move(_current));
+				_bufferFreed.notify_all();
+			}
+			_bufferFilled.wait(l, [this]() { return !_filled.empty() || _eof || _error; });
+			if (_filled.empty())
+			{
+				//data read before failure is passed first
+				if (_error)
+					std::rethrow_exception(_error);
+				return 0;
+			}
+			_current = std::move(_filled.front());
+			_filled.pop_front();
+			_offset = 0;
+		}
+
+		size_t n = std::min(size, _current.size() - _offset);
+		memcpy(data, _current.data() + _offset, n);
+		_offset += n;
+		return n;
+	}
+}
@@ -0,0 +1,63 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_ASYNCOBJECTINPUTSTREAM_H
+#define AFT_PTP_ASYNCOBJECTINPUTSTREAM_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ByteArray.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace mtp
+{
+	class AsyncObjectInputStream final: public IObjectInputStream, public CancellableStream //! reads source stream ahead in large chunks from background thread, so slow storage does not stall usb pipe
+	{
+		IObjectInputStreamPtr		_source;
+		size_t						_bufferSize;
+
+		std::mutex					_mutex;
+		std::condition_variable		_bufferFilled, _bufferFreed;
+		std::deque<ByteArray>		_filled;
+		std::deque<ByteArray>		_free;
+		ByteArray					_current;
+		size_t						_offset; //consumed part of _current
+		bool						_eof;
+		bool						_stopped;
+		std::exception_ptr			_error;
+		std::thread					_thread;
+
+		void Run();
+
+	public:
+		///buffers is total number of buffers, at least two: one consumed by usb transfer, others filled from source
+		AsyncObjectInputStream(const IObjectInputStreamPtr &source, size_t bufferSize = 1024 * 1024, size_t buffers = 2);
+		~AsyncObjectInputStream();
+
+		virtual void Cancel();
+		virtual u64 GetSize() const;
+		virtual size_t Read(u8 *data, size_t size);
+	};
+	DECLARE_PTR(AsyncObjectInputStream);
+}
+
+#endif
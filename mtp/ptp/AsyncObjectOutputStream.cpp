@@ -0,0 +1,134 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/AsyncObjectOutputStream.h>
+
+#include <algorithm>
+
+namespace mtp
+{
+	AsyncObjectOutputStream::AsyncObjectOutputStream(const IObjectOutputStreamPtr &target, size_t bufferSize, size_t buffers):
+		_target(target), _bufferSize(bufferSize), _finished(false)
+	{
+		_current.reserve(_bufferSize);
+		for(size_t i = 1; i < std::max<size_t>(buffers, 2); ++i)
+		{
+			_free.emplace_back();
+			_free.back().reserve(_bufferSize);
+		}
+		_thread = std::thread(&AsyncObjectOutputStream::Run, this);
+	}
+
+	AsyncObjectOutputStream::~AsyncObjectOutputStream()
+	{ Stop(); }
+
+	void AsyncObjectOutputStream::Stop()
+	{
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			_finished = true;
+			_bufferFilled.notify_all();
+		}
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	void AsyncObjectOutputStream::Cancel()
+	{
+		CancellableStream::Cancel();
+		_target->Cancel();
+		std::unique_lock<std::mutex> l(_mutex);
+		_bufferFreed.notify_all();
+	}
+
+	void AsyncObjectOutputStream::Submit()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_bufferFreed.wait(l, [this]() { return _error || !_free.empty(); });
+		if (_error)
+			std::rethrow_exception(_error);
+
+		_filled.push_back(std::move(_current));
+		_current = std::move(_free.front());
+		_free.pop_front();
+		_bufferFilled.notify_one();
+	}
+
+	void AsyncObjectOutputStream::Run()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		while(true)
+		{
+			_bufferFilled.wait(l, [this]() { return _finished || !_filled.empty(); });
+			if (_filled.empty())
+				break;
+
+			ByteArray buffer(std::move(_filled.front()));
+			_filled.pop_front();
+
+			if (!_error)
+			{
+				l.unlock();
+				std::exception_ptr error;
+				try
+				{
+					for(size_t offset = 0; offset < buffer.size(); )
+					{
+						size_t r = _target->Write(buffer.data() + offset, buffer.size() - offset);
+						if (r == 0)
+							throw std::runtime_error("short write");
+						offset += r;
+					}
+				}
+				catch(...)
+				{ error = std::current_exception(); }
+				l.lock();
+				if (error && !_error)
+					_error = error;
+			}
+
+			buffer.clear();
+			_free.push_back(std::move(buffer));
+			_bufferFreed.notify_all();
+		}
+	}
+
+	size_t AsyncObjectOutputStream::Write(const u8 *data, size_t size)
+	{
+		CheckCancelled();
+		for(size_t offset = 0; offset < size; )
+		{
+			size_t n = std::min(size - offset, _bufferSize - _current.size());
+			_current.insert(_current.end(), data + offset, data + offset + n);
+			offset += n;
+			if (_current.size() >= _bufferSize)
+				Submit();
+		}
+		return size;
+	}
+
+	void AsyncObjectOutputStream::Finish()
+	{
+		if (!_current.empty())
+			Submit();
+		Stop();
+		if (_error)
+			std::rethrow_exception(_error);
+		CheckCancelled();
+	}
+}
@@ -0,0 +1,65 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_ASYNCOBJECTOUTPUTSTREAM_H
+#define AFT_PTP_ASYNCOBJECTOUTPUTSTREAM_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ByteArray.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace mtp
+{
+	class AsyncObjectOutputStream final: public IObjectOutputStream, public CancellableStream //! passes filled buffers to background thread writing them into target stream, so slow storage does not stall usb pipe
+	{
+		IObjectOutputStreamPtr		_target;
+		size_t						_bufferSize;
+
+		std::mutex					_mutex;
+		std::condition_variable		_bufferFilled, _bufferFreed;
+		std::deque<ByteArray>		_filled;
+		std::deque<ByteArray>		_free;
+		ByteArray					_current;
+		bool						_finished;
+		std::exception_ptr			_error;
+		std::thread					_thread;
+
+		void Submit();
+		void Run();
+		void Stop();
+
+	public:
+		///buffers is total number of buffers, at least two: one filled by usb transfer, others written to target
+		AsyncObjectOutputStream(const IObjectOutputStreamPtr &target, size_t bufferSize = 1024 * 1024, size_t buffers = 2);
+		~AsyncObjectOutputStream();
+
+		virtual void Cancel();
+		virtual size_t Write(const u8 *data, size_t size);
+
+		///writes remaining data, waits for writer thread, rethrows its error
+		void Finish();
+	};
+	DECLARE_PTR(AsyncObjectOutputStream);
+}
+
+#endif
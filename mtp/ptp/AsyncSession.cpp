@@ -0,0 +1,294 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/AsyncSession.h>
+#include <mtp/ptp/ByteArrayObjectStream.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace mtp
+{
+	struct AsyncSession::DownloadState
+	{
+		ObjectId				Id;
+		IObjectOutputStreamPtr	Stream;
+		u64						Offset;
+		u64						Size;
+		u32						ChunkSize;
+		ByteArray				Buffer;
+		std::promise<void>		Promise;
+	};
+
+	struct AsyncSession::UploadState
+	{
+		msg::ObjectInfo						Info;
+		StorageId							Storage;
+		ObjectId							Parent;
+		IObjectInputStreamPtr				Stream;
+		u64									Offset;
+		u64									Size;
+		u32									ChunkSize;
+		Session::NewObjectInfo				NewObject;
+		Session::ObjectEditSessionPtr		Edit;
+		ByteArray							Buffer;
+		std::promise<Session::NewObjectInfo>	Promise;
+	};
+
+	AsyncSession::AsyncSession(const SessionPtr &session):
+		_session(session), _busy(false), _bulk(false), _stopped(false)
+	{
+		const Capabilities &caps = _session->GetCapabilities();
+		_getPartialObjectSupported = caps.Supports(OperationCode::GetPartialObject);
+		_getPartialObject64Supported = caps.Supports(OperationCode::GetPartialObject64);
+		_thread = std::thread(&AsyncSession::Run, this);
+	}
+
+	AsyncSession::~AsyncSession()
+	{
+		std::deque<Job> jobs;
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			_stopped = true;
+			for(auto &queue : _jobs)
+			{
+				std::move(queue.begin(), queue.end(), std::back_inserter(jobs));
+				queue.clear();
+			}
+			_jobAdded.notify_all();
+		}
+		_thread.join();
+		FailAll(jobs);
+	}
+
+	void AsyncSession::FailAll(std::deque<Job> &jobs)
+	{
+		auto error = std::make_exception_ptr(OperationCancelledException());
+		for(auto &job : jobs)
+			if (job.Fail)
+				job.Fail(error);
+	}
+
+	void AsyncSession::Enqueue(Job && job, Priority priority)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		if (_stopped)
+			throw std::runtime_error("async session stopped");
+		_jobs[static_cast<int>(priority)].push_back(std::move(job));
+		_jobAdded.notify_one();
+	}
+
+	void AsyncSession::Post(const Task &task, const ErrorCallback &onError, Priority priority)
+	{
+		Job job;
+		job.Run = task;
+		job.Fail = onError;
+		Enqueue(std::move(job), priority);
+	}
+
+	std::future<void> AsyncSession::Download(ObjectId objectId, const IObjectOutputStreamPtr &outputStream, u64 size, u32 chunkSize, u64 offset)
+	{
+		bool partial = _getPartialObject64Supported || (_getPartialObjectSupported && size <= std::numeric_limits<u32>::max());
+		if (offset && (!partial || offset >= size))
+			throw std::runtime_error("download cannot be continued from given offset");
+
+		bool chunked = partial && (offset || size > chunkSize);
+		if (!chunked)
+			return Submit([objectId, outputStream](Session &session) { session.GetObject(objectId, outputStream); }, Priority::Bulk);
+
+		auto state = std::make_shared<DownloadState>();
+		state->Id = objectId;
+		state->Stream = outputStream;
+		state->Offset = offset;
+		state->Size = size;
+		state->ChunkSize = chunkSize;
+		auto future = state->Promise.get_future();
+		DownloadChunk(state);
+		return future;
+	}
+
+	void AsyncSession::DownloadChunk(const DownloadStatePtr &state)
+	{
+		Job job;
+		job.Run = [this, state](Session &session)
+		{
+			u32 chunk = std::min<u64>(state->Size - state->Offset, state->ChunkSize);
+			session.GetPartialObject(state->Id, state->Offset, chunk, state->Buffer);
+			if (state->Buffer.empty())
+				throw std::runtime_error("device returned no data for partial object request");
+
+			size_t written = 0;
+			while(written < state->Buffer.size())
+				written += state->Stream->Write(state->Buffer.data() + written, state->Buffer.size() - written);
+			state->Offset += state->Buffer.size();
+
+			if (state->Offset < state->Size)
+				DownloadChunk(state); //goes to the back of bulk queue, after interactive jobs
+			else
+				state->Promise.set_value();
+		};
+		job.Fail = [state](std::exception_ptr error) { state->Promise.set_exception(error); };
+		Enqueue(std::move(job), Priority::Bulk);
+	}
+
+	std::future<Session::NewObjectInfo> AsyncSession::Upload(const msg::ObjectInfo &objectInfo, StorageId storageId, ObjectId parentObject, const IObjectInputStreamPtr &inputStream, u32 chunkSize)
+	{
+		u64 size = inputStream->GetSize();
+		if (size <= chunkSize || !_session->EditObjectSupported())
+		{
+			msg::ObjectInfo oi = objectInfo;
+			return Submit([oi, size, storageId, parentObject, inputStream](Session &session)
+			{
+				//objects over 4G need size in object property list
+				auto noi = session.CreateObject(oi, size, storageId, parentObject);
+				session.SendObject(inputStream);
+				return noi;
+			}, Priority::Bulk);
+		}
+
+		auto state = std::make_shared<UploadState>();
+		state->Info = objectInfo;
+		state->Info.SetSize(0);
+		state->Storage = storageId;
+		state->Parent = parentObject;
+		state->Stream = inputStream;
+		state->Offset = 0;
+		state->Size = size;
+		state->ChunkSize = chunkSize;
+		auto future = state->Promise.get_future();
+
+		Job job;
+		job.Run = [this, state](Session &session)
+		{
+			//empty object is created first and then filled with partial writes, like fuse does for new files
+			state->NewObject = session.SendObjectInfo(state->Info, state->Storage, state->Parent);
+			session.SendObject(std::make_shared<ByteArrayObjectInputStream>(ByteArray()));
+			state->Edit = Session::EditObject(_session, state->NewObject.ObjectId);
+			UploadChunk(state);
+		};
+		job.Fail = [state](std::exception_ptr error) { state->Edit.reset(); state->Promise.set_exception(error); };
+		Enqueue(std::move(job), Priority::Bulk);
+		return future;
+	}
+
+	void AsyncSession::UploadChunk(const UploadStatePtr &state)
+	{
+		Job job;
+		job.Run = [this, state](Session &)
+		{
+			size_t chunk = std::min<u64>(state->Size - state->Offset, state->ChunkSize);
+			state->Buffer.resize(chunk);
+			size_t r = 0;
+			while(r < chunk)
+			{
+				size_t n = state->Stream->Read(state->Buffer.data() + r, chunk - r);
+				if (n == 0)
+					throw std::runtime_error("unexpected end of upload stream");
+				r += n;
+			}
+			state->Edit->Send(state->Offset, state->Buffer);
+			state->Offset += chunk;
+
+			if (state->Offset < state->Size)
+				UploadChunk(state);
+			else
+			{
+				state->Edit.reset();
+				state->Promise.set_value(state->NewObject);
+			}
+		};
+		job.Fail = [state](std::exception_ptr error) { state->Edit.reset(); state->Promise.set_exception(error); };
+		Enqueue(std::move(job), Priority::Bulk);
+	}
+
+	size_t AsyncSession::GetPendingCount()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		return _jobs[0].size() + _jobs[1].size();
+	}
+
+	void AsyncSession::Cancel(int timeout)
+	{
+		std::deque<Job> jobs;
+		bool busy;
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			for(auto &queue : _jobs)
+			{
+				std::move(queue.begin(), queue.end(), std::back_inserter(jobs));
+				queue.clear();
+			}
+			busy = _busy;
+		}
+		FailAll(jobs);
+
+		if (busy)
+		{
+			try { _session->AbortCurrentTransaction(timeout); }
+			catch(const std::exception &ex)
+			{ debug("aborting transaction failed: ", ex.what()); }
+		}
+	}
+
+	bool AsyncSession::AbortBulk(int timeout)
+	{
+		//lock keeps next job from starting, so abort cannot hit interactive job which follows
+		std::unique_lock<std::mutex> l(_mutex);
+		if (!_busy || !_bulk)
+			return false;
+
+		try { _session->AbortCurrentTransaction(timeout); }
+		catch(const std::exception &ex)
+		{ debug("aborting transaction failed: ", ex.what()); }
+		return true;
+	}
+
+	void AsyncSession::Run()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		while(true)
+		{
+			_jobAdded.wait(l, [this]() { return _stopped || !_jobs[0].empty() || !_jobs[1].empty(); });
+			if (_stopped)
+				break;
+
+			_bulk = _jobs[0].empty();
+			auto &queue = _bulk? _jobs[1]: _jobs[0];
+			Job job = std::move(queue.front());
+			queue.pop_front();
+			_busy = true;
+			l.unlock();
+
+			try
+			{ job.Run(*_session); }
+			catch(...)
+			{
+				if (job.Fail)
+					job.Fail(std::current_exception());
+				else
+					error("async session job failed");
+			}
+
+			l.lock();
+			_busy = false;
+		}
+	}
+}
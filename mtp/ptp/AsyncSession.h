@@ -0,0 +1,140 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_ASYNCSESSION_H
+#define AFT_PTP_ASYNCSESSION_H
+
+#include <mtp/ptp/Session.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace mtp
+{
+	class AsyncSession : Noncopyable //! runs session transactions from worker thread, interactive jobs first, each class in submission order; completes futures or callbacks
+	{
+	public:
+		typedef std::function<void (Session &)>			Task;
+		typedef std::function<void (std::exception_ptr)>	ErrorCallback;
+
+		enum struct Priority
+		{
+			Interactive,	///< metadata requests user is waiting for
+			Bulk			///< object data, split into chunks where device allows it
+		};
+
+		///bulk data chunk, interactive jobs wait at most for one chunk transfer
+		static const u32 DefaultChunkSize = 4 * 1024 * 1024;
+
+	private:
+		struct Job
+		{
+			Task			Run;
+			ErrorCallback	Fail;
+		};
+
+		template<typename ResultType>
+		struct Completion
+		{
+			template<typename Func>
+			static void Run(std::promise<ResultType> &promise, Func &func, Session &session)
+			{ promise.set_value(func(session)); }
+		};
+
+		SessionPtr					_session;
+		std::mutex					_mutex;
+		std::condition_variable		_jobAdded;
+		std::deque<Job>				_jobs[2]; //indexed by priority
+		bool						_busy;
+		bool						_bulk; //job in progress is object data
+		bool						_stopped;
+		bool						_getPartialObjectSupported;
+		bool						_getPartialObject64Supported;
+		std::thread					_thread;
+
+		struct DownloadState;
+		struct UploadState;
+		DECLARE_PTR(DownloadState);
+		DECLARE_PTR(UploadState);
+
+		void Enqueue(Job && job, Priority priority);
+		void FailAll(std::deque<Job> &jobs);
+		void DownloadChunk(const DownloadStatePtr &state);
+		void UploadChunk(const UploadStatePtr &state);
+		void Run();
+
+	public:
+		AsyncSession(const SessionPtr &session);
+		///fails pending jobs with OperationCancelledException, waits for current one
+		~AsyncSession();
+
+		const SessionPtr & GetSession() const
+		{ return _session; }
+
+		///queues func(Session &), future receives its result or exception
+		template<typename Func>
+		auto Submit(Func func, Priority priority = Priority::Interactive) -> std::future<decltype(func(std::declval<Session &>()))>
+		{
+			typedef decltype(func(std::declval<Session &>())) ResultType;
+			auto promise = std::make_shared<std::promise<ResultType>>();
+			auto future = promise->get_future();
+			Job job;
+			job.Run = [promise, func](Session &session) mutable { Completion<ResultType>::Run(*promise, func, session); };
+			job.Fail = [promise](std::exception_ptr error) { promise->set_exception(error); };
+			Enqueue(std::move(job), priority);
+			return future;
+		}
+
+		///queues task, onError is called from worker thread if task throws or gets cancelled
+		void Post(const Task &task, const ErrorCallback &onError = ErrorCallback(), Priority priority = Priority::Interactive);
+
+		///queues bulk download of object of given size, GetPartialObject(64) chunks let interactive jobs in between, whole object is requested otherwise
+		///non-zero offset continues interrupted download, it requires partial object support
+		std::future<void> Download(ObjectId objectId, const IObjectOutputStreamPtr &outputStream, u64 size, u32 chunkSize = DefaultChunkSize, u64 offset = 0);
+
+		///queues bulk upload of new object, data is sent with SendPartialObject chunks into empty object if device supports editing, with single SendObject otherwise
+		std::future<Session::NewObjectInfo> Upload(const msg::ObjectInfo &objectInfo, StorageId storageId, ObjectId parentObject, const IObjectInputStreamPtr &inputStream, u32 chunkSize = DefaultChunkSize);
+
+		///number of jobs waiting for execution, current one excluded
+		size_t GetPendingCount();
+
+		///fails all pending jobs with OperationCancelledException and aborts transaction in progress
+		void Cancel(int timeout = Session::DefaultTimeout);
+
+		///aborts transaction in progress only if it belongs to bulk job, interactive ones are left running, pending jobs stay queued
+		///returns true if abort was sent
+		bool AbortBulk(int timeout = Session::DefaultTimeout);
+	};
+	DECLARE_PTR(AsyncSession);
+
+	template<>
+	struct AsyncSession::Completion<void>
+	{
+		template<typename Func>
+		static void Run(std::promise<void> &promise, Func &func, Session &session)
+		{ func(session); promise.set_value(); }
+	};
+}
+
+#endif
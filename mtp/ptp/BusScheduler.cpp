@@ -0,0 +1,161 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/BusScheduler.h>
+#include <mtp/log.h>
+#include <usb/Device.h>
+#include <algorithm>
+
+#if !defined(USB_BACKEND_LIBUSB) && !defined(__APPLE__)
+#	define BUS_SCHEDULER_URB_QUEUE //only usbfs backend keeps several urbs in flight
+#endif
+
+namespace mtp
+{
+
+	BusScheduler::BusScheduler(unsigned busUrbs): _busUrbs(std::max(1u, busUrbs))
+	{ }
+
+	BusScheduler::~BusScheduler()
+	{
+#ifdef BUS_SCHEDULER_URB_QUEUE
+		for(auto & member : _members)
+			member.Device->SetUrbQueueDepth(member.MaxDepth);
+#endif
+	}
+
+	std::string BusScheduler::GetBus(const std::string &busPath)
+	{
+		size_t pos = busPath.find('-');
+		return pos != busPath.npos? busPath.substr(0, pos): busPath;
+	}
+
+	BusScheduler::Member * BusScheduler::Find(const usb::DevicePtr &device)
+	{
+		auto i = std::find_if(_members.begin(), _members.end(), [&device](const Member &member) { return member.Device == device; });
+		return i != _members.end()? &*i: nullptr;
+	}
+
+	void BusScheduler::Rebalance(const std::string &bus)
+	{
+		unsigned activeWeight = 0;
+		for(auto & member : _members)
+			if (member.Bus == bus && member.Active)
+				activeWeight += member.Weight;
+
+		for(auto & member : _members)
+		{
+			if (member.Bus != bus)
+				continue;
+			//idle device gets the share it would have once it starts, so it does not flood the bus before it is marked busy
+			unsigned total = member.Active? activeWeight: activeWeight + member.Weight;
+			unsigned depth = static_cast<unsigned>(static_cast<u64>(_busUrbs) * member.Weight / total);
+			depth = std::min(std::max(depth, 1u), member.MaxDepth);
+			if (depth == member.Depth)
+				continue;
+			member.Depth = depth;
+#ifdef BUS_SCHEDULER_URB_QUEUE
+			member.Device->SetUrbQueueDepth(depth);
+#endif
+			debug("bus ", bus, ": device gets ", depth, " urbs in flight");
+		}
+	}
+
+	void BusScheduler::Add(const usb::DevicePtr &device, const std::string &busPath, unsigned weight)
+	{
+		if (!device)
+			return;
+		scoped_mutex_lock l(_mutex);
+		if (Find(device))
+			return;
+
+		Member member;
+		member.Device = device;
+		member.Bus = GetBus(busPath);
+		member.Weight = std::max(1u, weight);
+#ifdef BUS_SCHEDULER_URB_QUEUE
+		member.MaxDepth = device->GetUrbQueueDepth();
+#else
+		member.MaxDepth = 1;
+#endif
+		member.Depth = member.MaxDepth;
+		member.Active = 0;
+		_members.push_back(member);
+		Rebalance(member.Bus);
+	}
+
+	void BusScheduler::Remove(const usb::DevicePtr &device)
+	{
+		scoped_mutex_lock l(_mutex);
+		auto i = std::find_if(_members.begin(), _members.end(), [&device](const Member &member) { return member.Device == device; });
+		if (i == _members.end())
+			return;
+
+		std::string bus = i->Bus;
+#ifdef BUS_SCHEDULER_URB_QUEUE
+		i->Device->SetUrbQueueDepth(i->MaxDepth);
+#endif
+		_members.erase(i);
+		Rebalance(bus);
+	}
+
+	void BusScheduler::SetWeight(const usb::DevicePtr &device, unsigned weight)
+	{
+		scoped_mutex_lock l(_mutex);
+		Member *member = Find(device);
+		if (!member)
+			return;
+		member->Weight = std::max(1u, weight);
+		Rebalance(member->Bus);
+	}
+
+	void BusScheduler::SetActive(const usb::DevicePtr &device, bool active)
+	{
+		scoped_mutex_lock l(_mutex);
+		Member *member = Find(device);
+		if (!member)
+			return;
+		unsigned before = member->Active;
+		if (active)
+			++member->Active;
+		else if (member->Active)
+			--member->Active;
+		if ((before != 0) != (member->Active != 0))
+			Rebalance(member->Bus);
+	}
+
+	unsigned BusScheduler::GetDepth(const usb::DevicePtr &device) const
+	{
+		scoped_mutex_lock l(_mutex);
+		for(auto & member : _members)
+			if (member.Device == device)
+				return member.Depth;
+		return 0;
+	}
+
+	std::map<std::string, size_t> BusScheduler::GetBuses() const
+	{
+		scoped_mutex_lock l(_mutex);
+		std::map<std::string, size_t> buses;
+		for(auto & member : _members)
+			++buses[member.Bus];
+		return buses;
+	}
+
+}
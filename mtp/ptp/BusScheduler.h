@@ -0,0 +1,95 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_BUSSCHEDULER_H
+#define AFT_PTP_BUSSCHEDULER_H
+
+#include <mtp/types.h>
+#include <mtp/usb/BulkPipe.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mtp
+{
+	class BusScheduler : Noncopyable //! splits urbs in flight on one usb bus between devices attached to it by their weight, so bulk transfers of one device do not starve the others
+	{
+	public:
+		static const unsigned DefaultBusUrbs = 16; //keeps high-speed bus busy, every device still gets at least one urb
+
+	private:
+		struct Member
+		{
+			usb::DevicePtr	Device;
+			std::string		Bus;
+			unsigned		Weight;
+			unsigned		MaxDepth; //queue depth device had when it was added, quirks may have lowered it
+			unsigned		Depth;
+			unsigned		Active; //bulk jobs in progress
+		};
+
+		mutable std::mutex	_mutex;
+		std::vector<Member>	_members;
+		unsigned			_busUrbs;
+
+		Member * Find(const usb::DevicePtr &device);
+		void Rebalance(const std::string &bus); //called with _mutex held
+
+	public:
+		BusScheduler(unsigned busUrbs = DefaultBusUrbs);
+		///restores queue depth of devices still registered
+		~BusScheduler();
+
+		///returns bus number of sysfs device name, e.g. 1 for 1-2.3, devices on the same bus share host controller bandwidth
+		static std::string GetBus(const std::string &busPath);
+
+		///registers usb device with its bus path, devices without usb device (network, mock) are ignored
+		void Add(const usb::DevicePtr &device, const std::string &busPath, unsigned weight = 1);
+		void Remove(const usb::DevicePtr &device);
+
+		///devices with higher weight get proportionally more urbs while they are busy
+		void SetWeight(const usb::DevicePtr &device, unsigned weight);
+
+		///marks start and end of bulk transfer, idle devices leave their share to busy ones
+		void SetActive(const usb::DevicePtr &device, bool active);
+
+		class ActiveScope : Noncopyable //! marks device busy for its lifetime
+		{
+			BusScheduler &	_scheduler;
+			usb::DevicePtr	_device;
+
+		public:
+			ActiveScope(BusScheduler &scheduler, const usb::DevicePtr &device): _scheduler(scheduler), _device(device)
+			{ _scheduler.SetActive(_device, true); }
+			~ActiveScope()
+			{ _scheduler.SetActive(_device, false); }
+		};
+
+		///returns current urb queue depth assigned to device, 0 if it is not registered
+		unsigned GetDepth(const usb::DevicePtr &device) const;
+
+		///returns number of registered devices on every bus
+		std::map<std::string, size_t> GetBuses() const;
+	};
+	DECLARE_PTR(BusScheduler);
+}
+
+#endif
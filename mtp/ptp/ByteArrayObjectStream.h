@@ -33,7 +33,7 @@ namespace mtp
 
 	public:
 		ByteArrayObjectInputStream(const ByteArray & data) noexcept: _data(data), _offset(0) { }
-		ByteArrayObjectInputStream(ByteArray && data) noexcept: _data(data), _offset(0) { }
+		ByteArrayObjectInputStream(ByteArray && data) noexcept: _data(std::move(data)), _offset(0) { }
 
 		const ByteArray &GetData() const
 		{ return _data; }
@@ -62,10 +62,17 @@ namespace mtp
 		const ByteArray &GetData() const
 		{ return _data; }
 
+		///moves accumulated data out of the stream, leaving it empty
+		ByteArray ReleaseData()
+		{ return std::move(_data); }
+
+		virtual void Reserve(u64 size)
+		{ _data.reserve(_data.size() + size); }
+
 		virtual size_t Write(const u8 *data, size_t size)
 		{
 			CheckCancelled();
-			std::copy(data, data + size, std::back_inserter(_data));
+			_data.insert(_data.end(), data, data + size);
 			return size;
 		}
 	};
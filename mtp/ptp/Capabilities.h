@@ -0,0 +1,97 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_CAPABILITIES_H
+#define AFT_PTP_CAPABILITIES_H
+
+#include <mtp/ptp/DeviceProperty.h>
+#include <mtp/ptp/EventCode.h>
+#include <mtp/ptp/Messages.h>
+#include <atomic>
+#include <bitset>
+
+namespace mtp
+{
+	class Capabilities : Noncopyable //! operations, events, device properties and object formats of the device, built once from DeviceInfo and checked in constant time, plus quirk flags for known broken code paths
+	{
+	public:
+		enum struct Quirk : u32
+		{
+			ObjectModificationTimeBuggy		= 1 << 0,	///< DateModified is empty or zero, ObjectInfo has to be used
+			PropertyListDepthUnsupported	= 1 << 1,	///< recursive GetObjectPropList (depth > 1) fails or returns single level
+			PropertyListAllUnsupported		= 1 << 2,	///< GetObjectPropList ignores or rejects ObjectProperty::All
+			EventsUnsupported				= 1 << 3,	///< no events are sent, interrupt endpoint is not polled
+			PropertyListUpdateUnsupported	= 1 << 4,	///< SetObjectPropList is advertised but rejected as not supported
+		};
+
+	private:
+		typedef std::bitset<0x10000> CodeSet; //indexed by u16 code
+
+		CodeSet				_operations;
+		CodeSet				_events;
+		CodeSet				_deviceProperties;
+		CodeSet				_formats;
+		std::atomic<u32>	_quirks; //learnt at runtime from any thread
+
+		template<typename CodeType>
+		static void Fill(CodeSet &set, const std::vector<CodeType> &codes)
+		{
+			for(auto code : codes)
+				set.set(static_cast<u16>(code));
+		}
+
+	public:
+		Capabilities(): _quirks(0)
+		{ }
+
+		///replaces all sets with ones from device info, quirks are kept
+		void Load(const msg::DeviceInfo &info);
+
+		bool Supports(OperationCode code) const
+		{ return _operations.test(static_cast<u16>(code)); }
+
+		bool Supports(EventCode code) const
+		{ return _events.test(static_cast<u16>(code)); }
+
+		bool Supports(DeviceProperty property) const
+		{ return _deviceProperties.test(static_cast<u16>(property)); }
+
+		///format is listed as playback (image) or capture format
+		bool Supports(ObjectFormat format) const
+		{ return _formats.test(static_cast<u16>(format)); }
+
+		///android extension: BeginEditObject, EndEditObject, TruncateObject and SendPartialObject
+		bool CanEditObjects() const;
+
+		bool Has(Quirk quirk) const
+		{ return (_quirks.load(std::memory_order_relaxed) & static_cast<u32>(quirk)) != 0; }
+
+		void Set(Quirk quirk)
+		{ SetQuirks(static_cast<u32>(quirk)); }
+
+		///adds Quirk bits, e.g. from DeviceQuirks table
+		void SetQuirks(u32 quirks)
+		{ _quirks.fetch_or(quirks, std::memory_order_relaxed); }
+
+		u32 GetQuirks() const
+		{ return _quirks.load(std::memory_order_relaxed); }
+	};
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/Crc32c.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE4_2__
+#	include <nmmintrin.h>
+#endif
+
+namespace mtp
+{
+
+#ifdef __SSE4_2__
+	void Crc32c::Update(const u8 *data, size_t size)
+	{
+		u32 crc = _state;
+#ifdef __x86_64__
+		u64 crc64 = crc;
+		for(; size >= 8; data += 8, size -= 8)
+		{
+			u64 word;
+			memcpy(&word, data, sizeof(word));
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+		crc = static_cast<u32>(crc64);
+#endif
+		for(; size > 0; ++data, --size)
+			crc = _mm_crc32_u8(crc, *data);
+		_state = crc;
+	}
+#else
+	namespace
+	{
+		const u32 Polynomial = 0x82f63b78; //reflected castagnoli polynomial
+
+		struct Tables
+		{
+			u32 Data[8][256];
+
+			Tables()
+			{
+				for(u32 i = 0; i < 256; ++i)
+				{
+					u32 crc = i;
+					for(int bit = 0; bit < 8; ++bit)
+						crc = (crc >> 1) ^ ((crc & 1)? Polynomial: 0);
+					Data[0][i] = crc;
+				}
+				for(u32 i = 0; i < 256; ++i)
+					for(int t = 1; t < 8; ++t)
+						Data[t][i] = (Data[t - 1][i] >> 8) ^ Data[0][Data[t - 1][i] & 0xff];
+			}
+		};
+
+		const Tables & GetTables()
+		{
+			static const Tables tables;
+			return tables;
+		}
+	}
+
+	void Crc32c::Update(const u8 *data, size_t size)
+	{
+		auto &t = GetTables().Data;
+		u32 crc = _state;
+		for(; size >= 8; data += 8, size -= 8)
+		{
+			u32 lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<u32>(data[3]) << 24));
+			crc =
+				t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+				t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+		}
+		for(; size > 0; ++data, --size)
+			crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+		_state = crc;
+	}
+#endif
+
+	std::string Crc32c::GetHex() const
+	{
+		char buf[9];
+		snprintf(buf, sizeof(buf), "%08x", static_cast<unsigned>(Get()));
+		return buf;
+	}
+
+}
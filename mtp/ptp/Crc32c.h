@@ -0,0 +1,51 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_CRC32C_H
+#define AFT_PTP_CRC32C_H
+
+#include <mtp/types.h>
+#include <string>
+
+namespace mtp
+{
+
+	class Crc32c //! incremental crc32c (castagnoli), sse4.2 crc32 instruction if compiled in, slicing-by-8 tables otherwise
+	{
+		u32			_state;
+
+	public:
+		Crc32c(): _state(~0u)
+		{ }
+
+		void Update(const u8 *data, size_t size);
+
+		u32 Get() const
+		{ return ~_state; }
+
+		///returns lowercase hex digest, 8 characters
+		std::string GetHex() const;
+
+		static const char * GetName()
+		{ return "crc32c"; }
+	};
+
+}
+
+#endif
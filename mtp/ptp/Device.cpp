@@ -18,6 +18,10 @@
 */
 
 #include <mtp/ptp/Device.h>
+#include <mtp/mock/DeviceSpec.h>
+#include <mtp/mock/Recording.h>
+#include <mtp/net/BulkPipe.h>
+#include <mtp/ptp/DeviceQuirks.h>
 #include <mtp/ptp/Response.h>
 #include <mtp/ptp/Container.h>
 #include <mtp/ptp/Messages.h>
@@ -27,26 +31,126 @@
 #include <usb/Interface.h>
 #include <mtp/ptp/OperationRequest.h>
 #include <mtp/usb/Request.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <stdexcept>
+#include <stdlib.h>
 
 
 namespace mtp
 {
 
-	Device::Device(usb::BulkPipePtr pipe): _packeter(pipe)
+	namespace
+	{
+		const u8 StillImageClass		= 6;
+		const u8 StillImageSubclass		= 1;
+		const u8 VendorSpecificClass	= 0xff;
+		const int MinEndpoints			= 2; //bulk in and out, interrupt is optional
+
+		//vendors exposing MTP as vendor specific interface, sorted
+		const u16 KnownVendors[] =
+		{
+			0x0489, //Foxconn
+			0x04e8, //Samsung
+			0x05c6, //Qualcomm
+			0x0bb4, //HTC
+			0x0e8d, //MediaTek
+			0x0fce, //Sony
+			0x1004, //LG
+			0x12d1, //Huawei
+			0x17ef, //Lenovo
+			0x18d1, //Google
+			0x19d2, //ZTE
+			0x2207, //Rockchip
+			0x22b8, //Motorola
+			0x2717, //Xiaomi
+			0x2a70, //OnePlus
+			0x2ae5, //Fairphone
+		};
+
+		///interface name known without device i/o, only linux backend reads it from sysfs
+		std::string GetInterfaceNameHint(const usb::InterfacePtr &iface)
+		{
+#if defined(USB_BACKEND_LIBUSB) || defined(__APPLE__)
+			return std::string();
+#else
+			return iface->GetName();
+#endif
+		}
+
+		std::atomic_bool g_recording(false);
+
+		///wraps pipe of first opened device into recorder if AFT_RECORD names output file
+		usb::BulkPipePtr CreatePipe(const usb::DevicePtr &device, const usb::ConfigurationPtr &conf, const usb::InterfacePtr &iface, const ITokenPtr &token, const usb::DeviceDescriptorPtr &desc)
+		{
+			usb::BulkPipePtr pipe = usb::BulkPipe::Create(device, conf, iface, token);
+			const char *path = getenv("AFT_RECORD");
+			if (!path || !*path || g_recording.exchange(true))
+				return pipe;
+
+			mock::Recording header;
+			header.VendorId = desc->GetVendorId();
+			header.ProductId = desc->GetProductId();
+			header.BusPath = desc->GetBusPath();
+			return std::make_shared<mock::RecordingBulkPipe>(pipe, path, header);
+		}
+	}
+
+	Device::Device(usb::BulkPipePtr pipe, const usb::DeviceDescriptorPtr &desc):
+		_packeter(pipe), _vendorId(desc? desc->GetVendorId(): 0), _productId(desc? desc->GetProductId(): 0)
+	{
+		if (desc)
+			_busPath = desc->GetBusPath();
+	}
+
+	Device::Device(usb::BulkPipePtr pipe, u16 vendorId, u16 productId, const std::string &busPath):
+		_packeter(pipe), _busPath(busPath), _vendorId(vendorId), _productId(productId)
 	{ }
 
 	SessionPtr Device::OpenSession(u32 sessionId, int timeout)
 	{
+		auto started = StartupTimings::Clock::now();
 		OperationRequest req(OperationCode::OpenSession, 0, sessionId);
-		Container container(req);
-		_packeter.Write(container.Data, timeout);
+		_packeter.Write(req, timeout);
 		ByteArray data, response;
 		ResponseType code;
 		_packeter.Read(0, data, code, response, timeout);
 		//HexDump("payload", data);
+		auto opened = StartupTimings::Clock::now();
+
+		auto session = std::make_shared<Session>(_packeter.GetPipe(), sessionId); //requests device info
+		StartupTimings &timings = session->GetStartupTimings();
+		timings.Append(_startupTimings);
+		timings.Record("OpenSession", opened - started);
+		timings.Record("GetDeviceInfo", opened);
+		DeviceQuirks quirks = DeviceQuirks::Find(_vendorId, _productId, session->GetDeviceInfo());
+		session->SetQuirks(quirks.Quirks);
+
+		usb::DevicePtr device = _packeter.GetPipe()->GetDevice();
+		if (device && quirks.MaxTransferSize && (!device->GetTransferSize() || device->GetTransferSize() > quirks.MaxTransferSize))
+			device->SetTransferSize(quirks.MaxTransferSize);
+#if !defined(USB_BACKEND_LIBUSB) && !defined(__APPLE__)
+		if (device && quirks.UrbQueueDepth && device->GetUrbQueueDepth() > quirks.UrbQueueDepth)
+			device->SetUrbQueueDepth(quirks.UrbQueueDepth);
+#endif
+		return session;
+	}
+
+	msg::DeviceInfo Device::GetInfo(int timeout)
+	{
+		OperationRequest req(OperationCode::GetDeviceInfo, 0);
+		_packeter.Write(req, timeout);
+		ByteArray data, response;
+		ResponseType code;
+		_packeter.Read(0, data, code, response, timeout);
+		if (code != ResponseType::OK)
+			throw InvalidResponseException(__func__, code);
 
-		return std::make_shared<Session>(_packeter.GetPipe(), sessionId);
+		InputStream stream(data);
+		msg::DeviceInfo gdi;
+		gdi.Read(stream);
+		return gdi;
 	}
 
 	int Device::GetInterfaceStringIndex(usb::DeviceDescriptorPtr desc, u8 number)
@@ -71,7 +175,45 @@ namespace mtp
 		throw std::runtime_error("no interface descriptor found");
 	}
 
+	bool Device::IsKnownVendor(u16 vendorId)
+	{ return std::binary_search(std::begin(KnownVendors), std::end(KnownVendors), vendorId); }
+
+	Device::ProbeResult Device::Probe(usb::DeviceDescriptorPtr desc)
+	{
+		ProbeResult result = ProbeResult::None;
+		int confs = desc->GetConfigurationsCount();
+		for(int i = 0; i < confs; ++i)
+		{
+			usb::ConfigurationPtr conf = desc->GetConfiguration(i);
+			int interfaces = conf->GetInterfaceCount();
+			for(int j = 0; j < interfaces; ++j)
+			{
+				usb::InterfacePtr iface = conf->GetInterface(nullptr, conf, j, 0);
+				if (iface->GetClass() == StillImageClass && iface->GetSubclass() == StillImageSubclass)
+					return ProbeResult::Likely;
+				if (iface->GetClass() != VendorSpecificClass || iface->GetEndpointsCount() < MinEndpoints)
+					continue;
+
+				std::string name = GetInterfaceNameHint(iface);
+				if (name == "MTP" || (name.empty() && IsKnownVendor(desc->GetVendorId())))
+					return ProbeResult::Likely;
+				if (name.empty())
+					result = ProbeResult::Possible; //adb and other interfaces are named in sysfs
+			}
+		}
+		return result;
+	}
+
 	DevicePtr Device::Open(usb::ContextPtr ctx, usb::DeviceDescriptorPtr desc, bool claimInterface)
+	{
+		auto started = StartupTimings::Clock::now();
+		DevicePtr device = OpenInterface(ctx, desc, claimInterface);
+		if (device)
+			device->GetStartupTimings().Record("device open", started);
+		return device;
+	}
+
+	DevicePtr Device::OpenInterface(usb::ContextPtr ctx, usb::DeviceDescriptorPtr desc, bool claimInterface)
 	{
 		debug("probing device ", hex(desc->GetVendorId(), 4), ":", hex(desc->GetProductId(), 4));
 		usb::DevicePtr device = desc->TryOpen(ctx);
@@ -88,54 +230,220 @@ namespace mtp
 			for(int j = 0; j < interfaces; ++j)
 			{
 				usb::InterfacePtr iface = conf->GetInterface(device, conf, j, 0);
+				bool stillImage = iface->GetClass() == StillImageClass && iface->GetSubclass() == StillImageSubclass;
+				if (!stillImage && (iface->GetClass() != VendorSpecificClass || iface->GetEndpointsCount() < MinEndpoints))
+					continue; //do not claim or query unrelated interfaces
+
 				usb::InterfaceTokenPtr token = claimInterface? device->ClaimInterface(iface): nullptr;
 				debug("Device usb interface: ", i, ':', j, ", index: ", iface->GetIndex(), ", enpoints: ", iface->GetEndpointsCount());
+				if (stillImage)
+				{
+					usb::BulkPipePtr pipe = CreatePipe(device, conf, iface, token, desc);
+					return std::make_shared<Device>(pipe, desc);
+				}
 
+				std::string name = GetInterfaceNameHint(iface);
+				if (name.empty())
+				{
 #ifdef USB_BACKEND_LIBUSB
-				std::string name = iface->GetName();
+					name = iface->GetName();
 #else
-				ByteArray data = usb::DeviceRequest(device).GetDescriptor(usb::DescriptorType::String, 0, 0);
-				HexDump("languages", data);
-				if (data.size() < 4 || data[1] != (u8)usb::DescriptorType::String)
-					continue;
+					ByteArray data = usb::DeviceRequest(device).GetDescriptor(usb::DescriptorType::String, 0, 0);
+					HexDump("languages", data);
+					if (data.size() < 4 || data[1] != (u8)usb::DescriptorType::String)
+						continue;
 
-				int interfaceStringIndex = GetInterfaceStringIndex(desc, j);
-				u16 langId = data[2] | ((u16)data[3] << 8);
-				data = usb::DeviceRequest(device).GetDescriptor(usb::DescriptorType::String, interfaceStringIndex, langId);
-				HexDump("interface name", data);
-				if (data.size() < 4 || data[1] != (u8)usb::DescriptorType::String)
-					continue;
+					int interfaceStringIndex = GetInterfaceStringIndex(desc, j);
+					u16 langId = data[2] | ((u16)data[3] << 8);
+					data = usb::DeviceRequest(device).GetDescriptor(usb::DescriptorType::String, interfaceStringIndex, langId);
+					HexDump("interface name", data);
+					if (data.size() < 4 || data[1] != (u8)usb::DescriptorType::String)
+						continue;
 
-				u8 len = data[0];
-				InputStream stream(data, 2);
-				std::string name = stream.ReadString((len - 2) / 2);
+					u8 len = data[0];
+					InputStream stream(data, 2);
+					name = stream.ReadString((len - 2) / 2);
 #endif
+				}
 				if (name == "MTP")
 				{
 					//device->SetConfiguration(configuration->GetIndex());
-					usb::BulkPipePtr pipe = usb::BulkPipe::Create(device, conf, iface, token);
-					return std::make_shared<Device>(pipe);
-				}
-				if (iface->GetClass() == 6 && iface->GetSubclass() == 1)
-				{
-					usb::BulkPipePtr pipe = usb::BulkPipe::Create(device, conf, iface, token);
-					return std::make_shared<Device>(pipe);
+					usb::BulkPipePtr pipe = CreatePipe(device, conf, iface, token, desc);
+					return std::make_shared<Device>(pipe, desc);
 				}
 			}
 		}
 		return nullptr;
 	}
 
+	std::vector<usb::DeviceDescriptorPtr> Device::GetCandidates(const usb::ContextPtr &ctx)
+	{
+		//open likely devices first, devices without suitable interfaces are not touched at all
+		std::vector<usb::DeviceDescriptorPtr> likely, possible;
+		for (usb::DeviceDescriptorPtr desc : ctx->GetDevices())
+		try
+		{
+			switch(Probe(desc))
+			{
+			case ProbeResult::Likely:	likely.push_back(desc); break;
+			case ProbeResult::Possible:	possible.push_back(desc); break;
+			case ProbeResult::None:		break;
+			}
+		}
+		catch(const std::exception &ex)
+		{ error("Device::Probe failed:", ex.what()); }
+		likely.insert(likely.end(), possible.begin(), possible.end());
+		return likely;
+	}
+
+	DevicePtr Device::OpenReplay()
+	{
+		const char *path = getenv("AFT_REPLAY");
+		if (!path || !*path)
+			return nullptr;
+
+		const char *speed = getenv("AFT_REPLAY_SPEED");
+		auto pipe = std::make_shared<mock::ReplayBulkPipe>(path, speed? strtod(speed, NULL): 1);
+		const mock::Recording &header = pipe->GetHeader();
+		return std::make_shared<Device>(pipe, header.VendorId, header.ProductId, header.BusPath);
+	}
+
+	DevicePtr Device::OpenMock()
+	{
+		const char *spec = getenv("AFT_MOCK");
+		if (!spec)
+			return nullptr;
+		return std::make_shared<Device>(mock::DeviceSpec::Parse(spec).CreatePipe());
+	}
+
+	DevicePtr Device::OpenRemote()
+	{
+		const char *address = getenv("AFT_REMOTE");
+		if (!address || !*address)
+			return nullptr;
+		auto pipe = std::make_shared<net::BulkPipe>(address);
+		return std::make_shared<Device>(pipe, pipe->GetVendorId(), pipe->GetProductId(), pipe->GetBusPath());
+	}
+
+	DevicePtr Device::OpenEmulated()
+	{
+		DevicePtr device = OpenReplay();
+		if (!device)
+			device = OpenMock();
+		return device? device: OpenRemote();
+	}
+
+	bool Device::FindEmulated(DevicePtr &device)
+	{
+		const char *replay = getenv("AFT_REPLAY");
+		const char *remote = getenv("AFT_REMOTE");
+		if ((!replay || !*replay) && !getenv("AFT_MOCK") && (!remote || !*remote))
+			return false;
+		auto started = StartupTimings::Clock::now();
+		try
+		{ device = OpenEmulated(); }
+		catch(const std::exception &ex)
+		{ error("Device::OpenEmulated failed: ", ex.what()); }
+		if (device)
+			device->GetStartupTimings().Record("device open", started);
+		return true;
+	}
+
 	DevicePtr Device::FindFirst(bool claimInterface)
 	{
+		DevicePtr emulated;
+		if (FindEmulated(emulated))
+			return emulated;
+
+		auto started = StartupTimings::Clock::now();
 		usb::ContextPtr ctx(new usb::Context);
+		auto candidates = GetCandidates(ctx);
+		auto scan = StartupTimings::Clock::now() - started;
 
-		for (usb::DeviceDescriptorPtr desc : ctx->GetDevices())
+		for (usb::DeviceDescriptorPtr desc : candidates)
 		try
 		{
 			auto device = Open(ctx, desc, claimInterface);
 			if (device)
+			{
+				device->GetStartupTimings().Record("usb scan", scan);
 				return device;
+			}
+		}
+		catch(const std::exception &ex)
+		{ error("Device::Find failed:", ex.what()); }
+
+		return nullptr;
+	}
+
+	std::vector<DevicePtr> Device::FindAll(bool claimInterface)
+	{
+		std::vector<DevicePtr> devices;
+		DevicePtr emulated;
+		if (FindEmulated(emulated))
+		{
+			if (emulated)
+				devices.push_back(emulated);
+			return devices;
+		}
+
+		auto started = StartupTimings::Clock::now();
+		usb::ContextPtr ctx(new usb::Context);
+		auto candidates = GetCandidates(ctx);
+		auto scan = StartupTimings::Clock::now() - started;
+
+		for (usb::DeviceDescriptorPtr desc : candidates)
+		try
+		{
+			auto device = Open(ctx, desc, claimInterface);
+			if (device)
+			{
+				device->GetStartupTimings().Record("usb scan", scan);
+				devices.push_back(device);
+			}
+		}
+		catch(const std::exception &ex)
+		{ error("Device::FindAll failed:", ex.what()); }
+
+		return devices;
+	}
+
+	DevicePtr Device::Find(const std::string &id, bool claimInterface)
+	{
+		DevicePtr emulated;
+		if (FindEmulated(emulated))
+			return emulated; //there is single emulated device, id is not checked
+
+		auto started = StartupTimings::Clock::now();
+		usb::ContextPtr ctx(new usb::Context);
+		auto candidates = GetCandidates(ctx);
+		auto scan = StartupTimings::Clock::now() - started;
+
+		for (usb::DeviceDescriptorPtr desc : candidates)
+		{
+			if (desc->GetBusPath() != id)
+				continue;
+			try
+			{
+				auto device = Open(ctx, desc, claimInterface);
+				if (device)
+					device->GetStartupTimings().Record("usb scan", scan);
+				return device;
+			}
+			catch(const std::exception &ex)
+			{ error("Device::Find failed:", ex.what()); return nullptr; }
+		}
+
+		//no such port, match serial number, device info is available without session
+		for (usb::DeviceDescriptorPtr desc : candidates)
+		try
+		{
+			auto device = Open(ctx, desc, claimInterface);
+			if (device && device->GetInfo().SerialNumber == id)
+			{
+				device->GetStartupTimings().Record("usb scan", scan);
+				return device;
+			}
 		}
 		catch(const std::exception &ex)
 		{ error("Device::Find failed:", ex.what()); }
@@ -23,6 +23,7 @@
 #include <mtp/usb/BulkPipe.h>
 #include <mtp/ptp/PipePacketer.h>
 #include <mtp/ptp/Session.h>
+#include <mtp/ptp/StartupTimings.h>
 #include <usb/DeviceDescriptor.h>
 
 namespace mtp
@@ -30,17 +31,71 @@ namespace mtp
 	class Device //! Generic MTP Device class representing physical device, creates \ref Session
 	{
 		PipePacketer	_packeter;
+		std::string		_busPath;
+		u16				_vendorId, _productId;
+		StartupTimings	_startupTimings;
+
+	public:
+		enum struct ProbeResult
+		{
+			None,		///< no still image or vendor specific interface, device is never opened
+			Possible,	///< vendor specific interface, name has to be read from device
+			Likely		///< still image class, "MTP" interface name in sysfs or known vendor
+		};
 
 	private:
 		static int GetInterfaceStringIndex(usb::DeviceDescriptorPtr desc, u8 number);
+		static bool IsKnownVendor(u16 vendorId);
+		static std::vector<usb::DeviceDescriptorPtr> GetCandidates(const usb::ContextPtr &ctx);
+		///returns true if emulated or remote device was requested, usb devices are not scanned then, device is null if it failed to open
+		static bool FindEmulated(DevicePtr &device);
+		static DevicePtr OpenInterface(usb::ContextPtr context, usb::DeviceDescriptorPtr desc, bool claimInterface);
 
 	public:
-		Device(usb::BulkPipePtr pipe);
+		///descriptor provides bus path and ids for quirks lookup, it's optional
+		Device(usb::BulkPipePtr pipe, const usb::DeviceDescriptorPtr &desc = usb::DeviceDescriptorPtr());
+		///device without descriptor, e.g. replayed from recording, ids are used for quirks lookup
+		Device(usb::BulkPipePtr pipe, u16 vendorId, u16 productId, const std::string &busPath);
+
+		usb::BulkPipePtr GetPipe() const
+		{ return _packeter.GetPipe(); }
+
+		///usb topology path of device (e.g. 1-2.3), stable while device stays in the same port, empty if backend does not provide it
+		const std::string & GetBusPath() const
+		{ return _busPath; }
+
+		///usb ids used for quirks lookup, 0 if unknown
+		u16 GetVendorId() const
+		{ return _vendorId; }
+		u16 GetProductId() const
+		{ return _productId; }
+
+		///phases of finding and opening this device, copied into sessions it opens
+		StartupTimings & GetStartupTimings()
+		{ return _startupTimings; }
 
+		///opens session and applies known quirks of this device model
 		SessionPtr OpenSession(u32 sessionId, int timeout = Session::DefaultTimeout);
+		///requests device info outside of session, used to identify device before opening one
+		msg::DeviceInfo GetInfo(int timeout = Session::DefaultTimeout);
 
+		///classifies device by descriptors only, without opening it
+		static ProbeResult Probe(usb::DeviceDescriptorPtr desc);
 		static DevicePtr Open(usb::ContextPtr context, usb::DeviceDescriptorPtr desc, bool claimInterface = true);
+		///opens recording named by AFT_REPLAY environment variable instead of usb device, returns nullptr if it's not set
+		///AFT_REPLAY_SPEED scales recorded delays, 0 replays without delays
+		static DevicePtr OpenReplay();
+		///opens in-process simulated device with tree described by AFT_MOCK environment variable (see \ref mock::DeviceSpec), returns nullptr if it's not set
+		static DevicePtr OpenMock();
+		///connects to device served by relay at host:port from AFT_REMOTE environment variable (see \ref net::Relay), returns nullptr if it's not set
+		static DevicePtr OpenRemote();
+		///replayed, simulated or remote device, used by Find* methods before any usb device is touched
+		static DevicePtr OpenEmulated();
 		static DevicePtr FindFirst(bool claimInterface = true);
+		///opens all MTP devices, likely ones first
+		static std::vector<DevicePtr> FindAll(bool claimInterface = true);
+		///opens device with given bus path or MTP serial number, bus path is matched without opening other devices
+		static DevicePtr Find(const std::string &id, bool claimInterface = true);
 	};
 }
 
@@ -0,0 +1,205 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/DeviceCopier.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/log.h>
+
+#include <stdexcept>
+#include <thread>
+
+namespace mtp
+{
+	namespace
+	{
+		///transfer of this session can't go on, device is told to cancel it and session resyncs before it's used again
+		void AbortTransfer(const SessionPtr &session)
+		{
+			try
+			{ session->AbortCurrentTransaction(DeviceCopier::AbortTimeout); }
+			catch(const std::exception &ex)
+			{ debug("aborting transfer failed: ", ex.what()); }
+		}
+
+		class AbortingInputStream final: public IObjectInputStream, public CancellableStream //! pipe end feeding SendObject of target, if source fails, target is not left waiting for the rest of announced data
+		{
+			IObjectInputStreamPtr	_input;
+			SessionPtr				_session;
+
+		public:
+			AbortingInputStream(const IObjectInputStreamPtr &input, const SessionPtr &session): _input(input), _session(session)
+			{ }
+
+			virtual u64 GetSize() const
+			{ return _input->GetSize(); }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				CheckCancelled();
+				try
+				{ return _input->Read(data, size); }
+				catch(const OperationCancelledException &)
+				{ throw; }
+				catch(...)
+				{
+					AbortTransfer(_session);
+					throw OperationCancelledException();
+				}
+			}
+		};
+
+		class AbortingOutputStream final: public IObjectOutputStream, public CancellableStream //! pipe end filled by GetObject of source, if target fails, source stops sending instead of blocking on full pipe
+		{
+			IObjectOutputStreamPtr	_output;
+			SessionPtr				_session;
+
+		public:
+			AbortingOutputStream(const IObjectOutputStreamPtr &output, const SessionPtr &session): _output(output), _session(session)
+			{ }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				CheckCancelled();
+				try
+				{ return _output->Write(data, size); }
+				catch(const OperationCancelledException &)
+				{ throw; }
+				catch(...)
+				{
+					AbortTransfer(_session);
+					throw OperationCancelledException();
+				}
+			}
+		};
+	}
+
+	DeviceCopier::DeviceCopier(const SessionPtr &source, const SessionPtr &target, size_t bufferSize):
+		_source(source), _target(target), _bufferSize(bufferSize), _files(0), _directories(0), _bytes(0)
+	{
+		//both transactions would wait for the same session mutex while pipe is full
+		if (_source == _target)
+			throw std::invalid_argument("source and target sessions must belong to different devices");
+	}
+
+	ObjectId DeviceCopier::CopyFile(ObjectId objectId, ObjectFormat format, const std::string &name, u64 size, time_t mtime, time_t ctime, StorageId storageId, ObjectId parent)
+	{
+		msg::ObjectInfo oi;
+		oi.Filename = name;
+		oi.ObjectFormat = format;
+		if (mtime)
+			oi.ModificationDate = ConvertDateTime(mtime);
+		if (ctime)
+			oi.CaptureDate = ConvertDateTime(ctime);
+
+		Session::NewObjectInfo noi = _target->CreateObject(oi, size, storageId, parent);
+
+		//source is read from its own thread, target sends data as it arrives, so copy runs at speed of the slower device
+		//when one side fails, transfer of the other one is aborted from its stream, so both sessions are in sync again before they are reused
+		auto pipe = std::make_shared<ObjectPipe>(_bufferSize);
+		SessionPtr source = _source;
+		std::exception_ptr sourceError;
+		std::thread reader([pipe, source, objectId, &sourceError]()
+		{
+			try
+			{
+				source->GetObject(objectId, std::make_shared<AbortingOutputStream>(pipe->GetOutputStream(), source));
+				pipe->Close();
+			}
+			catch(...)
+			{
+				sourceError = std::current_exception();
+				pipe->Fail(sourceError);
+			}
+		});
+
+		try
+		{ _target->SendObject(std::make_shared<AbortingInputStream>(pipe->GetInputStream(size), _target)); }
+		catch(...)
+		{
+			std::exception_ptr targetError = std::current_exception();
+			pipe->Fail(targetError);
+			reader.join();
+			try
+			{ _target->DeleteObject(noi.ObjectId); } //incomplete copy is not left behind
+			catch(const std::exception &ex)
+			{ debug("removing incomplete copy failed: ", ex.what()); }
+			try
+			{ std::rethrow_exception(targetError); }
+			catch(const OperationCancelledException &)
+			{
+				if (sourceError)
+					std::rethrow_exception(sourceError); //target was cancelled because of it
+				throw;
+			}
+		}
+		reader.join();
+
+		++_files;
+		_bytes += size;
+		return noi.ObjectId;
+	}
+
+	void DeviceCopier::CopyTree(const ObjectTree &tree, ObjectId sourceParent, StorageId storageId, ObjectId parent, const std::string &path)
+	{
+		tree.ForEachChild(sourceParent, [&](const ObjectTree::Object &object)
+		{
+			std::string name = tree.GetName(object);
+			std::string objectPath = path + "/" + name;
+			if (object.Format == ObjectFormat::Association)
+			{
+				ObjectId directory = _target->CreateDirectory(name, parent, storageId).ObjectId;
+				++_directories;
+				if (_callback)
+					_callback(objectPath, 0);
+				CopyTree(tree, object.Id, storageId, directory, objectPath);
+			}
+			else
+			{
+				CopyFile(object.Id, object.Format, name, object.Size, object.ModificationTime, object.CreationTime, storageId, parent);
+				if (_callback)
+					_callback(objectPath, object.Size);
+			}
+		});
+	}
+
+	ObjectId DeviceCopier::Copy(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name, const ObjectTree::Formats &formats)
+	{
+		msg::ObjectInfo info = _source->GetFullObjectInfo(objectId);
+		std::string filename = name.empty()? info.Filename: name;
+
+		if (info.ObjectFormat != ObjectFormat::Association)
+		{
+			ObjectId copy = CopyFile(objectId, info.ObjectFormat, filename, info.ObjectSize, ConvertDateTime(info.ModificationDate), ConvertDateTime(info.CaptureDate), storageId, parent);
+			if (_callback)
+				_callback(filename, info.ObjectSize);
+			return copy;
+		}
+
+		//whole source tree is listed with as few transactions as device allows before anything is created
+		ObjectTree tree(_source);
+		tree.Enumerate(Session::AllStorages, objectId, formats);
+		ObjectId copy = _target->CreateDirectory(filename, parent, storageId, info.AssociationType).ObjectId;
+		++_directories;
+		if (_callback)
+			_callback(filename, 0);
+		CopyTree(tree, objectId, storageId, copy, filename);
+		return copy;
+	}
+
+}
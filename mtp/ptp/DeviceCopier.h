@@ -0,0 +1,72 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_DEVICECOPIER_H
+#define AFT_PTP_DEVICECOPIER_H
+
+#include <mtp/ptp/ObjectTree.h>
+#include <mtp/ptp/ObjectPipe.h>
+#include <mtp/ptp/Session.h>
+
+#include <functional>
+#include <string>
+
+namespace mtp
+{
+	class DeviceCopier //! copies objects from one device to another, GetObject of source streams into SendObject of target through ring buffer, nothing touches disk
+	{
+	public:
+		///called after every copied object with its path relative to copied root and its size
+		typedef std::function<void (const std::string &path, u64 size)> Callback;
+
+		static const int AbortTimeout = 6000; ///< for cancel request of transfer whose other side failed
+
+	private:
+		SessionPtr	_source;
+		SessionPtr	_target;
+		size_t		_bufferSize;
+		Callback	_callback;
+		size_t		_files, _directories;
+		u64			_bytes;
+
+		ObjectId CopyFile(ObjectId objectId, ObjectFormat format, const std::string &name, u64 size, time_t mtime, time_t ctime, StorageId storageId, ObjectId parent);
+		void CopyTree(const ObjectTree &tree, ObjectId sourceParent, StorageId storageId, ObjectId parent, const std::string &path);
+
+	public:
+		///sessions must belong to different devices, transfers of both run at the same time
+		DeviceCopier(const SessionPtr &source, const SessionPtr &target, size_t bufferSize = ObjectPipe::DefaultCapacity);
+
+		void SetCallback(const Callback &callback)
+		{ _callback = callback; }
+
+		///copies object of source (recursively for directories) into parent on target, empty name keeps original one, returns id of the copy
+		///metadata of source tree is fetched before transfer starts, formats keep directories and objects of those formats only
+		ObjectId Copy(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name = std::string(), const ObjectTree::Formats &formats = ObjectTree::Formats());
+
+		size_t GetFiles() const
+		{ return _files; }
+		size_t GetDirectories() const
+		{ return _directories; }
+		u64 GetBytes() const
+		{ return _bytes; }
+	};
+	DECLARE_PTR(DeviceCopier);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/DevicePool.h>
+#include <mtp/log.h>
+#include <usb/Device.h>
+
+namespace mtp
+{
+
+	DevicePool::DevicePool(const std::vector<DevicePtr> &devices, u32 sessionId, int timeout, unsigned busUrbs):
+		_scheduler(std::make_shared<BusScheduler>(busUrbs))
+	{
+		for(auto & device : devices)
+		try
+		{
+			Entry entry;
+			entry.Device = device;
+			SessionPtr session = device->OpenSession(sessionId, timeout);
+			entry.SerialNumber = session->GetDeviceInfo().SerialNumber;
+			entry.Session = std::make_shared<AsyncSession>(session);
+			entry.UsbDevice = device->GetPipe()->GetDevice();
+			_scheduler->Add(entry.UsbDevice, device->GetBusPath()); //after session is open, quirks may have lowered urb queue depth
+			_entries.push_back(std::move(entry));
+		}
+		catch(const std::exception &ex)
+		{ error("DevicePool: opening session failed: ", ex.what()); }
+	}
+
+	AsyncSessionPtr DevicePool::Find(const std::string &id) const
+	{
+		for(auto & entry : _entries)
+		{
+			if (entry.SerialNumber == id || (!entry.Device->GetBusPath().empty() && entry.Device->GetBusPath() == id))
+				return entry.Session;
+		}
+		return nullptr;
+	}
+
+	bool DevicePool::SetWeight(const std::string &id, unsigned weight)
+	{
+		for(auto & entry : _entries)
+		{
+			if (entry.SerialNumber == id || (!entry.Device->GetBusPath().empty() && entry.Device->GetBusPath() == id))
+			{
+				_scheduler->SetWeight(entry.UsbDevice, weight);
+				return true;
+			}
+		}
+		return false;
+	}
+
+}
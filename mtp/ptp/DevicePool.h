@@ -0,0 +1,109 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_DEVICEPOOL_H
+#define AFT_PTP_DEVICEPOOL_H
+
+#include <mtp/ptp/AsyncSession.h>
+#include <mtp/ptp/BusScheduler.h>
+#include <mtp/ptp/Device.h>
+
+#include <string>
+#include <vector>
+
+namespace mtp
+{
+	class DevicePool : Noncopyable //! sessions of several devices, each driven by its own AsyncSession worker, so transactions on different devices run concurrently, devices on the same usb bus share its urbs
+	{
+	public:
+		struct Entry
+		{
+			DevicePtr			Device;
+			AsyncSessionPtr		Session;
+			std::string			SerialNumber;
+			usb::DevicePtr		UsbDevice; //null for network devices
+		};
+
+	private:
+		BusSchedulerPtr			_scheduler;
+		std::vector<Entry>		_entries;
+
+	public:
+		///opens session on every device, devices failing to open session are skipped
+		DevicePool(const std::vector<DevicePtr> &devices, u32 sessionId = 1, int timeout = Session::DefaultTimeout, unsigned busUrbs = BusScheduler::DefaultBusUrbs);
+
+		const BusSchedulerPtr & GetScheduler() const
+		{ return _scheduler; }
+
+		///devices with higher weight get proportionally more urbs of their bus during bulk jobs, returns false if id is unknown
+		bool SetWeight(const std::string &id, unsigned weight);
+
+		const std::vector<Entry> & GetEntries() const
+		{ return _entries; }
+
+		size_t GetSize() const
+		{ return _entries.size(); }
+
+		///returns session of device with given MTP serial number or bus path, nullptr if there is none
+		AsyncSessionPtr Find(const std::string &id) const;
+
+		///queues func(Session &) on device of given entry, bulk jobs mark device busy for bus scheduler while they run
+		template<typename Func>
+		auto Submit(const Entry &entry, Func func, AsyncSession::Priority priority = AsyncSession::Priority::Bulk) -> std::future<decltype(func(std::declval<Session &>()))>
+		{
+			if (priority != AsyncSession::Priority::Bulk || !entry.UsbDevice)
+				return entry.Session->Submit(func, priority);
+
+			BusSchedulerPtr scheduler = _scheduler;
+			usb::DevicePtr device = entry.UsbDevice;
+			return entry.Session->Submit([func, scheduler, device](Session &session) mutable
+			{
+				BusScheduler::ActiveScope active(*scheduler, device);
+				return func(session);
+			}, priority);
+		}
+
+		///queues func(Session &) on every device and waits for all of them, first error is rethrown after all jobs finished
+		template<typename Func>
+		void ForEach(Func func, AsyncSession::Priority priority = AsyncSession::Priority::Bulk)
+		{
+			std::vector<std::future<void>> results;
+			results.reserve(_entries.size());
+			for(auto & entry : _entries)
+				results.push_back(Submit(entry, [func](Session &session) mutable { func(session); }, priority));
+
+			std::exception_ptr error;
+			for(auto & result : results)
+			{
+				try
+				{ result.get(); }
+				catch(...)
+				{
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+	DECLARE_PTR(DevicePool);
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/DeviceQuirks.h>
+#include <mtp/log.h>
+
+namespace mtp
+{
+
+	namespace
+	{
+		typedef Capabilities::Quirk Quirk;
+
+		struct Entry
+		{
+			u16				VendorId;		//0 matches any vendor
+			u16				ProductId;		//0 matches any product
+			const char *	Manufacturer;	//substrings, null matches anything
+			const char *	Model;
+			const char *	Extension;		//substring of VendorExtensionDesc
+			u32				Quirks;
+			size_t			MaxTransferSize;
+			unsigned		UrbQueueDepth;
+		};
+
+		const Entry Entries[] =
+		{
+			//android MtpServer answers depth > 1 with SpecificationByDepthUnsupported
+			{ 0, 0, nullptr, nullptr, "android.com", static_cast<u32>(Quirk::PropertyListDepthUnsupported), 0, 0 },
+		};
+
+		bool Matches(const char *pattern, const std::string &value)
+		{ return !pattern || value.find(pattern) != value.npos; }
+
+		void Limit(size_t &value, size_t limit)
+		{
+			if (limit && (!value || limit < value))
+				value = limit;
+		}
+	}
+
+	DeviceQuirks DeviceQuirks::Find(u16 vendorId, u16 productId, const msg::DeviceInfo &info)
+	{
+		DeviceQuirks quirks;
+		for(const Entry &entry : Entries)
+		{
+			if ((entry.VendorId && entry.VendorId != vendorId) || (entry.ProductId && entry.ProductId != productId))
+				continue;
+			if (!Matches(entry.Manufacturer, info.Manufacturer) || !Matches(entry.Model, info.Model) || !Matches(entry.Extension, info.VendorExtensionDesc))
+				continue;
+
+			quirks.Quirks |= entry.Quirks;
+			Limit(quirks.MaxTransferSize, entry.MaxTransferSize);
+			size_t depth = quirks.UrbQueueDepth;
+			Limit(depth, entry.UrbQueueDepth);
+			quirks.UrbQueueDepth = depth;
+		}
+		if (quirks.Quirks || quirks.MaxTransferSize || quirks.UrbQueueDepth)
+			debug("device quirks: 0x", hex(quirks.Quirks, 8), ", max transfer size: ", quirks.MaxTransferSize, ", urb queue depth: ", quirks.UrbQueueDepth);
+		return quirks;
+	}
+
+}
@@ -0,0 +1,42 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_DEVICEQUIRKS_H
+#define AFT_PTP_DEVICEQUIRKS_H
+
+#include <mtp/ptp/Capabilities.h>
+#include <mtp/ptp/Messages.h>
+
+namespace mtp
+{
+	struct DeviceQuirks //! known limits and broken operations of device models, looked up from built-in table so devices take their fastest working path from the first transaction
+	{
+		u32			Quirks;				///< Capabilities::Quirk bits
+		size_t		MaxTransferSize;	///< largest reliable usb transfer, 0 if backend choice works
+		unsigned	UrbQueueDepth;		///< largest safe number of urbs in flight, 0 if backend default works
+
+		DeviceQuirks(): Quirks(0), MaxTransferSize(0), UrbQueueDepth(0)
+		{ }
+
+		///merges all matching table entries, flags are combined and the lowest limits win
+		static DeviceQuirks Find(u16 vendorId, u16 productId, const msg::DeviceInfo &info);
+	};
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/EventListener.h>
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/Response.h>
+#include <mtp/log.h>
+
+namespace mtp
+{
+	EventListener::EventListener(const usb::BulkPipePtr &pipe): _pipe(pipe), _nextId(0), _stopped(false)
+	{ _thread = std::thread(&EventListener::Run, this); }
+
+	EventListener::~EventListener()
+	{
+		_stopped = true;
+		_thread.join();
+	}
+
+	int EventListener::Subscribe(const Callback &callback)
+	{
+		scoped_mutex_lock l(_mutex);
+		int id = _nextId++;
+		_subscribers[id] = callback;
+		return id;
+	}
+
+	void EventListener::Unsubscribe(int id)
+	{
+		scoped_mutex_lock l(_mutex);
+		_subscribers.erase(id);
+	}
+
+	bool EventListener::Decode(const ByteArray &data, Event &event)
+	{
+		static const size_t HeaderSize = 12;
+		if (data.size() < HeaderSize)
+			return false;
+
+		InputStream stream(data);
+		u32 size;
+		ContainerType containerType;
+		stream >> size;
+		stream >> containerType;
+		stream >> event.Code;
+		stream >> event.TransactionId;
+		if (containerType != ContainerType::Event)
+			return false;
+
+		size_t end = std::min<size_t>(size, data.size());
+		event.Params.clear();
+		for(size_t offset = HeaderSize; offset + 4 <= end; offset += 4)
+		{
+			u32 param;
+			stream >> param;
+			event.Params.push_back(param);
+		}
+		return true;
+	}
+
+	void EventListener::Publish(const Event &event)
+	{
+		scoped_mutex_lock l(_mutex);
+		for(auto &subscriber : _subscribers)
+		{
+			try { subscriber.second(event); }
+			catch(const std::exception &ex)
+			{ error("event handler failed: ", ex.what()); }
+		}
+	}
+
+	void EventListener::Run()
+	{
+		ByteArray data; //reused for every transfer
+		while(!_stopped)
+		{
+			try
+			{
+				if (!_pipe->ReadInterrupt(data, PollTimeout))
+					continue;
+
+				Event event;
+				if (!Decode(data, event))
+				{
+					HexDump("invalid interrupt data", data);
+					continue;
+				}
+				MTP_DEBUG_CATEGORY(LogTransaction, "event ", hex(static_cast<u16>(event.Code), 4), ", ", event.Params.size(), " parameter(s)");
+				Publish(event);
+			}
+			catch(const std::exception &ex)
+			{
+				error("reading interrupt endpoint failed: ", ex.what());
+				std::this_thread::sleep_for(std::chrono::milliseconds(PollTimeout));
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_EVENTLISTENER_H
+#define AFT_PTP_EVENTLISTENER_H
+
+#include <mtp/ptp/EventCode.h>
+#include <mtp/usb/BulkPipe.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mtp
+{
+	struct Event //! decoded event container
+	{
+		EventCode			Code;
+		u32					TransactionId;
+		std::vector<u32>	Params;
+
+		Event(): Code(), TransactionId() { }
+
+		u32 GetParam(size_t idx) const
+		{ return idx < Params.size()? Params[idx]: 0; }
+	};
+
+	class EventListener : Noncopyable //! reads interrupt endpoint from background thread and passes decoded events to subscribers
+	{
+	public:
+		typedef std::function<void (const Event &)> Callback;
+
+		static const int PollTimeout = 500; ///< stop request is noticed within this time
+
+	private:
+		usb::BulkPipePtr			_pipe;
+		std::mutex					_mutex;
+		std::map<int, Callback>		_subscribers;
+		int							_nextId;
+		std::atomic_bool			_stopped;
+		std::thread					_thread;
+
+		void Run();
+		void Publish(const Event &event);
+
+	public:
+		EventListener(const usb::BulkPipePtr &pipe);
+		~EventListener();
+
+		///callback is called from listener thread, it must not block on device i/o or unsubscribe itself
+		int Subscribe(const Callback &callback);
+		///no callback for this subscription runs after return
+		void Unsubscribe(int id);
+
+		///returns false if data is not an event container
+		static bool Decode(const ByteArray &data, Event &event);
+	};
+	DECLARE_PTR(EventListener);
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_HASHINGOBJECTSTREAM_H
+#define AFT_PTP_HASHINGOBJECTSTREAM_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/Crc32c.h>
+
+namespace mtp
+{
+
+	template<typename HashType = Crc32c>
+	class HashingObjectOutputStream final: public IObjectOutputStream //! hashes data on its way to wrapped output stream, so downloaded object is verified without reading it back
+	{
+		IObjectOutputStreamPtr	_stream;
+		HashType				_hash;
+		u64						_size;
+
+	public:
+		HashingObjectOutputStream(const IObjectOutputStreamPtr &stream): _stream(stream), _size(0)
+		{ }
+
+		virtual void Cancel()
+		{ _stream->Cancel(); }
+
+		virtual void Reserve(u64 size)
+		{ _stream->Reserve(size); }
+
+		virtual size_t Write(const u8 *data, size_t size)
+		{
+			size_t r = _stream->Write(data, size);
+			_hash.Update(data, r);
+			_size += r;
+			return r;
+		}
+
+		const HashType & GetHash() const
+		{ return _hash; }
+
+		///bytes hashed so far
+		u64 GetSize() const
+		{ return _size; }
+	};
+
+	template<typename HashType = Crc32c>
+	class HashingObjectInputStream final: public IObjectInputStream //! hashes data read from wrapped input stream, e.g. local file being uploaded
+	{
+		IObjectInputStreamPtr	_stream;
+		HashType				_hash;
+
+	public:
+		HashingObjectInputStream(const IObjectInputStreamPtr &stream): _stream(stream)
+		{ }
+
+		virtual void Cancel()
+		{ _stream->Cancel(); }
+
+		virtual u64 GetSize() const
+		{ return _stream->GetSize(); }
+
+		virtual size_t Read(u8 *data, size_t size)
+		{
+			size_t r = _stream->Read(data, size);
+			_hash.Update(data, r);
+			return r;
+		}
+
+		const HashType & GetHash() const
+		{ return _hash; }
+	};
+
+}
+
+#endif
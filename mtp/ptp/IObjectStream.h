@@ -67,6 +67,9 @@ namespace mtp
 	struct IObjectOutputStream : public virtual ICancellableStream //! Basic output stream interface
 	{
 		virtual size_t Write(const u8 *data, size_t size) = 0;
+
+		///payload size announced by data container before its first write, memory streams allocate it at once
+		virtual void Reserve(u64 size) { }
 	};
 	DECLARE_PTR(IObjectOutputStream);
 
@@ -22,17 +22,74 @@
 
 #include <mtp/types.h>
 #include <mtp/ByteArray.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/Utf16.h>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
 
 namespace mtp
 {
 
-	class InputStream //! MTP data decoding input stream
+	namespace impl
+	{
+		struct CheckedAccess //! every read is bounds checked, std::out_of_range is thrown past the end
+		{
+			static void Check(const ByteArray &data, size_t offset, size_t size)
+			{
+				if (offset + size > data.size())
+					throw std::out_of_range("read past the end of stream data");
+			}
+		};
+
+		struct UncheckedAccess //! no per-read checks, caller must validate remaining size with Require() beforehand
+		{
+			static void Check(const ByteArray &, size_t, size_t)
+			{ }
+		};
+
+		///element types which could be copied from little-endian data as is
+		template<typename ElementType>
+		struct RawArrayElement :
+			std::integral_constant<bool, std::is_arithmetic<ElementType>::value || std::is_enum<ElementType>::value>
+		{ };
+		template<> struct RawArrayElement<ObjectId> : std::true_type { };
+		template<> struct RawArrayElement<StorageId> : std::true_type { };
+	}
+
+	template<typename AccessPolicy>
+	class BasicInputStream //! MTP data decoding input stream
 	{
 		const ByteArray &	_data;
 		size_t				_offset;
 
+		template<typename ElementType>
+		void ReadArrayElements(std::vector<ElementType> &array, u32 size, std::true_type)
+		{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			Require(static_cast<u64>(size) * sizeof(ElementType));
+			array.resize(size);
+			if (size)
+				std::memcpy(static_cast<void *>(array.data()), _data.data() + _offset, size * sizeof(ElementType));
+			_offset += size * sizeof(ElementType);
+#else
+			ReadArrayElements(array, size, std::false_type());
+#endif
+		}
+
+		template<typename ElementType>
+		void ReadArrayElements(std::vector<ElementType> &array, u32 size, std::false_type)
+		{
+			while(size--)
+			{
+				ElementType el;
+				(*this) >> el;
+				array.push_back(el);
+			}
+		}
+
 	public:
-		InputStream(const ByteArray & data, size_t offset = 0): _data(data), _offset(offset) { }
+		BasicInputStream(const ByteArray & data, size_t offset = 0): _data(data), _offset(offset) { }
 
 		size_t GetOffset() const
 		{ return _offset; }
@@ -46,20 +103,36 @@ namespace mtp
 		bool AtEnd() const
 		{ return _offset >= _data.size(); }
 
+		size_t GetRemaining() const
+		{ return _offset < _data.size()? _data.size() - _offset: 0; }
+
+		///validates that stream has at least size bytes left regardless of access policy
+		void Require(u64 size) const
+		{
+			if (size > GetRemaining())
+				throw std::out_of_range("stream data is too short");
+		}
+
 		u8 Read8()
-		{ return _data.at(_offset++); }
+		{
+			AccessPolicy::Check(_data, _offset, 1);
+			return _data[_offset++];
+		}
 
 		u16 Read16()
 		{
-			u8 l = Read8();
-			u8 h = Read8();
-			return l | ((u16)h << 8);
+			AccessPolicy::Check(_data, _offset, 2);
+			const u8 *src = _data.data() + _offset;
+			_offset += 2;
+			return src[0] | ((u16)src[1] << 8);
 		}
+
 		u32 Read32()
 		{
-			u16 l = Read16();
-			u16 h = Read16();
-			return l | ((u32)h << 16);
+			AccessPolicy::Check(_data, _offset, 4);
+			const u8 *src = _data.data() + _offset;
+			_offset += 4;
+			return src[0] | ((u32)src[1] << 8) | ((u32)src[2] << 16) | ((u32)src[3] << 24);
 		}
 
 		u64 Read64()
@@ -74,27 +147,10 @@ namespace mtp
 
 		std::string ReadString(unsigned len)
 		{
+			AccessPolicy::Check(_data, _offset, 2 * len);
 			std::string str;
-			str.reserve(2 * len);
-			while(len--)
-			{
-				u16 ch = Read16();
-				if (ch == 0)
-					continue;
-				if (ch <= 0x7f)
-					str += (char)ch;
-				else if (ch <= 0x7ff)
-				{
-					str += (char) ((ch >> 6) | 0xc0);
-					str += (char) ((ch & 0x3f) | 0x80);
-				}
-				else //if (ch <= 0xffff)
-				{
-					str += (char)((ch >> 12) | 0xe0);
-					str += (char)(((ch & 0x0fc0) >> 6) | 0x80);
-					str += (char)( (ch & 0x003f) | 0x80);
-				}
-			}
+			DecodeUtf16(str, _data.data() + _offset, len);
+			_offset += 2 * len;
 			return str;
 		}
 
@@ -106,33 +162,36 @@ namespace mtp
 				return array;
 
 			u32 size = Read32();
-			while(size--)
-			{
-				ElementType el;
-				(*this) >> el;
-				array.push_back(el);
-			}
+			ReadArrayElements(array, size, impl::RawArrayElement<ElementType>());
 			return array;
 		}
 	};
 
-	inline InputStream & operator >> (InputStream &stream, u8 &value)
+	typedef BasicInputStream<impl::CheckedAccess> InputStream;
+	typedef BasicInputStream<impl::UncheckedAccess> UncheckedInputStream;
+
+	template<typename AccessPolicy>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, u8 &value)
 	{ value = stream.Read8(); return stream; }
 
-	inline InputStream & operator >> (InputStream &stream, u16 &value)
+	template<typename AccessPolicy>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, u16 &value)
 	{ value = stream.Read16(); return stream; }
 
-	inline InputStream & operator >> (InputStream &stream, u32 &value)
+	template<typename AccessPolicy>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, u32 &value)
 	{ value = stream.Read32(); return stream; }
 
-	inline InputStream & operator >> (InputStream &stream, u64 &value)
+	template<typename AccessPolicy>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, u64 &value)
 	{ value = stream.Read64(); return stream; }
 
-	inline InputStream & operator >> (InputStream &stream, std::string &value)
+	template<typename AccessPolicy>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, std::string &value)
 	{ value = stream.ReadString(); return stream; }
 
-	template<typename ElementType>
-	inline InputStream & operator >> (InputStream &stream, std::vector<ElementType> &value)
+	template<typename AccessPolicy, typename ElementType>
+	inline BasicInputStream<AccessPolicy> & operator >> (BasicInputStream<AccessPolicy> &stream, std::vector<ElementType> &value)
 	{ value = stream.template ReadArray<ElementType>(); return stream; }
 
 	inline u64 ReadSingleInteger(const ByteArray &data)
@@ -0,0 +1,151 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MTP_PTP_MESSAGECODEC_H
+#define AFT_MTP_PTP_MESSAGECODEC_H
+
+#include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/OutputStream.h>
+#include <type_traits>
+
+namespace mtp
+{
+	///messages describe their wire layout once with static VisitFields(Self &self, Visitor &visitor),
+	///calling visitor.Fixed(...) for runs of integer fields and visitor.Variable(...) for strings and arrays
+	namespace impl
+	{
+		template<typename ... Types>
+		struct WireSize //! encoded size of fixed width fields, known at compile time
+		{ static constexpr size_t Value = 0; };
+
+		template<typename Type, typename ... Rest>
+		struct WireSize<Type, Rest...>
+		{
+			typedef typename std::remove_cv<Type>::type ValueType;
+			static_assert(RawArrayElement<ValueType>::value, "fixed fields must be integers, enums or object ids");
+			static constexpr size_t Value = sizeof(ValueType) + WireSize<Rest...>::Value;
+		};
+
+		template<typename Stream>
+		void ReadFields(Stream &)
+		{ }
+
+		template<typename Stream, typename Field, typename ... Rest>
+		void ReadFields(Stream &stream, Field &field, Rest & ... rest)
+		{
+			stream >> field;
+			ReadFields(stream, rest...);
+		}
+
+		inline void WriteFields(OutputStream &)
+		{ }
+
+		template<typename Field, typename ... Rest>
+		void WriteFields(OutputStream &stream, const Field &field, const Rest & ... rest)
+		{
+			stream << field;
+			WriteFields(stream, rest...);
+		}
+
+		class MessageDecoder //! reads each run of fixed fields after a single bounds check
+		{
+			InputStream &	_stream;
+
+		public:
+			MessageDecoder(InputStream &stream): _stream(stream)
+			{ }
+
+			template<typename ... Fields>
+			void Fixed(Fields & ... fields)
+			{
+				const size_t size = WireSize<Fields...>::Value;
+				_stream.Require(size);
+				UncheckedInputStream fixed(_stream.GetData(), _stream.GetOffset());
+				ReadFields(fixed, fields...);
+				_stream.Skip(size);
+			}
+
+			template<typename ... Fields>
+			void Variable(Fields & ... fields)
+			{ ReadFields(_stream, fields...); }
+		};
+
+		class MessageSizer //! computes exact encoded size of message
+		{
+			static size_t GetVariableSize()
+			{ return 0; }
+
+			template<typename Field, typename ... Rest>
+			static size_t GetVariableSize(const Field &field, const Rest & ... rest)
+			{ return OutputStream::GetSize(field) + GetVariableSize(rest...); }
+
+		public:
+			size_t	Size;
+
+			MessageSizer(): Size(0)
+			{ }
+
+			template<typename ... Fields>
+			void Fixed(const Fields & ... fields)
+			{ Size += WireSize<Fields...>::Value; }
+
+			template<typename ... Fields>
+			void Variable(const Fields & ... fields)
+			{ Size += GetVariableSize(fields...); }
+		};
+
+		class MessageEncoder //! appends fields in wire order
+		{
+			OutputStream &	_stream;
+
+		public:
+			MessageEncoder(OutputStream &stream): _stream(stream)
+			{ }
+
+			template<typename ... Fields>
+			void Fixed(const Fields & ... fields)
+			{ WriteFields(_stream, fields...); }
+
+			template<typename ... Fields>
+			void Variable(const Fields & ... fields)
+			{ WriteFields(_stream, fields...); }
+		};
+	}
+
+	template<typename Message>
+	void DecodeMessage(InputStream &stream, Message &message)
+	{
+		impl::MessageDecoder decoder(stream);
+		Message::VisitFields(message, decoder);
+	}
+
+	///output buffer grows once, by the size computed from message fields
+	template<typename Message>
+	void EncodeMessage(OutputStream &stream, const Message &message)
+	{
+		impl::MessageSizer sizer;
+		Message::VisitFields(message, sizer);
+		stream.Reserve(sizer.Size);
+
+		impl::MessageEncoder encoder(stream);
+		Message::VisitFields(message, encoder);
+	}
+}
+
+#endif
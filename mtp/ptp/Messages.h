@@ -20,8 +20,7 @@
 #ifndef MESSAGES_H
 #define	MESSAGES_H
 
-#include <mtp/ptp/InputStream.h>
-#include <mtp/ptp/OutputStream.h>
+#include <mtp/ptp/MessageCodec.h>
 #include <mtp/ptp/ObjectFormat.h>
 #include <mtp/ptp/ObjectId.h>
 #include <mtp/ptp/ObjectProperty.h>
@@ -47,24 +46,19 @@ namespace mtp { namespace msg
 		std::string					DeviceVersion;
 		std::string					SerialNumber;
 
-		void Read(InputStream &stream)
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
 		{
-			stream >> StandardVersion;
-			stream >> VendorExtensionId;
-			stream >> VendorExtensionVersion;
-			stream >> VendorExtensionDesc;
-			stream >> FunctionalMode;
-			stream >> OperationsSupported;
-			stream >> EventsSupported;
-			stream >> DevicePropertiesSupported;
-			stream >> CaptureFormats;
-			stream >> ImageFormats;
-			stream >> Manufacturer;
-			stream >> Model;
-			stream >> DeviceVersion;
-			stream >> SerialNumber;
+			visitor.Fixed(self.StandardVersion, self.VendorExtensionId, self.VendorExtensionVersion);
+			visitor.Variable(self.VendorExtensionDesc);
+			visitor.Fixed(self.FunctionalMode);
+			visitor.Variable(self.OperationsSupported, self.EventsSupported, self.DevicePropertiesSupported, self.CaptureFormats, self.ImageFormats,
+				self.Manufacturer, self.Model, self.DeviceVersion, self.SerialNumber);
 		}
 
+		void Read(InputStream &stream)
+		{ DecodeMessage(stream, *this); }
+
 		bool Supports(OperationCode opcode) const
 		{
 			auto i = std::find(OperationsSupported.begin(), OperationsSupported.end(), opcode);
@@ -76,20 +70,24 @@ namespace mtp { namespace msg
 	{
 		std::vector<ObjectId> ObjectHandles;
 
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
+		{ visitor.Variable(self.ObjectHandles); }
+
 		void Read(InputStream &stream)
-		{
-			stream >> ObjectHandles;
-		}
+		{ DecodeMessage(stream, *this); }
 	};
 
 	struct StorageIDs //! MTP StorageIDs message
 	{
 		std::vector<StorageId> StorageIDs;
 
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
+		{ visitor.Variable(self.StorageIDs); }
+
 		void Read(InputStream &stream)
-		{
-			stream >> StorageIDs;
-		}
+		{ DecodeMessage(stream, *this); }
 	};
 
 	struct StorageInfo //! MTP StorageInfo message
@@ -106,17 +104,15 @@ namespace mtp { namespace msg
 		std::string GetName() const
 		{ return !StorageDescription.empty()? StorageDescription: VolumeLabel; }
 
-		void Read(InputStream &stream)
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
 		{
-			stream >> StorageType;
-			stream >> FilesystemType;
-			stream >> AccessCapability;
-			stream >> MaxCapacity;
-			stream >> FreeSpaceInBytes;
-			stream >> FreeSpaceInImages;
-			stream >> StorageDescription;
-			stream >> VolumeLabel;
+			visitor.Fixed(self.StorageType, self.FilesystemType, self.AccessCapability, self.MaxCapacity, self.FreeSpaceInBytes, self.FreeSpaceInImages);
+			visitor.Variable(self.StorageDescription, self.VolumeLabel);
 		}
+
+		void Read(InputStream &stream)
+		{ DecodeMessage(stream, *this); }
 	};
 
 	struct ObjectInfo //! MTP ObjectInfo message
@@ -141,63 +137,43 @@ namespace mtp { namespace msg
 		std::string			ModificationDate;
 		std::string			Keywords;
 
+		u64					ObjectSize; //not in dataset, full size if known, MaxObjectSize for objects of 4GiB and more read from dataset only
+
 		ObjectInfo(): StorageId(), ObjectFormat(), ProtectionStatus(), ObjectCompressedSize(),
 			ThumbFormat(), ThumbCompressedSize(), ThumbPixWidth(), ThumbPixHeight(),
 			ImagePixWidth(), ImagePixHeight(), ImageBitDepth(),
 			ParentObject(), AssociationType(), AssociationDesc(),
-			SequenceNumber()
+			SequenceNumber(), ObjectSize()
 		{ }
 
 		void SetSize(u64 size)
 		{
 			ObjectCompressedSize = (size > MaxObjectSize)? MaxObjectSize: size;
+			ObjectSize = size;
 		}
 
-		void Read(InputStream &stream)
+		///returns true if dataset size was clamped and full size has to be queried with ObjectSize property
+		bool IsSizeTruncated() const
+		{ return ObjectSize == MaxObjectSize; }
+
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
 		{
-			stream >> StorageId;
-			stream >> ObjectFormat;
-			stream >> ProtectionStatus;
-			stream >> ObjectCompressedSize;
-			stream >> ThumbFormat;
-			stream >> ThumbCompressedSize;
-			stream >> ThumbPixWidth;
-			stream >> ThumbPixHeight;
-			stream >> ImagePixWidth;
-			stream >> ImagePixHeight;
-			stream >> ImageBitDepth;
-			stream >> ParentObject;
-			stream >> AssociationType;
-			stream >> AssociationDesc;
-			stream >> SequenceNumber;
-			stream >> Filename;
-			stream >> CaptureDate;
-			stream >> ModificationDate;
-			stream >> Keywords;
+			visitor.Fixed(self.StorageId, self.ObjectFormat, self.ProtectionStatus, self.ObjectCompressedSize,
+				self.ThumbFormat, self.ThumbCompressedSize, self.ThumbPixWidth, self.ThumbPixHeight,
+				self.ImagePixWidth, self.ImagePixHeight, self.ImageBitDepth,
+				self.ParentObject, self.AssociationType, self.AssociationDesc, self.SequenceNumber);
+			visitor.Variable(self.Filename, self.CaptureDate, self.ModificationDate, self.Keywords);
 		}
-//fixme: make me template
-		void Write(OutputStream &stream) const
+
+		void Read(InputStream &stream)
 		{
-			stream << StorageId;
-			stream << ObjectFormat;
-			stream << ProtectionStatus;
-			stream << ObjectCompressedSize;
-			stream << ThumbFormat;
-			stream << ThumbCompressedSize;
-			stream << ThumbPixWidth;
-			stream << ThumbPixHeight;
-			stream << ImagePixWidth;
-			stream << ImagePixHeight;
-			stream << ImageBitDepth;
-			stream << ParentObject;
-			stream << AssociationType;
-			stream << AssociationDesc;
-			stream << SequenceNumber;
-			stream << Filename;
-			stream << CaptureDate;
-			stream << ModificationDate;
-			stream << Keywords;
+			DecodeMessage(stream, *this);
+			ObjectSize = ObjectCompressedSize;
 		}
+
+		void Write(OutputStream &stream) const
+		{ EncodeMessage(stream, *this); }
 	};
 	DECLARE_PTR(ObjectInfo);
 
@@ -205,9 +181,32 @@ namespace mtp { namespace msg
 	{
 		std::vector<ObjectProperty>		ObjectPropertyCodes;
 
+		template<typename Self, typename Visitor>
+		static void VisitFields(Self &self, Visitor &visitor)
+		{ visitor.Variable(self.ObjectPropertyCodes); }
+
+		void Read(InputStream &stream)
+		{ DecodeMessage(stream, *this); }
+	};
+
+	struct ObjectPropertyDesc //! MTP ObjectPropDesc dataset, only leading fixed fields are decoded
+	{
+		ObjectProperty		PropertyCode;
+		DataTypeCode		DataType;
+		u8					GetSet;
+		ByteArray			Data; //!< whole dataset, default value and form layout depend on DataType
+
+		ObjectPropertyDesc(): PropertyCode(), DataType(), GetSet() { }
+
+		bool IsWritable() const
+		{ return GetSet != 0; }
+
 		void Read(InputStream &stream)
 		{
-			stream >> ObjectPropertyCodes;
+			Data.assign(stream.GetData().begin() + stream.GetOffset(), stream.GetData().end());
+			stream >> PropertyCode;
+			stream >> DataType;
+			stream >> GetSet;
 		}
 	};
 
@@ -0,0 +1,175 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/ObjectCopier.h>
+#include <mtp/ptp/ObjectDeleter.h>
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/log.h>
+
+#include <stdio.h>
+
+namespace mtp
+{
+	namespace
+	{
+		class TemporaryFile : Noncopyable //! anonymous file holding object content between download and upload
+		{
+			FILE *	_file;
+
+		public:
+			TemporaryFile(): _file(tmpfile())
+			{
+				if (!_file)
+					throw system_error("tmpfile");
+			}
+
+			~TemporaryFile()
+			{ fclose(_file); }
+
+			FILE * GetFile() const
+			{ return _file; }
+		};
+
+		class TemporaryFileOutputStream final: public IObjectOutputStream, public CancellableStream
+		{
+			FILE *	_file;
+
+		public:
+			TemporaryFileOutputStream(FILE *file): _file(file)
+			{ }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				CheckCancelled();
+				if (fwrite(data, 1, size, _file) != size)
+					throw system_error("fwrite");
+				return size;
+			}
+		};
+
+		class TemporaryFileInputStream final: public IObjectInputStream, public CancellableStream
+		{
+			FILE *	_file;
+			u64		_size;
+
+		public:
+			TemporaryFileInputStream(FILE *file, u64 size): _file(file), _size(size)
+			{ rewind(_file); }
+
+			virtual u64 GetSize() const
+			{ return _size; }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{
+				CheckCancelled();
+				return fread(data, 1, size, _file);
+			}
+		};
+	}
+
+	ObjectCopier::ObjectCopier(const SessionPtr &session): _session(session)
+	{
+		const Capabilities &caps = _session->GetCapabilities();
+		_copyObjectSupported = caps.Supports(OperationCode::CopyObject);
+		_moveObjectSupported = caps.Supports(OperationCode::MoveObject);
+	}
+
+	void ObjectCopier::SetName(ObjectId objectId, const std::string &name)
+	{
+		if (!name.empty() && name != _session->GetObjectStringProperty(objectId, ObjectProperty::ObjectFilename))
+			_session->SetObjectProperty(objectId, ObjectProperty::ObjectFilename, name);
+	}
+
+	ObjectId ObjectCopier::CopyOnDevice(ObjectId objectId, StorageId storageId, ObjectId parent)
+	{
+		ObjectFormat format = static_cast<ObjectFormat>(_session->GetObjectIntegerProperty(objectId, ObjectProperty::ObjectFormat));
+		if (format != ObjectFormat::Association)
+			return _session->CopyObject(objectId, storageId, parent);
+
+		//not every device copies association content, recreate directories here
+		//children are listed before the copy is created, so the copy never shows up among them
+		std::string name = _session->GetObjectStringProperty(objectId, ObjectProperty::ObjectFilename);
+		auto children = _session->GetObjectHandles(Session::AllStorages, ObjectFormat::Any, objectId);
+		ObjectId copy = _session->CreateDirectory(name, parent, storageId).ObjectId;
+		for(auto child : children.ObjectHandles)
+			CopyOnDevice(child, storageId, copy);
+		return copy;
+	}
+
+	ObjectId ObjectCopier::CopyStreamed(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name)
+	{
+		msg::ObjectInfo oi = _session->GetObjectInfo(objectId);
+		if (!name.empty())
+			oi.Filename = name;
+
+		if (oi.ObjectFormat == ObjectFormat::Association)
+		{
+			auto children = _session->GetObjectHandles(Session::AllStorages, ObjectFormat::Any, objectId);
+			ObjectId copy = _session->CreateDirectory(oi.Filename, parent, storageId, oi.AssociationType).ObjectId;
+			for(auto child : children.ObjectHandles)
+				CopyStreamed(child, storageId, copy, std::string());
+			return copy;
+		}
+
+		debug("copying object ", objectId.Id, " through host");
+		TemporaryFile file;
+		_session->GetObject(objectId, std::make_shared<TemporaryFileOutputStream>(file.GetFile()));
+		fflush(file.GetFile());
+		u64 size = _session->GetObjectIntegerProperty(objectId, ObjectProperty::ObjectSize);
+		oi.SetSize(size);
+		auto noi = _session->SendObjectInfo(oi, storageId, parent);
+		_session->SendObject(std::make_shared<TemporaryFileInputStream>(file.GetFile(), size));
+		return noi.ObjectId;
+	}
+
+	void ObjectCopier::CheckTarget(ObjectId objectId, ObjectId parent)
+	{
+		for(unsigned depth = 0; depth < MaxDepth && parent != Session::Device && parent != Session::Root; ++depth)
+		{
+			if (parent == objectId)
+				throw std::runtime_error("cannot copy directory into itself or its subdirectory");
+			parent = _session->GetObjectParent(parent);
+		}
+	}
+
+	ObjectId ObjectCopier::Copy(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name)
+	{
+		CheckTarget(objectId, parent);
+		if (!_copyObjectSupported)
+			return CopyStreamed(objectId, storageId, parent, name);
+
+		ObjectId copy = CopyOnDevice(objectId, storageId, parent);
+		SetName(copy, name);
+		return copy;
+	}
+
+	ObjectId ObjectCopier::Move(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name)
+	{
+		if (_moveObjectSupported)
+		{
+			_session->MoveObject(objectId, storageId, parent);
+			SetName(objectId, name);
+			return objectId;
+		}
+
+		ObjectId copy = Copy(objectId, storageId, parent, name);
+		ObjectDeleter(_session).Delete(objectId);
+		return copy;
+	}
+}
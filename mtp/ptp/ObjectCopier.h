@@ -0,0 +1,59 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_OBJECTCOPIER_H
+#define AFT_PTP_OBJECTCOPIER_H
+
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/Session.h>
+
+#include <string>
+
+namespace mtp
+{
+	class ObjectCopier //! copies and moves objects on device with CopyObject/MoveObject, streams them through host if device lacks them
+	{
+		SessionPtr	_session;
+		bool		_copyObjectSupported;
+		bool		_moveObjectSupported;
+
+		ObjectId CopyStreamed(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name);
+		ObjectId CopyOnDevice(ObjectId objectId, StorageId storageId, ObjectId parent);
+		void SetName(ObjectId objectId, const std::string &name);
+		///throws if parent is object itself or one of its descendants
+		void CheckTarget(ObjectId objectId, ObjectId parent);
+
+	public:
+		static const unsigned MaxDepth = 256; ///< ancestors walked by target check, guards against parent loops of broken devices
+
+		ObjectCopier(const SessionPtr &session);
+
+		bool CopyObjectSupported() const
+		{ return _copyObjectSupported; }
+		bool MoveObjectSupported() const
+		{ return _moveObjectSupported; }
+
+		///copies object (recursively for directories) into parent, empty name keeps original one, returns id of the copy
+		ObjectId Copy(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name = std::string());
+		///moves object into parent, returns new object id, which differs from objectId only if object was copied through host
+		ObjectId Move(ObjectId objectId, StorageId storageId, ObjectId parent, const std::string &name = std::string());
+	};
+	DECLARE_PTR(ObjectCopier);
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/ObjectDeleter.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/log.h>
+
+namespace mtp
+{
+	ObjectDeleter::ObjectDeleter(const SessionPtr &session): _session(session), _recursiveDeleteSupported(true)
+	{ }
+
+	void ObjectDeleter::DeleteChildren(ObjectId objectId)
+	{
+		auto children = _session->GetObjectHandles(Session::AllStorages, ObjectFormat::Any, objectId);
+		for(auto child : children.ObjectHandles)
+			Delete(child);
+	}
+
+	void ObjectDeleter::Delete(ObjectId objectId)
+	{
+		if (!_recursiveDeleteSupported)
+		{
+			ObjectFormat format = static_cast<ObjectFormat>(_session->GetObjectIntegerProperty(objectId, ObjectProperty::ObjectFormat));
+			if (format == ObjectFormat::Association)
+				DeleteChildren(objectId);
+			_session->DeleteObject(objectId);
+			return;
+		}
+
+		try
+		{
+			_session->DeleteObject(objectId);
+		}
+		catch(const InvalidResponseException &ex)
+		{
+			if (ex.Type != ResponseType::PartialDeletion)
+				throw;
+
+			//device deleted what it could, remove remaining children one by one from now on
+			debug("device does not delete associations recursively");
+			_recursiveDeleteSupported = false;
+			DeleteChildren(objectId);
+			_session->DeleteObject(objectId);
+		}
+	}
+
+	void ObjectDeleter::Delete(const std::vector<ObjectId> &objects, size_t *deleted)
+	{
+		size_t index = 0;
+		if (deleted)
+			*deleted = 0;
+		//whole list goes in one batch until device turns out to delete associations partially
+		while(index < objects.size() && _recursiveDeleteSupported)
+		{
+			Session::Batch batch;
+			batch.SetStopOnError(true);
+			for(size_t i = index; i < objects.size(); ++i)
+				batch.DeleteObject(objects[i]);
+			_session->Execute(batch);
+
+			size_t executed = batch.GetExecuted();
+			const Session::Batch::Result &last = batch.GetResult(executed - 1);
+			index += executed;
+			if (last.IsOK())
+				break;
+
+			if (deleted)
+				*deleted = index - 1;
+			if (last.Response != ResponseType::PartialDeletion)
+				throw InvalidResponseException("DeleteObject", last.Response);
+
+			debug("device does not delete associations recursively");
+			_recursiveDeleteSupported = false;
+			DeleteChildren(objects[index - 1]);
+			_session->DeleteObject(objects[index - 1]);
+		}
+		if (deleted)
+			*deleted = index;
+
+		for(; index < objects.size(); ++index)
+		{
+			Delete(objects[index]);
+			if (deleted)
+				*deleted = index + 1;
+		}
+	}
+}
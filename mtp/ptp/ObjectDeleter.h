@@ -0,0 +1,51 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_OBJECTDELETER_H
+#define AFT_PTP_OBJECTDELETER_H
+
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/Session.h>
+
+#include <vector>
+
+namespace mtp
+{
+	class ObjectDeleter //! deletes objects with single DeleteObject per tree, deletes children first if device does not delete non-empty associations
+	{
+		SessionPtr	_session;
+		bool		_recursiveDeleteSupported;
+
+		void DeleteChildren(ObjectId objectId);
+
+	public:
+		ObjectDeleter(const SessionPtr &session);
+
+		bool RecursiveDeleteSupported() const
+		{ return _recursiveDeleteSupported; }
+
+		///deletes object, recursively for directories
+		void Delete(ObjectId objectId);
+		///deletes objects in order in back to back transactions, stops at first failure
+		///deleted receives number of objects removed before it, so caller can update its caches
+		void Delete(const std::vector<ObjectId> &objects, size_t *deleted = nullptr);
+	};
+	DECLARE_PTR(ObjectDeleter);
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/ObjectDownloader.h>
+#include <mtp/ptp/Messages.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace mtp
+{
+	namespace
+	{
+		class CountingObjectOutputStream final: public IObjectOutputStream //! forwards data to another stream counting bytes
+		{
+			IObjectOutputStreamPtr	_stream;
+			u64						_written;
+
+		public:
+			CountingObjectOutputStream(const IObjectOutputStreamPtr &stream): _stream(stream), _written(0)
+			{ }
+
+			u64 GetWritten() const
+			{ return _written; }
+
+			virtual void Cancel()
+			{ _stream->Cancel(); }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				size_t r = _stream->Write(data, size);
+				_written += r;
+				return r;
+			}
+		};
+	}
+
+	ObjectDownloader::ObjectDownloader(const SessionPtr &session, u32 chunkSize): _session(session), _chunkSize(chunkSize)
+	{
+		const Capabilities &caps = _session->GetCapabilities();
+		_getPartialObjectSupported = caps.Supports(OperationCode::GetPartialObject);
+		_getPartialObject64Supported = caps.Supports(OperationCode::GetPartialObject64);
+	}
+
+	bool ObjectDownloader::CanResume(u64 offset, u64 size) const
+	{
+		if (offset == 0 || offset >= size)
+			return false;
+		return _getPartialObject64Supported || (_getPartialObjectSupported && size <= std::numeric_limits<u32>::max());
+	}
+
+	void ObjectDownloader::Download(ObjectId objectId, const IObjectOutputStreamPtr &outputStream, u64 offset, u64 size)
+	{
+		if (offset == 0)
+		{
+			_session->GetObject(objectId, outputStream);
+			return;
+		}
+
+		debug("resuming object ", objectId.Id, " download at ", offset, " of ", size);
+		auto stream = std::make_shared<CountingObjectOutputStream>(outputStream);
+		while(offset < size)
+		{
+			u32 chunk = std::min<u64>(size - offset, _chunkSize);
+			u64 written = stream->GetWritten();
+			_session->GetPartialObject(objectId, offset, chunk, stream);
+			u64 received = stream->GetWritten() - written;
+			if (received == 0)
+				throw std::runtime_error("device returned no data for partial object request");
+			offset += received;
+		}
+	}
+}
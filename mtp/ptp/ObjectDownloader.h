@@ -0,0 +1,49 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_OBJECTDOWNLOADER_H
+#define AFT_PTP_OBJECTDOWNLOADER_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/Session.h>
+
+namespace mtp
+{
+	class ObjectDownloader //! downloads object from given offset, used to resume interrupted transfers with GetPartialObject(64) in large chunks
+	{
+		SessionPtr	_session;
+		bool		_getPartialObjectSupported;
+		bool		_getPartialObject64Supported;
+		u32			_chunkSize;
+
+	public:
+		static const u32 DefaultChunkSize = 64 * 1024 * 1024;
+
+		ObjectDownloader(const SessionPtr &session, u32 chunkSize = DefaultChunkSize);
+
+		///returns true if object of given size can be continued from offset
+		bool CanResume(u64 offset, u64 size) const;
+
+		///writes object data starting at offset into the stream, whole object is requested with GetObject if offset is zero
+		void Download(ObjectId objectId, const IObjectOutputStreamPtr &outputStream, u64 offset, u64 size);
+	};
+	DECLARE_PTR(ObjectDownloader);
+}
+
+#endif
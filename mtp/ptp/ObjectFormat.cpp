@@ -20,7 +20,9 @@
 #include <mtp/ptp/ObjectFormat.h>
 #include <algorithm>
 #include <ctype.h>
+#include <stdlib.h>
 #include <map>
+#include <mutex>
 
 #ifdef HAVE_LIBMAGIC
 #	include <magic.h>
@@ -37,13 +39,55 @@ namespace mtp
 			std::transform(ext.begin(), ext.end(), ext.begin(), tolower);
 			return ext;
 		}
+
+		struct ExtensionFormat
+		{
+			ObjectFormat	Format;
+			bool			Ambiguous; //container could hold different content, ask libmagic even in fast mode
+		};
+
+		class ExtensionMap
+		{
+			std::map<std::string, ExtensionFormat> _formats;
+
+		public:
+			ExtensionMap()
+			{
+#define MAP_EXT(name, format, ambiguous) _formats[name] = ExtensionFormat { (format), (ambiguous) }
+				MAP_EXT("mp3",	ObjectFormat::Mp3,	false);
+				MAP_EXT("txt",	ObjectFormat::Text,	false);
+				MAP_EXT("jpeg",	ObjectFormat::Jfif,	false);
+				MAP_EXT("jpg",	ObjectFormat::Jfif,	false);
+				MAP_EXT("gif",	ObjectFormat::Gif,	false);
+				MAP_EXT("bmp",	ObjectFormat::Bmp,	false);
+				MAP_EXT("png",	ObjectFormat::Png,	false);
+				MAP_EXT("wma",	ObjectFormat::Wma,	false);
+				MAP_EXT("ogg",	ObjectFormat::Ogg,	true);
+				MAP_EXT("flac",	ObjectFormat::Flac,	false);
+				MAP_EXT("aac",	ObjectFormat::Aac,	false);
+				MAP_EXT("wav",	ObjectFormat::Aiff,	false);
+				MAP_EXT("wmv",	ObjectFormat::Wmv,	false);
+				MAP_EXT("mp4",	ObjectFormat::Mp4,	true);
+				MAP_EXT("3gp",	ObjectFormat::_3gp,	true);
+				MAP_EXT("asf",	ObjectFormat::Asf,	true);
+				MAP_EXT("m3u",	ObjectFormat::M3u,	false); //libmagic missing mime type for m3u files
+#undef MAP_EXT
+			}
+
+			const ExtensionFormat * Find(const std::string &ext) const
+			{
+				auto it = _formats.find(ext);
+				return it != _formats.end()? &it->second: NULL;
+			}
+		};
 	}
 
 #ifdef HAVE_LIBMAGIC
 	namespace
 	{
-		class Magic
+		class Magic //! libmagic cookie is not thread safe, calls are serialised
 		{
+			std::mutex							_mutex;
 			magic_t								_magic;
 			std::map<std::string, ObjectFormat>	_types;
 
@@ -72,6 +116,7 @@ namespace mtp
 
 			ObjectFormat GetType(const std::string &path)
 			{
+				std::lock_guard<std::mutex> l(_mutex);
 				const char *type = _magic? magic_file(_magic, path.c_str()): NULL;
 				if (!type)
 					return ObjectFormat::Undefined;
@@ -95,12 +140,12 @@ namespace mtp
 	}
 #endif
 
-	ObjectFormat ObjectFormatFromFilename(const std::string &filename)
+	ObjectFormat ObjectFormatFromFilename(const std::string &filename, bool trustExtension)
 	{
-		//libmagic missing mime type for m3u files
-		auto ext = GetExtension(filename);
-		if (ext == "m3u")
-			return mtp::ObjectFormat::M3u;
+		static const ExtensionMap extensions;
+		auto byExtension = extensions.Find(GetExtension(filename));
+		if (byExtension && (byExtension->Format == ObjectFormat::M3u || (trustExtension && !byExtension->Ambiguous)))
+			return byExtension->Format;
 
 		static Magic magic;
 		{
@@ -109,38 +154,21 @@ namespace mtp
 				return magicType;
 		}
 
-		if (ext == "mp3")
-			return mtp::ObjectFormat::Mp3;
-		else if (ext == "txt")
-			return mtp::ObjectFormat::Text;
-		else if (ext == "jpeg" || ext == "jpg")
-			return mtp::ObjectFormat::Jfif;
-		else if (ext == "gif")
-			return mtp::ObjectFormat::Gif;
-		else if (ext == "bmp")
-			return mtp::ObjectFormat::Bmp;
-		else if (ext == "png")
-			return mtp::ObjectFormat::Png;
-		else if (ext == "wma")
-			return mtp::ObjectFormat::Wma;
-		else if (ext == "ogg")
-			return mtp::ObjectFormat::Ogg;
-		else if (ext == "flac")
-			return mtp::ObjectFormat::Flac;
-		else if (ext == "aac")
-			return mtp::ObjectFormat::Aac;
-		else if (ext == "wav")
-			return mtp::ObjectFormat::Aiff;
-		else if (ext == "wmv")
-			return mtp::ObjectFormat::Wmv;
-		else if (ext == "mp4")
-			return mtp::ObjectFormat::Mp4;
-		else if (ext == "3gp")
-			return mtp::ObjectFormat::_3gp;
-		else if (ext == "asf")
-			return mtp::ObjectFormat::Asf;
-		else
-			return ObjectFormat::Undefined;
+		return byExtension? byExtension->Format: ObjectFormat::Undefined;
+	}
+
+	ObjectFormat ParseObjectFormat(const std::string &str)
+	{
+		static const ExtensionMap extensions;
+		std::string extension(str);
+		std::transform(extension.begin(), extension.end(), extension.begin(), tolower);
+		auto byExtension = extensions.Find(extension);
+		if (byExtension)
+			return byExtension->Format; //extensions first, "aac" is also a hex number
+
+		char *end;
+		unsigned long code = strtoul(str.c_str(), &end, 16);
+		return !str.empty() && !*end && code <= 0xffff? static_cast<ObjectFormat>(code): ObjectFormat::Undefined;
 	}
 
 	time_t ConvertDateTime(const std::string &timespec)
@@ -110,7 +110,10 @@ namespace mtp
 
 	DECLARE_ENUM(AssociationType, u16);
 
-	ObjectFormat ObjectFormatFromFilename(const std::string &filename);
+	///trustExtension skips content scan for well-known unambiguous extensions, useful for bulk uploads; safe to call from multiple threads
+	ObjectFormat ObjectFormatFromFilename(const std::string &filename, bool trustExtension = false);
+	///parses hex format code or file extension, returns Undefined if it's not known
+	ObjectFormat ParseObjectFormat(const std::string &str);
 	time_t ConvertDateTime(const std::string &timespec);
 	std::string ConvertDateTime(time_t);
 
@@ -0,0 +1,111 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_MTP_PTP_OBJECTHANDLESOUTPUTSTREAM_H
+#define AFT_MTP_PTP_OBJECTHANDLESOUTPUTSTREAM_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ObjectId.h>
+
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace mtp
+{
+	class ObjectHandlesOutputStream final: public IObjectOutputStream, public CancellableStream //! decodes array of object handles while it's being received, passing handles to callback in chunks
+	{
+	public:
+		using Callback = std::function<void (const std::vector<ObjectId> &)>;
+
+	private:
+		Callback				_callback;
+		size_t					_chunkSize;
+		std::vector<ObjectId>	_chunk;
+		u8						_partial[4];
+		size_t					_partialSize;
+		bool					_hasCount;
+		u32						_remaining;
+
+		static u32 Load32(const u8 *src)
+		{ return src[0] | ((u32)src[1] << 8) | ((u32)src[2] << 16) | ((u32)src[3] << 24); }
+
+		void Push(u32 value)
+		{
+			if (!_hasCount)
+			{
+				_hasCount = true;
+				_remaining = value;
+				return;
+			}
+			if (_remaining == 0)
+				throw std::runtime_error("object handles array is longer than announced");
+			--_remaining;
+			_chunk.push_back(ObjectId(value));
+			if (_chunk.size() >= _chunkSize)
+				Flush();
+		}
+
+		void Flush()
+		{
+			if (_chunk.empty())
+				return;
+			_callback(_chunk);
+			_chunk.clear();
+		}
+
+	public:
+		///callback is invoked from session transaction, it must not use session itself
+		ObjectHandlesOutputStream(const Callback &callback, size_t chunkSize = 4096):
+			_callback(callback), _chunkSize(chunkSize), _partialSize(0), _hasCount(false), _remaining(0)
+		{ _chunk.reserve(chunkSize); }
+
+		virtual size_t Write(const u8 *data, size_t size)
+		{
+			CheckCancelled();
+			size_t r = size;
+			while(_partialSize != 0 && size != 0)
+			{
+				_partial[_partialSize++] = *data++;
+				--size;
+				if (_partialSize == sizeof(_partial))
+				{
+					_partialSize = 0;
+					Push(Load32(_partial));
+				}
+			}
+			for(; size >= 4; data += 4, size -= 4)
+				Push(Load32(data));
+			while(size--)
+				_partial[_partialSize++] = *data++;
+			return r;
+		}
+
+		///passes remaining handles to callback, throws if array was truncated
+		void Finish()
+		{
+			Flush();
+			if (!_hasCount || _remaining != 0 || _partialSize != 0)
+				throw std::runtime_error("object handles array is truncated");
+		}
+	};
+	DECLARE_PTR(ObjectHandlesOutputStream);
+}
+
+#endif
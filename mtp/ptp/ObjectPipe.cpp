@@ -0,0 +1,125 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/ObjectPipe.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace mtp
+{
+	namespace
+	{
+		class ObjectPipeOutputStream final: public IObjectOutputStream //! cancel of either side fails the whole pipe, so blocked peer wakes up
+		{
+			ObjectPipePtr	_pipe;
+
+		public:
+			ObjectPipeOutputStream(const ObjectPipePtr &pipe): _pipe(pipe)
+			{ }
+
+			virtual void Cancel()
+			{ _pipe->Fail(std::make_exception_ptr(OperationCancelledException())); }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{ return _pipe->Write(data, size); }
+		};
+
+		class ObjectPipeInputStream final: public IObjectInputStream
+		{
+			ObjectPipePtr	_pipe;
+			u64				_size;
+
+		public:
+			ObjectPipeInputStream(const ObjectPipePtr &pipe, u64 size): _pipe(pipe), _size(size)
+			{ }
+
+			virtual void Cancel()
+			{ _pipe->Fail(std::make_exception_ptr(OperationCancelledException())); }
+
+			virtual u64 GetSize() const
+			{ return _size; }
+
+			virtual size_t Read(u8 *data, size_t size)
+			{ return _pipe->Read(data, size); }
+		};
+	}
+
+	ObjectPipe::ObjectPipe(size_t capacity): _buffer(std::max<size_t>(capacity, 1)), _begin(0), _size(0), _closed(false)
+	{ }
+
+	size_t ObjectPipe::Write(const u8 *data, size_t size)
+	{
+		size_t written = 0;
+		std::unique_lock<std::mutex> l(_mutex);
+		while(written < size)
+		{
+			_writable.wait(l, [this]() { return _error || _size < _buffer.size(); });
+			if (_error)
+				std::rethrow_exception(_error);
+
+			size_t end = (_begin + _size) % _buffer.size();
+			size_t n = std::min(size - written, std::min(_buffer.size() - _size, _buffer.size() - end));
+			memcpy(_buffer.data() + end, data + written, n);
+			_size += n;
+			written += n;
+			_readable.notify_all();
+		}
+		return written;
+	}
+
+	size_t ObjectPipe::Read(u8 *data, size_t size)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_readable.wait(l, [this]() { return _error || _size != 0 || _closed; });
+		if (_error)
+			std::rethrow_exception(_error);
+		if (_size == 0)
+			return 0;
+
+		size_t n = std::min(size, std::min(_size, _buffer.size() - _begin));
+		memcpy(data, _buffer.data() + _begin, n);
+		_begin = (_begin + n) % _buffer.size();
+		_size -= n;
+		_writable.notify_all();
+		return n;
+	}
+
+	void ObjectPipe::Close()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_closed = true;
+		_readable.notify_all();
+	}
+
+	void ObjectPipe::Fail(std::exception_ptr error)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		if (!_error)
+			_error = error;
+		_readable.notify_all();
+		_writable.notify_all();
+	}
+
+	IObjectOutputStreamPtr ObjectPipe::GetOutputStream()
+	{ return std::make_shared<ObjectPipeOutputStream>(shared_from_this()); }
+
+	IObjectInputStreamPtr ObjectPipe::GetInputStream(u64 size)
+	{ return std::make_shared<ObjectPipeInputStream>(shared_from_this(), size); }
+}
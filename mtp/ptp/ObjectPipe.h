@@ -0,0 +1,66 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_OBJECTPIPE_H
+#define AFT_PTP_OBJECTPIPE_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ByteArray.h>
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+namespace mtp
+{
+	class ObjectPipe : Noncopyable, public std::enable_shared_from_this<ObjectPipe> //! bounded ring buffer passing object data from transfer of one device to transfer of another, each side runs in its own thread
+	{
+		std::mutex					_mutex;
+		std::condition_variable		_readable, _writable;
+		ByteArray					_buffer;
+		size_t						_begin; //first unread byte
+		size_t						_size; //unread bytes
+		bool						_closed; //writer finished, reader gets eof once buffer is drained
+		std::exception_ptr			_error; //fails both sides
+
+	public:
+		static const size_t DefaultCapacity = 8 * 1024 * 1024;
+
+		ObjectPipe(size_t capacity = DefaultCapacity);
+
+		///blocks until all data is buffered, throws error set by Fail
+		size_t Write(const u8 *data, size_t size);
+		///blocks until some data is available, returns 0 after Close and drained buffer
+		size_t Read(u8 *data, size_t size);
+
+		///marks end of data
+		void Close();
+		///wakes both sides, they throw given error, first error wins
+		void Fail(std::exception_ptr error);
+
+		///writing end for GetObject of source device
+		IObjectOutputStreamPtr GetOutputStream();
+		///reading end for SendObject of target device, size is announced in object info
+		IObjectInputStreamPtr GetInputStream(u64 size);
+	};
+	DECLARE_PTR(ObjectPipe);
+}
+
+#endif
@@ -24,13 +24,30 @@
 #include <mtp/ptp/ObjectProperty.h>
 #include <mtp/ByteArray.h>
 #include <mtp/ptp/InputStream.h>
+#include <mtp/ptp/IObjectStream.h>
 #include <functional>
+#include <stdexcept>
 
 namespace mtp
 {
 
+	struct ObjectPropertyValue //! value of any type from mixed property list, such as returned for ObjectProperty::All
+	{
+		DataTypeCode	Type;
+		u64				Integer;
+		std::string		String;
+
+		ObjectPropertyValue(): Type(DataTypeCode::Undefined), Integer(0) { }
+	};
+
 	namespace impl
 	{
+		inline u16 Load16(const u8 *data)
+		{ return data[0] | (static_cast<u16>(data[1]) << 8); }
+
+		inline u32 Load32(const u8 *data)
+		{ return Load16(data) | (static_cast<u32>(Load16(data + 2)) << 16); }
+
 		template<typename PropertyType>
 		struct ObjectPropertyParser
 		{
@@ -62,18 +79,74 @@ namespace mtp
 				if (dataType != DataTypeCode::String)
 					throw std::runtime_error("got invalid type");
 
-				std::string value;
-				stream >> value;
-				return value;
+				return stream.ReadString();
 			}
 
 		};
+
+		template<>
+		struct ObjectPropertyParser<ObjectPropertyValue>
+		{
+			static size_t GetSize(DataTypeCode dataType)
+			{
+				switch(dataType)
+				{
+				case DataTypeCode::Int8: case DataTypeCode::Uint8:		return 1;
+				case DataTypeCode::Int16: case DataTypeCode::Uint16:	return 2;
+				case DataTypeCode::Int32: case DataTypeCode::Uint32:	return 4;
+				case DataTypeCode::Int64: case DataTypeCode::Uint64:	return 8;
+				case DataTypeCode::Int128: case DataTypeCode::Uint128:	return 16;
+				default:
+					throw std::runtime_error("got invalid type");
+				}
+			}
+
+			static ObjectPropertyValue Parse(InputStream &stream, DataTypeCode dataType)
+			{
+				ObjectPropertyValue value;
+				value.Type = dataType;
+				if (dataType == DataTypeCode::String)
+					value.String = stream.ReadString();
+				else if (static_cast<u16>(dataType) & 0x4000) //arrays are skipped
+				{
+					u32 n = stream.Read32();
+					stream.Skip(n * GetSize(static_cast<DataTypeCode>(static_cast<u16>(dataType) & ~0x4000)));
+				}
+				else if (dataType == DataTypeCode::Int128 || dataType == DataTypeCode::Uint128)
+					stream.Skip(16);
+				else
+					value.Integer = ObjectPropertyParser<u64>::Parse(stream, dataType);
+				return value;
+			}
+		};
 	}
 
 	template<typename PropertyValueType, template <typename> class Parser = impl::ObjectPropertyParser>
 	struct ObjectPropertyListParser
 	{
-		void Parse(const ByteArray & data, const std::function<void (ObjectId, ObjectProperty property, const PropertyValueType &)> &func)
+		static const size_t ElementHeaderSize = 8; //object id, property, data type
+
+		///decodes single element, throws std::out_of_range if data is incomplete
+		static void ParseElement(InputStream &stream, ObjectId &objectId, ObjectProperty &property, PropertyValueType &value)
+		{
+			const ByteArray & data = stream.GetData();
+			size_t offset = stream.GetOffset();
+			if (offset + ElementHeaderSize > data.size())
+				throw std::out_of_range("short object property list element");
+
+			const u8 *header = data.data() + offset;
+			objectId = ObjectId(impl::Load32(header));
+			property = static_cast<ObjectProperty>(impl::Load16(header + 4));
+			DataTypeCode dataType = static_cast<DataTypeCode>(impl::Load16(header + 6));
+			stream.Skip(ElementHeaderSize);
+
+			value = Parser<PropertyValueType>::Parse(stream, dataType);
+			if (stream.GetOffset() > data.size()) //skipped past the end
+				throw std::out_of_range("short object property list element");
+		}
+
+		template<typename Callback>
+		void Parse(const ByteArray & data, Callback && func)
 		{
 			InputStream stream(data);
 			u32 n;
@@ -82,15 +155,74 @@ namespace mtp
 			{
 				ObjectId objectId;
 				ObjectProperty property;
-				DataTypeCode dataType;
+				PropertyValueType value;
+				ParseElement(stream, objectId, property, value);
+				func(objectId, property, value);
+			}
+		}
+	};
+
+	template<typename PropertyValueType, template <typename> class Parser = impl::ObjectPropertyParser>
+	class ObjectPropertyListStream final: public IObjectOutputStream, public CancellableStream //! incremental property list parser, invokes callback as data arrives
+	{
+	public:
+		typedef std::function<void (ObjectId, ObjectProperty property, const PropertyValueType &)> CallbackType;
 
-				stream >> objectId;
-				stream >> property;
-				stream >> dataType;
+	private:
+		CallbackType	_callback;
+		ByteArray		_buffer;
+		bool			_started;
+		u32				_remaining;
 
-				PropertyValueType value = Parser<PropertyValueType>::Parse(stream, dataType);
-				func(objectId, property, value);
+		///parses one complete element from _buffer at offset, returns false if more data is needed
+		bool ParseElement(size_t &offset)
+		{
+			InputStream stream(_buffer, offset);
+			ObjectId objectId;
+			ObjectProperty property;
+			PropertyValueType value;
+			try
+			{ ObjectPropertyListParser<PropertyValueType, Parser>::ParseElement(stream, objectId, property, value); }
+			catch(const std::out_of_range &)
+			{ return false; }
+
+			offset = stream.GetOffset();
+			--_remaining;
+			_callback(objectId, property, value);
+			return true;
+		}
+
+	public:
+		ObjectPropertyListStream(const CallbackType &callback): _callback(callback), _started(false), _remaining(0)
+		{ }
+
+		virtual size_t Write(const u8 *data, size_t size)
+		{
+			CheckCancelled();
+			_buffer.insert(_buffer.end(), data, data + size);
+
+			size_t offset = 0;
+			if (!_started)
+			{
+				if (_buffer.size() < 4)
+					return size;
+				InputStream stream(_buffer);
+				stream >> _remaining;
+				offset = stream.GetOffset();
+				_started = true;
 			}
+
+			while(_remaining && ParseElement(offset))
+				;
+			_buffer.erase(_buffer.begin(), _buffer.begin() + offset);
+			return size;
+		}
+
+		///checks that the whole list was received, throws otherwise
+		void Finish() const
+		{
+			if (!_started || _remaining)
+				throw std::runtime_error("truncated object property list");
 		}
 	};
 }
@@ -0,0 +1,188 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/ObjectStore.h>
+#include <string.h>
+
+namespace mtp
+{
+
+	size_t ObjectStore::HashName(const char *name)
+	{
+		u64 hash = 0xcbf29ce484222325ull; //fnv-1a
+		for(; *name; ++name)
+		{
+			hash ^= static_cast<u8>(*name);
+			hash *= 0x100000001b3ull;
+		}
+		return static_cast<size_t>(hash ^ (hash >> 32));
+	}
+
+	u32 ObjectStore::FindRecord(ObjectId id) const
+	{ return _byId.Find(Hash(id.Id), [this, id](u32 index) { return _records[index].Id == id; }); }
+
+	u32 ObjectStore::FindName(const std::string &name) const
+	{
+		const char *str = name.c_str();
+		return _interned.Find(HashName(str), [this, str](u32 offset) { return strcmp(_names.data() + offset, str) == 0; });
+	}
+
+	u32 ObjectStore::Intern(const std::string &name)
+	{
+		u32 offset = FindName(name);
+		if (offset != NotFound)
+			return offset;
+
+		offset = _names.size();
+		_names.insert(_names.end(), name.c_str(), name.c_str() + name.size() + 1);
+		_interned.Insert(HashName(name.c_str()), offset, [this](u32 value) { return HashName(_names.data() + value); });
+		return offset;
+	}
+
+	void ObjectStore::Link(u32 index)
+	{
+		Object &object = _records[index];
+		_byName.Insert(HashChild(object.Parent, object._name), index,
+			[this](u32 value) { return HashChild(_records[value].Parent, _records[value]._name); });
+
+		ObjectId parent = object.Parent;
+		u32 head = _heads.Find(Hash(parent.Id), [this, parent](u32 value) { return _records[value].Parent == parent; });
+		if (head == NotFound)
+		{
+			object._prev = object._next = index;
+			_heads.Insert(Hash(parent.Id), index, [this](u32 value) { return Hash(_records[value].Parent.Id); });
+			return;
+		}
+
+		Object &first = _records[head];
+		u32 tail = first._prev;
+		object._prev = tail;
+		object._next = head;
+		_records[tail]._next = index;
+		first._prev = index;
+	}
+
+	void ObjectStore::Unlink(u32 index)
+	{
+		Object &object = _records[index];
+		_byName.Erase(HashChild(object.Parent, object._name), index);
+
+		size_t parentHash = Hash(object.Parent.Id);
+		if (object._next == index)
+		{
+			_heads.Erase(parentHash, index); //last child
+			return;
+		}
+
+		_records[object._prev]._next = object._next;
+		_records[object._next]._prev = object._prev;
+		ObjectId parent = object.Parent;
+		u32 head = _heads.Find(parentHash, [this, parent](u32 value) { return _records[value].Parent == parent; });
+		if (head == index)
+		{
+			_heads.Erase(parentHash, index);
+			_heads.Insert(parentHash, object._next, [this](u32 value) { return Hash(_records[value].Parent.Id); });
+		}
+	}
+
+	ObjectStore::Object & ObjectStore::Insert(ObjectId id, ObjectId parent, const std::string &name)
+	{
+		u32 nameOffset = Intern(name);
+		u32 index = FindRecord(id);
+		if (index != NotFound)
+		{
+			Object &object = _records[index];
+			if (object.Parent != parent || object._name != nameOffset)
+			{
+				Unlink(index);
+				object.Parent = parent;
+				object._name = nameOffset;
+				Link(index);
+			}
+			return object;
+		}
+
+		if (_free != NotFound)
+		{
+			index = _free;
+			_free = _records[index]._next;
+		}
+		else
+		{
+			index = _records.size();
+			_records.emplace_back();
+		}
+
+		Object &object = _records[index];
+		object = Object();
+		object.Id = id;
+		object.Parent = parent;
+		object._name = nameOffset;
+		_byId.Insert(Hash(id.Id), index, [this](u32 value) { return Hash(_records[value].Id.Id); });
+		Link(index);
+		++_size;
+		return object;
+	}
+
+	bool ObjectStore::Remove(ObjectId id)
+	{
+		u32 index = FindRecord(id);
+		if (index == NotFound)
+			return false;
+
+		Unlink(index);
+		_byId.Erase(Hash(id.Id), index);
+		Object &object = _records[index];
+		object.Id = ObjectId();
+		object._next = _free;
+		_free = index;
+		--_size;
+		return true;
+	}
+
+	void ObjectStore::Clear()
+	{
+		_records.clear();
+		_names.clear();
+		_byId.Clear();
+		_byName.Clear();
+		_heads.Clear();
+		_interned.Clear();
+		_free = NotFound;
+		_size = 0;
+	}
+
+	const ObjectStore::Object * ObjectStore::FindChild(ObjectId parent, const std::string &name) const
+	{
+		u32 nameOffset = FindName(name);
+		if (nameOffset == NotFound)
+			return nullptr;
+
+		u32 index = _byName.Find(HashChild(parent, nameOffset),
+			[this, parent, nameOffset](u32 value) { return _records[value].Parent == parent && _records[value]._name == nameOffset; });
+		return index != NotFound? &_records[index]: nullptr;
+	}
+
+	size_t ObjectStore::GetMemoryUsage() const
+	{
+		return _records.capacity() * sizeof(Object) + _names.capacity() +
+			_byId.GetMemoryUsage() + _byName.GetMemoryUsage() + _heads.GetMemoryUsage() + _interned.GetMemoryUsage();
+	}
+
+}
@@ -0,0 +1,231 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_OBJECTSTORE_H
+#define AFT_PTP_OBJECTSTORE_H
+
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ObjectId.h>
+
+#include <string>
+#include <vector>
+#include <time.h>
+
+namespace mtp
+{
+	class ObjectStore : Noncopyable //! flat table of object metadata with open addressing indices by id and by parent and name, names are interned; references and names are valid until next insertion
+	{
+	public:
+		struct Object
+		{
+			ObjectId		Id;
+			ObjectId		Parent;
+			mtp::StorageId	StorageId;
+			ObjectFormat	Format;
+			u64				Size;
+			time_t			ModificationTime;
+			time_t			CreationTime;
+
+			Object(): Format(ObjectFormat::Undefined), Size(0), ModificationTime(0), CreationTime(0), _name(0), _prev(0), _next(0)
+			{ }
+
+		private:
+			friend class ObjectStore;
+			u32				_name; //offset in name pool
+			u32				_prev, _next; //record indices of siblings, circular list
+		};
+
+	private:
+		static const u32 NotFound = 0xffffffffu;
+
+		class Index //! open addressing hash set of record indices (or other u32 values), linear probing
+		{
+			static const u32 Empty = NotFound;
+			static const u32 Deleted = 0xfffffffeu;
+
+			std::vector<u32>	_slots; //power of two
+			size_t				_used, _deleted;
+
+			template<typename HashOf>
+			void Rehash(HashOf hashOf)
+			{
+				size_t size = 16;
+				while(size < (_used + 1) * 2)
+					size <<= 1;
+				std::vector<u32> slots(size, Empty);
+				size_t mask = size - 1;
+				for(u32 value : _slots)
+				{
+					if (value == Empty || value == Deleted)
+						continue;
+					size_t i = hashOf(value) & mask;
+					while(slots[i] != Empty)
+						i = (i + 1) & mask;
+					slots[i] = value;
+				}
+				_slots.swap(slots);
+				_deleted = 0;
+			}
+
+		public:
+			Index(): _used(0), _deleted(0)
+			{ }
+
+			template<typename Equal>
+			u32 Find(size_t hash, Equal equal) const
+			{
+				if (_slots.empty())
+					return NotFound;
+				size_t mask = _slots.size() - 1;
+				for(size_t i = hash & mask; ; i = (i + 1) & mask)
+				{
+					u32 value = _slots[i];
+					if (value == Empty)
+						return NotFound;
+					if (value != Deleted && equal(value))
+						return value;
+				}
+			}
+
+			///value must not be present yet, hashOf(value) is used when table grows
+			template<typename HashOf>
+			void Insert(size_t hash, u32 value, HashOf hashOf)
+			{
+				if ((_used + _deleted + 1) * 4 > _slots.size() * 3)
+					Rehash(hashOf);
+				size_t mask = _slots.size() - 1;
+				size_t i = hash & mask;
+				while(_slots[i] != Empty && _slots[i] != Deleted)
+					i = (i + 1) & mask;
+				if (_slots[i] == Deleted)
+					--_deleted;
+				_slots[i] = value;
+				++_used;
+			}
+
+			void Erase(size_t hash, u32 value)
+			{
+				if (_slots.empty())
+					return;
+				size_t mask = _slots.size() - 1;
+				for(size_t i = hash & mask; _slots[i] != Empty; i = (i + 1) & mask)
+				{
+					if (_slots[i] == value)
+					{
+						_slots[i] = Deleted;
+						--_used;
+						++_deleted;
+						return;
+					}
+				}
+			}
+
+			void Clear()
+			{
+				_slots.clear();
+				_used = _deleted = 0;
+			}
+
+			size_t GetMemoryUsage() const
+			{ return _slots.capacity() * sizeof(u32); }
+		};
+
+		std::vector<Object>	_records;
+		std::vector<char>	_names; //zero terminated, never shrinks until Clear
+		Index				_byId;
+		Index				_byName; //parent and interned name
+		Index				_heads; //first child of each parent
+		Index				_interned; //name pool offsets
+		u32					_free; //first free record, linked through _next
+		size_t				_size;
+
+		static size_t Hash(u32 value)
+		{
+			u64 x = value;
+			x ^= x >> 16;
+			x *= 0x45d9f3bull;
+			x ^= x >> 16;
+			x *= 0x45d9f3bull;
+			x ^= x >> 16;
+			return static_cast<size_t>(x);
+		}
+		static size_t HashName(const char *name);
+		static size_t HashChild(ObjectId parent, u32 name)
+		{ return Hash(parent.Id) ^ (Hash(name) * 31); }
+
+		u32 FindRecord(ObjectId id) const;
+		u32 FindName(const std::string &name) const;
+		u32 Intern(const std::string &name);
+		void Link(u32 index);
+		void Unlink(u32 index);
+
+	public:
+		ObjectStore(): _free(NotFound), _size(0)
+		{ }
+
+		///adds object or updates its parent and name, other fields are left untouched for existing objects
+		Object & Insert(ObjectId id, ObjectId parent, const std::string &name);
+		///returns false if there was no such object, children are kept
+		bool Remove(ObjectId id);
+		void Clear();
+
+		Object * Find(ObjectId id)
+		{
+			u32 index = FindRecord(id);
+			return index != NotFound? &_records[index]: nullptr;
+		}
+		const Object * Find(ObjectId id) const
+		{
+			u32 index = FindRecord(id);
+			return index != NotFound? &_records[index]: nullptr;
+		}
+
+		///returns first child with given name, nullptr if there is none
+		const Object * FindChild(ObjectId parent, const std::string &name) const;
+
+		const char * GetName(const Object &object) const
+		{ return _names.data() + object._name; }
+
+		///calls func(const Object &) for every child in insertion order, store must not be modified meanwhile
+		template<typename Func>
+		void ForEachChild(ObjectId parent, Func func) const
+		{
+			u32 head = _heads.Find(Hash(parent.Id), [this, parent](u32 index) { return _records[index].Parent == parent; });
+			if (head == NotFound)
+				return;
+			u32 index = head;
+			do
+			{
+				const Object &object = _records[index];
+				index = object._next;
+				func(object);
+			}
+			while(index != head);
+		}
+
+		size_t GetSize() const
+		{ return _size; }
+
+		///bytes held by records, names and indices
+		size_t GetMemoryUsage() const;
+	};
+	DECLARE_PTR(ObjectStore);
+}
+
+#endif
@@ -0,0 +1,301 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/ObjectTree.h>
+#include <mtp/ptp/ObjectPropertyListParser.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <vector>
+
+namespace mtp
+{
+	namespace
+	{
+		const u32 UnlimitedDepth = 0xffffffffu;
+	}
+
+	ObjectTree::ObjectTree(const SessionPtr &session): _session(session)
+	{ }
+
+	bool ObjectTree::Accepts(ObjectFormat format) const
+	{ return _formats.empty() || format == ObjectFormat::Association || std::find(_formats.begin(), _formats.end(), format) != _formats.end(); }
+
+	void ObjectTree::Add(const Entry &entry)
+	{
+		if (!Accepts(entry.Format))
+			return; //device ignored format filter
+		Object &object = _objects.Insert(entry.Id, entry.Parent, entry.Filename);
+		object.StorageId = entry.StorageId;
+		object.Format = entry.Format;
+		object.Size = entry.Size;
+		object.CreationTime = entry.CreationTime;
+		object.ModificationTime = entry.ModificationTime;
+	}
+
+	class ObjectTree::PropertyCollector //! gathers objects from ObjectProperty::All list
+	{
+		Entries &			_entries;
+		std::set<ObjectId>	_named, _parented;
+
+	public:
+		PropertyCollector(Entries &entries): _entries(entries)
+		{ }
+
+		void operator()(ObjectId objectId, ObjectProperty property, const ObjectPropertyValue &value)
+		{
+			Entry &object = _entries[objectId];
+			object.Id = objectId;
+			switch(property)
+			{
+			case ObjectProperty::StorageId:
+				object.StorageId = mtp::StorageId(value.Integer);
+				break;
+			case ObjectProperty::ObjectFormat:
+				object.Format = static_cast<ObjectFormat>(value.Integer);
+				break;
+			case ObjectProperty::ObjectSize:
+				object.Size = value.Integer;
+				break;
+			case ObjectProperty::ObjectFilename:
+				object.Filename = value.String;
+				_named.insert(objectId);
+				break;
+			case ObjectProperty::DateCreated:
+				object.CreationTime = ConvertDateTime(value.String);
+				break;
+			case ObjectProperty::DateModified:
+				object.ModificationTime = ConvertDateTime(value.String);
+				break;
+			case ObjectProperty::ParentObject:
+				object.Parent = value.Integer != Session::Device.Id? ObjectId(value.Integer): Session::Root;
+				_parented.insert(objectId);
+				break;
+			default:
+				break;
+			}
+		}
+
+		bool Finish(StorageId storageId, ObjectId parent)
+		{
+			bool valid = _named.size() == _entries.size() && (parent != Session::Device || _parented.size() == _entries.size());
+			for(auto i = _entries.begin(); i != _entries.end(); )
+			{
+				Entry &object = i->second;
+				if (parent != Session::Device)
+					object.Parent = parent;
+				if (storageId != Session::AllStorages && object.StorageId != storageId)
+					i = _entries.erase(i);
+				else
+					++i;
+			}
+			return valid;
+		}
+	};
+
+	bool ObjectTree::ParsePropertyList(const ByteArray &data, StorageId storageId, ObjectId parent, Entries &entries)
+	{
+		PropertyCollector collector(entries);
+		ObjectPropertyListParser<ObjectPropertyValue> parser;
+		parser.Parse(data, std::ref(collector));
+		return collector.Finish(storageId, parent);
+	}
+
+	bool ObjectTree::EnumerateByPropertyList(StorageId storageId, ObjectId root)
+	{
+		Entries objects;
+		try
+		{
+			//whole-storage lists may be huge, parse them while they arrive instead of buffering
+			PropertyCollector collector(objects);
+			auto stream = std::make_shared<ObjectPropertyListStream<ObjectPropertyValue>>(std::ref(collector));
+			if (_formats.empty())
+				_session->GetObjectPropertyList(root, ObjectFormat::Any, ObjectProperty::All, 0, UnlimitedDepth, stream);
+			else
+			{
+				//directories are needed to connect filtered objects to root
+				_session->GetObjectPropertyList(root, ObjectFormat::Association, ObjectProperty::All, 0, UnlimitedDepth, stream);
+				for(auto format : _formats)
+				{
+					stream->Finish();
+					stream = std::make_shared<ObjectPropertyListStream<ObjectPropertyValue>>(std::ref(collector));
+					_session->GetObjectPropertyList(root, format, ObjectProperty::All, 0, UnlimitedDepth, stream);
+				}
+			}
+			stream->Finish();
+			if (!collector.Finish(storageId, Session::Device))
+			{
+				debug("incomplete recursive property list");
+				_session->SetQuirk(Capabilities::Quirk::PropertyListDepthUnsupported);
+				return false;
+			}
+		}
+		catch(const std::exception &ex)
+		{
+			debug("recursive GetObjectPropList failed: ", ex.what());
+			_session->SetQuirk(Capabilities::Quirk::PropertyListDepthUnsupported);
+			return false;
+		}
+
+		//keep objects reachable from root only, some devices return unrelated objects
+		std::map<ObjectId, std::vector<ObjectId>> children;
+		for(auto &i : objects)
+			children[i.second.Parent].push_back(i.first);
+
+		//top-level objects are collected with Root parent, whichever handle device reported for it
+		ObjectId requested = root == Session::Device? Session::Root: root;
+		std::deque<ObjectId> queue(1, requested);
+		bool nested = false, directories = false;
+		while(!queue.empty())
+		{
+			ObjectId parent = queue.front();
+			queue.pop_front();
+			auto i = children.find(parent);
+			if (i == children.end())
+				continue;
+
+			nested |= parent != requested;
+			for(auto id : i->second)
+			{
+				const Entry &object = objects[id];
+				Add(object);
+				if (object.Format == ObjectFormat::Association)
+				{
+					directories = true;
+					queue.push_back(id);
+				}
+			}
+		}
+
+		if (directories && !nested)
+		{
+			//device ignored depth and returned first level only
+			debug("recursive GetObjectPropList returned single level");
+			_session->SetQuirk(Capabilities::Quirk::PropertyListDepthUnsupported);
+			_objects.Clear();
+			return false;
+		}
+		return true;
+	}
+
+	void ObjectTree::EnumerateByLevels(StorageId storageId, ObjectId root, bool recursive)
+	{
+		const Capabilities &caps = _session->GetCapabilities();
+		bool propList = _session->GetObjectPropertyListSupported() && !caps.Has(Capabilities::Quirk::PropertyListAllUnsupported);
+		std::deque<ObjectId> queue(1, root);
+		while(!queue.empty())
+		{
+			ObjectId parent = queue.front();
+			queue.pop_front();
+
+			Entries objects;
+			bool complete = false;
+			if (propList)
+			{
+				try
+				{
+					ByteArray data = _session->GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::All, 0, 1);
+					complete = ParsePropertyList(data, storageId, parent, objects);
+				}
+				catch(const std::exception &ex)
+				{
+					debug("GetObjectPropList failed: ", ex.what());
+					_session->SetQuirk(Capabilities::Quirk::PropertyListAllUnsupported);
+					propList = false;
+				}
+			}
+
+			if (!complete)
+			{
+				objects.clear();
+				auto handles = GetHandles(storageId, parent);
+				auto infos = _session->GetObjectInfos(handles, parent);
+				for(size_t i = 0; i < handles.size(); ++i)
+				{
+					const msg::ObjectInfo &info = infos[i];
+					if (info.Filename.empty())
+						continue;
+
+					ObjectId id = handles[i];
+					Entry &object = objects[id];
+					object.Id = id;
+					object.Parent = parent;
+					object.StorageId = info.StorageId;
+					object.Format = info.ObjectFormat;
+					object.Size = info.ObjectSize;
+					object.Filename = info.Filename;
+					object.CreationTime = ConvertDateTime(info.CaptureDate);
+					object.ModificationTime = ConvertDateTime(info.ModificationDate);
+				}
+			}
+
+			for(auto &i : objects)
+			{
+				Add(i.second);
+				if (recursive && i.second.Format == ObjectFormat::Association)
+					queue.push_back(i.first);
+			}
+		}
+	}
+
+	std::vector<ObjectId> ObjectTree::GetHandles(StorageId storageId, ObjectId parent)
+	{
+		//handles are appended as they arrive, whole response is never buffered
+		std::vector<ObjectId> handles;
+		auto append = [&handles](const std::vector<ObjectId> &chunk)
+		{ handles.insert(handles.end(), chunk.begin(), chunk.end()); };
+
+		if (_formats.empty())
+		{
+			_session->GetObjectHandles(storageId, ObjectFormat::Any, parent, append);
+			return handles;
+		}
+
+		//only matching objects are queried one by one
+		_session->GetObjectHandles(storageId, ObjectFormat::Association, parent, append);
+		for(auto format : _formats)
+			_session->GetObjectHandles(storageId, format, parent, append);
+		return handles;
+	}
+
+	void ObjectTree::Enumerate(StorageId storageId, ObjectId root, const Formats &formats)
+	{
+		_objects.Clear();
+		_formats = formats;
+		const Capabilities &caps = _session->GetCapabilities();
+		bool recursive = _session->GetObjectPropertyListSupported() &&
+			!caps.Has(Capabilities::Quirk::PropertyListDepthUnsupported) && !caps.Has(Capabilities::Quirk::PropertyListAllUnsupported);
+		if (recursive && EnumerateByPropertyList(storageId, root))
+		{
+			debug("enumerated ", _objects.GetSize(), " objects with single recursive property list");
+			return;
+		}
+		EnumerateByLevels(storageId, root, true);
+		debug("enumerated ", _objects.GetSize(), " objects level by level");
+	}
+
+	void ObjectTree::EnumerateChildren(StorageId storageId, ObjectId parent, const Formats &formats)
+	{
+		_objects.Clear();
+		_formats = formats;
+		EnumerateByLevels(storageId, parent, false);
+	}
+}
@@ -0,0 +1,98 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_OBJECTTREE_H
+#define AFT_PTP_OBJECTTREE_H
+
+#include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/ObjectStore.h>
+#include <mtp/ptp/Session.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mtp
+{
+	class ObjectTree //! object tree below given directory kept in flat ObjectStore, fetched with as few transactions as device allows
+	{
+	public:
+		typedef ObjectStore::Object Object;
+		typedef std::vector<ObjectFormat> Formats;
+
+	private:
+		struct Entry //! object assembled from property list or object info
+		{
+			ObjectId		Id;
+			ObjectId		Parent;
+			mtp::StorageId	StorageId;
+			ObjectFormat	Format;
+			u64				Size;
+			std::string		Filename;
+			time_t			CreationTime;
+			time_t			ModificationTime;
+
+			Entry(): Format(ObjectFormat::Undefined), Size(0), CreationTime(0), ModificationTime(0) { }
+		};
+		typedef std::map<ObjectId, Entry> Entries;
+
+		SessionPtr						_session;
+		ObjectStore						_objects;
+		Formats							_formats; //directories and objects of these formats are kept, empty keeps everything
+
+		class PropertyCollector;
+
+		///parent is Device for recursive lists, ParentObject property is used then, returns false if list is incomplete
+		bool ParsePropertyList(const ByteArray &data, StorageId storageId, ObjectId parent, Entries &entries);
+		bool EnumerateByPropertyList(StorageId storageId, ObjectId root);
+		void EnumerateByLevels(StorageId storageId, ObjectId root, bool recursive);
+		void Add(const Entry &entry);
+		bool Accepts(ObjectFormat format) const;
+		std::vector<ObjectId> GetHandles(StorageId storageId, ObjectId parent);
+
+	public:
+		ObjectTree(const SessionPtr &session);
+
+		///fetches all objects below root in given storage, replacing previous content
+		///formats keep directories and objects of those formats only, device is asked for them only where protocol allows it
+		void Enumerate(StorageId storageId = Session::AllStorages, ObjectId root = Session::Root, const Formats &formats = Formats());
+
+		///fetches direct children of parent only, with single property list if device supports it
+		void EnumerateChildren(StorageId storageId = Session::AllStorages, ObjectId parent = Session::Root, const Formats &formats = Formats());
+
+		///returns null if object was not enumerated
+		const Object * Find(ObjectId id) const
+		{ return _objects.Find(id); }
+
+		const char * GetName(const Object &object) const
+		{ return _objects.GetName(object); }
+
+		///calls func(const Object &) for children of parent in enumeration order
+		template<typename Func>
+		void ForEachChild(ObjectId parent, Func func) const
+		{ _objects.ForEachChild(parent, func); }
+
+		size_t GetSize() const
+		{ return _objects.GetSize(); }
+	};
+	DECLARE_PTR(ObjectTree);
+}
+
+#endif
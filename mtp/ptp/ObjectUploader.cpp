@@ -0,0 +1,82 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/ptp/ObjectUploader.h>
+#include <mtp/ptp/ByteArrayObjectStream.h>
+#include <mtp/log.h>
+
+#include <algorithm>
+
+namespace mtp
+{
+	ObjectUploader::ObjectUploader(const SessionPtr &session, u32 chunkSize): _session(session), _chunkSize(chunkSize)
+	{ }
+
+	bool ObjectUploader::CanCheckpoint() const
+	{ return _session->EditObjectSupported(); }
+
+	bool ObjectUploader::CanResume(ObjectId objectId, u64 committed, u64 size) const
+	{
+		if (!CanCheckpoint() || committed >= size)
+			return false;
+
+		try
+		{ return _session->GetObjectIntegerProperty(objectId, ObjectProperty::ObjectSize) == committed; }
+		catch(const std::exception &ex)
+		{
+			debug("object ", objectId.Id, " could not be resumed: ", ex.what());
+			return false;
+		}
+	}
+
+	Session::NewObjectInfo ObjectUploader::Create(const msg::ObjectInfo &objectInfo, StorageId storageId, ObjectId parentObject)
+	{
+		auto noi = _session->CreateObject(objectInfo, 0, storageId, parentObject);
+		_session->SendObject(std::make_shared<ByteArrayObjectInputStream>(ByteArray()));
+		return noi;
+	}
+
+	void ObjectUploader::Upload(ObjectId objectId, const IObjectInputStreamPtr &inputStream, u64 offset, u64 size, const CommitCallback &commit)
+	{
+		if (offset)
+			debug("resuming object ", objectId.Id, " upload at ", offset, " of ", size);
+
+		ByteArray data;
+		while(offset < size)
+		{
+			data.resize(std::min<u64>(size - offset, _chunkSize));
+			size_t filled = 0;
+			while(filled < data.size())
+			{
+				size_t r = inputStream->Read(data.data() + filled, data.size() - filled);
+				if (r == 0)
+					throw std::runtime_error("unexpected end of stream while uploading object");
+				filled += r;
+			}
+
+			{
+				//edit is ended after each chunk, so device could commit it
+				Session::ObjectEditSession edit(_session, objectId);
+				edit.Send(offset, data);
+			}
+			offset += data.size();
+			if (commit)
+				commit(offset);
+		}
+	}
+}
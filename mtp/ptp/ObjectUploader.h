@@ -0,0 +1,57 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_OBJECTUPLOADER_H
+#define AFT_PTP_OBJECTUPLOADER_H
+
+#include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ObjectId.h>
+#include <mtp/ptp/Session.h>
+
+#include <functional>
+
+namespace mtp
+{
+	class ObjectUploader //! sends object in chunks with android edit object extension, every chunk is committed so interrupted upload could be continued from last committed offset
+	{
+		SessionPtr	_session;
+		u32			_chunkSize;
+
+	public:
+		static const u32 DefaultChunkSize = 16 * 1024 * 1024;
+
+		typedef std::function<void (u64)> CommitCallback;
+
+		ObjectUploader(const SessionPtr &session, u32 chunkSize = DefaultChunkSize);
+
+		///returns true if device can edit objects, so upload progress could be checkpointed
+		bool CanCheckpoint() const;
+
+		///returns true if object still holds exactly committed bytes and upload of given size could be continued from it
+		bool CanResume(ObjectId objectId, u64 committed, u64 size) const;
+
+		///creates empty object which is filled in by Upload
+		Session::NewObjectInfo Create(const msg::ObjectInfo &objectInfo, StorageId storageId, ObjectId parentObject);
+
+		///sends the rest of stream positioned at offset, commit is called with new offset after each chunk is committed
+		void Upload(ObjectId objectId, const IObjectInputStreamPtr &inputStream, u64 offset, u64 size, const CommitCallback &commit = CommitCallback());
+	};
+	DECLARE_PTR(ObjectUploader);
+}
+
+#endif
@@ -25,13 +25,17 @@
 #include <mtp/ptp/OutputStream.h>
 #include <mtp/ptp/OperationCode.h>
 
+#include <array>
+
 namespace mtp
 {
 	struct RequestBase //! base class for Operation and Data requests
 	{
 		ByteArray					Data; //!< resulting data
+		OperationCode				Code;
+		u32							Transaction;
 
-		RequestBase(OperationCode opcode, u32 transaction)
+		RequestBase(OperationCode opcode, u32 transaction): Code(opcode), Transaction(transaction)
 		{
 			OutputStream stream(Data);
 			stream << opcode;
@@ -45,53 +49,70 @@ namespace mtp
 		}
 	};
 
-	struct OperationRequest : RequestBase //! Operation (Command) class, constructs operation request data in \ref Data
+	struct OperationRequest //! Operation (Command) container, encoded in place into fixed buffer, so sending a request does not allocate
 	{
 		static const ContainerType	Type = ContainerType::Command;
+		static const size_t			HeaderSize = 12; //!< length, type, code and transaction
+		static const size_t			MaxParameters = 5;
+		static const size_t			MaxSize = HeaderSize + 4 * MaxParameters;
 
-		OperationRequest(OperationCode opcode, u32 transaction):
-			RequestBase(opcode, transaction)
-		{ }
-		OperationRequest(OperationCode opcode, u32 transaction, u32 par1):
-			RequestBase(opcode, transaction)
+		OperationCode				Code;
+		u32							Transaction;
+
+	private:
+		std::array<u8, MaxSize>		_data;
+		size_t						_size;
+
+		void Write16(size_t offset, u16 value)
 		{
-			OutputStream stream(Data);
-			stream << par1;
+			_data[offset] = static_cast<u8>(value);
+			_data[offset + 1] = static_cast<u8>(value >> 8);
 		}
-		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2):
-			RequestBase(opcode, transaction)
+
+		void Write32(size_t offset, u32 value)
 		{
-			OutputStream stream(Data);
-			stream << par1;
-			stream << par2;
+			Write16(offset, static_cast<u16>(value));
+			Write16(offset + 2, static_cast<u16>(value >> 16));
 		}
-		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2, u32 par3):
-			RequestBase(opcode, transaction)
+
+	public:
+		///appends parameter to those passed to constructor, MaxParameters in total
+		void Append(u32 param)
 		{
-			OutputStream stream(Data);
-			stream << par1;
-			stream << par2;
-			stream << par3;
+			Write32(_size, param);
+			_size += 4;
+			Write32(0, _size);
 		}
-		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2, u32 par3, u32 par4):
-			RequestBase(opcode, transaction)
+
+		OperationRequest(OperationCode opcode, u32 transaction):
+			Code(opcode), Transaction(transaction), _size(HeaderSize)
 		{
-			OutputStream stream(Data);
-			stream << par1;
-			stream << par2;
-			stream << par3;
-			stream << par4;
+			Write32(0, HeaderSize);
+			Write16(4, static_cast<u16>(Type));
+			Write16(6, static_cast<u16>(opcode));
+			Write32(8, transaction);
 		}
+		OperationRequest(OperationCode opcode, u32 transaction, u32 par1):
+			OperationRequest(opcode, transaction)
+		{ Append(par1); }
+		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2):
+			OperationRequest(opcode, transaction, par1)
+		{ Append(par2); }
+		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2, u32 par3):
+			OperationRequest(opcode, transaction, par1, par2)
+		{ Append(par3); }
+		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2, u32 par3, u32 par4):
+			OperationRequest(opcode, transaction, par1, par2, par3)
+		{ Append(par4); }
 		OperationRequest(OperationCode opcode, u32 transaction, u32 par1, u32 par2, u32 par3, u32 par4, u32 par5):
-			RequestBase(opcode, transaction)
-		{
-			OutputStream stream(Data);
-			stream << par1;
-			stream << par2;
-			stream << par3;
-			stream << par4;
-			stream << par5;
-		}
+			OperationRequest(opcode, transaction, par1, par2, par3, par4)
+		{ Append(par5); }
+
+		///whole container including its header
+		const u8 * GetData() const
+		{ return _data.data(); }
+		size_t GetSize() const
+		{ return _size; }
 	};
 
 	struct DataRequest : RequestBase //! MTP Data request
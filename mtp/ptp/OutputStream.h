@@ -22,17 +22,40 @@
 
 #include <mtp/types.h>
 #include <mtp/ByteArray.h>
+#include <mtp/ptp/Utf16.h>
+#include <cstring>
+#include <stdexcept>
 
 namespace mtp
 {
+	namespace impl
+	{
+		template<typename ValueType>
+		inline void StoreLittleEndian(u8 *dst, ValueType value)
+		{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			std::memcpy(dst, &value, sizeof(value));
+#else
+			for(size_t i = 0; i < sizeof(value); ++i, value >>= 8)
+				dst[i] = static_cast<u8>(value);
+#endif
+		}
+	}
 
 	class OutputStream //! MTP format encoding output stream
 	{
 		ByteArray	& _data;
 
+		u8 * Grow(size_t size)
+		{
+			size_t offset = _data.size();
+			_data.resize(offset + size);
+			return _data.data() + offset;
+		}
+
 	public:
 		OutputStream(ByteArray &data): _data(data)
-		{ _data.reserve(512); }
+		{ }
 
 		ByteArray & GetData()
 		{ return _data; }
@@ -40,17 +63,21 @@ namespace mtp
 		const ByteArray & GetData() const
 		{ return _data; }
 
+		///makes room for size more bytes
+		void Reserve(size_t size)
+		{ _data.reserve(_data.size() + size); }
+
 		void Write8(u8 value)
 		{ _data.push_back(value); }
 
 		void Write16(u16 value)
-		{ Write8(value); Write8(value >> 8); }
+		{ impl::StoreLittleEndian(Grow(sizeof(value)), value); }
 
 		void Write32(u32 value)
-		{ Write16(value); Write16(value >> 16); }
+		{ impl::StoreLittleEndian(Grow(sizeof(value)), value); }
 
-		void Write64(u32 value)
-		{ Write32(value); Write32(value >> 16); }
+		void Write64(u64 value)
+		{ impl::StoreLittleEndian(Grow(sizeof(value)), value); }
 
 		static size_t Utf8Length(const std::string &value)
 		{
@@ -63,6 +90,27 @@ namespace mtp
 			return size;
 		}
 
+		///encoded size of fixed size field
+		template<typename ValueType>
+		static size_t GetSize(const ValueType &)
+		{ return sizeof(ValueType); }
+
+		///exact encoded size of string: length byte, UTF-16 code units and null terminator
+		static size_t GetSize(const std::string &value)
+		{ return value.empty()? 1: 1 + 2 * (Utf16Length(value) + 1); }
+
+		template<typename ElementType>
+		static size_t GetSize(const std::vector<ElementType> &array)
+		{ return 4 + array.size() * sizeof(ElementType); }
+
+		static size_t GetSize(const std::vector<std::string> &array)
+		{
+			size_t size = 4;
+			for(const auto &el : array)
+				size += GetSize(el);
+			return size;
+		}
+
 		void WriteString(const std::string &value)
 		{
 			if (value.empty())
@@ -70,44 +118,19 @@ namespace mtp
 				Write8(0);
 				return;
 			}
-			size_t len = 1 + Utf8Length(value);
+			size_t len = Utf16Length(value) + 1;
 			if (len > 255)
 				throw std::runtime_error("string is too big (only 255 chars allowed, including null terminator)");
+			Reserve(1 + 2 * len);
 			Write8(len);
-			for(size_t i = 0, p = 0; i < len && p < value.size(); ++i)
-			{
-				u8 c0 = value[p++];
-				u16 uni;
-				if (c0 == 0xc0 || c0 == 0xc1 || c0 >= 0xf5)
-				{
-					uni = '?';
-				}
-				else if (c0 < 0x80)
-				{
-					uni = c0;
-				}
-				else
-				{
-					u8 c1 = value[p++];
-					if (c0 >= 0xc2 && c0 <= 0xdf)
-						uni = ((c0 & 0x1f) << 6) | (c1 & 0x3f);
-					else
-					{
-						u8 c2 = value[p++];
-						if (c0 >= 0xe0 && c0 <= 0xef)
-							uni = ((c0 & 0x0f) << 12) | ((c1 & 0x3f) << 6) | (c2 & 0x3f);
-						else
-							uni = '?';
-					}
-				}
-				Write16(uni);
-			}
+			EncodeUtf16(_data, value);
 			Write16(0);
 		}
 
 		template<typename ElementType>
 		void WriteArray(const std::vector<ElementType> &array)
 		{
+			Reserve(GetSize(array));
 			Write32(array.size());
 			for(const auto &el : array)
 				(*this) << el;
@@ -21,222 +21,350 @@
 #include <mtp/ptp/Response.h>
 #include <mtp/ptp/InputStream.h>
 #include <mtp/ptp/ByteArrayObjectStream.h>
-#include <mtp/ptp/JoinedObjectStream.h>
 #include <mtp/ptp/OutputStream.h>
 #include <mtp/ptp/OperationRequest.h>
 #include <mtp/usb/Request.h>
+#include <mtp/usb/TimeoutException.h>
 #include <usb/Device.h>
 #include <mtp/log.h>
+#include <array>
+#include <chrono>
 
 
 namespace mtp
 {
 
-	void PipePacketer::Write(const IObjectInputStreamPtr &inputStream, int timeout)
-	{ _pipe->Write(inputStream, timeout); }
-
-	void PipePacketer::Write(const ByteArray &data, int timeout)
-	{ Write(std::make_shared<ByteArrayObjectInputStream>(data), timeout); }
-
 	namespace
 	{
-		class MessageParsingStream final: public JoinedObjectOutputStreamBase
+		class DrainStream final: public IObjectOutputStream, public CancellableStream //! drops data left from cancelled transaction
 		{
-			FixedSizeByteArrayObjectOutputStreamPtr	_header;
-			IObjectOutputStreamPtr					_stream;
-			u64										_offset;
-			u64										_size;
-
-		private:
-			IObjectOutputStreamPtr GetStream1() const
-			{ return _header; }
-
-			IObjectOutputStreamPtr GetStream2() const
-			{ return _stream; }
-
 		public:
-			MessageParsingStream(IObjectOutputStreamPtr stream): _header(new FixedSizeByteArrayObjectOutputStream(4)), _stream(stream), _offset(0), _size(4) { }
-
-			void OnStream1Exhausted() override
-			{
-				_stream1Exhausted = true;
-				InputStream is(_header->GetData());
-				u32 size;
-				is >> size;
-				if (size < 4)
-					throw std::runtime_error("invalid size/malformed message");
-				_size = size;
-			}
-
 			size_t Write(const u8 *data, size_t size) override
 			{
-				size_t r = JoinedObjectOutputStreamBase::Write(data, size);
-				_offset += r;
-				if (_offset == _header->GetData().size())
-					OnStream1Exhausted();
-				return r;
+				CheckCancelled();
+				return size;
 			}
 		};
-		DECLARE_PTR(MessageParsingStream);
 	}
 
-	void PipePacketer::ReadMessage(const IObjectOutputStreamPtr &outputStream, int timeout)
+	void PipePacketer::Write(const IObjectInputStreamPtr &inputStream, int timeout)
 	{
-		MessageParsingStreamPtr output(new MessageParsingStream(outputStream));
-		_pipe->Read(output, timeout);
+		u64 size = inputStream->GetSize();
+		try
+		{ _pipe->Write(inputStream, timeout); }
+		catch(const usb::TimeoutException &)
+		{
+			++_counters.Timeouts;
+			throw;
+		}
+		catch(const OperationCancelledException &)
+		{
+			Resync();
+			throw;
+		}
+		_counters.BytesOut += size;
 	}
 
-	void PipePacketer::PollEvent()
+	class PipePacketer::BufferStream final: public IObjectInputStream //! reads caller's buffer without copying it, reused for every write
 	{
-		ByteArray interruptData = _pipe->ReadInterrupt();
-		if (interruptData.empty())
-			return;
+		std::atomic_bool	_cancelled;
+		const u8 *			_data;
+		size_t				_size;
+		size_t				_offset;
 
-		HexDump("interrupt", interruptData);
-		InputStream stream(interruptData);
-		ContainerType containerType;
-		u32 size;
-		u16 eventCode;
-		u32 sessionId;
-		u32 transactionId;
-		stream >> size;
-		stream >> containerType;
-		stream >> eventCode;
-		stream >> sessionId;
-		stream >> transactionId;
-		if (containerType != ContainerType::Event)
-			throw std::runtime_error("not an event");
-		debug("event ", hex(eventCode, 8));
-	}
+	public:
+		BufferStream(): _cancelled(false), _data(), _size(0), _offset(0)
+		{ }
 
-	namespace
+		void Reset(const u8 *data, size_t size)
+		{
+			_cancelled.store(false);
+			_data	= data;
+			_size	= size;
+			_offset	= 0;
+		}
+
+		void Cancel() override
+		{ _cancelled.store(true); }
+
+		u64 GetSize() const override
+		{ return _size; }
+
+		size_t Read(u8 *data, size_t size) override
+		{
+			if (_cancelled.load())
+				throw OperationCancelledException();
+			size_t n = std::min(size, _size - _offset);
+			std::copy(_data + _offset, _data + _offset + n, data);
+			_offset += n;
+			return n;
+		}
+	};
+
+	void PipePacketer::Write(const u8 *data, size_t size, int timeout)
 	{
-		struct DummyOutputStream final: IObjectOutputStream, public CancellableStream
+		_bufferStream->Reset(data, size);
+		try
+		{ Write(_bufferStream, timeout); }
+		catch(...)
 		{
-			virtual size_t Write(const u8 *data, size_t size)
-			{ return size; }
-		};
+			_bufferStream->Reset(nullptr, 0);
+			throw;
+		}
+		_bufferStream->Reset(nullptr, 0);
+	}
 
-		class HeaderParserObjectOutputStream final: public JoinedObjectOutputStreamBase
+	void PipePacketer::Write(const ByteArray &data, int timeout)
+	{ Write(data.data(), data.size(), timeout); }
+
+	void PipePacketer::Write(const OperationRequest &request, int timeout)
+	{ Write(request.GetData(), request.GetSize(), timeout); }
+
+	class PipePacketer::MessageParser final: public IObjectOutputStream //! parses container header in place and passes payload straight to the data sink, reused for every message
+	{
+		static const size_t			HeaderSize = 4 + Response::Size;
+		static const size_t			MaxReservedPayload = 16 * 1024 * 1024;
+
+		std::atomic_bool			_cancelled;
+		u32							_transaction;
+		u64							_received;
+		IObjectOutputStream *		_dataOutput;
+		ByteArray *					_data;
+		ByteArray *					_response;
+
+		std::array<u8, HeaderSize>	_header;
+		size_t						_headerOffset;
+		bool						_valid;
+		bool						_finished;
+		ContainerType				_containerType;
+		ResponseType				_responseCode;
+
+	private:
+		static u16 Read16(const u8 *data)
+		{ return data[0] | (static_cast<u16>(data[1]) << 8); }
+
+		static u32 Read32(const u8 *data)
+		{ return Read16(data) | (static_cast<u32>(Read16(data + 2)) << 16); }
+
+		void ParseHeader(const u8 *header)
 		{
-			size_t									_offset;
-			u32										_transaction;
-			FixedSizeByteArrayObjectOutputStreamPtr	_header;
-			ByteArrayObjectOutputStreamPtr			_response;
-			IObjectOutputStreamPtr					_dataOutput;
-			IObjectOutputStreamPtr					_output;
-			bool									_valid;
-			bool									_finished;
-			ResponseType							_responseCode;
-
-		private:
-			virtual IObjectOutputStreamPtr GetStream1() const
-			{ return _header; }
-			virtual IObjectOutputStreamPtr GetStream2() const
-			{ if (!_output) throw std::runtime_error("no data stream"); return _output; }
-
-			virtual void OnStream1Exhausted()
+			u32 size = Read32(header);
+			if (size < HeaderSize)
+				throw std::runtime_error("invalid size/malformed message");
+
+			_containerType = static_cast<ContainerType>(Read16(header + 4));
+			u16 code = Read16(header + 6);
+			u32 transaction = Read32(header + 8);
+			if (_transaction && _transaction != transaction)
 			{
-				_stream1Exhausted = true;
-				InputStream stream(_header->GetData());
-				Response header;
-				header.Read(stream);
-				if (_transaction && _transaction != header.Transaction)
-				{
-					error("drop message ", hex(header.ContainerType, 4), ", response: ", hex(header.ResponseType, 4), ", transaction: ", hex(header.Transaction, 8), ", transaction: ", hex(_transaction, 8));
-					_valid = false;
-					_output = std::make_shared<DummyOutputStream>();
-					return;
-				}
+				error("drop message ", hex(_containerType, 4), ", response: ", hex(code, 4), ", transaction: ", hex(transaction, 8), ", transaction: ", hex(_transaction, 8));
+				_valid = false;
+				return;
+			}
 
-				switch(header.ContainerType)
+			switch(_containerType)
+			{
+			case ContainerType::Data:
+				if (size != MaxObjectSize) //bogus lengths do not allocate more than MaxReservedPayload
 				{
-				case ContainerType::Data:
-					_output			= _dataOutput;
-					break;
-				case ContainerType::Response:
-					_output			= _response;
-					_responseCode	= header.ResponseType;
-					_finished		= true;
-					break;
-				default:
-					_valid			= false;
-					_output			= std::make_shared<DummyOutputStream>();
+					size_t payload = std::min<size_t>(size - HeaderSize, MaxReservedPayload);
+					if (_dataOutput)
+						_dataOutput->Reserve(payload);
+					else if (_data)
+						_data->reserve(_data->size() + payload);
 				}
+				break;
+			case ContainerType::Response:
+				_responseCode	= static_cast<ResponseType>(code);
+				_finished		= true;
+				break;
+			default:
+				_valid			= false;
 			}
+		}
 
-		public:
-			HeaderParserObjectOutputStream(u32 transaction, IObjectOutputStreamPtr dataOutput):
-				_offset(0), _transaction(transaction),
-				_header(new FixedSizeByteArrayObjectOutputStream(Response::Size)),
-				_response(new ByteArrayObjectOutputStream),
-				_dataOutput(dataOutput),
-				_valid(true), _finished(false) { }
+	public:
+		MessageParser(): _cancelled(false), _transaction(), _received(0), _dataOutput(), _data(), _response(), _headerOffset(0), _valid(true), _finished(false)
+		{ }
+
+		///data payload goes to dataOutput stream if set or appended to data buffer otherwise
+		void Reset(u32 transaction, IObjectOutputStream *dataOutput, ByteArray *data, ByteArray *response)
+		{
+			_cancelled.store(false);
+			_transaction	= transaction;
+			_dataOutput		= dataOutput;
+			_data			= data;
+			_response		= response;
+			_headerOffset	= 0;
+			_valid			= true;
+			_finished		= false;
+		}
+
+		ResponseType GetResponseCode() const
+		{ return _responseCode; }
 
-			ResponseType GetResponseCode() const
-			{ return _responseCode; }
+		///bytes received since last call
+		u64 TakeReceived()
+		{
+			u64 received = _received;
+			_received = 0;
+			return received;
+		}
 
-			const ByteArray &GetResponse() const
-			{ return _response->GetData(); }
+		bool Valid() const
+		{ return _valid; }
+		bool Finished() const
+		{ return _finished; }
 
-			bool Valid() const
-			{ return _valid; }
-			bool Finished() const
-			{ return _finished; }
+		void Cancel() override
+		{ _cancelled.store(true); }
+
+		size_t Write(const u8 *data, size_t size) override
+		{
+			if (_cancelled.load())
+				throw OperationCancelledException();
 
-			virtual size_t Write(const u8 *data, size_t size)
+			_received += size;
+			size_t offset = 0;
+			if (_headerOffset < HeaderSize)
 			{
-				size_t r = JoinedObjectOutputStreamBase::Write(data, size);
-				_offset += r;
-				if (_offset == _header->GetData().size())
-					OnStream1Exhausted();
-				return r;
+				if (_headerOffset == 0 && size >= HeaderSize)
+				{
+					ParseHeader(data);
+					offset = HeaderSize;
+				}
+				else
+				{
+					offset = std::min(size, HeaderSize - _headerOffset);
+					std::copy(data, data + offset, _header.data() + _headerOffset);
+					if (_headerOffset + offset == HeaderSize)
+						ParseHeader(_header.data());
+				}
+				_headerOffset += offset;
 			}
-		};
-		DECLARE_PTR(HeaderParserObjectOutputStream);
-	}
+
+			if (offset == size || !_valid)
+				return size;
+
+			if (_containerType == ContainerType::Response)
+			{
+				if (_response)
+					_response->insert(_response->end(), data + offset, data + size);
+				return size;
+			}
+
+			if (_dataOutput)
+				return offset + _dataOutput->Write(data + offset, size - offset);
+			if (!_data)
+				throw std::runtime_error("no data stream");
+			_data->insert(_data->end(), data + offset, data + size);
+			return size;
+		}
+	};
+
+	PipePacketer::PipePacketer(const usb::BulkPipePtr &pipe): _pipe(pipe), _parser(std::make_shared<MessageParser>()), _bufferStream(std::make_shared<BufferStream>())
+	{ }
 
 	void PipePacketer::Read(u32 transaction, const IObjectOutputStreamPtr &object, ResponseType &code, ByteArray &response, int timeout)
+	{ Read(transaction, object.get(), nullptr, code, response, timeout); }
+
+	void PipePacketer::Read(u32 transaction, ByteArray &data, ResponseType &code, ByteArray &response, int timeout)
 	{
-		try
-		{ PollEvent(); }
-		catch(const std::exception &ex)
-		{ error("exception in interrupt: ", ex.what()); }
+		data.clear();
+		Read(transaction, nullptr, &data, code, response, timeout);
+	}
 
+	void PipePacketer::Read(u32 transaction, IObjectOutputStream *object, ByteArray *data, ResponseType &code, ByteArray &response, int timeout)
+	{
 		response.clear();
 
 		while(true)
 		{
-			HeaderParserObjectOutputStreamPtr parser(new HeaderParserObjectOutputStream(transaction, object));
-			ReadMessage(parser, timeout);
-			if (parser->Finished())
+			_parser->Reset(transaction, object, data, &response);
+			try
+			{ _pipe->Read(_parser, timeout); }
+			catch(const usb::TimeoutException &)
+			{
+				_counters.BytesIn += _parser->TakeReceived();
+				++_counters.Timeouts;
+				throw;
+			}
+			catch(const OperationCancelledException &)
 			{
-				response = parser->GetResponse();
-				code = parser->GetResponseCode();
+				_counters.BytesIn += _parser->TakeReceived();
+				Resync();
+				throw;
+			}
+			catch(...)
+			{
+				_counters.BytesIn += _parser->TakeReceived();
+				throw;
+			}
+			_counters.BytesIn += _parser->TakeReceived();
+			if (_parser->Finished())
+			{
+				code = _parser->GetResponseCode();
 				break;
 			}
 		}
+		_parser->Reset(0, nullptr, nullptr, nullptr);
 
 		//HexDump("response", response);
 	}
 
-	void PipePacketer::Read(u32 transaction, ByteArray &data, ResponseType &code, ByteArray &response, int timeout)
-	{
-		ByteArrayObjectOutputStreamPtr stream(new ByteArrayObjectOutputStream);
-		Read(transaction, stream, code, response, timeout);
-		data = stream->GetData();
-	}
-
 	void PipePacketer::Abort(u32 transaction, int timeout)
 	{
 		_pipe->Cancel();
 		OperationRequest req(OperationCode::CancelTransaction, transaction);
-		HexDump("abort control message", req.Data);
+		//control request carries code and transaction only, without container length and type
+		ByteArray data(req.GetData() + 6, req.GetData() + OperationRequest::HeaderSize);
+		HexDump("abort control message", data);
+		usb::DevicePtr device = _pipe->GetDevice();
+		if (!device)
+			return;
 		/* 0x21: host-to-device, class specific, recipient - interface, 0x64: cancel request */
-		_pipe->GetDevice()->WriteControl(
+		device->WriteControl(
 			(u8)(usb::RequestType::HostToDevice | usb::RequestType::Class | usb::RequestType::Interface),
 			0x64,
-			0, 0, req.Data, timeout);
+			0, 0, data, timeout);
+	}
+
+	void PipePacketer::Resync()
+	{
+		usb::DevicePtr device = _pipe->GetDevice();
+		if (!device)
+			return;
+
+		//device reports busy until it has processed cancel request, anything it sends meanwhile belongs to cancelled transaction
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ResyncTimeout);
+		auto drain = std::make_shared<DrainStream>();
+		try
+		{
+			while(true)
+			{
+				ByteArray status(StatusSize);
+				/* 0xa1: device-to-host, class specific, recipient - interface, 0x67: get device status */
+				device->ReadControl(
+					(u8)(usb::RequestType::DeviceToHost | usb::RequestType::Class | usb::RequestType::Interface),
+					0x67,
+					0, 0, status, ResyncTimeout);
+				ResponseType code = status.size() >= 4? static_cast<ResponseType>(status[2] | (status[3] << 8)): ResponseType::OK;
+				if (code != ResponseType::DeviceBusy)
+					break;
+				if (std::chrono::steady_clock::now() >= deadline)
+				{
+					error("device is still busy after cancellation");
+					break;
+				}
+
+				try
+				{ _pipe->Read(drain, DrainTimeout); }
+				catch(const usb::TimeoutException &)
+				{ }
+			}
+		}
+		catch(const std::exception &ex)
+		{ error("resyncing pipe after cancellation failed: ", ex.what()); }
 	}
 
 
@@ -28,28 +28,62 @@ namespace mtp
 {
 	class Device;
 	DECLARE_PTR(Device);
+	struct OperationRequest;
 
 	class PipePacketer //! BulkPipe high-level controller class, package all read/write operation into streams and send it to BulkPipe
 	{
+		class MessageParser;
+		DECLARE_PTR(MessageParser);
+		class BufferStream;
+		DECLARE_PTR(BufferStream);
+
+	public:
+		struct Counters //! raw bus traffic counters, including container headers
+		{
+			u64		BytesIn;
+			u64		BytesOut;
+			u64		Timeouts;
+
+			Counters(): BytesIn(), BytesOut(), Timeouts() { }
+		};
+
+		static const int	ResyncTimeout	= 2000;
+		static const int	DrainTimeout	= 100;
+		static const size_t	StatusSize		= 64;
+
+	private:
 		usb::BulkPipePtr	_pipe;
+		MessageParserPtr	_parser;
+		BufferStreamPtr		_bufferStream;
+		Counters			_counters;
 
 	public:
-		PipePacketer(const usb::BulkPipePtr &pipe): _pipe(pipe) { }
+		PipePacketer(const usb::BulkPipePtr &pipe);
 
 		usb::BulkPipePtr GetPipe() const
 		{ return _pipe; }
 
 		void Write(const IObjectInputStreamPtr &inputStream, int timeout);
+		///sends data straight from caller's buffer
 		void Write(const ByteArray &data, int timeout);
+		void Write(const u8 *data, size_t size, int timeout);
+		///sends command container straight from request buffer
+		void Write(const OperationRequest &request, int timeout);
 
 		void Read(u32 transaction, const IObjectOutputStreamPtr &outputStream, ResponseType &code, ByteArray &response, int timeout);
 		void Read(u32 transaction, ByteArray &data, ResponseType &code, ByteArray &response, int timeout);
 
-		void PollEvent();
+		///cancels transfers in progress and sends cancel request, thread running the transaction resyncs the pipe
 		void Abort(u32 transaction, int timeout);
 
+		///monotonic counters, callers compute deltas around a transaction, not synchronised, used under session lock
+		const Counters & GetCounters() const
+		{ return _counters; }
+
 	private:
-		void ReadMessage(const IObjectOutputStreamPtr &outputStream, int timeout);
+		void Read(u32 transaction, IObjectOutputStream *outputStream, ByteArray *data, ResponseType &code, ByteArray &response, int timeout);
+		///waits until device is no longer busy with cancelled transaction, draining its data
+		void Resync();
 	};
 
 }
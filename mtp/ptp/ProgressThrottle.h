@@ -0,0 +1,68 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_PROGRESSTHROTTLE_H
+#define AFT_PTP_PROGRESSTHROTTLE_H
+
+#include <mtp/types.h>
+#include <chrono>
+
+namespace mtp
+{
+	class ProgressThrottle //! decides whether progress update is worth reporting: at most once per interval and per 1/steps of total, always reports start and completion
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		Clock::duration		_interval;
+		u64					_steps;
+		u64					_step;
+		Clock::time_point	_lastReport;
+		bool				_reported;
+
+	public:
+		static const unsigned DefaultIntervalMs = 100;
+		static const unsigned DefaultSteps = 1000;
+
+		ProgressThrottle(unsigned intervalMs = DefaultIntervalMs, unsigned steps = DefaultSteps):
+			_interval(std::chrono::milliseconds(intervalMs)), _steps(steps? steps: 1), _step(0), _reported(false)
+		{ }
+
+		///forgets previous reports, next update is reported unconditionally
+		void Reset()
+		{ _reported = false; }
+
+		///returns true if current position should be reported, unknown (zero) total reports by time only
+		bool Update(u64 current, u64 total)
+		{
+			u64 step = total? (current >= total? _steps: current * _steps / total): 0;
+			auto now = Clock::now();
+			bool report = !_reported || (total && current >= total && _step != _steps) ||
+				((step != _step || !total) && now - _lastReport >= _interval);
+			if (report)
+			{
+				_reported = true;
+				_step = step;
+				_lastReport = now;
+			}
+			return report;
+		}
+	};
+}
+
+#endif
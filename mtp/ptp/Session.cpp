@@ -23,10 +23,13 @@
 #include <mtp/ptp/OperationRequest.h>
 #include <mtp/ptp/ByteArrayObjectStream.h>
 #include <mtp/ptp/JoinedObjectStream.h>
+#include <mtp/ptp/ObjectPropertyListParser.h>
 #include <mtp/log.h>
 #include <usb/Device.h>
 #include <limits>
 #include <array>
+#include <map>
+#include <set>
 
 namespace mtp
 {
@@ -44,33 +47,79 @@ namespace mtp
 
 	Session::Session(usb::BulkPipePtr pipe, u32 sessionId):
 		_packeter(pipe), _sessionId(sessionId), _nextTransactionId(1), _transaction(),
-		_getObjectModificationTimeBuggy(false),
-		_defaultTimeout(DefaultTimeout)
+		_coalesceDataPhase(false),
+		_defaultTimeout(DefaultTimeout),
+		_usbDevice(pipe->GetDevice())
 	{
 		_deviceInfo = GetDeviceInfoImpl();
-		_getPartialObject64Supported = _deviceInfo.Supports(OperationCode::GetPartialObject64);
-		_getObjectPropertyListSupported = _deviceInfo.Supports(OperationCode::GetObjectPropList);
-		_editObjectSupported = _deviceInfo.Supports(OperationCode::BeginEditObject) &&
-			_deviceInfo.Supports(OperationCode::EndEditObject) &&
-			_deviceInfo.Supports(OperationCode::TruncateObject) &&
-			_deviceInfo.Supports(OperationCode::SendPartialObject);
+		_capabilities.Load(_deviceInfo);
 	}
 
 	Session::~Session()
-	{ try { Close(); } catch(const std::exception &ex) { } }
+	{
+		_eventListener.reset();
+		try { Close(); } catch(const std::exception &ex) { }
+	}
 
 	class Session::Transaction
 	{
-		Session *	_session;
+		typedef std::chrono::steady_clock clock;
+
+		Session *					_session;
+		OperationCode				_code;
+		bool						_measured;
+		clock::time_point			_started; //always taken, feeds timeout estimation
+		PipePacketer::Counters		_counters;
+
 	public:
 		u32			Id;
+		bool		Aborted;
 
-		Transaction(Session *session): _session(session)
+		Transaction(Session *session, OperationCode code): _session(session), _code(code), _measured(session->_stats.IsEnabled()),
+			_started(clock::now()), _counters(session->_packeter.GetCounters()), Aborted(false)
 		{ session->SetCurrentTransaction(this); }
+
+		OperationCode GetCode() const
+		{ return _code; }
+		bool IsMeasured() const
+		{ return _measured; }
+		clock::time_point GetStarted() const
+		{ return _started; }
+
 		~Transaction()
-		{ _session->SetCurrentTransaction(0); }
+		{
+			_session->SetCurrentTransaction(0);
+
+			auto latency = clock::now() - _started;
+			const PipePacketer::Counters & counters = _session->_packeter.GetCounters();
+			u64 bytes = counters.BytesIn - _counters.BytesIn + counters.BytesOut - _counters.BytesOut;
+			TransactionStats::Result result = TransactionStats::Result::OK;
+			if (Aborted)
+				result = TransactionStats::Result::Aborted;
+			else if (counters.Timeouts != _counters.Timeouts)
+				result = TransactionStats::Result::Timeout;
+			else if (std::uncaught_exception())
+				result = TransactionStats::Result::Error;
+
+			if (result == TransactionStats::Result::OK)
+				_session->UpdateTimeouts(bytes, latency);
+			if (!_measured)
+				return;
+
+			try
+			{ _session->_stats.Record(_code, latency, counters.BytesIn - _counters.BytesIn, counters.BytesOut - _counters.BytesOut, result); }
+			catch(const std::exception &)
+			{ }
+		}
 	};
 
+	void Session::UpdateTimeouts(u64 bytes, std::chrono::steady_clock::duration duration)
+	{
+		_timeoutEstimator.Record(bytes, duration);
+		if (_usbDevice)
+			_usbDevice->SetStallTimeout(_timeoutEstimator.GetStallTimeout(LongTimeout));
+	}
+
 	void Session::SetCurrentTransaction(Transaction *transaction)
 	{
 		scoped_mutex_lock l(_transactionMutex);
@@ -84,8 +133,43 @@ namespace mtp
 	{
 		if (timeout <= 0)
 			timeout = _defaultTimeout;
-		Container container(req);
-		_packeter.Write(container.Data, timeout);
+		_packeter.Write(req, timeout);
+	}
+
+	void Session::Send(const OperationRequest &req, const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		if (timeout <= 0)
+			timeout = _defaultTimeout;
+
+		DataRequest dataReq(req.Code, req.Transaction);
+		Container data(dataReq, inputStream);
+
+		u64 payloadSize = inputStream->GetSize();
+		bool inlinePayload = payloadSize <= MaxInlinePayloadSize;
+		ByteArray largeBuffer;
+		ByteArray &buffer = inlinePayload? _sendBuffer: largeBuffer; //capacity of small buffer is kept between transactions
+		buffer.clear();
+		if (_coalesceDataPhase)
+			buffer.assign(req.GetData(), req.GetData() + req.GetSize());
+		else
+			_packeter.Write(req, timeout);
+		buffer.insert(buffer.end(), data.Data.begin(), data.Data.end());
+
+		if (inlinePayload)
+		{
+			size_t offset = buffer.size();
+			buffer.resize(offset + payloadSize);
+			while(offset < buffer.size())
+			{
+				size_t r = inputStream->Read(buffer.data() + offset, buffer.size() - offset);
+				if (r == 0)
+					throw std::runtime_error("short read from input stream");
+				offset += r;
+			}
+			_packeter.Write(buffer, timeout);
+		}
+		else
+			_packeter.Write(std::make_shared<JoinedObjectInputStream>(std::make_shared<ByteArrayObjectInputStream>(std::move(buffer)), inputStream), timeout);
 	}
 
 	void Session::Close()
@@ -113,14 +197,12 @@ namespace mtp
 	ByteArray Session::RunTransactionWithDataRequest(int timeout, OperationCode code, const IObjectInputStreamPtr & inputStream, Args && ... args)
 	{
 		scoped_mutex_lock l(_mutex);
-		Transaction transaction(this);
-		Send(OperationRequest(code, transaction.Id, std::forward<Args>(args) ... ), timeout);
+		Transaction transaction(this, code);
+		OperationRequest req(code, transaction.Id, std::forward<Args>(args) ... );
 		if (inputStream)
-		{
-			DataRequest req(code, transaction.Id);
-			Container container(req, inputStream);
-			_packeter.Write(std::make_shared<JoinedObjectInputStream>(std::make_shared<ByteArrayObjectInputStream>(container.Data), inputStream), timeout);
-		}
+			Send(req, inputStream, timeout);
+		else
+			Send(req, timeout);
 		return Get(transaction.Id);
 	}
 
@@ -144,6 +226,19 @@ namespace mtp
 		return goh;
 	}
 
+	void Session::GetObjectHandles(StorageId storageId, ObjectFormat objectFormat, ObjectId parent, const ObjectHandlesOutputStream::Callback &callback, int timeout)
+	{
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, OperationCode::GetObjectHandles);
+		Send(OperationRequest(OperationCode::GetObjectHandles, transaction.Id, storageId.Id, static_cast<u32>(objectFormat), parent.Id), timeout);
+		auto stream = std::make_shared<ObjectHandlesOutputStream>(callback);
+		ByteArray response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, stream, responseCode, response, timeout);
+		CHECK_RESPONSE(responseCode);
+		stream->Finish();
+	}
+
 	msg::StorageIDs Session::GetStorageIDs()
 	{
 		auto data = RunTransaction(_defaultTimeout, OperationCode::GetStorageIDs);
@@ -187,18 +282,227 @@ namespace mtp
 	}
 
 	msg::ObjectPropertiesSupported Session::GetObjectPropertiesSupported(ObjectId objectId)
+	{ return GetObjectPropertiesSupported(static_cast<ObjectFormat>(GetObjectIntegerProperty(objectId, ObjectProperty::ObjectFormat))); }
+
+	msg::ObjectPropertiesSupported Session::GetObjectPropertiesSupported(ObjectFormat format)
 	{
-		auto data = RunTransaction(_defaultTimeout, OperationCode::GetObjectPropsSupported, objectId.Id);
+		{
+			scoped_mutex_lock l(_propertyCacheMutex);
+			auto it = _propertiesSupported.find(format);
+			if (it != _propertiesSupported.end())
+				return it->second;
+		}
+		auto data = RunTransaction(_defaultTimeout, OperationCode::GetObjectPropsSupported, static_cast<u32>(format));
 		InputStream stream(data);
 		msg::ObjectPropertiesSupported ops;
 		ops.Read(stream);
+
+		scoped_mutex_lock l(_propertyCacheMutex);
+		_propertiesSupported[format] = ops;
 		return ops;
 	}
 
+	bool Session::IsObjectPropertySupported(ObjectFormat format, ObjectProperty property)
+	{
+		auto ops = GetObjectPropertiesSupported(format);
+		return std::find(ops.ObjectPropertyCodes.begin(), ops.ObjectPropertyCodes.end(), property) != ops.ObjectPropertyCodes.end();
+	}
+
+	msg::ObjectPropertyDesc Session::GetObjectPropertyDesc(ObjectFormat format, ObjectProperty property)
+	{
+		auto key = std::make_pair(format, property);
+		{
+			scoped_mutex_lock l(_propertyCacheMutex);
+			auto it = _propertyDescs.find(key);
+			if (it != _propertyDescs.end())
+				return it->second;
+		}
+		auto data = RunTransaction(_defaultTimeout, OperationCode::GetObjectPropDesc, static_cast<u32>(property), static_cast<u32>(format));
+		InputStream stream(data);
+		msg::ObjectPropertyDesc desc;
+		desc.Read(stream);
+
+		scoped_mutex_lock l(_propertyCacheMutex);
+		_propertyDescs[key] = desc;
+		return desc;
+	}
+
+	void Session::ResetObjectPropertyCache()
+	{
+		scoped_mutex_lock l(_propertyCacheMutex);
+		_propertiesSupported.clear();
+		_propertyDescs.clear();
+	}
+
+	std::vector<msg::ObjectInfo> Session::GetObjectInfos(const std::vector<ObjectId> &objects, ObjectId parent)
+	{
+		std::vector<msg::ObjectInfo> infos(objects.size());
+		std::map<ObjectId, msg::ObjectInfo> listed;
+		std::set<ObjectId> named;
+		//single object is listed by itself (depth 0), so its 64-bit size comes in the same transaction
+		bool single = objects.size() == 1;
+		if ((single || (parent != Device && objects.size() > 1)) && GetObjectPropertyListSupported() && !_capabilities.Has(Capabilities::Quirk::PropertyListAllUnsupported))
+		{
+			try
+			{
+				ByteArray data = single?
+					GetObjectPropertyList(objects[0], ObjectFormat::Any, ObjectProperty::All, 0, 0):
+					GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::All, 0, 1);
+				ObjectPropertyListParser<ObjectPropertyValue> parser;
+				parser.Parse(data, [&listed, &named, parent](ObjectId objectId, ObjectProperty property, const ObjectPropertyValue &value)
+				{
+					msg::ObjectInfo &info = listed[objectId];
+					if (parent != Device)
+						info.ParentObject = parent;
+					switch(property)
+					{
+					case ObjectProperty::StorageId:			info.StorageId = mtp::StorageId(value.Integer); break;
+					case ObjectProperty::ObjectFormat:		info.ObjectFormat = static_cast<ObjectFormat>(value.Integer); break;
+					case ObjectProperty::ProtectionStatus:	info.ProtectionStatus = value.Integer; break;
+					case ObjectProperty::ObjectSize:		info.SetSize(value.Integer); break;
+					case ObjectProperty::AssociationType:	info.AssociationType = static_cast<AssociationType>(value.Integer); break;
+					case ObjectProperty::AssociationDesc:	info.AssociationDesc = value.Integer; break;
+					case ObjectProperty::ParentObject:		if (parent == Device) info.ParentObject = ObjectId(value.Integer); break;
+					case ObjectProperty::ObjectFilename:	info.Filename = value.String; named.insert(objectId); break;
+					case ObjectProperty::DateCreated:		info.CaptureDate = value.String; break;
+					case ObjectProperty::DateModified:		info.ModificationDate = value.String; break;
+					case ObjectProperty::Keywords:			info.Keywords = value.String; break;
+					default: break;
+					}
+				});
+			}
+			catch(const InvalidResponseException &ex)
+			{
+				debug("GetObjectPropList failed: ", ex.what());
+				//object is gone or rejected by itself, which says nothing about the device, GetObjectInfo is used for it only
+				if (!single && ex.Type != ResponseType::InvalidObjectHandle)
+					SetQuirk(Capabilities::Quirk::PropertyListAllUnsupported);
+				listed.clear();
+				named.clear();
+			}
+			catch(const std::exception &ex)
+			{
+				debug("GetObjectPropList failed: ", ex.what());
+				if (!single)
+					SetQuirk(Capabilities::Quirk::PropertyListAllUnsupported);
+				listed.clear();
+				named.clear();
+			}
+		}
+
+		//objects missing from property list are queried back to back
+		Batch batch;
+		std::vector<size_t> queried;
+		for(size_t i = 0; i < objects.size(); ++i)
+		{
+			ObjectId id = objects[i];
+			auto object = listed.find(id);
+			if (object != listed.end() && named.count(id))
+			{
+				infos[i] = std::move(object->second);
+				continue;
+			}
+			batch.GetObjectInfo(id);
+			queried.push_back(i);
+		}
+		if (queried.empty())
+			return infos;
+
+		try
+		{ Execute(batch); }
+		catch(const std::exception &ex)
+		{ error("GetObjectInfo failed: ", ex.what()); } //infos received before failure are kept
+		std::vector<size_t> truncated;
+		for(size_t i = 0; i < batch.GetExecuted(); ++i)
+		{
+			const Batch::Result &result = batch.GetResult(i);
+			if (!result.IsOK())
+			{
+				error("GetObjectInfo failed: ", InvalidResponseException("GetObjectInfo", result.Response).what());
+				continue;
+			}
+			try
+			{
+				msg::ObjectInfo &info = infos[queried[i]];
+				InputStream stream(result.Data);
+				info.Read(stream);
+				if (info.IsSizeTruncated() && info.ObjectFormat != ObjectFormat::Association)
+					truncated.push_back(queried[i]);
+			}
+			catch(const std::exception &ex)
+			{ error("GetObjectInfo failed: ", ex.what()); }
+		}
+		if (!truncated.empty())
+			GetObjectSizes(objects, truncated, infos, parent);
+		return infos;
+	}
+
+	msg::ObjectInfo Session::GetFullObjectInfo(ObjectId objectId)
+	{
+		msg::ObjectInfo info = GetObjectInfos({objectId})[0];
+		if (info.Filename.empty())
+			info = GetObjectInfo(objectId); //repeats the query, so device error is thrown
+		return info;
+	}
+
+	void Session::GetObjectSizes(const std::vector<ObjectId> &objects, const std::vector<size_t> &indices, std::vector<msg::ObjectInfo> &infos, ObjectId parent)
+	{
+		//sizes of the whole directory in one list are cheaper than a transaction per big object
+		if (parent != Device && indices.size() > 1 && GetObjectPropertyListSupported())
+		{
+			try
+			{
+				std::map<ObjectId, u64> sizes;
+				ByteArray data = GetObjectPropertyList(parent, ObjectFormat::Any, ObjectProperty::ObjectSize, 0, 1);
+				ObjectPropertyListParser<u64> parser;
+				parser.Parse(data, [&sizes](ObjectId objectId, ObjectProperty property, u64 size)
+				{ sizes[objectId] = size; });
+
+				bool complete = true;
+				for(auto index : indices)
+				{
+					auto size = sizes.find(objects[index]);
+					if (size != sizes.end())
+						infos[index].SetSize(size->second);
+					else
+						complete = false;
+				}
+				if (complete)
+					return;
+			}
+			catch(const std::exception &ex)
+			{ debug("GetObjectPropList for object sizes failed: ", ex.what()); }
+		}
+
+		Batch batch;
+		std::vector<size_t> queried;
+		for(auto index : indices)
+		{
+			if (!infos[index].IsSizeTruncated())
+				continue;
+			batch.GetObjectProperty(objects[index], ObjectProperty::ObjectSize);
+			queried.push_back(index);
+		}
+		try
+		{ Execute(batch); }
+		catch(const std::exception &ex)
+		{ error("getting object size failed: ", ex.what()); }
+		for(size_t i = 0; i < batch.GetExecuted(); ++i)
+		{
+			const Batch::Result &result = batch.GetResult(i);
+			if (!result.IsOK())
+				continue;
+			try
+			{ infos[queried[i]].SetSize(ReadSingleInteger(result.Data)); }
+			catch(const std::exception &ex)
+			{ error("getting object size failed: ", ex.what()); }
+		}
+	}
+
 	void Session::GetObject(ObjectId objectId, const IObjectOutputStreamPtr &outputStream)
 	{
 		scoped_mutex_lock l(_mutex);
-		Transaction transaction(this);
+		Transaction transaction(this, OperationCode::GetObject);
 		Send(OperationRequest(OperationCode::GetObject, transaction.Id, objectId.Id));
 		ByteArray response;
 		ResponseType responseCode;
@@ -209,7 +513,7 @@ namespace mtp
 	void Session::GetThumb(ObjectId objectId, const IObjectOutputStreamPtr &outputStream)
 	{
 		scoped_mutex_lock l(_mutex);
-		Transaction transaction(this);
+		Transaction transaction(this, OperationCode::GetThumb);
 		Send(OperationRequest(OperationCode::GetThumb, transaction.Id, objectId.Id));
 		ByteArray response;
 		ResponseType responseCode;
@@ -217,32 +521,61 @@ namespace mtp
 		CHECK_RESPONSE(responseCode);
 	}
 
-	ByteArray Session::GetPartialObject(ObjectId objectId, u64 offset, u32 size)
+	OperationRequest Session::GetPartialObjectRequest(u32 transaction, ObjectId objectId, u64 offset, u32 size) const
 	{
-		if (_getPartialObject64Supported)
-			return RunTransaction(_defaultTimeout, OperationCode::GetPartialObject64, objectId.Id, offset, offset >> 32, size);
+		if (_capabilities.Supports(OperationCode::GetPartialObject64))
+			return OperationRequest(OperationCode::GetPartialObject64, transaction, objectId.Id, offset, offset >> 32, size);
 		else
 		{
 			if (offset + size > std::numeric_limits<u32>::max())
 				throw std::runtime_error("32 bit overflow for GetPartialObject");
-			return RunTransaction(_defaultTimeout, OperationCode::GetPartialObject, objectId.Id, offset, size);
+			return OperationRequest(OperationCode::GetPartialObject, transaction, objectId.Id, offset, size);
 		}
 	}
 
+	ByteArray Session::GetPartialObject(ObjectId objectId, u64 offset, u32 size)
+	{
+		ByteArray data;
+		GetPartialObject(objectId, offset, size, data);
+		return data;
+	}
+
+	void Session::GetPartialObject(ObjectId objectId, u64 offset, u32 size, ByteArray &data)
+	{
+		data.clear();
+		data.reserve(size);
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, _capabilities.Supports(OperationCode::GetPartialObject64)? OperationCode::GetPartialObject64: OperationCode::GetPartialObject);
+		Send(GetPartialObjectRequest(transaction.Id, objectId, offset, size));
+		ByteArray response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, data, responseCode, response, _defaultTimeout);
+		CHECK_RESPONSE(responseCode);
+	}
+
+	void Session::GetPartialObject(ObjectId objectId, u64 offset, u32 size, const IObjectOutputStreamPtr &outputStream)
+	{
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, _capabilities.Supports(OperationCode::GetPartialObject64)? OperationCode::GetPartialObject64: OperationCode::GetPartialObject);
+		Send(GetPartialObjectRequest(transaction.Id, objectId, offset, size));
+		ByteArray response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, outputStream, responseCode, response, _defaultTimeout);
+		CHECK_RESPONSE(responseCode);
+	}
+
 
 	Session::NewObjectInfo Session::SendObjectInfo(const msg::ObjectInfo &objectInfo, StorageId storageId, ObjectId parentObject)
 	{
 		if (objectInfo.Filename.empty())
 			throw std::runtime_error("object filename must not be empty");
 		scoped_mutex_lock l(_mutex);
-		Transaction transaction(this);
-		Send(OperationRequest(OperationCode::SendObjectInfo, transaction.Id, storageId.Id, parentObject.Id));
+		Transaction transaction(this, OperationCode::SendObjectInfo);
 		{
-			DataRequest req(OperationCode::SendObjectInfo, transaction.Id);
-			OutputStream stream(req.Data);
+			ByteArray data;
+			OutputStream stream(data);
 			objectInfo.Write(stream);
-			Container container(req);
-			_packeter.Write(container.Data, _defaultTimeout);
+			Send(OperationRequest(OperationCode::SendObjectInfo, transaction.Id, storageId.Id, parentObject.Id), std::make_shared<ByteArrayObjectInputStream>(std::move(data)));
 		}
 		ByteArray data, response;
 		ResponseType responseCode;
@@ -257,16 +590,64 @@ namespace mtp
 		return noi;
 	}
 
-	void Session::SendObject(const IObjectInputStreamPtr &inputStream, int timeout)
+	Session::NewObjectInfo Session::SendObjectPropList(StorageId storageId, ObjectId parentObject, ObjectFormat format, u64 objectSize, const ByteArray &propertyList)
 	{
 		scoped_mutex_lock l(_mutex);
-		Transaction transaction(this);
-		Send(OperationRequest(OperationCode::SendObject, transaction.Id));
+		Transaction transaction(this, OperationCode::SendObjectPropList);
+		Send(OperationRequest(OperationCode::SendObjectPropList, transaction.Id, storageId.Id, parentObject.Id, static_cast<u32>(format), static_cast<u32>(objectSize >> 32), static_cast<u32>(objectSize)), std::make_shared<ByteArrayObjectInputStream>(propertyList));
+		ByteArray data, response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, data, responseCode, response, _defaultTimeout);
+		CHECK_RESPONSE(responseCode);
+		InputStream stream(response);
+		NewObjectInfo noi;
+		stream >> noi.StorageId;
+		stream >> noi.ParentObjectId;
+		stream >> noi.ObjectId;
+		return noi;
+	}
+
+	Session::NewObjectInfo Session::CreateObject(const msg::ObjectInfo &objectInfo, u64 size, StorageId storageId, ObjectId parentObject)
+	{
+		if (!SendObjectPropListSupported())
 		{
-			DataRequest req(OperationCode::SendObject, transaction.Id);
-			Container container(req, inputStream);
-			_packeter.Write(std::make_shared<JoinedObjectInputStream>(std::make_shared<ByteArrayObjectInputStream>(container.Data), inputStream), timeout);
+			msg::ObjectInfo oi(objectInfo);
+			oi.SetSize(size);
+			return SendObjectInfo(oi, storageId, parentObject);
 		}
+		if (objectInfo.Filename.empty())
+			throw std::runtime_error("object filename must not be empty");
+
+		std::vector<std::pair<ObjectProperty, const std::string *>> properties;
+		properties.emplace_back(ObjectProperty::ObjectFilename, &objectInfo.Filename);
+		if (!objectInfo.ModificationDate.empty())
+			properties.emplace_back(ObjectProperty::DateModified, &objectInfo.ModificationDate);
+		if (!objectInfo.CaptureDate.empty())
+			properties.emplace_back(ObjectProperty::DateCreated, &objectInfo.CaptureDate);
+
+		size_t listSize = 4;
+		for(auto &property : properties)
+			listSize += 4 + 2 + 2 + OutputStream::GetSize(*property.second);
+
+		ByteArray data;
+		OutputStream stream(data);
+		stream.Reserve(listSize);
+		stream << static_cast<u32>(properties.size());
+		for(auto &property : properties)
+		{
+			stream << static_cast<u32>(0); //object handle is not assigned yet
+			stream << property.first;
+			stream << DataTypeCode::String;
+			stream << *property.second;
+		}
+		return SendObjectPropList(storageId, parentObject, objectInfo.ObjectFormat, size, data);
+	}
+
+	void Session::SendObject(const IObjectInputStreamPtr &inputStream, int timeout)
+	{
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, OperationCode::SendObject);
+		Send(OperationRequest(OperationCode::SendObject, transaction.Id), inputStream, timeout);
 		Get(transaction.Id);
 	}
 
@@ -305,12 +686,146 @@ namespace mtp
 	void Session::SetObjectProperty(ObjectId objectId, ObjectProperty property, const std::string &value)
 	{
 		ByteArray data;
-		data.reserve(value.size() * 2 + 1);
 		OutputStream stream(data);
+		stream.Reserve(OutputStream::GetSize(value));
 		stream << value;
 		SetObjectProperty(objectId, property, data);
 	}
 
+	Session::ObjectPropertyUpdate::ObjectPropertyUpdate(mtp::ObjectId objectId, mtp::ObjectProperty property, const std::string &value):
+		ObjectId(objectId), Property(property), Type(DataTypeCode::String)
+	{
+		OutputStream stream(Value);
+		stream.Reserve(OutputStream::GetSize(value));
+		stream << value;
+	}
+
+	void Session::SetObjectProperties(const std::vector<ObjectPropertyUpdate> &updates)
+	{
+		size_t index = 0;
+		while(index < updates.size() && SetObjectPropListSupported())
+		{
+			size_t end = std::min(updates.size(), index + MaxPropertyListUpdates);
+			size_t listSize = 4;
+			for(size_t i = index; i < end; ++i)
+				listSize += 4 + 2 + 2 + updates[i].Value.size();
+
+			ByteArray data;
+			OutputStream stream(data);
+			stream.Reserve(listSize);
+			stream << static_cast<u32>(end - index);
+			for(size_t i = index; i < end; ++i)
+			{
+				const ObjectPropertyUpdate &update = updates[i];
+				stream << update.ObjectId;
+				stream << update.Property;
+				stream << update.Type;
+				data.insert(data.end(), update.Value.begin(), update.Value.end());
+			}
+
+			ByteArray response;
+			ResponseType responseCode;
+			{
+				scoped_mutex_lock l(_mutex);
+				Transaction transaction(this, OperationCode::SetObjectPropList);
+				Send(OperationRequest(OperationCode::SetObjectPropList, transaction.Id), std::make_shared<ByteArrayObjectInputStream>(data));
+				ByteArray responseData;
+				_packeter.Read(transaction.Id, responseData, responseCode, response, _defaultTimeout);
+			}
+
+			if (responseCode == ResponseType::OK)
+			{
+				index = end;
+				continue;
+			}
+			if (responseCode == ResponseType::OperationNotSupported)
+			{
+				debug("SetObjectPropList is not supported, setting properties one by one");
+				SetQuirk(Capabilities::Quirk::PropertyListUpdateUnsupported);
+				break;
+			}
+
+			//first response parameter is index of failed entry within the list
+			size_t failed = index;
+			if (response.size() >= 4)
+			{
+				InputStream responseStream(response);
+				u32 failedIndex;
+				responseStream >> failedIndex;
+				if (failedIndex < end - index)
+					failed += failedIndex;
+			}
+			throw ObjectPropertyUpdateException(__func__, responseCode, failed);
+		}
+
+		//one transaction per update, but lock is taken once per group, so updates are sent back to back
+		Batch batch;
+		batch.SetStopOnError(true);
+		while(index < updates.size())
+		{
+			size_t end = std::min(updates.size(), index + MaxPropertyListUpdates);
+			batch.Clear();
+			for(size_t i = index; i < end; ++i)
+				batch.SetObjectProperty(updates[i].ObjectId, updates[i].Property, updates[i].Value);
+			Execute(batch);
+			const Batch::Result &last = batch.GetResult(batch.GetExecuted() - 1);
+			if (!last.IsOK())
+				throw ObjectPropertyUpdateException(__func__, last.Response, index + batch.GetExecuted() - 1);
+			index = end;
+		}
+	}
+
+	size_t Session::Batch::Add(OperationCode code, std::initializer_list<u32> parameters, int timeout)
+	{
+		if (parameters.size() > MaxParameters)
+			throw std::invalid_argument("too many operation parameters");
+		_operations.emplace_back();
+		Operation &op = _operations.back();
+		op.Code = code;
+		std::copy(parameters.begin(), parameters.end(), op.Parameters.begin());
+		op.ParameterCount = parameters.size();
+		op.HasPayload = false;
+		op.Timeout = timeout;
+		return _operations.size() - 1;
+	}
+
+	size_t Session::Batch::Add(OperationCode code, std::initializer_list<u32> parameters, const ByteArray &payload, int timeout)
+	{
+		size_t index = Add(code, parameters, timeout);
+		Operation &op = _operations.back();
+		op.HasPayload = true;
+		op.Payload = payload;
+		return index;
+	}
+
+	void Session::Execute(Batch &batch)
+	{
+		batch._executed = 0;
+		if (batch._results.size() < batch._operations.size())
+			batch._results.resize(batch._operations.size());
+
+		scoped_mutex_lock l(_mutex);
+		for(auto &op : batch._operations)
+		{
+			Batch::Result &result = batch._results[batch._executed];
+			int timeout = op.Timeout > 0? op.Timeout: _defaultTimeout;
+			{
+				Transaction transaction(this, op.Code);
+				OperationRequest req(op.Code, transaction.Id);
+				for(size_t i = 0; i < op.ParameterCount; ++i)
+					req.Append(op.Parameters[i]);
+				if (op.HasPayload)
+					Send(req, std::make_shared<ByteArrayObjectInputStream>(op.Payload), timeout);
+				else
+					Send(req, timeout);
+				_packeter.Read(transaction.Id, result.Data, result.Response, result.Parameters, timeout);
+			}
+			++batch._executed;
+			if (batch._stopOnError && !result.IsOK())
+				break;
+		}
+	}
+
 	ByteArray Session::GetObjectProperty(ObjectId objectId, ObjectProperty property)
 	{ return RunTransaction(_defaultTimeout, OperationCode::GetObjectPropValue, objectId.Id, (u16)property); }
 
@@ -341,7 +856,7 @@ namespace mtp
 
 	time_t Session::GetObjectModificationTime(ObjectId id)
 	{
-		if (!_getObjectModificationTimeBuggy)
+		if (!_capabilities.Has(Capabilities::Quirk::ObjectModificationTimeBuggy))
 		{
 			try
 			{
@@ -354,7 +869,7 @@ namespace mtp
 			{
 				debug("exception while getting mtime: ", ex.what());
 			}
-			_getObjectModificationTimeBuggy = true;
+			_capabilities.Set(Capabilities::Quirk::ObjectModificationTimeBuggy);
 		}
 		auto oi = GetObjectInfo(id);
 		return mtp::ConvertDateTime(oi.ModificationDate);
@@ -373,9 +888,46 @@ namespace mtp
 		return RunTransaction(timeout, OperationCode::GetObjectPropList, objectId.Id, (u32)format, property != ObjectProperty::All? (u32)property: 0xffffffffu, groupCode, depth);
 	}
 
+	void Session::GetObjectPropertyList(ObjectId objectId, ObjectFormat format, ObjectProperty property, u32 groupCode, u32 depth, const IObjectOutputStreamPtr &outputStream, int timeout)
+	{
+		if (objectId == Root) //ffffffff -> 0
+			objectId = Device;
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, OperationCode::GetObjectPropList);
+		Send(OperationRequest(OperationCode::GetObjectPropList, transaction.Id, objectId.Id, (u32)format, property != ObjectProperty::All? (u32)property: 0xffffffffu, groupCode, depth));
+		ByteArray response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, outputStream, responseCode, response, timeout);
+		CHECK_RESPONSE(responseCode);
+	}
+
 	void Session::DeleteObject(ObjectId objectId, int timeout)
 	{ RunTransaction(timeout, OperationCode::DeleteObject, objectId.Id, 0); }
 
+	void Session::MoveObject(ObjectId objectId, StorageId storageId, ObjectId parentObject, int timeout)
+	{
+		if (parentObject == Root) //ffffffff -> 0
+			parentObject = Device;
+		RunTransaction(timeout, OperationCode::MoveObject, objectId.Id, storageId.Id, parentObject.Id);
+	}
+
+	ObjectId Session::CopyObject(ObjectId objectId, StorageId storageId, ObjectId parentObject, int timeout)
+	{
+		if (parentObject == Root) //ffffffff -> 0
+			parentObject = Device;
+		scoped_mutex_lock l(_mutex);
+		Transaction transaction(this, OperationCode::CopyObject);
+		Send(OperationRequest(OperationCode::CopyObject, transaction.Id, objectId.Id, storageId.Id, parentObject.Id), timeout);
+		ByteArray data, response;
+		ResponseType responseCode;
+		_packeter.Read(transaction.Id, data, responseCode, response, timeout);
+		CHECK_RESPONSE(responseCode);
+		InputStream stream(response);
+		ObjectId newObjectId;
+		stream >> newObjectId;
+		return newObjectId;
+	}
+
 	ByteArray Session::GetDeviceProperty(DeviceProperty property)
 	{ return RunTransaction(_defaultTimeout, OperationCode::GetDevicePropValue, (u16)property); }
 
@@ -391,6 +943,34 @@ namespace mtp
 	void Session::ObjectEditSession::Send(u64 offset, const ByteArray &data)
 	{ _session->SendPartialObject(_objectId, offset, data); }
 
+	int Session::SubscribeEvents(const EventListener::Callback &callback)
+	{
+		if (_capabilities.Has(Capabilities::Quirk::EventsUnsupported))
+			return -1; //no listener thread polling interrupt endpoint
+
+		scoped_mutex_lock l(_eventListenerMutex);
+		if (!_eventListener)
+			_eventListener = std::make_shared<EventListener>(_packeter.GetPipe());
+		return _eventListener->Subscribe(callback);
+	}
+
+	void Session::UnsubscribeEvents(int id)
+	{
+		scoped_mutex_lock l(_eventListenerMutex);
+		if (_eventListener)
+			_eventListener->Unsubscribe(id);
+	}
+
+	bool Session::GetCurrentTransaction(OperationCode &code, std::chrono::steady_clock::duration &age)
+	{
+		scoped_mutex_lock l(_transactionMutex);
+		if (!_transaction)
+			return false;
+		code = _transaction->GetCode();
+		age = _transaction->IsMeasured()? std::chrono::steady_clock::now() - _transaction->GetStarted(): std::chrono::steady_clock::duration::zero();
+		return true;
+	}
+
 	void Session::AbortCurrentTransaction(int timeout)
 	{
 		u32 transactionId;
@@ -399,6 +979,7 @@ namespace mtp
 			if (!_transaction)
 				throw std::runtime_error("no transaction in progress");
 			transactionId = _transaction->Id;
+			_transaction->Aborted = true;
 		}
 		_packeter.Abort(transactionId, timeout);
 	}
@@ -21,12 +21,23 @@
 #define	SESSION_H
 
 #include <mtp/usb/BulkPipe.h>
+#include <mtp/ptp/Capabilities.h>
 #include <mtp/ptp/Messages.h>
 #include <mtp/ptp/DeviceProperty.h>
+#include <mtp/ptp/EventListener.h>
 #include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ObjectHandlesOutputStream.h>
 #include <mtp/ptp/ObjectId.h>
 #include <mtp/ptp/ObjectProperty.h>
 #include <mtp/ptp/PipePacketer.h>
+#include <mtp/ptp/Response.h>
+#include <mtp/ptp/StartupTimings.h>
+#include <mtp/ptp/TimeoutEstimator.h>
+#include <mtp/ptp/TransactionStats.h>
+#include <array>
+#include <initializer_list>
+#include <map>
+#include <vector>
 #include <time.h>
 
 namespace mtp
@@ -36,6 +47,14 @@ namespace mtp
 	class Session;
 	DECLARE_PTR(Session);
 
+	struct ObjectPropertyUpdateException : public InvalidResponseException //! SetObjectProperties failure, updates before Index were applied
+	{
+		size_t Index;
+		ObjectPropertyUpdateException(const std::string &where, ResponseType type, size_t index):
+			InvalidResponseException(where, type), Index(index)
+		{ }
+	};
+
 	class Session //! Main MTP interaction / object manipulation class
 	{
 		class Transaction;
@@ -47,16 +66,30 @@ namespace mtp
 		Transaction *	_transaction;
 
 		msg::DeviceInfo	_deviceInfo;
-		bool			_getPartialObject64Supported;
-		bool			_editObjectSupported;
-		bool			_getObjectPropertyListSupported;
-		bool			_getObjectModificationTimeBuggy;
+		Capabilities	_capabilities;
+		bool			_coalesceDataPhase;
 		int				_defaultTimeout;
+		ByteArray		_sendBuffer; //command and data phase of small transactions, reused under _mutex
+
+		std::mutex			_eventListenerMutex;
+		EventListenerPtr	_eventListener; //started on first subscription, stopped before packeter goes away
+
+		TransactionStats	_stats;
+		StartupTimings		_startupTimings;
+		usb::DevicePtr		_usbDevice; //null for software pipes
+		TimeoutEstimator	_timeoutEstimator; //updated under _mutex
+
+		std::mutex		_propertyCacheMutex;
+		std::map<ObjectFormat, msg::ObjectPropertiesSupported> _propertiesSupported; //per-format answers, constant for session lifetime
+		std::map<std::pair<ObjectFormat, ObjectProperty>, msg::ObjectPropertyDesc> _propertyDescs;
 
 	public:
 		static constexpr int DefaultTimeout		= 10000;
 		static constexpr int LongTimeout		= 30000;
 
+		///payloads up to this size are sent together with data container header in one buffer
+		static constexpr size_t MaxInlinePayloadSize = 16384;
+
 		static const StorageId AllStorages;
 		static const StorageId AnyStorage;
 		static const ObjectId Device;
@@ -69,6 +102,22 @@ namespace mtp
 			mtp::ObjectId		ObjectId;
 		};
 
+		struct ObjectPropertyUpdate //! single property assignment for SetObjectProperties
+		{
+			mtp::ObjectId			ObjectId;
+			mtp::ObjectProperty		Property;
+			DataTypeCode			Type;
+			ByteArray				Value; //encoded as in SetObjectPropValue data phase
+
+			ObjectPropertyUpdate(mtp::ObjectId objectId, mtp::ObjectProperty property, DataTypeCode type, const ByteArray &value):
+				ObjectId(objectId), Property(property), Type(type), Value(value)
+			{ }
+			ObjectPropertyUpdate(mtp::ObjectId objectId, mtp::ObjectProperty property, const std::string &value);
+		};
+
+		///updates sent in one SetObjectPropList transaction
+		static const size_t MaxPropertyListUpdates = 1024;
+
 		///sub-session object which handles partial writes and truncation
 		class ObjectEditSession : Noncopyable
 		{
@@ -84,38 +133,162 @@ namespace mtp
 		};
 		DECLARE_PTR(ObjectEditSession);
 
+		///small operations queued and run back to back by \ref Session::Execute with session locked once
+		///batch may be reused after Clear, result buffers keep their capacity
+		class Batch : Noncopyable
+		{
+		public:
+			struct Result //! response of single queued operation
+			{
+				ResponseType	Response;
+				ByteArray		Data; //data phase sent by device
+				ByteArray		Parameters; //response parameters
+
+				Result(): Response(ResponseType::OK) { }
+
+				bool IsOK() const
+				{ return Response == ResponseType::OK; }
+			};
+
+			static const size_t MaxParameters = 5;
+
+		private:
+			friend class Session;
+
+			struct Operation
+			{
+				OperationCode			Code;
+				std::array<u32, MaxParameters>	Parameters;
+				size_t					ParameterCount;
+				bool					HasPayload;
+				ByteArray				Payload; //data phase sent to device
+				int						Timeout;
+			};
+
+			std::vector<Operation>	_operations;
+			std::vector<Result>		_results; //may be longer than _operations, extra entries are kept for reuse
+			size_t					_executed;
+			bool					_stopOnError;
+
+		public:
+			Batch(): _executed(0), _stopOnError(false) { }
+
+			///execution stops after first operation rejected by device, default is to run all of them
+			void SetStopOnError(bool stop)
+			{ _stopOnError = stop; }
+
+			///returns index of operation, timeout 0 means default one
+			size_t Add(OperationCode code, std::initializer_list<u32> parameters, int timeout = 0);
+			size_t Add(OperationCode code, std::initializer_list<u32> parameters, const ByteArray &payload, int timeout = 0);
+
+			size_t DeleteObject(ObjectId objectId, int timeout = LongTimeout)
+			{ return Add(OperationCode::DeleteObject, { objectId.Id, 0 }, timeout); }
+			size_t GetObjectInfo(ObjectId objectId)
+			{ return Add(OperationCode::GetObjectInfo, { objectId.Id }); }
+			size_t GetObjectProperty(ObjectId objectId, ObjectProperty property)
+			{ return Add(OperationCode::GetObjectPropValue, { objectId.Id, static_cast<u16>(property) }); }
+			size_t SetObjectProperty(ObjectId objectId, ObjectProperty property, const ByteArray &value)
+			{ return Add(OperationCode::SetObjectPropValue, { objectId.Id, static_cast<u16>(property) }, value); }
+
+			size_t GetSize() const
+			{ return _operations.size(); }
+			///number of operations run by last Execute, including rejected ones
+			size_t GetExecuted() const
+			{ return _executed; }
+			///valid after Execute for index < GetExecuted()
+			const Result & GetResult(size_t index) const
+			{ return _results.at(index); }
+
+			void Clear()
+			{ _operations.clear(); _executed = 0; }
+		};
+
 		Session(usb::BulkPipePtr pipe, u32 sessionId);
 		~Session();
 
 		const msg::DeviceInfo & GetDeviceInfo() const
 		{ return _deviceInfo; }
 
+		///capability table built from device info, use it instead of DeviceInfo::Supports
+		const Capabilities & GetCapabilities() const
+		{ return _capabilities; }
+
+		///adds Capabilities::Quirk bits, known from DeviceQuirks table or learnt from failed requests
+		void SetQuirks(u32 quirks)
+		{ _capabilities.SetQuirks(quirks); }
+		void SetQuirk(Capabilities::Quirk quirk)
+		{ _capabilities.Set(quirk); }
+
 		msg::ObjectHandles GetObjectHandles(StorageId storageId = AllStorages, ObjectFormat objectFormat = ObjectFormat::Any, ObjectId parent = Device, int timeout = LongTimeout);
+		///passes handles to callback in chunks while response is being received, without buffering whole array
+		///callback is called with session locked, so it must not issue requests itself
+		void GetObjectHandles(StorageId storageId, ObjectFormat objectFormat, ObjectId parent, const ObjectHandlesOutputStream::Callback &callback, int timeout = LongTimeout);
 		msg::StorageIDs GetStorageIDs();
 		msg::StorageInfo GetStorageInfo(StorageId storageId);
 
 		NewObjectInfo CreateDirectory(const std::string &name, ObjectId parentId, StorageId storageId = AnyStorage, AssociationType type = AssociationType::GenericFolder);
 		msg::ObjectInfo GetObjectInfo(ObjectId objectId);
+		///returns infos in order of objects, using single GetObjectPropList if all of them are children of parent or there's only one object, back to back GetObjectInfo otherwise
+		///ObjectSize of returned infos is 64-bit, for objects of 4GiB and more it is queried in one property list of parent or in a batch
+		///infos of objects which could not be queried are left default-constructed (empty filename)
+		std::vector<msg::ObjectInfo> GetObjectInfos(const std::vector<ObjectId> &objects, ObjectId parent = Device);
+		///info of single object with 64-bit size, throws if it could not be queried
+		msg::ObjectInfo GetFullObjectInfo(ObjectId objectId);
 		void GetObject(ObjectId objectId, const IObjectOutputStreamPtr &outputStream);
 		void GetThumb(ObjectId objectId, const IObjectOutputStreamPtr &outputStream);
 		ByteArray GetPartialObject(ObjectId objectId, u64 offset, u32 size);
+		///reads object range into caller's buffer, reusing its capacity
+		void GetPartialObject(ObjectId objectId, u64 offset, u32 size, ByteArray &data);
+		void GetPartialObject(ObjectId objectId, u64 offset, u32 size, const IObjectOutputStreamPtr &outputStream);
 		NewObjectInfo SendObjectInfo(const msg::ObjectInfo &objectInfo, StorageId storageId = AnyStorage, ObjectId parentObject = Device);
+		///creates object with filename, format and dates of objectInfo and 64-bit size in single SendObjectPropList transaction, uses SendObjectInfo if it's not supported
+		///object data is sent with SendObject afterwards
+		NewObjectInfo CreateObject(const msg::ObjectInfo &objectInfo, u64 size, StorageId storageId = AnyStorage, ObjectId parentObject = Device);
+		NewObjectInfo SendObjectPropList(StorageId storageId, ObjectId parentObject, ObjectFormat format, u64 objectSize, const ByteArray &propertyList);
 		void SendObject(const IObjectInputStreamPtr &inputStream, int timeout = LongTimeout);
 		void DeleteObject(ObjectId objectId, int timeout = LongTimeout);
+		///moves object to another parent/storage on device, object keeps its id
+		void MoveObject(ObjectId objectId, StorageId storageId, ObjectId parentObject, int timeout = LongTimeout);
+		///copies object on device, returns id of the copy
+		ObjectId CopyObject(ObjectId objectId, StorageId storageId, ObjectId parentObject, int timeout = LongTimeout);
 
 		bool EditObjectSupported() const
-		{ return _editObjectSupported; }
+		{ return _capabilities.CanEditObjects(); }
 		bool GetObjectPropertyListSupported() const
-		{ return _getObjectPropertyListSupported; }
+		{ return _capabilities.Supports(OperationCode::GetObjectPropList); }
+		bool SendObjectPropListSupported() const
+		{ return _capabilities.Supports(OperationCode::SendObjectPropList); }
+		bool SetObjectPropListSupported() const
+		{ return _capabilities.Supports(OperationCode::SetObjectPropList) && !_capabilities.Has(Capabilities::Quirk::PropertyListUpdateUnsupported); }
+
+		///sends command and data containers in a single bulk transfer, only for responders splitting containers by their size
+		void SetCoalesceDataPhase(bool coalesce)
+		{ _coalesceDataPhase = coalesce; }
+		bool GetCoalesceDataPhase() const
+		{ return _coalesceDataPhase; }
 
 		static ObjectEditSessionPtr EditObject(const SessionPtr &session, ObjectId objectId)
 		{ return std::make_shared<ObjectEditSession>(session, objectId); }
 
+		///resolves object format and returns cached per-format answer
 		msg::ObjectPropertiesSupported GetObjectPropertiesSupported(ObjectId objectId);
+		///queried once per format, cached for session lifetime
+		msg::ObjectPropertiesSupported GetObjectPropertiesSupported(ObjectFormat format);
+		bool IsObjectPropertySupported(ObjectFormat format, ObjectProperty property);
+		///queried once per format and property, cached for session lifetime
+		msg::ObjectPropertyDesc GetObjectPropertyDesc(ObjectFormat format, ObjectProperty property);
+		///drops cached property answers, e.g. on ObjectPropDescChanged event
+		void ResetObjectPropertyCache();
 
 		void SetObjectProperty(ObjectId objectId, ObjectProperty property, const ByteArray &value);
 		void SetObjectProperty(ObjectId objectId, ObjectProperty property, u64 value);
 		void SetObjectProperty(ObjectId objectId, ObjectProperty property, const std::string &value);
+		///applies updates in order, in SetObjectPropList transactions of MaxPropertyListUpdates entries if supported, with back to back SetObjectPropValue otherwise
+		///stops at first rejected update and throws ObjectPropertyUpdateException with its index
+		void SetObjectProperties(const std::vector<ObjectPropertyUpdate> &updates);
+		///runs queued operations in order, responses are stored in batch, rejected operations do not throw
+		///transport failures (timeout, disconnect) are thrown, results of operations run before are kept
+		void Execute(Batch &batch);
 		time_t GetObjectModificationTime(ObjectId id);
 
 		//common properties shortcuts
@@ -127,6 +300,8 @@ namespace mtp
 		std::string GetObjectStringProperty(ObjectId objectId, ObjectProperty property);
 
 		ByteArray GetObjectPropertyList(ObjectId objectId, ObjectFormat format, ObjectProperty property, u32 groupCode, u32 depth, int timeout = LongTimeout);
+		///streams property list into outputStream while it's being received, see \ref ObjectPropertyListStream
+		void GetObjectPropertyList(ObjectId objectId, ObjectFormat format, ObjectProperty property, u32 groupCode, u32 depth, const IObjectOutputStreamPtr &outputStream, int timeout = LongTimeout);
 
 		ByteArray GetDeviceProperty(DeviceProperty property);
 		u64 GetDeviceIntegerProperty(DeviceProperty property);
@@ -134,6 +309,23 @@ namespace mtp
 
 		void AbortCurrentTransaction(int timeout);
 
+		///starts reading device events on first call, callback is called from listener thread, see \ref EventListener
+		int SubscribeEvents(const EventListener::Callback &callback);
+		void UnsubscribeEvents(int id);
+
+		///per-operation latency and traffic counters, call SetEnabled(true) to start collecting
+		TransactionStats & GetStats()
+		{ return _stats; }
+		const TransactionStats & GetStats() const
+		{ return _stats; }
+		///phases of device discovery and session startup, applications append their own (e.g. storages)
+		StartupTimings & GetStartupTimings()
+		{ return _startupTimings; }
+		const StartupTimings & GetStartupTimings() const
+		{ return _startupTimings; }
+		///returns false if no transaction is running, age is measured only while statistics are enabled
+		bool GetCurrentTransaction(OperationCode &code, std::chrono::steady_clock::duration &age);
+
 	private:
 		template<typename ... Args>
 		ByteArray RunTransaction(int timeout, OperationCode code, Args && ... args)
@@ -142,8 +334,12 @@ namespace mtp
 		ByteArray RunTransactionWithDataRequest(int timeout, OperationCode code, const IObjectInputStreamPtr & inputStream, Args && ... args);
 
 		void SetCurrentTransaction(Transaction *);
+		///feeds successful transaction to timeout estimator and applies its stall timeout to usb device, called under _mutex
+		void UpdateTimeouts(u64 bytes, std::chrono::steady_clock::duration duration);
 
 		msg::DeviceInfo GetDeviceInfoImpl();
+		void GetObjectSizes(const std::vector<ObjectId> &objects, const std::vector<size_t> &indices, std::vector<msg::ObjectInfo> &infos, ObjectId parent);
+		OperationRequest GetPartialObjectRequest(u32 transaction, ObjectId objectId, u64 offset, u32 size) const;
 
 		void BeginEditObject(ObjectId objectId);
 		void SendPartialObject(ObjectId objectId, u64 offset, const ByteArray &data);
@@ -152,6 +348,7 @@ namespace mtp
 
 		ByteArray Get(u32 transaction, int timeout = 0);
 		void Send(const OperationRequest &req, int timeout = 0);
+		void Send(const OperationRequest &req, const IObjectInputStreamPtr &inputStream, int timeout = 0);
 		void Close();
 	};
 
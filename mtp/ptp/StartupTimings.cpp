@@ -0,0 +1,46 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/StartupTimings.h>
+#include <mtp/log.h>
+
+namespace mtp
+{
+
+	void StartupTimings::Record(const std::string &name, Duration duration)
+	{
+		debug("startup phase ", name, ": ", std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 1000.0, " ms");
+		scoped_mutex_lock l(_mutex);
+		_phases.emplace_back(name, duration);
+	}
+
+	void StartupTimings::Append(const StartupTimings &other)
+	{
+		Phases phases = other.Get();
+		scoped_mutex_lock l(_mutex);
+		_phases.insert(_phases.end(), phases.begin(), phases.end());
+	}
+
+	StartupTimings::Phases StartupTimings::Get() const
+	{
+		scoped_mutex_lock l(_mutex);
+		return _phases;
+	}
+
+}
@@ -0,0 +1,58 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_STARTUPTIMINGS_H
+#define AFT_PTP_STARTUPTIMINGS_H
+
+#include <mtp/types.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mtp
+{
+
+	class StartupTimings //! durations of device attach phases (usb scan, device open, session, storages), in order they were recorded
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+		typedef Clock::duration Duration;
+		typedef std::vector<std::pair<std::string, Duration>> Phases;
+
+	private:
+		mutable std::mutex	_mutex;
+		Phases				_phases;
+
+	public:
+		///adds phase and prints its duration in debug output
+		void Record(const std::string &name, Duration duration);
+		///records phase started at given time and ending now
+		void Record(const std::string &name, Clock::time_point started)
+		{ Record(name, Clock::now() - started); }
+		///adds phases recorded by another object, e.g. device phases to session
+		void Append(const StartupTimings &other);
+
+		Phases Get() const;
+	};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFT_PTP_THROUGHPUTESTIMATOR_H
+#define AFT_PTP_THROUGHPUTESTIMATOR_H
+
+#include <mtp/types.h>
+#include <chrono>
+#include <cmath>
+
+namespace mtp
+{
+	class ThroughputEstimator //! transfer rate and eta estimation: rate of every closed sliding window is folded into exponentially weighted average, so stalls and bursts are smoothed but not remembered forever
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		Clock::duration		_window;
+		double				_timeConstant;
+		Clock::time_point	_windowStart;
+		Clock::time_point	_lastUpdate;
+		u64					_windowPosition;
+		u64					_position;
+		double				_rate;
+		bool				_started;
+		bool				_rated;
+
+	public:
+		static const unsigned DefaultWindowMs = 500;
+		static const unsigned DefaultTimeConstantMs = 3000;
+
+		ThroughputEstimator(unsigned windowMs = DefaultWindowMs, unsigned timeConstantMs = DefaultTimeConstantMs):
+			_window(std::chrono::milliseconds(windowMs? windowMs: 1)), _timeConstant(timeConstantMs / 1000.0),
+			_windowPosition(0), _position(0), _rate(0), _started(false), _rated(false)
+		{ }
+
+		///forgets all samples, next update starts new measurement
+		void Reset()
+		{ _started = _rated = false; _rate = 0; _position = _windowPosition = 0; }
+
+		///feeds absolute transferred byte count, position going backwards is treated as new transfer
+		void Update(u64 position)
+		{ Update(position, Clock::now()); }
+
+		void Update(u64 position, Clock::time_point now)
+		{
+			if (!_started || position < _windowPosition)
+			{
+				Reset();
+				_started = true;
+				_windowStart = _lastUpdate = now;
+				_windowPosition = _position = position;
+				return;
+			}
+
+			_position = position;
+			_lastUpdate = now;
+			auto elapsed = now - _windowStart;
+			if (elapsed < _window)
+				return;
+
+			double seconds = std::chrono::duration<double>(elapsed).count();
+			double sample = (position - _windowPosition) / seconds;
+			if (_rated)
+			{
+				//time-weighted, so irregular update intervals weigh in proportionally
+				double alpha = _timeConstant > 0? 1 - std::exp(-seconds / _timeConstant): 1;
+				_rate += alpha * (sample - _rate);
+			}
+			else
+			{
+				_rate = sample;
+				_rated = true;
+			}
+			_windowStart = now;
+			_windowPosition = position;
+		}
+
+		///returns true if rate is meaningful: some bytes were transferred over measurable time
+		bool IsValid() const
+		{ return _rated || (_started && _position > _windowPosition && _lastUpdate > _windowStart); }
+
+		///returns smoothed rate in bytes per second, rate of the first, incomplete window until it closes, zero if not known yet
+		double GetRate() const
+		{
+			if (_rated)
+				return _rate;
+			if (!IsValid())
+				return 0;
+			return (_position - _windowPosition) / std::chrono::duration<double>(_lastUpdate - _windowStart).count();
+		}
+
+		///returns estimated seconds left until total is reached, negative if unknown
+		double GetEta(u64 total) const
+		{
+			if (total && _position >= total)
+				return 0;
+			double rate = GetRate();
+			if (!total || rate <= 0)
+				return -1;
+			return (total - _position) / rate;
+		}
+	};
+}
+
+#endif
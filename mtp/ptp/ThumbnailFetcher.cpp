@@ -0,0 +1,254 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/ThumbnailFetcher.h>
+#include <mtp/ptp/MemoryObjectStream.h>
+#include <mtp/log.h>
+#include <algorithm>
+#include <string.h>
+
+namespace mtp
+{
+
+	namespace
+	{
+		const u16 TagJpegOffset = 0x0201;
+		const u16 TagJpegLength = 0x0202;
+
+		class TiffReader
+		{
+			const u8 *	_data;
+			size_t		_size;
+			bool		_bigEndian;
+
+		public:
+			TiffReader(const u8 *data, size_t size, bool bigEndian): _data(data), _size(size), _bigEndian(bigEndian)
+			{ }
+
+			bool Has(size_t offset, size_t size) const
+			{ return offset <= _size && size <= _size - offset; }
+
+			u16 Read16(size_t offset) const
+			{
+				const u8 *p = _data + offset;
+				return _bigEndian? (p[0] << 8) | p[1]: (p[1] << 8) | p[0];
+			}
+
+			u32 Read32(size_t offset) const
+			{
+				const u8 *p = _data + offset;
+				return _bigEndian?
+					(static_cast<u32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]:
+					(static_cast<u32>(p[3]) << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+			}
+
+			///returns offset of IFD following the one at offset, 0 if none
+			u32 NextIfd(u32 offset) const
+			{
+				if (!Has(offset, 2))
+					return 0;
+				u16 entries = Read16(offset);
+				size_t next = offset + 2 + 12 * static_cast<size_t>(entries);
+				return Has(next, 4)? Read32(next): 0;
+			}
+
+			bool FindTag(u32 ifd, u16 tag, u32 &value) const
+			{
+				if (!Has(ifd, 2))
+					return false;
+				u16 entries = Read16(ifd);
+				for(u16 i = 0; i < entries; ++i)
+				{
+					size_t entry = ifd + 2 + 12 * static_cast<size_t>(i);
+					if (!Has(entry, 12))
+						return false;
+					if (Read16(entry) != tag)
+						continue;
+					u16 type = Read16(entry + 2);
+					value = type == 3? Read16(entry + 8): Read32(entry + 8); //SHORT or LONG
+					return true;
+				}
+				return false;
+			}
+		};
+
+		ByteArray ParseTiff(const u8 *tiff, size_t size)
+		{
+			if (size < 8)
+				return ByteArray();
+			bool bigEndian;
+			if (tiff[0] == 'M' && tiff[1] == 'M')
+				bigEndian = true;
+			else if (tiff[0] == 'I' && tiff[1] == 'I')
+				bigEndian = false;
+			else
+				return ByteArray();
+
+			TiffReader reader(tiff, size, bigEndian);
+			if (reader.Read16(2) != 42)
+				return ByteArray();
+
+			u32 ifd1 = reader.NextIfd(reader.Read32(4));
+			u32 offset, length;
+			if (!ifd1 || !reader.FindTag(ifd1, TagJpegOffset, offset) || !reader.FindTag(ifd1, TagJpegLength, length))
+				return ByteArray();
+			if (length < 4 || !reader.Has(offset, length))
+				return ByteArray(); //thumbnail lies beyond fetched head
+			if (tiff[offset] != 0xff || tiff[offset + 1] != 0xd8)
+				return ByteArray();
+			return ByteArray(tiff + offset, tiff + offset + length);
+		}
+
+		const u8 ExifSignature[] = { 'E', 'x', 'i', 'f', 0, 0 };
+	}
+
+	constexpr u32 ThumbnailFetcher::HeadSize;
+	constexpr int ThumbnailFetcher::Probes;
+	constexpr ObjectFormat ThumbnailFetcher::Heif;
+
+	ThumbnailFetcher::ThumbnailFetcher(const SessionPtr &session, Source source):
+		_session(session), _source(source)
+	{ }
+
+	bool ThumbnailFetcher::MayHaveExif(ObjectFormat format)
+	{ return format == ObjectFormat::ExifJpeg || format == ObjectFormat::Jfif || format == ObjectFormat::UndefinedImage || format == Heif; }
+
+	bool ThumbnailFetcher::MayHaveThumbnail(ObjectFormat format)
+	{
+		switch(format)
+		{
+		case ObjectFormat::Avi:
+		case ObjectFormat::Mpeg:
+		case ObjectFormat::Asf:
+		case ObjectFormat::Wmv:
+		case ObjectFormat::Mp4:
+		case ObjectFormat::_3gp:
+			return true;
+		default:
+			return format == Heif || (static_cast<unsigned>(format) & 0xff00) == 0x3800; //image formats
+		}
+	}
+
+	ByteArray ThumbnailFetcher::ExtractExifThumbnail(const ByteArray &head)
+	{
+		const u8 *data = head.data();
+		size_t size = head.size();
+		if (size >= 4 && data[0] == 0xff && data[1] == 0xd8)
+		{
+			//walk jpeg segments up to APP1
+			size_t pos = 2;
+			while(pos + 4 <= size && data[pos] == 0xff)
+			{
+				u8 marker = data[pos + 1];
+				size_t length = (data[pos + 2] << 8) | data[pos + 3];
+				if (marker == 0xda || length < 2) //start of scan, no metadata past this point
+					break;
+				size_t payload = pos + 4;
+				if (marker == 0xe1 && payload + sizeof(ExifSignature) <= size && memcmp(data + payload, ExifSignature, sizeof(ExifSignature)) == 0)
+				{
+					size_t tiff = payload + sizeof(ExifSignature);
+					size_t end = std::min(size, pos + 2 + length);
+					return ParseTiff(data + tiff, end - tiff);
+				}
+				pos += 2 + length;
+			}
+			return ByteArray();
+		}
+
+		//heif keeps exif in an item payload, locating it via iloc is not worth it for a thumbnail, look for the signature instead
+		for(size_t pos = 0; pos + sizeof(ExifSignature) + 8 <= size; ++pos)
+		{
+			const u8 *p = static_cast<const u8 *>(memchr(data + pos, 'E', size - pos - sizeof(ExifSignature) - 8 + 1));
+			if (!p)
+				break;
+			pos = p - data;
+			if (memcmp(p, ExifSignature, sizeof(ExifSignature)) == 0)
+			{
+				ByteArray thumb = ParseTiff(p + sizeof(ExifSignature), size - pos - sizeof(ExifSignature));
+				if (!thumb.empty())
+					return thumb;
+			}
+		}
+		return ByteArray();
+	}
+
+	double ThumbnailFetcher::Elapsed(std::chrono::steady_clock::time_point start)
+	{ return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count(); }
+
+	ThumbnailFetcher::Source ThumbnailFetcher::Choose() const
+	{
+		if (_source != Source::Auto)
+			return _source;
+		if (_exif.Count < Probes)
+			return _device.Count < _exif.Count? Source::Device: Source::Exif;
+		if (_device.Count < Probes)
+			return Source::Device;
+		return GetChosenSource();
+	}
+
+	ThumbnailFetcher::Source ThumbnailFetcher::GetChosenSource() const
+	{
+		if (_source != Source::Auto)
+			return _source;
+		if (_exif.Count < Probes || _device.Count < Probes)
+			return Source::Auto;
+		//images without embedded thumbnail pay for both requests, which is accounted in exif timing
+		bool exifUseful = _exif.Failures * 2 <= _exif.Count;
+		return exifUseful && _exif.GetAverage() < _device.GetAverage()? Source::Exif: Source::Device;
+	}
+
+	ByteArray ThumbnailFetcher::GetDeviceThumb(ObjectId objectId)
+	{
+		auto stream = std::make_shared<MemoryObjectOutputStream>();
+		_session->GetThumb(objectId, stream);
+		return *stream->GetData();
+	}
+
+	ByteArray ThumbnailFetcher::Get(ObjectId objectId, ObjectFormat format)
+	{
+		bool exifPossible = MayHaveExif(format) && _session->GetCapabilities().Supports(OperationCode::GetPartialObject);
+		Source source = exifPossible? Choose(): Source::Device;
+		auto start = std::chrono::steady_clock::now();
+		if (source == Source::Device)
+		{
+			ByteArray thumb = GetDeviceThumb(objectId);
+			if (exifPossible)
+			{
+				++_device.Count;
+				_device.Seconds += Elapsed(start);
+			}
+			return thumb;
+		}
+
+		ByteArray thumb;
+		try
+		{ thumb = ExtractExifThumbnail(_session->GetPartialObject(objectId, 0, HeadSize)); }
+		catch(const std::exception &ex)
+		{ debug("GetPartialObject for exif thumbnail failed: ", ex.what()); }
+
+		bool failed = thumb.empty();
+		if (failed)
+			thumb = GetDeviceThumb(objectId);
+		++_exif.Count;
+		_exif.Failures += failed;
+		_exif.Seconds += Elapsed(start);
+		return thumb;
+	}
+
+}
@@ -0,0 +1,86 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_THUMBNAILFETCHER_H
+#define AFT_PTP_THUMBNAILFETCHER_H
+
+#include <mtp/ptp/Session.h>
+#include <chrono>
+
+namespace mtp
+{
+
+	class ThumbnailFetcher //! gets thumbnails with GetThumb or from exif header fetched with GetPartialObject, whichever is faster on this device; not thread-safe
+	{
+	public:
+		enum struct Source
+		{
+			Auto,		///< measures both sources on first images, then sticks to the faster one
+			Device,		///< GetThumb only
+			Exif		///< embedded exif thumbnail, GetThumb if image has none
+		};
+
+		static constexpr u32	HeadSize		= 64 * 1024;	///< exif APP1 segment can't be larger
+		static constexpr int	Probes			= 4;			///< samples of each source before choosing
+		static constexpr ObjectFormat Heif		= static_cast<ObjectFormat>(0xb986); ///< android extension
+
+	private:
+		struct Sample
+		{
+			int		Count;
+			int		Failures;
+			double	Seconds;
+
+			Sample(): Count(0), Failures(0), Seconds(0) { }
+
+			double GetAverage() const
+			{ return Count? Seconds / Count: 0; }
+		};
+
+		SessionPtr		_session;
+		Source			_source;
+		Sample			_device, _exif;
+
+		Source Choose() const;
+		ByteArray GetDeviceThumb(ObjectId objectId);
+		static double Elapsed(std::chrono::steady_clock::time_point start);
+
+	public:
+		ThumbnailFetcher(const SessionPtr &session, Source source = Source::Auto);
+
+		void SetSource(Source source)
+		{ _source = source; }
+
+		///source Auto settled on, Auto while still measuring
+		Source GetChosenSource() const;
+
+		///returns encoded image, empty if device has no thumbnail for object
+		ByteArray Get(ObjectId objectId, ObjectFormat format);
+
+		static bool MayHaveExif(ObjectFormat format);
+		///returns true for image and video formats devices generate thumbnails for
+		static bool MayHaveThumbnail(ObjectFormat format);
+		///returns jpeg thumbnail from IFD1 of exif data found at the start of jpeg or heif file, empty if there's none or it's truncated
+		static ByteArray ExtractExifThumbnail(const ByteArray &head);
+	};
+	DECLARE_PTR(ThumbnailFetcher);
+
+}
+
+#endif
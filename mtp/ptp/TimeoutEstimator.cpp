@@ -0,0 +1,56 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/TimeoutEstimator.h>
+#include <algorithm>
+
+namespace mtp
+{
+
+	namespace
+	{
+		const double Weight = 0.25; //of the newest sample in moving average
+
+		void Average(double &value, double sample)
+		{ value = value > 0? value + Weight * (sample - value): sample; }
+	}
+
+	void TimeoutEstimator::Record(u64 bytes, Duration duration)
+	{
+		double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+		if (seconds <= 0)
+			return;
+
+		if (bytes <= MaxLatencySample)
+			Average(_latency, seconds);
+		else if (bytes >= MinBandwidthSample)
+			Average(_bandwidth, bytes / seconds);
+	}
+
+	int TimeoutEstimator::GetStallTimeout(int fallback) const
+	{
+		if (_bandwidth <= 0)
+			return fallback;
+
+		double chunkTime = _latency + MaxChunkSize / _bandwidth;
+		double timeout = StallFactor * chunkTime * 1000;
+		return static_cast<int>(std::min<double>(fallback, std::max<double>(MinStallTimeout, timeout)));
+	}
+
+}
@@ -0,0 +1,62 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_TIMEOUTESTIMATOR_H
+#define AFT_PTP_TIMEOUTESTIMATOR_H
+
+#include <mtp/types.h>
+#include <chrono>
+
+namespace mtp
+{
+
+	class TimeoutEstimator //! learns response latency and bulk bandwidth of the device to tell stalled transfer from slow one
+	{
+	public:
+		typedef std::chrono::steady_clock::duration Duration;
+
+		static constexpr u64	MinBandwidthSample	= 256 * 1024;	///< smaller transactions are dominated by latency
+		static constexpr u64	MaxLatencySample	= 4096;			///< larger ones are dominated by transfer time
+		static constexpr u64	MaxChunkSize		= 1024 * 1024;	///< largest single bulk transfer issued by usb backends
+		static constexpr int	StallFactor			= 8;
+		static constexpr int	MinStallTimeout		= 5000;			///< devices pause for a few seconds on flash garbage collection
+
+	private:
+		double		_latency; //seconds, 0 until first sample
+		double		_bandwidth; //bytes per second, 0 until first sample
+
+	public:
+		TimeoutEstimator(): _latency(0), _bandwidth(0)
+		{ }
+
+		///accounts successful transaction
+		void Record(u64 bytes, Duration duration);
+
+		double GetLatency() const
+		{ return _latency; }
+		double GetBandwidth() const
+		{ return _bandwidth; }
+
+		///how long transfer which already started may wait for its next chunk, fallback if bandwidth is not known yet
+		int GetStallTimeout(int fallback) const;
+	};
+
+}
+
+#endif
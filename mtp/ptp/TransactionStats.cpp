@@ -0,0 +1,94 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/ptp/TransactionStats.h>
+
+namespace mtp
+{
+
+	unsigned OperationStats::GetLatencyBucket(u64 latencyUs)
+	{
+		u64 ms = latencyUs / 1000;
+		unsigned bucket = 0;
+		while(ms != 0 && bucket + 1 < LatencyBuckets)
+		{
+			ms >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+
+	u64 OperationStats::GetLatencyPercentileUs(unsigned percentile) const
+	{
+		if (Count == 0)
+			return 0;
+
+		u64 threshold = (Count * percentile + 99) / 100;
+		u64 total = 0;
+		for(unsigned bucket = 0; bucket + 1 < LatencyBuckets; ++bucket)
+		{
+			total += LatencyHistogram[bucket];
+			if (total >= threshold)
+				return std::min<u64>((1000ull << bucket), MaxLatencyUs);
+		}
+		return MaxLatencyUs;
+	}
+
+	void TransactionStats::Record(OperationCode code, std::chrono::steady_clock::duration latency, u64 bytesIn, u64 bytesOut, Result result)
+	{
+		u64 latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+		scoped_mutex_lock l(_mutex);
+		OperationStats &stats = _operations[code];
+		++stats.Count;
+		switch(result)
+		{
+		case Result::OK:
+			break;
+		case Result::Error:
+			++stats.Errors;
+			break;
+		case Result::Timeout:
+			++stats.Timeouts;
+			break;
+		case Result::Aborted:
+			++stats.Aborts;
+			break;
+		}
+		stats.BytesIn += bytesIn;
+		stats.BytesOut += bytesOut;
+		stats.TotalLatencyUs += latencyUs;
+		if (latencyUs > stats.MaxLatencyUs)
+			stats.MaxLatencyUs = latencyUs;
+		++stats.LatencyHistogram[OperationStats::GetLatencyBucket(latencyUs)];
+	}
+
+	TransactionStats::Snapshot TransactionStats::GetSnapshot() const
+	{
+		scoped_mutex_lock l(_mutex);
+		return _operations;
+	}
+
+	void TransactionStats::Reset()
+	{
+		scoped_mutex_lock l(_mutex);
+		_operations.clear();
+	}
+
+}
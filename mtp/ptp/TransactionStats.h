@@ -0,0 +1,94 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_PTP_TRANSACTIONSTATS_H
+#define AFT_PTP_TRANSACTIONSTATS_H
+
+#include <mtp/ptp/OperationCode.h>
+#include <mtp/types.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+namespace mtp
+{
+
+	struct OperationStats //! accumulated counters for single operation code
+	{
+		///bucket 0 counts transactions faster than 1ms, bucket n - [2^(n-1), 2^n) ms, the last one is open-ended
+		static constexpr unsigned LatencyBuckets = 16;
+
+		u64		Count;
+		u64		Errors;
+		u64		Timeouts;
+		u64		Aborts;
+		u64		BytesIn;
+		u64		BytesOut;
+		u64		TotalLatencyUs;
+		u64		MaxLatencyUs;
+		std::array<u64, LatencyBuckets> LatencyHistogram;
+
+		OperationStats(): Count(), Errors(), Timeouts(), Aborts(), BytesIn(), BytesOut(), TotalLatencyUs(), MaxLatencyUs()
+		{ LatencyHistogram.fill(0); }
+
+		u64 GetAverageLatencyUs() const
+		{ return Count? TotalLatencyUs / Count: 0; }
+
+		///upper bound of the bucket containing given percentile (0-100) in microseconds
+		u64 GetLatencyPercentileUs(unsigned percentile) const;
+
+		static unsigned GetLatencyBucket(u64 latencyUs);
+	};
+
+	class TransactionStats : Noncopyable //! per-operation transaction counters, disabled by default, collected only while enabled
+	{
+	public:
+		enum struct Result
+		{
+			OK, Error, Timeout, Aborted
+		};
+
+		typedef std::map<OperationCode, OperationStats> Snapshot;
+
+	private:
+		std::atomic_bool	_enabled;
+		mutable std::mutex	_mutex;
+		Snapshot			_operations;
+
+	public:
+		TransactionStats(): _enabled(false)
+		{ }
+
+		void SetEnabled(bool enabled)
+		{ _enabled.store(enabled, std::memory_order_relaxed); }
+		bool IsEnabled() const
+		{ return _enabled.load(std::memory_order_relaxed); }
+
+		void Record(OperationCode code, std::chrono::steady_clock::duration latency, u64 bytesIn, u64 bytesOut, Result result);
+
+		///copy of all counters collected so far
+		Snapshot GetSnapshot() const;
+		void Reset();
+	};
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef AFS_MTP_PTP_UTF16_H
+#define	AFS_MTP_PTP_UTF16_H
+
+#include <mtp/types.h>
+#include <mtp/ByteArray.h>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#	include <emmintrin.h>
+#	define AFT_UTF16_SSE2
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#	include <arm_neon.h>
+#	define AFT_UTF16_NEON
+#endif
+
+namespace mtp
+{
+	namespace impl
+	{
+		inline u16 LoadUtf16(const u8 *src)
+		{ return src[0] | (static_cast<u16>(src[1]) << 8); }
+
+		///copies leading run of non-zero ascii code units, returns number of units consumed
+		inline size_t DecodeAsciiRun(std::string &dst, const u8 *src, size_t units)
+		{
+			size_t i = 0;
+#if defined(AFT_UTF16_SSE2)
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xff80));
+			for(; i + 8 <= units; i += 8)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+				__m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, nonAscii), zero);
+				__m128i nul = _mm_cmpeq_epi16(v, zero);
+				if (_mm_movemask_epi8(_mm_andnot_si128(nul, ascii)) != 0xffff)
+					break;
+				char buf[16];
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(buf), _mm_packus_epi16(v, v));
+				dst.append(buf, 8);
+			}
+#elif defined(AFT_UTF16_NEON)
+			const uint16x8_t ascii = vdupq_n_u16(0x80);
+			const uint16x8_t zero = vdupq_n_u16(0);
+			for(; i + 8 <= units; i += 8)
+			{
+				uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(src + 2 * i)); //data is not 2-byte aligned
+				uint16x8_t bad = vorrq_u16(vcgeq_u16(v, ascii), vceqq_u16(v, zero));
+				if (vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(bad)), 0))
+					break;
+				char buf[8];
+				vst1_u8(reinterpret_cast<uint8_t *>(buf), vmovn_u16(v));
+				dst.append(buf, 8);
+			}
+#endif
+			for(; i < units; ++i)
+			{
+				u16 ch = LoadUtf16(src + 2 * i);
+				if (ch == 0 || ch > 0x7f)
+					break;
+				dst += static_cast<char>(ch);
+			}
+			return i;
+		}
+
+		///copies leading run of ascii characters as UTF-16LE code units, returns number of bytes consumed
+		inline size_t EncodeAsciiRun(ByteArray &dst, const std::string &src, size_t p)
+		{
+			size_t begin = p, size = src.size();
+			const u8 *data = reinterpret_cast<const u8 *>(src.data());
+#if defined(AFT_UTF16_SSE2)
+			const __m128i zero = _mm_setzero_si128();
+			for(; p + 16 <= size; p += 16)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + p));
+				if (_mm_movemask_epi8(v))
+					break;
+				size_t offset = dst.size();
+				dst.resize(offset + 32);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[offset]), _mm_unpacklo_epi8(v, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[offset + 16]), _mm_unpackhi_epi8(v, zero));
+			}
+#elif defined(AFT_UTF16_NEON)
+			for(; p + 16 <= size; p += 16)
+			{
+				uint8x16_t v = vld1q_u8(data + p);
+				uint8x8_t high = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+				if (vget_lane_u64(vreinterpret_u64_u8(high), 0) & 0x8080808080808080ull)
+					break;
+				size_t offset = dst.size();
+				dst.resize(offset + 32);
+				vst1q_u8(&dst[offset], vreinterpretq_u8_u16(vmovl_u8(vget_low_u8(v))));
+				vst1q_u8(&dst[offset + 16], vreinterpretq_u8_u16(vmovl_u8(vget_high_u8(v))));
+			}
+#endif
+			for(; p < size && data[p] < 0x80; ++p)
+			{
+				dst.push_back(data[p]);
+				dst.push_back(0);
+			}
+			return p - begin;
+		}
+
+		inline void AppendUtf8(std::string &dst, u32 ch)
+		{
+			if (ch <= 0x7f)
+				dst += static_cast<char>(ch);
+			else if (ch <= 0x7ff)
+			{
+				dst += static_cast<char>((ch >> 6) | 0xc0);
+				dst += static_cast<char>((ch & 0x3f) | 0x80);
+			}
+			else if (ch <= 0xffff)
+			{
+				dst += static_cast<char>((ch >> 12) | 0xe0);
+				dst += static_cast<char>(((ch >> 6) & 0x3f) | 0x80);
+				dst += static_cast<char>((ch & 0x3f) | 0x80);
+			}
+			else
+			{
+				dst += static_cast<char>((ch >> 18) | 0xf0);
+				dst += static_cast<char>(((ch >> 12) & 0x3f) | 0x80);
+				dst += static_cast<char>(((ch >> 6) & 0x3f) | 0x80);
+				dst += static_cast<char>((ch & 0x3f) | 0x80);
+			}
+		}
+
+		inline void AppendUtf16(ByteArray &dst, u16 unit)
+		{
+			dst.push_back(unit);
+			dst.push_back(unit >> 8);
+		}
+	}
+
+	///appends UTF-8 representation of UTF-16LE units to dst, null characters are skipped, unpaired surrogates are replaced with U+FFFD
+	inline void DecodeUtf16(std::string &dst, const u8 *src, size_t units)
+	{
+		dst.reserve(dst.size() + units);
+		size_t i = 0;
+		while(i < units)
+		{
+			i += impl::DecodeAsciiRun(dst, src + 2 * i, units - i);
+			if (i >= units)
+				break;
+
+			u32 ch = impl::LoadUtf16(src + 2 * i++);
+			if (ch == 0)
+				continue;
+			if (ch >= 0xd800 && ch <= 0xdbff && i < units)
+			{
+				u16 low = impl::LoadUtf16(src + 2 * i);
+				if (low >= 0xdc00 && low <= 0xdfff)
+				{
+					ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+					++i;
+				}
+			}
+			if (ch >= 0xd800 && ch <= 0xdfff)
+				ch = 0xfffd;
+			impl::AppendUtf8(dst, ch);
+		}
+	}
+
+	namespace impl
+	{
+		const u32 InvalidCodePoint = 0xffffffffu;
+
+		///decodes non-ascii UTF-8 sequence starting at p, advances p, returns InvalidCodePoint for malformed input
+		inline u32 DecodeUtf8(const std::string &value, size_t &p)
+		{
+			size_t size = value.size();
+			u8 c0 = value[p++];
+			size_t extra = c0 >= 0xf0? 3: c0 >= 0xe0? 2: 1;
+			if (c0 < 0xc2 || c0 > 0xf4 || p + extra > size)
+				return InvalidCodePoint;
+
+			u32 ch = c0 & (0x3f >> extra);
+			for(size_t i = 0; i < extra; ++i)
+			{
+				u8 c = value[p];
+				if ((c & 0xc0) != 0x80)
+					return InvalidCodePoint;
+				ch = (ch << 6) | (c & 0x3f);
+				++p;
+			}
+
+			if (ch > 0x10ffff || (ch >= 0xd800 && ch <= 0xdfff))
+				return InvalidCodePoint;
+			return ch;
+		}
+	}
+
+	///returns number of UTF-16 code units EncodeUtf16 produces for value
+	inline size_t Utf16Length(const std::string &value)
+	{
+		size_t units = 0, p = 0, size = value.size();
+		while(p < size)
+		{
+			if (static_cast<u8>(value[p]) < 0x80)
+			{
+				++p;
+				++units;
+				continue;
+			}
+			u32 ch = impl::DecodeUtf8(value, p);
+			units += ch != impl::InvalidCodePoint && ch >= 0x10000? 2: 1;
+		}
+		return units;
+	}
+
+	///appends UTF-16LE code units of UTF-8 string to dst, invalid sequences are replaced with '?'
+	inline void EncodeUtf16(ByteArray &dst, const std::string &value)
+	{
+		dst.reserve(dst.size() + 2 * value.size());
+		size_t p = 0, size = value.size();
+		while(p < size)
+		{
+			p += impl::EncodeAsciiRun(dst, value, p);
+			if (p >= size)
+				break;
+
+			u32 ch = impl::DecodeUtf8(value, p);
+			if (ch == impl::InvalidCodePoint)
+				impl::AppendUtf16(dst, '?');
+			else if (ch >= 0x10000)
+			{
+				ch -= 0x10000;
+				impl::AppendUtf16(dst, 0xd800 | (ch >> 10));
+				impl::AppendUtf16(dst, 0xdc00 | (ch & 0x3ff));
+			}
+			else
+				impl::AppendUtf16(dst, ch);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,167 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <mtp/usb/BufferPool.h>
+#include <mtp/log.h>
+#include <Exception.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace mtp { namespace usb
+{
+
+	BufferPool::BufferPool(bool deviceMemory): _memoryLimit(DefaultMemoryLimit), _deviceMemory(deviceMemory), _pageSize(sysconf(_SC_PAGESIZE))
+	{
+		if (_pageSize <= 0)
+			throw posix::Exception("sysconf(_SC_PAGESIZE)");
+		debug("page size = ", _pageSize, ", zerocopy ", _deviceMemory? "enabled": "disabled");
+	}
+
+	BufferPool::~BufferPool()
+	{ Clear(); }
+
+	void BufferPool::Clear()
+	{
+		scoped_mutex_lock l(_mutex);
+		for(auto & kv : _blocks)
+			FreeBlock(kv.first, kv.second);
+		_blocks.clear();
+		for(auto & list : _free)
+			list.clear();
+	}
+
+	size_t BufferPool::GetSizeClass(size_t size)
+	{
+		size_t sizeClass = 0;
+		while(GetClassSize(sizeClass) < size)
+			++sizeClass;
+		return sizeClass;
+	}
+
+	u8 * BufferPool::AllocateBlock(size_t sizeClass)
+	{
+		size_t size = GetBlockSize(sizeClass);
+		if (_deviceMemory)
+		{
+			u8 * buffer = AllocateDeviceMemory(size);
+			if (buffer)
+			{
+				debug("mapped buffer of ", size, " bytes to ", buffer);
+				_blocks[buffer] = Block { sizeClass, true };
+				return buffer;
+			}
+			error("zerocopy allocator failed, falling back to normal buffers");
+			_deviceMemory = false;
+		}
+		void * buffer = nullptr;
+		int r = posix_memalign(&buffer, _pageSize, size);
+		if (r != 0)
+			throw posix::Exception("posix_memalign", r);
+		_blocks[static_cast<u8 *>(buffer)] = Block { sizeClass, false };
+		return static_cast<u8 *>(buffer);
+	}
+
+	void BufferPool::FreeBlock(u8 *data, const Block &block)
+	{
+		if (block.Device)
+			FreeDeviceMemory(data, GetBlockSize(block.SizeClass));
+		else
+			free(data);
+	}
+
+	//releases cached free blocks until there's enough space for size bytes
+	bool BufferPool::Reclaim(size_t size)
+	{
+		for(size_t sizeClass = SizeClasses; sizeClass-- > 0 && _stats.Reserved + size > _memoryLimit; )
+		{
+			auto & list = _free[sizeClass];
+			while(!list.empty() && _stats.Reserved + size > _memoryLimit)
+			{
+				u8 * data = list.back();
+				list.pop_back();
+				auto it = _blocks.find(data);
+				_stats.Reserved -= GetBlockSize(it->second.SizeClass);
+				FreeBlock(data, it->second);
+				_blocks.erase(it);
+			}
+		}
+		return _stats.Reserved + size <= _memoryLimit;
+	}
+
+	BufferPool::Mode BufferPool::GetMode()
+	{
+		scoped_mutex_lock l(_mutex);
+		return _deviceMemory? Mode::Device: Mode::Heap;
+	}
+
+	void BufferPool::SetMemoryLimit(size_t limit)
+	{
+		scoped_mutex_lock l(_mutex);
+		_memoryLimit = limit;
+	}
+
+	BufferPool::Stats BufferPool::GetStats()
+	{
+		scoped_mutex_lock l(_mutex);
+		return _stats;
+	}
+
+	void BufferPool::Free(Buffer &buffer)
+	{
+		scoped_mutex_lock l(_mutex);
+		auto it = _blocks.find(buffer.GetData());
+		if (it == _blocks.end())
+			throw std::logic_error("BufferPool::Free: unknown buffer");
+		_stats.Allocated -= GetBlockSize(it->second.SizeClass);
+		_free[it->second.SizeClass].push_back(buffer.GetData());
+	}
+
+	Buffer BufferPool::Allocate(size_t size)
+	{
+		scoped_mutex_lock l(_mutex);
+		if (size > MaxBufferSize)
+			size = MaxBufferSize;
+
+		size_t sizeClass = GetSizeClass(size);
+		size_t blockSize = GetBlockSize(sizeClass);
+		auto & list = _free[sizeClass];
+		u8 * data;
+		if (!list.empty())
+		{
+			data = list.back();
+			list.pop_back();
+		}
+		else
+		{
+			if (!Reclaim(blockSize))
+			{
+				++_stats.Failures;
+				throw std::runtime_error("BufferPool::Allocate: memory limit reached");
+			}
+			data = AllocateBlock(sizeClass);
+			_stats.Reserved += blockSize;
+			_stats.HighWaterMark = std::max(_stats.HighWaterMark, _stats.Reserved);
+		}
+		_stats.Allocated += blockSize;
+		++_stats.Allocations;
+		return Buffer(data, size);
+	}
+
+}}
@@ -0,0 +1,149 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef AFT_USB_BUFFERPOOL_H
+#define AFT_USB_BUFFERPOOL_H
+
+#include <mtp/types.h>
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace mtp { namespace usb
+{
+	class Buffer //! memory block borrowed from \ref BufferPool, returned with BufferPool::Free
+	{
+		u8 *				_data;
+		size_t				_size;
+
+	public:
+		Buffer(): _data(), _size(0)
+		{ }
+		Buffer(u8 *data, size_t size): _data(data), _size(size)
+		{ }
+
+		u8 * GetData() const
+		{ return _data; }
+		size_t GetSize() const
+		{ return _size; }
+	};
+
+	class BufferPool : Noncopyable //! caches transfer buffers by size class, backends override AllocateMemory to hand out memory controller can use directly
+	{
+	public:
+		enum struct Mode
+		{
+			Heap,	//!< plain memory, kernel or usb library copies transfer data
+			Device	//!< memory shared with usb controller, zero-copy
+		};
+
+		struct Stats
+		{
+			size_t		Allocated;		//!< bytes currently handed out
+			size_t		Reserved;		//!< bytes held by pool, including free lists
+			size_t		HighWaterMark;	//!< maximum of Reserved
+			size_t		Allocations;
+			size_t		Failures;		//!< allocations refused because of memory limit
+
+			Stats(): Allocated(0), Reserved(0), HighWaterMark(0), Allocations(0), Failures(0)
+			{ }
+		};
+
+		static constexpr size_t MinBufferSize		= 16 * 1024;
+		static constexpr size_t MaxBufferSize		= 1024 * 1024;
+		static constexpr size_t DefaultMemoryLimit	= 32 * 1024 * 1024;
+
+	private:
+		static constexpr size_t SizeClasses			= 7; //16k..1M
+
+		struct Block
+		{
+			size_t		SizeClass;
+			bool		Device;
+		};
+
+		std::mutex	_mutex;
+		size_t		_memoryLimit;
+		Stats		_stats;
+		bool		_deviceMemory; //cleared when backend fails to allocate device memory
+		long		_pageSize;
+
+		std::array<std::vector<u8 *>, SizeClasses>	_free;
+		std::unordered_map<u8 *, Block>				_blocks;
+
+		static size_t GetClassSize(size_t sizeClass)
+		{ return MinBufferSize << sizeClass; }
+
+		static size_t GetSizeClass(size_t size);
+		size_t GetBlockSize(size_t sizeClass) const
+		{ return (GetClassSize(sizeClass) + _pageSize - 1) / _pageSize * _pageSize; }
+
+		u8 * AllocateBlock(size_t sizeClass);
+		void FreeBlock(u8 *data, const Block &block);
+		bool Reclaim(size_t size);
+
+	protected:
+		///returns device memory block of given size (multiple of page size) or null if backend has none, pool switches to heap memory then
+		virtual u8 * AllocateDeviceMemory(size_t size)
+		{ return nullptr; }
+		virtual void FreeDeviceMemory(u8 *data, size_t size)
+		{ }
+
+		///pool must be cleared by derived class destructor while its device memory hooks are still available
+		void Clear();
+
+	public:
+		BufferPool(bool deviceMemory = false);
+		virtual ~BufferPool();
+
+		///returns zero-copy mode used for newly allocated buffers
+		Mode GetMode();
+
+		///sets maximum amount of memory held by pool, free blocks are released on demand
+		void SetMemoryLimit(size_t limit);
+
+		Stats GetStats();
+
+		///allocates buffer of at least MinBufferSize, requests larger than MaxBufferSize are clamped
+		Buffer Allocate(size_t size);
+		void Free(Buffer &buffer);
+	};
+	DECLARE_PTR(BufferPool);
+
+	class PooledBuffer : Noncopyable //! holds buffer borrowed from pool for its lifetime
+	{
+		BufferPoolPtr	_pool;
+		Buffer			_buffer;
+
+	public:
+		PooledBuffer(const BufferPoolPtr &pool, size_t size): _pool(pool), _buffer(pool->Allocate(size))
+		{ }
+		~PooledBuffer()
+		{ _pool->Free(_buffer); }
+
+		u8 * GetData() const
+		{ return _buffer.GetData(); }
+		size_t GetSize() const
+		{ return _buffer.GetSize(); }
+	};
+
+}}
+
+#endif
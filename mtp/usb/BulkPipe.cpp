@@ -23,6 +23,8 @@
 #include <mtp/ptp/ByteArrayObjectStream.h>
 #include <mtp/log.h>
 
+#include <algorithm>
+
 namespace mtp { namespace usb
 {
 	BulkPipe::BulkPipe(DevicePtr device, ConfigurationPtr conf, InterfacePtr interface, EndpointPtr in, EndpointPtr out, EndpointPtr interrupt, ITokenPtr claimToken):
@@ -33,28 +35,63 @@ namespace mtp { namespace usb
 			_device->SetConfiguration(conf->GetIndex());
 	}
 
+	BulkPipe::BulkPipe()
+	{ }
+
 	BulkPipe::~BulkPipe()
 	{ }
 
 	DevicePtr BulkPipe::GetDevice() const
 	{ return _device; }
 
-	ByteArray BulkPipe::ReadInterrupt()
+	BufferPoolPtr BulkPipe::GetBufferPool() const
+	{
+		DevicePtr device = GetDevice();
+		return device? device->GetBufferPool(): BufferPoolPtr();
+	}
+
+	namespace
 	{
-#if 0
-#warning causes out of memory errors in some time
-		ByteArrayObjectOutputStreamPtr s(new ByteArrayObjectOutputStream());
-		try { _device->ReadBulk(_interrupt, s, 0); } catch(const TimeoutException &ex) { return ByteArray(); }
-		return std::move(s->GetData());
-#else
-		return ByteArray();
-#endif
+		class InterruptOutputStream final: public IObjectOutputStream, public CancellableStream //! collects interrupt data into caller's buffer, drops anything above MaxInterruptSize
+		{
+			ByteArray &	_data;
+
+		public:
+			InterruptOutputStream(ByteArray &data): _data(data)
+			{ _data.clear(); }
+
+			virtual size_t Write(const u8 *data, size_t size)
+			{
+				size_t n = std::min(size, BulkPipe::MaxInterruptSize - std::min(_data.size(), BulkPipe::MaxInterruptSize));
+				_data.insert(_data.end(), data, data + n);
+				return size;
+			}
+		};
+	}
+
+	bool BulkPipe::ReadInterrupt(ByteArray &data, int timeout)
+	{
+		//previous implementation read interrupt endpoint in line with every transaction, growing fresh buffer each time
+		data.reserve(MaxInterruptSize);
+		auto stream = std::make_shared<InterruptOutputStream>(data);
+		try
+		{ _device->ReadBulk(_interrupt, stream, timeout); }
+		catch(const TimeoutException &ex)
+		{
+			data.clear();
+			return false;
+		}
+		return !data.empty();
 	}
 
 	void BulkPipe::SetCurrentStream(const ICancellableStreamPtr &stream)
 	{
-		scoped_mutex_lock l(_mutex);
-		_currentStream = stream;
+		ICancellableStreamPtr previous(stream);
+		{
+			scoped_mutex_lock l(_mutex);
+			std::swap(_currentStream, previous);
+		}
+		//previous stream is released outside of the lock
 	}
 
 	ICancellableStreamPtr BulkPipe::GetCurrentStream()
@@ -69,7 +106,7 @@ namespace mtp { namespace usb
 		BulkPipe *					_owner;
 
 	public:
-		CurrentStreamSetter(BulkPipe *owner, ICancellableStreamPtr stream): _owner(owner)
+		CurrentStreamSetter(BulkPipe *owner, const ICancellableStreamPtr &stream): _owner(owner)
 		{ _owner->SetCurrentStream(stream); }
 		~CurrentStreamSetter()
 		{ _owner->SetCurrentStream(nullptr); }
@@ -77,13 +114,13 @@ namespace mtp { namespace usb
 
 	void BulkPipe::Read(const IObjectOutputStreamPtr &outputStream, int timeout)
 	{
-		CurrentStreamSetter s(this, std::dynamic_pointer_cast<ICancellableStream>(outputStream));
+		CurrentStreamSetter s(this, outputStream); //streams derive from ICancellableStream, no runtime cast needed
 		_device->ReadBulk(_in, outputStream, timeout);
 	}
 
 	void BulkPipe::Write(const IObjectInputStreamPtr &inputStream, int timeout)
 	{
-		CurrentStreamSetter s(this, std::dynamic_pointer_cast<ICancellableStream>(inputStream));
+		CurrentStreamSetter s(this, inputStream);
 		_device->WriteBulk(_out, inputStream, timeout);
 	}
 
@@ -93,6 +130,12 @@ namespace mtp { namespace usb
 		print("cancelling stream ", stream.get());
 		if (stream)
 			stream->Cancel();
+		if (_device)
+		{
+			//stream flag is checked only when data arrives, discarding transfers wakes up waiting thread at once
+			_device->Cancel(_in);
+			_device->Cancel(_out);
+		}
 	}
 
 	BulkPipePtr BulkPipe::Create(const usb::DevicePtr & device, const ConfigurationPtr & conf, const usb::InterfacePtr & interface, ITokenPtr claimToken)
@@ -36,6 +36,8 @@ namespace mtp { namespace usb
 	DECLARE_PTR(Endpoint);
 	class BulkPipe;
 	DECLARE_PTR(BulkPipe);
+	class BufferPool;
+	DECLARE_PTR(BufferPool);
 
 	class BulkPipe //! USB BulkPipe, incapsulate three (in, out, interrupt) endpoints, allowing easier data transfer
 	{
@@ -47,6 +49,9 @@ namespace mtp { namespace usb
 		ITokenPtr				_claimToken;
 		ICancellableStreamPtr	_currentStream;
 
+	protected:
+		BulkPipe(); ///< used by software pipes without underlying usb device (e.g. \ref mtp::mock::BulkPipe)
+
 	private:
 		void SetCurrentStream(const ICancellableStreamPtr &stream);
 		ICancellableStreamPtr GetCurrentStream();
@@ -55,15 +60,20 @@ namespace mtp { namespace usb
 
 	public:
 		BulkPipe(DevicePtr device, ConfigurationPtr conf, InterfacePtr interface, EndpointPtr in, EndpointPtr out, EndpointPtr interrupt, ITokenPtr claimToken);
-		~BulkPipe();
+		virtual ~BulkPipe();
+
+		virtual DevicePtr GetDevice() const;
+		///buffers of usb device, null for software pipes
+		BufferPoolPtr GetBufferPool() const;
 
-		DevicePtr GetDevice() const;
+		static const size_t MaxInterruptSize = 512; ///< event container with all parameters fits easily
 
-		ByteArray ReadInterrupt();
+		///reads one interrupt transfer into data reusing its capacity, returns false on timeout
+		virtual bool ReadInterrupt(ByteArray &data, int timeout);
 
-		void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000);
-		void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000);
-		void Cancel();
+		virtual void Read(const IObjectOutputStreamPtr &outputStream, int timeout = 10000);
+		virtual void Write(const IObjectInputStreamPtr &inputStream, int timeout = 10000);
+		virtual void Cancel();
 
 		static BulkPipePtr Create(const usb::DevicePtr & device, const ConfigurationPtr & conf, const usb::InterfacePtr & owner, ITokenPtr claimToken);
 	};
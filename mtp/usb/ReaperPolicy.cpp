@@ -0,0 +1,161 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <mtp/usb/ReaperPolicy.h>
+#include <mtp/log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#	include <sys/syscall.h>
+#endif
+
+namespace mtp { namespace usb
+{
+
+	namespace
+	{
+		const unsigned MaxCpus = 1024; //CPU_SETSIZE of glibc
+
+		unsigned ParseNumber(const std::string &spec, const std::string &value)
+		{
+			char *end;
+			unsigned long n = strtoul(value.c_str(), &end, 10);
+			if (value.empty() || *end)
+				throw std::runtime_error("invalid number " + value + " in reaper policy " + spec);
+			return n;
+		}
+	}
+
+	ReaperPolicy ReaperPolicy::Parse(const std::string &spec)
+	{
+		ReaperPolicy policy;
+		policy.Enabled = true;
+
+		std::string scheduling = spec, cpus;
+		size_t at = spec.find('@');
+		if (at != spec.npos)
+		{
+			scheduling = spec.substr(0, at);
+			cpus = spec.substr(at + 1);
+		}
+
+		std::string name = scheduling;
+		size_t colon = scheduling.find(':');
+		if (colon != scheduling.npos)
+		{
+			name = scheduling.substr(0, colon);
+			std::string priority = scheduling.substr(colon + 1);
+			bool negative = !priority.empty() && priority[0] == '-';
+			int value = ParseNumber(spec, negative? priority.substr(1): priority);
+			policy.Priority = negative? -value: value;
+		}
+
+		if (name.empty() || name == "default")
+			policy.Policy = Scheduling::Inherited;
+		else if (name == "other")
+			policy.Policy = Scheduling::Other;
+		else if (name == "batch")
+			policy.Policy = Scheduling::Batch;
+		else if (name == "idle")
+			policy.Policy = Scheduling::Idle;
+		else if (name == "fifo")
+			policy.Policy = Scheduling::Fifo;
+		else if (name == "rr")
+			policy.Policy = Scheduling::RoundRobin;
+		else
+			throw std::runtime_error("unknown scheduling policy " + name + ", use default, other, batch, idle, fifo or rr");
+		if (colon == scheduling.npos && (policy.Policy == Scheduling::Fifo || policy.Policy == Scheduling::RoundRobin))
+			policy.Priority = 1; //lowest realtime priority still preempts any regular thread
+
+		//comma separated list of cpus and ranges, as in taskset -c
+		for(size_t begin = 0; begin < cpus.size(); )
+		{
+			size_t end = cpus.find(',', begin);
+			if (end == cpus.npos)
+				end = cpus.size();
+			std::string range = cpus.substr(begin, end - begin);
+			size_t dash = range.find('-');
+			unsigned first = ParseNumber(spec, range.substr(0, dash));
+			unsigned last = dash != range.npos? ParseNumber(spec, range.substr(dash + 1)): first;
+			if (last < first || last >= MaxCpus)
+				throw std::runtime_error("invalid cpu range " + range + " in reaper policy " + spec);
+			for(unsigned cpu = first; cpu <= last; ++cpu)
+				policy.Cpus.push_back(cpu);
+			begin = end + 1;
+		}
+		return policy;
+	}
+
+	void ReaperPolicy::Apply() const
+	{
+		int policy = -1;
+		switch(Policy)
+		{
+		case Scheduling::Inherited:		break;
+		case Scheduling::Other:			policy = SCHED_OTHER; break;
+#ifdef SCHED_BATCH
+		case Scheduling::Batch:			policy = SCHED_BATCH; break;
+#endif
+#ifdef SCHED_IDLE
+		case Scheduling::Idle:			policy = SCHED_IDLE; break;
+#endif
+		case Scheduling::Fifo:			policy = SCHED_FIFO; break;
+		case Scheduling::RoundRobin:	policy = SCHED_RR; break;
+		default:
+			error("scheduling policy is not supported on this platform");
+		}
+
+		if (policy >= 0)
+		{
+			bool realtime = policy == SCHED_FIFO || policy == SCHED_RR;
+			sched_param param = {};
+			param.sched_priority = realtime? Priority: 0;
+			int r = pthread_setschedparam(pthread_self(), policy, &param);
+			if (r != 0)
+				error("setting reaper thread scheduling failed: ", strerror(r), realtime? " (realtime policies need CAP_SYS_NICE or RLIMIT_RTPRIO)": "");
+		}
+
+#ifdef __linux__
+		//nice value is per thread on linux
+		bool nice = Policy == Scheduling::Other || Policy == Scheduling::Batch || (Policy == Scheduling::Inherited && Priority != 0);
+		if (nice && setpriority(PRIO_PROCESS, syscall(SYS_gettid), Priority) != 0)
+			error("setting reaper thread nice value failed: ", strerror(errno));
+
+		if (!Cpus.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for(auto cpu : Cpus)
+				if (cpu < CPU_SETSIZE)
+					CPU_SET(cpu, &set);
+			int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+			if (r != 0)
+				error("setting reaper thread cpu affinity failed: ", strerror(r));
+		}
+#else
+		if (!Cpus.empty())
+			error("reaper thread cpu affinity is not supported on this platform");
+#endif
+	}
+
+}}
@@ -0,0 +1,49 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef USB_REAPERPOLICY_H
+#define USB_REAPERPOLICY_H
+
+#include <mtp/types.h>
+#include <string>
+#include <vector>
+
+namespace mtp { namespace usb
+{
+
+	struct ReaperPolicy //! scheduling of dedicated urb completion thread, parsed from [policy][:priority][@cpus] option, e.g. fifo:10@2,3 or @0-1
+	{
+		enum struct Scheduling { Inherited, Other, Batch, Idle, Fifo, RoundRobin };
+
+		bool					Enabled;
+		Scheduling				Policy;
+		int						Priority; //realtime priority for fifo and rr, nice value for other and batch
+		std::vector<unsigned>	Cpus; //empty for any cpu
+
+		ReaperPolicy(): Enabled(false), Policy(Scheduling::Inherited), Priority(0) { }
+
+		///throws std::runtime_error on malformed spec
+		static ReaperPolicy Parse(const std::string &spec);
+
+		///applies policy to calling thread, failures are reported and ignored, thread keeps running with inherited scheduling
+		void Apply() const;
+	};
+
+}}
+
+#endif
@@ -18,19 +18,31 @@
 */
 
 #include "commandqueue.h"
+#include "mtpobjectsloader.h"
 #include "mtpobjectsmodel.h"
+#include "qtobjectstream.h"
 #include "utils.h"
+#include <mtp/backend/posix/DirectoryScanner.h>
+#include <mtp/ptp/AsyncObjectOutputStream.h>
+#include <mtp/ptp/ObjectDownloader.h>
+#include <cli/PosixStreams.h> //for mtime
 #include <QFileInfo>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
-#include <QApplication>
+#include <map>
+
+void StartQueue::execute(CommandQueue &queue)
+{ queue.begin(Batch, Scheduler, StorageId, DirectoryId); }
 
 void FinishQueue::execute(CommandQueue &queue)
-{ queue.finish(DirectoryId); }
+{ queue.finish(); }
+
+void UploadFile::prepare(CommandQueue &)
+{ Prepared = MtpObjectsModel::prepareUpload(Filename); }
 
 void UploadFile::execute(CommandQueue &queue)
-{ queue.uploadFile(Filename); }
+{ queue.uploadFile(Filename, Prepared); }
 
 void MakeDirectory::execute(CommandQueue &queue)
 { queue.createDirectory(Filename); }
@@ -38,9 +50,110 @@ void MakeDirectory::execute(CommandQueue &queue)
 void DownloadFile::execute(CommandQueue &queue)
 { queue.downloadFile(Filename, ObjectId); }
 
+void ScanUpload::execute(CommandQueue &queue)
+{ queue.scanUpload(Filename, Scanner); }
+
+void PlanDownload::execute(CommandQueue &queue)
+{
+	if (Listing)
+		queue.listDirectory(Filename, ObjectId);
+	else
+		queue.planDownload(Filename, ObjectId);
+}
+
+void CommandQueue::scanUpload(const QString &path, const std::shared_ptr<mtp::posix::DirectoryScanner> &scanner)
+{
+	if (aborted())
+		return;
+
+	std::vector<mtp::posix::DirectoryScanner::Entry> entries;
+	if (!scanner->Fetch(entries))
+		return;
+
+	QList<Command *> commands;
+	qint64 total = 0;
+	for(const auto &entry : entries)
+	{
+		QString filename = path + "/" + fromUtf8(entry.Path);
+		if (entry.Directory)
+			commands.push_back(new MakeDirectory(filename));
+		else
+		{
+			commands.push_back(new UploadFile(filename));
+			total += entry.Size;
+		}
+	}
+	commands.push_back(new ScanUpload(path, scanner));
+	emit planned(total);
+	push(commands);
+}
+
+void CommandQueue::planDownload(const QString &prefix, mtp::ObjectId objectId)
+{
+	if (aborted())
+		return;
+
+	try
+	{
+		mtp::msg::ObjectInfo oi = request([objectId](mtp::Session &session) { return session.GetFullObjectInfo(objectId); });
+		QString path = prefix + "/" + fromUtf8(oi.Filename);
+		if (oi.ObjectFormat == mtp::ObjectFormat::Association)
+		{
+			listDirectory(path, objectId);
+			return;
+		}
+		emit planned(objectSize(objectId, oi));
+		push(QList<Command *>() << new DownloadFile(path, objectId));
+	} catch(const std::exception &ex)
+	{ qDebug() << "getting object info for " << objectId << " failed: " << fromUtf8(ex.what()); }
+}
+
+void CommandQueue::listDirectory(const QString &path, mtp::ObjectId directoryId)
+{
+	if (aborted())
+		return;
+
+	//late properties and fallback listing pass objects again, last info wins
+	std::map<mtp::ObjectId, mtp::msg::ObjectInfoPtr> objects;
+	try
+	{
+		MtpObjectsLoader::fetch(_scheduler, mtp::Session::AllStorages, directoryId, [&objects](const MtpLoadedObjects &loaded)
+		{
+			for(const auto &object : loaded)
+				objects[object.first] = object.second;
+		});
+	} catch(const std::exception &ex)
+	{ qDebug() << "listing directory " << path << " failed: " << fromUtf8(ex.what()); return; }
+
+	qDebug() << "found " << objects.size() << " objects in " << path;
+	QList<Command *> files, directories;
+	qint64 total = 0;
+	for(const auto &object : objects)
+	{
+		const mtp::msg::ObjectInfo &oi = *object.second;
+		if (oi.Filename.empty())
+			continue;
+
+		QString filename = path + "/" + fromUtf8(oi.Filename);
+		if (oi.ObjectFormat == mtp::ObjectFormat::Association)
+		{
+			directories.push_back(new PlanDownload(filename, object.first, true));
+			continue;
+		}
+
+		try
+		{ total += objectSize(object.first, oi); }
+		catch(const std::exception &ex)
+		{ qDebug() << "getting size of " << filename << " failed: " << fromUtf8(ex.what()); }
+		files.push_back(new DownloadFile(filename, object.first));
+	}
+	emit planned(total);
+	push(files + directories);
+}
+
 void CommandQueue::downloadFile(const QString &filename, mtp::ObjectId objectId)
 {
-	if (_aborted)
+	if (aborted())
 		return;
 	qDebug() << "downloading " << objectId << "to" << filename;
 
@@ -49,16 +162,16 @@ void CommandQueue::downloadFile(const QString &filename, mtp::ObjectId objectId)
 	start(fi.fileName());
 	try
 	{
-		model()->downloadFile(filename, objectId);
+		downloadObject(filename, objectId);
 	} catch(const std::exception &ex)
 	{ qDebug() << "downloading file " << filename << " failed: " << fromUtf8(ex.what()); }
 
 	addProgress(fi.size());
 }
 
-void CommandQueue::uploadFile(const QString &filename)
+void CommandQueue::uploadFile(const QString &filename, const MtpPreparedUploadPtr &prepared)
 {
-	if (_aborted)
+	if (aborted())
 		return;
 
 	QFileInfo fi(filename);
@@ -69,8 +182,8 @@ void CommandQueue::uploadFile(const QString &filename)
 	if (_directories.empty())
 	{
 		qDebug() << "adding first parent path";
-		_directories[parentPath] = _model->parentObjectId();
-		qDebug() << "directories[0]: " << parentPath << " -> " << _model->parentObjectId().Id;
+		_directories[parentPath] = _targetId;
+		qDebug() << "directories[0]: " << parentPath << " -> " << _targetId.Id;
 	}
 	start(fi.fileName());
 	auto parent = _directories.find(parentPath);
@@ -81,10 +194,7 @@ void CommandQueue::uploadFile(const QString &filename)
 	}
 	try
 	{
-		if (_model->parentObjectId() != parent.value()) //needed for overwrite protection
-			_model->setParent(parent.value());
-
-		_model->uploadFile(parent.value(), filename);
+		uploadObject(parent.value(), prepared? prepared: MtpObjectsModel::prepareUpload(filename));
 	} catch(const std::exception &ex)
 	{ qDebug() << "uploading file " << filename << " failed: " << fromUtf8(ex.what()); }
 
@@ -93,7 +203,7 @@ void CommandQueue::uploadFile(const QString &filename)
 
 void CommandQueue::createDirectory(const QString &srcPath)
 {
-	if (_aborted)
+	if (aborted())
 		return;
 
 	QFileInfo fi(srcPath);
@@ -102,8 +212,8 @@ void CommandQueue::createDirectory(const QString &srcPath)
 	if (_directories.empty())
 	{
 		qDebug() << "adding first parent path";
-		_directories[parentPath] = _model->parentObjectId();
-		qDebug() << "directories[0]: " << parentPath << " -> " << _model->parentObjectId().Id;
+		_directories[parentPath] = _targetId;
+		qDebug() << "directories[0]: " << parentPath << " -> " << _targetId.Id;
 	}
 
 	auto parent = _directories.find(parentPath);
@@ -115,27 +225,69 @@ void CommandQueue::createDirectory(const QString &srcPath)
 
 	try
 	{
-		mtp::ObjectId dirId = _model->createDirectory(parent.value(), fi.fileName());
+		mtp::ObjectId parentId = parent.value();
+		QString name = fi.fileName();
+		Names &existing = names(parentId);
+		auto object = existing.find(name);
+		mtp::ObjectId dirId;
+		if (object != existing.end())
+			dirId = object.value();
+		else
+		{
+			mtp::StorageId storageId = _storageId;
+			std::string filename = toUtf8(name);
+			dirId = request([filename, parentId, storageId](mtp::Session &session)
+			{ return session.CreateDirectory(filename, parentId, storageId).ObjectId; });
+			existing[name] = dirId;
+			_names[dirId.Id]; //new directory is empty, no need to list it
+		}
 		_directories[srcPath] = dirId;
 		qDebug() << "directories[]: " << srcPath << " -> " << dirId.Id;
 	} catch(const std::exception &ex)
 	{ qDebug() << "creating directory" << srcPath << "failed: " << fromUtf8(ex.what()); return; }
 }
 
-CommandQueue::CommandQueue(MtpObjectsModel *model): _model(model), _completedFilesSize(0), _aborted(false)
+CommandQueue::CommandQueue(MtpObjectsModel *model): _model(model), _completedFilesSize(0), _batch(0), _abortedBatch(0)
 {
-	connect(_model, SIGNAL(filePositionChanged(qint64,qint64)), this, SLOT(onFileProgress(qint64,qint64)));
 	qDebug() << "upload worker started";
 }
 
 CommandQueue::~CommandQueue()
 {
+	qDeleteAll(_pending);
 	qDebug() << "upload worker stopped";
 }
 
-void CommandQueue::execute(Command *ptr)
+void CommandQueue::execute(Command *cmd)
+{
+	//commands are posted in bulk, executing them from separate queued call lets us see the next one
+	_pending.enqueue(cmd);
+	QMetaObject::invokeMethod(this, "executeNext", Qt::QueuedConnection);
+}
+
+void CommandQueue::push(const QList<Command *> &commands)
+{
+	//depth first, transfers of listed files start before the rest of the tree is listed
+	for(int i = commands.size() - 1; i >= 0; --i)
+	{
+		_pending.prepend(commands[i]);
+		QMetaObject::invokeMethod(this, "executeNext", Qt::QueuedConnection);
+	}
+}
+
+void CommandQueue::executeNext()
 {
-	std::unique_ptr<Command> cmd(ptr);
+	if (_pending.empty())
+		return;
+
+	std::unique_ptr<Command> cmd(_pending.dequeue());
+	if (!_pending.empty() && !aborted())
+	{
+		//local work for the next command overlaps with this command's transfer
+		try { _pending.head()->prepare(*this); }
+		catch(const std::exception &ex)
+		{ qDebug() << "preparing command failed: " << fromUtf8(ex.what()); }
+	}
 	cmd->execute(*this);
 }
 
@@ -144,38 +296,158 @@ void CommandQueue::start(const QString &filename)
 	emit started(filename);
 }
 
-void CommandQueue::finish(mtp::ObjectId directoryId)
+void CommandQueue::begin(int batch, const mtp::AsyncSessionPtr &scheduler, mtp::StorageId storageId, mtp::ObjectId directoryId)
 {
-	qDebug() << "finishing queue";
-	try
-	{
-		model()->setParent(directoryId);
-	} catch(const std::exception &ex)
-	{ qDebug() << "finalizing commands failed: " << fromUtf8(ex.what()); }
-
-	_model->moveToThread(QApplication::instance()->thread());
+	qDebug() << "starting batch " << batch;
+	_batch = batch;
+	_scheduler = scheduler;
+	_storageId = storageId != mtp::Session::AllStorages? storageId: mtp::Session::AnyStorage;
+	_targetId = directoryId;
 	_completedFilesSize = 0;
 	_directories.clear();
-	_aborted = false;
+	_names.clear();
+	_progress.Reset();
+}
+
+void CommandQueue::finish()
+{
+	qDebug() << "finishing batch " << _batch;
+	emit progress(_completedFilesSize);
+	_scheduler.reset();
+	_directories.clear();
+	_names.clear();
 	emit finished();
 }
 
-void CommandQueue::abort()
+void CommandQueue::abort(int batch)
 {
 	qDebug() << "aborting...";
-	_aborted = true;
-	_model->session()->AbortCurrentTransaction(6000);
-	qDebug() << "sent abort request";
+	_abortedBatch = batch;
+	//only object data transfer in progress is aborted, listings run by ui are left alone
+	mtp::AsyncSessionPtr scheduler = _model->scheduler();
+	if (scheduler && scheduler->AbortBulk(6000))
+		qDebug() << "sent abort request";
+}
+
+CommandQueue::Names & CommandQueue::names(mtp::ObjectId directoryId)
+{
+	auto i = _names.find(directoryId.Id);
+	if (i != _names.end())
+		return i.value();
+
+	Names listing;
+	MtpObjectsLoader::fetch(_scheduler, mtp::Session::AllStorages, directoryId, [&listing](const MtpLoadedObjects &objects)
+	{
+		for(const auto &object : objects)
+			if (!object.second->Filename.empty())
+				listing[fromUtf8(object.second->Filename)] = object.first;
+	});
+	return _names.insert(directoryId.Id, listing).value();
+}
+
+qint64 CommandQueue::objectSize(mtp::ObjectId objectId, const mtp::msg::ObjectInfo &oi)
+{
+	qint64 size = oi.ObjectSize;
+	if (oi.IsSizeTruncated())
+		size = request([objectId](mtp::Session &session) { return session.GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize); });
+	return size;
+}
+
+bool CommandQueue::uploadObject(mtp::ObjectId parentId, const MtpPreparedUploadPtr &upload)
+{
+	if (!upload)
+		return false;
+
+	QString filename = QFileInfo(upload->FilePath).fileName();
+	Names &existing = names(parentId);
+	auto object = existing.find(filename);
+	if (object != existing.end())
+	{
+		if (!emit existingFileOverwrite(filename))
+		{
+			qDebug() << "skipping, overwrite not confirmed";
+			return false;
+		}
+		mtp::ObjectId existingId = object.value();
+		request([existingId](mtp::Session &session) { session.DeleteObject(existingId); });
+		existing.erase(object);
+	}
+
+	qDebug() << "sending " << upload->Size << " bytes";
+	connect(upload->Stream.get(), SIGNAL(positionChanged(qint64,qint64)), this, SLOT(onFileProgress(qint64,qint64)));
+
+	mtp::msg::ObjectInfo oi;
+	oi.Filename = toUtf8(filename);
+	oi.ObjectFormat = upload->Format.get();
+	oi.SetSize(upload->Size);
+	//data goes in bulk chunks, ui listings are answered in between
+	mtp::Session::NewObjectInfo noi = _scheduler->Upload(oi, _storageId, parentId, upload->Source).get();
+	qDebug() << "new object id: " << noi.ObjectId;
+	existing[filename] = noi.ObjectId;
+	return true;
+}
+
+bool CommandQueue::downloadObject(const QString &filePath, mtp::ObjectId objectId)
+{
+	std::string path = filePath.toStdString();
+	mtp::u64 size = request([objectId](mtp::Session &session) { return session.GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize); });
+	time_t mtime = request([objectId](mtp::Session &session) { return session.GetObjectModificationTime(objectId); });
+
+	mtp::u64 offset = cli::ObjectOutputStream::GetResumeOffset(path, size, mtime);
+	if (offset && !mtp::ObjectDownloader(_scheduler->GetSession()).CanResume(offset, size))
+		offset = 0;
+	if (offset)
+		qDebug() << "resuming download of " << filePath << " from " << offset;
+
+	auto object = std::make_shared<QtObjectOutputStream>(filePath, offset != 0);
+	if (!object->Valid())
+	{
+		qWarning() << "cannot open file " << filePath;
+		return false;
+	}
+	connect(object.get(), SIGNAL(positionChanged(qint64,qint64)), this, SLOT(onFileProgress(qint64,qint64)));
+	object->setSize(size);
+	if (!offset)
+		object->preallocate(size);
+	//file is written from background thread, positionChanged is delivered through queued connection
+	auto async = std::make_shared<mtp::AsyncObjectOutputStream>(object);
+	try
+	{
+		_scheduler->Download(objectId, async, size, mtp::AsyncSession::DefaultChunkSize, offset).get();
+		async->Finish();
+	}
+	catch(...)
+	{
+		async.reset();
+		object.reset();
+		//mark partial file, next download continues from its length
+		if (mtime)
+		{
+			try { cli::ObjectOutputStream::SetModificationTime(path, mtime); } catch(const std::exception &ex) { }
+		}
+		throw;
+	}
+	async.reset();
+	object.reset();
+	cli::ObjectOutputStream::SetModificationTime(path, mtime);
+	return true;
 }
 
 void CommandQueue::addProgress(qint64 fileSize)
 {
 	_completedFilesSize += fileSize;
-	emit progress(_completedFilesSize);
+	reportProgress(_completedFilesSize);
 }
 
 void CommandQueue::onFileProgress(qint64 pos, qint64)
 {
 	//qDebug() << "on file progress " << _completedFilesSize << " " << pos;
-	emit progress(_completedFilesSize + pos);
+	reportProgress(_completedFilesSize + pos);
+}
+
+void CommandQueue::reportProgress(qint64 bytes)
+{
+	//queue total is only known to uploader, throttle by time, small files would flood gui thread otherwise
+	if (_progress.Update(bytes, 0))
+		emit progress(bytes);
 }
@@ -23,22 +23,44 @@
 #include <QObject>
 #include <QQueue>
 #include <QMap>
+#include <QHash>
+#include <mtp/ptp/AsyncSession.h>
 #include <mtp/ptp/ObjectId.h>
 #include <mtp/ptp/ObjectFormat.h>
+#include <mtp/ptp/ProgressThrottle.h>
+#include <memory>
 
 class MtpObjectsModel;
 class CommandQueue;
+struct MtpPreparedUpload;
+
+namespace mtp { namespace posix
+{
+	class DirectoryScanner;
+}}
 
 struct Command
 {
 	virtual ~Command() = default;
+	///called from queue thread while previous command is executed, must not touch device
+	virtual void prepare(CommandQueue &) { }
 	virtual void execute(CommandQueue &queue) = 0;
 };
 
+struct StartQueue : public Command
+{
+	int						Batch; //abort request covers this batch and all batches queued before it
+	mtp::AsyncSessionPtr	Scheduler;
+	mtp::StorageId			StorageId;
+	mtp::ObjectId			DirectoryId; //local parent of selected files maps to it
+
+	StartQueue(int batch, const mtp::AsyncSessionPtr &scheduler, mtp::StorageId storageId, mtp::ObjectId directoryId):
+		Batch(batch), Scheduler(scheduler), StorageId(storageId), DirectoryId(directoryId) { }
+	virtual void execute(CommandQueue &queue);
+};
+
 struct FinishQueue : public Command
 {
-	mtp::ObjectId DirectoryId; //return id
-	FinishQueue(mtp::ObjectId id): DirectoryId(id) { }
 	virtual void execute(CommandQueue &queue);
 };
 
@@ -58,7 +80,10 @@ struct MakeDirectory : public FileCommand
 
 struct UploadFile : public FileCommand
 {
+	std::shared_ptr<MtpPreparedUpload>	Prepared;
+
 	UploadFile(const QString &filename) : FileCommand(filename) { }
+	void prepare(CommandQueue &queue);
 	void execute(CommandQueue &queue);
 };
 
@@ -70,38 +95,93 @@ struct DownloadFile : public FileCommand
 	void execute(CommandQueue &queue);
 };
 
-class CommandQueue: public QObject
+struct ScanUpload : public FileCommand
+{
+	std::shared_ptr<mtp::posix::DirectoryScanner>	Scanner;
+
+	ScanUpload(const QString &filename, const std::shared_ptr<mtp::posix::DirectoryScanner> &scanner) : FileCommand(filename), Scanner(scanner) { }
+	void execute(CommandQueue &queue);
+};
+
+struct PlanDownload : public FileCommand
+{
+	mtp::ObjectId			ObjectId;
+	bool					Listing; //Filename is local path of directory ObjectId, otherwise it's the directory to download ObjectId into
+
+	PlanDownload(const QString &filename, mtp::ObjectId objectId, bool listing = false) : FileCommand(filename), ObjectId(objectId), Listing(listing) { }
+	void execute(CommandQueue &queue);
+};
+
+class CommandQueue: public QObject //! runs transfers in its own thread, without touching the model, metadata goes to scheduler as interactive jobs and object data as bulk chunks
 {
 	Q_OBJECT
 
 private:
+	typedef QHash<QString, mtp::ObjectId> Names;
+
 	MtpObjectsModel *				_model;
+	mtp::AsyncSessionPtr			_scheduler;
+	mtp::StorageId					_storageId;
+	mtp::ObjectId					_targetId;
 	qint64							_completedFilesSize;
 	QMap<QString, mtp::ObjectId>	_directories;
-	volatile bool					_aborted;
+	QMap<quint32, Names>			_names; //target directory -> its objects, listed once per batch
+	int								_batch;
+	volatile int					_abortedBatch;
+	mtp::ProgressThrottle			_progress;
+	QQueue<Command *>				_pending;
+
+	bool aborted() const
+	{ return _batch <= _abortedBatch; }
+
+	///runs metadata request ahead of queued bulk chunks and waits for its result
+	template<typename Func>
+	auto request(Func func) -> decltype(func(std::declval<mtp::Session &>()))
+	{ return _scheduler->Submit(func, mtp::AsyncSession::Priority::Interactive).get(); }
+
+	Names & names(mtp::ObjectId directoryId);
+	qint64 objectSize(mtp::ObjectId objectId, const mtp::msg::ObjectInfo &oi);
+	///replaces existing object after confirmation, returns false if upload was skipped
+	bool uploadObject(mtp::ObjectId parentId, const std::shared_ptr<MtpPreparedUpload> &upload);
+	///continues partial file left by interrupted download if device allows it
+	bool downloadObject(const QString &filePath, mtp::ObjectId objectId);
+	void reportProgress(qint64 bytes);
+	///puts commands at the head of the queue, ahead of final FinishQueue
+	void push(const QList<Command *> &commands);
 
 public:
 	CommandQueue(MtpObjectsModel *model);
 	~CommandQueue();
 
-	MtpObjectsModel *model() const
-	{ return _model; }
-
+	void begin(int batch, const mtp::AsyncSessionPtr &scheduler, mtp::StorageId storageId, mtp::ObjectId directoryId);
 	void createDirectory(const QString &path);
-	void uploadFile(const QString &file);
+	void uploadFile(const QString &file, const std::shared_ptr<MtpPreparedUpload> &prepared = std::shared_ptr<MtpPreparedUpload>());
 	void downloadFile(const QString &filename, mtp::ObjectId objectId);
+	///queues uploads of entries scanned so far, then itself again until scan is complete
+	void scanUpload(const QString &path, const std::shared_ptr<mtp::posix::DirectoryScanner> &scanner);
+	///resolves selected object, queues its download or lists it if it's a directory
+	void planDownload(const QString &prefix, mtp::ObjectId objectId);
+	///lists directory with GetObjectPropList if possible, its files are queued before its subdirectories are listed
+	void listDirectory(const QString &path, mtp::ObjectId directoryId);
+
+private slots:
+	void executeNext();
 
 public slots:
 	void onFileProgress(qint64, qint64);
 	void execute(Command *cmd);
 	void start(const QString &filename);
-	void finish(mtp::ObjectId directoryId);
+	void finish();
 	void addProgress(qint64);
-	void abort();
+	///aborts given batch and batches queued before it, called from ui thread
+	void abort(int batch);
 
 signals:
+	///asks ui whether existing object should be replaced
+	bool existingFileOverwrite(QString);
 	void started(QString);
 	void progress(qint64 bytes);
+	void planned(qint64 bytes);
 	void finished();
 };
 
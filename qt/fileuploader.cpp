@@ -20,15 +20,21 @@
 #include "fileuploader.h"
 #include "commandqueue.h"
 #include "mtpobjectsmodel.h"
+#include "utils.h"
+#include <mtp/backend/posix/DirectoryScanner.h>
 #include <QStringList>
 #include <QFileInfo>
 #include <QDir>
-#include <QDirIterator>
 #include <QDebug>
 
 FileUploader::FileUploader(MtpObjectsModel * model, QObject *parent) :
 	QObject(parent),
 	_model(model),
+	_total(0),
+	_base(0),
+	_position(0),
+	_batch(0),
+	_batches(0),
 	_aborted(false)
 {
 	_worker = new CommandQueue(_model);
@@ -37,8 +43,10 @@ FileUploader::FileUploader(MtpObjectsModel * model, QObject *parent) :
 	connect(&_workerThread, SIGNAL(finished()), SLOT(deleteLater()));
 	connect(this, SIGNAL(executeCommand(Command*)), _worker, SLOT(execute(Command*)));
 	connect(_worker, SIGNAL(progress(qint64)), SLOT(onProgress(qint64)));
+	connect(_worker, SIGNAL(planned(qint64)), SLOT(onPlanned(qint64)));
 	connect(_worker, SIGNAL(started(QString)), SLOT(onStarted(QString)));
 	connect(_worker, SIGNAL(finished()), SLOT(onFinished()));
+	connect(_worker, SIGNAL(existingFileOverwrite(QString)), SLOT(onExistingFileOverwrite(QString)), Qt::BlockingQueuedConnection);
 	_workerThread.start();
 }
 
@@ -48,17 +56,37 @@ FileUploader::~FileUploader()
 	_workerThread.wait();
 }
 
-void FileUploader::onProgress(qint64 current)
+void FileUploader::onProgress(qint64 batchCurrent)
 {
+	//worker counts bytes of current batch only
+	qint64 current = _position = _base + batchCurrent;
 	//qDebug() << "progress " << current << " of " << _total;
-	qint64 secs = _startedAt.secsTo(QDateTime::currentDateTime());
-	if (secs > 0)
-		emit uploadSpeed(current / secs);
+	_throughput.Update(current);
+	if (!_progress.Update(current, _total))
+		return;
+
+	if (_throughput.IsValid())
+		emit uploadSpeed(_throughput.GetRate());
+	else
+	{
+		qint64 msecs = _startedAt.msecsTo(QDateTime::currentDateTime());
+		if (msecs > 0)
+			emit uploadSpeed(current * 1000 / msecs);
+	}
+
+	double eta = _throughput.GetEta(_total);
+	emit uploadEta(eta >= 0? qint64(eta * 1000): -1);
 
 	if (_total > 0)
 		emit uploadProgress(1.0 * current / _total);
 }
 
+void FileUploader::onPlanned(qint64 bytes)
+{
+	//total grows while worker lists directories
+	_total += bytes;
+}
+
 void FileUploader::onStarted(const QString &file)
 {
 	emit uploadStarted(file);
@@ -66,17 +94,40 @@ void FileUploader::onStarted(const QString &file)
 
 void FileUploader::onFinished()
 {
+	qDebug() << "batch finished";
+	_base = _position;
+	//objects were added behind model's back, only the difference is applied
+	_model->refresh();
+	if (--_batches > 0)
+		return;
+
 	qDebug() << "finished";
 	emit finished();
 }
 
+bool FileUploader::onExistingFileOverwrite(const QString &filename)
+{ return emit existingFileOverwrite(filename); }
+
+void FileUploader::startBatch()
+{
+	if (_batches++ == 0)
+	{
+		_total = _base = _position = 0;
+		_startedAt = QDateTime::currentDateTime();
+		_progress.Reset();
+		_throughput.Reset();
+	}
+	_aborted = false;
+	//model stays in ui thread, worker shares its scheduler
+	emit executeCommand(new StartQueue(++_batch, _model->scheduler(), _model->storageId(), _model->parentObjectId()));
+}
+
 void FileUploader::upload(QStringList files)
 {
-	_model->moveToThread(&_workerThread);
-	_total = 0;
+	startBatch();
 
-	mtp::ObjectId currentParentId = _model->parentObjectId();
 	QList<Command *> commands;
+	qint64 total = 0;
 	while(!files.empty())
 	{
 		QString currentFile = files.front();
@@ -86,102 +137,48 @@ void FileUploader::upload(QStringList files)
 		{
 			qDebug() << "adding subdirectory" << currentFile;
 			commands.push_back(new MakeDirectory(currentFile));
-			QDirIterator it(currentFile, QDirIterator::Subdirectories);
-			while(it.hasNext())
-			{
-				QString next = it.next();
-				QFileInfo fi(next);
-				QString filename = fi.fileName();
-				if (filename == "." || filename == "..")
-					continue;
-
-				if (fi.isFile())
-				{
-					commands.push_back(new UploadFile(next));
-					_total += fi.size();
-				}
-				else if (fi.isDir())
-				{
-					commands.push_back(new MakeDirectory(next));
-				}
-			}
+			//tree is scanned in background while previous files are uploaded, worker queues its entries as they come
+			try
+			{ commands.push_back(new ScanUpload(currentFile, std::make_shared<mtp::posix::DirectoryScanner>(toUtf8(currentFile)))); }
+			catch(const std::exception &ex)
+			{ qWarning() << "scanning " << currentFile << " failed: " << fromUtf8(ex.what()); }
 		}
 		else if (currentFileInfo.isFile())
 		{
 			commands.push_back(new UploadFile(currentFile));
-			_total += currentFileInfo.size();
+			total += currentFileInfo.size();
 		}
 	}
-	qDebug() << "uploading" << _total << "bytes";
-	if (_total < 1)
-		_total = 1;
-
-	_startedAt = QDateTime::currentDateTime();
-	_aborted = false;
+	qDebug() << "uploading" << total << "bytes of selected files";
+	_total += total;
 
 	for(auto command: commands)
 	{
 		if (_aborted)
-			break;
+		{
+			delete command;
+			continue;
+		}
 		emit executeCommand(command);
 	}
-	emit executeCommand(new FinishQueue(currentParentId));
+	emit executeCommand(new FinishQueue());
 }
 
 void FileUploader::download(const QString &rootPath, const QVector<mtp::ObjectId> &objectIds)
 {
-	_model->moveToThread(&_workerThread);
-	_total = 0;
-
-	mtp::ObjectId currentParentId = _model->parentObjectId();
+	startBatch();
 
-	QVector<QPair<QString, mtp::ObjectId> > input;
+	//objects are resolved and directories listed in worker thread, planned files are downloaded before the next directory is listed
+	qDebug() << "planning download of " << objectIds.size() << " object(s)";
 	for(auto id : objectIds)
-		input.push_back(qMakePair(rootPath, id));
-
-	QVector<QPair<QString, mtp::ObjectId> > files;
-	while(!input.empty())
-	{
-		QString prefix = input.front().first;
-		mtp::ObjectId id = input.front().second;
-		input.pop_front();
-
-		MtpObjectsModel::ObjectInfo oi = _model->getInfoById(id);
-		if (oi.Format == mtp::ObjectFormat::Association)
-		{
-			//enumerate here
-			QString dirPath = prefix + "/" + oi.Filename;
-			mtp::SessionPtr session = _model->session();
-			mtp::msg::ObjectHandles handles = session->GetObjectHandles(mtp::Session::AllStorages, mtp::ObjectFormat::Any, id);
-			qDebug() << "found " << handles.ObjectHandles.size() << " objects in " << dirPath;
-			for(mtp::ObjectId id : handles.ObjectHandles)
-				input.push_back(qMakePair(dirPath, id));
-		}
-		else
-		{
-			_total += oi.Size;
-			files.push_back(qMakePair(prefix + "/" + oi.Filename, id));
-		}
-	}
-
-	qDebug() << "downloading " << files.size() << " file(s), " << _total << " bytes";
-	_startedAt = QDateTime::currentDateTime();
-	_aborted = false;
-	if (_total < 1)
-		_total = 1;
-
-	for(const auto & file : files)
-	{
-		if (_aborted)
-			break;
-		emit executeCommand(new DownloadFile(file.first, file.second));
-	}
-	emit executeCommand(new FinishQueue(currentParentId));
+		emit executeCommand(new PlanDownload(rootPath, id));
+	emit executeCommand(new FinishQueue());
 }
 
 void FileUploader::abort()
 {
 	qDebug() << "abort request";
 	_aborted = true;
-	_worker->abort();
+	//batches queued afterwards are not affected
+	_worker->abort(_batch);
 }
@@ -23,6 +23,8 @@
 #include <QObject>
 #include <QThread>
 #include <QDateTime>
+#include <mtp/ptp/ProgressThrottle.h>
+#include <mtp/ptp/ThroughputEstimator.h>
 
 class MtpObjectsModel;
 struct Command;
@@ -42,18 +44,32 @@ private:
 	QThread				_workerThread;
 	CommandQueue *		_worker;
 	qint64				_total;
+	qint64				_base; //bytes of finished batches
+	qint64				_position;
+	int					_batch; //serial of the last queued batch
+	int					_batches; //batches in queue, finished is emitted when the last one is done
 	QDateTime			_startedAt;
+	mtp::ProgressThrottle	_progress;
+	mtp::ThroughputEstimator	_throughput;
 	bool				_aborted;
 
+	void startBatch();
+
 private slots:
-	void onProgress(qint64 current);
+	void onProgress(qint64 batchCurrent);
+	void onPlanned(qint64 bytes);
 	void onStarted(const QString &file);
 	void onFinished();
+	bool onExistingFileOverwrite(const QString &filename);
 
 public:
 	explicit FileUploader(MtpObjectsModel * model, QObject *parent = 0);
 	~FileUploader();
 
+	bool busy() const
+	{ return _batches > 0; }
+
+	///batch is appended to queue if transfer is already running, model can be browsed meanwhile
 	void upload(QStringList files);
 	void download(const QString &path, const QVector<mtp::ObjectId> & objectIds);
 
@@ -63,10 +79,13 @@ public slots:
 signals:
 	void executeCommand(Command *cmd);
 
+	bool existingFileOverwrite(QString file);
+
 	//incoming signals (from worker)
 	void uploadStarted(QString file);
 	void uploadProgress(float);
 	void uploadSpeed(qint64);
+	void uploadEta(qint64);
 	void finished();
 };
 
@@ -30,6 +30,7 @@
 #include <mtp/usb/TimeoutException.h>
 #include <mtp/usb/DeviceBusyException.h>
 #include <mtp/usb/DeviceNotFoundException.h>
+#include <QActionGroup>
 #include <QClipboard>
 #include <QDebug>
 #include <QSortFilterProxyModel>
@@ -46,7 +47,8 @@ MainWindow::MainWindow(QWidget *parent) :
 	_proxyModel(new QSortFilterProxyModel),
 	_storageModel(),
 	_objectModel(new MtpObjectsModel()),
-	_uploader(new FileUploader(_objectModel, this))
+	_uploader(new FileUploader(_objectModel, this)),
+	_deviceClipboardMove(false)
 {
 	_ui->setupUi(this);
 	setWindowIcon(QIcon(":/android-file-transfer.png"));
@@ -54,14 +56,15 @@ MainWindow::MainWindow(QWidget *parent) :
 	_ui->listView->setModel(_proxyModel);
 
 	_proxyModel->setSortCaseSensitivity(Qt::CaseInsensitive);
-	_proxyModel->sort(0);
+	_proxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
+	_proxyModel->setFilterRole(MtpObjectsModel::NameRole);
 	_proxyModel->setDynamicSortFilter(true);
-
-	_objectModel->moveToThread(QApplication::instance()->thread());
+	createSortMenu();
 
 	connect(_ui->listView->selectionModel(), SIGNAL(selectionChanged(const QItemSelection &, const QItemSelection &)), SLOT(updateActionsState()));
 	connect(_ui->listView, SIGNAL(doubleClicked(QModelIndex)), SLOT(onActivated(QModelIndex)));
 	connect(_ui->listView, SIGNAL(customContextMenuRequested(QPoint)), SLOT(showContextMenu(QPoint)));
+	connect(_objectModel, SIGNAL(objectsLoaded()), SLOT(onObjectsLoaded()));
 	connect(_ui->actionBack, SIGNAL(triggered()), SLOT(back()));
 	connect(_ui->actionGo_Down, SIGNAL(triggered()), SLOT(down()));
 	connect(_ui->actionCreateDirectory, SIGNAL(triggered()), SLOT(createDirectory()));
@@ -73,11 +76,14 @@ MainWindow::MainWindow(QWidget *parent) :
 	connect(_ui->actionDelete, SIGNAL(triggered()), SLOT(deleteFiles()));
 	connect(_ui->storageList, SIGNAL(activated(int)), SLOT(onStorageChanged(int)));
 	connect(_ui->actionRefresh, SIGNAL(triggered()), SLOT(refresh()));
+	connect(_ui->actionCut, SIGNAL(triggered()), SLOT(cutObjects()));
+	connect(_ui->actionCopy, SIGNAL(triggered()), SLOT(copyObjects()));
 	connect(_ui->actionPaste, SIGNAL(triggered()), SLOT(pasteFromClipboard()));
 	connect(_ui->actionShowThumbnails, SIGNAL(triggered(bool)), SLOT(showThumbnails(bool)));
 
 	connect(_objectModel, SIGNAL(onFilesDropped(QStringList)), SLOT(uploadFiles(QStringList)));
-	connect(_objectModel, SIGNAL(existingFileOverwrite(QString)), SLOT(confirmOverwrite(QString)), Qt::BlockingQueuedConnection);
+	connect(_objectModel, SIGNAL(existingFileOverwrite(QString)), SLOT(confirmOverwrite(QString)));
+	connect(_uploader, SIGNAL(existingFileOverwrite(QString)), SLOT(confirmOverwrite(QString)));
 
 	connect(_clipboard, SIGNAL(dataChanged()), SLOT(validateClipboard()));
 	validateClipboard();
@@ -90,6 +96,58 @@ MainWindow::MainWindow(QWidget *parent) :
 	_ui->listView->setFocus();
 }
 
+void MainWindow::createSortMenu()
+{
+	QSettings settings;
+	int role = settings.value("state/sort-role", int(MtpObjectsModel::NameRole)).toInt();
+	bool descending = settings.value("state/sort-descending", false).toBool();
+
+	QMenu *menu = _ui->menuBar->addMenu(tr("&Sort"));
+	QActionGroup *group = new QActionGroup(menu);
+	const QPair<QString, int> columns[] =
+	{
+		qMakePair(tr("By &Name"), int(MtpObjectsModel::NameRole)),
+		qMakePair(tr("By &Size"), int(MtpObjectsModel::SizeRole)),
+		qMakePair(tr("By &Date"), int(MtpObjectsModel::DateRole)),
+		qMakePair(tr("By &Type"), int(MtpObjectsModel::TypeRole)),
+	};
+	for(auto &column : columns)
+	{
+		QAction *action = menu->addAction(column.first);
+		action->setCheckable(true);
+		action->setChecked(column.second == role);
+		action->setData(column.second);
+		group->addAction(action);
+	}
+	menu->addSeparator();
+	QAction *descendingAction = menu->addAction(tr("D&escending"));
+	descendingAction->setCheckable(true);
+	descendingAction->setChecked(descending);
+
+	connect(group, SIGNAL(triggered(QAction*)), SLOT(sortBy(QAction*)));
+	connect(descendingAction, SIGNAL(triggered(bool)), SLOT(setSortDescending(bool)));
+
+	_proxyModel->setSortRole(role);
+	_proxyModel->sort(0, descending? Qt::DescendingOrder: Qt::AscendingOrder);
+}
+
+void MainWindow::sortBy(QAction *action)
+{
+	QSettings settings;
+	int role = action->data().toInt();
+	settings.setValue("state/sort-role", role);
+	//keys come from metadata prefetched by listing, sorting does not touch the device
+	_proxyModel->setSortRole(role);
+	_proxyModel->sort(0, _proxyModel->sortOrder());
+}
+
+void MainWindow::setSortDescending(bool descending)
+{
+	QSettings settings;
+	settings.setValue("state/sort-descending", descending);
+	_proxyModel->sort(0, descending? Qt::DescendingOrder: Qt::AscendingOrder);
+}
+
 MainWindow::~MainWindow()
 {
 	_proxyModel->setSourceModel(NULL);
@@ -124,10 +182,15 @@ bool MainWindow::reconnectToDevice()
 	_session.reset();
 	_device.reset();
 
+	try
+	{ _device = mtp::Device::OpenEmulated(); }
+	catch(const std::exception &ex)
+	{ qWarning("Device::OpenEmulated failed: %s", ex.what()); }
+
 	mtp::usb::ContextPtr ctx(new mtp::usb::Context);
 
 	auto devices = ctx->GetDevices();
-	for (auto desc = devices.begin(); desc != devices.end();)
+	for (auto desc = devices.begin(); !_device && desc != devices.end();)
 	{
 		qDebug("probing device...");
 		try
@@ -232,8 +295,12 @@ void MainWindow::showEvent(QShowEvent *)
 		{
 			try
 			{
+				auto started = mtp::StartupTimings::Clock::now();
 				if (_storageModel->update(_session))
+				{
+					_session->GetStartupTimings().Record("storages", started);
 					break;
+				}
 			}
 			catch(const mtp::usb::DeviceNotFoundException &ex)
 			{
@@ -305,6 +372,8 @@ void MainWindow::updateActionsState()
 	_ui->actionDelete->setEnabled(!rows.empty());
 	_ui->actionDownload->setEnabled(!rows.empty());
 	_ui->actionRename->setEnabled(rows.size() == 1);
+	_ui->actionCut->setEnabled(!rows.empty());
+	_ui->actionCopy->setEnabled(!rows.empty());
 	_ui->actionGo_Down->setEnabled(rows.size() == 1);
 	_ui->actionBack->setEnabled(!_history.empty());
 
@@ -351,8 +420,6 @@ void MainWindow::renameFile()
 
 void MainWindow::deleteFiles()
 {
-	QItemSelectionModel *selection =_ui->listView->selectionModel();
-	QModelIndexList rows = selection->selectedRows();
 	int r = QMessageBox::question(this,
 		tr("Deleting file(s)"),
 		tr("Are you sure?"),
@@ -362,13 +429,19 @@ void MainWindow::deleteFiles()
 	if (r != QMessageBox::Yes)
 		return;
 
-	MtpObjectList objects;
+	_objectModel->deleteObjects(selectedObjects());
+}
+
+QVector<mtp::ObjectId> MainWindow::selectedObjects()
+{
+	QModelIndexList rows = _ui->listView->selectionModel()->selectedRows();
+	QVector<mtp::ObjectId> objects;
 	for(QModelIndex row : rows)
 	{
 		row = mapIndex(row);
 		objects.push_back(_objectModel->objectIdAt(row.row()));
 	}
-	_objectModel->deleteObjects(objects);
+	return objects;
 }
 
 
@@ -382,6 +455,10 @@ void MainWindow::showContextMenu ( const QPoint & pos )
 	menu.addAction(_ui->actionRename);
 	menu.addAction(_ui->actionDownload);
 	menu.addAction(_ui->actionDelete);
+	menu.addSeparator();
+	menu.addAction(_ui->actionCut);
+	menu.addAction(_ui->actionCopy);
+	menu.addAction(_ui->actionPaste);
 	menu.exec(_ui->listView->mapToGlobal(pos));
 }
 
@@ -394,10 +471,22 @@ void MainWindow::back()
 	_history.pop_back();
 	mtp::ObjectId oid = _history.empty()? mtp::Session::Root: _history.back().second;
 	_objectModel->setParent(oid);
-	QModelIndex prevIndex = _objectModel->findObject(oldParent);
+	_selectAfterLoad = oldParent;
+	onObjectsLoaded();
+	updateActionsState();
+}
+
+void MainWindow::onObjectsLoaded()
+{
+	if (_selectAfterLoad == mtp::ObjectId())
+		return;
+
+	QModelIndex prevIndex = _objectModel->findObject(_selectAfterLoad);
 	if (prevIndex.isValid())
+	{
 		_ui->listView->setCurrentIndex(_proxyModel->mapFromSource(prevIndex));
-	updateActionsState();
+		_selectAfterLoad = mtp::ObjectId();
+	}
 }
 
 void MainWindow::createDirectory()
@@ -424,23 +513,10 @@ void MainWindow::uploadFiles(const QStringList &files)
 		return;
 
 	qDebug() << "uploadFiles " << files;
-	_uploadAnswer = 0;
-	_proxyModel->setSourceModel(NULL);
-	ProgressDialog progressDialog(this);
-	progressDialog.setModal(true);
-	progressDialog.setValue(0);
-
-	connect(_uploader, SIGNAL(uploadProgress(float)), &progressDialog, SLOT(setValue(float)));
-	connect(_uploader, SIGNAL(uploadSpeed(qint64)), &progressDialog, SLOT(setSpeed(qint64)));
-	connect(_uploader, SIGNAL(uploadStarted(QString)), &progressDialog, SLOT(setFilename(QString)));
-	connect(_uploader, SIGNAL(finished()), &progressDialog, SLOT(accept()));
-	connect(&progressDialog, SIGNAL(abort()), _uploader, SLOT(abort()));
+	if (!_uploader->busy())
+		_uploadAnswer = 0;
+	showProgress(tr("Upload Progress"));
 	_uploader->upload(files);
-
-	progressDialog.exec();
-
-	_objectModel->moveToThread(QApplication::instance()->thread());
-	_proxyModel->setSourceModel(_objectModel);
 }
 
 
@@ -477,18 +553,28 @@ void MainWindow::downloadFiles(const QVector<mtp::ObjectId> &objects)
 void MainWindow::downloadFiles(const QString & path, const QVector<mtp::ObjectId> &objects)
 {
 	qDebug() << "downloading to " << path;
-	ProgressDialog progressDialog(this);
-	progressDialog.setWindowTitle(tr("Download Progress"));
-	progressDialog.show();
-
-	connect(_uploader, SIGNAL(uploadProgress(float)), &progressDialog, SLOT(setValue(float)));
-	connect(_uploader, SIGNAL(uploadSpeed(qint64)), &progressDialog, SLOT(setSpeed(qint64)));
-	connect(_uploader, SIGNAL(uploadStarted(QString)), &progressDialog, SLOT(setFilename(QString)));
-	connect(_uploader, SIGNAL(finished()), &progressDialog, SLOT(accept()));
-	connect(&progressDialog, SIGNAL(abort()), _uploader, SLOT(abort()));
+	showProgress(tr("Download Progress"));
 	_uploader->download(path, objects);
+}
 
-	progressDialog.exec();
+void MainWindow::showProgress(const QString &title)
+{
+	if (!_progressDialog)
+	{
+		//dialog is not modal, folders can be browsed and more transfers queued while it's shown
+		_progressDialog = new ProgressDialog(this);
+		_progressDialog->setValue(0);
+
+		connect(_uploader, SIGNAL(uploadProgress(float)), _progressDialog, SLOT(setValue(float)));
+		connect(_uploader, SIGNAL(uploadSpeed(qint64)), _progressDialog, SLOT(setSpeed(qint64)));
+		connect(_uploader, SIGNAL(uploadEta(qint64)), _progressDialog, SLOT(setEta(qint64)));
+		connect(_uploader, SIGNAL(uploadStarted(QString)), _progressDialog, SLOT(setFilename(QString)));
+		connect(_uploader, SIGNAL(finished()), _progressDialog, SLOT(deleteLater()));
+		connect(_progressDialog, SIGNAL(abort()), _uploader, SLOT(abort()));
+	}
+	_progressDialog->setWindowTitle(title);
+	_progressDialog->show();
+	_progressDialog->raise();
 }
 
 
@@ -643,11 +729,35 @@ void MainWindow::uploadAlbum(QString dirPath)
 void MainWindow::validateClipboard()
 {
 	QStringList files = _objectModel->extractMimeData(_clipboard->mimeData());
-	_ui->actionPaste->setEnabled(!files.isEmpty());
+	if (!files.isEmpty())
+		_deviceClipboard.clear(); //local files copied later take precedence
+	_ui->actionPaste->setEnabled(!files.isEmpty() || !_deviceClipboard.isEmpty());
+}
+
+void MainWindow::cutObjects()
+{
+	_deviceClipboard = selectedObjects();
+	_deviceClipboardMove = true;
+	_ui->actionPaste->setEnabled(!_deviceClipboard.isEmpty());
+}
+
+void MainWindow::copyObjects()
+{
+	_deviceClipboard = selectedObjects();
+	_deviceClipboardMove = false;
+	_ui->actionPaste->setEnabled(!_deviceClipboard.isEmpty());
 }
 
 void MainWindow::pasteFromClipboard()
 {
+	if (!_deviceClipboard.isEmpty())
+	{
+		_objectModel->copyObjects(_deviceClipboard, _deviceClipboardMove);
+		if (_deviceClipboardMove)
+			_deviceClipboard.clear(); //moved objects could not be pasted again
+		validateClipboard();
+		return;
+	}
 	//fixme: CHECK THAT THE MODEL IS NOT IN UPLOADER NOW
 	uploadFiles(_objectModel->extractMimeData(_clipboard->mimeData()));
 }
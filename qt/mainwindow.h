@@ -23,6 +23,7 @@
 #include <mtp/ptp/Device.h>
 #include <QMainWindow>
 #include <QModelIndex>
+#include <QPointer>
 #include <QVector>
 
 namespace Ui {
@@ -32,7 +33,9 @@ class MainWindow;
 class MtpObjectsModel;
 class MtpStoragesModel;
 class FileUploader;
+class ProgressDialog;
 
+class QAction;
 class QSortFilterProxyModel;
 class QClipboard;
 
@@ -51,13 +54,18 @@ private:
 	void showEvent(QShowEvent *e);
 	void closeEvent(QCloseEvent *event);
 	QModelIndex mapIndex(const QModelIndex &index);
+	QVector<mtp::ObjectId> selectedObjects();
 	void saveGeometry(const QString &name, const QWidget &widget);
 	void restoreGeometry(const QString &name, QWidget &widget);
+	void createSortMenu();
+	///shows progress of transfer queue, the same dialog is reused for batches queued while it's running
+	void showProgress(const QString &title);
 
 private slots:
 	bool reconnectToDevice();
 	void back();
 	void down();
+	void onObjectsLoaded();
 	void onActivated ( const QModelIndex & index );
 	void activate(const QModelIndex & index);
 	void updateActionsState();
@@ -75,9 +83,13 @@ private slots:
 	void uploadFiles(const QStringList &files);
 	void onStorageChanged(int idx);
 	void validateClipboard();
+	void cutObjects();
+	void copyObjects();
 	void pasteFromClipboard();
 	bool confirmOverwrite(const QString &file);
 	void showThumbnails(bool enable);
+	void sortBy(QAction *action);
+	void setSortDescending(bool descending);
 
 public slots:
 	void downloadFiles(const QString & path, const QVector<mtp::ObjectId> &objects);
@@ -89,9 +101,13 @@ private:
 	MtpStoragesModel *			_storageModel;
 	MtpObjectsModel *			_objectModel;
 	FileUploader *				_uploader;
+	QPointer<ProgressDialog>	_progressDialog;
 	typedef QVector<QPair<QString, mtp::ObjectId>> History;
 	History						_history;
 	int							_uploadAnswer;
+	QVector<mtp::ObjectId>		_deviceClipboard; //objects cut or copied on device
+	bool						_deviceClipboardMove;
+	mtp::ObjectId				_selectAfterLoad; //folder left with back(), selected when listing arrives
 
 	mtp::DevicePtr				_device;
 	mtp::SessionPtr				_session;
@@ -18,9 +18,92 @@
 */
 
 #include "mtpmimedata.h"
+#include "mtpobjectsmodel.h"
+#include "utils.h"
+#include <QDebug>
+#include <QDir>
+#if QT_VERSION >= 0x050000
+#	include <QMimeDatabase>
+#endif
+#include <mtp/ptp/MemoryObjectStream.h>
+#include <mtp/ptp/ObjectDownloader.h>
 
-MtpMimeData::MtpMimeData()
+namespace
 {
+	const QString UriList("text/uri-list");
+}
 
+MtpMimeData::MtpMimeData(MtpObjectsModel *model, const QVector<mtp::ObjectId> &objects, const QStringList &names):
+	_model(model), _objects(objects), _names(names)
+{
+#if QT_VERSION >= 0x050000
+	if (_objects.size() == 1)
+	{
+		QMimeType type = QMimeDatabase().mimeTypeForFile(_names.front(), QMimeDatabase::MatchExtension);
+		if (type.isValid() && !type.isDefault())
+			_mimeType = type.name();
+	}
+#endif
+}
+
+QStringList MtpMimeData::formats() const
+{
+	QStringList result(UriList);
+	if (!_mimeType.isEmpty())
+		result << _mimeType;
+	return result;
+}
+
+bool MtpMimeData::hasFormat(const QString &mimeType) const
+{ return mimeType == UriList || (!_mimeType.isEmpty() && mimeType == _mimeType); }
+
+QVariant MtpMimeData::retrieveData(const QString &mimeType, QVariant::Type type) const
+{
+	try
+	{
+		if (mimeType == UriList)
+		{
+			QList<QVariant> urls;
+			for(auto &url : download())
+				urls << url;
+			return urls;
+		}
+		if (!_mimeType.isEmpty() && mimeType == _mimeType)
+			return read();
+	}
+	catch(const std::exception &ex)
+	{ qWarning() << "fetching dragged objects failed: " << fromUtf8(ex.what()); }
+	return QMimeData::retrieveData(mimeType, type);
 }
 
+QList<QUrl> MtpMimeData::download() const
+{
+	if (!_urls.isEmpty())
+		return _urls;
+
+	//file managers accept paths only, objects are downloaded once target asked for them, not when drag starts
+	QString dir = QDir::tempPath() + "/android-file-transfer-drag";
+	if (!QDir().mkpath(dir))
+		throw std::runtime_error("cannot create " + dir.toStdString());
+
+	for(int i = 0; i < _objects.size(); ++i)
+	{
+		QString path = dir + "/" + _names[i];
+		if (_model->downloadFile(path, _objects[i]))
+			_urls << QUrl::fromLocalFile(path);
+	}
+	return _urls;
+}
+
+QByteArray MtpMimeData::read() const
+{
+	mtp::SessionPtr session = _model->session();
+	mtp::ObjectId objectId = _objects.front();
+	mtp::u64 size = session->GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize);
+
+	auto stream = std::make_shared<mtp::MemoryObjectOutputStream>();
+	mtp::ObjectDownloader downloader(session);
+	downloader.Download(objectId, stream, 0, size);
+	auto data = stream->GetData();
+	return QByteArray(reinterpret_cast<const char *>(data->data()), data->size());
+}
@@ -20,11 +20,34 @@
 #ifndef MTPMIMEDATA_H
 #define MTPMIMEDATA_H
 
+#include <QMimeData>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+#include <mtp/ptp/ObjectId.h>
 
-class MtpMimeData : public QMimeData
+class MtpObjectsModel;
+
+class MtpMimeData : public QMimeData //! dragged objects, nothing is fetched from device until drop target asks for data
 {
+	MtpObjectsModel *			_model;
+	QVector<mtp::ObjectId>		_objects;
+	QStringList					_names;
+	QString						_mimeType; //of single dragged file, its content goes to target without temporary copy
+	mutable QList<QUrl>			_urls; //local copies, made on first request only
+
+	QList<QUrl> download() const;
+	QByteArray read() const;
+
 public:
-	MtpMimeData();
+	MtpMimeData(MtpObjectsModel *model, const QVector<mtp::ObjectId> &objects, const QStringList &names);
+
+	virtual QStringList formats() const;
+	virtual bool hasFormat(const QString &mimeType) const;
+
+protected:
+	virtual QVariant retrieveData(const QString &mimeType, QVariant::Type type) const;
 };
 
 #endif // MTPMIMEDATA_H
@@ -0,0 +1,214 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "mtpobjectsloader.h"
+#include "utils.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <mtp/ptp/ObjectPropertyListParser.h>
+#include <map>
+#include <set>
+
+namespace
+{
+	class PropertyCollector //! builds ObjectInfo from ObjectProperty::All list, passes finished objects in chunks
+	{
+		MtpObjectsLoader::Callback						_callback;
+		mtp::StorageId									_storageId;
+		std::map<mtp::ObjectId, mtp::msg::ObjectInfoPtr>	_objects;
+		std::set<mtp::ObjectId>							_named, _passed;
+		MtpLoadedObjects								_pending;
+		mtp::ObjectId									_current;
+		bool											_started;
+
+		void complete(mtp::ObjectId objectId)
+		{
+			if (!_passed.insert(objectId).second)
+				return;
+
+			const mtp::msg::ObjectInfoPtr &info = _objects[objectId];
+			if (_storageId != mtp::Session::AllStorages && info->StorageId != mtp::StorageId() && info->StorageId != _storageId)
+				return;
+
+			_pending.push_back(qMakePair(objectId, info));
+			if (_pending.size() >= MtpObjectsLoader::ChunkSize)
+				flush();
+		}
+
+		void flush()
+		{
+			if (_pending.isEmpty())
+				return;
+			_callback(_pending);
+			_pending.clear();
+		}
+
+	public:
+		PropertyCollector(const MtpObjectsLoader::Callback &callback, mtp::StorageId storageId):
+			_callback(callback), _storageId(storageId), _started(false)
+		{ }
+
+		void operator()(mtp::ObjectId objectId, mtp::ObjectProperty property, const mtp::ObjectPropertyValue &value)
+		{
+			//devices list properties object by object, previous object is complete when id changes
+			if (_started && objectId != _current)
+				complete(_current);
+			_current = objectId;
+			_started = true;
+
+			mtp::msg::ObjectInfoPtr &info = _objects[objectId];
+			if (!info)
+				info = std::make_shared<mtp::msg::ObjectInfo>();
+			else if (_passed.erase(objectId))
+				info = std::make_shared<mtp::msg::ObjectInfo>(*info); //late property, passed copy is owned by model now
+
+			switch(property)
+			{
+			case mtp::ObjectProperty::StorageId:
+				info->StorageId = mtp::StorageId(value.Integer);
+				break;
+			case mtp::ObjectProperty::ObjectFormat:
+				info->ObjectFormat = static_cast<mtp::ObjectFormat>(value.Integer);
+				break;
+			case mtp::ObjectProperty::ObjectSize:
+				info->SetSize(value.Integer);
+				break;
+			case mtp::ObjectProperty::ObjectFilename:
+				info->Filename = value.String;
+				_named.insert(objectId);
+				break;
+			case mtp::ObjectProperty::DateCreated:
+				info->CaptureDate = value.String;
+				break;
+			case mtp::ObjectProperty::DateModified:
+				info->ModificationDate = value.String;
+				break;
+			default:
+				break;
+			}
+		}
+
+		///passes remaining objects, returns ids of objects which were listed without name
+		std::vector<mtp::ObjectId> finish()
+		{
+			if (_started)
+				complete(_current);
+			flush();
+
+			std::vector<mtp::ObjectId> unnamed;
+			for(auto &i : _objects)
+				if (!_named.count(i.first))
+					unnamed.push_back(i.first);
+			return unnamed;
+		}
+	};
+}
+
+MtpObjectsLoader::MtpObjectsLoader(const std::atomic<int> &generation): _generation(generation)
+{ }
+
+void MtpObjectsLoader::setScheduler(const mtp::AsyncSessionPtr &scheduler)
+{
+	QMutexLocker l(&_mutex);
+	_scheduler = scheduler;
+}
+
+bool MtpObjectsLoader::loadByPropertyList(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback)
+{
+	PropertyCollector collector(callback, storageId);
+	auto stream = std::make_shared<mtp::ObjectPropertyListStream<mtp::ObjectPropertyValue> >(std::ref(collector));
+	try
+	{
+		session->GetObjectPropertyList(parentId, mtp::ObjectFormat::Any, mtp::ObjectProperty::All, 0, 1, stream);
+		stream->Finish();
+	}
+	catch(const std::exception &ex)
+	{
+		qDebug() << "GetObjectPropList failed: " << fromUtf8(ex.what());
+		collector.finish();
+		return false;
+	}
+
+	MtpLoadedObjects objects;
+	auto unnamed = collector.finish();
+	auto infos = session->GetObjectInfos(unnamed, parentId);
+	for(size_t i = 0; i < unnamed.size(); ++i)
+	{
+		if (!infos[i].Filename.empty())
+			objects.push_back(qMakePair(unnamed[i], std::make_shared<mtp::msg::ObjectInfo>(infos[i])));
+		else
+			qDebug() << "failed to get object info " << unnamed[i].Id;
+	}
+	if (!objects.isEmpty())
+		callback(objects);
+	return true;
+}
+
+void MtpObjectsLoader::loadByObjectInfo(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback)
+{
+	mtp::msg::ObjectHandles handles = session->GetObjectHandles(storageId, mtp::ObjectFormat::Any, parentId);
+	const auto &ids = handles.ObjectHandles;
+	for(size_t begin = 0; begin < ids.size(); begin += ChunkSize)
+	{
+		std::vector<mtp::ObjectId> chunk(ids.begin() + begin, ids.begin() + std::min<size_t>(begin + ChunkSize, ids.size()));
+		auto infos = session->GetObjectInfos(chunk);
+		MtpLoadedObjects objects;
+		for(size_t i = 0; i < chunk.size(); ++i)
+			objects.push_back(qMakePair(chunk[i], std::make_shared<mtp::msg::ObjectInfo>(infos[i])));
+		callback(objects);
+	}
+}
+
+void MtpObjectsLoader::fetch(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback)
+{
+	//if property list fails halfway, listing is fetched again object by object, model updates objects it already has
+	if (!session->GetObjectPropertyListSupported() || !loadByPropertyList(session, storageId, parentId, callback))
+		loadByObjectInfo(session, storageId, parentId, callback);
+}
+
+void MtpObjectsLoader::fetch(const mtp::AsyncSessionPtr &scheduler, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback)
+{
+	mtp::SessionPtr session = scheduler->GetSession();
+	scheduler->Submit([session, storageId, parentId, callback](mtp::Session &)
+	{ fetch(session, storageId, parentId, callback); }, mtp::AsyncSession::Priority::Interactive).get();
+}
+
+void MtpObjectsLoader::load(int generation, quint32 storageId, quint32 parentId)
+{
+	mtp::AsyncSessionPtr scheduler;
+	{
+		QMutexLocker l(&_mutex);
+		scheduler = _scheduler;
+	}
+	if (!scheduler || generation != _generation.load())
+		return; //folder was changed while request was queued
+
+	bool complete = false;
+	try
+	{
+		fetch(scheduler, mtp::StorageId(storageId), mtp::ObjectId(parentId), [this, generation](const MtpLoadedObjects &objects)
+		{
+			if (generation == _generation.load())
+				emit objectsLoaded(generation, objects);
+		});
+		complete = true;
+	}
+	catch(const std::exception &ex)
+	{ qDebug() << "loading objects failed: " << fromUtf8(ex.what()); }
+	emit loadFinished(generation, complete);
+}
@@ -0,0 +1,72 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef MTPOBJECTSLOADER_H
+#define MTPOBJECTSLOADER_H
+
+#include <QObject>
+#include <QMetaType>
+#include <QMutex>
+#include <QPair>
+#include <QVector>
+#include <mtp/ptp/Messages.h>
+#include <mtp/ptp/AsyncSession.h>
+#include <atomic>
+#include <functional>
+
+typedef QVector<QPair<mtp::ObjectId, mtp::msg::ObjectInfoPtr> > MtpLoadedObjects;
+Q_DECLARE_METATYPE(MtpLoadedObjects)
+
+class MtpObjectsLoader : public QObject //! fetches directory listing in background thread and passes it in chunks, so large folders do not block ui
+{
+	Q_OBJECT
+
+public:
+	typedef std::function<void (const MtpLoadedObjects &)> Callback;
+	static const int ChunkSize = 64;
+
+private:
+	const std::atomic<int> &	_generation;
+	QMutex				_mutex;
+	mtp::AsyncSessionPtr	_scheduler;
+
+	static bool loadByPropertyList(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback);
+	static void loadByObjectInfo(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback);
+
+signals:
+	void objectsLoaded(int generation, MtpLoadedObjects objects);
+	///complete is false if listing failed halfway, objects which were not passed may still exist
+	void loadFinished(int generation, bool complete);
+
+public slots:
+	void load(int generation, quint32 storageId, quint32 parentId);
+
+public:
+	///generation is incremented by the model each time listing changes, stale requests are skipped
+	MtpObjectsLoader(const std::atomic<int> &generation);
+
+	///listings are submitted as interactive jobs, so they are answered between chunks of running transfer
+	void setScheduler(const mtp::AsyncSessionPtr &scheduler);
+
+	///fetches listing in calling thread, uses GetObjectPropList if device supports it, falls back to GetObjectInfo per object
+	static void fetch(const mtp::SessionPtr &session, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback);
+	///same as above, but runs listing as interactive job of scheduler and waits for it, callback is invoked from scheduler thread
+	static void fetch(const mtp::AsyncSessionPtr &scheduler, mtp::StorageId storageId, mtp::ObjectId parentId, const Callback &callback);
+};
+
+#endif // MTPOBJECTSLOADER_H
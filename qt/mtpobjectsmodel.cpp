@@ -18,52 +18,217 @@
 */
 
 #include "mtpobjectsmodel.h"
+#include "mtpmimedata.h"
 #include "qtobjectstream.h"
 #include "utils.h"
 #include <QDebug>
 #include <QBrush>
 #include <QColor>
+#include <QDateTime>
 #include <QIcon>
 #include <QFile>
 #include <QFont>
 #include <QFileInfo>
 #include <QMimeData>
 #include <QUrl>
-
-#include <mtp/ptp/MemoryObjectStream.h>
+#include <algorithm>
+
+#include <mtp/ptp/AsyncObjectInputStream.h>
+#include <mtp/ptp/AsyncObjectOutputStream.h>
+#include <mtp/ptp/ObjectCopier.h>
+#include <mtp/ptp/ObjectDeleter.h>
+#include <mtp/ptp/ObjectDownloader.h>
+#include <mtp/ptp/ObjectUploader.h>
 #include <cli/PosixStreams.h> //for mtime
+#include <cli/UploadCheckpoint.h>
 
 MtpObjectsModel::MtpObjectsModel(QObject *parent):
 	QAbstractListModel(parent),
+	_eventSubscription(-1),
 	_storageId(mtp::Session::AllStorages),
 	_parentObjectId(mtp::Session::Root),
-	_enableThumbnails(false)
-{ }
+	_enableThumbnails(false),
+	_generation(0),
+	_refreshing(false)
+{
+	qRegisterMetaType<MtpLoadedObjects>("MtpLoadedObjects");
+	_loader = new MtpObjectsLoader(_generation);
+	_loader->moveToThread(&_loaderThread);
+	connect(&_loaderThread, SIGNAL(finished()), _loader, SLOT(deleteLater()));
+	connect(this, SIGNAL(loadObjects(int,quint32,quint32)), _loader, SLOT(load(int,quint32,quint32)));
+	//loader emits from scheduler thread, rows are touched by model's thread only
+	connect(_loader, SIGNAL(objectsLoaded(int,MtpLoadedObjects)), this, SLOT(onObjectsLoaded(int,MtpLoadedObjects)), Qt::QueuedConnection);
+	connect(_loader, SIGNAL(loadFinished(int,bool)), this, SLOT(onLoadFinished(int,bool)), Qt::QueuedConnection);
+	_loaderThread.start();
+
+	_thumbnails.setMaxCost(ThumbnailCacheSize);
+	_thumbnailLoader = new MtpThumbnailLoader;
+	_thumbnailLoader->moveToThread(&_thumbnailThread);
+	connect(&_thumbnailThread, SIGNAL(finished()), _thumbnailLoader, SLOT(deleteLater()));
+	connect(_thumbnailLoader, SIGNAL(thumbnailLoaded(quint32,QSize,QImage)), this, SLOT(onThumbnailLoaded(quint32,QSize,QImage)));
+	_thumbnailThread.start();
+}
 
 MtpObjectsModel::~MtpObjectsModel()
-{ }
+{
+	if (_session)
+		_session->UnsubscribeEvents(_eventSubscription);
+	++_generation; //skip queued requests
+	_loaderThread.quit();
+	_thumbnailLoader->cancel();
+	_thumbnailThread.quit();
+	_loaderThread.wait();
+	_thumbnailThread.wait();
+}
 
 void MtpObjectsModel::setStorageId(mtp::StorageId storageId)
 {
 	_storageId = storageId;
-	setParent(mtp::Session::Root);
+	reset(mtp::Session::Root);
 }
 
 void MtpObjectsModel::setParent(mtp::ObjectId parentObjectId)
+{
+	if (parentObjectId == _parentObjectId)
+		refresh();
+	else
+		reset(parentObjectId);
+}
+
+void MtpObjectsModel::reset(mtp::ObjectId parentObjectId)
 {
 	beginResetModel();
 
 	_parentObjectId = parentObjectId;
-	mtp::msg::ObjectHandles handles = _session->GetObjectHandles(_storageId, mtp::ObjectFormat::Any, parentObjectId);
 	_rows.clear();
-	_rows.reserve(handles.ObjectHandles.size());
-	for(size_t i = 0; i < handles.ObjectHandles.size(); ++i)
+	_rowIndex.clear();
+	_nameIndex.clear();
+	_thumbnailLoader->cancel();
+	_refreshing = false;
+	_listed.clear();
+	int generation = ++_generation;
+
+	endResetModel();
+
+	load(generation);
+}
+
+void MtpObjectsModel::refresh()
+{
+	_refreshing = true;
+	_listed.clear();
+	load(++_generation);
+}
+
+void MtpObjectsModel::load(int generation)
+{
+	if (!_session)
+		return;
+
+	emit loadObjects(generation, _storageId.Id, _parentObjectId.Id);
+}
+
+void MtpObjectsModel::finishRefresh(bool complete)
+{
+	if (!_refreshing)
+		return;
+	_refreshing = false;
+
+	//rows missing from complete listing were removed by someone else
+	std::set<mtp::ObjectId> removed;
+	if (complete)
 	{
-		mtp::ObjectId oid = handles.ObjectHandles[i];
-		_rows.append(Row(oid));
+		for(auto &row : _rows)
+			if (!_listed.contains(row.ObjectId.Id))
+				removed.insert(row.ObjectId);
 	}
+	_listed.clear();
+	removeObjectRows(removed);
+}
 
-	endResetModel();
+void MtpObjectsModel::appendRow(const Row &row)
+{
+	Q_ASSERT(QThread::currentThread() == thread());
+	beginInsertRows(QModelIndex(), _rows.size(), _rows.size());
+	_rows.push_back(row);
+	indexRow(_rows.size() - 1);
+	endInsertRows();
+}
+
+void MtpObjectsModel::indexRow(int idx)
+{
+	Row &row = _rows[idx];
+	_rowIndex[row.ObjectId.Id] = idx;
+	if (row.HasInfo())
+		_nameIndex[fromUtf8(row.GetInfo(_session)->Filename)] = row.ObjectId;
+}
+
+void MtpObjectsModel::reindexRows()
+{
+	_rowIndex.clear();
+	_nameIndex.clear();
+	for(int i = 0; i < _rows.size(); ++i)
+		indexRow(i);
+}
+
+bool MtpObjectsModel::sameInfo(const mtp::msg::ObjectInfo &a, const mtp::msg::ObjectInfo &b)
+{
+	return a.Filename == b.Filename && a.ObjectFormat == b.ObjectFormat && a.ObjectSize == b.ObjectSize &&
+		a.ModificationDate == b.ModificationDate && a.StorageId == b.StorageId;
+}
+
+void MtpObjectsModel::onObjectsLoaded(int generation, MtpLoadedObjects objects)
+{
+	Q_ASSERT(QThread::currentThread() == thread());
+	if (generation != _generation)
+		return;
+
+	QVector<Row> rows;
+	for(auto &object : objects)
+	{
+		if (_refreshing)
+			_listed.insert(object.first.Id);
+
+		auto existing = _rowIndex.find(object.first.Id);
+		if (existing != _rowIndex.end())
+		{
+			//row was added by upload or listing was refreshed, update its info if it changed
+			int idx = existing.value();
+			Row &row = _rows[idx];
+			const mtp::msg::ObjectInfoPtr &info = row.PeekInfo();
+			if (info && sameInfo(*info, *object.second))
+				continue;
+			if (info)
+			{
+				_nameIndex.remove(fromUtf8(info->Filename));
+				if (info->ModificationDate != object.second->ModificationDate)
+					_thumbnails.remove(thumbnailKey(row.ObjectId, thumbnailSize()));
+			}
+			row.SetInfo(object.second);
+			indexRow(idx);
+			emit dataChanged(createIndex(idx, 0), createIndex(idx, 0));
+		}
+		else
+			rows.push_back(Row(object.first, object.second));
+	}
+	if (rows.isEmpty())
+		return;
+
+	beginInsertRows(QModelIndex(), _rows.size(), _rows.size() + rows.size() - 1);
+	for(auto &row : rows)
+	{
+		_rows.push_back(row);
+		indexRow(_rows.size() - 1);
+	}
+	endInsertRows();
+}
+
+void MtpObjectsModel::onLoadFinished(int generation, bool complete)
+{
+	if (generation != _generation)
+		return;
+	finishRefresh(complete);
+	emit objectsLoaded();
 }
 
 bool MtpObjectsModel::enter(int idx)
@@ -83,24 +248,111 @@ bool MtpObjectsModel::enter(int idx)
 
 QModelIndex MtpObjectsModel::findObject(mtp::ObjectId objectId) const
 {
-	auto idx = std::find_if(_rows.begin(), _rows.end(), [objectId](const Row & row) { return row.ObjectId == objectId; } );
-	return idx != _rows.end()? createIndex(std::distance(_rows.begin(), idx), 0): QModelIndex();
+	auto i = _rowIndex.find(objectId.Id);
+	return i != _rowIndex.end()? createIndex(i.value(), 0): QModelIndex();
 }
 
 QModelIndex MtpObjectsModel::findObject(const QString &filename) const
 {
-	auto idx = std::find_if(_rows.begin(), _rows.end(), [filename, this](Row & row) { return fromUtf8(row.GetInfo(_session)->Filename) == filename; } );
-	return idx != _rows.end()? createIndex(std::distance(_rows.begin(), idx), 0): QModelIndex();
+	auto i = _nameIndex.find(filename);
+	if (i != _nameIndex.end())
+		return findObject(i.value());
+
+	//rows added without metadata or filled lazily by data() are not indexed by name yet
+	for(int idx = 0; idx < _rows.size(); ++idx)
+	{
+		Row &row = _rows[idx];
+		QString name = fromUtf8(row.GetInfo(_session)->Filename);
+		if (name.isEmpty())
+			continue;
+		_nameIndex[name] = row.ObjectId;
+		if (name == filename)
+			return createIndex(idx, 0);
+	}
+	return QModelIndex();
 }
 
 void MtpObjectsModel::setSession(mtp::SessionPtr session)
 {
 	beginResetModel();
+	if (_session)
+		_session->UnsubscribeEvents(_eventSubscription);
 	_session = session;
-	setParent(mtp::Session::Root);
+	_scheduler = _session? std::make_shared<mtp::AsyncSession>(_session): mtp::AsyncSessionPtr();
+	if (_session)
+	{
+		//listener thread must not block, events are applied from model's thread
+		_eventSubscription = _session->SubscribeEvents([this](const mtp::Event &event) {
+			QMetaObject::invokeMethod(this, "onDeviceEvent", Qt::QueuedConnection,
+				Q_ARG(int, static_cast<int>(event.Code)), Q_ARG(quint32, event.GetParam(0)));
+		});
+	}
+	_loader->setScheduler(_scheduler);
+	_thumbnailLoader->setSession(session);
+	_thumbnails.clear();
+	reset(mtp::Session::Root);
 	endResetModel();
 }
 
+void MtpObjectsModel::onDeviceEvent(int code, quint32 objectId)
+{
+	if (!_session)
+		return;
+
+	mtp::ObjectId id(objectId);
+	try
+	{
+		switch(static_cast<mtp::EventCode>(code))
+		{
+		case mtp::EventCode::ObjectAdded:
+			if (!findObject(id).isValid())
+				updateObjectRow(id);
+			break;
+		case mtp::EventCode::ObjectRemoved:
+			removeObjectRows(std::set<mtp::ObjectId>({id}));
+			break;
+		case mtp::EventCode::ObjectInfoChanged:
+		case mtp::EventCode::ObjectPropChanged:
+			if (findObject(id).isValid())
+				updateObjectRow(id);
+			break;
+		default:
+			break;
+		}
+	}
+	catch(const std::exception &ex)
+	{ qDebug() << "handling device event failed: " << fromUtf8(ex.what()); }
+}
+
+void MtpObjectsModel::updateObjectRow(mtp::ObjectId objectId)
+{
+	auto info = std::make_shared<mtp::msg::ObjectInfo>(_session->GetObjectInfo(objectId));
+	mtp::ObjectId parent = info->ParentObject == mtp::Session::Device? mtp::Session::Root: info->ParentObject;
+	bool visible = parent == _parentObjectId && (_storageId == mtp::Session::AllStorages || info->StorageId == _storageId);
+
+	QModelIndex index = findObject(objectId);
+	if (!index.isValid())
+	{
+		if (visible)
+			appendRow(Row(objectId, info));
+		return;
+	}
+	if (!visible) //moved away
+	{
+		removeObjectRows(std::set<mtp::ObjectId>({objectId}));
+		return;
+	}
+
+	int idx = index.row();
+	Row &row = _rows[idx];
+	if (row.HasInfo())
+		_nameIndex.remove(fromUtf8(row.GetInfo(_session)->Filename));
+	row.SetInfo(info);
+	indexRow(idx);
+	_thumbnails.remove(thumbnailKey(objectId, thumbnailSize()));
+	emit dataChanged(index, index);
+}
+
 int MtpObjectsModel::rowCount(const QModelIndex &) const
 { return _rows.size(); }
 
@@ -120,33 +372,50 @@ mtp::msg::ObjectInfoPtr MtpObjectsModel::Row::GetInfo(mtp::SessionPtr session)
 	return _info;
 }
 
-MtpObjectsModel::ThumbnailPtr MtpObjectsModel::Row::GetThumbnail(mtp::SessionPtr session, QSize maxSize)
+void MtpObjectsModel::onThumbnailLoaded(quint32 objectId, QSize size, QImage image)
 {
-	if (!_thumbnail)
-	{
-		auto stream = std::make_shared<mtp::MemoryObjectOutputStream>();
-		_thumbnail = std::make_shared<QPixmap>();
-		try
-		{
-			qDebug() << "requesting thumbnail for " << ObjectId.Id;
-			session->GetThumb(ObjectId, stream);
+	//pixmaps can be created in ui thread only, decoding and scaling is done by loader
+	QPixmap *pixmap = new QPixmap;
+	if (image.isNull())
+		*pixmap = QIcon::fromTheme("image-missing").pixmap(size);
+	else
+		*pixmap = QPixmap::fromImage(image);
+	int cost = std::max(1, pixmap->width() * pixmap->height() * pixmap->depth() / 8);
+	_thumbnails.insert(thumbnailKey(mtp::ObjectId(objectId), size), pixmap, cost);
 
-			auto data = stream->GetData();
-			QPixmap pixmap;
-			if (!pixmap.loadFromData(data->data(), data->size()))
-				throw std::runtime_error("couldn't load pixmap");
+	QModelIndex index = findObject(mtp::ObjectId(objectId));
+	if (index.isValid())
+		emit dataChanged(index, index);
+}
 
-			*_thumbnail = pixmap.scaled(maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+QVariant MtpObjectsModel::sortKey(const Row &row, int role)
+{
+	//rows without metadata yet sort first and move once their info arrives
+	const mtp::msg::ObjectInfoPtr &info = row.PeekInfo();
+	if (!info)
+		return QVariant();
 
-			qDebug() << "loaded " << data->size() << " bytes of thumbnail data";
-		}
-		catch(const std::exception &ex)
+	bool association = info->ObjectFormat == mtp::ObjectFormat::Association || info->ObjectFormat == mtp::ObjectFormat::AudioAlbum;
+	switch(role)
+	{
+	case NameRole:
+		return fromUtf8(info->Filename);
+	case SizeRole:
+		return association? qint64(-1): qint64(info->ObjectSize);
+	case DateRole:
+		return fromUtf8(info->ModificationDate); //YYYYMMDDThhmmss, lexical order is chronological
+	case TypeRole:
 		{
-			qDebug() << "failed to get thumbnail" << fromUtf8(ex.what());
-			*_thumbnail = QIcon::fromTheme("image-missing").pixmap(maxSize);
+			//directories first, then by extension
+			if (association)
+				return QString();
+			QString name = fromUtf8(info->Filename);
+			int dot = name.lastIndexOf('.');
+			return dot >= 0? "." + name.mid(dot + 1).toLower(): QString(".");
 		}
+	default:
+		return QVariant();
 	}
-	return _thumbnail;
 }
 
 bool MtpObjectsModel::Row::IsAssociation(mtp::SessionPtr session)
@@ -159,21 +428,70 @@ void MtpObjectsModel::rename(int idx, const QString &fileName)
 {
 	qDebug() << "renaming row " << idx << " to " << fileName;
 	_session->SetObjectProperty(objectIdAt(idx), mtp::ObjectProperty::ObjectFilename, toUtf8(fileName));
-	_rows[idx].ResetInfo();
+	Row &row = _rows[idx];
+	auto info = std::make_shared<mtp::msg::ObjectInfo>(*row.GetInfo(_session));
+	_nameIndex.remove(fromUtf8(info->Filename));
+	info->Filename = toUtf8(fileName);
+	row.SetInfo(info);
+	indexRow(idx);
 	emit dataChanged(createIndex(idx, 0), createIndex(idx, 0));
 }
 
 void MtpObjectsModel::deleteObjects(const MtpObjectList &objects)
 {
+	mtp::ObjectDeleter deleter(_session);
+	std::vector<mtp::ObjectId> list(objects.begin(), objects.end());
+	qDebug() << "deleting " << list.size() << " objects";
+	size_t count = 0;
+	try
+	{ deleter.Delete(list, &count); } //back to back DeleteObject, single one for whole directory
+	catch(...)
+	{
+		removeObjectRows(std::set<mtp::ObjectId>(list.begin(), list.begin() + count));
+		throw;
+	}
+	removeObjectRows(std::set<mtp::ObjectId>(list.begin(), list.end()));
+}
+
+void MtpObjectsModel::removeObjectRows(const std::set<mtp::ObjectId> &objects)
+{
+	Q_ASSERT(QThread::currentThread() == thread());
+	//remove contiguous ranges from the end, no re-enumeration of parent directory
+	for(int end = _rows.size(); end > 0; )
+	{
+		if (!objects.count(_rows[end - 1].ObjectId))
+		{
+			--end;
+			continue;
+		}
+		int begin = end - 1;
+		while(begin > 0 && objects.count(_rows[begin - 1].ObjectId))
+			--begin;
+		beginRemoveRows(QModelIndex(), begin, end - 1);
+		_rows.remove(begin, end - begin);
+		reindexRows();
+		endRemoveRows();
+		end = begin;
+	}
+}
+
+void MtpObjectsModel::copyObjects(const MtpObjectList &objects, bool move)
+{
+	mtp::ObjectCopier copier(_session);
 	for(mtp::ObjectId objectId: objects)
 	{
-		qDebug() << "deleting object " << objectId;
-		_session->DeleteObject(objectId);
+		mtp::StorageId storageId = _parentObjectId != mtp::Session::Root? _session->GetObjectStorage(_parentObjectId): _storageId;
+		if (storageId == mtp::Session::AllStorages)
+			storageId = _session->GetObjectStorage(objectId);
+		qDebug() << (move? "moving object ": "copying object ") << objectId;
+		if (move)
+			copier.Move(objectId, storageId, _parentObjectId);
+		else
+			copier.Copy(objectId, storageId, _parentObjectId);
 	}
 	refresh();
 }
 
-
 mtp::ObjectId MtpObjectsModel::objectIdAt(int idx)
 {
 	return (idx >= 0 && idx < _rows.size())? _rows[idx].ObjectId: mtp::ObjectId();
@@ -203,7 +521,15 @@ QVariant MtpObjectsModel::data(const QModelIndex &index, int role) const
 
 	case Qt::DecorationRole:
 		if (_enableThumbnails)
-			return *row.GetThumbnail(_session, QSize(_maxThumbnailSize.width(), _maxThumbnailSize.height() / 1.5f));
+		{
+			QSize size = thumbnailSize();
+			if (QPixmap *pixmap = _thumbnails.object(thumbnailKey(row.ObjectId, size)))
+				return *pixmap;
+			//only visible rows are asked for decoration, newest requests are served first
+			auto info = row.GetInfo(_session);
+			_thumbnailLoader->request(row.ObjectId, info->ObjectFormat, size, fromUtf8(info->ModificationDate));
+			return QVariant();
+		}
 		else
 			return QVariant();
 
@@ -213,6 +539,12 @@ QVariant MtpObjectsModel::data(const QModelIndex &index, int role) const
 		else
 			return QVariant();
 
+	case NameRole:
+	case SizeRole:
+	case DateRole:
+	case TypeRole:
+		return sortKey(row, role);
+
 	default:
 		return QVariant();
 	}
@@ -228,86 +560,189 @@ mtp::ObjectId MtpObjectsModel::createDirectory(mtp::ObjectId parentObjectId, con
 	mtp::Session::NewObjectInfo noi = _session->CreateDirectory(toUtf8(name), parentObjectId, storageId, type);
 	if (parentObjectId == _parentObjectId)
 	{
-		beginInsertRows(QModelIndex(), _rows.size(), _rows.size());
-		_rows.push_back(Row(noi.ObjectId));
-		endInsertRows();
+		auto info = std::make_shared<mtp::msg::ObjectInfo>();
+		info->Filename = toUtf8(name);
+		info->ObjectFormat = mtp::ObjectFormat::Association;
+		info->AssociationType = type;
+		info->StorageId = noi.StorageId;
+		info->ParentObject = noi.ParentObjectId;
+		appendRow(Row(noi.ObjectId, info));
 	}
 	return noi.ObjectId;
 }
 
-bool MtpObjectsModel::uploadFile(mtp::ObjectId parentObjectId, const QString &filePath, QString filename)
+MtpPreparedUploadPtr MtpObjectsModel::prepareUpload(const QString &filePath)
 {
-	QFileInfo fileInfo(filePath);
-	mtp::ObjectFormat objectFormat = mtp::ObjectFormatFromFilename(toUtf8(filePath));
+	std::shared_ptr<QtObjectInputStream> object(new QtObjectInputStream(filePath));
+	if (!object->Valid())
+	{
+		qWarning() << "file " << filePath << " could not be opened";
+		return MtpPreparedUploadPtr();
+	}
+
+	auto upload = std::make_shared<MtpPreparedUpload>();
+	upload->FilePath = filePath;
+	upload->Size = object->GetSize();
+	upload->Stream = object;
+	//file is read ahead from background thread, positionChanged is delivered through queued connection
+	upload->Source = std::make_shared<mtp::AsyncObjectInputStream>(object);
+	upload->Format = std::async(std::launch::async, &mtp::ObjectFormatFromFilename, toUtf8(filePath), true).share();
+	return upload;
+}
 
+bool MtpObjectsModel::uploadFile(mtp::ObjectId parentObjectId, const MtpPreparedUploadPtr &upload, QString filename)
+{
+	if (!upload)
+		return false;
+
+	QFileInfo fileInfo(upload->FilePath);
 	if (filename.isEmpty())
 		filename = fileInfo.fileName();
 
 	qDebug() << "uploadFile " << fileInfo.fileName() << " as " << filename;
 
-	bool needReset = false;
-	QModelIndex existingObject = findObject(filename);
+	mtp::StorageId storageId = _storageId != mtp::Session::AllStorages? _storageId: mtp::Session::AnyStorage;
+	time_t mtime = fileInfo.lastModified().toMSecsSinceEpoch() / 1000;
+	mtp::ObjectUploader uploader(_session);
+	//large objects are sent in committed chunks, so interrupted upload is continued by next attempt
+	bool checkpointed = static_cast<mtp::u64>(upload->Size) > mtp::ObjectUploader::DefaultChunkSize && uploader.CanCheckpoint();
+	cli::UploadCheckpoint checkpoint(_session->GetDeviceInfo().SerialNumber, storageId, parentObjectId, toUtf8(filename));
+	cli::UploadCheckpoint::State state;
+	bool resume = false;
+
+	QModelIndex existingObject = parentObjectId == _parentObjectId? findObject(filename): QModelIndex();
 	if (existingObject.isValid())
 	{
-		if (!emit existingFileOverwrite(filename))
+		mtp::ObjectId existingId = _rows.at(existingObject.row()).ObjectId;
+		resume = checkpointed && checkpoint.Load(state, upload->Size, mtime) &&
+			state.ObjectId == existingId && uploader.CanResume(existingId, state.Committed, upload->Size);
+		if (!resume)
 		{
-			qDebug() << "skipping, overwrite not confirmed";
-			return false;
+			if (!emit existingFileOverwrite(filename))
+			{
+				qDebug() << "skipping, overwrite not confirmed";
+				return false;
+			}
+			_session->DeleteObject(existingId);
+			removeObjectRows(std::set<mtp::ObjectId>({existingId}));
 		}
-		_session->DeleteObject(_rows.at(existingObject.row()).ObjectId);
-		needReset = parentObjectId == _parentObjectId;
 	}
 
-	std::shared_ptr<QtObjectInputStream> object(new QtObjectInputStream(filePath));
-	if (!object->Valid())
+	auto stream = upload->Stream;
+	auto source = upload->Source;
+	if (resume)
 	{
-		qWarning() << "file " << filePath << " could not be opened";
-		return false;
+		qDebug() << "resuming upload of " << filename << " from " << state.Committed;
+		//prepared stream is already read ahead from the beginning
+		stream = std::make_shared<QtObjectInputStream>(upload->FilePath);
+		if (!stream->Valid() || !stream->seek(state.Committed))
+		{
+			qWarning() << "file " << upload->FilePath << " could not be opened";
+			return false;
+		}
+		source = std::make_shared<mtp::AsyncObjectInputStream>(stream);
 	}
-	qDebug() << "sending " << fileInfo.size() << " bytes";
-	connect(object.get(), SIGNAL(positionChanged(qint64,qint64)), this, SIGNAL(filePositionChanged(qint64,qint64)));
+
+	qDebug() << "sending " << upload->Size << " bytes";
+	connect(stream.get(), SIGNAL(positionChanged(qint64,qint64)), this, SIGNAL(filePositionChanged(qint64,qint64)));
 
 	mtp::msg::ObjectInfo oi;
 	oi.Filename = toUtf8(filename);
-	oi.ObjectFormat = objectFormat;
-	oi.SetSize(fileInfo.size());
-	mtp::Session::NewObjectInfo noi = _session->SendObjectInfo(oi, _storageId != mtp::Session::AllStorages? _storageId: mtp::Session::AnyStorage, parentObjectId);
-	qDebug() << "new object id: " << noi.ObjectId << ", sending...";
-	_session->SendObject(object);
-	qDebug() << "ok";
-	if (parentObjectId == _parentObjectId)
+	oi.ObjectFormat = upload->Format.get();
+	oi.SetSize(upload->Size);
+	if (!checkpointed)
+	{
+		mtp::Session::NewObjectInfo noi = _session->CreateObject(oi, upload->Size, storageId, parentObjectId);
+		qDebug() << "new object id: " << noi.ObjectId << ", sending...";
+		_session->SendObject(source);
+		qDebug() << "ok";
+		if (parentObjectId == _parentObjectId)
+		{
+			//row is complete without asking device, everything but dates was sent by us
+			oi.StorageId = noi.StorageId;
+			oi.ParentObject = noi.ParentObjectId;
+			appendRow(Row(noi.ObjectId, std::make_shared<mtp::msg::ObjectInfo>(oi)));
+		}
+		return true;
+	}
+
+	if (!resume)
 	{
-		beginInsertRows(QModelIndex(), _rows.size(), _rows.size());
-		_rows.push_back(Row(noi.ObjectId));
-		endInsertRows();
+		mtp::Session::NewObjectInfo noi = uploader.Create(oi, storageId, parentObjectId);
+		qDebug() << "new object id: " << noi.ObjectId << ", sending in chunks...";
+		state.ObjectId = noi.ObjectId;
+		state.Size = upload->Size;
+		state.ModificationTime = mtime;
+		checkpoint.Save(state);
+		if (parentObjectId == _parentObjectId)
+		{
+			//row is shown while object is sent, so failed upload could be retried on it
+			oi.StorageId = noi.StorageId;
+			oi.ParentObject = noi.ParentObjectId;
+			appendRow(Row(noi.ObjectId, std::make_shared<mtp::msg::ObjectInfo>(oi)));
+		}
 	}
-	if (needReset)
-		refresh();
+	uploader.Upload(state.ObjectId, source, state.Committed, upload->Size, [&](mtp::u64 committed)
+	{
+		state.Committed = committed;
+		checkpoint.Save(state);
+	});
+	checkpoint.Remove();
+	qDebug() << "ok";
 	return true;
 }
 
 bool MtpObjectsModel::downloadFile(const QString &filePath, mtp::ObjectId objectId)
 {
-	auto object = std::make_shared<QtObjectOutputStream>(filePath);
+	std::string path = filePath.toStdString();
+	mtp::u64 size = _session->GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize);
+	time_t mtime = _session->GetObjectModificationTime(objectId);
+
+	mtp::ObjectDownloader downloader(_session);
+	mtp::u64 offset = cli::ObjectOutputStream::GetResumeOffset(path, size, mtime);
+	if (offset && !downloader.CanResume(offset, size))
+		offset = 0;
+	if (offset)
+		qDebug() << "resuming download of " << filePath << " from " << offset;
+
+	auto object = std::make_shared<QtObjectOutputStream>(filePath, offset != 0);
 	if (!object->Valid())
 	{
 		qWarning() << "cannot open file " << filePath;
 		return false;
 	}
 	connect(object.get(), SIGNAL(positionChanged(qint64,qint64)), this, SIGNAL(filePositionChanged(qint64,qint64)));
-	_session->GetObject(objectId, object);
+	object->setSize(size);
+	if (!offset)
+		object->preallocate(size);
+	//file is written from background thread, positionChanged is delivered through queued connection
+	auto async = std::make_shared<mtp::AsyncObjectOutputStream>(object);
+	try
+	{
+		downloader.Download(objectId, async, offset, size);
+		async->Finish();
+	}
+	catch(...)
+	{
+		async.reset();
+		object.reset();
+		//mark partial file, next download continues from its length
+		if (mtime)
+		{
+			try { cli::ObjectOutputStream::SetModificationTime(path, mtime); } catch(const std::exception &ex) { }
+		}
+		throw;
+	}
+	async.reset();
 	object.reset();
-	cli::ObjectOutputStream::SetModificationTime(filePath.toStdString(), _session->GetObjectModificationTime(objectId));
+	cli::ObjectOutputStream::SetModificationTime(path, mtime);
 	return true;
 }
 
 MtpObjectsModel::ObjectInfo MtpObjectsModel::getInfoById(mtp::ObjectId objectId) const
 {
-	mtp::msg::ObjectInfo oi(_session->GetObjectInfo(objectId));
-	qint64 size = oi.ObjectCompressedSize;
-	if (size == mtp::MaxObjectSize)
-		size = _session->GetObjectIntegerProperty(objectId, mtp::ObjectProperty::ObjectSize);
-	return ObjectInfo(fromUtf8(oi.Filename), oi.ObjectFormat, size);
+	mtp::msg::ObjectInfo oi(_session->GetFullObjectInfo(objectId));
+	return ObjectInfo(fromUtf8(oi.Filename), oi.ObjectFormat, oi.ObjectSize);
 }
 
 QStringList MtpObjectsModel::extractMimeData(const QMimeData *data)
@@ -331,6 +766,8 @@ bool MtpObjectsModel::dropMimeData(const QMimeData *data,
 	qDebug() << "data: " << data << action << row << column;
 	if (action != Qt::CopyAction || !data)
 		return false;
+	if (dynamic_cast<const MtpMimeData *>(data))
+		return false; //dragged from this view, dropping it back would download and upload objects again
 
 	QStringList files = extractMimeData(data);
 	qDebug() << "files dropped: " << files;
@@ -343,8 +780,33 @@ QStringList MtpObjectsModel::mimeTypes () const
 
 Qt::ItemFlags MtpObjectsModel::flags(const QModelIndex &index) const
 {
-	Qt::ItemFlags defaultFlags = QAbstractListModel::flags(index);
-	return defaultFlags | Qt::ItemIsDropEnabled;
+	Qt::ItemFlags defaultFlags = QAbstractListModel::flags(index) | Qt::ItemIsDropEnabled;
+	int idx = index.row();
+	if (!index.isValid() || idx >= _rows.size())
+		return defaultFlags;
+
+	//directories are not dragged out, only what was listed is checked, flags are asked for often
+	const mtp::msg::ObjectInfoPtr &info = _rows[idx].PeekInfo();
+	bool association = info && (info->ObjectFormat == mtp::ObjectFormat::Association || info->ObjectFormat == mtp::ObjectFormat::AudioAlbum);
+	return association? defaultFlags: defaultFlags | Qt::ItemIsDragEnabled;
+}
+
+QMimeData * MtpObjectsModel::mimeData(const QModelIndexList &indexes) const
+{
+	QVector<mtp::ObjectId> objects;
+	QStringList names;
+	for(auto &index : indexes)
+	{
+		int idx = index.row();
+		if (!index.isValid() || idx >= _rows.size())
+			continue;
+		Row &row = _rows[idx];
+		if (row.IsAssociation(_session))
+			continue;
+		objects << row.ObjectId;
+		names << fromUtf8(row.GetInfo(_session)->Filename);
+	}
+	return objects.isEmpty()? nullptr: new MtpMimeData(const_cast<MtpObjectsModel *>(this), objects, names);
 }
 
 void MtpObjectsModel::enableThumbnail(bool enable, QSize maxSize)
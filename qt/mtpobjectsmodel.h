@@ -22,49 +22,125 @@
 
 #include <qabstractitemmodel.h>
 #include <mtp/ptp/Device.h>
+#include <mtp/ptp/AsyncSession.h>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QPixmap>
 #include <QSize>
+#include <QThread>
 #include <QVector>
 #include <QStringList>
+#include "mtpobjectsloader.h"
+#include "mtpthumbnailloader.h"
+#include <atomic>
+#include <future>
+#include <memory>
+#include <set>
 
 typedef QVector<mtp::ObjectId> MtpObjectList;
 
+class QtObjectInputStream;
+
+struct MtpPreparedUpload //! local part of upload, prepared ahead while previous object is being sent
+{
+	QString									FilePath;
+	qint64									Size;
+	std::shared_ptr<QtObjectInputStream>	Stream;
+	mtp::IObjectInputStreamPtr				Source; //reads Stream ahead from background thread
+	std::shared_future<mtp::ObjectFormat>	Format; //detected from background thread
+};
+typedef std::shared_ptr<MtpPreparedUpload> MtpPreparedUploadPtr;
+
 class MtpObjectsModel : public QAbstractListModel
 {
 	Q_OBJECT
 
 private:
 	mtp::SessionPtr		_session;
+	mtp::AsyncSessionPtr	_scheduler; //folder listings and transfer queue, listings go first
+	int					_eventSubscription;
 	mtp::StorageId		_storageId;
 	mtp::ObjectId		_parentObjectId;
 	bool				_enableThumbnails;
 	QSize				_maxThumbnailSize;
 
-	using ThumbnailPtr = std::shared_ptr<QPixmap>;
-
 	class Row
 	{
 		mtp::msg::ObjectInfoPtr					_info;
-		ThumbnailPtr							_thumbnail;
 
 	public:
 		mtp::ObjectId							ObjectId;
 
-		Row(mtp::ObjectId id = mtp::ObjectId()): ObjectId(id) { }
+		Row(mtp::ObjectId id = mtp::ObjectId(), const mtp::msg::ObjectInfoPtr &info = mtp::msg::ObjectInfoPtr()): _info(info), ObjectId(id) { }
 
 		void ResetInfo() { _info.reset(); }
+		void SetInfo(const mtp::msg::ObjectInfoPtr &info) { _info = info; }
+		bool HasInfo() const { return _info != nullptr; }
+		///returns cached info without fetching it
+		const mtp::msg::ObjectInfoPtr & PeekInfo() const { return _info; }
 		mtp::msg::ObjectInfoPtr GetInfo(mtp::SessionPtr session);
-		ThumbnailPtr GetThumbnail(mtp::SessionPtr session, QSize maxSize);
 		bool IsAssociation(mtp::SessionPtr);
 	};
 
-	mutable QVector<Row>		_rows;
+	mutable QVector<Row>		_rows; //model's thread only, loader results arrive as queued signals, info is filled lazily by data()
+	QHash<quint32, int>			_rowIndex; //object id -> row
+	mutable QHash<QString, mtp::ObjectId>	_nameIndex; //filename -> object id, rows with known info only, completed by name lookup
+
+	std::atomic<int>			_generation; //incremented when listing is reset
+	bool						_refreshing; //current listing is compared against existing rows
+	QSet<quint32>				_listed; //objects passed by refresh listing so far
+	QThread						_loaderThread;
+	MtpObjectsLoader *			_loader;
+
+	typedef QPair<quint32, quint32> ThumbnailKey; //object id, packed size
+	static ThumbnailKey thumbnailKey(mtp::ObjectId objectId, QSize size)
+	{ return ThumbnailKey(objectId.Id, (size.width() << 16) | size.height()); }
+
+	static const int			ThumbnailCacheSize = 64 * 1024 * 1024; //bytes
+	mutable QCache<ThumbnailKey, QPixmap>	_thumbnails; //lru, cost is pixmap size in bytes
+	QThread						_thumbnailThread;
+	MtpThumbnailLoader *		_thumbnailLoader;
+
+	QSize thumbnailSize() const
+	{ return QSize(_maxThumbnailSize.width(), _maxThumbnailSize.height() / 1.5f); }
+
+	static QVariant sortKey(const Row &row, int role);
+	static bool sameInfo(const mtp::msg::ObjectInfo &a, const mtp::msg::ObjectInfo &b);
+
+	void reset(mtp::ObjectId parentObjectId);
+	void load(int generation);
+	void finishRefresh(bool complete);
+	void appendRow(const Row &row);
+	void indexRow(int idx);
+	void reindexRows();
+	void removeObjectRows(const std::set<mtp::ObjectId> &objects);
+	void updateObjectRow(mtp::ObjectId objectId);
+
+private slots:
+	void onObjectsLoaded(int generation, MtpLoadedObjects objects);
+	void onLoadFinished(int generation, bool complete);
+	void onThumbnailLoaded(quint32 objectId, QSize size, QImage image);
+	void onDeviceEvent(int code, quint32 objectId);
 
 signals:
+	void loadObjects(int generation, quint32 storageId, quint32 parentId);
+	///emitted when background listing of current folder is complete
+	void objectsLoaded();
 	void filePositionChanged(qint64, qint64);
 	void onFilesDropped(QStringList);
 	bool existingFileOverwrite(QString);
 
 public:
+	///sort and filter keys, answered from prefetched metadata only, so sorting big folder does not issue a request per row
+	enum Role
+	{
+		NameRole = Qt::UserRole,
+		SizeRole,
+		DateRole,
+		TypeRole
+	};
+
 	struct ObjectInfo
 	{
 		QString				Filename;
@@ -83,11 +159,18 @@ public:
 	void setSession(mtp::SessionPtr session);
 	mtp::SessionPtr session() const
 	{ return _session; }
+	///runs metadata requests ahead of chunked bulk transfers, shared with transfer queue
+	mtp::AsyncSessionPtr scheduler() const
+	{ return _scheduler; }
 
 	void setStorageId(mtp::StorageId storageId);
+	mtp::StorageId storageId() const
+	{ return _storageId; }
+	///resets listing, folder is populated from background thread
+	///same folder is refreshed instead
 	void setParent(mtp::ObjectId parentObjectId);
-	void refresh()
-	{ setParent(_parentObjectId); }
+	///lists current folder again and applies only the difference, unchanged rows keep their info and thumbnails
+	void refresh();
 
 	bool enter(int idx);
 	mtp::ObjectId objectIdAt(int idx);
@@ -101,19 +184,27 @@ public:
 	mtp::ObjectId createDirectory(const QString &name, mtp::AssociationType type = mtp::AssociationType::GenericFolder)
 	{ return createDirectory(_parentObjectId, name, type); }
 
-	bool uploadFile(mtp::ObjectId parentObjectId, const QString &filePath, QString filename = QString());
+	///does local work for upload: opens file and starts reading it ahead, detects format, does not touch device; returns null if file could not be opened
+	static MtpPreparedUploadPtr prepareUpload(const QString &filePath);
+	bool uploadFile(mtp::ObjectId parentObjectId, const MtpPreparedUploadPtr &upload, QString filename = QString());
+	bool uploadFile(mtp::ObjectId parentObjectId, const QString &filePath, QString filename = QString())
+	{ return uploadFile(parentObjectId, prepareUpload(filePath), filename); }
 	bool uploadFile(const QString &filePath, QString filename = QString())
 	{ return uploadFile(_parentObjectId, filePath, filename); }
 	bool downloadFile(const QString &filePath, mtp::ObjectId objectId);
 	void rename(int idx, const QString &fileName);
 	ObjectInfo getInfoById(mtp::ObjectId objectId) const;
 	void deleteObjects(const MtpObjectList &objects);
+	///copies or moves objects into current directory, on device if it supports CopyObject/MoveObject
+	void copyObjects(const MtpObjectList &objects, bool move);
 
 	QStringList extractMimeData(const QMimeData *data);
 
 	virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
 	virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 	virtual Qt::ItemFlags flags(const QModelIndex &index) const;
+	///returns lazy mime data, dragged files are fetched when drop target asks for them
+	virtual QMimeData * mimeData(const QModelIndexList &indexes) const;
 
 protected:
 	virtual QStringList mimeTypes () const;
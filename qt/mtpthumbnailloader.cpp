@@ -0,0 +1,230 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include "mtpthumbnailloader.h"
+#include "utils.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegExp>
+#if QT_VERSION >= 0x050000
+#	include <QStandardPaths>
+#else
+#	include <QDesktopServices>
+#endif
+#include <cli/PosixStreams.h>
+#include <mtp/ThreadPool.h>
+#include <algorithm>
+
+namespace
+{
+	QString cacheRoot()
+	{
+#if QT_VERSION >= 0x050000
+		return QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+		return QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+	}
+}
+
+MtpThumbnailLoader::MtpThumbnailLoader(): _cacheSize(0), _decoding(0)
+{ connect(this, SIGNAL(wakeUp()), SLOT(process()), Qt::QueuedConnection); }
+
+MtpThumbnailLoader::~MtpThumbnailLoader()
+{
+	QMutexLocker l(&_mutex);
+	while(_decoding)
+		_decoded.wait(&_mutex);
+}
+
+void MtpThumbnailLoader::setSession(const mtp::SessionPtr &session)
+{
+	QString cacheDir;
+	if (session)
+	{
+		QString serial = fromUtf8(session->GetDeviceInfo().SerialNumber);
+		serial.replace(QRegExp("[^A-Za-z0-9_.-]"), "_");
+		QString root = cacheRoot();
+		if (!serial.isEmpty() && !root.isEmpty())
+			cacheDir = root + "/thumbnails/" + serial;
+	}
+
+	mtp::ThumbnailFetcherPtr fetcher = session? std::make_shared<mtp::ThumbnailFetcher>(session): nullptr;
+
+	QMutexLocker l(&_mutex);
+	_session = session;
+	_fetcher = fetcher;
+	_requests.clear();
+	_pending.clear();
+	_cacheDir = cacheDir;
+}
+
+QString MtpThumbnailLoader::cachePath(const Request &request) const
+{
+	return QString("%1/%2-%3x%4-%5.png").arg(request.CacheDir).arg(request.ObjectId.Id).
+		arg(request.Size.width()).arg(request.Size.height()).arg(request.ModificationDate);
+}
+
+bool MtpThumbnailLoader::loadCached(const Request &request, QImage &image)
+{
+	if (request.CacheDir.isEmpty() || request.ModificationDate.isEmpty())
+		return false;
+
+	QString path = cachePath(request);
+	if (!image.load(path, "PNG"))
+		return false;
+
+	//mtime is used as access time for eviction
+	try { cli::ObjectOutputStream::SetModificationTime(path.toStdString(), time(nullptr)); } catch(const std::exception &ex) { }
+	return true;
+}
+
+void MtpThumbnailLoader::storeCached(const Request &request, const QImage &image)
+{
+	if (request.CacheDir.isEmpty() || request.ModificationDate.isEmpty() || image.isNull())
+		return;
+
+	if (!QDir().mkpath(request.CacheDir))
+		return;
+
+	QString path = cachePath(request);
+	if (!image.save(path, "PNG"))
+	{
+		qDebug() << "failed to save thumbnail to " << path;
+		return;
+	}
+
+	QMutexLocker l(&_cacheMutex);
+	QDir dir(request.CacheDir);
+	if (_scannedDir != request.CacheDir)
+	{
+		_scannedDir = request.CacheDir;
+		_cacheSize = 0;
+		for(auto &fi : dir.entryInfoList(QDir::Files))
+			_cacheSize += fi.size();
+	}
+	else
+		_cacheSize += QFileInfo(path).size();
+	evict(dir);
+}
+
+void MtpThumbnailLoader::evict(const QDir &dir)
+{
+	if (_cacheSize <= MaxDiskCacheSize)
+		return;
+
+	//remove least recently used thumbnails until cache is at 3/4 of its limit
+	QFileInfoList files = dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+	for(auto &fi : files)
+	{
+		if (_cacheSize <= MaxDiskCacheSize * 3 / 4)
+			break;
+		if (QFile::remove(fi.filePath()))
+			_cacheSize -= fi.size();
+	}
+}
+
+void MtpThumbnailLoader::request(mtp::ObjectId objectId, mtp::ObjectFormat format, QSize size, const QString &modificationDate)
+{
+	{
+		QMutexLocker l(&_mutex);
+		if (_pending.count(objectId))
+		{
+			//requested again, row is visible, move it to the front
+			auto i = std::find_if(_requests.begin(), _requests.end(), [objectId](const Request &r) { return r.ObjectId == objectId; });
+			if (i != _requests.end())
+				_requests.erase(i);
+		}
+		_requests.push_front(Request(objectId, format, size, modificationDate, _cacheDir));
+		_pending.insert(objectId);
+
+		while(_requests.size() > MaxPendingRequests)
+		{
+			_pending.erase(_requests.back().ObjectId);
+			_requests.pop_back();
+		}
+	}
+	emit wakeUp();
+}
+
+void MtpThumbnailLoader::cancel()
+{
+	QMutexLocker l(&_mutex);
+	_requests.clear();
+	_pending.clear();
+}
+
+void MtpThumbnailLoader::process()
+{
+	while(true)
+	{
+		QMutexLocker l(&_mutex);
+		if (_requests.empty())
+			return;
+		mtp::ThumbnailFetcherPtr fetcher = _fetcher;
+		Request request = _requests.front();
+		_requests.pop_front();
+		l.unlock();
+
+		QImage image;
+		if (fetcher && !loadCached(request, image))
+		{
+			try
+			{
+				//next thumbnail is fetched while this one is decoded
+				auto data = std::make_shared<mtp::ByteArray>(fetcher->Get(request.ObjectId, request.Format));
+				l.relock();
+				++_decoding;
+				l.unlock();
+				mtp::ThreadPool::Get().Post([this, request, data]() { decode(request, *data); });
+				continue;
+			}
+			catch(const std::exception &ex)
+			{ qDebug() << "failed to get thumbnail " << fromUtf8(ex.what()); }
+		}
+		finish(request, image);
+	}
+}
+
+void MtpThumbnailLoader::decode(const Request &request, const mtp::ByteArray &data)
+{
+	QImage image;
+	if (image.loadFromData(data.data(), data.size()))
+	{
+		image = image.scaled(request.Size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+		storeCached(request, image);
+	}
+	else
+		qDebug() << "couldn't load thumbnail for " << request.ObjectId.Id;
+	finish(request, image);
+
+	QMutexLocker l(&_mutex);
+	if (--_decoding == 0)
+		_decoded.wakeAll();
+}
+
+void MtpThumbnailLoader::finish(const Request &request, const QImage &image)
+{
+	{
+		QMutexLocker l(&_mutex);
+		_pending.erase(request.ObjectId);
+	}
+	emit thumbnailLoaded(request.ObjectId.Id, request.Size, image); //null image if thumbnail is not available
+}
@@ -0,0 +1,99 @@
+/*
+    This file is part of Android File Transfer For Linux.
+    Copyright (C) 2015-2018  Vladimir Menshakov
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation,
+    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef MTPTHUMBNAILLOADER_H
+#define MTPTHUMBNAILLOADER_H
+
+#include <QObject>
+#include <QDir>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSize>
+#include <QString>
+#include <mtp/ptp/Session.h>
+#include <mtp/ptp/ThumbnailFetcher.h>
+#include <deque>
+#include <set>
+
+class MtpThumbnailLoader : public QObject //! fetches thumbnails in background thread, most recently requested first, decodes and scales them on shared thread pool
+{
+	Q_OBJECT
+
+public:
+	static const size_t MaxPendingRequests = 64; //roughly two screens of icons
+	static const qint64 MaxDiskCacheSize = 256 * 1024 * 1024;
+
+private:
+	struct Request
+	{
+		mtp::ObjectId		ObjectId;
+		mtp::ObjectFormat	Format;
+		QSize				Size;
+		QString				ModificationDate;
+		QString				CacheDir;
+
+		Request(mtp::ObjectId id, mtp::ObjectFormat format, QSize size, const QString &mtime, const QString &cacheDir):
+			ObjectId(id), Format(format), Size(size), ModificationDate(mtime), CacheDir(cacheDir) { }
+	};
+
+	QMutex					_mutex;
+	mtp::SessionPtr			_session;
+	mtp::ThumbnailFetcherPtr	_fetcher; //picks faster thumbnail source, replaced with session
+	std::deque<Request>		_requests; //newest at front
+	std::set<mtp::ObjectId>	_pending;
+
+	QString					_cacheDir; //scaled thumbnails of current device, empty if device has no serial
+
+	QMutex					_cacheMutex; //pool workers store thumbnails concurrently
+	QString					_scannedDir; //guarded by _cacheMutex
+	qint64					_cacheSize; //of _scannedDir
+
+	QWaitCondition			_decoded;
+	int						_decoding; //pool tasks still referring to this loader, guarded by _mutex
+
+	QString cachePath(const Request &request) const;
+	bool loadCached(const Request &request, QImage &image);
+	void storeCached(const Request &request, const QImage &image);
+	void evict(const QDir &dir);
+	void decode(const Request &request, const mtp::ByteArray &data);
+	void finish(const Request &request, const QImage &image);
+
+signals:
+	void wakeUp();
+	void thumbnailLoaded(quint32 objectId, QSize size, QImage image);
+
+private slots:
+	void process();
+
+public:
+	MtpThumbnailLoader();
+	///waits for thumbnails being decoded on thread pool
+	~MtpThumbnailLoader();
+
+	void setSession(const mtp::SessionPtr &session);
+
+	///thread-safe, queues request in front of older ones, requests which scrolled out of the queue are dropped
+	///modification date is a part of disk cache key, so changed objects get new thumbnails
+	///format tells if embedded exif thumbnail may be used instead of GetThumb
+	void request(mtp::ObjectId objectId, mtp::ObjectFormat format, QSize size, const QString &modificationDate);
+	///drops all queued requests, e.g. when folder changes
+	void cancel();
+};
+
+#endif // MTPTHUMBNAILLOADER_H
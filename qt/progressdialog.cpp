@@ -26,7 +26,7 @@
 
 ProgressDialog::ProgressDialog(QWidget *parent) :
 	QDialog(parent),
-	ui(new Ui::ProgressDialog), _progress(0), _duration(0)
+	ui(new Ui::ProgressDialog), _progress(0), _duration(0), _speed(-1), _eta(-1)
 {
 	ui->setupUi(this);
 	ui->progressBar->setMaximum(10000);
@@ -75,12 +75,18 @@ void ProgressDialog::setValue(float current)
 	if (_duration <= 0)
 		return;
 
-	float currentSpeed = current * 1000 / _duration;
-	if (currentSpeed <= 0)
-		return;
-
-	int estimate = 1000 / currentSpeed;
-	int duration = estimate - _duration;
+	int duration;
+	if (_eta >= 0)
+		duration = _eta; //smoothed by uploader, follows recent speed rather than average since start
+	else
+	{
+		float currentSpeed = current * 1000 / _duration;
+		if (currentSpeed <= 0)
+			return;
+
+		int estimate = 1000 / currentSpeed;
+		duration = estimate - _duration;
+	}
 	if (duration < 100)
 		duration = 100;
 	//qDebug() << current << currentSpeed << estimate;
@@ -91,16 +97,42 @@ void ProgressDialog::setValue(float current)
 }
 
 void ProgressDialog::setSpeed(qint64 speed)
+{
+	_speed = speed;
+	updateSpeedLabel();
+}
+
+void ProgressDialog::setEta(qint64 msecs)
+{
+	_eta = msecs;
+	updateSpeedLabel();
+}
+
+void ProgressDialog::updateSpeedLabel()
 {
 	static constexpr double Kb = 1000;
 	static constexpr double Mb = 1000 * Kb; //haha
 	static constexpr double Gb = 1000 * Mb;
-	if (speed < 2 * Mb)
-		ui->speedLabel->setText(tr("Speed: ") + QString().sprintf("%.1f", speed / Kb) + tr(" Kb/s"));
-	else if (speed < 2 * Gb)
-		ui->speedLabel->setText(tr("Speed: ") + QString().sprintf("%.1f", speed / Mb) + tr(" Mb/s"));
+	if (_speed < 0)
+		return;
+
+	QString text;
+	if (_speed < 2 * Mb)
+		text = tr("Speed: ") + QString().sprintf("%.1f", _speed / Kb) + tr(" Kb/s");
+	else if (_speed < 2 * Gb)
+		text = tr("Speed: ") + QString().sprintf("%.1f", _speed / Mb) + tr(" Mb/s");
 	else
-		ui->speedLabel->setText(tr("Speed: ") + QString().sprintf("%.1f", speed / Gb) + tr(" Gb/s"));
+		text = tr("Speed: ") + QString().sprintf("%.1f", _speed / Gb) + tr(" Gb/s");
+
+	if (_eta >= 0)
+	{
+		qint64 seconds = (_eta + 999) / 1000;
+		if (seconds >= 3600)
+			text += tr(", %1 left").arg(QString().sprintf("%d:%02d:%02d", int(seconds / 3600), int(seconds / 60 % 60), int(seconds % 60)));
+		else
+			text += tr(", %1 left").arg(QString().sprintf("%d:%02d", int(seconds / 60), int(seconds % 60)));
+	}
+	ui->speedLabel->setText(text);
 }
 
 void ProgressDialog::setFilename(const QString &filename)
@@ -47,6 +47,7 @@ signals:
 
 public slots:
 	void setSpeed(qint64 speed);
+	void setEta(qint64 msecs);
 	void setFilename(const QString &filename);
 	void setValue(float current);
 	virtual void reject();
@@ -56,12 +57,15 @@ private slots:
 
 private:
 	void closeEvent(QCloseEvent *event);
+	void updateSpeedLabel();
 
 private:
 	Ui::ProgressDialog *ui;
 	QPropertyAnimation *_animation;
 	float				_progress;
 	int					_duration;
+	qint64				_speed;
+	qint64				_eta;
 };
 
 #endif // PROGRESSDIALOG_H
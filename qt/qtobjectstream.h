@@ -23,6 +23,8 @@
 #include <QObject>
 #include <QFile>
 #include <mtp/ptp/IObjectStream.h>
+#include <mtp/ptp/ProgressThrottle.h>
+#include <cli/PosixStreams.h>
 
 class QtObjectInputStream : public QObject, public mtp::IObjectInputStream, public mtp::CancellableStream
 {
@@ -32,13 +34,14 @@ signals:
 	void positionChanged(qint64, qint64);
 
 private:
-	QFile		_file;
-	qint64		_size;
-	int			_progress;
+	QFile					_file;
+	qint64					_size;
+	mtp::ProgressThrottle	_progress;
 
 public:
-	QtObjectInputStream(const QString &file) : _file(file), _size(_file.size()), _progress(-1) {
-		_file.open(QFile::ReadOnly);
+	QtObjectInputStream(const QString &file) : _file(file), _size(_file.size()) {
+		if (_file.open(QFile::ReadOnly))
+			cli::ObjectInputStream::AdviseSequential(_file.handle());
 	}
 
 	bool Valid() const
@@ -47,6 +50,10 @@ public:
 	virtual mtp::u64 GetSize() const
 	{ return _size; }
 
+	///positions stream at offset of resumed upload
+	bool seek(qint64 offset)
+	{ return _file.seek(offset); }
+
 	virtual size_t Read(mtp::u8 *data, size_t size)
 	{
 		CheckCancelled();
@@ -54,12 +61,8 @@ public:
 		if (r < 0)
 			throw std::runtime_error(_file.errorString().toStdString());
 
-		int progress = _size > 0? _file.pos() * 1000L / _size: 0;
-		if (progress != _progress) //throttle events a bit
-		{
-			_progress = progress;
+		if (_progress.Update(_file.pos(), _size)) //every signal crosses threads, throttle them
 			emit positionChanged(_file.pos(), _size);
-		}
 		return r;
 	}
 };
@@ -72,23 +75,44 @@ signals:
 	void positionChanged(qint64, qint64);
 
 private:
-	QFile		_file;
-	qint64		_size;
+	QFile					_file;
+	qint64					_size;
+	qint64					_preallocated;
+	mtp::ProgressThrottle	_progress;
 
 public:
-	QtObjectOutputStream(const QString &file): _file(file)
-	{ _file.open(QFile::WriteOnly | QFile::Truncate); }
+	///append continues partial file left by interrupted download
+	QtObjectOutputStream(const QString &file, bool append = false): _file(file), _size(0), _preallocated(0)
+	{ _file.open(append? QFile::WriteOnly | QFile::Append: QFile::WriteOnly | QFile::Truncate); }
+
+	~QtObjectOutputStream()
+	{
+		if (_file.isOpen() && _file.pos() < _preallocated)
+			_file.resize(_file.pos());
+	}
 
 	bool Valid() const
 	{ return _file.isOpen(); }
 
+	///sets total object size reported with positionChanged
+	void setSize(qint64 size)
+	{ _size = size; }
+
+	///reserves disk space for object of known size
+	void preallocate(qint64 size)
+	{
+		if (cli::ObjectOutputStream::Preallocate(_file.handle(), size))
+			_preallocated = size;
+	}
+
 	virtual size_t Write(const mtp::u8 *data, size_t size)
 	{
 		CheckCancelled();
 		qint64 r = _file.write(static_cast<const char *>(static_cast<const void *>(data)), size);
 		if (r < 0)
 			throw std::runtime_error(_file.errorString().toStdString());
-		emit positionChanged(_file.pos(), _size);
+		if (_progress.Update(_file.pos(), _size))
+			emit positionChanged(_file.pos(), _size);
 		return r;
 	}
 };